@@ -0,0 +1,68 @@
+/** @file arena.h Documented header file for the contiguous storage of SONG's jagged arrays */
+
+#ifndef __ARENA__
+#define __ARENA__
+
+#include "common.h"
+
+/**
+ * Contiguous block of memory holding all the values of a jagged array.
+ *
+ * Most of the large arrays in SONG, like ptr2->transfer or the intrinsic bispectrum
+ * integrals, are triangular in (k1,k2) and have a last level whose size depends on
+ * the previous ones. Rather than allocating each last-level row separately, we
+ * first compute the total number of values, allocate them in a single block with
+ * arena_init(), and then point the rows of the array inside the block with
+ * arena_take() or arena_take_row(). The array can still be accessed through the
+ * usual pointer levels, but its values are contiguous in memory and are freed with
+ * a single call to arena_free().
+ */
+struct arena {
+
+  double * data;   /**< Block of memory with all the values, initialised to zero */
+  long int size;   /**< Number of doubles in the block */
+  long int used;   /**< Number of doubles already assigned to rows via arena_take() */
+
+};
+
+
+/**************************************************************/
+
+/*
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  int arena_init(
+      struct arena * pa,
+      long int size,
+      ErrorMsg error_message
+      );
+
+  int arena_take(
+      struct arena * pa,
+      long int n,
+      double ** row,
+      ErrorMsg error_message
+      );
+
+  int arena_take_row(
+      struct arena * pa,
+      int n_rows,
+      int * row_size,
+      long int stride,
+      double ** rows,
+      ErrorMsg error_message
+      );
+
+  int arena_free(
+      struct arena * pa
+      );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,6 +16,87 @@ enum projection_function_types {
 };
 
 
+/**
+ * Number of points of pbs2->xx in each segment of the adaptive grid for J_Llm(x);
+ * see bessel2_adapt_J(). Must be a power of two.
+ */
+#define _BESSEL2_SEGMENT_SHIFT_ 6
+#define _BESSEL2_SEGMENT_SIZE_ (1<<_BESSEL2_SEGMENT_SHIFT_)
+
+/**
+ * Segment of the adaptive grid for J_Llm(x); see bessel2_adapt_J().
+ */
+struct bessel2_segment {
+  int offset;                   /**< Position of the first node of the segment in pbs2->J_Llm_x */
+  int stride;                   /**< Distance between the nodes of the segment, in units of pbs2->xx_step */
+};
+
+
+/**
+ * Unit of work for the parallel construction of the projection functions in
+ * bessel2_init(): J_Llm(x) for a given (J,L,l,m) is computed, and then splined,
+ * resampled or converted to single precision, by a single thread. See
+ * bessel2_J_queue() for details.
+ */
+struct bessel2_J_task {
+  int index_J;                  /**< Type of projection function */
+  int index_L;                  /**< Index of L in pbs2->L */
+  int index_l;                  /**< Index of l in pbs->l */
+  int index_m;                  /**< Index of m in pbs2->m */
+  double cost;                  /**< Estimated cost, the number of terms in the sum over l1 times the number of x values */
+};
+
+/**
+ * Memory counters kept by each thread during the parallel loops in bessel2_init(),
+ * so that the threads do not update the shared counters in the bessels2 structure.
+ * They are added to the latter at the end of each loop by bessel2_add_counters().
+ */
+struct bessel2_counters {
+  long int allocated_Js;        /**< Change in the number of doubles allocated for j_l1(x) and J_Llm(x) */
+  long int adaptive_Js;         /**< Number of doubles stored in the adaptive grids */
+  long int compact_Js;          /**< Number of floats stored in single precision */
+  long int released_Js;         /**< Number of doubles given back to the system by the single-precision storage */
+  double compact_max_error;     /**< Largest relative error introduced by the single-precision storage */
+};
+
+
+/**
+ * Header of the cache file for the projection functions; see bessel2_cache_load().
+ */
+struct bessel2_cache_header {
+  char magic[8];                /**< Always "SONGJLM" */
+  unsigned long long key;       /**< Hash of the sampling parameters, see bessel2_cache_key() */
+  int J_size;                   /**< Number of projection function types */
+  int L_size;                   /**< Number of L values */
+  int l_size;                   /**< Number of l values */
+  int xx_size;                  /**< Number of points in pbs2->xx */
+  int interpolation;            /**< Value of ppr->bessels_interpolation */
+  long int n_configs;           /**< Number of (J,L,l,m) configurations */
+  long int size;                /**< Size of the file in bytes */
+};
+
+/**
+ * Index entry of the cache file for a (J,L,l,m) configuration.
+ */
+struct bessel2_cache_entry {
+  long int offset;              /**< Position of J_Llm(x) in the data section, in doubles; for cubic
+                                interpolation, its second derivative follows */
+  int index_xmin;               /**< Value of pbs2->index_xmin_J */
+  int x_size;                   /**< Value of pbs2->x_size_J */
+  double x_min;                 /**< Value of pbs2->x_min_J */
+};
+
+/**
+ * Projection functions kept in memory between runs of bessel2_init() in the same
+ * process; see pbs2->kept_J.
+ */
+struct bessel2_J_image {
+  void * data;                  /**< Image of the cache file in memory, in the format described in
+                                bessel2_cache_load(); NULL if no projection functions were kept yet */
+  long int size;                /**< Size of the image in bytes */
+};
+
+
 /**
  * Structure containing the projection functions needed for the line of
  * sight integration at second order.
@@ -90,6 +171,68 @@ struct bessels2 {
     
   double ***** ddJ_Llm_x;   /**< Same indexing as J_Llm_x, used for spline interpolation */
 
+  short has_compact_J;      /**< If _TRUE_, the projection functions are stored in single precision in
+                            pbs2->J_Llm_x_float and pbs2->ddJ_Llm_x_float, and the leaves of pbs2->J_Llm_x
+                            and pbs2->ddJ_Llm_x are NULL. Set from ppr2->compact_projection_functions. */
+
+  float ***** J_Llm_x_float;    /**< Same as J_Llm_x, in single precision; used only if pbs2->has_compact_J==_TRUE_ */
+
+  float ***** ddJ_Llm_x_float;  /**< Same as ddJ_Llm_x, in single precision; used only if pbs2->has_compact_J==_TRUE_ */
+
+  long int count_compact_Js;    /**< Number of floats stored in the single-precision projection function arrays */
+
+  long int count_released_Js;   /**< Number of doubles freed, or unmapped with the cache, after their conversion to
+                                single precision; see bessel2_compact_J() */
+
+  double compact_J_max_error;   /**< Largest relative error on the projection functions introduced by the
+                                single-precision storage; see bessel2_compact_J() */
+
+  short has_adaptive_J;         /**< If _TRUE_, each J_Llm(x) is stored on its own piecewise uniform grid,
+                                described by pbs2->J_segments; see bessel2_adapt_J(). Set from
+                                ppr2->bessel_J_adaptive_tol_song. */
+
+  struct bessel2_segment ***** J_segments;  /**< J_segments[index_J][index_L][index_l][index_m][index_segment]
+                                            describes the sampling of J_Llm(x) on the points of pbs2->xx between
+                                            index_xmin_J + index_segment*_BESSEL2_SEGMENT_SIZE_ and the beginning of
+                                            the next segment; used only if pbs2->has_adaptive_J==_TRUE_ */
+
+  double J_adaptive_tol;        /**< Tolerance for the adaptive grid, relative to max|J_Llm(x)| */
+
+  long int count_adaptive_Js;   /**< Number of doubles stored in the adaptive grids */
+
+  short has_J_cache;            /**< Should we read and write the projection functions from the cache directory
+                                ppr2->projection_functions_cache_dir? See bessel2_cache_load(). */
+
+  char J_cache_path[_FILENAMESIZE_];  /**< Path of the cache file for the current sampling */
+
+  void * J_cache_map;           /**< Memory-mapped cache file; if not NULL, the leaves of pbs2->J_Llm_x and
+                                pbs2->ddJ_Llm_x point inside it and must not be freed */
+
+  long int J_cache_map_size;    /**< Size in bytes of pbs2->J_cache_map */
+
+  struct bessel2_J_image * kept_J; /**< If not NULL, the projection functions are taken from this image when it
+                                   matches the current run, and are otherwise copied there once computed; the
+                                   image is owned by the caller. Used by song_compute() to compute them only
+                                   once for many models. */
+
+  short J_cache_map_is_kept;    /**< If _TRUE_, pbs2->J_cache_map is the image in pbs2->kept_J rather than a
+                                mapped file, and must not be unmapped */
+
+  int J_replica_size;           /**< Number of NUMA domains with their own copy of the projection functions, or
+                                zero if they are not replicated; see bessel2_replicate_J() */
+
+  double ****** J_Llm_x_replica;    /**< J_Llm_x_replica[domain] has the same indexing as pbs2->J_Llm_x, and its
+                                    leaves are placed in the memory of the given NUMA domain. The replica of the
+                                    first domain is pbs2->J_Llm_x itself. */
+
+  double ****** ddJ_Llm_x_replica;  /**< Same as J_Llm_x_replica, for pbs2->ddJ_Llm_x */
+
+  float ****** J_Llm_x_float_replica;    /**< Same as J_Llm_x_replica, for pbs2->J_Llm_x_float */
+
+  float ****** ddJ_Llm_x_float_replica;  /**< Same as J_Llm_x_replica, for pbs2->ddJ_Llm_x_float */
+
+  long int count_replicated_Js; /**< Number of values stored in the replicas, excluding the first one */
+
   short * has_allocated_J;  /**< was the memory for the index_J projection functions allocated? */
                                                                   
   /* Sampling of j_l1 */
@@ -198,7 +341,132 @@ extern "C" {
        int index_J,
        int index_L,
        int index_l,
-       int index_m
+       int index_m,
+       struct bessel2_counters * pbc
+       );
+
+  int bessel2_J_queue (
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2,
+       int * task_size,
+       struct bessel2_J_task ** tasks
+       );
+
+  int bessel2_compare_J_tasks (
+       const void * a,
+       const void * b
+       );
+
+  int bessel2_J_leaf_size (
+       struct precision * ppr,
+       struct bessels2 * pbs2,
+       int index_J,
+       int index_L,
+       int index_l,
+       int index_m,
+       int * J_size,
+       int * ddJ_size
+       );
+
+  int bessel2_replicate_J (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2,
+       int task_size,
+       struct bessel2_J_task * tasks
+       );
+
+  int bessel2_free_J_replicas (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2
+       );
+
+  int bessel2_add_counters (
+       struct bessels2 * pbs2,
+       int counter_size,
+       struct bessel2_counters * counters
+       );
+
+  int bessel2_cache_key (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2,
+       unsigned long long * key
+       );
+
+  int bessel2_cache_load (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2,
+       short * found
+       );
+
+  int bessel2_cache_store (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2
+       );
+
+  int bessel2_cache_index (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2,
+       struct bessel2_cache_header * header,
+       struct bessel2_cache_entry ** entries
+       );
+
+  int bessel2_cache_attach (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2,
+       void * image,
+       long int image_size,
+       short * found
+       );
+
+  int bessel2_cache_keep (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2
+       );
+
+  int bessel2_cache_release (
+       struct bessels2 * pbs2
+       );
+
+  int bessel2_adapt_J (
+       struct precision * ppr,
+       struct bessels2 * pbs2,
+       int index_J,
+       int index_L,
+       int index_l,
+       int index_m,
+       struct bessel2_counters * pbc
+       );
+
+  short bessel2_is_in_cache (
+       struct bessels2 * pbs2,
+       double * data
+       );
+
+  int bessel2_compact_J (
+       struct precision * ppr,
+       struct bessels2 * pbs2,
+       int index_J,
+       int index_L,
+       int index_l,
+       int index_m,
+       struct bessel2_counters * pbc
        );
 
   int bessel2_J_Llm(
@@ -233,7 +501,8 @@ extern "C" {
          struct precision2 * ppr2,
          struct bessels * pbs,
          struct bessels2 * pbs2,
-         int index_l1
+         int index_l1,
+         struct bessel2_counters * pbc
          );
 
   int bessel2_get_xx_list(
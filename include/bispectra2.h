@@ -9,6 +9,65 @@
 #include "transfer2.h"
 
 
+/**
+ * Header of the cache file for the geometrical factors of the intrinsic bispectrum;
+ * see bispectra2_geometrical_table_load().
+ */
+struct bispectra2_geometry_header {
+  char magic[8];                /**< Always "SONGGEO" */
+  unsigned long long key;       /**< Hash of the multipole sampling and of (M3,offset_L3,offset_L1),
+                                see bispectra2_geometrical_table_path() */
+  long int size;                /**< Number of geometrical factors in the file */
+};
+
+
+/**
+ * Geometrical factors of the intrinsic bispectrum kept in memory between runs in
+ * the same process; see ppr2->kept_geometrical_factors.
+ */
+struct bispectra2_kept_geometry {
+  int table_size;               /**< Number of tables kept */
+  unsigned long long * keys;    /**< keys[index_table] is the key of the table, see bispectra2_geometrical_table_path() */
+  long int * sizes;             /**< sizes[index_table] is the number of geometrical factors in the table */
+  double ** tables;             /**< tables[index_table] contains the geometrical factors, in the same order as
+                                pwb->geometrical_table */
+};
+
+
+/**
+ * Unit of work for the parallel loops over the multipoles of the intrinsic bispectrum.
+ *
+ * All the l1 values associated to a (l3,l2) pair are computed by the same thread,
+ * so that the pair is the smallest amount of work that is distributed between
+ * the threads. See bispectra2_l3l2_queue() for details.
+ */
+struct bispectra2_l3l2_pair {
+
+  int index_l3;   /**< Index of l3 in pbi->l */
+  int index_l2;   /**< Index of l2 in pbi->l */
+  double cost;    /**< Estimated cost of the pair, that is the number of l1 values allowed by the triangular condition */
+
+};
+
+
+/**
+ * Unit of work for the k3 integration when the second-order transfer functions are
+ * streamed from the transfer2 module one k1 level at a time.
+ *
+ * Each slab is a (X,M3,L3) combination, and each entry of the list refers to one of
+ * its l3 values. See bispectra2_intrinsic_stream_over_k3() for details.
+ */
+struct bispectra2_k3_slab {
+
+  int index_slab;   /**< Index of the slab in pwb->streamed_integral_over_k3 */
+  int index_tt2_k3; /**< Index of the second-order transfer function type of the k3 field */
+  int index_M3;     /**< Index of m3 in ppr2->m */
+  int index_l3;     /**< Index of l3 in pbi->l */
+  int index_L3;     /**< Index of L3=l3+offset_L3 in pbs2->l1 */
+
+};
+
+
 /**
  * Workspace that contains the intermediate results for the integration of an intrinsic
  * bispectrum.
@@ -44,6 +103,22 @@ struct bispectra_workspace_intrinsic {
   pwb->k_window[index_k] where 'index_k' indexes ptr->k. Its size is ptr->q_size. */
   double * k_window_inverse;
 
+  /* Coefficients for the interpolation of a function sampled in pwb->k_smooth_grid in the points
+  of ptr->q, which do not depend on the interpolated function; see bispectra2_interpolate_smooth_k().
+  For each point index_k_tr, k_interp_index[index_k_tr] is the index of the node on its left,
+  k_interp_a and k_interp_b are the linear weights a=1-b and b, k_interp_a3 and k_interp_b3 are
+  a^3-a and b^3-b, and k_interp_h is the distance between the two nodes. */
+  int * k_interp_index;
+  double * k_interp_a;
+  double * k_interp_b;
+  double * k_interp_a3;
+  double * k_interp_b3;
+  double * k_interp_h;
+
+  /* Copy of ppr2->scalar_bispectrum_kernels: if _TRUE_, the above coefficients and pwb->r_weight
+  are ignored, and the interpolation nodes are found on the fly as in the original scalar loops */
+  short scalar_kernels;
+
   /* Grid in the integration variable 'r'.  This is the parameter that stems from the Rayleigh expansion 
   of the Dirac Delta \delta(\vec{k1}+\vec{k2}+\vec{k3}) */
   double r_min;
@@ -60,6 +135,16 @@ struct bispectra_workspace_intrinsic {
 
     The array is indexed as pbi->integral_over_k3[index_l3][index_r][index_k1][index_k2]  */
   double **** integral_over_k3;
+  struct arena integral_over_k3_arena; /* Contiguous storage for the values of integral_over_k3 */
+
+  /* When ppr2->stream_transfers is turned on, the k3 integrals for all the (X,M3,L3) slabs are
+  accumulated while the transfer functions are computed one k1 level at a time. The array is
+  indexed as streamed_integral_over_k3[index_slab][index_l3][index_r][index_k1][index_k2], with
+  index_slab = (X*m_size + index_M3)*streamed_L3_size + offset_L3; each slab has its own arena. */
+  double ***** streamed_integral_over_k3;
+  struct arena * streamed_integral_over_k3_arena;
+  int streamed_L3_size; /* Number of offset_L3 values in each slab, that is 2*max(|m|)+1 */
+  int streamed_slab_size; /* Total number of slabs, bf_size*m_size*streamed_L3_size */
                            
   /* Integration grid in k3 for a given k1 and k3, one for each thread: k3_grid[thread][index_k3] */
   double ** k3_grid;
@@ -100,6 +185,7 @@ struct bispectra_workspace_intrinsic {
 
     The array is indexed as pbi->integral_over_r[index_l1][index_l2][index_l3-index_l_triangular_min] */
   double *** integral_over_r;
+  struct arena integral_over_r_arena; /* Contiguous storage for the values of integral_over_r */
 
 
   /* Array to contain the unsymmetrised bispectrum. This is basically the integral over r times messy
@@ -110,6 +196,34 @@ struct bispectra_workspace_intrinsic {
   that is, the second-order transfer function always corresponds to the first field and to the
   the first multipole index of the unsymmetrised bispectrum array. */
   double ****** unsymmetrised_bispectrum;
+
+
+  /* Tables of geometrical factors (four 3j's and a 6j) multiplying the integral over r, computed
+  by bispectra2_intrinsic_geometrical_table(). They are indexed as
+  geometrical_table[index_parity][index_M3][offset_L3][offset_L1][index_l3_l2_l1], where index_parity
+  is 0 for even bispectra and 1 for odd ones, and index_l3_l2_l1 = triangle_start[index_l3][index_l2]
+  + index_l1-index_l_triangular_min. A NULL table has not been computed yet. */
+  double ***** geometrical_table;
+  long int ** triangle_start;
+  long int triangle_size;
+
+
+  /* Configurations for which the bispectrum was requested, as set by ppr2->bispectrum_triangles;
+  see bispectra2_needed_triangle(). The triangle mask is indexed as the geometrical tables,
+  triangle_mask[triangle_start[index_l3][index_l2] + index_l1-index_l_triangular_min], the
+  number of requested l1 values for a given (l3,l2) is l3l2_triangle_count[index_l3][index_l2],
+  l3_mask[index_l3] is _TRUE_ if at least one requested configuration involves l3, and
+  requested_triangle_size is the number of requested configurations. */
+  short * triangle_mask;
+  int ** l3l2_triangle_count;
+  short * l3_mask;
+  long int requested_triangle_size;
+
+
+  /* Queue of (l3,l2) pairs shared between the threads in the loops over the multipoles, sorted
+  by decreasing cost; see bispectra2_l3l2_queue() */
+  struct bispectra2_l3l2_pair * l3l2_pairs;
+  int l3l2_pair_size;
   
 
   /* Array that contains the interpolated values of the above integrals in ptr->k. Each thread has one.
@@ -125,6 +239,9 @@ struct bispectra_workspace_intrinsic {
   the function 'bispectra_smooth_integration_over_r' */
   double * delta_r;
 
+  /* Weights r^2*delta_r of the trapezoidal rule for the integral over r, without the factor 1/2 */
+  double * r_weight;
+
   
   /* Keep track of the summations over M3,L3,L1 */
   int M3;
@@ -254,7 +371,70 @@ int bispectra2_indices (
       struct bispectra_workspace_intrinsic * pwb
       );
 
+  int bispectra2_needed_triangle(
+      struct precision2 * ppr2,
+      struct bispectra * pbi,
+      int index_l1,
+      int index_l2,
+      int index_l3,
+      short * needed
+      );
+
+  int bispectra2_l3l2_queue(
+      struct bispectra * pbi,
+      int ** l3l2_triangle_count,
+      int * pair_size,
+      struct bispectra2_l3l2_pair ** pairs
+      );
+
+  int bispectra2_compare_l3l2_pairs(
+      const void * a,
+      const void * b
+      );
+
   
+  int bispectra2_intrinsic_integrate_over_k3_for_l3(
+      struct precision * ppr,
+      struct precision2 * ppr2,
+      struct perturbs * ppt,
+      struct perturbs2 * ppt2,
+      struct bessels * pbs,
+      struct bessels2 * pbs2,
+      struct transfers * ptr,
+      struct transfers2 * ptr2,
+      struct primordial * ppm,
+      struct bispectra * pbi,
+      int index_tt2_k3,
+      int index_M3,
+      int index_l3,
+      int index_L3,
+      double *** integral_over_k3, /* out */
+      double * average_k3_grid_size, /* out */
+      struct bispectra_workspace_intrinsic * pwb
+      );
+
+  int bispectra2_intrinsic_integrate_over_k3_for_k1k2(
+      struct precision * ppr,
+      struct precision2 * ppr2,
+      struct perturbs2 * ppt2,
+      struct bessels * pbs,
+      struct bessels2 * pbs2,
+      struct transfers2 * ptr2,
+      struct primordial * ppm,
+      struct bispectra * pbi,
+      int index_tt2_k3,
+      int index_M3,
+      int index_l3,
+      int index_L3,
+      int index_k1,
+      int index_k2,
+      double * k3_grid,
+      double * delta_k3,
+      double *** integral_over_k3, /* out */
+      int * k3_size, /* out */
+      struct bispectra_workspace_intrinsic * pwb
+      );
+
   int bispectra2_intrinsic_integrate_over_k3(
       struct precision * ppr,
       struct precision2 * ppr2,
@@ -272,6 +452,59 @@ int bispectra2_indices (
       struct bispectra_workspace_intrinsic * pwb
       );
 
+  int bispectra2_intrinsic_allocate_k3_integral(
+      struct bispectra * pbi,
+      struct bispectra_workspace_intrinsic * pwb,
+      int abs_M3,
+      struct arena * pa, /* out */
+      double ***** integral_over_k3 /* out */
+      );
+
+  int bispectra2_intrinsic_free_k3_integral(
+      double **** integral_over_k3,
+      struct arena * pa
+      );
+
+  int bispectra2_intrinsic_stream_over_k3(
+      struct precision * ppr,
+      struct precision2 * ppr2,
+      struct perturbs * ppt,
+      struct perturbs2 * ppt2,
+      struct bessels * pbs,
+      struct bessels2 * pbs2,
+      struct transfers * ptr,
+      struct transfers2 * ptr2,
+      struct primordial * ppm,
+      struct bispectra * pbi,
+      struct bispectra_workspace_intrinsic * pwb
+      );
+
+  int bispectra2_intrinsic_integrate_over_k3_for_k1(
+      struct precision * ppr,
+      struct precision2 * ppr2,
+      struct perturbs2 * ppt2,
+      struct bessels * pbs,
+      struct bessels2 * pbs2,
+      struct transfers2 * ptr2,
+      struct primordial * ppm,
+      struct bispectra * pbi,
+      int index_k1,
+      int slab_l3_size,
+      struct bispectra2_k3_slab * slabs,
+      double * average_k3_grid_size, /* out */
+      struct bispectra_workspace_intrinsic * pwb
+      );
+
+  int bispectra2_interpolate_smooth_k(
+      struct transfers * ptr,
+      struct bispectra * pbi,
+      short cubic,
+      double * f,
+      double * splines,
+      double * interpolated,
+      struct bispectra_workspace_intrinsic * pwb
+      );
+
   int bispectra2_interpolate_over_k2(
       struct precision * ppr,
       struct precision2 * ppr2,
@@ -286,6 +519,7 @@ int bispectra2_indices (
       int index_r,
       int index_k1,
       int index_l3,
+      double ** integral_over_k3,
       double * integral_splines,
       double * interpolated_integral,
       double * f,
@@ -321,6 +555,7 @@ int bispectra2_indices (
       int index_r,
       int index_l3,
       int index_l2,
+      double * integral_over_k2,
       double * integral_splines,
       double * interpolated_integral,
       double * f,
@@ -358,6 +593,95 @@ int bispectra2_indices (
       struct bispectra_workspace_intrinsic * pwb
       );
 
+  int bispectra2_intrinsic_integrate_tiled(
+      struct precision * ppr,
+      struct precision2 * ppr2,
+      struct perturbs * ppt,
+      struct perturbs2 * ppt2,
+      struct bessels * pbs,
+      struct bessels2 * pbs2,
+      struct transfers * ptr,
+      struct transfers2 * ptr2,
+      struct primordial * ppm,
+      struct bispectra * pbi,
+      int index_bt,
+      int index_tt2_k3,
+      int index_M3,
+      int offset_L3,
+      struct bispectra_workspace_intrinsic * pwb
+      );
+
+  int bispectra2_intrinsic_geometrical_table(
+      struct precision * ppr,
+      struct precision2 * ppr2,
+      struct perturbs * ppt,
+      struct perturbs2 * ppt2,
+      struct bessels * pbs,
+      struct bessels2 * pbs2,
+      struct transfers * ptr,
+      struct transfers2 * ptr2,
+      struct primordial * ppm,
+      struct bispectra * pbi,
+      int index_M3,
+      int offset_L3,
+      int offset_L1,
+      double * table, /* out */
+      struct bispectra_workspace_intrinsic * pwb
+      );
+
+  int bispectra2_geometrical_table_path(
+      struct precision2 * ppr2,
+      struct bispectra * pbi,
+      int index_M3,
+      int offset_L3,
+      int offset_L1,
+      char * path, /* out */
+      unsigned long long * key, /* out */
+      struct bispectra_workspace_intrinsic * pwb
+      );
+
+  int bispectra2_geometrical_table_load(
+      struct precision2 * ppr2,
+      struct bispectra * pbi,
+      int index_M3,
+      int offset_L3,
+      int offset_L1,
+      double * table, /* out */
+      short * found, /* out */
+      struct bispectra_workspace_intrinsic * pwb
+      );
+
+  int bispectra2_geometrical_table_store(
+      struct precision2 * ppr2,
+      struct bispectra * pbi,
+      int index_M3,
+      int offset_L3,
+      int offset_L1,
+      double * table,
+      struct bispectra_workspace_intrinsic * pwb
+      );
+
+  int bispectra2_geometrical_table_recall(
+      struct precision2 * ppr2,
+      struct bispectra * pbi,
+      int index_M3,
+      int offset_L3,
+      int offset_L1,
+      double * table, /* out */
+      short * found, /* out */
+      struct bispectra_workspace_intrinsic * pwb
+      );
+
+  int bispectra2_geometrical_table_keep(
+      struct precision2 * ppr2,
+      struct bispectra * pbi,
+      int index_M3,
+      int offset_L3,
+      int offset_L1,
+      double * table,
+      struct bispectra_workspace_intrinsic * pwb
+      );
+
   int bispectra2_intrinsic_geometrical_factors(
       struct precision * ppr,
       struct precision2 * ppr2,
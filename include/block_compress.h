@@ -0,0 +1,105 @@
+/** @file block_compress.h Documented header file for the compression of the arrays stored to disk by SONG */
+
+#ifndef __BLOCK_COMPRESS__
+#define __BLOCK_COMPRESS__
+
+#include "common.h"
+
+#define _BLOCK_MAGIC_ 0x314b4c42474e4f53ULL  /**< First 8 bytes of a compressed block, "SONGBLK1" in ASCII */
+
+/**
+ * Compression of the blocks of doubles stored to disk, chosen by the user with
+ * the disk_compression parameter.
+ */
+enum block_compression {
+  block_compression_none,      /**< Store the doubles as they are, without a block header */
+  block_compression_lossless,  /**< Store the exact doubles, dropping the bits that can be predicted from the previous ones */
+  block_compression_lossy      /**< Round the doubles to a fraction ppr2->disk_compression_tolerance of the
+                               largest absolute value in the block */
+};
+
+
+/**
+ * Encoding of the payload of a compressed block. The encoding is chosen block by
+ * block by block_compress(), depending on the requested compression and on the
+ * content of the block.
+ */
+enum block_codecs {
+  block_codec_raw,        /**< The doubles as they are; used when the other codecs would not save space */
+  block_codec_zero,       /**< All the doubles are zero and there is no payload */
+  block_codec_predicted,  /**< Lossless: the bits of each double, as an ordered integer, minus their linear
+                          extrapolation from the two previous doubles; the residuals are stored as zigzag varints */
+  block_codec_quantised   /**< Lossy: each double rounded to a multiple of header.step; the differences
+                          between consecutive multiples are stored as zigzag varints */
+};
+
+
+/**
+ * Header of a compressed block of doubles.
+ *
+ * A compressed block is made of this header followed by header.payload_size bytes
+ * of payload. Each block can be decoded on its own, so that a file made of several
+ * blocks can be read only in part, and its blocks decoded by different threads.
+ *
+ * The varints store an unsigned 64-bit integer in groups of 7 bits, starting from
+ * the least significant ones, with the high bit of each byte set if more bytes
+ * follow; the zigzag encoding maps signed integers to unsigned ones by interleaving
+ * the positive and negative values. Since the SONG arrays are smooth, the residuals
+ * of the prediction and the differences of the multiples of step are small integers,
+ * whose leading zeros are not stored.
+ */
+struct block_header {
+
+  unsigned long long magic;  /**< Always _BLOCK_MAGIC_ */
+  int codec;                 /**< Encoding of the payload, one of enum block_codecs */
+  long int n;                /**< Number of doubles in the block */
+  long int payload_size;     /**< Number of bytes following the header */
+  double step;               /**< Quantisation step, used only by block_codec_quantised */
+
+};
+
+
+/**************************************************************/
+
+/*
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  long int block_compress_bound(
+      long int n
+      );
+
+  int block_compress(
+      double * data,
+      long int n,
+      enum block_compression compression,
+      double tolerance,
+      unsigned char * block,
+      long int * block_size,
+      ErrorMsg error_message
+      );
+
+  int block_decompress(
+      unsigned char * block,
+      long int block_size,
+      double * data,
+      long int n,
+      ErrorMsg error_message
+      );
+
+  int block_read(
+      FILE * stream,
+      unsigned char * block,
+      long int capacity,
+      long int * block_size,
+      ErrorMsg error_message
+      );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,6 +7,14 @@
 #include "song_tools.h"
 #include "slatec_3j_C.h"
 #include "binary.h"
+#include "arena.h"
+#include "run_report.h"
+#include "block_compress.h"
+#include "numa_layout.h"
+
+#ifdef _MPI
+#include <mpi.h>
+#endif
 
 #ifndef __COMMON2__
 #define __COMMON2__
@@ -17,6 +25,26 @@ factorial of m never overflows, assuming a limit of 10^30. The factorial of m is
 needed in bispectra2.c */
 #define _MAX_NUM_AZIMUTHAL_ 14
 
+/** Maximum number of (l1,l2,l3) configurations that can be listed in the
+bispectrum_l1_list, bispectrum_l2_list and bispectrum_l3_list parameters */
+#define _MAX_NUM_TRIANGLES_ 1024
+
+/** Initial value of the 64-bit FNV-1a checksums used to validate the files
+stored to disk; see perturb2_checksum() */
+#define _CHECKSUM_SEED_ 14695981039346656037ULL
+
+
+/**
+ * Families of (l1,l2,l3) configurations for which the intrinsic bispectrum
+ * is computed; see bispectra2_needed_triangle().
+ */
+enum bispectrum_triangles {
+  all_triangles,          /**< All the configurations in pbi->l allowed by the triangular condition */
+  squeezed_triangles,     /**< Only the configurations whose smallest multipole is ppr2->l_squeezed */
+  equilateral_triangles,  /**< Only the configurations with l1=l2=l3 */
+  listed_triangles        /**< Only the configurations in ppr2->triangle_l1, ppr2->triangle_l2, ppr2->triangle_l3 */
+};
+
 
 /**
  * All precision parameters for the second-order part of SONG. 
@@ -175,6 +203,11 @@ struct precision2
                           used when 'k3_sampling' is set to smart */
   int k3_size;            /**< Fixed number of grid points for any (k1,k2) pair,
                           used when 'k3_sampling' is set to lin or log */
+  double k3_adaptive_tol; /**< If positive, solve the system only for the k3 modes needed to
+                          interpolate linearly the sources in k3 with this relative accuracy,
+                          and interpolate the sources in the other modes */
+  int k3_adaptive_stride; /**< Spacing in grid points of the k3 modes that are always solved
+                          when k3_adaptive_tol is positive */
   double q_linstep_song;  /**< Upper bound on linear sampling step in k space for the
                           transfer functions, in units of one period of acoustic oscillation,
                           2*pi/(tau0-tau_rec) */
@@ -197,6 +230,131 @@ struct precision2
   double bessel_j_cut_song;  /* Value of j_l1(x) below which it is approximated by zero (in the region x << l) */
 	double bessel_J_cut_song;	/* Value of J_Llm(x) below which it is approximated by zero (in the region x << l) */
   double bessel_x_step_song; /* Linear step dx for sampling spherical Bessel functions j_l1(x) and functions J_Llm(x) */
+  double bessel_J_adaptive_tol_song; /* If positive, store each J_Llm(x) on a coarser grid where the linear interpolation error is smaller than this fraction of max|J_Llm(x)| */
+
+
+
+  // ====================================================================================
+  // =                                    Performance                                   =
+  // ====================================================================================
+
+  /** Should we cache, for each (k1,k2) pair, the first-order perturbations and the background
+  and thermodynamics quantities needed to compute the quadratic sources? If _TRUE_, they will be
+  computed only for the first k3 mode of each pair and reused for the others; see
+  perturb2_quadratic_sources_for_k1k2k(). */
+  short cache_quadsources;
+
+  /** If positive, stop evolving a wavemode as soon as its line-of-sight sources have become
+  negligible, and set them to zero at all later times. The sources are negligible when, after
+  the peak of recombination, none of them has exceeded this fraction of its maximum absolute
+  value over the last _SOURCES_CUTOFF_STRIDE_ time levels. Used only if the sources are confined
+  to recombination (ppt2->has_only_recombination==_TRUE_), because afterwards they never grow
+  again; see perturb2_sources_cutoff(). */
+  double sources_cutoff_song;
+
+  /** Should we check, at the start of each time interval of each wavemode, that the Jacobian
+  of the second-order system computed by finite differences has no nonzero entries outside
+  the sparsity pattern of perturb2_jacobian_pattern()? The check is slow and does not change
+  the result; see perturb2_jacobian_check(). */
+  short check_jacobian_pattern;
+
+  /** Should we store the line-of-sight sources in a single memory-mapped file rather than
+  in one file per k1? Used only if store_sources_to_disk==_TRUE_. The subsequent modules will
+  then read the sources directly from the page cache, and only the source types that they
+  actually access will be read from disk; see perturb2_sources_map_init(). */
+  short store_sources_mmap;
+
+  /** Should we compress the line-of-sight sources and the transfer functions stored to disk?
+  Each (type,k1,k2) block of the sources and each (type,k1) block of the transfer functions is
+  compressed separately, so that it can be read and decompressed on its own; see
+  block_compress(). Not used for the memory-mapped sources. */
+  enum block_compression disk_compression;
+
+  /** Error of the lossy compression (disk_compression==block_compression_lossy), relative to the
+  largest absolute value in each block */
+  double disk_compression_tolerance;
+
+  /** Should we read the line-of-sight sources for the next k1 value, and write the transfer
+  functions for the previous one, while the transfer functions for the current k1 are being
+  computed? Used only if the sources or the transfer functions are stored to disk; see
+  transfer2_prefetch_k1_level(). */
+  short prefetch_sources;
+
+  /** Number of NUMA domains (typically, sockets) spanned by the OpenMP threads. If larger than one,
+  the projection functions are replicated in each domain, each k1 level of the transfer functions is
+  placed in the memory of the domain whose threads integrate it over k3, and the interpolated sources
+  are placed in the memory of the threads that read them; see numa_layout.h. The result does not change. */
+  int numa_domains;
+
+  /** Should we compute the E-mode and B-mode transfer functions with the same (l,m) together,
+  so that the projection and source functions they share are read only once? The result does
+  not change; see transfer2_compute_EB(). */
+  short batch_transfers;
+
+  /** Should we store the projection functions J_Llm(x) in single precision? This halves the
+  memory used by the bessel2 module, at the cost of a relative error of order 1e-7 on the
+  projection functions and hence on the transfer functions; see bessel2_compact_J(). */
+  short compact_projection_functions;
+
+  /** Should we read the projection functions J_Llm(x) from a cache directory, and store them
+  there if they are not found? The projection functions do not depend on cosmology, so that
+  runs with the same precision parameters can share them; see bessel2_cache_load(). */
+  short cache_projection_functions;
+  char projection_functions_cache_dir[_FILENAMESIZE_];  /**< Cache directory for J_Llm(x) */
+
+  /** Should we compute the integrals over k3, k2, k1 and r of the intrinsic bispectrum one l3 at
+  a time? The result does not change, but the intermediate arrays, whose size grows as
+  l_size^2*r_size*k_size, are never stored in full; see bispectra2_intrinsic_integrate_tiled(). */
+  short tile_intrinsic_bispectrum;
+
+  /** Should the intrinsic bispectrum interpolate over k1 and k2 and integrate over r with the
+  original scalar loops, which look for the interpolation nodes on the fly, rather than with
+  the precomputed weights? The two agree to rounding; the scalar loops are kept as a reference
+  for the vectorised ones; see bispectra2_interpolate_smooth_k(). */
+  short scalar_bispectrum_kernels;
+
+  /** Should the second-order transfer functions be computed one k1 at a time by the bispectrum
+  module, and integrated over k3 as soon as they are computed? The result does not change, but
+  the full transfer function array is never kept in memory nor written to disk; instead, the
+  integrals over k3, whose size grows as r_size rather than k3_size, are kept for all the
+  (l3,m3) pairs; see bispectra2_intrinsic_stream_over_k3(). */
+  short stream_transfers;
+
+  /** Should we keep the geometrical factors (3j and 6j symbols) of the intrinsic bispectrum in
+  memory, so that they are computed only once for all fields and bispectrum types? If
+  geometrical_factors_cache_dir is not empty, they are also stored there and reused by later
+  runs with the same multipole sampling; see bispectra2_intrinsic_geometrical_factors(). */
+  short cache_geometrical_factors;
+  char geometrical_factors_cache_dir[_FILENAMESIZE_];  /**< Cache directory for the geometrical factors */
+
+  struct bispectra2_kept_geometry * kept_geometrical_factors; /**< If not NULL, the geometrical factors are copied
+                                                              from and to these tables, which are owned by the caller
+                                                              and reused by later runs in the same process; set by
+                                                              song_compute(), NULL otherwise */
+
+  /** For which (l1,l2,l3) configurations should we compute the intrinsic bispectrum? The
+  integrals over k and r are restricted to the requested configurations and to their
+  permutations, while the other configurations are set to zero; see bispectra2_needed_triangle(). */
+  enum bispectrum_triangles bispectrum_triangles;
+  int l_squeezed;                       /**< Smallest multipole of the squeezed configurations; if negative, use the smallest l in pbi->l */
+  int triangle_size;                    /**< Number of configurations in the list, for bispectrum_triangles=list */
+  int triangle_l1[_MAX_NUM_TRIANGLES_]; /**< First multipole of the listed configurations */
+  int triangle_l2[_MAX_NUM_TRIANGLES_]; /**< Second multipole of the listed configurations */
+  int triangle_l3[_MAX_NUM_TRIANGLES_]; /**< Third multipole of the listed configurations */
+
+  /** Should we write a JSON report with the wall and CPU time and the peak memory of each module,
+  the busy and idle time of each thread in the main parallel regions, and the statistics of the
+  differential system for each (k1,k2,k3) mode? The report is written in the output directory
+  as run_report.json; see run_report_write() and perturb2_write_run_report(). */
+  short write_run_report;
+
+  /** Should we keep the line-of-sight sources and the transfer functions in a cache directory,
+  and reuse them in later runs with the same parameters? The sources and transfers directories
+  are then named after a hash of the parameters they depend on, so that, for example, a run that
+  changes only the bispectrum parameters reuses both, and one that changes only the transfer2
+  parameters reuses the sources; see input2_run_cache_keys(). */
+  short cache_run;
+  char run_cache_dir[_FILENAMESIZE_];  /**< Cache directory for the sources and transfer functions */
 
 
 
@@ -211,6 +369,17 @@ struct precision2
   short load_sources_from_disk;   /**< Should we load the source functions from disk? */
   short old_run; /**< set to _TRUE_ if the run was stored with a version of SONG smaller than 1.0 */
 
+  /** Rank of this process and number of processes. If SONG is compiled with -D_MPI and
+  run with more than one process, the k1 levels of the perturbations2 and transfer2 modules
+  are distributed between the processes, which exchange them through the sources and transfers
+  directories; see perturb2_assign_k1_to_ranks(). Otherwise, mpi_rank=0 and mpi_size=1. */
+  int mpi_rank;
+  int mpi_size;
+
+  /** Timing of the stages and of the parallel regions of the run; filled whether or not
+  write_run_report is true, as it is cheap. See struct run_report. */
+  struct run_report report;
+
 };  /* end of struct precision2 declaration */
 
 #endif
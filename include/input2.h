@@ -117,6 +117,25 @@ extern "C" {
 		 ErrorMsg errmsg
 		 );
 
+  int input2_read_status_file(
+         char * status_path,
+         short * exists,
+         short * is_complete,
+         ErrorMsg errmsg
+         );
+
+  int input2_mpi_share_disk_flags(
+         struct precision2 * ppr2,
+         ErrorMsg errmsg
+         );
+
+  int input2_run_cache_keys(
+         struct file_content * pfc,
+         unsigned long long * sources_key,
+         unsigned long long * transfers_key,
+         ErrorMsg errmsg
+         );
+
   int input2_default_params(
 			   struct background *pba,
 			   struct thermo *pth,
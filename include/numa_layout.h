@@ -0,0 +1,65 @@
+/** @file numa_layout.h Documented header file for the placement of SONG's large arrays on multi-socket nodes */
+
+#ifndef __NUMA_LAYOUT__
+#define __NUMA_LAYOUT__
+
+#include "common.h"
+
+/*
+ * On a node with several NUMA domains (typically one per socket), a page of
+ * memory is placed in the domain of the thread that first writes to it. The
+ * functions below split the OpenMP threads and the k1 modes between
+ * ppr2->numa_domains domains, so that each array can be first touched by the
+ * threads that will later read it.
+ *
+ * The threads are assigned to the domains in contiguous blocks of thread
+ * numbers: with N domains and T threads, thread t belongs to domain t*N/T.
+ * This matches the placement of the threads obtained with OMP_PLACES=cores
+ * and OMP_PROC_BIND=close (or spread) when the cores are numbered socket by
+ * socket, as it is usually the case on Linux.
+ */
+
+
+/**************************************************************/
+
+/*
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  int numa_thread_domain(
+      int thread,
+      int number_of_threads,
+      int domain_size
+      );
+
+  int numa_domain_threads(
+      int domain,
+      int number_of_threads,
+      int domain_size,
+      int * first_thread,
+      int * thread_size
+      );
+
+  int numa_k1_domain(
+      int index_k1,
+      int k_size,
+      int domain_size
+      );
+
+  int numa_first_touch(
+      double * data,
+      long int n_rows,
+      long int row_size,
+      int domain,
+      int domain_size,
+      ErrorMsg error_message
+      );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
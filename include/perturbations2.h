@@ -135,6 +135,16 @@ enum quadratic_source_interpolation {
                              of the collision term. Usable only if ppt2->compute_quadsources_derivatives==_TRUE_. */
 };
 
+/**
+ * How should perturb2_quadratic_sources() use the cache of first-order perturbations
+ * in the workspace (ppw2->sources1_cache and ppw2->sources2_cache)?
+ */
+enum k1k2_cache_modes {
+  k1k2_cache_off,       /**< Do not use the cache; extract the first-order perturbations from ppt->quadsources */
+  k1k2_cache_fill,      /**< Extract the first-order perturbations from ppt->quadsources and store them in the cache */
+  k1k2_cache_read       /**< Read the first-order perturbations from the cache */
+};
+
 /**
  * Which quadratic sources should we compute? Options for the
  * perturb2_quadratic_sources() function.
@@ -163,6 +173,26 @@ enum quadratic_source_computation {
  */
 #define _MAX_NUM_EQUATIONS_ 4096
 
+/**
+ * Relative step used by perturb2_jacobian() to compute the Jacobian of the
+ * differential system by finite differences.
+ *
+ * The second-order system is linear in the evolved perturbations, because
+ * the quadratic sources depend only on the first-order ones; therefore, the
+ * finite differences are exact up to round-off for any step size.
+ */
+#define _JACOBIAN_STEP_ 1e-7
+
+/**
+ * Number of time levels in ppt2->tau_sampling between two checks of the
+ * convergence of the line-of-sight sources of a wavemode; see the documentation
+ * of ppr2->sources_cutoff_song.
+ *
+ * The evolver is restarted at each check, so that checking too often would
+ * cost more than it saves.
+ */
+#define _SOURCES_CUTOFF_STRIDE_ 8
+
 /**
  * Exclude edges of the triangular condition on (k1,k2,k3).
  *
@@ -187,6 +217,35 @@ enum quadratic_source_computation {
 #define _MIN_K3_RATIO_ 100
 
 
+/**
+ * Signature of the kernels that evolve the free-streaming multipoles l>2 of the
+ * intensity and neutrino hierarchies, and of the E-mode and B-mode hierarchies, for
+ * all the m's at once; see PERTURB2_FREE_STREAMING_KERNELS in perturbations2.c.
+ */
+typedef int (*perturb2_free_streaming_kernel_t)(
+      int l_max,
+      double k,
+      double kappa_dot,
+      const double * restrict c_minus,
+      const double * restrict c_plus,
+      const double * restrict y,
+      double * restrict dy
+      );
+
+typedef int (*perturb2_free_streaming_pol_kernel_t)(
+      int l_max,
+      double k,
+      double kappa_dot,
+      const double * restrict d_minus,
+      const double * restrict d_plus,
+      const double * restrict d_zero,
+      const double * restrict y_E,
+      const double * restrict y_B,
+      double * restrict dy_E,
+      double * restrict dy_B
+      );
+
+
 
 // ======================================================================================
 // =                              Perturbations structure                               =
@@ -416,6 +475,10 @@ struct perturbs2
   short * has_allocated_sources;  /**< If has_allocated_sources[index_k1]==_TRUE_,
                                   then ppt2->sources[index_k1] is fully allocated */
 
+  struct arena * sources_k1_arena; /**< Contiguous storage for the values of the index_k1 level of
+                                   ppt2->sources, unless the sources are memory mapped; see
+                                   perturb2_allocate_k1_level() */
+
   /**
    * Flags for internal use in the perturbations2.c module.
    */
@@ -705,6 +768,30 @@ struct perturbs2
   double ** d_plus;
   double ** d_zero;
   //@}
+
+
+  /**
+   * Free-streaming kernels for the l>2 radiation multipoles.
+   *
+   * The l>2 moments of the photon and neutrino hierarchies only couple to l-1 and
+   * l+1 with the same m, via the C and D coefficients with m1=m. If the requested
+   * m are a standard set (m=0, or m=0,1,2), the multipoles with l>2 are stored with
+   * a constant stride in the evolved vector, and perturb2_derivs() computes them
+   * with a kernel specialised at compile time for that stride, without bound checks
+   * or indirections; see PERTURB2_FREE_STREAMING_KERNELS. The kernels are chosen once
+   * in perturb2_get_lm_lists(); for other sets of m they are NULL, and the generic
+   * equations are used instead.
+   */
+  //@{
+  double * c_minus_mm;  /**< c_minus_mm[lm(l,m)] = c_minus(l,m,m) */
+  double * c_plus_mm;   /**< c_plus_mm[lm(l,m)] = c_plus(l,m,m) */
+  double * d_minus_mm;  /**< d_minus_mm[lm(l,m)] = d_minus(l,m,m) */
+  double * d_plus_mm;   /**< d_plus_mm[lm(l,m)] = d_plus(l,m,m) */
+  double * d_zero_mm;   /**< d_zero_mm[lm(l,m)] = d_zero(l,m,m) */
+
+  perturb2_free_streaming_kernel_t free_streaming_kernel;          /**< Kernel for the intensity and neutrino hierarchies, or NULL */
+  perturb2_free_streaming_pol_kernel_t free_streaming_pol_kernel;  /**< Kernel for the E-mode and B-mode hierarchies, or NULL */
+  //@}
   
 
   /**
@@ -726,14 +813,14 @@ struct perturbs2
    * The coupling coefficients will be crucial to compute the spherical decomposition of
    * the delta-squared term in the delta_tilde transformation. They are indexed as:
    *
-   *   ppt2->coupling_coefficients[ppt2->index_pf_t]
-   *                              [lm(l,m)]
-   *                              [l1]
-   *                              [m1+ppt2->l1_max]
-   *                              [l2]
+   *   coupling_coefficient(ppt2->index_pf_t,l,m,l1,l2,m1)
    * 
-   * and they vanish for configurations where the triangular inequality between l, l1 and l2
-   * is not met.
+   * where the macro is defined in perturbations2_macros.h. The coefficients vanish for
+   * configurations where the triangular inequality between l, l1 and l2 is not met, where
+   * |m1|>l1 or |m-m1|>l2, or where l+l1+l2 does not have the parity of the field; these
+   * are not stored. The other coefficients are stored contiguously in m1, for each
+   * (field,l,m,l1,l2) in this order, in a flat array; ppt2->coupling_offsets gives the
+   * position of the first m1 for each (field,l,m,l1,l2).
    *
    * FORMAL DEFINITION
    * 
@@ -783,8 +870,8 @@ struct perturbs2
    *                   ( 0    F  |  F  )   (  m1   m2 |  m  ) ,
    * 
    * for F=0 (intensity) or F=2 (E and B-mode polarisation). We store the result in the array
-   * ppt2->coupling_coefficients[index_pf][lm][l1][m1-m1_min][l2], where index_pf refers to
-   * the considered field (I,E,B...). Note that, in terms of 3j symbols, the coefficients read: 
+   * ppt2->coupling_coefficients, accessed via coupling_coefficient(index_pf,l,m,l1,l2,m1),
+   * where index_pf refers to the considered field (I,E,B...). Note that, in terms of 3j symbols, the coefficients read: 
    *       
    *       prefactor * (-1)^m * (2*l+1) * ( l1   l2   l  ) * (  l1   l2   l  )
    *                                      ( 0    F   -F  )   (  m1   m2  -m  )
@@ -811,7 +898,15 @@ struct perturbs2
    * Note that there is no delta_B because we neglect the first-order B-modes.
    *
    */
-  double ***** coupling_coefficients;
+  double * coupling_coefficients;
+
+  long int * coupling_offsets;  /**< Position in ppt2->coupling_coefficients of the coefficient with the smallest
+                                allowed m1, that is MAX(-l1,m-l2), for each (index_pf,l,m,l1,l2); the
+                                l2 index starts from |l-l1|. Set to -1 for the configurations that are not
+                                stored. Use the coupling_offset_index() macro to index it. */
+  long int coupling_size;       /**< Number of coupling coefficients stored in ppt2->coupling_coefficients */
+  int coupling_lm_size;         /**< Number of (l,m) pairs in ppt2->coupling_offsets */
+  int coupling_l2_size;         /**< Number of l2 values for each (l,m,l1) in ppt2->coupling_offsets, 2*ppt2->largest_l+1 */
 
   int l1_max;   /**< Maximum l1 for which we have stored the coupling coefficients in ppt2->coupling_coefficients.
                 It is determined by ppr2->l_max_los_quadratic and is used the truncate the summation for the
@@ -820,6 +915,12 @@ struct perturbs2
   int l2_max;   /**< Maximum l2 for which we have stored the coupling coefficients in ppt2->coupling_coefficients.
                 It is determined by ppr2->l_max_los_quadratic and is used the truncate the summation for the
                 delta_tilde transformation. */
+
+  struct perturb2_couplings * kept_couplings; /**< If not NULL, the coupling coefficients are taken from this
+                                              structure when they were computed by a previous run with the same
+                                              multipoles, and are otherwise stored there; in both cases, they are
+                                              owned by the caller and not freed by perturb2_free(). Used by
+                                              song_compute() to compute them only once for many models. */
   
 
   // ------------------------------------------------------------------------------------
@@ -911,6 +1012,12 @@ struct perturbs2
 
   double z_end_of_recombination; /**< Redshift that marks the end of recombination. Defined only if has_only_recombination==_TRUE_. */
 
+  int tau_size_evolved; /**< Number of time levels in ppt2->tau_sampling, counting from the first one, where the sources
+                        are obtained by evolving the differential system; the sources at later times vanish and are
+                        set to zero. It is smaller than ppt2->tau_size only when has_only_recombination==_TRUE_ and
+                        the time sampling was set by the user, so that it could not be cut at the end of recombination.
+                        Individual wavemodes might stop even earlier, if ppr2->sources_cutoff_song is positive. */
+
   int index_tau_rec; /**< Index in ppt2->tau_sampling where the visibility function peaks at recombination */
 
   int index_tau_reio_start; /**< Index in ppt2->tau_sampling where reionisation starts */
@@ -1030,8 +1137,50 @@ struct perturbs2
                          for k1=ppt2->k[index_k1]. Used only if ppr2->store_sources_to_disk==_TRUE_ or
                          ppr2->load_sources_from_disk==_TRUE_. */
 
-  FILE * sources_status_file;                 /**< NOT IMPLEMENTED YET */
-  char sources_status_path[_FILENAMESIZE_];   /**< NOT IMPLEMENTED YET */
+  enum block_compression sources_compression;  /**< Compression of the sources files written by perturb2_store_sources_to_disk(),
+                                              set to ppr2->disk_compression; see perturb2_store_sources_compressed().
+                                              When loading, each file tells whether it is compressed. */
+
+  double sources_compression_tolerance;  /**< Relative error of the lossy compression, set to ppr2->disk_compression_tolerance */
+
+  short has_sources_map;  /**< If _TRUE_, the line-of-sight sources are stored in a single memory-mapped file
+                          (ppt2->sources_map_path) rather than in the ppt2->k_size files in ppt2->sources_paths;
+                          the k1 levels of ppt2->sources then point directly inside the mapping. Set to
+                          ppr2->store_sources_mmap when storing the sources, and to _TRUE_ when loading them
+                          from a sources directory that contains the map file. See perturb2_sources_map_init(). */
+
+  short sources_map_writable;  /**< If _TRUE_, the memory-mapped sources file was created by this run and is mapped
+                               as shared, so that ppt2->sources is written to it; otherwise, it is mapped as private
+                               and the file is never modified */
+
+  char sources_map_path[_FILENAMESIZE_];  /**< Path of the memory-mapped sources file, sources_dir/sources.map */
+
+  int sources_map_fd;  /**< File descriptor of the memory-mapped sources file */
+
+  struct perturb2_sources_map_block * sources_map_blocks;  /**< Index of the memory-mapped sources file, with one
+                                                           entry for each (k1,tp2,k2) block, in this order; the entry
+                                                           for (index_k1,index_tp2,index_k2) is at position
+                                                           ppt2->tp2_size*index_k1*(index_k1+1)/2 + index_tp2*(index_k1+1)
+                                                           + index_k2. The blocks of a given k1 are contiguous in the file
+                                                           and start on a page boundary. */
+
+  void ** sources_map;  /**< sources_map[index_k1] is the address where the index_k1 level of the sources file
+                        is mapped, or NULL if it is not mapped */
+
+  FILE * sources_status_file;                 /**< Stream of the status file, open only while it is being updated */
+  char sources_status_path[_FILENAMESIZE_];   /**< Path of the status file of the sources directory, sources_dir/sources_status.txt,
+                                              listing the complete sources files with their checksums; see
+                                              perturb2_sources_status_init() */
+  char sources_status_rank_path[_FILENAMESIZE_+16];  /**< Status file where this MPI process lists its complete sources files;
+                                                     it is sources_status_path.<mpi_rank> when running with more than one
+                                                     MPI process, and sources_status_path otherwise */
+
+  int * k1_rank;  /**< k1_rank[index_k1] is the rank of the MPI process in charge of computing the sources
+                  for index_k1; always zero without MPI. See perturb2_assign_k1_to_ranks(). */
+
+  short * has_stored_sources;  /**< has_stored_sources[index_k1] is _TRUE_ if the sources file for index_k1 was found complete
+                               and valid in the sources directory of an interrupted run, so that it does not need to be
+                               computed again. NULL if the sources are not stored to disk in one file per k1. */
 
 
   // ------------------------------------------------------------------------------------
@@ -1046,6 +1195,20 @@ struct perturbs2
   
   long int count_k_configurations;    /**< Number of k-modes for which we shall solve the differential system */
 
+  long int count_interpolated_k3;     /**< Number of k-modes whose sources were interpolated in k3 rather than solved for (see ppr2->k3_adaptive_tol) */
+
+  long int count_allocated_for_cache; /**< Number of doubles allocated in the workspaces for the quadratic sources cache */
+
+  struct perturb2_ode_stats *** ode_stats;  /**< ode_stats[index_k1][index_k2][index_k3] contains the statistics of the
+                                            differential system for the (k1,k2,k3) mode; filled only if
+                                            ppr2->write_run_report==_TRUE_, NULL otherwise */
+
+  short is_freeable;               /**< _TRUE_ once perturb2_init() has allocated the indices, the samplings and the
+                                   arrays of ppt2->sources, so that perturb2_free() can be called even if
+                                   perturb2_init() fails afterwards; see song_free_results() */
+  short has_solved_perturbations1; /**< _TRUE_ once perturb2_init() has run perturb_init(), so that the first-order
+                                   perturbations can be freed even if perturb2_init() fails afterwards */
+
   short stop_at_perturbations1;    /**< If _TRUE_, SONG will stop execution after having run the perturbations.c 
                                       module. Useful to debug the first-order transfer functions at recombination. */
   short stop_at_perturbations2;    /**< If _TRUE_, SONG will stop execution after having run the perturbations2.c
@@ -1192,6 +1355,22 @@ struct perturb2_workspace
   struct perturb2_vector * pv;  /**< Pointer to vector of evolved perturbations containing the
                                 state of the differential system at the current time */
 
+  struct perturb2_vector * pv_pool[2];  /**< Preallocated vectors of evolved perturbations. Each time interval
+                                        uses the vector that was not used by the previous interval, so that
+                                        the initial conditions can be copied from the old to the new vector.
+                                        The y, dy and used_in_sources arrays have room for _MAX_NUM_EQUATIONS_
+                                        elements, so that they can be reused for all the wavemodes and
+                                        approximation schemes without further memory allocation. Allocated
+                                        in perturb2_workspace_init(); ppw2->pv always points to one of them. */
+
+  int * interval_number_of;     /**< Number of time intervals where each approximation is uniform, for the current
+                                wavemode; allocated once with size ppw2->ap2_size. See perturb2_solve(). */
+  double * interval_limit;      /**< Edges of the time intervals for the current wavemode; allocated once
+                                with size ppw2->ap2_size+2. See perturb2_solve(). */
+  int ** interval_approx;       /**< Logical matrix interval_approx[index_interval][index_ap] telling which approximations
+                                are active in each time interval of the current wavemode; allocated once with size
+                                (ppw2->ap2_size+1)*ppw2->ap2_size. See perturb2_solve(). */
+
   double tau_start_evolution;   /**< Conformal time when we start evolving the current wavemode */
   
   int l_max_g;                /**< Number of multipoles to evolve in the second-order Boltzmann hierarchy for the
@@ -1465,6 +1644,33 @@ struct perturb2_workspace
   int index_qs2_vv_cdm;  /**< (velocity potential)^2 of CDM */
 
 
+  /**
+   * Cache for the quantities entering the quadratic sources that do not depend on k3.
+   *
+   * The quadratic sources are tabulated for each (k1,k2,k3) triplet on the time grid
+   * ppt->tau_sampling_quadsources. The background and thermodynamics quantities
+   * depend only on time, and the first-order perturbations only on (k1,k2,tau);
+   * if ppr2->cache_quadsources==_TRUE_, we compute them once and reuse them for all
+   * the k3 modes of a (k1,k2) pair. See perturb2_quadratic_sources_for_k1k2k().
+   */
+  //@{
+
+  double * pvecback_cache;       /**< Background quantities at the nodes of ppt->tau_sampling_quadsources,
+                                 indexed as [index_tau*pba->bg_size + pba->index_bg_XXX] */
+  double * pvecthermo_cache;     /**< Thermodynamics quantities at the nodes of ppt->tau_sampling_quadsources,
+                                 indexed as [index_tau*pth->th_size + pth->index_th_XXX] */
+  double * sources1_cache;       /**< First-order perturbations in k1 at the nodes of ppt->tau_sampling_quadsources,
+                                 indexed as [index_tau*qs_size + ppt->index_qs_XXX] */
+  double * sources2_cache;       /**< First-order perturbations in k2 at the nodes of ppt->tau_sampling_quadsources,
+                                 indexed as [index_tau*qs_size + ppt->index_qs_XXX] */
+  int index_k1_cache;            /**< Index in ppt2->k of the k1 mode stored in ppw2->sources1_cache, or -1 if none */
+  int index_k2_cache;            /**< Index in ppt2->k of the k2 mode stored in ppw2->sources2_cache, or -1 if none */
+  enum k1k2_cache_modes k1k2_cache_mode; /**< Should perturb2_quadratic_sources() fill the first-order cache,
+                                         read from it, or ignore it? */
+
+  //@}
+
+
 
   // ====================================================================================
   // =                                Time interpolation                                =
@@ -1760,6 +1966,43 @@ struct perturb2_vector
   char (*pt2_labels)[_MAX_LENGTH_LABEL_];
 
 
+
+  // ====================================================================================
+  // =                                Jacobian pattern                                  =
+  // ====================================================================================
+
+  /**
+   * Sparsity pattern of the Jacobian of the differential system, d(dy)/dy.
+   *
+   * The Boltzmann hierarchies couple each (l,m) multipole only to the l-1 and l+1
+   * multipoles with the same m, and the E-modes to the B-modes with the same (l,m);
+   * the metric, the matter moments and the l<=2 multipoles, which enter the Einstein
+   * equations and the collision term, form a small dense block. The pattern is
+   * therefore known in advance from the structure of the vector; it is computed by
+   * perturb2_jacobian_pattern() and stored in compressed sparse column (CSC) format,
+   * as in the sparse module of CLASS.
+   *
+   * The columns are also partitioned in groups (colours) such that no two columns in
+   * the same group have a nonzero in the same row. This allows perturb2_jacobian() to
+   * compute the full Jacobian with jacobian_colour_size+1 calls to perturb2_derivs(),
+   * rather than pt2_size+1.
+   */
+  //@{
+
+  int jacobian_nnz;           /**< Number of nonzero entries of the Jacobian */
+  int * jacobian_Ap;          /**< jacobian_Ap[j] is the position in jacobian_Ai of the first nonzero of column j; size pt2_size+1 */
+  int * jacobian_Ai;          /**< Row indices of the nonzero entries, sorted within each column; size jacobian_nnz */
+  int jacobian_Ai_capacity;   /**< Allocated size of jacobian_Ai */
+  int * jacobian_colour;      /**< jacobian_colour[j] is the group of column j */
+  int jacobian_colour_size;   /**< Number of groups of columns */
+  int jacobian_key[6];        /**< Layout of the vector for which the pattern was computed, used to skip recomputing it */
+  int * jacobian_work;        /**< Integer workspace for perturb2_jacobian_pattern() */
+  double * jacobian_y;        /**< Shifted perturbations, used by perturb2_jacobian() */
+  double * jacobian_dy;       /**< Derivatives at the shifted perturbations, used by perturb2_jacobian() */
+  double * jacobian_step;     /**< Finite difference step for each column, used by perturb2_jacobian() */
+
+  //@}
+
 };
 
 
@@ -1790,6 +2033,92 @@ struct perturb2_parameters_and_workspace {
 
 
 
+/**
+ * Header of the memory-mapped sources file.
+ *
+ * The header is followed by the index of the file, an array of
+ * n_blocks perturb2_sources_map_block structures, and then by the
+ * data. See perturb2_sources_map_init() for details.
+ */
+struct perturb2_sources_map_header {
+
+  char magic[8];      /**< Always "SONGMAP", used to recognise the file */
+  int tp2_size;       /**< Number of source types, ppt2->tp2_size */
+  int k_size;         /**< Number of k1 and k2 values, ppt2->k_size */
+  int tau_size;       /**< Number of time values, ppt2->tau_size */
+  int page_size;      /**< Page size of the machine that created the file */
+  long int n_blocks;  /**< Number of (k1,tp2,k2) blocks in the file */
+
+};
+
+
+/**
+ * Entry of the index of the memory-mapped sources file, describing
+ * where the (k3,tau) level of ppt2->sources for a given (k1,tp2,k2)
+ * is stored.
+ */
+struct perturb2_sources_map_block {
+
+  long int offset;    /**< Position of the block in the file, in bytes */
+  long int size;      /**< Number of doubles in the block, ppt2->tau_size*ppt2->k3_size[index_k1][index_k2] */
+
+};
+
+
+
+/**
+ * Statistics of the differential system for a (k1,k2,k3) mode, to be written
+ * in the run report by perturb2_write_run_report().
+ *
+ * The step and Jacobian statistics internal to the evolver are not returned
+ * to SONG; as a proxy, we count the accepted time steps through the print
+ * function of the evolver, and the evaluations of the derivatives, which
+ * include those needed to compute the numerical Jacobian.
+ */
+struct perturb2_ode_stats {
+
+  int steps;          /**< Number of time steps taken by the evolver */
+  int derivs_calls;   /**< Number of calls to perturb2_derivs() */
+  int pt2_size;       /**< Largest number of evolved equations over the time intervals */
+  int jacobian_colours; /**< Largest number of calls to perturb2_derivs() needed for a Jacobian by perturb2_jacobian(),
+                        over the time intervals; compare with pt2_size for the cost of a dense Jacobian */
+  float solve_time;   /**< Wall time spent in perturb2_solve(), in seconds */
+  int tau_size;       /**< Number of time levels in ppt2->tau_sampling reached by the evolver */
+
+};
+
+
+/**
+ * Unit of work for the parallel loop over the wavemodes in perturb2_init().
+ *
+ * All the k3 modes associated to a (k1,k2) pair are solved by the same thread,
+ * so that the pair is the smallest amount of work that is distributed between
+ * the threads. See perturb2_k1k2_queue() for details.
+ */
+struct perturb2_k1k2_pair {
+
+  int index_k1;   /**< Index of k1 in ppt2->k */
+  int index_k2;   /**< Index of k2 in ppt2->k, always smaller than or equal to index_k1 */
+  double cost;    /**< Estimated cost of solving the differential system for all the k3 modes of the pair */
+
+};
+
+
+/**
+ * Coupling coefficients of the delta_tilde transformation kept between runs of
+ * perturb2_init() in the same process; see ppt2->kept_couplings.
+ */
+struct perturb2_couplings {
+
+  unsigned long long key;   /**< Hash of the parameters of the coefficients, see perturb2_coupling_key() */
+  double * coefficients;    /**< Same as ppt2->coupling_coefficients; NULL if none was computed yet */
+  long int * offsets;       /**< Same as ppt2->coupling_offsets */
+  long int size;            /**< Same as ppt2->coupling_size */
+
+};
+
+
+
 /*************************************************************************************************************/
 
 /*
@@ -1812,6 +2141,37 @@ struct perturb2_parameters_and_workspace {
          struct precision2 * ppr2,
          struct perturbs2 * ppt2
          );
+
+    int perturb2_k1k2_queue (
+            struct precision2 * ppr2,
+            struct perturbs2 * ppt2,
+            int * pair_size,
+            struct perturb2_k1k2_pair ** pairs
+            );
+
+    double perturb2_k1k2_cost (
+            struct perturbs2 * ppt2,
+            int index_k1,
+            int index_k2
+            );
+
+    int perturb2_assign_k1_to_ranks (
+            struct precision2 * ppr2,
+            int k_size,
+            double * k1_cost,
+            int * k1_rank,
+            ErrorMsg error_message
+            );
+
+    int perturb2_compare_k1k2_pairs (
+            const void * a,
+            const void * b
+            );
+
+    int perturb2_compare_k1k2_pairs_by_k1 (
+            const void * a,
+            const void * b
+            );
          
 
     int perturb2_indices_of_perturbs(
@@ -1861,6 +2221,12 @@ struct perturb2_parameters_and_workspace {
          struct perturbs2 * ppt2
          );
 
+    int perturb2_coupling_key(
+         struct precision2 * ppr2,
+         struct perturbs2 * ppt2,
+         unsigned long long * key
+         );
+
 
     int perturb2_get_k_lists(
          struct precision * ppr,
@@ -1941,6 +2307,38 @@ struct perturb2_parameters_and_workspace {
           struct perturb2_workspace * ppw2
           );
 
+    int perturb2_solve_k3_adaptive(
+          struct precision * ppr,
+          struct precision2 * ppr2,
+          struct background * pba,
+          struct thermo * pth,
+          struct perturbs * ppt,
+          struct perturbs2 * ppt2,
+          int index_k1,
+          int index_k2,
+          struct perturb2_workspace * ppw2,
+          int * k3_solved
+          );
+
+    int perturb2_k3_is_smooth(
+          struct precision2 * ppr2,
+          struct perturbs2 * ppt2,
+          int index_k1,
+          int index_k2,
+          int a,
+          int m,
+          int b,
+          short * is_smooth
+          );
+
+    int perturb2_interpolate_k3(
+          struct perturbs2 * ppt2,
+          int index_k1,
+          int index_k2,
+          int a,
+          int b
+          );
+
     int perturb2_initial_conditions(
            struct precision * ppr,
            struct precision2 * ppr2,
@@ -2086,6 +2484,28 @@ struct perturb2_parameters_and_workspace {
           ErrorMsg error_message
           );
 
+    int perturb2_sources_cutoff(
+          struct precision2 * ppr2,
+          struct perturbs2 * ppt2,
+          struct perturb2_workspace * ppw2,
+          int index_tau_check,
+          int * converged
+          );
+
+    int perturb2_count_steps(
+            double tau,
+            int index_tau,
+            double * y,
+            double * dy,
+            void * parameters_and_workspace,
+            ErrorMsg error_message
+            );
+
+    int perturb2_write_run_report(
+            struct perturbs2 * ppt2,
+            FILE * stream
+            );
+
     int perturb2_save_perturbations(
           double tau,
           int index_tau,
@@ -2144,6 +2564,75 @@ struct perturb2_parameters_and_workspace {
            ErrorMsg error_message
            );
 
+    int perturb2_free_streaming_scalar(
+          int l_max,
+          double k,
+          double kappa_dot,
+          const double * restrict c_minus,
+          const double * restrict c_plus,
+          const double * restrict y,
+          double * restrict dy
+          );
+
+    int perturb2_free_streaming_pol_scalar(
+          int l_max,
+          double k,
+          double kappa_dot,
+          const double * restrict d_minus,
+          const double * restrict d_plus,
+          const double * restrict d_zero,
+          const double * restrict y_E,
+          const double * restrict y_B,
+          double * restrict dy_E,
+          double * restrict dy_B
+          );
+
+    int perturb2_free_streaming_m012(
+          int l_max,
+          double k,
+          double kappa_dot,
+          const double * restrict c_minus,
+          const double * restrict c_plus,
+          const double * restrict y,
+          double * restrict dy
+          );
+
+    int perturb2_free_streaming_pol_m012(
+          int l_max,
+          double k,
+          double kappa_dot,
+          const double * restrict d_minus,
+          const double * restrict d_plus,
+          const double * restrict d_zero,
+          const double * restrict y_E,
+          const double * restrict y_B,
+          double * restrict dy_E,
+          double * restrict dy_B
+          );
+
+    int perturb2_jacobian_pattern(
+          struct precision2 * ppr2,
+          struct background * pba,
+          struct perturbs2 * ppt2,
+          struct perturb2_vector * ppv
+          );
+
+    int perturb2_jacobian(
+          double tau,
+          double * y,
+          double * dy,
+          double * jacobian,
+          void * parameters_and_workspace,
+          ErrorMsg error_message
+          );
+
+    int perturb2_jacobian_check(
+          double tau,
+          double * y,
+          void * parameters_and_workspace,
+          ErrorMsg error_message
+          );
+
     int perturb2_quadratic_sources(
           struct precision * ppr,
           struct precision2 * ppr2,
@@ -2227,9 +2716,42 @@ struct perturb2_parameters_and_workspace {
             FILE * output_stream
             );
 
+    int perturb2_store_sources_compressed(
+            struct perturbs2 * ppt2,
+            int index_k1,
+            char * filepath,
+            FILE * output_stream,
+            unsigned long long * checksum
+            );
+
+    void perturb2_checksum (
+            const void * data,
+            size_t n_bytes,
+            unsigned long long * checksum
+            );
+
+    int perturb2_sources_status_init (
+            struct precision2 * ppr2,
+            struct perturbs2 * ppt2
+            );
+
+    int perturb2_sources_status_update (
+            struct perturbs2 * ppt2,
+            int index_k1,
+            unsigned long long checksum
+            );
+
+    int perturb2_sources_file_is_valid (
+            struct perturbs2 * ppt2,
+            int index_k1,
+            unsigned long long checksum,
+            short * is_valid
+            );
+
     int perturb2_load_sources_from_disk(
             struct perturbs2 * ppt2,
-            int index_k1
+            int index_k1,
+            ErrorMsg error_message
             );
 
     int perturb2_load_sources_k3_tau(
@@ -2238,12 +2760,38 @@ struct perturb2_parameters_and_workspace {
             int index_k1,
             int index_k2,
             char * filepath,
-            FILE * input_stream
+            FILE * input_stream,
+            ErrorMsg error_message
             );
 
+    int perturb2_load_sources_compressed(
+            struct perturbs2 * ppt2,
+            int index_k1,
+            char * filepath,
+            FILE * input_stream,
+            ErrorMsg error_message
+            );
+
+    int perturb2_sources_map_init(
+         struct precision2 * ppr2,
+         struct perturbs2 * ppt2
+         );
+
+    int perturb2_sources_map_k1_level(
+         struct perturbs2 * ppt2,
+         int index_k1,
+         struct perturb2_sources_map_block ** first_block,
+         size_t * length
+         );
+
+    int perturb2_sources_map_free(
+         struct perturbs2 * ppt2
+         );
+
     int perturb2_allocate_k1_level(
          struct perturbs2 * ppt2,
-         int index_k1
+         int index_k1,
+         ErrorMsg error_message
          );
 
     int perturb2_free_k1_level(
@@ -76,6 +76,26 @@
  */
 #define lm_quad(l,m) ppt2->lm_array_quad[l][m]
 
+/**
+ * Shorthands to access the general coupling coefficients in the flat array
+ * ppt2->coupling_coefficients, in O(1) operations.
+ *
+ * The coefficient for the field index_pf and the multipoles (l,m), (l1,m1) and (l2,m-m1)
+ * is coupling_coefficient(index_pf,l,m,l1,l2,m1). It is stored only if the 3j selection
+ * rules are met, that is, if |l-l1| <= l2 <= l+l1, |m1| <= l1, |m-m1| <= l2 and l+l1+l2
+ * has the parity of the field; the macros must not be used for other configurations.
+ * See the documentation of ppt2->coupling_coefficients for more details.
+ */
+//@{
+#define coupling_offset_index(index_pf,l,m,l1,l2) \
+  ((((long int)(index_pf)*ppt2->coupling_lm_size + lm(l,m))*(ppt2->l1_max+1) + (l1))\
+  *ppt2->coupling_l2_size + (l2) - abs((l)-(l1)))
+#define coupling_coefficient_index(index_pf,l,m,l1,l2,m1) \
+  (ppt2->coupling_offsets[coupling_offset_index(index_pf,l,m,l1,l2)] + (m1) - MAX(-(l1),(m)-(l2)))
+#define coupling_coefficient(index_pf,l,m,l1,l2,m1) \
+  ppt2->coupling_coefficients[coupling_coefficient_index(index_pf,l,m,l1,l2,m1)]
+//@}
+
 
 /**
  * Shorthands to access y, the vector of evolved perturbations.
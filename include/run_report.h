@@ -0,0 +1,127 @@
+/** @file run_report.h Documented header file for the timing and memory report of a SONG run */
+
+#ifndef __RUN_REPORT__
+#define __RUN_REPORT__
+
+#include "common.h"
+
+#define _MAX_NUM_REPORT_STAGES_ 32    /**< Maximum number of stages timed by run_report_stage_start() */
+#define _MAX_NUM_REPORT_REGIONS_ 32   /**< Maximum number of parallel regions timed by run_report_region() */
+#define _REPORT_NAME_LENGTH_ 64       /**< Maximum length of the name of a stage or region */
+
+/**
+ * Wall time, CPU time and memory used by a stage of the run, typically the
+ * xxx_init() function of a module.
+ */
+struct run_report_stage {
+
+  char name[_REPORT_NAME_LENGTH_];  /**< Name of the stage, e.g. "perturb2_init" */
+  double wall_time;                 /**< Elapsed time in seconds */
+  double cpu_time;                  /**< CPU time in seconds, summed over all threads */
+  long int peak_memory;             /**< Peak resident memory of the process at the end of the stage, in kB */
+  long int peak_memory_increase;    /**< Increase of the peak resident memory during the stage, in kB */
+
+};
+
+
+/**
+ * Time spent by each thread doing actual work in a parallel region. The
+ * difference between the wall time of the region and the busy time of a
+ * thread is the time the thread was idle, waiting for the others; a large
+ * spread in the busy times signals a load imbalance. If the region is
+ * entered several times, the times are summed over all the calls.
+ *
+ * Each thread can also count the work items it processed, such as the number
+ * of wavemodes solved, so that the throughput of the region (items per second)
+ * can be compared between runs with different settings or code versions.
+ */
+struct run_report_region {
+
+  char name[_REPORT_NAME_LENGTH_];  /**< Name of the region, e.g. "perturb2_solve" */
+  int thread_size;                  /**< Number of threads in the region */
+  int calls;                        /**< Number of times the region was entered */
+  double wall_time;                 /**< Elapsed time in seconds, summed over the calls */
+  double * busy_time;               /**< busy_time[thread] is the time spent working by the thread, in seconds */
+  char work_unit[_REPORT_NAME_LENGTH_];  /**< Name of the work items counted in work[thread], e.g. "modes"; empty if
+                                        the region does not count its work */
+  long int * work;                  /**< work[thread] is the number of work items processed by the thread */
+
+};
+
+
+/**
+ * Timing and memory report of a SONG run.
+ *
+ * The stages are timed by the main program, while the parallel regions are
+ * timed by the modules. The report is written to a JSON file by
+ * run_report_write(), so that different runs can be compared.
+ */
+struct run_report {
+
+  struct run_report_stage stages[_MAX_NUM_REPORT_STAGES_];     /**< Stages timed so far */
+  int stage_size;                                               /**< Number of stages timed so far */
+
+  struct run_report_region regions[_MAX_NUM_REPORT_REGIONS_];  /**< Parallel regions timed so far */
+  int region_size;                                              /**< Number of parallel regions timed so far */
+
+  double stage_start_wall_time;   /**< Wall time at the beginning of the current stage */
+  double stage_start_cpu_time;    /**< CPU time at the beginning of the current stage */
+  long int stage_start_memory;    /**< Peak resident memory at the beginning of the current stage */
+
+};
+
+
+/**************************************************************/
+
+/*
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  double run_report_time();
+
+  int run_report_usage(
+      double * cpu_time,
+      long int * peak_memory
+      );
+
+  int run_report_init(
+      struct run_report * prr
+      );
+
+  int run_report_stage_start(
+      struct run_report * prr,
+      char * name,
+      ErrorMsg error_message
+      );
+
+  int run_report_stage_end(
+      struct run_report * prr,
+      ErrorMsg error_message
+      );
+
+  int run_report_region(
+      struct run_report * prr,
+      char * name,
+      char * work_unit,
+      int thread_size,
+      int * index_region,
+      ErrorMsg error_message
+      );
+
+  int run_report_write(
+      struct run_report * prr,
+      FILE * stream
+      );
+
+  int run_report_free(
+      struct run_report * prr
+      );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
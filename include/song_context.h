@@ -0,0 +1,165 @@
+/** @file song_context.h Documented header file for the library interface of SONG */
+
+#ifndef __SONG_CONTEXT__
+#define __SONG_CONTEXT__
+
+#include "song.h"
+
+/**
+ * Stages of an evaluation of SONG, in the order in which they are computed by
+ * song_compute(). The structures filled by a stage are freed by song_free_results()
+ * only if the stage was completed, with the exception of the perturbations stage.
+ */
+enum song_stages {
+  song_input,          /**< input_init_from_arguments(), or input_init() in song_compute_from_content() */
+  song_input2,         /**< input2_init_from_arguments(), or input2_init() in song_compute_from_content() */
+  song_background,     /**< background_init() */
+  song_thermodynamics, /**< thermodynamics_init() */
+  song_cls,            /**< compute_cls(), the first-order C_l */
+  song_perturbations,  /**< perturb2_init(), which also computes the first-order perturbations */
+  song_primordial,     /**< primordial_init() */
+  song_nonlinear,      /**< nonlinear_init() */
+  song_transfer,       /**< transfer_init() */
+  song_bessel,         /**< bessel_init() */
+  song_bessel2,        /**< bessel2_init() */
+  song_transfer2,      /**< transfer2_init() */
+  song_bispectra,      /**< bispectra_init() */
+  song_bispectra2,     /**< bispectra2_init() */
+  song_spectra2,       /**< spectra2_init() */
+  song_fisher,         /**< fisher_init() */
+  song_output,         /**< output_init() */
+  song_stage_size      /**< Number of stages */
+};
+
+
+/**
+ * Everything needed to run SONG several times in the same process, for example
+ * to evaluate many cosmological models from an MCMC driver.
+ *
+ * A context is initialised once with song_context_init(); then, each call to
+ * song_compute() reads the parameter files of a model and runs all the modules,
+ * from background_init() to fisher_init(). To vary the parameters in memory rather
+ * than through parameter files, use song_compute_from_content(). The results of the last evaluation,
+ * such as the bispectra in psc->bi and the Fisher matrix in psc->fi, stay in the
+ * context until the next call to song_compute() or to song_context_free().
+ *
+ * The tables that do not depend on cosmology are computed by the first evaluation
+ * and kept in the context for the following evaluations with the same multipole
+ * and x sampling: the coupling coefficients of the delta_tilde transformation in
+ * psc->couplings, the projection functions J_Llm(x) of the bessel2 module in
+ * psc->projection_functions and the geometrical factors of the intrinsic bispectrum
+ * in psc->geometrical_factors. If the context has a cache directory, the projection
+ * functions and the geometrical factors are also stored there, so that other
+ * processes can read them from the page cache. See perturb2_get_lm_lists(),
+ * bessel2_init() and bispectra2_intrinsic_geometrical_factors(). The workspaces of
+ * the modules depend on the cosmological parameters through their samplings, and
+ * are allocated by each evaluation.
+ *
+ * Example:
+ *
+ *   struct song_context sc;
+ *   song_context_init (&sc, "/tmp/song_cache", errmsg);
+ *   for (int i=0; i < n_models; ++i) {
+ *     char * argv[] = {"song", model_ini[i], "precision.pre"};
+ *     if (song_compute (&sc, 3, argv, errmsg) == _FAILURE_)
+ *       continue;
+ *     use_bispectra (&sc.bi);
+ *   }
+ *   song_context_free (&sc, errmsg);
+ */
+struct song_context {
+
+  struct precision pr;        /**< precision parameters (1st-order) */
+  struct precision2 pr2;      /**< precision parameters (2nd-order) */
+  struct background ba;       /**< cosmological background */
+  struct thermo th;           /**< thermodynamics */
+  struct perturbs pt;         /**< source functions (1st-order) */
+  struct perturbs2 pt2;       /**< source functions (2nd-order) */
+  struct transfers tr;        /**< transfer functions (1st-order) */
+  struct bessels bs;          /**< bessel functions (1st-order) */
+  struct bessels2 bs2;        /**< bessel functions (2nd-order) */
+  struct transfers2 tr2;      /**< transfer functions (2nd-order) */
+  struct primordial pm;       /**< primordial spectra */
+  struct spectra sp;          /**< output spectra (1st-order) */
+  struct nonlinear nl;        /**< non-linear spectra */
+  struct lensing le;          /**< lensed spectra */
+  struct bispectra bi;        /**< bispectra */
+  struct fisher fi;           /**< fisher matrix */
+  struct output op;           /**< output files */
+
+  struct perturb2_couplings couplings; /**< Coupling coefficients of the delta_tilde transformation, computed by the
+                                       first evaluation and reused by the following ones with the same multipoles */
+
+  struct bessel2_J_image projection_functions; /**< Projection functions J_Llm(x) of the bessel2 module, computed
+                                               by the first evaluation and reused by the following ones with the
+                                               same multipole and x sampling */
+
+  struct bispectra2_kept_geometry geometrical_factors; /**< Geometrical factors of the intrinsic bispectrum, computed
+                                                       by the first evaluation and reused by the following ones with
+                                                       the same multipole sampling */
+
+  char cache_dir[_FILENAMESIZE_];  /**< Directory for the tables that do not depend on cosmology; empty
+                                   if they are not cached. Used only if the parameter files do not
+                                   set projection_functions_cache_dir and geometrical_factors_cache_dir. */
+
+  int stage_size;             /**< Number of stages of the current evaluation that were completed, in the
+                              order of enum song_stages; song_free_results() frees these, so that
+                              a failed evaluation does not prevent the next one */
+  int evaluation_count;       /**< Number of successful calls to song_compute() */
+
+};
+
+
+/**************************************************************/
+
+/*
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  int song_context_init(
+        struct song_context * psc,
+        char * cache_dir,
+        ErrorMsg error_message
+        );
+
+  int song_compute(
+        struct song_context * psc,
+        int argc,
+        char ** argv,
+        ErrorMsg error_message
+        );
+
+  int song_compute_from_content(
+        struct song_context * psc,
+        struct file_content * pfc,
+        ErrorMsg error_message
+        );
+
+  int song_compute_modules(
+        struct song_context * psc,
+        ErrorMsg error_message
+        );
+
+  int song_write_run_report(
+        struct song_context * psc,
+        ErrorMsg error_message
+        );
+
+  int song_free_results(
+        struct song_context * psc,
+        ErrorMsg error_message
+        );
+
+  int song_context_free(
+        struct song_context * psc,
+        ErrorMsg error_message
+        );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
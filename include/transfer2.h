@@ -201,8 +201,30 @@ struct transfers2 {
                            for the transfer type indexed by index_tt2. Used only if ppr2->store_transfers_to_disk==_TRUE_ or
                            ppr2->load_transfers_from_disk==_TRUE_. */
 
-  FILE * transfers_status_file;                      /**< NOT IMPLEMENTED YET */
-  char transfers_status_path[_FILENAMESIZE_];        /**< NOT IMPLEMENTED YET */
+  FILE * transfers_status_file;                      /**< Stream of the status file, open only while it is being updated */
+  char transfers_status_path[_FILENAMESIZE_];        /**< Path of the status file of the transfers directory,
+                                                     transfers_dir/transfers_status.txt, listing the k1 levels stored
+                                                     in the transfers files with their checksums; see
+                                                     transfer2_transfers_status_init() */
+  char transfers_status_rank_path[_FILENAMESIZE_+16];  /**< Status file where this MPI process lists its complete k1 levels;
+                                                       it is transfers_status_path.<mpi_rank> when running with more than
+                                                       one MPI process, and transfers_status_path otherwise */
+
+  short * has_stored_transfers;  /**< has_stored_transfers[index_k1] is _TRUE_ if the index_k1 level was found complete
+                                 and valid in the transfers files of an interrupted run, so that it does not need to be
+                                 computed again. NULL if the transfer functions are not stored to disk. */
+
+  long int * k1_offset;  /**< k1_offset[index_k1] is the position in bytes of the index_k1 level in each transfers
+                         file; k1_offset[ppt2->k_size] is the size of the files. NULL if the transfer functions are
+                         not stored to disk. */
+
+  enum block_compression transfers_compression; /**< Compression of the transfers files, from ppr2->disk_compression. If
+                                                not block_compression_none, each k1 level of a file is a single compressed
+                                                block, written at the start of its slot; see transfer2_store_transfers_to_disk() */
+  double transfers_compression_tolerance;       /**< Relative error of the lossy compression, from ppr2->disk_compression_tolerance */
+
+  int * k1_rank;  /**< k1_rank[index_k1] is the rank of the MPI process in charge of computing the transfer functions
+                  for index_k1; always zero without MPI. See perturb2_assign_k1_to_ranks(). */
 
 
 
@@ -231,6 +253,12 @@ struct transfers2 {
   /* Logical array. If the index_k1 position is true, then ppt2->transfers[index_k1] is allocated */
   short * has_allocated_transfers;
 
+  /* Contiguous storage for the values of ptr2->transfer. The index_k1 level allocated by
+  transfer2_allocate_k1_level() lives in transfer_k1_arena[index_k1], while the index_tt
+  level allocated by transfer2_allocate_type_level() lives in transfer_type_arena[index_tt] */
+  struct arena * transfer_k1_arena;
+  struct arena * transfer_type_arena;
+
   short stop_at_transfers2; /**< If _TRUE_, SONG will stop execution after having run the transfer2.c
                             module. Useful to debug the second-order transfer functions today. */
   
@@ -271,6 +299,9 @@ struct transfer2_workspace {
   double * tau_grid;
   double * tau0_minus_tau;        /* List of tau0-tau values, tau0_minus_tau[index_tau_grid] */
   double * delta_tau;             /* List of delta_tau values for trapezoidal rule, delta_tau[index_tau_grid] */
+  int * index_x;                  /* Position of x=k*(tau0-tau) in pbs2->xx, index_x[index_tau_grid] */
+  double * a_J;                   /* Linear interpolation weight of x=k*(tau0-tau) in pbs2->xx, a_J[index_tau_grid] */
+  double * J_in_time[2];          /* Projection functions J_EE and J_EB interpolated on the time grid, J_in_time[0 or 1][index_tau_grid] */
 
   /* Sampling in k where we shall compute the transfer function */
   double * k_grid;
@@ -289,6 +320,14 @@ struct transfer2_workspace {
   temperature (ppr2->l_max_los_t) or polarization (ppr->l_max_los_p). */
   int L_max;
 
+  /* Projection functions read by this thread. They point to the copy of pbs2->J_Llm_x,
+  pbs2->ddJ_Llm_x, etc. placed in the NUMA domain of the thread, if the projection functions
+  are replicated (see bessel2_replicate_J()), and to the original arrays otherwise. */
+  double ***** J_Llm_x;
+  double ***** ddJ_Llm_x;
+  float ***** J_Llm_x_float;
+  float ***** ddJ_Llm_x_float;
+
   /* Number of the thread that is currently using this workspace */
   int thread;
 
@@ -466,6 +505,58 @@ extern "C" {
         int * last_used_index_pt
         );
 
+  int transfer2_compute_k1_level(
+        struct precision * ppr,
+        struct precision2 * ppr2,
+        struct perturbs * ppt,
+        struct perturbs2 * ppt2,
+        struct bessels * pbs,
+        struct bessels2 * pbs2,
+        struct transfers2 * ptr2,
+        int index_k1,
+        int number_of_threads,
+        struct transfer2_workspace ** ppw,
+        double ** sources_k_spline,
+        double ** interpolated_sources_in_k
+        );
+
+  int transfer2_workspace_init(
+        struct precision2 * ppr2,
+        struct perturbs2 * ppt2,
+        struct bessels2 * pbs2,
+        struct transfers2 * ptr2,
+        int number_of_threads,
+        struct transfer2_workspace *** pppw
+        );
+
+  int transfer2_workspace_free(
+        struct perturbs2 * ppt2,
+        int number_of_threads,
+        struct transfer2_workspace ** ppw
+        );
+
+  int transfer2_stream_k1_level(
+        struct precision * ppr,
+        struct precision2 * ppr2,
+        struct perturbs * ppt,
+        struct perturbs2 * ppt2,
+        struct bessels * pbs,
+        struct bessels2 * pbs2,
+        struct transfers2 * ptr2,
+        int index_k1,
+        int number_of_threads,
+        struct transfer2_workspace ** ppw
+        );
+
+  int transfer2_prefetch_k1_level(
+        struct precision2 * ppr2,
+        struct perturbs2 * ppt2,
+        struct transfers2 * ptr2,
+        int index_k1_previous,
+        int index_k1_next,
+        ErrorMsg error_message
+        );
+
   int transfer2_compute (
           struct precision * ppr,
           struct precision2 * ppr2,
@@ -483,6 +574,63 @@ extern "C" {
           struct transfer2_workspace * pw
           );
 
+  int transfer2_compute_EB (
+          struct precision * ppr,
+          struct precision2 * ppr2,
+          struct perturbs2 * ppt2,
+          struct bessels * pbs,
+          struct bessels2 * pbs2,
+          struct transfers2 * ptr2,
+          int index_k1,
+          int index_k2,
+          int index_k,
+          int index_l,
+          int index_m,
+          int index_tt_E,
+          int index_tt_B,
+          double ** interpolated_sources_in_time,
+          struct transfer2_workspace * pw
+          );
+
+  int transfer2_rescale_and_store (
+          struct transfers2 * ptr2,
+          int index_k1,
+          int index_k2,
+          int index_k,
+          int index_l,
+          int index_tt,
+          double transfer
+          );
+
+  int transfer2_integrate_EB (
+        struct precision * ppr,
+        struct precision2 * ppr2,
+        struct bessels2 * pbs2,
+        struct perturbs2 * ppt2,
+        struct transfers2 * ptr2,
+        int index_l,
+        int index_m,
+        double ** interpolated_sources_in_time,
+        struct transfer2_workspace * pw,
+        double * E_to_E,
+        double * B_to_E,
+        double * B_to_B,
+        double * E_to_B
+        );
+
+  int transfer2_interpolate_J (
+        struct precision * ppr,
+        struct bessels2 * pbs2,
+        struct transfers2 * ptr2,
+        int index_J,
+        int index_L,
+        int index_l,
+        int index_m,
+        struct transfer2_workspace * pw,
+        double * J_in_time,
+        int * tau_size
+        );
+
   int transfer2_integrate (
         struct precision * ppr,
         struct precision2 * ppr2,
@@ -506,10 +654,36 @@ extern "C" {
   int transfer2_store_transfers_to_disk(
           struct perturbs2 * ppt2,
           struct transfers2 * ptr2,
-          int index_k1
+          int index_k1,
+          ErrorMsg error_message
+          );
+
+  int transfer2_compact_transfers(
+          struct perturbs2 * ppt2,
+          struct transfers2 * ptr2
+          );
+
+  int transfer2_k1_offsets(
+          struct perturbs2 * ppt2,
+          struct transfers2 * ptr2,
+          short is_compressed,
+          long int ** k1_offset
+          );
+
+  int transfer2_transfers_status_init(
+          struct precision2 * ppr2,
+          struct perturbs2 * ppt2,
+          struct transfers2 * ptr2
           );
 
   int transfer2_load_transfers_from_disk(
+          struct precision2 * ppr2,
+          struct perturbs2 * ppt2,
+          struct transfers2 * ptr2,
+          int index_tt
+          );
+
+  int transfer2_load_transfers_compressed(
           struct perturbs2 * ppt2,
           struct transfers2 * ptr2,
           int index_tt
@@ -517,6 +691,7 @@ extern "C" {
 
 
   int transfer2_allocate_type_level(
+       struct precision2 * ppr2,
        struct perturbs2 * ppt2,
        struct transfers2 * ptr2,
        int index_tt
@@ -529,6 +704,7 @@ extern "C" {
        );
 
   int transfer2_allocate_k1_level(
+       struct precision2 * ppr2,
        struct perturbs2 * ppt2,
        struct transfers2 * ptr2,
        int index_k1
@@ -537,7 +713,8 @@ extern "C" {
   int transfer2_free_k1_level(
        struct perturbs2 * ppt2,
        struct transfers2 * ptr2,
-       int index_k1
+       int index_k1,
+       ErrorMsg error_message
        );
 
 
@@ -7,9 +7,18 @@ This module defines a parent class called SongBinary as well as one child class
 type of binary file: {FixedTauFile, Fixedk1k2File}. SongBinary holds the general functions
 for manipulating the binary file, while the child class holds filetype specific methods
 and the initialisation procedure.
+
+The blocks are not read from the files: they are read-only views of a memory map of
+the file, so that only the parts that are actually used are loaded from disk. The
+class Fixedk1k2Stack gathers many files for fixed k1 and k2 in a single
+(k1,k2,k3,tau) array, which is read lazily.
 """
+import os
 import numpy as np
 
+# Binary maps of the files parsed so far, indexed by (path, size, modification time)
+_mapping_cache = {}
+
 class SongBinary:
     """
     This class holds the basic routines for manipulating the
@@ -27,41 +36,58 @@ class SongBinary:
         """
         Extracts the filemap from the header and store it in self.mapping.
         Also performs a test that self.filetype matches the actual file.
+        The header of each file is parsed only once; the mapping is then
+        reused until the file changes.
         """
         import re
-        f = open(self.filename)
-        line = f.readline()
+        stat = os.stat(self.filename)
+        key = (os.path.abspath(self.filename), stat.st_size, stat.st_mtime)
+        if key not in _mapping_cache:
+            f = open(self.filename)
+            firstline = line = f.readline()
+            while line.find('BLOCK')==-1:
+                line = f.readline()
+            line = f.readline()
+            mapping = []
+            while line[0]=='#':
+                tmp = re.split(r'\s{2,}', line)
+                mapping.append(tmp[1:])
+                line = f.readline()
+            f.close()
+            _mapping_cache[key] = (firstline, mapping)
+        firstline, self.mapping = _mapping_cache[key]
         #Check that the file type matches first line
-        if self.filetype not in line:
-            raise Exception('songy.'+self.__class__.__name__+' expects filetype <'+self.filetype+'>, but '+self.filename+' reports:\n'+line)
+        if self.filetype not in firstline:
+            raise Exception('songy.'+self.__class__.__name__+' expects filetype <'+self.filetype+'>, but '+self.filename+' reports:\n'+firstline)
+
+    def get_memmap(self):
+        """
+        Returns a read-only memory map of the whole file, as an array of bytes.
+        The file is mapped only once per object.
+        """
+        if not hasattr(self, 'memmap'):
+            self.memmap = np.memmap(self.filename, dtype='uint8', mode='r')
+        return self.memmap
 
-        while line.find('BLOCK')==-1:
-            line = f.readline()
-        line = f.readline()
-        self.mapping = []
-        while line[0]=='#':
-            tmp = re.split(r'\s{2,}', line)
-            self.mapping.append(tmp[1:])
-            line = f.readline()
-        f.close()
-        
     def read_block(self,blocknumber):
         """
         Read block [blocknumber] from the binary file using the binary map
         computed by self.get_binary_mapping(). If no mapping is found,
         the function will call self.get_binary_mapping().
+        The block is returned as a read-only view of the memory map of the
+        file, with the data type given in the binary map; no data is read
+        from disk until it is used. Unlike in the earlier versions of songy,
+        which read the block with np.fromfile, writing to the returned array
+        raises a ValueError; use np.array() to get a modifiable copy.
         """
         if not hasattr(self, 'mapping'):
             self.get_binary_mapping()
         mapelement = self.mapping[blocknumber];
-        f = open(self.filename,'rb')
-        f.seek(int(mapelement[4]))
         if mapelement[1][0]=='c':
-            val = np.fromfile(f,dtype='uint8', count=int(mapelement[2]), sep="")
+            dtype = np.dtype('uint8')
         else:
-            val = np.fromfile(f,dtype=mapelement[1][0], count=int(mapelement[2]), sep="")
-        f.close()
-        return val
+            dtype = np.dtype(mapelement[1][0])
+        return np.frombuffer(self.get_memmap(), dtype=dtype, count=int(mapelement[2]), offset=int(mapelement[4]))
 
     def get_name_array(self,blocknumnumber,blocknumnames):
         """
@@ -131,6 +157,112 @@ class Fixedk1k2File(SongBinary):
                 return val.reshape(len(self.tau),len(self.k3))
     
 
+class Fixedk1k2Stack:
+    """
+    This class gathers many SONG binary files for fixed k1 and k2 in a
+    single array indexed as [index_k1,index_k2,index_k3,index_tau].
+    The k1 and k2 values are sorted in increasing order and stored in
+    self.k1 and self.k2; the files must share the same time sampling,
+    self.tau. Since the k3 sampling depends on (k1,k2), the k3 values
+    are stored in self.k3[index_k1,index_k2], padded with NaN up to
+    the largest k3 size; the (k1,k2) pairs without a file are NaN, too.
+    Example:
+    import glob
+    stack = songy.Fixedk1k2Stack(glob.glob('output/sources_song_k*.dat'))
+    source = stack.get_source('T_00')
+    source[3,1]       # [Nk3 x Ntau] matrix, reading only one file
+    source[:,:,:,-1]  # all (k1,k2,k3) today, reading only the last tau
+    np.asarray(source) # the whole array
+    Only the headers are read when the stack is created; the files are
+    memory mapped only when a source is extracted, so that the number of
+    open files stays small.
+    """
+    def __init__(self,filenames):
+        self.filenames = list(filenames)
+        if len(self.filenames)==0:
+            raise Exception('songy.Fixedk1k2Stack needs at least one file')
+        k1 = []
+        k2 = []
+        k3 = []
+        for filename in self.filenames:
+            f = Fixedk1k2File(filename)
+            if not hasattr(self, 'tau'):
+                self.tau = np.array(f.tau)
+                self.sourcenames = f.sourcenames
+            elif len(f.tau)!=len(self.tau) or np.any(f.tau!=self.tau):
+                raise Exception('songy.Fixedk1k2Stack: '+filename+' has a different time sampling than '+self.filenames[0])
+            k1.append(f.k1)
+            k2.append(f.k2)
+            k3.append(np.array(f.k3))
+            del f
+        self.k1 = np.unique(k1)
+        self.k2 = np.unique(k2)
+        self.k3_size = max(len(k) for k in k3)
+        #self.fileidx[index_k1,index_k2] is the position of the file in self.filenames, or -1
+        self.fileidx = -np.ones((len(self.k1),len(self.k2)),dtype='int')
+        self.k3 = np.nan*np.ones((len(self.k1),len(self.k2),self.k3_size))
+        for i in range(len(self.filenames)):
+            index_k1 = np.searchsorted(self.k1,k1[i])
+            index_k2 = np.searchsorted(self.k2,k2[i])
+            self.fileidx[index_k1,index_k2] = i
+            self.k3[index_k1,index_k2,:len(k3[i])] = k3[i]
+        self.shape = (len(self.k1),len(self.k2),self.k3_size,len(self.tau))
+
+    def get_source(self,sourcename):
+        """
+        Returns the source with name <sourcename> as a Fixedk1k2StackSource
+        object, that behaves like a [Nk1 x Nk2 x Nk3 x Ntau] array whose
+        values are read from the files only when indexed. For a list of all
+        possible source names, see self.sourcenames.
+        """
+        return Fixedk1k2StackSource(self,sourcename)
+
+
+class Fixedk1k2StackSource:
+    """
+    A second-order source of a Fixedk1k2Stack, read lazily. Indexing it
+    with integers and slices returns a numpy array, after reading only the
+    files of the selected (k1,k2) pairs, and in each file only the rows of
+    the selected times. The Ellipsis is not supported.
+    """
+    def __init__(self,stack,sourcename):
+        self.stack = stack
+        self.sourcename = sourcename
+        self.shape = stack.shape
+        self.ndim = 4
+        self.dtype = np.dtype('float64')
+
+    def __len__(self):
+        return self.shape[0]
+
+    def __getitem__(self,key):
+        if not isinstance(key,tuple):
+            key = (key,)
+        key = key + (slice(None),)*(4-len(key))
+        indices = [np.arange(self.shape[axis])[key[axis]] for axis in range(4)]
+        #Remember which axes are dropped by the indexing
+        squeeze = tuple(0 if np.ndim(idx)==0 else slice(None) for idx in indices)
+        indices_k1, indices_k2, indices_k3, indices_tau = [np.atleast_1d(idx) for idx in indices]
+        val = np.nan*np.ones((len(indices_k1),len(indices_k2),len(indices_k3),len(indices_tau)))
+        for a in range(len(indices_k1)):
+            for b in range(len(indices_k2)):
+                i = self.stack.fileidx[indices_k1[a],indices_k2[b]]
+                if i<0:
+                    continue
+                source = Fixedk1k2File(self.stack.filenames[i]).get_source(self.sourcename)
+                #The k3 values beyond the size of this file are padding
+                has_k3 = indices_k3<source.shape[1]
+                #Select the times first, so that only their rows are read from the file
+                val[a,b,has_k3,:] = source[indices_tau][:,indices_k3[has_k3]].T
+        return val[squeeze]
+
+    def __array__(self,dtype=None):
+        val = self[:]
+        if dtype is not None:
+            val = val.astype(dtype)
+        return val
+
+
 class FixedTauFile(SongBinary):
     """
     This class is used for accessing SONG binary files for fixed tau or z.
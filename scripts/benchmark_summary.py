@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+
+"""Summarise the run reports written by scripts/song_benchmark.sh.
+
+Usage:
+
+  scripts/benchmark_summary.py benchmark_folder [--compare baseline_folder]
+                                                [--tolerance 0.05]
+
+For each benchmark case and number of threads, print the wall time of the
+stages, the throughput of the timed kernels (modes per second for
+perturb2_solve, integrals per second for transfer2_compute, evaluations
+per second for bessel2_J and triangles per second for bispectra2_intrinsic)
+and the parallel efficiency with respect to the smallest number of threads.
+When a run was repeated, the fastest repetition is used.
+
+With --compare, print the relative change of each quantity with respect to
+the baseline folder, typically produced by the same script on an earlier
+commit, and exit with status 1 if any stage became slower, or any kernel
+less efficient, by more than the tolerance.
+"""
+
+import argparse
+import glob
+import json
+import os
+import sys
+
+
+def load_reports(folder):
+  """Return {(case, threads): {'stages': {name: wall_time}, 'regions': {name: (throughput, unit)}}}"""
+
+  results = {}
+
+  for path in glob.glob(os.path.join(folder, '*', 'threads_*', 'run_*', 'run_report.json')):
+
+    run_folder = os.path.dirname(path)
+    threads_folder = os.path.dirname(run_folder)
+    case = os.path.basename(os.path.dirname(threads_folder))
+    threads = int(os.path.basename(threads_folder).split('_')[1])
+
+    with open(path) as f:
+      report = json.load(f)
+
+    result = results.setdefault((case, threads), {'stages': {}, 'regions': {}})
+
+    # Keep the fastest repetition of each stage and kernel
+    for stage in report['stages']:
+      old = result['stages'].get(stage['name'])
+      if old is None or stage['wall_time'] < old:
+        result['stages'][stage['name']] = stage['wall_time']
+
+    for region in report['regions']:
+      if 'throughput' not in region:
+        continue
+      old = result['regions'].get(region['name'])
+      if old is None or region['throughput'] > old[0]:
+        result['regions'][region['name']] = (region['throughput'], region['work_unit'])
+
+  return results
+
+
+def print_summary(results):
+
+  for case in sorted(set(case for case, threads in results)):
+
+    thread_list = sorted(threads for c, threads in results if c == case)
+    reference = results[(case, thread_list[0])]
+
+    print('\n=== %s ===' % case)
+
+    print('\n  %-30s' % 'stage wall time [s]' + ''.join('%12s' % ('%d thr' % n) for n in thread_list))
+    for name in reference['stages']:
+      print('  %-30s' % name + ''.join('%12.4g' % results[(case, n)]['stages'].get(name, float('nan'))
+        for n in thread_list))
+
+    print('\n  %-30s' % 'kernel throughput [1/s]' + ''.join('%12s' % ('%d thr' % n) for n in thread_list)
+      + '%14s' % 'efficiency')
+    for name, (throughput, unit) in sorted(reference['regions'].items()):
+      values = [results[(case, n)]['regions'].get(name, (float('nan'), unit))[0] for n in thread_list]
+      # Parallel efficiency of the largest number of threads with respect to the smallest
+      efficiency = (values[-1]/values[0]) * thread_list[0]/thread_list[-1] if values[0] > 0 else float('nan')
+      print('  %-30s' % ('%s (%s)' % (name, unit)) + ''.join('%12.4g' % v for v in values)
+        + '%14.2f' % efficiency)
+
+
+def compare(results, baseline, tolerance):
+  """Print the relative changes with respect to the baseline and return the number of regressions"""
+
+  regressions = 0
+
+  print('\n=== comparison with baseline (tolerance %g%%) ===\n' % (100*tolerance))
+
+  for key in sorted(results):
+
+    if key not in baseline:
+      continue
+
+    case, threads = key
+    new, old = results[key], baseline[key]
+
+    for name, time in new['stages'].items():
+      if name not in old['stages'] or old['stages'][name] <= 0:
+        continue
+      change = time/old['stages'][name] - 1
+      flag = change > tolerance
+      regressions += flag
+      print('  %-8s %3d thr  %-30s time %+7.1f%%%s' % (case, threads, name, 100*change,
+        '  <- SLOWER' if flag else ''))
+
+    for name, (throughput, unit) in new['regions'].items():
+      if name not in old['regions'] or old['regions'][name][0] <= 0:
+        continue
+      change = throughput/old['regions'][name][0] - 1
+      flag = change < -tolerance
+      regressions += flag
+      print('  %-8s %3d thr  %-30s throughput %+7.1f%%%s' % (case, threads, name, 100*change,
+        '  <- SLOWER' if flag else ''))
+
+  return regressions
+
+
+if __name__ == '__main__':
+
+  parser = argparse.ArgumentParser(description='Summarise the output of scripts/song_benchmark.sh')
+  parser.add_argument('folder', help='output folder of song_benchmark.sh')
+  parser.add_argument('--compare', metavar='baseline', help='output folder of a baseline benchmark')
+  parser.add_argument('--tolerance', type=float, default=0.05,
+    help='relative slowdown above which a change is reported as a regression (default 0.05)')
+  args = parser.parse_args()
+
+  results = load_reports(args.folder)
+
+  if not results:
+    sys.exit('No run reports found in %s' % args.folder)
+
+  print_summary(results)
+
+  if args.compare:
+    regressions = compare(results, load_reports(args.compare), args.tolerance)
+    if regressions:
+      print('\n%d regressions found' % regressions)
+      sys.exit(1)
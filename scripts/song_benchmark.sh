@@ -0,0 +1,120 @@
+#! /bin/sh
+
+## Run a reproducible benchmark of SONG and collect its run reports.
+##
+## Usage:
+##
+##   scripts/song_benchmark.sh [output_folder] [thread counts]
+##
+## For example, "scripts/song_benchmark.sh benchmark "1 2 4 8"" runs all the
+## cases below with 1, 2, 4 and 8 OpenMP threads. The defaults are the folder
+## 'benchmark' and a sweep from 1 thread to the number of cores in powers of 2.
+## The cases to run and the number of repetitions of each run can be set with
+## the environment variables BENCHMARK_CASES (default "quick sn_t sn_pol") and
+## BENCHMARK_REPEAT (default 1).
+##
+## Each case is a scaled-down version of one of the shipped parameter files,
+## with the intrinsic bispectrum as the only output. The parameter files of each
+## case are written to output_folder/<case>, and each run writes its
+## run_report.json file (see write_run_report in explanatory.ini) to
+## output_folder/<case>/threads_<n>/run_<i>. All caches are disabled, so that
+## the runs do not depend on the state of the disk.
+##
+## The results can be summarised, or compared with those of another commit, with
+## scripts/benchmark_summary.py:
+##
+##   scripts/benchmark_summary.py benchmark
+##   scripts/benchmark_summary.py benchmark --compare benchmark_baseline
+
+output=${1:-benchmark}
+threads=$2
+cases=${BENCHMARK_CASES:-"quick sn_t sn_pol"}
+repeat=${BENCHMARK_REPEAT:-1}
+
+if [ -z "$threads" ]; then
+  cores=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)
+  threads=1
+  n=2
+  while [ $n -le $cores ]; do
+    threads="$threads $n"
+    n=$((n*2))
+  done
+fi
+
+if [ ! -x ./song ]; then
+  echo "Run this script from the SONG folder, after compiling song with 'make song'"
+  exit 1
+fi
+
+mkdir -p $output
+
+## Set key = value in a parameter file, replacing any previous setting
+set_parameter () {
+  sed -i.bak "/^[[:space:]]*$2[[:space:]]*=/d" $1 && rm -f $1.bak
+  echo "$2 = $3" >> $1
+}
+
+## Record what was benchmarked
+{
+  echo "commit = $(git rev-parse HEAD 2>/dev/null)"
+  echo "date = $(date)"
+  echo "host = $(uname -n)"
+  echo "cores = $(getconf _NPROCESSORS_ONLN 2>/dev/null)"
+  echo "threads = $threads"
+  echo "cases = $cases"
+  echo "repeat = $repeat"
+} > $output/benchmark_info.txt
+
+for case in $cases; do
+
+  ## Scaled-down versions of the shipped precision files
+  case $case in
+    quick)  pre=pre/quick_song_run.pre;          out="tBisp";        l_max=100 ;;
+    sn_t)   pre=pre/sn_t_5percent_lmax2000.pre;  out="tBisp";        l_max=400 ;;
+    sn_pol) pre=pre/sn_pol_10percent_lmax2000.pre; out="tBisp, eBisp"; l_max=400 ;;
+    *) echo "Unknown benchmark case '$case'"; exit 1 ;;
+  esac
+
+  mkdir -p $output/$case
+  ini_file=$output/$case/benchmark.ini
+  pre_file=$output/$case/benchmark.pre
+
+  cp ini/intrinsic.ini $ini_file
+  cp $pre $pre_file
+
+  sed -i.bak 's/^\([[:alnum:]_]*_verbose\)[[:space:]]*=.*/\1 = 0/' $ini_file && rm -f $ini_file.bak
+  set_parameter $ini_file output "$out"
+  set_parameter $ini_file bispectrum_types intrinsic
+  set_parameter $ini_file write_run_report yes
+  set_parameter $ini_file store_run no
+  set_parameter $ini_file store_sources no
+  set_parameter $ini_file store_transfers no
+  set_parameter $ini_file store_bispectra no
+  set_parameter $ini_file run_cache_dir ""
+
+  set_parameter $pre_file l_max_scalars $l_max
+  set_parameter $pre_file projection_functions_cache_dir ""
+  set_parameter $pre_file geometrical_factors_cache_dir ""
+
+  for n in $threads; do
+    i=1
+    while [ $i -le $repeat ]; do
+
+      run=$output/$case/threads_$n/run_$i
+      mkdir -p $run
+      set_parameter $ini_file root "$run/"
+
+      echo "Running case $case with $n threads ($i/$repeat)"
+      OMP_NUM_THREADS=$n ./song $ini_file $pre_file > $run/log.txt 2>&1
+
+      if [ $? -ne 0 ] || [ ! -f $run/run_report.json ]; then
+        echo "SONG failed for case $case with $n threads, see $run/log.txt"
+        exit 1
+      fi
+
+      i=$((i+1))
+    done
+  done
+done
+
+echo "Done; summarise with scripts/benchmark_summary.py $output"
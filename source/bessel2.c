@@ -29,6 +29,10 @@
  */
 
 #include "bessel2.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 
 
@@ -85,6 +89,13 @@ int bessel2_init(
   // =                               Preparations                                 =
   // ==============================================================================
 
+  /* The projection functions are replicated at the end of this function, if requested */
+  pbs2->J_replica_size = 0;
+  pbs2->J_Llm_x_replica = NULL;
+  pbs2->ddJ_Llm_x_replica = NULL;
+  pbs2->J_Llm_x_float_replica = NULL;
+  pbs2->ddJ_Llm_x_float_replica = NULL;
+
   /* Do we need to compute the 2nd-order projection functions? */
   if ((pbs->l_max==0) || ((ppt2->has_cmb_spectra==_FALSE_) && (ppt2->has_cmb_bispectra==_FALSE_))
     || ((ppr2->load_transfers_from_disk==_TRUE_) && (ppr->load_bispectra_from_disk==_TRUE_))) {
@@ -101,6 +112,16 @@ int bessel2_init(
 
   /* Initialize counter for the memory allocated in the projection functions */
   pbs2->count_allocated_Js = 0;
+  pbs2->count_compact_Js = 0;
+  pbs2->count_released_Js = 0;
+  pbs2->compact_J_max_error = 0;
+
+  /* Should the projection functions be stored in single precision? */
+  pbs2->has_compact_J = ppr2->compact_projection_functions;
+
+  /* Should each projection function be stored on its own x-grid? */
+  pbs2->has_adaptive_J = (ppr2->bessel_J_adaptive_tol_song > 0);
+  pbs2->J_adaptive_tol = ppr2->bessel_J_adaptive_tol_song;
 
   /* Determine minimum allowed values of the Bessels and of the J's */
   pbs2->j_l1_cut  = ppr2->bessel_j_cut_song;
@@ -200,20 +221,56 @@ int bessel2_init(
   if (pbs2->bessels2_verbose > 1)
     printf (" -> computing spherical Bessel functions in l1\n");
 
-  /* Compute j_l1(x) in a parallel loop over l1 */
+  /* Each thread keeps its own memory counters, which are added to those in pbs2 at the
+  end of each parallel loop */
+  int number_of_threads = 1;
+  #ifdef _OPENMP
+  number_of_threads = omp_get_max_threads();
+  #endif
+
+  struct bessel2_counters * counters;
+  class_calloc (counters, number_of_threads, sizeof(struct bessel2_counters), pbs2->error_message);
+
+  /* Compute j_l1(x) in a parallel loop over l1, together with its second derivative
+  in view of the spline interpolation */
   int abort = _FALSE_;
   #pragma omp parallel for schedule (dynamic)
   for (int index_l1 = 0; index_l1 < pbs2->l1_size; index_l1++) {
 
-    class_call_parallel (bessel2_j_for_l1 (ppr,ppr2,pbs,pbs2,index_l1),
+    int thread = 0;
+    #ifdef _OPENMP
+    thread = omp_get_thread_num();
+    #endif
+
+    class_call_parallel (bessel2_j_for_l1 (ppr,ppr2,pbs,pbs2,index_l1,&counters[thread]),
       pbs2->error_message,
       pbs2->error_message);
 
+    if (ppr->bessels_interpolation == cubic_interpolation) {
+
+      class_call_parallel (array_spline_table_one_column(
+                             pbs2->xx + pbs2->index_xmin_l1[index_l1],
+                             pbs2->x_size_l1[index_l1],
+                             pbs2->j_l1[index_l1],
+                             1,                                                 /* Not used */    
+                             0,                                                 /* We need to spline just one function */   
+                             pbs2->ddj_l1[index_l1],
+                             _SPLINE_NATURAL_,
+                             pbs2->error_message
+                             ),
+        pbs2->error_message,
+        pbs2->error_message);
+    }
+
     #pragma omp flush(abort)
 
   }
   if (abort == _TRUE_) return _FAILURE_;
 
+  class_call (bessel2_add_counters (pbs2, number_of_threads, counters),
+    pbs2->error_message,
+    pbs2->error_message);
+
   /* Debug - Check the computation of the Bessel functions */
   // {
   //   double j;
@@ -232,6 +289,7 @@ int bessel2_init(
     if (pbs2->bessels2_verbose > 0)
       printf (" -> No second-order projection functions needed.\n");
 
+    free (counters);
     return _SUCCESS_;
   }
 
@@ -260,6 +318,13 @@ int bessel2_init(
   class_alloc (pbs2->J_Llm_x,  pbs2->J_size*sizeof(double****), pbs2->error_message);
   if (ppr->bessels_interpolation == cubic_interpolation)
     class_alloc (pbs2->ddJ_Llm_x,  pbs2->J_size*sizeof(double****), pbs2->error_message);
+  if (pbs2->has_compact_J == _TRUE_) {
+    class_alloc (pbs2->J_Llm_x_float,  pbs2->J_size*sizeof(float****), pbs2->error_message);
+    if (ppr->bessels_interpolation == cubic_interpolation)
+      class_alloc (pbs2->ddJ_Llm_x_float,  pbs2->J_size*sizeof(float****), pbs2->error_message);
+  }
+  if (pbs2->has_adaptive_J == _TRUE_)
+    class_alloc (pbs2->J_segments,  pbs2->J_size*sizeof(struct bessel2_segment ****), pbs2->error_message);
 
   for (int index_J = 0; index_J < pbs2->J_size; ++index_J) {
 
@@ -270,6 +335,13 @@ int bessel2_init(
     class_alloc (pbs2->J_Llm_x[index_J],  pbs2->L_size*sizeof(double***), pbs2->error_message);
     if (ppr->bessels_interpolation == cubic_interpolation)
       class_alloc (pbs2->ddJ_Llm_x[index_J],  pbs2->L_size*sizeof(double***), pbs2->error_message);
+    if (pbs2->has_compact_J == _TRUE_) {
+      class_alloc (pbs2->J_Llm_x_float[index_J],  pbs2->L_size*sizeof(float***), pbs2->error_message);
+      if (ppr->bessels_interpolation == cubic_interpolation)
+        class_alloc (pbs2->ddJ_Llm_x_float[index_J],  pbs2->L_size*sizeof(float***), pbs2->error_message);
+    }
+    if (pbs2->has_adaptive_J == _TRUE_)
+      class_alloc (pbs2->J_segments[index_J],  pbs2->L_size*sizeof(struct bessel2_segment ***), pbs2->error_message);
   
     /* l-level */
     for (int index_L=0; index_L<pbs2->L_size; ++index_L) {
@@ -280,6 +352,13 @@ int bessel2_init(
       class_alloc (pbs2->J_Llm_x[index_J][index_L], pbs->l_size*sizeof(double**), pbs2->error_message);
       if (ppr->bessels_interpolation == cubic_interpolation)
         class_alloc (pbs2->ddJ_Llm_x[index_J][index_L], pbs->l_size*sizeof(double**), pbs2->error_message);
+      if (pbs2->has_compact_J == _TRUE_) {
+        class_alloc (pbs2->J_Llm_x_float[index_J][index_L], pbs->l_size*sizeof(float**), pbs2->error_message);
+        if (ppr->bessels_interpolation == cubic_interpolation)
+          class_alloc (pbs2->ddJ_Llm_x_float[index_J][index_L], pbs->l_size*sizeof(float**), pbs2->error_message);
+      }
+      if (pbs2->has_adaptive_J == _TRUE_)
+        class_alloc (pbs2->J_segments[index_J][index_L], pbs->l_size*sizeof(struct bessel2_segment **), pbs2->error_message);
   
       /* m-level */
       for (int index_l=0; index_l<pbs->l_size; ++index_l) {
@@ -293,6 +372,13 @@ int bessel2_init(
         class_alloc (pbs2->J_Llm_x[index_J][index_L][index_l], m_size*sizeof(double*), pbs2->error_message);
         if (ppr->bessels_interpolation == cubic_interpolation)
           class_alloc (pbs2->ddJ_Llm_x[index_J][index_L][index_l], m_size*sizeof(double*), pbs2->error_message);
+        if (pbs2->has_compact_J == _TRUE_) {
+          class_calloc (pbs2->J_Llm_x_float[index_J][index_L][index_l], m_size, sizeof(float*), pbs2->error_message);
+          if (ppr->bessels_interpolation == cubic_interpolation)
+            class_calloc (pbs2->ddJ_Llm_x_float[index_J][index_L][index_l], m_size, sizeof(float*), pbs2->error_message);
+        }
+        if (pbs2->has_adaptive_J == _TRUE_)
+          class_calloc (pbs2->J_segments[index_J][index_L][index_l], m_size, sizeof(struct bessel2_segment *), pbs2->error_message);
 
       } // end of for(index_l)
     } // end of for(index_L)
@@ -300,6 +386,40 @@ int bessel2_init(
 
 
 
+  // ====================================================================================
+  // =                                 Look up the cache                                =
+  // ====================================================================================
+
+  /* The projection functions depend only on the multipole and x sampling, and not on
+  the cosmological parameters. If the user provided a cache directory, look there for
+  projection functions computed in a previous run with the same sampling */
+  pbs2->has_J_cache = ppr2->cache_projection_functions;
+  pbs2->J_cache_map = NULL;
+  pbs2->J_cache_map_is_kept = _FALSE_;
+  short found_in_cache = _FALSE_;
+
+  /* Look first among the projection functions kept in memory by a previous run in
+  the same process, if any (see pbs2->kept_J) */
+  if ((pbs2->kept_J != NULL) && (pbs2->kept_J->data != NULL)) {
+
+    class_call (bessel2_cache_attach (ppr, ppr2, pbs, pbs2, pbs2->kept_J->data, pbs2->kept_J->size,
+                  &found_in_cache),
+      pbs2->error_message,
+      pbs2->error_message);
+
+    pbs2->J_cache_map_is_kept = found_in_cache;
+
+    if ((pbs2->bessels2_verbose > 1) && found_in_cache)
+      printf (" -> reusing the projection functions kept in memory by a previous run\n");
+  }
+
+  if ((pbs2->has_J_cache == _TRUE_) && !found_in_cache)
+    class_call (bessel2_cache_load (ppr, ppr2, pbs, pbs2, &found_in_cache),
+      pbs2->error_message,
+      pbs2->error_message);
+
+
+
   // ====================================================================================
   // =                                    Compute J                                     =
   // ====================================================================================
@@ -310,68 +430,115 @@ int bessel2_init(
   We shall denote it as J_Llm(x). There are three types of projection functions:
   temperature (J_TT), polarisation (J_EE) and polarisation mixing (J_EB). For more
   detail, see Sec. 5.5.1.4 of http://arxiv.org/abs/1405.2280. */
-  
-  /* Loop on the type of projection function */
-  for (int index_J = 0; index_J < pbs2->J_size; ++index_J) {
-  
-    if (pbs2->bessels2_verbose > 1)
-      printf (" -> computing the projection function #%d\n", index_J);
-  
-    /* Loop on the source index L */
-    for (int index_L = 0; index_L < pbs2->L_size; ++index_L) {
-      
-      /* Parallel loop on the multipole index l */
-      abort = _FALSE_;
-      #pragma omp parallel for schedule (dynamic)
-      for (int index_l = 0; index_l < pbs->l_size; ++index_l) {
-      
-        /* There are two important consideration to take into account when dealing with
-        the m!=0 case.  First, not all m-values are allowed: abs(m) should be smaller than
-        MIN(L,l).  Secondly, there is no need to compute J_Llm(x) for negative m, because 
-        it can be obtained by flipping the sign of the second line of one of the 3j, thus
-        yielding a (-1)^(l+l1+L) sign. The factor l+l1+L is even for the direct projection
-        functions (TT, EE and BB), while it is odd for the mixing ones (EB and BE). This 
-        property comes from the the definition of H_X_X' in Beneke & Fidler 2010 (below eq. B.9).
-        As a result:
-
-        J_TT_Ll-m = J_TT_Llm
-        J_EE_Ll-m = J_EE_Llm
-        J_BB_Ll-m = J_BB_Llm
-        J_EB_Ll-m = - J_EB_Llm
-        J_BE_Ll-m = - J_BE_Llm.
-
-        It follows from the above relations that for m=0, both J_EB and J_BE vanish.  */
-        int index_m_max = MIN (ppr2->index_m_max[pbs2->L[index_L]], ppr2->index_m_max[pbs->l[index_l]]);
-      
-        /* Loop on the azimuthal index m */
-        for (int index_m = 0; index_m <= index_m_max; ++index_m) {
-  
-          int L = pbs2->L[index_L];
-          int l = pbs->l[index_l];
-          int m = pbs2->m[index_m];
-
-          class_test_parallel (abs(m) > MIN(L,l),
-            pbs2->error_message,
-            "abs(m) should always be smaller that MIN(L,l), check ppr2->index_m_max");
-                     
-          class_call_parallel (bessel2_J_for_Llm(
-                    ppr,
-                    ppr2,
-                    pbs,
-                    pbs2,
-                    index_J,
-                    index_L,
-                    index_l,
-                    index_m),
-               pbs2->error_message,
-               pbs2->error_message);     
-
-        } // end of for(index_m)
-        #pragma omp flush(abort)    
-      } // end of for(index_l)
-      if (abort == _TRUE_) return _FAILURE_;  // end of parallel region
-    } // end of for(index_L)
-  } // end of loop on type of projection functions
+
+  /* All the (J,L,l,m) configurations are computed in a single parallel loop, starting
+  from the most expensive ones, so that the threads are not left idle at the end of the
+  loop; see bessel2_J_queue(). Each thread computes J_Llm(x) and, if needed, its second
+  derivative for one configuration at a time. */
+  struct bessel2_J_task * tasks;
+  int task_size;
+
+  class_call (bessel2_J_queue (ppr2, pbs, pbs2, &task_size, &tasks),
+    pbs2->error_message,
+    pbs2->error_message);
+
+  /* Time spent by each thread computing the projection functions */
+  int index_region;
+  class_call (run_report_region (&(ppr2->report), "bessel2_J", "evaluations", number_of_threads,
+                &index_region, pbs2->error_message),
+    pbs2->error_message,
+    pbs2->error_message);
+
+  double region_start = run_report_time();
+
+  /* There is nothing to compute if the projection functions were read from the cache,
+  which also contains their second derivatives */
+  abort = _FALSE_;
+  #pragma omp parallel for schedule (dynamic,1)
+  for (int index_task = 0; index_task < (found_in_cache ? 0 : task_size); ++index_task) {
+
+    int thread = 0;
+    #ifdef _OPENMP
+    thread = omp_get_thread_num();
+    #endif
+
+    double busy_start = run_report_time();
+
+    int index_J = tasks[index_task].index_J;
+    int index_L = tasks[index_task].index_L;
+    int index_l = tasks[index_task].index_l;
+    int index_m = tasks[index_task].index_m;
+
+    /* There are two important consideration to take into account when dealing with
+    the m!=0 case.  First, not all m-values are allowed: abs(m) should be smaller than
+    MIN(L,l).  Secondly, there is no need to compute J_Llm(x) for negative m, because 
+    it can be obtained by flipping the sign of the second line of one of the 3j, thus
+    yielding a (-1)^(l+l1+L) sign. The factor l+l1+L is even for the direct projection
+    functions (TT, EE and BB), while it is odd for the mixing ones (EB and BE). This 
+    property comes from the the definition of H_X_X' in Beneke & Fidler 2010 (below eq. B.9).
+    As a result:
+
+    J_TT_Ll-m = J_TT_Llm
+    J_EE_Ll-m = J_EE_Llm
+    J_BB_Ll-m = J_BB_Llm
+    J_EB_Ll-m = - J_EB_Llm
+    J_BE_Ll-m = - J_BE_Llm.
+
+    It follows from the above relations that for m=0, both J_EB and J_BE vanish.  */
+    class_test_parallel (abs(pbs2->m[index_m]) > MIN(pbs2->L[index_L],pbs->l[index_l]),
+      pbs2->error_message,
+      "abs(m) should always be smaller that MIN(L,l), check ppr2->index_m_max");
+               
+    class_call_parallel (bessel2_J_for_Llm(
+              ppr,
+              ppr2,
+              pbs,
+              pbs2,
+              index_J,
+              index_L,
+              index_l,
+              index_m,
+              &counters[thread]),
+         pbs2->error_message,
+         pbs2->error_message);     
+
+    /* Compute second derivatives of J_Llm(x) in view of the spline interpolation. 
+    The J will be used in the second-order transfer module to solve the line of sight
+    integral. */
+    if ((ppr->bessels_interpolation == cubic_interpolation) && (abort == _FALSE_)) {
+
+      /* TODO: Here I am doing a bit of free style, find a criterion */
+      int SPLINE_METHOD = (pbs->l[index_l]==2 ? _SPLINE_EST_DERIV_:_SPLINE_NATURAL_);
+
+      class_call_parallel (array_spline_table_one_column(
+                             pbs2->xx + pbs2->index_xmin_J[index_J][index_L][index_l][index_m],
+                             pbs2->x_size_J[index_J][index_L][index_l][index_m],
+                             pbs2->J_Llm_x[index_J][index_L][index_l][index_m],
+                             1,         /* Not used */    
+                             0,         /* We need to spline just one function */   
+                             pbs2->ddJ_Llm_x[index_J][index_L][index_l][index_m],
+                             SPLINE_METHOD,
+                             pbs2->error_message
+                             ),
+        pbs2->error_message,
+        pbs2->error_message);
+    }
+
+    /* Number of points where J_Llm(x) was evaluated */
+    if (abort == _FALSE_)
+      ppr2->report.regions[index_region].work[thread] += pbs2->x_size_J[index_J][index_L][index_l][index_m];
+
+    ppr2->report.regions[index_region].busy_time[thread] += run_report_time() - busy_start;
+
+    #pragma omp flush(abort)
+
+  } if (abort == _TRUE_) return _FAILURE_;  // end of parallel region
+
+  ppr2->report.regions[index_region].wall_time += run_report_time() - region_start;
+
+  class_call (bessel2_add_counters (pbs2, number_of_threads, counters),
+    pbs2->error_message,
+    pbs2->error_message);
   
   /* Determine the maximum size of the x-level in pbs2->J_Llm_x */
   pbs2->x_size_max_J = 0;
@@ -382,85 +549,132 @@ int bessel2_init(
           pbs2->x_size_max_J = MAX (pbs2->x_size_max_J, pbs2->x_size_J[index_J][index_L][index_l][index_m]);
   
   /* Print information on the used memory */
-  if (pbs2->bessels2_verbose > 1)
+  if ((pbs2->bessels2_verbose > 1) && !found_in_cache)
     printf (" -> memory in use to store the 2nd-order projection functions: ~ %3g MB\n",
     8*pbs2->count_allocated_Js/1e6);
 
 
 
   // ====================================================================================
-  // =                               Spline interpolation                               =
+  // =                                  Store the cache                                 =
   // ====================================================================================
-  
-  if (ppr->bessels_interpolation == cubic_interpolation) {
-    
-    /* Compute second derivatives of the J_Llm in view of the spline interpolation. 
-    The J will be used in the second-order transfer module to solve the line of sight
-    integral. */
-    
-    for (int index_J = 0; index_J < pbs2->J_size; ++index_J) {
 
-      for (int index_L = 0; index_L < pbs2->L_size; ++index_L) {
+  /* Save the projection functions to the cache directory, so that subsequent runs with
+  the same sampling can skip their computation */
+  if ((pbs2->has_J_cache == _TRUE_) && !found_in_cache)
+    class_call (bessel2_cache_store (ppr, ppr2, pbs, pbs2),
+      pbs2->error_message,
+      pbs2->error_message);
 
-        /* Beginning of parallel region */
-        int abort = _FALSE_;    
-        #pragma omp parallel for schedule (dynamic)
-        for (int index_l = 0; index_l < pbs->l_size; ++index_l) {
+  /* Keep them also in memory, for the next runs in the same process */
+  if ((pbs2->kept_J != NULL) && !found_in_cache)
+    class_call (bessel2_cache_keep (ppr, ppr2, pbs, pbs2),
+      pbs2->error_message,
+      pbs2->error_message);
 
-          int index_m_max = MIN (ppr2->index_m_max[pbs2->L[index_L]], ppr2->index_m_max[pbs->l[index_l]]);
-      
-          for (int index_m = 0; index_m <= index_m_max; ++index_m) {
 
-            /* TODO: Here I am doing a bit of free style, find a criterion */
-            int SPLINE_METHOD = (pbs->l[index_l]==2 ? _SPLINE_EST_DERIV_:_SPLINE_NATURAL_);
-
-            class_call_parallel (array_spline_table_one_column(
-                                   pbs2->xx + pbs2->index_xmin_J[index_J][index_L][index_l][index_m],
-                                   pbs2->x_size_J[index_J][index_L][index_l][index_m],
-                                   pbs2->J_Llm_x[index_J][index_L][index_l][index_m],
-                                   1,         /* Not used */    
-                                   0,         /* We need to spline just one function */   
-                                   pbs2->ddJ_Llm_x[index_J][index_L][index_l][index_m],
-                                   SPLINE_METHOD,
-                                   pbs2->error_message
-                                   ),
-              pbs2->error_message,
-              pbs2->error_message);
-
-          } // end of for(index_m)
-        #pragma omp flush(abort)
-        } // end of for(index_l)
-        if (abort == _TRUE_) return _FAILURE_;
-      } // end of for(index_L)
-    } // end of loop of projection function type
-
-
-    /* Compute second derivatives of the j1_l in view of the spline interpolation. */
-
-    #pragma omp parallel for shared(pbs,abort)
-    for (int index_l1 = 0; index_l1 < pbs2->l1_size; ++index_l1) {
-
-        int SPLINE_METHOD = _SPLINE_NATURAL_;
-
-        class_call_parallel (array_spline_table_one_column(
-                               pbs2->xx + pbs2->index_xmin_l1[index_l1],
-                               pbs2->x_size_l1[index_l1],
-                               pbs2->j_l1[index_l1],
-                               1,                                                 /* Not used */    
-                               0,                                                 /* We need to spline just one function */   
-                               pbs2->ddj_l1[index_l1],
-                               SPLINE_METHOD,
-                               pbs2->error_message
-                               ),
+
+  // ====================================================================================
+  // =                      Adaptive sampling & single-precision storage                =
+  // ====================================================================================
+
+  /* Resample each projection function on a grid that is coarser where J_Llm(x) is
+  smooth, and then convert it to single precision. As for the cache, this is done after
+  the spline interpolation, which needs J in double precision on the full grid, and after
+  storing the cache, so that the cache does not depend on the tolerance and is always in
+  double precision. Both operations act on one projection function at a time, so they
+  are performed in the same parallel loop over the configurations of the queue. */
+  if ((pbs2->has_adaptive_J == _TRUE_) || (pbs2->has_compact_J == _TRUE_)) {
+
+    pbs2->count_adaptive_Js = 0;
+
+    abort = _FALSE_;
+    #pragma omp parallel for schedule (dynamic,1)
+    for (int index_task = 0; index_task < task_size; ++index_task) {
+
+      int thread = 0;
+      #ifdef _OPENMP
+      thread = omp_get_thread_num();
+      #endif
+
+      int index_J = tasks[index_task].index_J;
+      int index_L = tasks[index_task].index_L;
+      int index_l = tasks[index_task].index_l;
+      int index_m = tasks[index_task].index_m;
+
+      if (pbs2->has_adaptive_J == _TRUE_)
+        class_call_parallel (bessel2_adapt_J (
+                               ppr,
+                               pbs2,
+                               index_J,
+                               index_L,
+                               index_l,
+                               index_m,
+                               &counters[thread]),
+          pbs2->error_message,
+          pbs2->error_message);
+
+      if ((pbs2->has_compact_J == _TRUE_) && (abort == _FALSE_))
+        class_call_parallel (bessel2_compact_J (
+                               ppr,
+                               pbs2,
+                               index_J,
+                               index_L,
+                               index_l,
+                               index_m,
+                               &counters[thread]),
           pbs2->error_message,
           pbs2->error_message);
 
       #pragma omp flush(abort)
+
+    } if (abort == _TRUE_) return _FAILURE_;  // end of parallel region
+
+    class_call (bessel2_add_counters (pbs2, number_of_threads, counters),
+      pbs2->error_message,
+      pbs2->error_message);
+
+    /* The leaves of pbs2->J_Llm_x are now allocated, and the projection functions read
+    from the cache are not needed anymore */
+    class_call (bessel2_cache_release (pbs2),
+      pbs2->error_message,
+      pbs2->error_message);
+
+    /* Print information on the memory saved with the adaptive grid */
+    if ((pbs2->has_adaptive_J == _TRUE_) && (pbs2->bessels2_verbose > 1)) {
+      long int count_fine_Js = 0;
+      for (int index_task = 0; index_task < task_size; ++index_task)
+        count_fine_Js += pbs2->x_size_J[tasks[index_task].index_J][tasks[index_task].index_L]
+                                       [tasks[index_task].index_l][tasks[index_task].index_m];
+      printf (" -> stored projection functions on an adaptive grid: ~ %3g MB in use, ~ %3g MB saved\n",
+        8*pbs2->count_adaptive_Js/1e6, 8*(count_fine_Js-pbs2->count_adaptive_Js)/1e6);
     }
-    if (abort == _TRUE_) return _FAILURE_;
+
+    /* Print information on the memory saved with the single-precision storage, that is the
+    doubles given back to the system minus the floats that replace them; the projection
+    functions kept in memory by the caller are not given back. The error is the one on the
+    projection functions alone; the error induced on the transfer functions is not estimated. */
+    if ((pbs2->has_compact_J == _TRUE_) && (pbs2->bessels2_verbose > 1))
+      printf (" -> stored projection functions in single precision: ~ %3g MB in use, ~ %3g MB saved; max relative error on J_Llm(x) = %g\n",
+        4*pbs2->count_compact_Js/1e6, (8*pbs2->count_released_Js-4*pbs2->count_compact_Js)/1e6,
+        pbs2->compact_J_max_error);
+  }
+
 
 
-  } // end of spline calculation
+  // ====================================================================================
+  // =                                   NUMA replicas                                  =
+  // ====================================================================================
+
+  /* On multi-socket nodes, give each NUMA domain its own copy of the projection functions,
+  which are read by all the threads of the transfer2 module */
+  if (ppr2->numa_domains > 1)
+    class_call (bessel2_replicate_J (ppr, ppr2, pbs, pbs2, task_size, tasks),
+      pbs2->error_message,
+      pbs2->error_message);
+
+  free (tasks);
+  free (counters);
 
 
   return _SUCCESS_;
@@ -742,6 +956,10 @@ int bessel2_free(
 
   if (ppr2->load_transfers_from_disk == _FALSE_) {
 
+    class_call (bessel2_free_J_replicas (ppr, ppr2, pbs, pbs2),
+      pbs2->error_message,
+      pbs2->error_message);
+
     for (int index_J = 0; index_J < pbs2->J_size; ++index_J) {
   
       for (int index_L = 0; index_L < pbs2->L_size; index_L++) {
@@ -752,9 +970,19 @@ int bessel2_free(
   
           for (int index_m = 0; index_m <= index_m_max; ++index_m) {
         
-            free(pbs2->J_Llm_x[index_J][index_L][index_l][index_m]);
-            if (ppr->bessels_interpolation == cubic_interpolation)
-              free(pbs2->ddJ_Llm_x[index_J][index_L][index_l][index_m]);
+            /* The projection functions read from the cache point to the mapped file */
+            if (pbs2->J_cache_map == NULL) {
+              free(pbs2->J_Llm_x[index_J][index_L][index_l][index_m]);
+              if (ppr->bessels_interpolation == cubic_interpolation)
+                free(pbs2->ddJ_Llm_x[index_J][index_L][index_l][index_m]);
+            }
+            if (pbs2->has_compact_J == _TRUE_) {
+              free(pbs2->J_Llm_x_float[index_J][index_L][index_l][index_m]);
+              if (ppr->bessels_interpolation == cubic_interpolation)
+                free(pbs2->ddJ_Llm_x_float[index_J][index_L][index_l][index_m]);
+            }
+            if (pbs2->has_adaptive_J == _TRUE_)
+              free(pbs2->J_segments[index_J][index_L][index_l][index_m]);
         
           }  // end of for(index_m)
       
@@ -764,6 +992,13 @@ int bessel2_free(
           free(pbs2->J_Llm_x[index_J][index_L][index_l]);
           if (ppr->bessels_interpolation == cubic_interpolation)
             free(pbs2->ddJ_Llm_x[index_J][index_L][index_l]);
+          if (pbs2->has_compact_J == _TRUE_) {
+            free(pbs2->J_Llm_x_float[index_J][index_L][index_l]);
+            if (ppr->bessels_interpolation == cubic_interpolation)
+              free(pbs2->ddJ_Llm_x_float[index_J][index_L][index_l]);
+          }
+          if (pbs2->has_adaptive_J == _TRUE_)
+            free(pbs2->J_segments[index_J][index_L][index_l]);
       
         }  // end of for(index_l)
     
@@ -773,6 +1008,13 @@ int bessel2_free(
         free(pbs2->J_Llm_x[index_J][index_L]);
         if (ppr->bessels_interpolation == cubic_interpolation)
           free(pbs2->ddJ_Llm_x[index_J][index_L]);
+        if (pbs2->has_compact_J == _TRUE_) {
+          free(pbs2->J_Llm_x_float[index_J][index_L]);
+          if (ppr->bessels_interpolation == cubic_interpolation)
+            free(pbs2->ddJ_Llm_x_float[index_J][index_L]);
+        }
+        if (pbs2->has_adaptive_J == _TRUE_)
+          free(pbs2->J_segments[index_J][index_L]);
     
       }  // end of for(index_L)
   
@@ -782,6 +1024,13 @@ int bessel2_free(
       free(pbs2->J_Llm_x[index_J]);
       if (ppr->bessels_interpolation == cubic_interpolation)
         free(pbs2->ddJ_Llm_x[index_J]);
+      if (pbs2->has_compact_J == _TRUE_) {
+        free(pbs2->J_Llm_x_float[index_J]);
+        if (ppr->bessels_interpolation == cubic_interpolation)
+          free(pbs2->ddJ_Llm_x_float[index_J]);
+      }
+      if (pbs2->has_adaptive_J == _TRUE_)
+        free(pbs2->J_segments[index_J]);
   
     } // end of for(index_J)
   
@@ -791,6 +1040,17 @@ int bessel2_free(
     free(pbs2->J_Llm_x);
     if (ppr->bessels_interpolation == cubic_interpolation)
       free(pbs2->ddJ_Llm_x);
+    if (pbs2->has_compact_J == _TRUE_) {
+      free(pbs2->J_Llm_x_float);
+      if (ppr->bessels_interpolation == cubic_interpolation)
+        free(pbs2->ddJ_Llm_x_float);
+    }
+    if (pbs2->has_adaptive_J == _TRUE_)
+      free(pbs2->J_segments);
+
+    class_call (bessel2_cache_release (pbs2),
+      pbs2->error_message,
+      pbs2->error_message);
 
   }
   
@@ -1046,7 +1306,8 @@ int bessel2_J_for_Llm (
        int index_J,
        int index_L,
        int index_l,
-       int index_m
+       int index_m,
+       struct bessel2_counters * pbc  /**< output, memory counters of the calling thread */
        )
 {
 
@@ -1360,13 +1621,11 @@ int bessel2_J_for_Llm (
   int x_size_J = pbs2->x_size_J[index_J][index_L][index_l][index_m];
 
   class_calloc (pbs2->J_Llm_x[index_J][index_L][index_l][index_m], x_size_J, sizeof(double), pbs2->error_message);
-  #pragma omp atomic
-  pbs2->count_allocated_Js += x_size_J;
+  pbc->allocated_Js += x_size_J;
   
   if (ppr->bessels_interpolation == cubic_interpolation) {
     class_calloc (pbs2->ddJ_Llm_x[index_J][index_L][index_l][index_m], x_size_J, sizeof(double), pbs2->error_message);
-    #pragma omp atomic
-    pbs2->count_allocated_Js += x_size_J;
+    pbc->allocated_Js += x_size_J;
   }
   
   /* Define a shorthand for J_Llm_x */
@@ -1441,6 +1700,1281 @@ int bessel2_J_for_Llm (
 
 
 
+/**
+ * Compute the key identifying the projection functions in the cache.
+ *
+ * The projection functions J_Llm(x) are purely geometrical objects: they
+ * depend on the multipole sampling (pbs->l, pbs2->L, pbs2->m), on the x grid
+ * (pbs2->xx), on the cuts below which J and j_l1 are set to zero, on the
+ * projection function types and on the interpolation method, but not on the
+ * cosmological parameters. The key is a 64-bit FNV-1a hash of all these
+ * quantities; it is used both to name the cache file and to validate it.
+ */
+
+int bessel2_cache_key (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2,
+       unsigned long long * key
+       )
+{
+
+  *key = 14695981039346656037ULL;
+
+  /* Hash an array of n_bytes bytes into the key */
+  #define bessel2_hash(array, n_bytes) {                            \
+    const unsigned char * bytes = (const unsigned char *)(array);   \
+    for (long int i=0; i < (long int)(n_bytes); ++i) {              \
+      *key ^= bytes[i];                                             \
+      *key *= 1099511628211ULL;                                     \
+    }                                                               \
+  }
+
+  int flags[] = {
+    pbs2->J_size, pbs2->has_J_TT, pbs2->has_J_EE, pbs2->has_J_EB,
+    pbs2->extend_l1_using_m, ppr->bessels_interpolation,
+    pbs2->L_size, pbs->l_size, pbs2->m_size, pbs2->xx_size
+  };
+
+  bessel2_hash (flags, sizeof(flags));
+  bessel2_hash (pbs2->L, pbs2->L_size*sizeof(int));
+  bessel2_hash (pbs->l, pbs->l_size*sizeof(int));
+  bessel2_hash (pbs2->m, pbs2->m_size*sizeof(int));
+  bessel2_hash (pbs2->xx, pbs2->xx_size*sizeof(double));
+  bessel2_hash (&(pbs2->j_l1_cut), sizeof(double));
+  bessel2_hash (&(pbs2->J_Llm_cut), sizeof(double));
+
+  #undef bessel2_hash
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Look for the projection functions in the cache directory, and read them if
+ * they are there.
+ *
+ * The cache file, ppr2->projection_functions_cache_dir/projection_functions_<key>.dat,
+ * starts with a bessel2_cache_header, followed by a bessel2_cache_entry for each
+ * (J,L,l,m) configuration, in the same order as the loops in bessel2_init(), and
+ * by the values of J_Llm(x) and, for cubic interpolation, of its second derivative.
+ *
+ * The file is mapped read-only in memory and the leaves of pbs2->J_Llm_x and
+ * pbs2->ddJ_Llm_x point directly to the mapped pages. This way, the projection
+ * functions are read from disk only when the transfer2 module accesses them, and
+ * runs executed at the same time on the same machine share the same physical
+ * memory through the page cache.
+ *
+ * If the file does not exist, or if it does not match the current run, found is
+ * set to _FALSE_ and the projection functions will be computed and stored by
+ * bessel2_cache_store().
+ */
+
+int bessel2_cache_load (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2,
+       short * found
+       )
+{
+
+  *found = _FALSE_;
+
+  unsigned long long key;
+
+  class_call (bessel2_cache_key (ppr, ppr2, pbs, pbs2, &key),
+    pbs2->error_message,
+    pbs2->error_message);
+
+  sprintf (pbs2->J_cache_path, "%s/projection_functions_%016llx.dat",
+    ppr2->projection_functions_cache_dir, key);
+
+  /* Open the file and read its header */
+  int fd = open (pbs2->J_cache_path, O_RDONLY);
+
+  if (fd < 0) {
+    if (pbs2->bessels2_verbose > 1)
+      printf (" -> projection functions not found in the cache; will store them in '%s'\n",
+        pbs2->J_cache_path);
+    return _SUCCESS_;
+  }
+
+  struct stat st;
+  fstat (fd, &st);
+
+  /* A file that does not match the current run, for example because it was truncated
+  by an interrupted run, or because of a hash collision, is recomputed */
+  struct bessel2_cache_header header;
+
+  if ((st.st_size < sizeof(struct bessel2_cache_header))
+   || (read (fd, &header, sizeof(struct bessel2_cache_header)) != sizeof(struct bessel2_cache_header))
+   || (st.st_size != header.size)) {
+
+    close (fd);
+    if (pbs2->bessels2_verbose > 0)
+      printf (" -> the cached projection functions in '%s' do not match the current run; will recompute them\n",
+        pbs2->J_cache_path);
+    return _SUCCESS_;
+  }
+
+  /* Map the file in memory */
+  void * map = mmap (NULL, header.size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+
+  class_test (map == MAP_FAILED,
+    pbs2->error_message,
+    "could not map '%s' in memory", pbs2->J_cache_path);
+
+  /* Point the projection functions to the mapped file */
+  class_call (bessel2_cache_attach (ppr, ppr2, pbs, pbs2, map, header.size, found),
+    pbs2->error_message,
+    pbs2->error_message);
+
+  if (*found == _FALSE_) {
+    munmap (map, header.size);
+    if (pbs2->bessels2_verbose > 0)
+      printf (" -> the cached projection functions in '%s' do not match the current run; will recompute them\n",
+        pbs2->J_cache_path);
+    return _SUCCESS_;
+  }
+
+  if (pbs2->bessels2_verbose > 1)
+    printf (" -> read the projection functions from the cache '%s' (%.3g MB)\n",
+      pbs2->J_cache_path, header.size/1e6);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Store the projection functions in the cache directory, in the format described
+ * in bessel2_cache_load().
+ *
+ * Many runs with the same precision parameters might be launched at the same
+ * time; to avoid that a run reads a partially written file, the cache is written
+ * to a temporary file that is then renamed.
+ */
+
+int bessel2_cache_store (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2
+       )
+{
+
+  /* Build the index */
+  struct bessel2_cache_header header;
+  struct bessel2_cache_entry * entries;
+
+  class_call (bessel2_cache_index (ppr, ppr2, pbs, pbs2, &header, &entries),
+    pbs2->error_message,
+    pbs2->error_message);
+
+  long int n_configs = header.n_configs;
+
+  /* Write the file */
+  char tmp_path[_FILENAMESIZE_+32];
+  sprintf (tmp_path, "%s.%d.tmp", pbs2->J_cache_path, (int)getpid());
+
+  FILE * cache_file;
+  class_open (cache_file, tmp_path, "wb", pbs2->error_message);
+
+  int write_error = (fwrite (&header, sizeof(struct bessel2_cache_header), 1, cache_file) != 1)
+                 || (fwrite (entries, sizeof(struct bessel2_cache_entry), n_configs, cache_file) != n_configs);
+
+  for (int index_J = 0; index_J < pbs2->J_size; ++index_J) {
+    for (int index_L = 0; index_L < pbs2->L_size; ++index_L) {
+      for (int index_l = 0; index_l < pbs->l_size; ++index_l) {
+
+        int index_m_max = MIN (ppr2->index_m_max[pbs2->L[index_L]], ppr2->index_m_max[pbs->l[index_l]]);
+
+        for (int index_m = 0; index_m <= index_m_max && !write_error; ++index_m) {
+          int x_size = pbs2->x_size_J[index_J][index_L][index_l][index_m];
+          write_error = write_error
+            || (fwrite (pbs2->J_Llm_x[index_J][index_L][index_l][index_m], sizeof(double), x_size, cache_file) != x_size);
+          if (ppr->bessels_interpolation == cubic_interpolation)
+            write_error = write_error
+              || (fwrite (pbs2->ddJ_Llm_x[index_J][index_L][index_l][index_m], sizeof(double), x_size, cache_file) != x_size);
+        }
+      }
+    }
+  }
+
+  write_error = (fclose (cache_file) != 0) || write_error;
+
+  free (entries);
+
+  /* A failure in writing the cache is not fatal: the projection functions were computed
+  anyway, and the next run will try again */
+  if (write_error || (rename (tmp_path, pbs2->J_cache_path) != 0)) {
+    remove (tmp_path);
+    if (pbs2->bessels2_verbose > 0)
+      printf (" -> could not store the projection functions in '%s'\n", pbs2->J_cache_path);
+    return _SUCCESS_;
+  }
+
+  if (pbs2->bessels2_verbose > 1)
+    printf (" -> stored the projection functions in the cache '%s' (%.3g MB)\n",
+      pbs2->J_cache_path, header.size/1e6);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Build the header and the index of the cache file for the projection functions
+ * of the current run, in the format described in bessel2_cache_load().
+ *
+ * The entries are written in an array allocated here, which must be freed by the
+ * caller.
+ */
+
+int bessel2_cache_index (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2,
+       struct bessel2_cache_header * header, /**< output, header of the cache file */
+       struct bessel2_cache_entry ** entries /**< output, index of the cache file */
+       )
+{
+
+  unsigned long long key;
+
+  class_call (bessel2_cache_key (ppr, ppr2, pbs, pbs2, &key),
+    pbs2->error_message,
+    pbs2->error_message);
+
+  int n_functions = (ppr->bessels_interpolation == cubic_interpolation ? 2 : 1);
+
+  long int n_configs = 0;
+  for (int index_J = 0; index_J < pbs2->J_size; ++index_J)
+    for (int index_L = 0; index_L < pbs2->L_size; ++index_L)
+      for (int index_l = 0; index_l < pbs->l_size; ++index_l)
+        n_configs += MIN (ppr2->index_m_max[pbs2->L[index_L]], ppr2->index_m_max[pbs->l[index_l]]) + 1;
+
+  class_alloc (*entries, n_configs*sizeof(struct bessel2_cache_entry), pbs2->error_message);
+
+  long int index_config = 0;
+  long int offset = 0;
+
+  for (int index_J = 0; index_J < pbs2->J_size; ++index_J) {
+    for (int index_L = 0; index_L < pbs2->L_size; ++index_L) {
+      for (int index_l = 0; index_l < pbs->l_size; ++index_l) {
+
+        int index_m_max = MIN (ppr2->index_m_max[pbs2->L[index_L]], ppr2->index_m_max[pbs->l[index_l]]);
+
+        for (int index_m = 0; index_m <= index_m_max; ++index_m) {
+          struct bessel2_cache_entry * entry = &((*entries)[index_config++]);
+          entry->offset = offset;
+          entry->index_xmin = pbs2->index_xmin_J[index_J][index_L][index_l][index_m];
+          entry->x_size = pbs2->x_size_J[index_J][index_L][index_l][index_m];
+          entry->x_min = pbs2->x_min_J[index_J][index_L][index_l][index_m];
+          offset += n_functions*entry->x_size;
+        }
+      }
+    }
+  }
+
+  memset (header, 0, sizeof(struct bessel2_cache_header));
+  strcpy (header->magic, "SONGJLM");
+  header->key = key;
+  header->J_size = pbs2->J_size;
+  header->L_size = pbs2->L_size;
+  header->l_size = pbs->l_size;
+  header->xx_size = pbs2->xx_size;
+  header->interpolation = ppr->bessels_interpolation;
+  header->n_configs = n_configs;
+  header->size = sizeof(struct bessel2_cache_header)
+               + n_configs*sizeof(struct bessel2_cache_entry)
+               + offset*sizeof(double);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Point the projection functions to an image of the cache file in memory, that is
+ * either the mapped cache file or the projection functions kept by a previous run
+ * in pbs2->kept_J.
+ *
+ * If the image does not match the current run, found is set to _FALSE_ and the
+ * projection functions are left untouched. Otherwise, pbs2->J_cache_map is set to
+ * the image, whose memory is not owned by this module.
+ */
+
+int bessel2_cache_attach (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2,
+       void * image,
+       long int image_size,
+       short * found
+       )
+{
+
+  *found = _FALSE_;
+
+  unsigned long long key;
+
+  class_call (bessel2_cache_key (ppr, ppr2, pbs, pbs2, &key),
+    pbs2->error_message,
+    pbs2->error_message);
+
+  long int n_configs = 0;
+  for (int index_J = 0; index_J < pbs2->J_size; ++index_J)
+    for (int index_L = 0; index_L < pbs2->L_size; ++index_L)
+      for (int index_l = 0; index_l < pbs->l_size; ++index_l)
+        n_configs += MIN (ppr2->index_m_max[pbs2->L[index_L]], ppr2->index_m_max[pbs->l[index_l]]) + 1;
+
+  struct bessel2_cache_header * header = (struct bessel2_cache_header *)image;
+
+  if ((image_size < sizeof(struct bessel2_cache_header))
+   || (memcmp (header->magic, "SONGJLM", sizeof(header->magic)) != 0) || (header->key != key)
+   || (header->J_size != pbs2->J_size) || (header->L_size != pbs2->L_size)
+   || (header->l_size != pbs->l_size) || (header->xx_size != pbs2->xx_size)
+   || (header->interpolation != ppr->bessels_interpolation) || (header->n_configs != n_configs)
+   || (header->size != image_size))
+    return _SUCCESS_;
+
+  struct bessel2_cache_entry * entry = (struct bessel2_cache_entry *)
+    ((char *)image + sizeof(struct bessel2_cache_header));
+  double * data = (double *)(entry + n_configs);
+
+  for (int index_J = 0; index_J < pbs2->J_size; ++index_J) {
+    for (int index_L = 0; index_L < pbs2->L_size; ++index_L) {
+      for (int index_l = 0; index_l < pbs->l_size; ++index_l) {
+
+        int index_m_max = MIN (ppr2->index_m_max[pbs2->L[index_L]], ppr2->index_m_max[pbs->l[index_l]]);
+
+        for (int index_m = 0; index_m <= index_m_max; ++index_m) {
+
+          pbs2->index_xmin_J[index_J][index_L][index_l][index_m] = entry->index_xmin;
+          pbs2->x_size_J[index_J][index_L][index_l][index_m] = entry->x_size;
+          pbs2->x_min_J[index_J][index_L][index_l][index_m] = entry->x_min;
+
+          pbs2->J_Llm_x[index_J][index_L][index_l][index_m] = data + entry->offset;
+          if (ppr->bessels_interpolation == cubic_interpolation)
+            pbs2->ddJ_Llm_x[index_J][index_L][index_l][index_m] = data + entry->offset + entry->x_size;
+
+          entry++;
+        }
+      }
+    }
+  }
+
+  pbs2->J_cache_map = image;
+  pbs2->J_cache_map_size = image_size;
+
+  *found = _TRUE_;
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Keep the projection functions just computed in pbs2->kept_J, so that the next
+ * runs in the same process with the same sampling do not need to compute them
+ * again; see bessel2_init().
+ *
+ * The projection functions are copied in an image of the cache file in memory,
+ * which replaces the one previously kept, and the leaves of pbs2->J_Llm_x and
+ * pbs2->ddJ_Llm_x are then pointed to the image, as if they were read from the
+ * cache; this way, they are not duplicated in memory.
+ */
+
+int bessel2_cache_keep (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2
+       )
+{
+
+  struct bessel2_cache_header header;
+  struct bessel2_cache_entry * entries;
+
+  class_call (bessel2_cache_index (ppr, ppr2, pbs, pbs2, &header, &entries),
+    pbs2->error_message,
+    pbs2->error_message);
+
+  free (pbs2->kept_J->data);
+  pbs2->kept_J->data = NULL;
+  pbs2->kept_J->size = 0;
+
+  char * image;
+  class_alloc (image, header.size, pbs2->error_message);
+
+  memcpy (image, &header, sizeof(struct bessel2_cache_header));
+  memcpy (image + sizeof(struct bessel2_cache_header), entries,
+    header.n_configs*sizeof(struct bessel2_cache_entry));
+
+  double * data = (double *)(image + sizeof(struct bessel2_cache_header)
+                                   + header.n_configs*sizeof(struct bessel2_cache_entry));
+
+  /* Copy the projection functions in the image and free them */
+  long int index_config = 0;
+
+  for (int index_J = 0; index_J < pbs2->J_size; ++index_J) {
+    for (int index_L = 0; index_L < pbs2->L_size; ++index_L) {
+      for (int index_l = 0; index_l < pbs->l_size; ++index_l) {
+
+        int index_m_max = MIN (ppr2->index_m_max[pbs2->L[index_L]], ppr2->index_m_max[pbs->l[index_l]]);
+
+        for (int index_m = 0; index_m <= index_m_max; ++index_m) {
+
+          struct bessel2_cache_entry * entry = &(entries[index_config++]);
+
+          memcpy (data + entry->offset, pbs2->J_Llm_x[index_J][index_L][index_l][index_m],
+            entry->x_size*sizeof(double));
+          free (pbs2->J_Llm_x[index_J][index_L][index_l][index_m]);
+          pbs2->count_allocated_Js -= entry->x_size;
+
+          if (ppr->bessels_interpolation == cubic_interpolation) {
+            memcpy (data + entry->offset + entry->x_size, pbs2->ddJ_Llm_x[index_J][index_L][index_l][index_m],
+              entry->x_size*sizeof(double));
+            free (pbs2->ddJ_Llm_x[index_J][index_L][index_l][index_m]);
+            pbs2->count_allocated_Js -= entry->x_size;
+          }
+        }
+      }
+    }
+  }
+
+  free (entries);
+
+  pbs2->kept_J->data = image;
+  pbs2->kept_J->size = header.size;
+
+  short found;
+
+  class_call (bessel2_cache_attach (ppr, ppr2, pbs, pbs2, pbs2->kept_J->data, pbs2->kept_J->size, &found),
+    pbs2->error_message,
+    pbs2->error_message);
+
+  class_test (found == _FALSE_,
+    pbs2->error_message,
+    "the projection functions kept in memory do not match the current run");
+
+  pbs2->J_cache_map_is_kept = _TRUE_;
+
+  if (pbs2->bessels2_verbose > 1)
+    printf (" -> kept the projection functions in memory for the next runs (%.3g MB)\n",
+      header.size/1e6);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Release the image of the cache file pointed by pbs2->J_cache_map, once the leaves
+ * of the projection functions do not point inside it anymore. A mapped cache file is
+ * unmapped, while the image kept in pbs2->kept_J is left to its owner.
+ */
+
+int bessel2_cache_release (
+       struct bessels2 * pbs2
+       )
+{
+
+  if ((pbs2->J_cache_map != NULL) && (pbs2->J_cache_map_is_kept == _FALSE_))
+    munmap (pbs2->J_cache_map, pbs2->J_cache_map_size);
+
+  pbs2->J_cache_map = NULL;
+  pbs2->J_cache_map_is_kept = _FALSE_;
+
+  return _SUCCESS_;
+
+}
+
+
+
+
+
+
+/**
+ * Resample the projection function J_Llm(x) for a given (J,L,l,m) on a grid that
+ * is coarse where J_Llm(x) is smooth and fine where it varies rapidly.
+ *
+ * The points of pbs2->xx where J_Llm(x) is non-negligible are divided in segments
+ * of _BESSEL2_SEGMENT_SIZE_ points. In each segment, J_Llm(x) is stored only every
+ * 'stride' points, where the stride is the largest power of two for which the linear
+ * interpolation between the stored values reproduces J_Llm(x) on all the points of
+ * the segment to better than ppr2->bessel_J_adaptive_tol_song times max|J_Llm(x)|.
+ * The stride is typically large in the region x<<l, where J_Llm(x) is exponentially
+ * suppressed, and at large x, where the amplitude of the oscillations decays.
+ *
+ * The segment containing a point index_x of pbs2->xx is (index_x-index_xmin_J) >>
+ * _BESSEL2_SEGMENT_SHIFT_, so that the lookup in transfer2_interpolate_J() is still
+ * O(1) and requires no search. Each segment stores its nodes, including the one at its
+ * end, and an extra copy of the last node, so that the interpolation never reads
+ * outside the segment.
+ *
+ * The new grid replaces pbs2->J_Llm_x[index_J][index_L][index_l][index_m], and is
+ * described by pbs2->J_segments[index_J][index_L][index_l][index_m]. This function
+ * supports only linear interpolation.
+ */
+
+int bessel2_adapt_J (
+       struct precision * ppr,
+       struct bessels2 * pbs2,
+       int index_J,
+       int index_L,
+       int index_l,
+       int index_m,
+       struct bessel2_counters * pbc  /**< output, memory counters of the calling thread */
+       )
+{
+
+  int x_size = pbs2->x_size_J[index_J][index_L][index_l][index_m];
+  double * J = pbs2->J_Llm_x[index_J][index_L][index_l][index_m];
+
+  /* Segments that end before the last point of the fine grid can have any stride;
+  the last segment, which contains x_size-index_segment*_BESSEL2_SEGMENT_SIZE_ points,
+  keeps the original sampling */
+  int n_segments = (x_size-1)/_BESSEL2_SEGMENT_SIZE_ + 1;
+
+  class_alloc (pbs2->J_segments[index_J][index_L][index_l][index_m],
+    n_segments*sizeof(struct bessel2_segment),
+    pbs2->error_message);
+
+  struct bessel2_segment * segments = pbs2->J_segments[index_J][index_L][index_l][index_m];
+
+  double J_max = 0;
+  for (int index_x=0; index_x < x_size; ++index_x)
+    J_max = MAX (J_max, fabs(J[index_x]));
+
+  double tolerance = pbs2->J_adaptive_tol * J_max;
+
+  /* Choose the stride of each segment and count the nodes */
+  int size = 0;
+
+  for (int index_segment=0; index_segment < n_segments; ++index_segment) {
+
+    int first = index_segment*_BESSEL2_SEGMENT_SIZE_;
+    int stride = 1;
+
+    if (index_segment < n_segments-1) {
+
+      for (stride=_BESSEL2_SEGMENT_SIZE_; stride > 1; stride /= 2) {
+
+        double error = 0;
+
+        for (int index_x=0; index_x <= _BESSEL2_SEGMENT_SIZE_; ++index_x) {
+          int node = index_x/stride;
+          double b = (index_x - node*stride)/(double)stride;
+          double J_left = J[first + node*stride];
+          double J_right = (b > 0 ? J[first + (node+1)*stride] : J_left);
+          error = MAX (error, fabs ((1-b)*J_left + b*J_right - J[first + index_x]));
+        }
+
+        if (error <= tolerance)
+          break;
+      }
+    }
+
+    int last = MIN (first + _BESSEL2_SEGMENT_SIZE_, x_size-1);
+
+    segments[index_segment].offset = size;
+    segments[index_segment].stride = stride;
+    size += (last - first)/stride + 2;
+  }
+
+  /* Fill the nodes */
+  double * J_adaptive;
+  class_alloc (J_adaptive, size*sizeof(double), pbs2->error_message);
+
+  for (int index_segment=0; index_segment < n_segments; ++index_segment) {
+
+    int first = index_segment*_BESSEL2_SEGMENT_SIZE_;
+    int last = MIN (first + _BESSEL2_SEGMENT_SIZE_, x_size-1);
+    int stride = segments[index_segment].stride;
+    double * nodes = J_adaptive + segments[index_segment].offset;
+
+    int n_nodes = (last - first)/stride + 1;
+    for (int index_node=0; index_node < n_nodes; ++index_node)
+      nodes[index_node] = J[first + index_node*stride];
+    nodes[n_nodes] = nodes[n_nodes-1];
+  }
+
+  /* Replace the fine grid; the projection functions read from the cache are not allocated */
+  if (pbs2->J_cache_map == NULL) {
+    free (J);
+    pbc->allocated_Js -= x_size;
+  }
+
+  pbs2->J_Llm_x[index_J][index_L][index_l][index_m] = J_adaptive;
+
+  pbc->allocated_Js += size;
+  pbc->adaptive_Js += size;
+
+  return _SUCCESS_;
+
+}
+
+
+
+
+
+
+/**
+ * Is the array of doubles starting at data part of the projection functions read
+ * from the cache, pbs2->J_cache_map?
+ */
+
+short bessel2_is_in_cache (
+       struct bessels2 * pbs2,
+       double * data
+       )
+{
+
+  char * map = pbs2->J_cache_map;
+
+  return (map != NULL) && ((char *)data >= map) && ((char *)data < map + pbs2->J_cache_map_size);
+
+}
+
+
+
+
+/**
+ * Convert the projection function J_Llm(x) for a given (J,L,l,m), and its second
+ * derivative if needed, to single precision.
+ *
+ * The single-precision values are stored in pbs2->J_Llm_x_float and
+ * pbs2->ddJ_Llm_x_float, and the double-precision arrays are freed and set to
+ * NULL. The relative error introduced by the conversion, that is the largest
+ * difference between the two representations divided by the largest value of
+ * |J_Llm(x)|, is used to update pbs2->compact_J_max_error.
+ *
+ * This function is called after J_Llm(x) has been computed by bessel2_J_for_Llm()
+ * and, for cubic interpolation, after its second derivative has been computed.
+ */
+
+int bessel2_compact_J (
+       struct precision * ppr,
+       struct bessels2 * pbs2,
+       int index_J,
+       int index_L,
+       int index_l,
+       int index_m,
+       struct bessel2_counters * pbc  /**< output, memory counters of the calling thread */
+       )
+{
+
+  int x_size = pbs2->x_size_J[index_J][index_L][index_l][index_m];
+
+  double * J = pbs2->J_Llm_x[index_J][index_L][index_l][index_m];
+
+  class_alloc (pbs2->J_Llm_x_float[index_J][index_L][index_l][index_m], x_size*sizeof(float), pbs2->error_message);
+  float * J_float = pbs2->J_Llm_x_float[index_J][index_L][index_l][index_m];
+
+  double J_max = 0, error_max = 0;
+
+  for (int index_x=0; index_x < x_size; ++index_x) {
+    J_float[index_x] = (float)J[index_x];
+    J_max = MAX (J_max, fabs(J[index_x]));
+    error_max = MAX (error_max, fabs(J_float[index_x] - J[index_x]));
+  }
+
+  /* Projection functions read from the cache are not allocated; they will be unmapped
+  at the end of bessel2_init(), unless the cache is kept in memory by the caller. Those
+  resampled by bessel2_adapt_J() are allocated even when there is a cache. */
+  short is_mapped = bessel2_is_in_cache (pbs2, J);
+
+  if (is_mapped == _FALSE_) {
+    free (J);
+    pbc->allocated_Js -= x_size;
+  }
+
+  if ((is_mapped == _FALSE_) || (pbs2->J_cache_map_is_kept == _FALSE_))
+    pbc->released_Js += x_size;
+
+  pbs2->J_Llm_x[index_J][index_L][index_l][index_m] = NULL;
+
+  int count = x_size;
+
+  if (ppr->bessels_interpolation == cubic_interpolation) {
+
+    double * ddJ = pbs2->ddJ_Llm_x[index_J][index_L][index_l][index_m];
+
+    class_alloc (pbs2->ddJ_Llm_x_float[index_J][index_L][index_l][index_m], x_size*sizeof(float), pbs2->error_message);
+    float * ddJ_float = pbs2->ddJ_Llm_x_float[index_J][index_L][index_l][index_m];
+
+    for (int index_x=0; index_x < x_size; ++index_x)
+      ddJ_float[index_x] = (float)ddJ[index_x];
+
+    is_mapped = bessel2_is_in_cache (pbs2, ddJ);
+
+    if (is_mapped == _FALSE_) {
+      free (ddJ);
+      pbc->allocated_Js -= x_size;
+    }
+
+    if ((is_mapped == _FALSE_) || (pbs2->J_cache_map_is_kept == _FALSE_))
+      pbc->released_Js += x_size;
+
+    pbs2->ddJ_Llm_x[index_J][index_L][index_l][index_m] = NULL;
+
+    count += x_size;
+  }
+
+  /* Update the memory counters; pbc->allocated_Js counts doubles */
+  pbc->compact_Js += count;
+
+  if (J_max > 0)
+    pbc->compact_max_error = MAX (pbc->compact_max_error, error_max/J_max);
+
+  return _SUCCESS_;
+
+}
+
+
+
+
+/**
+ * Build the queue of (J,L,l,m) configurations for which the projection functions
+ * J_Llm(x) are computed in bessel2_init().
+ *
+ * The cost of computing J_Llm(x) varies by orders of magnitude between the
+ * configurations: it is proportional to the number of terms in the sum over l1,
+ * 2*MIN(L,l)+1, times the number of x values where J_Llm(x) is not negligible.
+ * Since the smallest l1 in the sum is |l-L|, and j_l1(x) is negligible for
+ * x << l1, we estimate the latter as the number of points in pbs2->xx larger
+ * than |l-L|. We sort the queue so that the most expensive configurations come
+ * first; when the queue is distributed between threads with a dynamic schedule,
+ * the cheap configurations at the end fill the gaps left by the expensive ones.
+ *
+ * The queue is written in the array pointed by tasks, which must be freed by
+ * the caller.
+ */
+
+int bessel2_J_queue (
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2,
+       int * task_size,                  /**< output: number of (J,L,l,m) configurations in the queue */
+       struct bessel2_J_task ** tasks    /**< output: queue of (J,L,l,m) configurations, sorted by cost */
+       )
+{
+
+  *task_size = 0;
+
+  for (int index_L = 0; index_L < pbs2->L_size; ++index_L)
+    for (int index_l = 0; index_l < pbs->l_size; ++index_l)
+      *task_size += MIN (ppr2->index_m_max[pbs2->L[index_L]], ppr2->index_m_max[pbs->l[index_l]]) + 1;
+
+  *task_size *= pbs2->J_size;
+
+  class_alloc (*tasks, MAX(1,*task_size)*sizeof(struct bessel2_J_task), pbs2->error_message);
+
+  int index_task = 0;
+
+  for (int index_J = 0; index_J < pbs2->J_size; ++index_J) {
+    for (int index_L = 0; index_L < pbs2->L_size; ++index_L) {
+      for (int index_l = 0; index_l < pbs->l_size; ++index_l) {
+
+        int L = pbs2->L[index_L];
+        int l = pbs->l[index_l];
+
+        /* Number of x values larger than the smallest l1 in the sum */
+        int index_x_min = MIN (pbs2->xx_size-1, (int)(abs(l-L)/pbs2->xx_step));
+        double cost = (2*MIN(L,l)+1) * (double)(pbs2->xx_size - index_x_min);
+
+        int index_m_max = MIN (ppr2->index_m_max[L], ppr2->index_m_max[l]);
+
+        for (int index_m = 0; index_m <= index_m_max; ++index_m) {
+          (*tasks)[index_task].index_J = index_J;
+          (*tasks)[index_task].index_L = index_L;
+          (*tasks)[index_task].index_l = index_l;
+          (*tasks)[index_task].index_m = index_m;
+          (*tasks)[index_task].cost = cost;
+          index_task++;
+        }
+      }
+    }
+  }
+
+  qsort (*tasks, *task_size, sizeof(struct bessel2_J_task), bessel2_compare_J_tasks);
+
+  if (pbs2->bessels2_verbose > 2)
+    printf (" -> distributing %d projection functions between threads\n", *task_size);
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Comparison function to sort the (J,L,l,m) configurations by decreasing cost,
+ * to be passed to qsort().
+ */
+
+int bessel2_compare_J_tasks (
+       const void * a,
+       const void * b
+       )
+{
+
+  double cost_a = ((const struct bessel2_J_task *)a)->cost;
+  double cost_b = ((const struct bessel2_J_task *)b)->cost;
+
+  return (cost_a < cost_b) - (cost_a > cost_b);
+
+}
+
+
+/**
+ * Find the number of values in the leaves of the projection function arrays for a
+ * given (J,L,l,m) configuration: J_size for pbs2->J_Llm_x (or pbs2->J_Llm_x_float)
+ * and ddJ_size for pbs2->ddJ_Llm_x (or pbs2->ddJ_Llm_x_float). The latter is zero
+ * when the projection functions are interpolated linearly.
+ */
+
+int bessel2_J_leaf_size (
+       struct precision * ppr,
+       struct bessels2 * pbs2,
+       int index_J,
+       int index_L,
+       int index_l,
+       int index_m,
+       int * J_size,      /**< output: number of values of J_Llm(x) */
+       int * ddJ_size     /**< output: number of values of its second derivative */
+       )
+{
+
+  int x_size = pbs2->x_size_J[index_J][index_L][index_l][index_m];
+
+  *J_size = x_size;
+  *ddJ_size = (ppr->bessels_interpolation == cubic_interpolation) ? x_size : 0;
+
+  /* On the adaptive grid, the last segment keeps the original sampling and is followed
+  by a copy of its last node; see bessel2_adapt_J() */
+  if (pbs2->has_adaptive_J == _TRUE_) {
+    int n_segments = (x_size-1)/_BESSEL2_SEGMENT_SIZE_ + 1;
+    int first = (n_segments-1)*_BESSEL2_SEGMENT_SIZE_;
+    *J_size = pbs2->J_segments[index_J][index_L][index_l][index_m][n_segments-1].offset
+              + (x_size-1 - first) + 2;
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Give each NUMA domain its own copy of the projection functions.
+ *
+ * The projection functions are read by all the threads in the transfer2 module, but
+ * their pages are placed in the memory of the threads that computed them, that is,
+ * randomly between the domains. With ppr2->numa_domains > 1, the threads of each domain
+ * copy the leaves of pbs2->J_Llm_x and pbs2->ddJ_Llm_x (or of their single-precision
+ * versions) to memory that they first touch, so that each domain reads its own copy;
+ * see numa_layout.h. The copy of the first domain replaces the original leaves, while
+ * the copies of the other domains are stored in pbs2->J_Llm_x_replica[domain] and use
+ * (numa_domains-1) times the memory of the projection functions.
+ *
+ * The leaves are copied in the order of the queue of (J,L,l,m) configurations built
+ * by bessel2_J_queue(), and are distributed cyclically between the threads of each
+ * domain. The adaptive grids in pbs2->J_segments are small and are not replicated.
+ */
+
+int bessel2_replicate_J (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2,
+       int task_size,                  /**< input: number of (J,L,l,m) configurations in the queue */
+       struct bessel2_J_task * tasks   /**< input: queue of (J,L,l,m) configurations */
+       )
+{
+
+  int domain_size = ppr2->numa_domains;
+
+  short has_double = (pbs2->has_compact_J == _FALSE_);
+  short has_dd = (ppr->bessels_interpolation == cubic_interpolation);
+
+  pbs2->J_replica_size = domain_size;
+  pbs2->J_Llm_x_replica = NULL;
+  pbs2->ddJ_Llm_x_replica = NULL;
+  pbs2->J_Llm_x_float_replica = NULL;
+  pbs2->ddJ_Llm_x_float_replica = NULL;
+
+  if (has_double) {
+    class_calloc (pbs2->J_Llm_x_replica, domain_size, sizeof(double *****), pbs2->error_message);
+    pbs2->J_Llm_x_replica[0] = pbs2->J_Llm_x;
+    if (has_dd) {
+      class_calloc (pbs2->ddJ_Llm_x_replica, domain_size, sizeof(double *****), pbs2->error_message);
+      pbs2->ddJ_Llm_x_replica[0] = pbs2->ddJ_Llm_x;
+    }
+  }
+  else {
+    class_calloc (pbs2->J_Llm_x_float_replica, domain_size, sizeof(float *****), pbs2->error_message);
+    pbs2->J_Llm_x_float_replica[0] = pbs2->J_Llm_x_float;
+    if (has_dd) {
+      class_calloc (pbs2->ddJ_Llm_x_float_replica, domain_size, sizeof(float *****), pbs2->error_message);
+      pbs2->ddJ_Llm_x_float_replica[0] = pbs2->ddJ_Llm_x_float;
+    }
+  }
+
+  /* Allocate the pointer levels of the replicas for the domains after the first one;
+  the leaves are allocated below by the threads of each domain */
+  for (int domain = 1; domain < domain_size; ++domain) {
+
+    if (has_double) {
+      class_alloc (pbs2->J_Llm_x_replica[domain], pbs2->J_size*sizeof(double ****), pbs2->error_message);
+      if (has_dd)
+        class_alloc (pbs2->ddJ_Llm_x_replica[domain], pbs2->J_size*sizeof(double ****), pbs2->error_message);
+    }
+    else {
+      class_alloc (pbs2->J_Llm_x_float_replica[domain], pbs2->J_size*sizeof(float ****), pbs2->error_message);
+      if (has_dd)
+        class_alloc (pbs2->ddJ_Llm_x_float_replica[domain], pbs2->J_size*sizeof(float ****), pbs2->error_message);
+    }
+
+    for (int index_J = 0; index_J < pbs2->J_size; ++index_J) {
+
+      if (has_double) {
+        class_alloc (pbs2->J_Llm_x_replica[domain][index_J], pbs2->L_size*sizeof(double ***), pbs2->error_message);
+        if (has_dd)
+          class_alloc (pbs2->ddJ_Llm_x_replica[domain][index_J], pbs2->L_size*sizeof(double ***), pbs2->error_message);
+      }
+      else {
+        class_alloc (pbs2->J_Llm_x_float_replica[domain][index_J], pbs2->L_size*sizeof(float ***), pbs2->error_message);
+        if (has_dd)
+          class_alloc (pbs2->ddJ_Llm_x_float_replica[domain][index_J], pbs2->L_size*sizeof(float ***), pbs2->error_message);
+      }
+
+      for (int index_L = 0; index_L < pbs2->L_size; ++index_L) {
+
+        if (has_double) {
+          class_alloc (pbs2->J_Llm_x_replica[domain][index_J][index_L], pbs->l_size*sizeof(double **), pbs2->error_message);
+          if (has_dd)
+            class_alloc (pbs2->ddJ_Llm_x_replica[domain][index_J][index_L], pbs->l_size*sizeof(double **), pbs2->error_message);
+        }
+        else {
+          class_alloc (pbs2->J_Llm_x_float_replica[domain][index_J][index_L], pbs->l_size*sizeof(float **), pbs2->error_message);
+          if (has_dd)
+            class_alloc (pbs2->ddJ_Llm_x_float_replica[domain][index_J][index_L], pbs->l_size*sizeof(float **), pbs2->error_message);
+        }
+
+        for (int index_l = 0; index_l < pbs->l_size; ++index_l) {
+
+          int m_size = MIN (ppr2->index_m_max[pbs2->L[index_L]], ppr2->index_m_max[pbs->l[index_l]]) + 1;
+
+          if (has_double) {
+            class_calloc (pbs2->J_Llm_x_replica[domain][index_J][index_L][index_l], m_size, sizeof(double *), pbs2->error_message);
+            if (has_dd)
+              class_calloc (pbs2->ddJ_Llm_x_replica[domain][index_J][index_L][index_l], m_size, sizeof(double *), pbs2->error_message);
+          }
+          else {
+            class_calloc (pbs2->J_Llm_x_float_replica[domain][index_J][index_L][index_l], m_size, sizeof(float *), pbs2->error_message);
+            if (has_dd)
+              class_calloc (pbs2->ddJ_Llm_x_float_replica[domain][index_J][index_L][index_l], m_size, sizeof(float *), pbs2->error_message);
+          }
+        }
+      }
+    }
+  }
+
+  /* Count the memory used by the replicas */
+  pbs2->count_replicated_Js = 0;
+  for (int index_task = 0; index_task < task_size; ++index_task) {
+    int J_size, ddJ_size;
+    class_call (bessel2_J_leaf_size (ppr, pbs2, tasks[index_task].index_J, tasks[index_task].index_L,
+                  tasks[index_task].index_l, tasks[index_task].index_m, &J_size, &ddJ_size),
+      pbs2->error_message,
+      pbs2->error_message);
+    pbs2->count_replicated_Js += (long int)(domain_size-1)*(J_size+ddJ_size);
+  }
+
+  /* Copies made by the first domain. They replace the original leaves only after all
+  domains have finished copying, since the other domains read the same originals. */
+  void ** J_first_copy, ** ddJ_first_copy;
+  class_calloc (J_first_copy, task_size, sizeof(void *), pbs2->error_message);
+  class_calloc (ddJ_first_copy, task_size, sizeof(void *), pbs2->error_message);
+
+  /* Copy the leaves. Each thread copies the leaves of its own domain, so that their pages
+  are placed in its memory. */
+  int abort = _FALSE_;
+  #pragma omp parallel
+  {
+
+    int thread = 0;
+    int number_of_threads = 1;
+    #ifdef _OPENMP
+    thread = omp_get_thread_num();
+    number_of_threads = omp_get_num_threads();
+    #endif
+
+    int domain = numa_thread_domain (thread, number_of_threads, domain_size);
+
+    int first_thread, thread_size;
+    numa_domain_threads (domain, number_of_threads, domain_size, &first_thread, &thread_size);
+
+    for (int index_task = thread-first_thread; index_task < task_size; index_task += thread_size) {
+
+      int index_J = tasks[index_task].index_J;
+      int index_L = tasks[index_task].index_L;
+      int index_l = tasks[index_task].index_l;
+      int index_m = tasks[index_task].index_m;
+
+      int J_size, ddJ_size;
+      class_call_parallel (bessel2_J_leaf_size (ppr, pbs2, index_J, index_L, index_l, index_m,
+                             &J_size, &ddJ_size),
+        pbs2->error_message,
+        pbs2->error_message);
+
+      if (abort == _TRUE_)
+        continue;
+
+      size_t element_size = has_double ? sizeof(double) : sizeof(float);
+
+      void * J = has_double ? (void *)pbs2->J_Llm_x[index_J][index_L][index_l][index_m]
+                            : (void *)pbs2->J_Llm_x_float[index_J][index_L][index_l][index_m];
+      void * J_copy;
+      class_alloc_parallel (J_copy, J_size*element_size, pbs2->error_message);
+      if (abort == _TRUE_) continue;
+      memcpy (J_copy, J, J_size*element_size);
+
+      void * ddJ_copy = NULL;
+      if (has_dd) {
+        void * ddJ = has_double ? (void *)pbs2->ddJ_Llm_x[index_J][index_L][index_l][index_m]
+                                : (void *)pbs2->ddJ_Llm_x_float[index_J][index_L][index_l][index_m];
+        class_alloc_parallel (ddJ_copy, ddJ_size*element_size, pbs2->error_message);
+        if (abort == _TRUE_) continue;
+        memcpy (ddJ_copy, ddJ, ddJ_size*element_size);
+      }
+
+      if (domain == 0) {
+        J_first_copy[index_task] = J_copy;
+        ddJ_first_copy[index_task] = ddJ_copy;
+      }
+      else if (has_double) {
+        pbs2->J_Llm_x_replica[domain][index_J][index_L][index_l][index_m] = J_copy;
+        if (has_dd)
+          pbs2->ddJ_Llm_x_replica[domain][index_J][index_L][index_l][index_m] = ddJ_copy;
+      }
+      else {
+        pbs2->J_Llm_x_float_replica[domain][index_J][index_L][index_l][index_m] = J_copy;
+        if (has_dd)
+          pbs2->ddJ_Llm_x_float_replica[domain][index_J][index_L][index_l][index_m] = ddJ_copy;
+      }
+
+      #pragma omp flush(abort)
+
+    } // end of for(index_task)
+
+  } // end of parallel region
+
+  /* The first domain replaces the original leaves, freeing them unless they point inside
+  the cache file, which is unmapped below. On failure, the copies of the first domain are dropped
+  and the originals are kept. */
+  for (int index_task = 0; index_task < task_size; ++index_task) {
+
+    int index_J = tasks[index_task].index_J;
+    int index_L = tasks[index_task].index_L;
+    int index_l = tasks[index_task].index_l;
+    int index_m = tasks[index_task].index_m;
+
+    if ((abort == _TRUE_) || (J_first_copy[index_task] == NULL)) {
+      free (J_first_copy[index_task]);
+      free (ddJ_first_copy[index_task]);
+      continue;
+    }
+
+    if (has_double) {
+      if (pbs2->J_cache_map == NULL) {
+        free (pbs2->J_Llm_x[index_J][index_L][index_l][index_m]);
+        if (has_dd)
+          free (pbs2->ddJ_Llm_x[index_J][index_L][index_l][index_m]);
+      }
+      pbs2->J_Llm_x[index_J][index_L][index_l][index_m] = J_first_copy[index_task];
+      if (has_dd)
+        pbs2->ddJ_Llm_x[index_J][index_L][index_l][index_m] = ddJ_first_copy[index_task];
+    }
+    else {
+      /* The compact leaves are always allocated, also when read from the cache */
+      free (pbs2->J_Llm_x_float[index_J][index_L][index_l][index_m]);
+      if (has_dd)
+        free (pbs2->ddJ_Llm_x_float[index_J][index_L][index_l][index_m]);
+      pbs2->J_Llm_x_float[index_J][index_L][index_l][index_m] = J_first_copy[index_task];
+      if (has_dd)
+        pbs2->ddJ_Llm_x_float[index_J][index_L][index_l][index_m] = ddJ_first_copy[index_task];
+    }
+  }
+
+  free (J_first_copy);
+  free (ddJ_first_copy);
+
+  if (abort == _TRUE_)
+    return _FAILURE_;
+
+  /* All the leaves of pbs2->J_Llm_x are now allocated */
+  class_call (bessel2_cache_release (pbs2),
+    pbs2->error_message,
+    pbs2->error_message);
+
+  if (pbs2->bessels2_verbose > 1)
+    printf (" -> replicated the projection functions in %d NUMA domains: ~ %3g MB more in use\n",
+      domain_size, (pbs2->has_compact_J == _TRUE_ ? 4 : 8)*pbs2->count_replicated_Js/1e6);
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Free the replicas of the projection functions allocated by bessel2_replicate_J(),
+ * except for the one of the first NUMA domain, which is pbs2->J_Llm_x itself.
+ */
+
+int bessel2_free_J_replicas (
+       struct precision * ppr,
+       struct precision2 * ppr2,
+       struct bessels * pbs,
+       struct bessels2 * pbs2
+       )
+{
+
+  short has_double = (pbs2->has_compact_J == _FALSE_);
+  short has_dd = (ppr->bessels_interpolation == cubic_interpolation);
+
+  for (int domain = 1; domain < pbs2->J_replica_size; ++domain) {
+    for (int index_J = 0; index_J < pbs2->J_size; ++index_J) {
+      for (int index_L = 0; index_L < pbs2->L_size; ++index_L) {
+        for (int index_l = 0; index_l < pbs->l_size; ++index_l) {
+
+          int m_size = MIN (ppr2->index_m_max[pbs2->L[index_L]], ppr2->index_m_max[pbs->l[index_l]]) + 1;
+
+          for (int index_m = 0; index_m < m_size; ++index_m) {
+            if (has_double) {
+              free (pbs2->J_Llm_x_replica[domain][index_J][index_L][index_l][index_m]);
+              if (has_dd)
+                free (pbs2->ddJ_Llm_x_replica[domain][index_J][index_L][index_l][index_m]);
+            }
+            else {
+              free (pbs2->J_Llm_x_float_replica[domain][index_J][index_L][index_l][index_m]);
+              if (has_dd)
+                free (pbs2->ddJ_Llm_x_float_replica[domain][index_J][index_L][index_l][index_m]);
+            }
+          }
+
+          if (has_double) {
+            free (pbs2->J_Llm_x_replica[domain][index_J][index_L][index_l]);
+            if (has_dd)
+              free (pbs2->ddJ_Llm_x_replica[domain][index_J][index_L][index_l]);
+          }
+          else {
+            free (pbs2->J_Llm_x_float_replica[domain][index_J][index_L][index_l]);
+            if (has_dd)
+              free (pbs2->ddJ_Llm_x_float_replica[domain][index_J][index_L][index_l]);
+          }
+        }
+
+        if (has_double) {
+          free (pbs2->J_Llm_x_replica[domain][index_J][index_L]);
+          if (has_dd)
+            free (pbs2->ddJ_Llm_x_replica[domain][index_J][index_L]);
+        }
+        else {
+          free (pbs2->J_Llm_x_float_replica[domain][index_J][index_L]);
+          if (has_dd)
+            free (pbs2->ddJ_Llm_x_float_replica[domain][index_J][index_L]);
+        }
+      }
+
+      if (has_double) {
+        free (pbs2->J_Llm_x_replica[domain][index_J]);
+        if (has_dd)
+          free (pbs2->ddJ_Llm_x_replica[domain][index_J]);
+      }
+      else {
+        free (pbs2->J_Llm_x_float_replica[domain][index_J]);
+        if (has_dd)
+          free (pbs2->ddJ_Llm_x_float_replica[domain][index_J]);
+      }
+    }
+
+    if (has_double) {
+      free (pbs2->J_Llm_x_replica[domain]);
+      if (has_dd)
+        free (pbs2->ddJ_Llm_x_replica[domain]);
+    }
+    else {
+      free (pbs2->J_Llm_x_float_replica[domain]);
+      if (has_dd)
+        free (pbs2->ddJ_Llm_x_float_replica[domain]);
+    }
+  }
+
+  if (pbs2->J_replica_size > 0) {
+    free (pbs2->J_Llm_x_replica);
+    free (pbs2->ddJ_Llm_x_replica);
+    free (pbs2->J_Llm_x_float_replica);
+    free (pbs2->ddJ_Llm_x_float_replica);
+  }
+
+  pbs2->J_replica_size = 0;
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Add the memory counters kept by the threads to those in the bessels2
+ * structure, and reset them in view of the next parallel loop.
+ */
+
+int bessel2_add_counters (
+       struct bessels2 * pbs2,
+       int counter_size,                     /**< input: number of threads */
+       struct bessel2_counters * counters    /**< input/output: counters of each thread, reset to zero */
+       )
+{
+
+  for (int thread = 0; thread < counter_size; ++thread) {
+
+    pbs2->count_allocated_Js += counters[thread].allocated_Js;
+    pbs2->count_adaptive_Js += counters[thread].adaptive_Js;
+    pbs2->count_compact_Js += counters[thread].compact_Js;
+    pbs2->count_released_Js += counters[thread].released_Js;
+    pbs2->compact_J_max_error = MAX (pbs2->compact_J_max_error, counters[thread].compact_max_error);
+
+    counters[thread].allocated_Js = 0;
+    counters[thread].adaptive_Js = 0;
+    counters[thread].compact_Js = 0;
+    counters[thread].released_Js = 0;
+    counters[thread].compact_max_error = 0;
+
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+
+
+
+
 /**
  * Compute the projection function J_Llm(x) using the precomputed table of spherical
  * Bessel functions (pbs2->j_l1) and output the result in J_Llm_x.
@@ -1671,7 +3205,8 @@ int bessel2_j_for_l1(
        struct precision2 * ppr2,
        struct bessels * pbs,
        struct bessels2 * pbs2,
-       int index_l1 /**< input, index inside pbs2->l1 for which to compute the Bessel function */
+       int index_l1, /**< input, index inside pbs2->l1 for which to compute the Bessel function */
+       struct bessel2_counters * pbc  /**< output, memory counters of the calling thread */
        )
 {
   
@@ -1769,13 +3304,11 @@ int bessel2_j_for_l1(
   /* Allocate memory for j_l1[index_l1] */
 
   class_alloc (pbs2->j_l1[index_l1], sizeof(double)*pbs2->x_size_l1[index_l1], pbs2->error_message);
-  #pragma omp atomic
-  pbs2->count_allocated_Js += pbs2->x_size_l1[index_l1];
+  pbc->allocated_Js += pbs2->x_size_l1[index_l1];
 
   if (ppr->bessels_interpolation == cubic_interpolation) {
     class_alloc (pbs2->ddj_l1[index_l1], sizeof(double)*pbs2->x_size_l1[index_l1], pbs2->error_message);
-    #pragma omp atomic
-    pbs2->count_allocated_Js += pbs2->x_size_l1[index_l1];
+    pbc->allocated_Js += pbs2->x_size_l1[index_l1];
   }  
 
 
@@ -8,6 +8,7 @@
  */
 
 #include "bispectra2.h"
+#include <unistd.h>
 
 
 /**
@@ -121,6 +122,42 @@ int bispectra2_indices (
     if (ppr2->m_max_song > 0)
         pbi->has_reduced_bispectrum[pbi->index_bt_intrinsic] = _FALSE_;
 
+  /* The squeezed configurations are built around the smallest multipole, unless
+  the user specified otherwise */
+  if ((ppr2->bispectrum_triangles == squeezed_triangles) && (ppr2->l_squeezed < 0))
+    ppr2->l_squeezed = pbi->l[0];
+
+  /* The multipoles of the requested configurations must be in the l-sampling of
+  the bispectrum, otherwise they would be silently ignored */
+  if (ppr2->bispectrum_triangles == squeezed_triangles) {
+    short found = _FALSE_;
+    for (int index_l=0; index_l < pbi->l_size; ++index_l)
+      if (pbi->l[index_l] == ppr2->l_squeezed)
+        found = _TRUE_;
+    class_test (found == _FALSE_,
+      pbi->error_message,
+      "l_squeezed=%d is not in the l-sampling of the bispectrum", ppr2->l_squeezed);
+  }
+
+  if (ppr2->bispectrum_triangles == listed_triangles) {
+    for (int index_triangle=0; index_triangle < ppr2->triangle_size; ++index_triangle) {
+      int l[3] = {ppr2->triangle_l1[index_triangle], ppr2->triangle_l2[index_triangle], ppr2->triangle_l3[index_triangle]};
+      for (int i=0; i < 3; ++i) {
+        short found = _FALSE_;
+        for (int index_l=0; index_l < pbi->l_size; ++index_l)
+          if (pbi->l[index_l] == l[i])
+            found = _TRUE_;
+        class_test (found == _FALSE_,
+          pbi->error_message,
+          "the multipole l=%d of the configuration (%d,%d,%d) is not in the l-sampling of the bispectrum",
+          l[i], l[0], l[1], l[2]);
+      }
+      class_test ((abs(l[0]-l[1]) > l[2]) || (l[2] > l[0]+l[1]),
+        pbi->error_message,
+        "the configuration (%d,%d,%d) does not satisfy the triangular condition", l[0], l[1], l[2]);
+    }
+  }
+
   return _SUCCESS_;
 
 }
@@ -421,6 +458,35 @@ int bispectra2_intrinsic_init (
     if (pbi->bispectrum_type[index_bt] != intrinsic_bispectrum)
       continue;        
 
+    /* Time the whole computation of the bispectrum, counting one triangle for each requested
+    (l1,l2,l3) configuration and (X,Y,Z) field combination. The parallel regions inside are
+    timed separately. */
+    int index_region;
+    class_call (run_report_region (&(ppr2->report), "bispectra2_intrinsic", "triangles", 1,
+                  &index_region, pbi->error_message),
+      pbi->error_message,
+      pbi->error_message);
+
+    double region_start = run_report_time();
+
+    /* If the transfer functions are streamed, compute them now together with their integrals
+    over k3, for all the fields and azimuthal numbers; see bispectra2_intrinsic_stream_over_k3() */
+    if (ppr2->stream_transfers == _TRUE_)
+      class_call (bispectra2_intrinsic_stream_over_k3 (
+                    ppr,
+                    ppr2,
+                    ppt,
+                    ppt2,
+                    pbs,
+                    pbs2,
+                    ptr,
+                    ptr2,
+                    ppm,
+                    pbi,
+                    pwb),
+        pbi->error_message,
+        pbi->error_message);
+
     /* The XYZ indices refer to the considered field (T,E...). The first, X, refers to the
     second order perturbation, X=T^(2),E^(2)..., while Y and Z refer to the first-order ones:
     X -> second-order, Y -> first-order, Z -> first-order. This association ceases to be valid
@@ -487,24 +553,60 @@ int bispectra2_intrinsic_init (
           // -                        Compute 4D integral                      -
           // -------------------------------------------------------------------
 
-          /* Compute fist integral over k3 */
-          class_call (bispectra2_intrinsic_integrate_over_k3(
-                        ppr,
-                        ppr2,
-                        ppt,
-                        ppt2,
-                        pbs,
-                        pbs2,
-                        ptr,
-                        ptr2,
-                        ppm,
-                        pbi,
-                        pwb->index_tt2_of_bf[X],
-                        index_M3,
-                        offset_L3,
-                        pwb),
-            pbi->error_message,
-            pbi->error_message);
+          /* Compute the 4D integral one l3 at a time, without storing the full
+          intermediate arrays (see bispectra2_intrinsic_integrate_tiled) */
+          if (ppr2->tile_intrinsic_bispectrum == _TRUE_) {
+
+            class_call (bispectra2_intrinsic_integrate_tiled (
+                          ppr,
+                          ppr2,
+                          ppt,
+                          ppt2,
+                          pbs,
+                          pbs2,
+                          ptr,
+                          ptr2,
+                          ppm,
+                          pbi,
+                          index_bt,
+                          pwb->index_tt2_of_bf[X],
+                          index_M3,
+                          offset_L3,
+                          pwb),
+              pbi->error_message,
+              pbi->error_message);
+
+            continue;
+          }
+
+          /* Compute fist integral over k3, unless it was already computed together with the
+          streamed transfer functions. In the latter case, the slab is handed over to
+          pwb->integral_over_k3, which is freed after the integral over k2. */
+          if (ppr2->stream_transfers == _TRUE_) {
+            int index_slab = (X*ppr2->m_size + index_M3)*pwb->streamed_L3_size + offset_L3;
+            pwb->integral_over_k3 = pwb->streamed_integral_over_k3[index_slab];
+            pwb->integral_over_k3_arena = pwb->streamed_integral_over_k3_arena[index_slab];
+            pwb->streamed_integral_over_k3[index_slab] = NULL;
+          }
+          else {
+            class_call (bispectra2_intrinsic_integrate_over_k3(
+                          ppr,
+                          ppr2,
+                          ppt,
+                          ppt2,
+                          pbs,
+                          pbs2,
+                          ptr,
+                          ptr2,
+                          ppm,
+                          pbi,
+                          pwb->index_tt2_of_bf[X],
+                          index_M3,
+                          offset_L3,
+                          pwb),
+              pbi->error_message,
+              pbi->error_message);
+          }
 
 
           for (int Y=0; Y < pbi->bf_size; ++Y) {
@@ -630,6 +732,17 @@ int bispectra2_intrinsic_init (
       } // end of loop on M3  
     } // end of loop on field 'X'
 
+    /* All the streamed slabs were freed after use */
+    if (ppr2->stream_transfers == _TRUE_) {
+      free (pwb->streamed_integral_over_k3);
+      free (pwb->streamed_integral_over_k3_arena);
+    }
+
+    double region_time = run_report_time() - region_start;
+    ppr2->report.regions[index_region].wall_time += region_time;
+    ppr2->report.regions[index_region].busy_time[0] += region_time;
+    ppr2->report.regions[index_region].work[0] += pwb->requested_triangle_size*pbi->bf_size*pbi->bf_size*pbi->bf_size;
+
     // ====================================================================================
     // =                               Consistency checks                                 =
     // ====================================================================================
@@ -770,11 +883,30 @@ wrong/non_negl=%g, <diff> of matches=%g, <diff> of wrongs=%g\n",
 
           int index_l1_min = pbi->index_l_triangular_min[index_l2][index_l3];          
           int index_l2_min = pbi->index_l_triangular_min[index_l1][index_l3];
+
+          /* The configurations that were not requested are set to zero */
+          short needed;
+          class_call (bispectra2_needed_triangle (
+                        ppr2,
+                        pbi,
+                        index_l1,
+                        index_l2,
+                        index_l3,
+                        &needed),
+            pbi->error_message,
+            pbi->error_message);
           
           for (int X=0; X < pbi->bf_size; ++X) {
             for (int Y=0; Y < pbi->bf_size; ++Y) {
               for (int Z=0; Z < pbi->bf_size; ++Z) {
 
+                if (needed == _FALSE_) {
+                  pbi->bispectra[index_bt][X][Y][Z][index_l1_l2_l3] = 0;
+                  #pragma omp atomic
+                  pbi->count_memorised_for_bispectra++;
+                  continue;
+                }
+
                 pbi->bispectra[index_bt][X][Y][Z][index_l1_l2_l3] =
                   pwb->unsymmetrised_bispectrum[X][Y][Z][index_l1][index_l2][index_l3-index_l3_min]
                 + pwb->unsymmetrised_bispectrum[Y][X][Z][index_l2][index_l1][index_l3-index_l3_min]
@@ -858,6 +990,12 @@ int bispectra2_intrinsic_workspace_init (
   sight sources, that is ppt2->k */
   pwb->k_smooth_grid = ppt2->k;
   pwb->k_smooth_size = ppt2->k_size;
+
+  /* The streamed k3 integrals are allocated by bispectra2_intrinsic_stream_over_k3() */
+  pwb->streamed_integral_over_k3 = NULL;
+  pwb->streamed_integral_over_k3_arena = NULL;
+  pwb->streamed_L3_size = 1;
+  pwb->streamed_slab_size = 0;
   
   
   
@@ -890,6 +1028,49 @@ int bispectra2_intrinsic_workspace_init (
     pwb->k_window_inverse[index_k] = pow(k,2);
   }
 
+  /* The interpolation of the smooth k1 and k2 directions in the points of ptr->q is always
+  performed between the same grids. Here we find once and for all the nodes and the weights
+  of the interpolation, so that bispectra2_interpolate_smooth_k() is a simple loop. */
+  class_alloc (pwb->k_interp_index, ptr->q_size*sizeof(int), pbi->error_message);
+  class_alloc (pwb->k_interp_a, ptr->q_size*sizeof(double), pbi->error_message);
+  class_alloc (pwb->k_interp_b, ptr->q_size*sizeof(double), pbi->error_message);
+  class_alloc (pwb->k_interp_a3, ptr->q_size*sizeof(double), pbi->error_message);
+  class_alloc (pwb->k_interp_b3, ptr->q_size*sizeof(double), pbi->error_message);
+  class_alloc (pwb->k_interp_h, ptr->q_size*sizeof(double), pbi->error_message);
+
+  int index_k_pt = 0;
+  double * k_pt = pwb->k_smooth_grid;
+  double h = k_pt[index_k_pt+1] - k_pt[index_k_pt];
+
+  for (int index_k_tr=0; index_k_tr < ptr->q_size; ++index_k_tr) {
+
+    while (((index_k_pt+1) < pwb->k_smooth_size) && (k_pt[index_k_pt+1] < ptr->q[index_k_tr])) {
+      index_k_pt++;
+      h = k_pt[index_k_pt+1] - k_pt[index_k_pt];
+    }
+
+    class_test(h==0., pbi->error_message, "stop to avoid division by zero");
+    class_test((index_k_pt+1) >= pwb->k_smooth_size, pbi->error_message,
+      "some of the elements in k_tr are larger than the largest k_pt. Stop to avoid seg fault.");
+
+    double b = (ptr->q[index_k_tr] - k_pt[index_k_pt])/h;
+    double a = 1.-b;
+
+    pwb->k_interp_index[index_k_tr] = index_k_pt;
+    pwb->k_interp_a[index_k_tr] = a;
+    pwb->k_interp_b[index_k_tr] = b;
+    pwb->k_interp_a3[index_k_tr] = a*a*a-a;
+    pwb->k_interp_b3[index_k_tr] = b*b*b-b;
+    pwb->k_interp_h[index_k_tr] = h;
+  }
+
+  pwb->scalar_kernels = ppr2->scalar_bispectrum_kernels;
+
+  /* Weights for the trapezoidal integration over r */
+  class_alloc (pwb->r_weight, pwb->r_size*sizeof(double), pbi->error_message);
+  for (int index_r=0; index_r < pwb->r_size; ++index_r)
+    pwb->r_weight[index_r] = pwb->r[index_r]*pwb->r[index_r]*pwb->delta_r[index_r];
+
   
   
   
@@ -1006,6 +1187,94 @@ int bispectra2_intrinsic_workspace_init (
   }
 
 
+  /* Position of each (l3,l2) pair in the tables of geometrical factors, which are stored
+  contiguously over the triangular (l3,l2,l1) domain */
+  class_alloc (pwb->triangle_start, pbi->l_size*sizeof(long int *), pbi->error_message);
+  pwb->triangle_size = 0;
+
+  for (int index_l3=0; index_l3 < pbi->l_size; ++index_l3) {
+    class_alloc (pwb->triangle_start[index_l3], pbi->l_size*sizeof(long int), pbi->error_message);
+    for (int index_l2=0; index_l2 < pbi->l_size; ++index_l2) {
+      pwb->triangle_start[index_l3][index_l2] = pwb->triangle_size;
+      pwb->triangle_size += pbi->l_triangular_size[index_l3][index_l2];
+    }
+  }
+
+  /* Mark the configurations for which the bispectrum was requested */
+  class_calloc (pwb->triangle_mask, pwb->triangle_size, sizeof(short), pbi->error_message);
+  class_alloc (pwb->l3l2_triangle_count, pbi->l_size*sizeof(int *), pbi->error_message);
+  class_calloc (pwb->l3_mask, pbi->l_size, sizeof(short), pbi->error_message);
+
+  long int requested_triangles = 0;
+
+  for (int index_l3=0; index_l3 < pbi->l_size; ++index_l3) {
+
+    class_calloc (pwb->l3l2_triangle_count[index_l3], pbi->l_size, sizeof(int), pbi->error_message);
+
+    for (int index_l2=0; index_l2 < pbi->l_size; ++index_l2) {
+
+      int index_l1_min = pbi->index_l_triangular_min[index_l3][index_l2];
+      int index_l1_max = pbi->index_l_triangular_max[index_l3][index_l2];
+
+      for (int index_l1=index_l1_min; index_l1 <= index_l1_max; ++index_l1) {
+
+        short needed;
+
+        class_call (bispectra2_needed_triangle (
+                      ppr2,
+                      pbi,
+                      index_l1,
+                      index_l2,
+                      index_l3,
+                      &needed),
+          pbi->error_message,
+          pbi->error_message);
+
+        if (needed == _FALSE_)
+          continue;
+
+        pwb->triangle_mask[pwb->triangle_start[index_l3][index_l2] + index_l1-index_l1_min] = _TRUE_;
+        pwb->l3l2_triangle_count[index_l3][index_l2]++;
+        pwb->l3_mask[index_l3] = _TRUE_;
+        requested_triangles++;
+      }
+    }
+  }
+
+  class_test (requested_triangles == 0,
+    pbi->error_message,
+    "none of the requested (l1,l2,l3) configurations is in the l-sampling of the bispectrum");
+
+  pwb->requested_triangle_size = requested_triangles;
+
+  if ((pbi->bispectra_verbose > 1) && (ppr2->bispectrum_triangles != all_triangles))
+    printf (" -> computing %ld out of %ld (l1,l2,l3) configurations, including permutations\n",
+      requested_triangles, pwb->triangle_size);
+
+  /* Queue of (l3,l2) pairs to be shared between the threads in the loops over the multipoles */
+  class_call (bispectra2_l3l2_queue (
+                pbi,
+                pwb->l3l2_triangle_count,
+                &(pwb->l3l2_pair_size),
+                &(pwb->l3l2_pairs)),
+    pbi->error_message,
+    pbi->error_message);
+
+  /* The tables of geometrical factors are computed when needed by
+  bispectra2_intrinsic_geometrical_factors(); initialise them to NULL */
+  class_alloc (pwb->geometrical_table, 2*sizeof(double ****), pbi->error_message);
+
+  for (int index_parity=0; index_parity < 2; ++index_parity) {
+    class_alloc (pwb->geometrical_table[index_parity], ppr2->m_size*sizeof(double ***), pbi->error_message);
+    for (int index_M3=0; index_M3 < ppr2->m_size; ++index_M3) {
+      int offset_size = 2*abs(ppr2->m[index_M3])+1;
+      class_alloc (pwb->geometrical_table[index_parity][index_M3], offset_size*sizeof(double **), pbi->error_message);
+      for (int offset_L3=0; offset_L3 < offset_size; ++offset_L3)
+        class_calloc (pwb->geometrical_table[index_parity][index_M3][offset_L3], offset_size, sizeof(double *), pbi->error_message);
+    }
+  }
+
+
   /* Compute the m-dependent coefficient that enters the rescaling of the second-order transfer
   function in the bispectrum integral. */
   for (int index_M3=0; index_M3 < ppr2->m_size; ++index_M3) {
@@ -1049,6 +1318,33 @@ int bispectra2_intrinsic_workspace_free(
   free (pwb->r);
   free (pwb->delta_r);
 
+  /* Free the tables of geometrical factors */
+  for (int index_parity=0; index_parity < 2; ++index_parity) {
+    for (int index_M3=0; index_M3 < ptr2->m_size; ++index_M3) {
+      int offset_size = 2*abs(ptr2->m[index_M3])+1;
+      for (int offset_L3=0; offset_L3 < offset_size; ++offset_L3) {
+        for (int offset_L1=0; offset_L1 < offset_size; ++offset_L1)
+          free (pwb->geometrical_table[index_parity][index_M3][offset_L3][offset_L1]);
+        free (pwb->geometrical_table[index_parity][index_M3][offset_L3]);
+      }
+      free (pwb->geometrical_table[index_parity][index_M3]);
+    }
+    free (pwb->geometrical_table[index_parity]);
+  }
+  free (pwb->geometrical_table);
+
+  for (int index_l3=0; index_l3 < pbi->l_size; ++index_l3)
+    free (pwb->triangle_start[index_l3]);
+  free (pwb->triangle_start);
+
+  free (pwb->l3l2_pairs);
+
+  for (int index_l3=0; index_l3 < pbi->l_size; ++index_l3)
+    free (pwb->l3l2_triangle_count[index_l3]);
+  free (pwb->l3l2_triangle_count);
+  free (pwb->triangle_mask);
+  free (pwb->l3_mask);
+
   /* Parallelization variables */
   int thread = 0;
   int abort = _FALSE_;
@@ -1074,6 +1370,13 @@ int bispectra2_intrinsic_workspace_free(
   free(pwb->interpolated_integral);
   free(pwb->f);
   free(pwb->k_window_inverse);
+  free(pwb->k_interp_index);
+  free(pwb->k_interp_a);
+  free(pwb->k_interp_b);
+  free(pwb->k_interp_a3);
+  free(pwb->k_interp_b3);
+  free(pwb->k_interp_h);
+  free(pwb->r_weight);
  
   /* Free pwb->unsymmetrised bispectrum */
   for (int X=0; X < pbi->bf_size; ++X) {
@@ -1099,12 +1402,165 @@ int bispectra2_intrinsic_workspace_free(
   
 }
 
-  
 
 
+/**
+ * Determine whether the intrinsic bispectrum is needed in the (l1,l2,l3) configuration,
+ * according to ppr2->bispectrum_triangles.
+ *
+ * The answer does not depend on the order of the multipoles. The unsymmetrised
+ * bispectrum is computed for all the permutations of a configuration and is then
+ * symmetrised, so a requested configuration also needs its permutations.
+ */
+
+int bispectra2_needed_triangle (
+        struct precision2 * ppr2,
+        struct bispectra * pbi,
+        int index_l1,
+        int index_l2,
+        int index_l3,
+        short * needed  /**< output: _TRUE_ if the configuration was requested */
+        )
+{
+
+  int l1 = pbi->l[index_l1];
+  int l2 = pbi->l[index_l2];
+  int l3 = pbi->l[index_l3];
 
+  /* Sort the multipoles so that l_min <= l_mid <= l_max */
+  int l_min = MIN (l1, MIN (l2, l3));
+  int l_max = MAX (l1, MAX (l2, l3));
+  int l_mid = l1 + l2 + l3 - l_min - l_max;
 
-int bispectra2_intrinsic_integrate_over_k3 (
+  if (ppr2->bispectrum_triangles == all_triangles) {
+    *needed = _TRUE_;
+  }
+  else if (ppr2->bispectrum_triangles == squeezed_triangles) {
+    *needed = (l_min == ppr2->l_squeezed);
+  }
+  else if (ppr2->bispectrum_triangles == equilateral_triangles) {
+    *needed = (l_min == l_max);
+  }
+  else if (ppr2->bispectrum_triangles == listed_triangles) {
+
+    *needed = _FALSE_;
+
+    for (int index_triangle=0; index_triangle < ppr2->triangle_size; ++index_triangle) {
+
+      int t1 = ppr2->triangle_l1[index_triangle];
+      int t2 = ppr2->triangle_l2[index_triangle];
+      int t3 = ppr2->triangle_l3[index_triangle];
+      int t_min = MIN (t1, MIN (t2, t3));
+      int t_max = MAX (t1, MAX (t2, t3));
+      int t_mid = t1 + t2 + t3 - t_min - t_max;
+
+      if ((t_min == l_min) && (t_mid == l_mid) && (t_max == l_max)) {
+        *needed = _TRUE_;
+        break;
+      }
+    }
+  }
+  else {
+    class_stop (pbi->error_message, "bispectrum_triangles=%d not implemented", ppr2->bispectrum_triangles);
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Build the queue of (l3,l2) pairs that is shared between the threads in the
+ * parallel loops over the multipoles of the intrinsic bispectrum, that is in
+ * bispectra2_intrinsic_integrate_over_r(), bispectra2_intrinsic_geometrical_table()
+ * and bispectra2_intrinsic_geometrical_factors().
+ *
+ * Distributing the l3 values alone leaves the threads idle at the end of the
+ * loops, because the number of (l2,l1) configurations grows with l3 and the
+ * last few l3 values dominate the cost. The cost of a (l3,l2) pair is instead
+ * proportional to its number of requested l1 values, l3l2_triangle_count[index_l3][index_l2];
+ * we sort the queue so that the most expensive pairs come first, and skip the
+ * pairs with no l1 values. 
+ *
+ * The queue is written in the array pointed by pairs, which must be freed by
+ * the caller.
+ */
+
+int bispectra2_l3l2_queue (
+        struct bispectra * pbi,
+        int ** l3l2_triangle_count,         /**< input: number of requested l1 values for each (l3,l2) pair */
+        int * pair_size,                    /**< output: number of (l3,l2) pairs in the queue */
+        struct bispectra2_l3l2_pair ** pairs  /**< output: queue of (l3,l2) pairs, sorted by cost */
+        )
+{
+
+  class_alloc (*pairs, pbi->l_size*pbi->l_size*sizeof(struct bispectra2_l3l2_pair), pbi->error_message);
+
+  *pair_size = 0;
+
+  for (int index_l3 = pbi->l_size-1; index_l3 >= 0; --index_l3) {
+    for (int index_l2 = 0; index_l2 < pbi->l_size; ++index_l2) {
+
+      if (l3l2_triangle_count[index_l3][index_l2] <= 0)
+        continue;
+
+      (*pairs)[*pair_size].index_l3 = index_l3;
+      (*pairs)[*pair_size].index_l2 = index_l2;
+      (*pairs)[*pair_size].cost = l3l2_triangle_count[index_l3][index_l2];
+      (*pair_size)++;
+
+    }
+  }
+
+  qsort (*pairs, *pair_size, sizeof(struct bispectra2_l3l2_pair), bispectra2_compare_l3l2_pairs);
+
+  if (pbi->bispectra_verbose > 2)
+    printf (" -> distributing %d (l3,l2) pairs between threads\n", *pair_size);
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Comparison function to sort the (l3,l2) pairs by decreasing cost, to
+ * be passed to qsort().
+ */
+
+int bispectra2_compare_l3l2_pairs (
+        const void * a,
+        const void * b
+        )
+{
+
+  double cost_a = ((const struct bispectra2_l3l2_pair *)a)->cost;
+  double cost_b = ((const struct bispectra2_l3l2_pair *)b)->cost;
+
+  return (cost_a < cost_b) - (cost_a > cost_b);
+
+}
+
+
+
+
+
+/**
+ * Compute the integral over k3 of the intrinsic bispectrum, INT_l3(r,k1,k2), for a
+ * single l3 and for all values of r, k1 and k2, and store it in
+ * integral_over_k3[index_r][index_k1][index_k2].
+ *
+ * This function is called by bispectra2_intrinsic_integrate_over_k3(), which
+ * computes the integral for all l3 values, and by bispectra2_intrinsic_integrate_tiled().
+ * The second-order transfer functions for l3 must be already in memory.
+ *
+ * The k1 levels are distributed dynamically between the threads. On nodes with several
+ * NUMA domains, each k1 level of ptr2->transfer is placed in the memory of the domain
+ * that owns it (see transfer2_allocate_k1_level()), and the threads take the k1 levels
+ * of their own domain first; only when these are finished, they help the other domains.
+ */
+
+int bispectra2_intrinsic_integrate_over_k3_for_l3 (
     struct precision * ppr,
     struct precision2 * ppr2,
     struct perturbs * ppt,
@@ -1117,7 +1573,10 @@ int bispectra2_intrinsic_integrate_over_k3 (
     struct bispectra * pbi,
     int index_tt2_k3,
     int index_M3,
-    int offset_L3,
+    int index_l3,
+    int index_L3,
+    double *** integral_over_k3, /* out */
+    double * average_k3_grid_size, /* out, incremented */
     struct bispectra_workspace_intrinsic * pwb
     )
 {
@@ -1125,289 +1584,445 @@ int bispectra2_intrinsic_integrate_over_k3 (
   /* Parallelization variables */
   int thread = 0;
   int abort = _FALSE_;
-  
-  // =========================================================================================
-  // =                             Allocate memory for I_l3(r,k1,k2)                         =
-  // =========================================================================================
-    
-  /* Initialize counter */
-  pwb->count_allocated_for_integral_over_k3 = 0;
-  
-  /* Allocate l3-level.  Note that, even if l3 must satisfy the triangular
-  inequality, we allocate this level for all the possible l3 values.  We do so because this
-  array is going to be used by all (l1,l2) computations that follow, which means that l3 will
-  eventually cover all the allowed range. */
-  class_alloc (pwb->integral_over_k3, pbi->l_size*sizeof(double ***), pbi->error_message);
-  
-  for (int index_l3=0; index_l3<pbi->l_size; ++index_l3) {
-    
-    /* Allocate r-level */
-    class_alloc (pwb->integral_over_k3[index_l3], pwb->r_size*sizeof(double **), pbi->error_message);
-  
-    /* Allocate 'k1' level */
-    for (int index_r=0; index_r < pwb->r_size; ++index_r) {
-  
-      int k1_size = pwb->k_smooth_size;
-      class_alloc (pwb->integral_over_k3[index_l3][index_r], k1_size*sizeof(double *), pbi->error_message);
+  int number_of_threads = 1;
+  #ifdef _OPENMP
+  number_of_threads = omp_get_max_threads();
+  #endif
 
-      /* Allocate 'k2' level. Make sure to use calloc. */
-      for (int index_k1=0; index_k1<k1_size; ++index_k1) {
-  
-        int k2_size = index_k1 + 1;
-        class_calloc (pwb->integral_over_k3[index_l3][index_r][index_k1], k2_size, sizeof(double), pbi->error_message);
-        
-        /* Increase memory counter, excluding non-physical configurations where |M3|>l3 */
-        if (pwb->abs_M3 <= pbi->l[index_l3])
-          pwb->count_allocated_for_integral_over_k3 += k2_size;
-  
-      } // end of for(index_k1)
-    } // end of for(index_r)
-  } // end of for(index_l3)
-    
-  if (pbi->bispectra_verbose > 2)
-    printf("     * allocated ~ %.3g MB (%ld doubles) for the k3-integral array (k_size=%d)\n",
-      pwb->count_allocated_for_integral_over_k3*sizeof(double)/1e6, pwb->count_allocated_for_integral_over_k3, pwb->k_smooth_size);
+  /* Time spent by each thread integrating over k3 */
+  int index_region;
+  class_call (run_report_region (&(ppr2->report), "bispectra2_integrate_over_k3", "", number_of_threads,
+                &index_region, pbi->error_message),
+    pbi->error_message,
+    pbi->error_message);
 
+  double region_start = run_report_time();
 
-  // ===================================================================================================
-  // =                               Compute the INT_l3(r, k1, k2)  integral                           =
-  // ===================================================================================================  
-  
-  /* Initialize counter for the number of integrals computed */
-  pwb->count_memorised_for_integral_over_k3 = 0;
-  
-  /* We shall keep track of the average size of the integration grid in k3, which is (k1,k2) dependent */
-  double average_k3_grid_size = 0;
-  
-  /* We compute the integral over k3 for all possible l-values */
-  for (int index_l3 = 0; index_l3 < pbi->l_size; ++index_l3) {
+  /* Queue of k1 levels for each NUMA domain; the levels owned by a domain are contiguous,
+  and next_k1[domain] is the next one to be taken */
+  int domain_size = ppr2->numa_domains;
+  int * next_k1, * end_k1;
+  class_calloc (next_k1, domain_size, sizeof(int), pbi->error_message);
+  class_calloc (end_k1, domain_size, sizeof(int), pbi->error_message);
 
-    int l3 = pbi->l[index_l3];
-    int L3 = abs(l3-pwb->abs_M3) + offset_L3;
+  for (int index_k1 = pwb->k_smooth_size-1; index_k1 >= 0; --index_k1) {
+    int domain = numa_k1_domain (index_k1, pwb->k_smooth_size, domain_size);
+    next_k1[domain] = index_k1;
+    if (end_k1[domain] == 0)
+      end_k1[domain] = index_k1+1;
+  }
 
-    /* The configurations with |M3|>l3 do not contribute to the bispectrum because
-    they would violate the 3j-symbol properties */
-    if (pwb->abs_M3 > pbi->l[index_l3])
-      continue;
+  abort = _FALSE_;
+  #pragma omp parallel shared (abort) private (thread)
+  {
 
-    /* Skip the (L3,l3,M3) configurations forbidden by the triangular condition */
-    if (L3 > (l3+pwb->abs_M3)) {
-      pwb->count_memorised_for_integral_over_k3 += 0.5*pwb->k_smooth_size*(pwb->k_smooth_size+1)*pwb->r_size;
-      continue;
-    }
-    
-    /* Find L3 inside pbs2->l1, the list of l's where we computed the Bessel functions */
-    int index_L3 = pbs2->index_l1[L3];
+    #ifdef _OPENMP
+    thread = omp_get_thread_num();
+    #endif
 
-    /* Paranoid android */
-    class_test ((ppr2->m_max_song==0) && (l3!=L3),
-      pbi->error_message,
-      "inconsistency! for scalar modes, L3 must be equal to l3");
+    int thread_domain = numa_thread_domain (thread, number_of_threads, domain_size);
+
+    while (_TRUE_) {
+
+      /* Take the next k1 level, starting from the domain of the thread */
+      int index_k1 = -1;
+
+      for (int i = 0; (i < domain_size) && (index_k1 < 0); ++i) {
+        int domain = (thread_domain + i) % domain_size;
+        int next;
+        #pragma omp atomic capture
+        next = next_k1[domain]++;
+        if (next < end_k1[domain])
+          index_k1 = next;
+      }
+
+      if (index_k1 < 0)
+        break;
+
+      double busy_start = run_report_time();
+
+      /* We only need to consider those k2's that are equal or smaller than k1,
+      as the quadratic sources were symmetrised  in the perturbation2 module */
+      for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+
+        int k3_size;
+
+        class_call_parallel (bispectra2_intrinsic_integrate_over_k3_for_k1k2 (
+                               ppr,
+                               ppr2,
+                               ppt2,
+                               pbs,
+                               pbs2,
+                               ptr2,
+                               ppm,
+                               pbi,
+                               index_tt2_k3,
+                               index_M3,
+                               index_l3,
+                               index_L3,
+                               index_k1,
+                               index_k2,
+                               pwb->k3_grid[thread],
+                               pwb->delta_k3[thread],
+                               integral_over_k3,
+                               &k3_size,
+                               pwb),
+          pbi->error_message,
+          pbi->error_message);
 
-    class_test (pbs2->l1[index_L3]!=L3,
-      pbi->error_message,
-      "error in the indexing of pbs2->l1. Is the pbs2->extend_l1_using_m parameter true?");
+        /* Update the counters */
+        #pragma omp atomic
+        *average_k3_grid_size += (double)k3_size*pwb->r_size;
 
-    /* Load the transfer functions from disk */
-    if ((ppr2->load_transfers_from_disk == _TRUE_) || (ppr2->store_transfers_to_disk == _TRUE_)) {
-      class_call (transfer2_load_transfers_from_disk (
-                    ppt2,
-                    ptr2,
-                    index_tt2_k3 + ptr2->lm_array[index_l3][index_M3]),
-        ptr2->error_message,
-        pbi->error_message);
-    }
-  
-    if (pbi->bispectra_verbose > 2)
-      printf("     * computing the k3 integral for l3=%d, index_l3=%d, L3=%d, index_L3=%d\n",
-        l3, index_l3, pbs2->l1[index_L3], index_L3);
+        #pragma omp atomic
+        pwb->count_memorised_for_integral_over_k3 += pwb->r_size;
 
-    abort = _FALSE_;
-    #pragma omp parallel shared (abort) private (thread)
-    {
-  
-      #ifdef _OPENMP
-      thread = omp_get_thread_num();
-      #endif
-  
-      #pragma omp for schedule (dynamic)
-      for (int index_k1 = 0; index_k1 < pwb->k_smooth_size; ++index_k1) {
-  
-        double k1 = pwb->k_smooth_grid[index_k1];
+        #pragma omp flush(abort)
 
-        /* We only need to consider those k2's that are equal or smaller than k1,
-        as the quadratic sources were symmetrised  in the perturbation2 module */
-        for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+      } // end of for(index_k2)
 
-          double k2 = pwb->k_smooth_grid[index_k2]; 
+      ppr2->report.regions[index_region].busy_time[thread] += run_report_time() - busy_start;
 
-          if (pbi->bispectra_verbose > 4)
-            printf ("      \\ computing (index_k1,index_k2)=(%4d,%4d), (k1,k2)=(%g,%g)\n",
-              index_k1, index_k2, k1, k2);
-  
-          // ===================================================
-          // =            Fix the integration domain           =
-          // ===================================================
+    } // end of while(index_k1)
+  } if (abort == _TRUE_) return _FAILURE_; /* end of parallel region */
 
-          int dump;
+  ppr2->report.regions[index_region].wall_time += run_report_time() - region_start;
 
-          /* Compute the integration grid in the k3 variable */
-          class_call_parallel (transfer2_get_k3_list (
-                                 ppr,
-                                 ppr2,
-                                 ppt2,
-                                 pbs,
-                                 pbs2,
-                                 ptr2,
-                                 index_k1,
-                                 index_k2,
-                                 pwb->k3_grid[thread],  /* output */
-                                 &dump   
-                                 ),
-            ptr2->error_message,
-            pbi->error_message);
+  free (next_k1);
+  free (end_k1);
 
-          /* Get the size of the integration grid. Note that when extrapolation is turned on, the k3-grid will
-          also include values that do not satisfty the triangular condition k1 + k2 = k3. */
-          int k3_size = ptr2->k_size_k1k2[index_k1][index_k2];
-          
-          class_test_parallel (k3_size < 2,
-            pbi->error_message,
-            "integration grid has less than two elements, cannot use trapezoidal integration");
-          
-          /* Determine the measure for the trapezoidal rule for k3 */  
-          pwb->delta_k3[thread][0] = pwb->k3_grid[thread][1] - pwb->k3_grid[thread][0];
-            
-          for (int index_k3=1; index_k3<(k3_size-1); ++index_k3)
-            pwb->delta_k3[thread][index_k3] = pwb->k3_grid[thread][index_k3+1] - pwb->k3_grid[thread][index_k3-1];
-            
-          pwb->delta_k3[thread][k3_size-1] = pwb->k3_grid[thread][k3_size-1] - pwb->k3_grid[thread][k3_size-2];
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Compute the integral over k3 of the intrinsic bispectrum, INT_l3(r,k1,k2), for a
+ * single (l3,m3,k1,k2) configuration and for all values of r, and store it in
+ * integral_over_k3[index_r][index_k1][index_k2].
+ *
+ * The integration grid in k3 is written in k3_grid and its trapezoidal measure in
+ * delta_k3, which must have ptr2->k3_size_max elements; when the function is called
+ * in a parallel loop, each thread has to provide its own arrays. Only the index_k1
+ * level of the second-order transfer functions needs to be in memory.
+ *
+ * This function is called by bispectra2_intrinsic_integrate_over_k3_for_l3(), which
+ * loops over (k1,k2), and by bispectra2_intrinsic_integrate_over_k3_for_k1(), which
+ * loops over (l3,m3,k2).
+ */
+
+int bispectra2_intrinsic_integrate_over_k3_for_k1k2 (
+    struct precision * ppr,
+    struct precision2 * ppr2,
+    struct perturbs2 * ppt2,
+    struct bessels * pbs,
+    struct bessels2 * pbs2,
+    struct transfers2 * ptr2,
+    struct primordial * ppm,
+    struct bispectra * pbi,
+    int index_tt2_k3,
+    int index_M3,
+    int index_l3,
+    int index_L3,
+    int index_k1,
+    int index_k2,
+    double * k3_grid,             /* workspace */
+    double * delta_k3,            /* workspace */
+    double *** integral_over_k3,  /* out */
+    int * k3_size,                /* out, size of the k3 grid */
+    struct bispectra_workspace_intrinsic * pwb
+    )
+{
+
+  int abs_M3 = abs(ppr2->m[index_M3]);
+
+  if (pbi->bispectra_verbose > 4)
+    printf ("      \\ computing (index_k1,index_k2)=(%4d,%4d), (k1,k2)=(%g,%g)\n",
+      index_k1, index_k2, pwb->k_smooth_grid[index_k1], pwb->k_smooth_grid[index_k2]);
+
+  // ===================================================
+  // =            Fix the integration domain           =
+  // ===================================================
+
+  int dump;
+
+  /* Compute the integration grid in the k3 variable */
+  class_call (transfer2_get_k3_list (
+                ppr,
+                ppr2,
+                ppt2,
+                pbs,
+                pbs2,
+                ptr2,
+                index_k1,
+                index_k2,
+                k3_grid,  /* output */
+                &dump
+                ),
+    ptr2->error_message,
+    pbi->error_message);
+
+  /* Get the size of the integration grid. Note that when extrapolation is turned on, the k3-grid will
+  also include values that do not satisfty the triangular condition k1 + k2 = k3. */
+  *k3_size = ptr2->k_size_k1k2[index_k1][index_k2];
+
+  class_test (*k3_size < 2,
+    pbi->error_message,
+    "integration grid has less than two elements, cannot use trapezoidal integration");
+
+  /* Determine the measure for the trapezoidal rule for k3 */
+  delta_k3[0] = k3_grid[1] - k3_grid[0];
+
+  for (int index_k3=1; index_k3<(*k3_size-1); ++index_k3)
+    delta_k3[index_k3] = k3_grid[index_k3+1] - k3_grid[index_k3-1];
+
+  delta_k3[*k3_size-1] = k3_grid[*k3_size-1] - k3_grid[*k3_size-2];
 
 #ifdef DEBUG
-          /* Let's be super cautious */
-          for (int index_k3=0; index_k3<k3_size; ++index_k3)
-            class_test_parallel (pwb->delta_k3[thread][index_k3] < 0,
-              pbi->error_message,
-              "something went terribly wrong, negative trapezoidal measure for index_k1=%d, index_k2=%d :-/",
-              index_k1, index_k2);
+  /* Let's be super cautious */
+  for (int index_k3=0; index_k3<*k3_size; ++index_k3)
+    class_test (delta_k3[index_k3] < 0,
+      pbi->error_message,
+      "something went terribly wrong, negative trapezoidal measure for index_k1=%d, index_k2=%d :-/",
+      index_k1, index_k2);
 #endif // DEBUG
 
-          /* Define the pointer to the second-order transfer function as a function of k3.
-          Note that this transfer function has already been rescaled according to eq. 6.26
-          of http://arxiv.org/abs/1405.2280 in the perturbations.c module.  */
-          double * transfer = ptr2->transfer[index_tt2_k3 + ptr2->lm_array[index_l3][index_M3]]
-                              [index_k1]
-                              [index_k2];
-          
+  /* Define the pointer to the second-order transfer function as a function of k3.
+  Note that this transfer function has already been rescaled according to eq. 6.26
+  of http://arxiv.org/abs/1405.2280 in the perturbations.c module.  */
+  double * transfer = ptr2->transfer[index_tt2_k3 + ptr2->lm_array[index_l3][index_M3]]
+                      [index_k1]
+                      [index_k2];
+
 #ifdef DEBUG
-          /* We expect the second-order transfer function to be order unity for scalar modes */
-          if (pwb->abs_M3 == 0) {
-            double expected_scale = 1;
-            for (int index_k3=0; index_k3 < k3_size; ++index_k3) {
-              class_test_permissive (fabs(transfer[index_k3]) > (expected_scale*1000),
-                pbi->error_message,
-                "found extremely large value for second-order transfer function: T_l3_m3(k1,k2,k3_tr)=%g\
+  /* We expect the second-order transfer function to be order unity for scalar modes */
+  if (abs_M3 == 0) {
+    double expected_scale = 1;
+    for (int index_k3=0; index_k3 < *k3_size; ++index_k3) {
+      class_test_permissive (fabs(transfer[index_k3]) > (expected_scale*1000),
+        pbi->error_message,
+        "found extremely large value for second-order transfer function: T_l3_m3(k1,k2,k3_tr)=%g\
  for l3=%d[%d], m3=%d[%d], k1=%g[%d], k2=%g[%d], k3_tr=%g[%d]\n",
-                transfer[index_k3], pbi->l[index_l3], index_l3, pwb->abs_M3, ppr2->index_m[pwb->abs_M3],
-                ppt2->k[index_k1], index_k1, ppt2->k[index_k2], index_k2, 
-                pwb->k3_grid[thread][index_k3], index_k3);
-            }
-          }
+        transfer[index_k3], pbi->l[index_l3], index_l3, abs_M3, ppr2->index_m[abs_M3],
+        ppt2->k[index_k1], index_k1, ppt2->k[index_k2], index_k2,
+        k3_grid[index_k3], index_k3);
+    }
+  }
 #endif // DEBUG
 
 
-          // ===================================================
-          // =                     Integrate                   =
-          // ===================================================
-  
-          for (int index_r = 0; index_r < pwb->r_size; ++index_r) {
-          
-            /* It is important to note that the used Bessel here has order L3 rather than l3 */
-            class_call_parallel (bessel2_convolution (
-                ppr,
-                pbs2,
-                pwb->k3_grid[thread],
-                pwb->delta_k3[thread],
-                k3_size,
-                transfer,
-                NULL,
-                index_L3,
-                pwb->r[index_r],
-                &(pwb->integral_over_k3[index_l3][index_r][index_k1][index_k2]),
-                pbi->error_message
-                ),
-              pbi->error_message,
-              pbi->error_message);
+  // ===================================================
+  // =                     Integrate                   =
+  // ===================================================
+
+  for (int index_r = 0; index_r < pwb->r_size; ++index_r) {
+
+    /* It is important to note that the used Bessel here has order L3 rather than l3 */
+    class_call (bessel2_convolution (
+        ppr,
+        pbs2,
+        k3_grid,
+        delta_k3,
+        *k3_size,
+        transfer,
+        NULL,
+        index_L3,
+        pwb->r[index_r],
+        &(integral_over_k3[index_r][index_k1][index_k2]),
+        pbi->error_message
+        ),
+      pbi->error_message,
+      pbi->error_message);
 
 #ifdef DEBUG
-            /* Check that when m is odd and k1=k2, then T(k1,k2,k3) is small with respect to 1.
-            This should be the case because the odd-m quadratic sources always vanish for k1==k2
-            (see comment for vector Q_SS in perturb2_quadratic_sources()), unless non-vanishing
-            initial conditions are given */
-            /* TODO: Include this check in perturb2_quadratic_sources(), which is the quantity
-            that we know should vanish. The bispectrum could still be non-vanishing for non-zero
-            initial conditions.  */
-            if ((index_k1==index_k2) && (pwb->abs_M3%2!=0)) {
-              double expected_scale = ppm->A_s*ppm->A_s;
-              double epsilon = 1e-4*expected_scale;
-              class_test_permissive (
-                fabs (pwb->integral_over_k3[index_l3][index_r][index_k1][index_k2]) > epsilon,
-                ppt2->error_message,
-                "k1=k2, m odd, but bispectrum=%20.12g is larger than the characteristic scale (%20.12g). Problem?",
-                pwb->integral_over_k3[index_l3][index_r][index_k1][index_k2], epsilon);
-            }
+    /* Check that when m is odd and k1=k2, then T(k1,k2,k3) is small with respect to 1.
+    This should be the case because the odd-m quadratic sources always vanish for k1==k2
+    (see comment for vector Q_SS in perturb2_quadratic_sources()), unless non-vanishing
+    initial conditions are given */
+    /* TODO: Include this check in perturb2_quadratic_sources(), which is the quantity
+    that we know should vanish. The bispectrum could still be non-vanishing for non-zero
+    initial conditions.  */
+    if ((index_k1==index_k2) && (abs_M3%2!=0)) {
+      double expected_scale = ppm->A_s*ppm->A_s;
+      double epsilon = 1e-4*expected_scale;
+      class_test_permissive (
+        fabs (integral_over_k3[index_r][index_k1][index_k2]) > epsilon,
+        ppt2->error_message,
+        "k1=k2, m odd, but bispectrum=%20.12g is larger than the characteristic scale (%20.12g). Problem?",
+        integral_over_k3[index_r][index_k1][index_k2], epsilon);
+    }
 #endif // DEBUG
 
-            /* Include the M3-dependent coefficient coming from the rescaling of the transfer
-            function. Note that this is always equal to 1 for m=0. */
-            if (pwb->abs_M3!=0)
-              pwb->integral_over_k3[index_l3][index_r][index_k1][index_k2] *= pwb->M3_coefficient[index_M3];
+    /* Include the M3-dependent coefficient coming from the rescaling of the transfer
+    function. Note that this is always equal to 1 for m=0. */
+    if (abs_M3!=0)
+      integral_over_k3[index_r][index_k1][index_k2] *= pwb->M3_coefficient[index_M3];
+
+    /* Multiply the result by the factor 2 coming from the fact that in the bispectrum
+    formula the second-order transfer functions appears as
+    T(\vec{k1},\vec{k2},\vec{3}) + T(\vec{k2},\vec{k1},\vec{3}) */
+    integral_over_k3[index_r][index_k1][index_k2] *= 2;
+
+    /* Debug - print the second-order transfer function as a function of k3 */
+    // if ((l3==170) && (abs_M3 == 2))
+    //   for (int index_k3=0; index_k3<*k3_size; ++index_k3)
+    //     printf ("%14.7g %22.16g\n", k3_grid[index_k3], transfer[index_k3]);
+
+    /* Print the integral as a function of r */
+    // if ((abs_M3==1) && (offset_L3==0))
+    //   if (l3==200)
+    //     /* For bks run they correspond to 0.03728321 and 0.01724184, which are Christian's 13 and 6 */
+    //     if ((index_k1==85) && (index_k2==63))
+    //     // if ((index_k1==1) && (index_k2==0))
+    //       fprintf (stderr, "%17.7g %17.7g\n",
+    //         pwb->r[index_r], integral_over_k3[index_r][index_k1][index_k2]);
+
+    /* Print the integral as a function of k2 */
+    // if (offset_L3==0)
+    //  if (index_k1==13) /* To be used when you have the same grid as Christian */
+    //   // if (index_k1==160) /* for bks runs it corresponds to 0.1912861 */
+    //   if (index_k1==85) /* for bks runs it corresponds to 0.03728321, which is Christian's 13 */
+    //   // if (index_k1==118) /* For bks runs, corresponds to 0.1 */
+    //   // if (index_k1==95) /* For ref k-sampling, corresponds to 0.1 */
+    //     // if (index_r==83) /* 14000 for 250r13to16 */
+    //     if (index_r==49) /* 14000 for 99r135to145 */
+    //       if ((l3==200) && (abs_M3==1))
+    //         fprintf (stderr, "%17.7g %17.7g\n",
+    //           k2, integral_over_k3[index_r][index_k1][index_k2]);
+
+  } // end of for(index_r)
 
-            /* Multiply the result by the factor 2 coming from the fact that in the bispectrum
-            formula the second-order transfer functions appears as
-            T(\vec{k1},\vec{k2},\vec{3}) + T(\vec{k2},\vec{k1},\vec{3}) */
-            pwb->integral_over_k3[index_l3][index_r][index_k1][index_k2] *= 2;
+  return _SUCCESS_;
 
-            /* Update the counters */
-            #pragma omp atomic
-            average_k3_grid_size += k3_size; 
+}
 
-            #pragma omp atomic
-            ++pwb->count_memorised_for_integral_over_k3;
-              
-            #pragma omp flush(abort)
 
-            /* Debug - print the second-order transfer function as a function of k3 */
-            // if ((l3==170) && (pwb->abs_M3 == 2))
-            //   for (int index_k3=0; index_k3<k3_size; ++index_k3)
-            //     printf ("%14.7g %22.16g\n", pwb->k3_grid[thread][index_k3], transfer[index_k3]);
 
-            /* Print the integral as a function of r */
-            // if ((pwb->abs_M3==1) && (offset_L3==0))
-            //   if (l3==200)
-            //     /* For bks run they correspond to 0.03728321 and 0.01724184, which are Christian's 13 and 6 */
-            //     if ((index_k1==85) && (index_k2==63))
-            //     // if ((index_k1==1) && (index_k2==0))
-            //       fprintf (stderr, "%17.7g %17.7g\n",
-            //         pwb->r[index_r], pwb->integral_over_k3[index_l3][index_r][index_k1][index_k2]);
-
-            /* Print the integral as a function of k2 */
-            // if (offset_L3==0)
-            //  if (index_k1==13) /* To be used when you have the same grid as Christian */
-            //   // if (index_k1==160) /* for bks runs it corresponds to 0.1912861 */
-            //   if (index_k1==85) /* for bks runs it corresponds to 0.03728321, which is Christian's 13 */
-            //   // if (index_k1==118) /* For bks runs, corresponds to 0.1 */
-            //   // if (index_k1==95) /* For ref k-sampling, corresponds to 0.1 */
-            //     // if (index_r==83) /* 14000 for 250r13to16 */
-            //     if (index_r==49) /* 14000 for 99r135to145 */
-            //       if ((l3==200) && (pwb->abs_M3==1))
-            //         fprintf (stderr, "%17.7g %17.7g\n",
-            //           k2, pwb->integral_over_k3[index_l3][index_r][index_k1][index_k2]);
 
-          } // end of for(index_r)          
-        } // end of for(index_k2)
-      } // end of for(index_k1)
-    } if (abort == _TRUE_) return _FAILURE_; /* end of parallel region */
+
+int bispectra2_intrinsic_integrate_over_k3 (
+    struct precision * ppr,
+    struct precision2 * ppr2,
+    struct perturbs * ppt,
+    struct perturbs2 * ppt2,
+    struct bessels * pbs,
+    struct bessels2 * pbs2,
+    struct transfers * ptr,
+    struct transfers2 * ptr2,
+    struct primordial * ppm,
+    struct bispectra * pbi,
+    int index_tt2_k3,
+    int index_M3,
+    int offset_L3,
+    struct bispectra_workspace_intrinsic * pwb
+    )
+{
+
+  /* Parallelization variables */
+  int thread = 0;
+  int abort = _FALSE_;
+  
+  // =========================================================================================
+  // =                             Allocate memory for I_l3(r,k1,k2)                         =
+  // =========================================================================================
+    
+  /* Allocate the array for all l3 values, with its values stored contiguously in
+  pwb->integral_over_k3_arena. The memory counter is just the size of the arena. */
+  class_call (bispectra2_intrinsic_allocate_k3_integral (
+                pbi,
+                pwb,
+                pwb->abs_M3,
+                &(pwb->integral_over_k3_arena),
+                &(pwb->integral_over_k3)),
+    pbi->error_message,
+    pbi->error_message);
+
+  pwb->count_allocated_for_integral_over_k3 = pwb->integral_over_k3_arena.size;
+
+  if (pbi->bispectra_verbose > 2)
+    printf("     * allocated ~ %.3g MB (%ld doubles) for the k3-integral array (k_size=%d)\n",
+      pwb->count_allocated_for_integral_over_k3*sizeof(double)/1e6, pwb->count_allocated_for_integral_over_k3, pwb->k_smooth_size);
+
+
+  // ===================================================================================================
+  // =                               Compute the INT_l3(r, k1, k2)  integral                           =
+  // ===================================================================================================  
+  
+  /* Initialize counter for the number of integrals computed */
+  pwb->count_memorised_for_integral_over_k3 = 0;
+  
+  /* We shall keep track of the average size of the integration grid in k3, which is (k1,k2) dependent */
+  double average_k3_grid_size = 0;
+  
+  /* We compute the integral over k3 for all possible l-values */
+  for (int index_l3 = 0; index_l3 < pbi->l_size; ++index_l3) {
+
+    int l3 = pbi->l[index_l3];
+    int L3 = abs(l3-pwb->abs_M3) + offset_L3;
+
+    /* The configurations with |M3|>l3 do not contribute to the bispectrum because
+    they would violate the 3j-symbol properties */
+    if (pwb->abs_M3 > pbi->l[index_l3])
+      continue;
+
+    /* Skip the l3 values that do not appear in any requested configuration */
+    if (pwb->l3_mask[index_l3] == _FALSE_)
+      continue;
+
+    /* Skip the (L3,l3,M3) configurations forbidden by the triangular condition */
+    if (L3 > (l3+pwb->abs_M3)) {
+      pwb->count_memorised_for_integral_over_k3 += 0.5*pwb->k_smooth_size*(pwb->k_smooth_size+1)*pwb->r_size;
+      continue;
+    }
+    
+    /* Find L3 inside pbs2->l1, the list of l's where we computed the Bessel functions */
+    int index_L3 = pbs2->index_l1[L3];
+
+    /* Paranoid android */
+    class_test ((ppr2->m_max_song==0) && (l3!=L3),
+      pbi->error_message,
+      "inconsistency! for scalar modes, L3 must be equal to l3");
+
+    class_test (pbs2->l1[index_L3]!=L3,
+      pbi->error_message,
+      "error in the indexing of pbs2->l1. Is the pbs2->extend_l1_using_m parameter true?");
+
+    /* Load the transfer functions from disk */
+    if ((ppr2->load_transfers_from_disk == _TRUE_) || (ppr2->store_transfers_to_disk == _TRUE_)) {
+      class_call (transfer2_load_transfers_from_disk (
+                    ppr2,
+                    ppt2,
+                    ptr2,
+                    index_tt2_k3 + ptr2->lm_array[index_l3][index_M3]),
+        ptr2->error_message,
+        pbi->error_message);
+    }
+  
+    if (pbi->bispectra_verbose > 2)
+      printf("     * computing the k3 integral for l3=%d, index_l3=%d, L3=%d, index_L3=%d\n",
+        l3, index_l3, pbs2->l1[index_L3], index_L3);
+
+    class_call (bispectra2_intrinsic_integrate_over_k3_for_l3 (
+                  ppr,
+                  ppr2,
+                  ppt,
+                  ppt2,
+                  pbs,
+                  pbs2,
+                  ptr,
+                  ptr2,
+                  ppm,
+                  pbi,
+                  index_tt2_k3,
+                  index_M3,
+                  index_l3,
+                  index_L3,
+                  pwb->integral_over_k3[index_l3],
+                  &average_k3_grid_size,
+                  pwb),
+      pbi->error_message,
+      pbi->error_message);
 
   
     /* Free the memory associated with the second order transfer function for this (l,m) */
@@ -1444,163 +2059,98 @@ int bispectra2_intrinsic_integrate_over_k3 (
 
 
 
+/**
+ * Allocate the array for the integral over k3 of the intrinsic bispectrum,
+ * INT_l3(r,k1,k2), for all l3 values and for a given |M3|, indexed as
+ * integral_over_k3[index_l3][index_r][index_k1][index_k2] with index_k2 <= index_k1.
+ *
+ * All the values of the array are stored contiguously in the arena pa, which is
+ * initialised to zero. We do not reserve space for the non-physical configurations
+ * where |M3|>l3, nor for the l3 values that do not appear in any requested
+ * configuration; their k2 level is set to NULL.
+ *
+ * The array must be freed with bispectra2_intrinsic_free_k3_integral().
+ */
 
-int bispectra2_interpolate_over_k2 (
-    struct precision * ppr,
-    struct precision2 * ppr2,
-    struct perturbs * ppt,
-    struct perturbs2 * ppt2,
-    struct bessels * pbs,
-    struct bessels2 * pbs2,
-    struct transfers * ptr,
-    struct transfers2 * ptr2,
-    struct primordial * ppm,
+int bispectra2_intrinsic_allocate_k3_integral (
     struct bispectra * pbi,
-    int index_r,
-    int index_k1,
-    int index_l3,
-    double * integral_splines,
-    double * interpolated_integral,
-    double * f,
-    struct bispectra_workspace_intrinsic * pwb
+    struct bispectra_workspace_intrinsic * pwb,
+    int abs_M3,
+    struct arena * pa,                /* out */
+    double ***** integral_over_k3     /* out */
     )
 {
 
-  /* Shortcuts */
-  int k_pt_size = pwb->k_smooth_size;
-  double * k_pt = pwb->k_smooth_grid;
-  int k_tr_size = ptr->q_size;
-  double * k_tr = ptr->q;
+  int k1_size = pwb->k_smooth_size;
 
-  /* So far, we always assumed that k1>=k2 because the transfer function has the
-  following symmetry:
-      T (\vec{k1},\vec{k_2},\vec{k_3}) = (-1)^m * T (\vec{k_2},\vec{k_1},\vec{k_3}).
-  The (-1)^m factor comes from the fact that one can exchange \vec{k_1} and \vec{k_2} by
-  performing a rotation around \vec{k} of pi radians. This is equivalent to a factor of
-  exp(i*pi*m) = (-1)^m, and also implies that T_lm (\vec{k_1},\vec{k_2},\vec{k_3})=0 when
-  m is odd and \vec{k_1}=\vec{k_2}.
-    
-  Now we need to interpolate the k2 dependence of the transfer function, hence we build a
-  temporary array where
-      f(index_k1, index_k2) = (-1)^m * integral_over_k3(index_k2, index_k1)
-  when index_k1 < index_k2.
-  
-  We also include a (k1/k2)^m factor that mimicks the rescaling of the transfer function
-  under the exchange \vec{k_1}<->\vec{k_2}. This follows from the fact that
-      k1*sin(theta_1) = k2*sin(theta_2),
-  which implies that
-      T_rescaled(\vec{k2},\vec{k1},\vec{k3})
-      = T_rescaled(\vec{k1},\vec{k2},\vec{k3})*(k1/k2)^m */
+  long int size = 0;
+  for (int index_l3=0; index_l3<pbi->l_size; ++index_l3)
+    if ((abs_M3 <= pbi->l[index_l3]) && (pwb->l3_mask[index_l3] == _TRUE_))
+      size += pwb->r_size * (long int)k1_size*(k1_size+1)/2;
 
-  for (int index_k2=0; index_k2 < k_pt_size; ++index_k2) {
+  class_call (arena_init (pa, size, pbi->error_message),
+    pbi->error_message,
+    pbi->error_message);
 
-    if (index_k1 > index_k2)
-      f[index_k2] = pwb->integral_over_k3[index_l3][index_r][index_k1][index_k2];
-    else 
-      f[index_k2] = pwb->integral_over_k3[index_l3][index_r][index_k2][index_k1]
-                  * pow (-k_pt[index_k1]/k_pt[index_k2], pwb->abs_M3);
-    
-    /* Multiply by window function */
-    f[index_k2] *= pwb->k_window[index_k2];
-                                        
-  }
-  
-  if (ppr->transfers_k2_interpolation == cubic_interpolation) {
-    
-    class_call (array_spline_table_columns (
-                  k_pt,
-                  k_pt_size,
-                  f,
-                  1,  /* how many columns to consider */
-                  integral_splines,
-                  _SPLINE_EST_DERIV_,
-                  pbi->error_message),
-         pbi->error_message,
-         pbi->error_message);
-  }
+  /* Allocate l3-level.  Note that, even if l3 must satisfy the triangular
+  inequality, we allocate this level for all the possible l3 values.  We do so because this
+  array is going to be used by all (l1,l2) computations that follow, which means that l3 will
+  eventually cover all the allowed range. The r and k1 levels are allocated in a single
+  block each, too. */
+  class_alloc (*integral_over_k3, pbi->l_size*sizeof(double ***), pbi->error_message);
 
+  double *** r_level, ** k1_level;
+  class_alloc (r_level, pbi->l_size*pwb->r_size*sizeof(double **), pbi->error_message);
+  class_alloc (k1_level, pbi->l_size*pwb->r_size*k1_size*sizeof(double *), pbi->error_message);
 
-  /* Interpolate at each k value using the usual spline interpolation algorithm */
-  int index_k = 0;
-  double h = k_pt[index_k+1] - k_pt[index_k];
-    
-  for (int index_k_tr = 0; index_k_tr < k_tr_size; ++index_k_tr) {
-    
-    while (((index_k+1) < k_pt_size) && (k_pt[index_k+1] < k_tr[index_k_tr])) {
-      index_k++;
-      h = k_pt[index_k+1] - k_pt[index_k];
-    }
-    
-    class_test(h==0., pbi->error_message, "stop to avoid division by zero");
-    class_test((index_k+1) >= k_pt_size, pbi->error_message,
-      "some of the elements in k_tr are larger than the largest k_pt. Stop to avoid seg fault.");
-    
-    double b = (k_tr[index_k_tr] - k_pt[index_k])/h;
-    double a = 1.-b;
+  for (int index_l3=0; index_l3<pbi->l_size; ++index_l3) {
 
-    /* Interpolate for each value of l3, r, k1 */
-    if (ppr->transfers_k2_interpolation == linear_interpolation) {
-      interpolated_integral[index_k_tr] = a * f[index_k] + b * f[index_k+1];
-    }
-    else if (ppr->transfers_k2_interpolation == cubic_interpolation) {
-      interpolated_integral[index_k_tr] =  
-        a * f[index_k] + b * f[index_k+1] +
-        ((a*a*a-a) * integral_splines[index_k] +(b*b*b-b) * integral_splines[index_k+1])*h*h/6.0;
-    }
+    (*integral_over_k3)[index_l3] = r_level + index_l3*pwb->r_size;
 
-    /* Revert the effect of the window function */
-    interpolated_integral[index_k_tr] *= pwb->k_window_inverse[index_k_tr];
+    for (int index_r=0; index_r < pwb->r_size; ++index_r) {
 
-#ifdef DEBUG
-    /* We expect the integral over k3 that we are interpolating to be order unity,
-    because it is obtained as a convolution of the second-order transfer functions
-    and a Bessel function */
-    double expected_scale = 1;
-    class_test_permissive (fabs(interpolated_integral[index_k_tr]) > (expected_scale*1000),
-      pbi->error_message,
-      "found extremely large value for integral over k3 (m=%d): I_l3(k1_pt,k2_tr,r)=%g,\
- for l3=%d[%d], k1_pt=%g[%d], k2_tr=%g[%d], r=%g[%d]\n",
-      pwb->abs_M3, interpolated_integral[index_k_tr], pbi->l[index_l3], index_l3,
-      k_pt[index_k1], index_k1, k_tr[index_k_tr], index_k_tr, pwb->r[index_r], index_r);
-#endif // DEBUG
+      (*integral_over_k3)[index_l3][index_r] = k1_level + (index_l3*pwb->r_size + index_r)*k1_size;
 
-    /* Further convolve with the primordial power spectrum */
-    interpolated_integral[index_k_tr] *= pbi->pk[index_k_tr];
+      /* Point the 'k2' level, of size index_k1+1, inside the arena */
+      for (int index_k1=0; index_k1<k1_size; ++index_k1) {
 
-    /* Test for nans */
-    class_test (isnan(interpolated_integral[index_k_tr]),
-      pbi->error_message,
-      "k2 interpolation yielded a nan for index_r=%d, index_k1=%d, index_l3=%d",
-      index_r, index_k1, index_l3);
+        if ((abs_M3 > pbi->l[index_l3]) || (pwb->l3_mask[index_l3] == _FALSE_)) {
+          (*integral_over_k3)[index_l3][index_r][index_k1] = NULL;
+          continue;
+        }
 
-  } // end of for (index_k_tr)
+        class_call (arena_take (
+                      pa,
+                      index_k1+1,
+                      &((*integral_over_k3)[index_l3][index_r][index_k1]),
+                      pbi->error_message),
+          pbi->error_message,
+          pbi->error_message);
 
+      } // end of for(index_k1)
+    } // end of for(index_r)
+  } // end of for(index_l3)
 
-  /* Some debug - print the original array and the interpolation */
-  // if ((index_k1==1) && (index_l3==0) && (index_r==0)) {
-  // 
-  //   fprintf (stderr, "\n\n");
-  // 
-  //   /* Node points before window */
-  //   for (index_k=0; index_k < k_pt_size; ++index_k)
-  //     fprintf (stderr, "%17.7g %17.7g\n", k_pt[index_k], f[index_k]/pwb->k_window[index_k]);
-  // 
-  //   fprintf (stderr, "\n");
-  //   
-  //   /* Node points after window */
-  //   for (index_k=0; index_k < k_pt_size; ++index_k)
-  //     fprintf (stderr, "%17.7g %17.7g\n", k_pt[index_k], f[index_k]);
-  // 
-  //   fprintf (stderr, "\n");
-  // 
-  //   /* Interpolation after inverse window */  
-  //   for (index_k_tr = 0; index_k_tr < k_tr_size; ++index_k_tr)
-  //     fprintf (stderr, "%17.7g %17.7g\n", k_tr[index_k_tr], interpolated_integral[index_k_tr]/pbi->pk[index_k_tr]);
-  // 
-  //   fprintf (stderr, "\n\n");
-  //   
-  // }
+  return _SUCCESS_;
 
+}
+
+
+
+/**
+ * Free an array allocated with bispectra2_intrinsic_allocate_k3_integral().
+ */
+
+int bispectra2_intrinsic_free_k3_integral (
+    double **** integral_over_k3,
+    struct arena * pa
+    )
+{
+
+  free (integral_over_k3[0][0]);
+  free (integral_over_k3[0]);
+  free (integral_over_k3);
+  arena_free (pa);
 
   return _SUCCESS_;
 
@@ -1608,9 +2158,31 @@ int bispectra2_interpolate_over_k2 (
 
 
 
+/**
+ * Compute the second-order transfer functions one k1 at a time and integrate them
+ * over k3 as soon as they are computed, for all the fields X, azimuthal numbers M3
+ * and offsets L3 needed by the intrinsic bispectrum; this function is used when
+ * ppr2->stream_transfers is _TRUE_.
+ *
+ * In the default mode, transfer2_init() fills the full ptr2->transfer array for all
+ * (k1,k2,k3) and all the (X,l3,M3) types, and bispectra2_intrinsic_integrate_over_k3()
+ * integrates one (X,M3,offset_L3) slab at a time, reading it from disk if
+ * store_transfers=yes. Here, the transfer2 module only computed the indices and
+ * the k-samplings, and we call transfer2_stream_k1_level() for each k1; the
+ * resulting transfer functions are integrated over k3 for all (X,M3,offset_L3,l3)
+ * and k2 <= k1 by bispectra2_intrinsic_integrate_over_k3_for_k1(), and then freed.
+ * Only one k1 level of the transfer functions is in memory at any time, and they
+ * are never written to disk.
+ *
+ * The integrals are stored in pwb->streamed_integral_over_k3[index_slab], with
+ * index_slab = (X*ppr2->m_size + index_M3)*pwb->streamed_L3_size + offset_L3, and
+ * have the same form as pwb->integral_over_k3; bispectra2_intrinsic_init() uses
+ * them in place of the output of bispectra2_intrinsic_integrate_over_k3(), and
+ * frees each slab after computing its contribution to the bispectrum. The slabs
+ * skipped for symmetry reasons are set to NULL.
+ */
 
-
-int bispectra2_intrinsic_integrate_over_k2 (
+int bispectra2_intrinsic_stream_over_k3 (
     struct precision * ppr,
     struct precision2 * ppr2,
     struct perturbs * ppt,
@@ -1621,233 +2193,432 @@ int bispectra2_intrinsic_integrate_over_k2 (
     struct transfers2 * ptr2,
     struct primordial * ppm,
     struct bispectra * pbi,
-    int index_tt_k2,
     struct bispectra_workspace_intrinsic * pwb
     )
 {
 
-  /* Integration grid */
-  int k_tr_size = ptr->q_size;
-  double * k_tr = ptr->q;
+  // ====================================================================================
+  // =                                 Allocate memory                                  =
+  // ====================================================================================
 
-  /* Parallelization variables */
-  int thread = 0;
-  int abort = _FALSE_;
+  /* The number of offsets for L3 is 2*|M3|+1; we reserve space for the largest |M3| */
+  int abs_M3_max = 0;
+  for (int index_M3=0; index_M3 < ppr2->m_size; ++index_M3)
+    abs_M3_max = MAX (abs_M3_max, abs(ppr2->m[index_M3]));
 
-  // ======================================================================================================
-  // =                                   Allocate memory for INT_l2_l3(r,k1)                              =
-  // ======================================================================================================
-  
-  /* Because we shall recycle the array for more than one fields (T,E...) we make sure we allocate it
-  only once. This is achieved by performing the allocation only at the beginning of the loop over
-  the field (that is, when pwb->Y==0) */
+  pwb->streamed_L3_size = 2*abs_M3_max+1;
+  pwb->streamed_slab_size = pbi->bf_size*ppr2->m_size*pwb->streamed_L3_size;
 
-  if (pwb->Y == 0) {
+  class_calloc (pwb->streamed_integral_over_k3, pwb->streamed_slab_size, sizeof(double ****), pbi->error_message);
+  class_calloc (pwb->streamed_integral_over_k3_arena, pwb->streamed_slab_size, sizeof(struct arena), pbi->error_message);
 
-    /* Initialize counter */
-    pwb->count_allocated_for_integral_over_k2 = 0;
-  
-    /* Allocate l2-level */
-    class_alloc (pwb->integral_over_k2, pbi->l_size*sizeof(double ***), pbi->error_message);
-  
-    for (int index_l3=0; index_l3<pbi->l_size; ++index_l3) {
-  
-      /* Allocate l3-level */
-      class_alloc (pwb->integral_over_k2[index_l3], pbi->l_size*sizeof(double **), pbi->error_message);
-  
-      for (int index_l2=0; index_l2<pbi->l_size; ++index_l2) {
-    
-        /* Allocate r-level */
-        class_alloc (pwb->integral_over_k2[index_l3][index_l2], pwb->r_size*sizeof(double *), pbi->error_message);
-  
-        /* Allocate 'k1' level. Make sure to use calloc. */
-        for (int index_r=0; index_r < pwb->r_size; ++index_r) {
-  
-          int k1_size = pwb->k_smooth_size;
-          class_calloc (pwb->integral_over_k2[index_l3][index_l2][index_r], k1_size, sizeof(double), pbi->error_message);
-  
-        /* Increase memory counter, excluding non-physical configurations where |M3|>l3 */
-        if (pwb->abs_M3 <= pbi->l[index_l3])
-          pwb->count_allocated_for_integral_over_k2 += k1_size;
-  
-        } // end of for(index_r)
-      } // end of for(index_l2)
-    } // end of for(index_l3)
-    
-    if (pbi->bispectra_verbose > 2)
-      printf("     * allocated ~ %.3g MB (%ld doubles) for the k2-integral array (l_size=%d)\n",
-        pwb->count_allocated_for_integral_over_k2*sizeof(double)/1e6, pwb->count_allocated_for_integral_over_k2, pbi->l_size);
+  /* List of the (slab,l3) pairs to integrate for each k1 */
+  struct bispectra2_k3_slab * slabs;
+  class_alloc (slabs, pwb->streamed_slab_size*pbi->l_size*sizeof(struct bispectra2_k3_slab), pbi->error_message);
+  int slab_l3_size = 0;
 
-  } // end of if pwb->Y==0
-  
-  
-  // ==============================================================================================================
-  // =                                   Compute the INT_l2_l3(r, k1) integral                                    =
-  // ==============================================================================================================
-  
-  /* Initialize counter for the number of integrals computed */
-  pwb->count_memorised_for_integral_over_k2 = 0;
-  
-  /* As for the k3_integral, we parallelize the loop over 'r'.  Here, we set it as the outermost loop
-  as we do not need to load the second-order transfer functions from disk. */
-  abort = _FALSE_;
-  #pragma omp parallel shared (abort) private (thread)
+  pwb->count_allocated_for_integral_over_k3 = 0;
+  pwb->count_memorised_for_integral_over_k3 = 0;
+
+  for (int X=0; X < pbi->bf_size; ++X) {
+    for (int index_M3=0; index_M3 < ppr2->m_size; ++index_M3) {
+
+      int abs_M3 = abs(ppr2->m[index_M3]);
+
+      for (int offset_L3=0; offset_L3 < (2*abs_M3+1); ++offset_L3) {
+
+        /* Skip the same offsets as in bispectra2_intrinsic_init() */
+        short skip_condition;
+
+        if (pwb->bispectrum_parity == _EVEN_)
+          skip_condition = (offset_L3%2!=0);
+        else
+          skip_condition = (offset_L3%2==0);
+
+        if (skip_condition)
+          continue;
+
+        int index_slab = (X*ppr2->m_size + index_M3)*pwb->streamed_L3_size + offset_L3;
+
+        class_call (bispectra2_intrinsic_allocate_k3_integral (
+                      pbi,
+                      pwb,
+                      abs_M3,
+                      &(pwb->streamed_integral_over_k3_arena[index_slab]),
+                      &(pwb->streamed_integral_over_k3[index_slab])),
+          pbi->error_message,
+          pbi->error_message);
+
+        pwb->count_allocated_for_integral_over_k3 += pwb->streamed_integral_over_k3_arena[index_slab].size;
+
+        for (int index_l3 = 0; index_l3 < pbi->l_size; ++index_l3) {
+
+          int l3 = pbi->l[index_l3];
+          int L3 = abs(l3-abs_M3) + offset_L3;
+
+          /* Same conditions as in bispectra2_intrinsic_integrate_over_k3() */
+          if ((abs_M3 > l3) || (pwb->l3_mask[index_l3] == _FALSE_))
+            continue;
+
+          if (L3 > (l3+abs_M3)) {
+            pwb->count_memorised_for_integral_over_k3 += 0.5*pwb->k_smooth_size*(pwb->k_smooth_size+1)*pwb->r_size;
+            continue;
+          }
+
+          int index_L3 = pbs2->index_l1[L3];
+
+          class_test ((ppr2->m_max_song==0) && (l3!=L3),
+            pbi->error_message,
+            "inconsistency! for scalar modes, L3 must be equal to l3");
+
+          class_test (pbs2->l1[index_L3]!=L3,
+            pbi->error_message,
+            "error in the indexing of pbs2->l1. Is the pbs2->extend_l1_using_m parameter true?");
+
+          slabs[slab_l3_size].index_slab = index_slab;
+          slabs[slab_l3_size].index_tt2_k3 = pwb->index_tt2_of_bf[X];
+          slabs[slab_l3_size].index_M3 = index_M3;
+          slabs[slab_l3_size].index_l3 = index_l3;
+          slabs[slab_l3_size].index_L3 = index_L3;
+          slab_l3_size++;
+        }
+      }
+    }
+  }
+
+  if (pbi->bispectra_verbose > 1)
+    printf(" -> allocated ~ %.3g MB (%ld doubles) for the k3 integrals of the streamed transfer functions\n",
+      pwb->count_allocated_for_integral_over_k3*sizeof(double)/1e6, pwb->count_allocated_for_integral_over_k3);
+
+  /* The k3 integrals of all the slabs are kept at the same time, also when tiling over l3;
+  their size grows as r_size rather than k3_size, but with many slabs or a fine r grid they
+  can take more memory than the transfer functions that are not stored */
+  if (pbi->bispectra_verbose > 0) {
+
+    long int count_transfers = 0;
+    for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1)
+      for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2)
+        count_transfers += ptr2->tt2_size*(long int)ptr2->k_size_k1k2[index_k1][index_k2];
+
+    printf(" -> k3 integrals take %.3g MB in place of %.3g MB of transfer functions\n",
+      pwb->count_allocated_for_integral_over_k3*sizeof(double)/1e6, count_transfers*sizeof(double)/1e6);
+
+    if (pwb->count_allocated_for_integral_over_k3 > count_transfers)
+      printf(" -> WARNING: stream_transfers=yes uses more memory than it saves; set it to no%s\n",
+        (ppr2->tile_intrinsic_bispectrum == _TRUE_) ? " to keep one l3 at a time with tile_intrinsic_bispectrum" : "");
+  }
+
+  /* Workspaces for the computation of the transfer functions */
+  int number_of_threads = 1;
+
+  #pragma omp parallel
   {
-  
     #ifdef _OPENMP
-    thread = omp_get_thread_num();
+    number_of_threads = omp_get_num_threads();
     #endif
-  
-    #pragma omp for schedule (dynamic)
-    for (int index_r = 0; index_r < pwb->r_size; ++index_r) {
-  
-      if (pbi->bispectra_verbose > 2)
-        printf("     * computing the k2 integral for r=%g, index_r=%d\n", pwb->r[index_r], index_r);
-  
-      for (int index_l3 = 0; index_l3 < pbi->l_size; ++index_l3) {
-        
-        /* The configurations with |M3|>l3 do not contribute to the bispectrum because
-        they would violate the 3j-symbol properties */
-        if (pwb->abs_M3 > pbi->l[index_l3])
-          continue;
-        
-        for (int index_k1 = 0; index_k1 < pwb->k_smooth_size; ++index_k1) {
-    
-          /* Interpolate the integral I_l3(k1,k2,r) that we computed above in the integration grid of k2.
-          Note that we pass the integral_splines and interpolated_integral arrays separately rather
-          than accessing them from pwb, because they are thread dependent (while pwb isn't). */
-          class_call_parallel (bispectra2_interpolate_over_k2 (
-                                 ppr,
-                                 ppr2,
-                                 ppt,
-                                 ppt2,
-                                 pbs,
-                                 pbs2,
-                                 ptr,
-                                 ptr2,
-                                 ppm,
-                                 pbi,
-                                 index_r,
-                                 index_k1,
-                                 index_l3,
-                                 pwb->integral_splines[thread],
-                                 pwb->interpolated_integral[thread],
-                                 pwb->f[thread],
-                                 pwb),
-            pbi->error_message,
-            pbi->error_message);            
-            
-          /* Some debug - show the function that was interpolated as a function of r */
-          // if ((pbi->l[index_l3]==205) && (pwb->abs_M3==1))
-          //   if (pwb->offset_L3==1)
-          //     if (index_k1==46) {
-          //       index_k2 = 37;
-          //       fprintf (stderr, "%17.7g %17.7g\n", pwb->r[index_r], pwb->f[thread][index_k2]);
-          //     }
-            
-          /* Some debug - show the function that was interpolated as a function of k2 */
-          // if (pwb->offset_L3==-1)
-          //   if (index_k1==46)
-          //     if (index_k2==37)
-          //     // if (index_r==49) /* 14000 for 99r135to145 */
-          //       // if ((pbi->l[index_l3]==205) && (pwb->abs_M3==1))
-          //       //   for (index_k2=0; index_k2 < pwb->k_smooth_size; ++index_k2)
-          //           fprintf (stderr, "%17.7g %17.7g\n",
-          //             pwb->k_smooth_grid[index_k2], pwb->f[thread][index_k2]);
+  }
 
-          /* Some debug - show the function after interpolation as a function of k2 */
-          // if (pwb->offset_L3==0)
-          //   if (index_k1==85) /* for ref runs with l_max=200 and kmax=6 it corresponds to 0.03728321, which is Christian's 13 */
-          //   // if (index_k1==118) /* For better k-sampling, corresponds to 0.1 */
-          //   // if (index_k1==95) /* For ref k-sampling, corresponds to 0.1 */
-          //     // if (index_r==83) /* 14000 for 250r13to16 */
-          //     if (index_r==49) /* 14005.1 for 100r135to145 */
-          //       if ((pbi->l[index_l3]==200) && (pwb->abs_M3==1))
-          //         for (index_k2=0; index_k2 < ptr->q_size; ++index_k2)
-          //           fprintf (stderr, "%17.7g %17.7g\n",
-          //             ptr->q[index_k2],
-          //             pwb->interpolated_integral[thread][index_k2]/pbi->pk[index_k2]);
+  struct transfer2_workspace ** ppw;
 
-          for (int index_l2 = 0; index_l2 < pbi->l_size; ++index_l2) {  
-  
-            /* Define the pointer to the first-order transfer functions as a function of k */
-            double * transfer = &(ptr->transfer [ppt->index_md_scalars]
-                                                [((ppt->index_ic_ad * ptr->tt_size[ppt->index_md_scalars] + index_tt_k2)
-                                                * ptr->l_size[ppt->index_md_scalars] + index_l2) * k_tr_size]);
-  
-            class_call_parallel (bessel_convolution (
-                                   ppr,
-                                   pbs,
-                                   k_tr,
-                                   pbi->delta_k,
-                                   k_tr_size,
-                                   pwb->interpolated_integral[thread],
-                                   transfer,
-                                   index_l2,
-                                   pwb->r[index_r],
-                                   &(pwb->integral_over_k2[index_l3][index_l2][index_r][index_k1]),
-                                   pbi->error_message
-                                   ),
-              pbi->error_message,
-              pbi->error_message);
+  class_call (transfer2_workspace_init (
+                ppr2,
+                ppt2,
+                pbs2,
+                ptr2,
+                number_of_threads,
+                &ppw),
+    ptr2->error_message,
+    pbi->error_message);
 
-            /* Some debug - Print the integral as a function of r */
-            // if ((pwb->abs_M3==1) && (pwb->offset_L3==0))
-            //   if ((pbi->l[index_l2]==200) && (pbi->l[index_l3]==200))
-            //     /* for l_max=200 and kmax=6 it corresponds to 0.03728321, which is Christian's 13 */
-            //     if (index_k1==85)
-            //     // if ((index_k1==1) && (index_k2==0))
-            //       fprintf (stderr, "%17.7g %17.7g\n",
-            //         pwb->r[index_r], pwb->integral_over_k2[index_l3][index_l2][index_r][index_k1]);
 
-            /* Update the counter */
-            #pragma omp atomic
-            ++pwb->count_memorised_for_integral_over_k2;
-  
-            #pragma omp flush(abort)
-  
-          } // end of for(index_l2)
-        } // end of for(index_k1)
-      } // end of for(index_l3)
-    } // end of for(index_r)
-  } if (abort == _TRUE_) return _FAILURE_;  // end of parallel region
-  
+
+  // ====================================================================================
+  // =                                  Cycle on k1                                     =
+  // ====================================================================================
+
+  if (pbi->bispectra_verbose > 0)
+    printf(" -> computing the transfer functions and their k3 integrals for %d (l3,m3) pairs, one k1 at a time\n",
+      slab_l3_size);
+
+  double average_k3_grid_size = 0;
+
+  for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1) {
+
+    class_call (transfer2_stream_k1_level (
+                  ppr,
+                  ppr2,
+                  ppt,
+                  ppt2,
+                  pbs,
+                  pbs2,
+                  ptr2,
+                  index_k1,
+                  number_of_threads,
+                  ppw),
+      ptr2->error_message,
+      pbi->error_message);
+
+    class_call (bispectra2_intrinsic_integrate_over_k3_for_k1 (
+                  ppr,
+                  ppr2,
+                  ppt2,
+                  pbs,
+                  pbs2,
+                  ptr2,
+                  ppm,
+                  pbi,
+                  index_k1,
+                  slab_l3_size,
+                  slabs,
+                  &average_k3_grid_size,
+                  pwb),
+      pbi->error_message,
+      pbi->error_message);
+
+    class_call (transfer2_free_k1_level (ppt2, ptr2, index_k1, ptr2->error_message),
+      ptr2->error_message,
+      pbi->error_message);
+
+  } // end of for(index_k1)
+
+  class_call (transfer2_workspace_free (
+                ppt2,
+                number_of_threads,
+                ppw),
+    ptr2->error_message,
+    pbi->error_message);
+
+  free (slabs);
+
   if (pbi->bispectra_verbose > 2)
-    printf("     * memorised ~ %.3g MB (%ld doubles) for the k2-integral array (k2_size=%d)\n",
-      pwb->count_memorised_for_integral_over_k2*sizeof(double)/1e6, pwb->count_memorised_for_integral_over_k2,
-      k_tr_size);
-  
-  /* Check that we correctly filled the array */
-  class_test (pwb->count_memorised_for_integral_over_k2 != pwb->count_allocated_for_integral_over_k2,
+    printf("     * memorised ~ %.3g MB (%ld doubles) for the k3-integral array (<k3_size>=%g)\n",
+      pwb->count_memorised_for_integral_over_k3*sizeof(double)/1e6,
+      pwb->count_memorised_for_integral_over_k3,
+      average_k3_grid_size/pwb->count_memorised_for_integral_over_k3);
+
+  /* Check that we correctly filled the arrays */
+  class_test (ptr2->count_allocated_transfers != ptr2->count_memorised_transfers,
+    pbi->error_message,
+    "there is a mismatch between allocated (%ld) and used (%ld) space for the transfer functions!",
+    ptr2->count_allocated_transfers, ptr2->count_memorised_transfers);
+
+  class_test (
+    pwb->count_memorised_for_integral_over_k3 != pwb->count_allocated_for_integral_over_k3,
     pbi->error_message,
     "there is a mismatch between allocated (%ld) and used (%ld) space!",
-    pwb->count_allocated_for_integral_over_k2, pwb->count_memorised_for_integral_over_k2);
-  
-  /* Free the memory that was allocated for the I_l3 integral, but only if we have already computed it
-  for all the required probes */
-  if (pwb->Y == (pbi->bf_size-1)) {
-    for (int index_l3=0; index_l3<pbi->l_size; ++index_l3) {
-      for (int index_r=0; index_r < pwb->r_size; ++index_r) {
-        for (int index_k1=0; index_k1<pwb->k_smooth_size; ++index_k1) {
-          free (pwb->integral_over_k3[index_l3][index_r][index_k1]);
-        } // end of for(index_k1)
-        free (pwb->integral_over_k3[index_l3][index_r]);
-      } // end of for(index_r)
-      free (pwb->integral_over_k3[index_l3]);
-    } // end of for(index_l3)
-    free (pwb->integral_over_k3);
-  } 
+    pwb->count_allocated_for_integral_over_k3, pwb->count_memorised_for_integral_over_k3);
 
-  return _SUCCESS_; 
+  return _SUCCESS_;
 
 }
 
-        
 
 
+/**
+ * Integrate over k3 the second-order transfer functions for a given k1, for all the
+ * (slab,l3) pairs in the list slabs and for all k2 <= k1, and store the result in
+ * pwb->streamed_integral_over_k3.
+ *
+ * The (slab,l3,k2) configurations are distributed between the threads in a single
+ * parallel loop. Only the index_k1 level of ptr2->transfer needs to be in memory; this
+ * function is called by bispectra2_intrinsic_stream_over_k3().
+ */
 
+int bispectra2_intrinsic_integrate_over_k3_for_k1 (
+    struct precision * ppr,
+    struct precision2 * ppr2,
+    struct perturbs2 * ppt2,
+    struct bessels * pbs,
+    struct bessels2 * pbs2,
+    struct transfers2 * ptr2,
+    struct primordial * ppm,
+    struct bispectra * pbi,
+    int index_k1,
+    int slab_l3_size,
+    struct bispectra2_k3_slab * slabs,
+    double * average_k3_grid_size, /* out, incremented */
+    struct bispectra_workspace_intrinsic * pwb
+    )
+{
 
-int bispectra2_interpolate_over_k1 (
+  /* Parallelization variables */
+  int thread = 0;
+  int abort = _FALSE_;
+  int number_of_threads = 1;
+  #ifdef _OPENMP
+  number_of_threads = omp_get_max_threads();
+  #endif
+
+  /* Time spent by each thread integrating over k3 */
+  int index_region;
+  class_call (run_report_region (&(ppr2->report), "bispectra2_integrate_over_k3", "", number_of_threads,
+                &index_region, pbi->error_message),
+    pbi->error_message,
+    pbi->error_message);
+
+  double region_start = run_report_time();
+
+  int k2_size = index_k1+1;
+
+  abort = _FALSE_;
+  #pragma omp parallel shared (abort) private (thread)
+  {
+
+    #ifdef _OPENMP
+    thread = omp_get_thread_num();
+    #endif
+
+    #pragma omp for schedule (dynamic)
+    for (int index = 0; index < slab_l3_size*k2_size; ++index) {
+
+      double busy_start = run_report_time();
+
+      struct bispectra2_k3_slab * slab = &(slabs[index/k2_size]);
+      int index_k2 = index%k2_size;
+      int k3_size;
+
+      class_call_parallel (bispectra2_intrinsic_integrate_over_k3_for_k1k2 (
+                             ppr,
+                             ppr2,
+                             ppt2,
+                             pbs,
+                             pbs2,
+                             ptr2,
+                             ppm,
+                             pbi,
+                             slab->index_tt2_k3,
+                             slab->index_M3,
+                             slab->index_l3,
+                             slab->index_L3,
+                             index_k1,
+                             index_k2,
+                             pwb->k3_grid[thread],
+                             pwb->delta_k3[thread],
+                             pwb->streamed_integral_over_k3[slab->index_slab][slab->index_l3],
+                             &k3_size,
+                             pwb),
+        pbi->error_message,
+        pbi->error_message);
+
+      /* Update the counters */
+      #pragma omp atomic
+      *average_k3_grid_size += (double)k3_size*pwb->r_size;
+
+      #pragma omp atomic
+      pwb->count_memorised_for_integral_over_k3 += pwb->r_size;
+
+      ppr2->report.regions[index_region].busy_time[thread] += run_report_time() - busy_start;
+
+      #pragma omp flush(abort)
+
+    } // end of for(index)
+  } if (abort == _TRUE_) return _FAILURE_; /* end of parallel region */
+
+  ppr2->report.regions[index_region].wall_time += run_report_time() - region_start;
+
+  return _SUCCESS_;
+
+}
+
+
+
+
+
+
+/**
+ * Interpolate a function sampled in the smooth grid pwb->k_smooth_grid, and multiplied
+ * by the window function pwb->k_window, in the integration grid ptr->q; then revert the
+ * window function and multiply the result by the primordial power spectrum pbi->pk.
+ *
+ * The nodes and weights of the interpolation are computed once and for all in
+ * bispectra2_intrinsic_workspace_init(), so that the loop has no branches and can
+ * be vectorised by the compiler. The arithmetic is the same as when the nodes
+ * are found on the fly, so the result does not change.
+ *
+ * If pwb->scalar_kernels is _TRUE_, the nodes are found on the fly instead, as in the
+ * original scalar loop, which is kept as a reference for the vectorised one.
+ */
+
+int bispectra2_interpolate_smooth_k (
+    struct transfers * ptr,
+    struct bispectra * pbi,
+    short cubic,          /**< input: _TRUE_ for spline interpolation, _FALSE_ for linear interpolation */
+    double * f,           /**< input: function to interpolate, already multiplied by the window function */
+    double * splines,     /**< input: second derivatives of f, used only if cubic is _TRUE_ */
+    double * interpolated, /**< output: interpolated function, with ptr->q_size elements */
+    struct bispectra_workspace_intrinsic * pwb
+    )
+{
+
+  int k_tr_size = ptr->q_size;
+  int * index_k = pwb->k_interp_index;
+  double * a = pwb->k_interp_a;
+  double * b = pwb->k_interp_b;
+  double * window_inverse = pwb->k_window_inverse;
+  double * pk = pbi->pk;
+
+  /* Reference loop, which looks for the interpolation nodes at each call */
+  if (pwb->scalar_kernels == _TRUE_) {
+
+    int k_pt_size = pwb->k_smooth_size;
+    double * k_pt = pwb->k_smooth_grid;
+    double * k_tr = ptr->q;
+    int index_k_pt = 0;
+    double h = k_pt[index_k_pt+1] - k_pt[index_k_pt];
+
+    for (int index_k_tr = 0; index_k_tr < k_tr_size; ++index_k_tr) {
+
+      while (((index_k_pt+1) < k_pt_size) && (k_pt[index_k_pt+1] < k_tr[index_k_tr])) {
+        index_k_pt++;
+        h = k_pt[index_k_pt+1] - k_pt[index_k_pt];
+      }
+
+      class_test(h==0., pbi->error_message, "stop to avoid division by zero");
+
+      double b_k = (k_tr[index_k_tr] - k_pt[index_k_pt])/h;
+      double a_k = 1.-b_k;
+
+      if (cubic == _FALSE_)
+        interpolated[index_k_tr] = a_k * f[index_k_pt] + b_k * f[index_k_pt+1];
+      else
+        interpolated[index_k_tr] = a_k * f[index_k_pt] + b_k * f[index_k_pt+1]
+                                 + ((a_k*a_k*a_k-a_k) * splines[index_k_pt] + (b_k*b_k*b_k-b_k) * splines[index_k_pt+1])
+                                 * h*h/6.0;
+
+      /* Revert the window function and multiply by the primordial power spectrum */
+      interpolated[index_k_tr] *= window_inverse[index_k_tr];
+      interpolated[index_k_tr] *= pk[index_k_tr];
+    }
+  }
+  else if (cubic == _FALSE_) {
+
+    #pragma omp simd
+    for (int index_k_tr = 0; index_k_tr < k_tr_size; ++index_k_tr)
+      interpolated[index_k_tr] = (a[index_k_tr] * f[index_k[index_k_tr]] + b[index_k_tr] * f[index_k[index_k_tr]+1])
+                               * window_inverse[index_k_tr] * pk[index_k_tr];
+  }
+  else {
+
+    double * a3 = pwb->k_interp_a3;
+    double * b3 = pwb->k_interp_b3;
+    double * h = pwb->k_interp_h;
+
+    #pragma omp simd
+    for (int index_k_tr = 0; index_k_tr < k_tr_size; ++index_k_tr)
+      interpolated[index_k_tr] = (a[index_k_tr] * f[index_k[index_k_tr]] + b[index_k_tr] * f[index_k[index_k_tr]+1]
+                               + (a3[index_k_tr] * splines[index_k[index_k_tr]] + b3[index_k_tr] * splines[index_k[index_k_tr]+1])
+                               * h[index_k_tr]*h[index_k_tr]/6.0)
+                               * window_inverse[index_k_tr] * pk[index_k_tr];
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+
+
+int bispectra2_interpolate_over_k2 (
     struct precision * ppr,
     struct precision2 * ppr2,
     struct perturbs * ppt,
@@ -1859,8 +2630,9 @@ int bispectra2_interpolate_over_k1 (
     struct primordial * ppm,
     struct bispectra * pbi,
     int index_r,
+    int index_k1,
     int index_l3,
-    int index_l2,
+    double ** integral_over_k3,
     double * integral_splines,
     double * interpolated_integral,
     double * f,
@@ -1873,21 +2645,47 @@ int bispectra2_interpolate_over_k1 (
   double * k_pt = pwb->k_smooth_grid;
   int k_tr_size = ptr->q_size;
   double * k_tr = ptr->q;
-  
-  /* Define the function to be interpolated, and multiply it by a window function */
-  for (int index_k1=0; index_k1 < k_pt_size; ++index_k1) {
+
+  /* So far, we always assumed that k1>=k2 because the transfer function has the
+  following symmetry:
+      T (\vec{k1},\vec{k_2},\vec{k_3}) = (-1)^m * T (\vec{k_2},\vec{k_1},\vec{k_3}).
+  The (-1)^m factor comes from the fact that one can exchange \vec{k_1} and \vec{k_2} by
+  performing a rotation around \vec{k} of pi radians. This is equivalent to a factor of
+  exp(i*pi*m) = (-1)^m, and also implies that T_lm (\vec{k_1},\vec{k_2},\vec{k_3})=0 when
+  m is odd and \vec{k_1}=\vec{k_2}.
     
-    f[index_k1] = pwb->integral_over_k2[index_l3][index_l2][index_r][index_k1];
-    f[index_k1] *= pwb->k_window[index_k1];
+  Now we need to interpolate the k2 dependence of the transfer function, hence we build a
+  temporary array where
+      f(index_k1, index_k2) = (-1)^m * integral_over_k3(index_k2, index_k1)
+  when index_k1 < index_k2.
+  
+  We also include a (k1/k2)^m factor that mimicks the rescaling of the transfer function
+  under the exchange \vec{k_1}<->\vec{k_2}. This follows from the fact that
+      k1*sin(theta_1) = k2*sin(theta_2),
+  which implies that
+      T_rescaled(\vec{k2},\vec{k1},\vec{k3})
+      = T_rescaled(\vec{k1},\vec{k2},\vec{k3})*(k1/k2)^m */
+
+  for (int index_k2=0; index_k2 < k_pt_size; ++index_k2) {
+
+    if (index_k1 > index_k2)
+      f[index_k2] = integral_over_k3[index_k1][index_k2];
+    else 
+      f[index_k2] = integral_over_k3[index_k2][index_k1]
+                  * pow (-k_pt[index_k1]/k_pt[index_k2], pwb->abs_M3);
+    
+    /* Multiply by window function */
+    f[index_k2] *= pwb->k_window[index_k2];
+                                        
   }
- 
-  if (ppr->transfers_k1_interpolation == cubic_interpolation) {
+  
+  if (ppr->transfers_k2_interpolation == cubic_interpolation) {
     
     class_call (array_spline_table_columns (
                   k_pt,
                   k_pt_size,
                   f,
-                  1,  /* How many columns to consider */
+                  1,  /* how many columns to consider */
                   integral_splines,
                   _SPLINE_EST_DERIV_,
                   pbi->error_message),
@@ -1896,64 +2694,45 @@ int bispectra2_interpolate_over_k1 (
   }
 
 
-  /* Interpolate at each k value using the usual spline interpolation algorithm */
-  int index_k = 0;
-  double h = k_pt[index_k+1] - k_pt[index_k];
-    
-  for (int index_k_tr = 0; index_k_tr < k_tr_size; ++index_k_tr) {
-    
-    while (((index_k+1) < k_pt_size) && (k_pt[index_k+1] < k_tr[index_k_tr])) {
-      index_k++;
-      h = k_pt[index_k+1] - k_pt[index_k];
-    }
-    
-    class_test(h==0., pbi->error_message, "stop to avoid division by zero");
-    class_test((index_k+1) >= k_pt_size, pbi->error_message,
-      "some of the elements in k_tr are larger than the largest k_pt. Stop to avoid seg fault.");
-    
-    double b = (k_tr[index_k_tr] - k_pt[index_k])/h;
-    double a = 1.-b;
-      
-    /* Interpolate for each value of l2, l3, r */
-    if (ppr->transfers_k1_interpolation == linear_interpolation) {
-      interpolated_integral[index_k_tr] = a * f[index_k] + b * f[index_k+1];
-    }
-    else if (ppr->transfers_k1_interpolation == cubic_interpolation) {
-      interpolated_integral[index_k_tr] =  
-        a * f[index_k] + b * f[index_k+1]
-        + ((a*a*a-a) * integral_splines[index_k] +(b*b*b-b) * integral_splines[index_k+1])*h*h/6.0;
-    }
+  /* Interpolate at each k value, revert the effect of the window function and further
+  convolve with the primordial power spectrum */
+  class_call (bispectra2_interpolate_smooth_k (
+                ptr,
+                pbi,
+                ppr->transfers_k2_interpolation == cubic_interpolation,
+                f,
+                integral_splines,
+                interpolated_integral,
+                pwb),
+    pbi->error_message,
+    pbi->error_message);
 
-    /* Revert the effect of the window function */
-    interpolated_integral[index_k_tr] *= pwb->k_window_inverse[index_k_tr];
+  for (int index_k_tr = 0; index_k_tr < k_tr_size; ++index_k_tr) {
 
 #ifdef DEBUG
-    /* We expect the integral over k2 that we are interpolating to be order A_s~1e-10,
-    because it is obtained as a convolution of two O(1) function (the integral over k3
-    and a Bessel function) and the primordial power spectrum (of oder A_s) */
-    double expected_scale = 1e-10;
-    class_test_permissive (fabs(interpolated_integral[index_k_tr]) > (expected_scale*1000),
+    /* We expect the integral over k3 that we are interpolating to be order unity,
+    because it is obtained as a convolution of the second-order transfer functions
+    and a Bessel function */
+    double expected_scale = 1;
+    class_test_permissive (fabs(interpolated_integral[index_k_tr]/pbi->pk[index_k_tr]) > (expected_scale*1000),
       pbi->error_message,
-      "found extremely large value for integral over k2 (m=%d): I_l2_l3(k1_tr,r)=%g,\
- for l2=%d[%d], l3=%d[%d], k1_tr=%g[%d], r=%g[%d]\n",
-      pwb->abs_M3, interpolated_integral[index_k_tr], pbi->l[index_l2], index_l2, pbi->l[index_l3], index_l3,
-      k_tr[index_k_tr], index_k_tr, pwb->r[index_r], index_r);
+      "found extremely large value for integral over k3 (m=%d): I_l3(k1_pt,k2_tr,r)=%g,\
+ for l3=%d[%d], k1_pt=%g[%d], k2_tr=%g[%d], r=%g[%d]\n",
+      pwb->abs_M3, interpolated_integral[index_k_tr], pbi->l[index_l3], index_l3,
+      k_pt[index_k1], index_k1, k_tr[index_k_tr], index_k_tr, pwb->r[index_r], index_r);
 #endif // DEBUG
 
-    /* Further convolve with the primordial power spectrum */
-    interpolated_integral[index_k_tr] *= pbi->pk[index_k_tr];
-
     /* Test for nans */
     class_test (isnan(interpolated_integral[index_k_tr]),
       pbi->error_message,
-      "k1 interpolation yielded a nan for index_r=%d, index_l3=%d, index_l2=%d",
-      index_r, index_l3, index_l2);
+      "k2 interpolation yielded a nan for index_r=%d, index_k1=%d, index_l3=%d",
+      index_r, index_k1, index_l3);
 
   } // end of for (index_k_tr)
 
 
   /* Some debug - print the original array and the interpolation */
-  // if ((index_l2==10) && (index_l3==11) && (index_r==49)) {
+  // if ((index_k1==1) && (index_l3==0) && (index_r==0)) {
   // 
   //   fprintf (stderr, "\n\n");
   // 
@@ -1977,6 +2756,7 @@ int bispectra2_interpolate_over_k1 (
   //   
   // }
 
+
   return _SUCCESS_;
 
 }
@@ -1985,14 +2765,7 @@ int bispectra2_interpolate_over_k1 (
 
 
 
-
-
-
-
-    
-        
-        
-int bispectra2_intrinsic_integrate_over_k1 (
+int bispectra2_intrinsic_integrate_over_k2 (
     struct precision * ppr,
     struct precision2 * ppr2,
     struct perturbs * ppt,
@@ -2003,8 +2776,7 @@ int bispectra2_intrinsic_integrate_over_k1 (
     struct transfers2 * ptr2,
     struct primordial * ppm,
     struct bispectra * pbi,
-    int index_tt_k1,
-    int offset_L1,
+    int index_tt_k2,
     struct bispectra_workspace_intrinsic * pwb
     )
 {
@@ -2016,59 +2788,58 @@ int bispectra2_intrinsic_integrate_over_k1 (
   /* Parallelization variables */
   int thread = 0;
   int abort = _FALSE_;
-  
+
   // ======================================================================================================
   // =                                   Allocate memory for INT_l2_l3(r,k1)                              =
   // ======================================================================================================
   
-  /* We shall allocate the array pwb->integral_over_k1[index_l3][index_l2][index_l1-index_l1_min][index_r]
-  so that the l1 level is the one satisfying the triangular inequality (|l2-l3| <= l1 <= l2+l3). 
-  pwb->integral_over_k1 is recycled by the different iterations in the L1 loop and Z-field loop, hence we allocate
-  it only at the first iteration (offset_L1==, pwb->Y==0 and pwb->Z==0) */
-  
-  if ((offset_L1 == 0) && (pwb->Y==0) && (pwb->Z==0)) {
+  /* Because we shall recycle the array for more than one fields (T,E...) we make sure we allocate it
+  only once. This is achieved by performing the allocation only at the beginning of the loop over
+  the field (that is, when pwb->Y==0) */
+
+  if (pwb->Y == 0) {
 
     /* Initialize counter */
-    pwb->count_allocated_for_integral_over_k1 = 0;
+    pwb->count_allocated_for_integral_over_k2 = 0;
   
     /* Allocate l2-level */
-    class_alloc (pwb->integral_over_k1, pbi->l_size*sizeof(double ***), pbi->error_message);
+    class_alloc (pwb->integral_over_k2, pbi->l_size*sizeof(double ***), pbi->error_message);
   
     for (int index_l3=0; index_l3<pbi->l_size; ++index_l3) {
   
-      /* Allocate l2-level */
-      class_alloc (pwb->integral_over_k1[index_l3], pbi->l_size*sizeof(double **), pbi->error_message);
+      /* Allocate l3-level */
+      class_alloc (pwb->integral_over_k2[index_l3], pbi->l_size*sizeof(double **), pbi->error_message);
   
       for (int index_l2=0; index_l2<pbi->l_size; ++index_l2) {
+
+        /* We do not need the (l3,l2) pairs that do not appear in any requested configuration */
+        if (pwb->l3l2_triangle_count[index_l3][index_l2] == 0) {
+          pwb->integral_over_k2[index_l3][index_l2] = NULL;
+          continue;
+        }
+    
+        /* Allocate r-level */
+        class_alloc (pwb->integral_over_k2[index_l3][index_l2], pwb->r_size*sizeof(double *), pbi->error_message);
   
-        /* Determine the limits for l1, which come from the triangular inequality |l3-l2| <= l1 <= l3+l2 */
-        int index_l1_min = pbi->index_l_triangular_min[index_l3][index_l2];
-        int l1_size = pbi->l_triangular_size[index_l3][index_l2];
+        /* Allocate 'k1' level. Make sure to use calloc. */
+        for (int index_r=0; index_r < pwb->r_size; ++index_r) {
   
-        /* Allocate l1-level */
-        class_alloc (pwb->integral_over_k1[index_l3][index_l2], l1_size*sizeof(double *), pbi->error_message);
-      
-        /* Allocate r-level. Make sure to use calloc. */
-        for (int index_l1=index_l1_min; index_l1<(index_l1_min + l1_size); ++index_l1) {
+          int k1_size = pwb->k_smooth_size;
+          class_calloc (pwb->integral_over_k2[index_l3][index_l2][index_r], k1_size, sizeof(double), pbi->error_message);
   
-          class_calloc (pwb->integral_over_k1[index_l3][index_l2][index_l1-index_l1_min],
-                        pwb->r_size,
-                        sizeof(double),
-                        pbi->error_message);
-        
         /* Increase memory counter, excluding non-physical configurations where |M3|>l3 */
         if (pwb->abs_M3 <= pbi->l[index_l3])
-          pwb->count_allocated_for_integral_over_k1 += pwb->r_size;
-      
-        } // end of for(index_l1)
+          pwb->count_allocated_for_integral_over_k2 += k1_size;
+  
+        } // end of for(index_r)
       } // end of for(index_l2)
     } // end of for(index_l3)
     
     if (pbi->bispectra_verbose > 2)
-      printf("     * allocated ~ %.3g MB (%ld doubles) for the k1-integral array (l_size=%d)\n",
-        pwb->count_allocated_for_integral_over_k1*sizeof(double)/1e6, pwb->count_allocated_for_integral_over_k1, pbi->l_size);
-  
-  } // end of if(offset_L1==0 and pwb->Z==0)
+      printf("     * allocated ~ %.3g MB (%ld doubles) for the k2-integral array (l_size=%d)\n",
+        pwb->count_allocated_for_integral_over_k2*sizeof(double)/1e6, pwb->count_allocated_for_integral_over_k2, pbi->l_size);
+
+  } // end of if pwb->Y==0
   
   
   // ==============================================================================================================
@@ -2076,13 +2847,12 @@ int bispectra2_intrinsic_integrate_over_k1 (
   // ==============================================================================================================
   
   /* Initialize counter for the number of integrals computed */
-  pwb->count_memorised_for_integral_over_k1 = 0;
-
-  /* We parallelize the loop over 'r'. */
+  pwb->count_memorised_for_integral_over_k2 = 0;
+  
+  /* As for the k3_integral, we parallelize the loop over 'r'.  Here, we set it as the outermost loop
+  as we do not need to load the second-order transfer functions from disk. */
   abort = _FALSE_;
-  #pragma omp parallel              \
-    shared (ppt,ppt2,pbs,ptr,ptr2,ppm,pbi,pwb,abort)       \
-    private (thread)
+  #pragma omp parallel shared (abort) private (thread)
   {
   
     #ifdef _OPENMP
@@ -2093,204 +2863,1295 @@ int bispectra2_intrinsic_integrate_over_k1 (
     for (int index_r = 0; index_r < pwb->r_size; ++index_r) {
   
       if (pbi->bispectra_verbose > 2)
-        printf("     * computing the k1 integral for r=%g, index_r=%d\n", pwb->r[index_r], index_r);
-
-      /* We compute the integral over k1 for all possible l2-values */
+        printf("     * computing the k2 integral for r=%g, index_r=%d\n", pwb->r[index_r], index_r);
+  
       for (int index_l3 = 0; index_l3 < pbi->l_size; ++index_l3) {
-
-        int l3 = pbi->l[index_l3];
-
+        
         /* The configurations with |M3|>l3 do not contribute to the bispectrum because
         they would violate the 3j-symbol properties */
         if (pwb->abs_M3 > pbi->l[index_l3])
           continue;
 
-        if (pbi->bispectra_verbose > 3)
-          printf("      \\ computing the k1 integral for l3=%d, index_l3=%d, L1=%d, offset_L1=%d\n",
-            pbi->l[index_l3], index_l3, pbs2->l1[offset_L1], offset_L1);
-  
-        /* We compute the integral over k1 for all possible l3-values */
-        for (int index_l2 = 0; index_l2 < pbi->l_size; ++index_l2) {  
-
-          /* Determine the limits for l1, which come from the triangular inequality |l2-l2| <= l1 <= l2+l2 */
-          int index_l1_min = pbi->index_l_triangular_min[index_l3][index_l2];
-          int index_l1_max = pbi->index_l_triangular_max[index_l3][index_l2];
-          
-          /* DISABLED: see comment outside the outside the outermost loop. */
-          /* We compute only those l1's whereby l1 >= l2. The reason is that the k1<->k2 symmetry of the
-          second-order transfer functions enforces the l2<->l1 symmetry of I_l2_l3_l1(r). Note that
-          this is a different symmetry than the full (l2,l3,l1) symmetry of the bispectrum, which we shall
-          enforce later. If you comment out the following line together with the next one outside the
-          outermost loop, the result should not change. */
-          // index_l1_min = MAX (index_l2, index_l1_min);
-
-          /* Interpolate the integral I_l2_l3(k1,r) that we computed above in the integration grid of k1 */
-          if (index_l1_max >= index_l1_min) {
+        /* Skip the l3 values that do not appear in any requested configuration */
+        if (pwb->l3_mask[index_l3] == _FALSE_)
+          continue;
+        
+        for (int index_k1 = 0; index_k1 < pwb->k_smooth_size; ++index_k1) {
+    
+          /* Interpolate the integral I_l3(k1,k2,r) that we computed above in the integration grid of k2.
+          Note that we pass the integral_splines and interpolated_integral arrays separately rather
+          than accessing them from pwb, because they are thread dependent (while pwb isn't). */
+          class_call_parallel (bispectra2_interpolate_over_k2 (
+                                 ppr,
+                                 ppr2,
+                                 ppt,
+                                 ppt2,
+                                 pbs,
+                                 pbs2,
+                                 ptr,
+                                 ptr2,
+                                 ppm,
+                                 pbi,
+                                 index_r,
+                                 index_k1,
+                                 index_l3,
+                                 pwb->integral_over_k3[index_l3][index_r],
+                                 pwb->integral_splines[thread],
+                                 pwb->interpolated_integral[thread],
+                                 pwb->f[thread],
+                                 pwb),
+            pbi->error_message,
+            pbi->error_message);            
             
-            class_call_parallel (bispectra2_interpolate_over_k1 (
-                          ppr,
-                          ppr2,
-                          ppt,
-                          ppt2,
-                          pbs,
-                          pbs2,
-                          ptr,
-                          ptr2,
-                          ppm,
-                          pbi,
-                          index_r,
-                          index_l3,
-                          index_l2,
-                          pwb->integral_splines[thread],
-                          pwb->interpolated_integral[thread],
-                          pwb->f[thread],
-                          pwb),
-              pbi->error_message,
-              pbi->error_message);
-              
-          }
-          else {
-            continue;
-          }
-
-
-          /* l1 is the index of the first transfer function that we are going to integrate,
-          while L1 is the order of the Bessel function */
-          for (int index_l1=index_l1_min; index_l1<=index_l1_max; ++index_l1) {
+          /* Some debug - show the function that was interpolated as a function of r */
+          // if ((pbi->l[index_l3]==205) && (pwb->abs_M3==1))
+          //   if (pwb->offset_L3==1)
+          //     if (index_k1==46) {
+          //       index_k2 = 37;
+          //       fprintf (stderr, "%17.7g %17.7g\n", pwb->r[index_r], pwb->f[thread][index_k2]);
+          //     }
             
-            int l1 = pbi->l[index_l1];
-            int L1 = abs(l1-pwb->abs_M3) + offset_L1;
-
-            /* Skip the (L3,l3,M3) configurations forbidden by the triangular condition */
-            if (L1 > (l1+pwb->abs_M3)) {
-              #pragma omp atomic
-              ++pwb->count_memorised_for_integral_over_k1;
-              continue;
-            }  
-      
-            /* Find L1 inside pbs2->l1, the list of l's where we have computed the Bessel functions 
-            for the extended l-range that is necessary to compute the m!=0 bispectra. */
-            int index_L1 = pbs2->index_l1[L1];
+          /* Some debug - show the function that was interpolated as a function of k2 */
+          // if (pwb->offset_L3==-1)
+          //   if (index_k1==46)
+          //     if (index_k2==37)
+          //     // if (index_r==49) /* 14000 for 99r135to145 */
+          //       // if ((pbi->l[index_l3]==205) && (pwb->abs_M3==1))
+          //       //   for (index_k2=0; index_k2 < pwb->k_smooth_size; ++index_k2)
+          //           fprintf (stderr, "%17.7g %17.7g\n",
+          //             pwb->k_smooth_grid[index_k2], pwb->f[thread][index_k2]);
 
-#ifdef DEBUG
-            /* Paranoid android */
-            class_test_parallel ((ppr2->m_max_song==0) && (l1!=L1),
-              pbi->error_message,
-              "inconsistency! for scalar modes, L1 must be equal to l1");
-              
-            class_test_parallel (pbs2->l1[index_L1]!=L1,
-              pbi->error_message,
-              "error in the indexing of pbs2->l1. Is the pbs2->extend_l1_using_m parameter true?");
-#endif // DEBUG
+          /* Some debug - show the function after interpolation as a function of k2 */
+          // if (pwb->offset_L3==0)
+          //   if (index_k1==85) /* for ref runs with l_max=200 and kmax=6 it corresponds to 0.03728321, which is Christian's 13 */
+          //   // if (index_k1==118) /* For better k-sampling, corresponds to 0.1 */
+          //   // if (index_k1==95) /* For ref k-sampling, corresponds to 0.1 */
+          //     // if (index_r==83) /* 14000 for 250r13to16 */
+          //     if (index_r==49) /* 14005.1 for 100r135to145 */
+          //       if ((pbi->l[index_l3]==200) && (pwb->abs_M3==1))
+          //         for (index_k2=0; index_k2 < ptr->q_size; ++index_k2)
+          //           fprintf (stderr, "%17.7g %17.7g\n",
+          //             ptr->q[index_k2],
+          //             pwb->interpolated_integral[thread][index_k2]/pbi->pk[index_k2]);
+
+          for (int index_l2 = 0; index_l2 < pbi->l_size; ++index_l2) {  
 
+            if (pwb->l3l2_triangle_count[index_l3][index_l2] == 0)
+              continue;
+  
             /* Define the pointer to the first-order transfer functions as a function of k */
             double * transfer = &(ptr->transfer [ppt->index_md_scalars]
-                                                [((ppt->index_ic_ad * ptr->tt_size[ppt->index_md_scalars] + index_tt_k1)
-                                                * ptr->l_size[ppt->index_md_scalars] + index_l1) * k_tr_size]);
+                                                [((ppt->index_ic_ad * ptr->tt_size[ppt->index_md_scalars] + index_tt_k2)
+                                                * ptr->l_size[ppt->index_md_scalars] + index_l2) * k_tr_size]);
   
-            /* It is important to note that the used Bessel here has order L1 rather than l1 */
-            class_call_parallel (bessel2_convolution (
+            class_call_parallel (bessel_convolution (
                                    ppr,
-                                   pbs2,
+                                   pbs,
                                    k_tr,
                                    pbi->delta_k,
                                    k_tr_size,
                                    pwb->interpolated_integral[thread],
                                    transfer,
-                                   index_L1,
+                                   index_l2,
                                    pwb->r[index_r],
-                                   &(pwb->integral_over_k1[index_l3][index_l2][index_l1-index_l1_min][index_r]),
+                                   &(pwb->integral_over_k2[index_l3][index_l2][index_r][index_k1]),
                                    pbi->error_message
                                    ),
               pbi->error_message,
               pbi->error_message);
-  
-  
-            /* Update the counter */
-            #pragma omp atomic
-            ++pwb->count_memorised_for_integral_over_k1;
 
-            /* Print the integral as a function of r */
-            // if ((pwb->abs_M3==0) && (pwb->offset_L3==0) && (offset_L1==0))
-            //   if ((pwb->X==pbi->index_bf_t) && (pwb->Y==pbi->index_bf_t) && (pwb->Z==pbi->index_bf_t))
-            //     if ((pbi->l[index_l1]==2) && (pbi->l[index_l2]==2) && (pbi->l[index_l3]==2))
-            //         fprintf (stderr, "%17.7g %17.7g\n",
-            //           pwb->r[index_r], pwb->integral_over_k1[index_l3][index_l2][index_l1-index_l1_min][index_r]);
+            /* Some debug - Print the integral as a function of r */
+            // if ((pwb->abs_M3==1) && (pwb->offset_L3==0))
+            //   if ((pbi->l[index_l2]==200) && (pbi->l[index_l3]==200))
+            //     /* for l_max=200 and kmax=6 it corresponds to 0.03728321, which is Christian's 13 */
+            //     if (index_k1==85)
+            //     // if ((index_k1==1) && (index_k2==0))
+            //       fprintf (stderr, "%17.7g %17.7g\n",
+            //         pwb->r[index_r], pwb->integral_over_k2[index_l3][index_l2][index_r][index_k1]);
 
+            /* Update the counter */
+            #pragma omp atomic
+            ++pwb->count_memorised_for_integral_over_k2;
+  
             #pragma omp flush(abort)
   
-          } // end of for(index_l1)
-        } // end of for(index_l2)
+          } // end of for(index_l2)
+        } // end of for(index_k1)
       } // end of for(index_l3)
     } // end of for(index_r)
   } if (abort == _TRUE_) return _FAILURE_;  // end of parallel region
+  
+  if (pbi->bispectra_verbose > 2)
+    printf("     * memorised ~ %.3g MB (%ld doubles) for the k2-integral array (k2_size=%d)\n",
+      pwb->count_memorised_for_integral_over_k2*sizeof(double)/1e6, pwb->count_memorised_for_integral_over_k2,
+      k_tr_size);
+  
+  /* Check that we correctly filled the array */
+  class_test (pwb->count_memorised_for_integral_over_k2 != pwb->count_allocated_for_integral_over_k2,
+    pbi->error_message,
+    "there is a mismatch between allocated (%ld) and used (%ld) space!",
+    pwb->count_allocated_for_integral_over_k2, pwb->count_memorised_for_integral_over_k2);
+  
+  /* Free the memory that was allocated for the I_l3 integral, but only if we have already computed it
+  for all the required probes */
+  if (pwb->Y == (pbi->bf_size-1))
+    class_call (bispectra2_intrinsic_free_k3_integral (
+                  pwb->integral_over_k3,
+                  &(pwb->integral_over_k3_arena)),
+      pbi->error_message,
+      pbi->error_message);
 
-  /* DISABLED:  While the optimization makes sense, the way we implement it below leads to nan's. Investigate. */
-  /* Take care of the case when l1 < l2 */
-  // for (index_r = 0; index_r < pwb->r_size; ++index_r) {
-  //   for (index_l2=0; index_l2<pbi->l_size; ++index_l2) {
-  //     for (index_l3=0; index_l3<pbi->l_size; ++index_l3) {
-  //
-  //       if (pwb->abs_M3 > pbi->l[index_l3])
-  //        continue;
+
+  return _SUCCESS_; 
+
+}
+
+        
+
+
+
+
+int bispectra2_interpolate_over_k1 (
+    struct precision * ppr,
+    struct precision2 * ppr2,
+    struct perturbs * ppt,
+    struct perturbs2 * ppt2,
+    struct bessels * pbs,
+    struct bessels2 * pbs2,
+    struct transfers * ptr,
+    struct transfers2 * ptr2,
+    struct primordial * ppm,
+    struct bispectra * pbi,
+    int index_r,
+    int index_l3,
+    int index_l2,
+    double * integral_over_k2,
+    double * integral_splines,
+    double * interpolated_integral,
+    double * f,
+    struct bispectra_workspace_intrinsic * pwb
+    )
+{
+
+  /* Shortcuts */
+  int k_pt_size = pwb->k_smooth_size;
+  double * k_pt = pwb->k_smooth_grid;
+  int k_tr_size = ptr->q_size;
+  double * k_tr = ptr->q;
+  
+  /* Define the function to be interpolated, and multiply it by a window function */
+  for (int index_k1=0; index_k1 < k_pt_size; ++index_k1) {
+    
+    f[index_k1] = integral_over_k2[index_k1];
+    f[index_k1] *= pwb->k_window[index_k1];
+  }
+ 
+  if (ppr->transfers_k1_interpolation == cubic_interpolation) {
+    
+    class_call (array_spline_table_columns (
+                  k_pt,
+                  k_pt_size,
+                  f,
+                  1,  /* How many columns to consider */
+                  integral_splines,
+                  _SPLINE_EST_DERIV_,
+                  pbi->error_message),
+         pbi->error_message,
+         pbi->error_message);
+  }
+
+
+  /* Interpolate at each k value, revert the effect of the window function and further
+  convolve with the primordial power spectrum */
+  class_call (bispectra2_interpolate_smooth_k (
+                ptr,
+                pbi,
+                ppr->transfers_k1_interpolation == cubic_interpolation,
+                f,
+                integral_splines,
+                interpolated_integral,
+                pwb),
+    pbi->error_message,
+    pbi->error_message);
+
+  for (int index_k_tr = 0; index_k_tr < k_tr_size; ++index_k_tr) {
+
+#ifdef DEBUG
+    /* We expect the integral over k2 that we are interpolating to be order A_s~1e-10,
+    because it is obtained as a convolution of two O(1) function (the integral over k3
+    and a Bessel function) and the primordial power spectrum (of oder A_s) */
+    double expected_scale = 1e-10;
+    class_test_permissive (fabs(interpolated_integral[index_k_tr]/pbi->pk[index_k_tr]) > (expected_scale*1000),
+      pbi->error_message,
+      "found extremely large value for integral over k2 (m=%d): I_l2_l3(k1_tr,r)=%g,\
+ for l2=%d[%d], l3=%d[%d], k1_tr=%g[%d], r=%g[%d]\n",
+      pwb->abs_M3, interpolated_integral[index_k_tr], pbi->l[index_l2], index_l2, pbi->l[index_l3], index_l3,
+      k_tr[index_k_tr], index_k_tr, pwb->r[index_r], index_r);
+#endif // DEBUG
+
+    /* Test for nans */
+    class_test (isnan(interpolated_integral[index_k_tr]),
+      pbi->error_message,
+      "k1 interpolation yielded a nan for index_r=%d, index_l3=%d, index_l2=%d",
+      index_r, index_l3, index_l2);
+
+  } // end of for (index_k_tr)
+
+
+  /* Some debug - print the original array and the interpolation */
+  // if ((index_l2==10) && (index_l3==11) && (index_r==49)) {
   // 
-  //       int index_l1_min = pbi->index_l_triangular_min[index_l3][index_l2];
-  //       int index_l1_max = pbi->index_l_triangular_max[index_l3][index_l2];
+  //   fprintf (stderr, "\n\n");
   // 
-  //       /* The following is equivalent to restrict the loop to l1<l2 */
-  //       index_l1_max = MIN (index_l2-1, index_l1_max);
+  //   /* Node points before window */
+  //   for (index_k=0; index_k < k_pt_size; ++index_k)
+  //     fprintf (stderr, "%17.7g %17.7g\n", k_pt[index_k], f[index_k]/pwb->k_window[index_k]);
   // 
-  //       for (index_l1=index_l1_min; index_l1<=index_l1_max; ++index_l1) {
+  //   fprintf (stderr, "\n");
+  //   
+  //   /* Node points after window */
+  //   for (index_k=0; index_k < k_pt_size; ++index_k)
+  //     fprintf (stderr, "%17.7g %17.7g\n", k_pt[index_k], f[index_k]);
   // 
-  //           int index_l2_min = pbi->index_l_triangular_min[index_l3][index_l1];
-  //         
-  //           pwb->integral_over_k1[index_l3][index_l2][index_l1-index_l1_min][index_r]
-  //             = pwb->integral_over_k1[index_l1][index_l3][index_l2-index_l2_min][index_r];
-  //         
-  //           /* Update the counter */
-  //           #pragma omp atomic
-  //           ++pwb->count_memorised_for_integral_over_k1;
-  //         
-  //       }
-  //     }
-  //   }
+  //   fprintf (stderr, "\n");
+  // 
+  //   /* Interpolation after inverse window */  
+  //   for (index_k_tr = 0; index_k_tr < k_tr_size; ++index_k_tr)
+  //     fprintf (stderr, "%17.7g %17.7g\n", k_tr[index_k_tr], interpolated_integral[index_k_tr]/pbi->pk[index_k_tr]);
+  // 
+  //   fprintf (stderr, "\n\n");
+  //   
   // }
 
-  if (pbi->bispectra_verbose > 2)
-    printf("     * memorised ~ %.3g MB (%ld doubles) for the k1-integral array (k1_size=%d)\n",
-      pwb->count_memorised_for_integral_over_k1*sizeof(double)/1e6, pwb->count_memorised_for_integral_over_k1,
-      k_tr_size);
-  
-  /* Check that we correctly filled the array */
-  class_test (pwb->count_memorised_for_integral_over_k1 != pwb->count_allocated_for_integral_over_k1,
-    pbi->error_message,
-    "there is a mismatch between allocated (%ld) and used (%ld) space!",
-    pwb->count_allocated_for_integral_over_k1, pwb->count_memorised_for_integral_over_k1);
+  return _SUCCESS_;
+
+}
+
+
+
+
+
+
+
+
+
+    
+        
+        
+int bispectra2_intrinsic_integrate_over_k1 (
+    struct precision * ppr,
+    struct precision2 * ppr2,
+    struct perturbs * ppt,
+    struct perturbs2 * ppt2,
+    struct bessels * pbs,
+    struct bessels2 * pbs2,
+    struct transfers * ptr,
+    struct transfers2 * ptr2,
+    struct primordial * ppm,
+    struct bispectra * pbi,
+    int index_tt_k1,
+    int offset_L1,
+    struct bispectra_workspace_intrinsic * pwb
+    )
+{
+
+  /* Integration grid */
+  int k_tr_size = ptr->q_size;
+  double * k_tr = ptr->q;
+
+  /* Parallelization variables */
+  int thread = 0;
+  int abort = _FALSE_;
+  
+  // ======================================================================================================
+  // =                                   Allocate memory for INT_l2_l3(r,k1)                              =
+  // ======================================================================================================
+  
+  /* We shall allocate the array pwb->integral_over_k1[index_l3][index_l2][index_l1-index_l1_min][index_r]
+  so that the l1 level is the one satisfying the triangular inequality (|l2-l3| <= l1 <= l2+l3). 
+  pwb->integral_over_k1 is recycled by the different iterations in the L1 loop and Z-field loop, hence we allocate
+  it only at the first iteration (offset_L1==, pwb->Y==0 and pwb->Z==0) */
+  
+  if ((offset_L1 == 0) && (pwb->Y==0) && (pwb->Z==0)) {
+
+    /* Initialize counter */
+    pwb->count_allocated_for_integral_over_k1 = 0;
+  
+    /* Allocate l2-level */
+    class_alloc (pwb->integral_over_k1, pbi->l_size*sizeof(double ***), pbi->error_message);
+  
+    for (int index_l3=0; index_l3<pbi->l_size; ++index_l3) {
+  
+      /* Allocate l2-level */
+      class_alloc (pwb->integral_over_k1[index_l3], pbi->l_size*sizeof(double **), pbi->error_message);
+  
+      for (int index_l2=0; index_l2<pbi->l_size; ++index_l2) {
+  
+        /* Determine the limits for l1, which come from the triangular inequality |l3-l2| <= l1 <= l3+l2 */
+        int index_l1_min = pbi->index_l_triangular_min[index_l3][index_l2];
+        int l1_size = pbi->l_triangular_size[index_l3][index_l2];
+  
+        /* Allocate l1-level */
+        class_alloc (pwb->integral_over_k1[index_l3][index_l2], l1_size*sizeof(double *), pbi->error_message);
+      
+        /* Allocate r-level. Make sure to use calloc. The configurations that were not
+        requested are not computed. */
+        for (int index_l1=index_l1_min; index_l1<(index_l1_min + l1_size); ++index_l1) {
+
+          if (pwb->triangle_mask[pwb->triangle_start[index_l3][index_l2] + index_l1-index_l1_min] == _FALSE_) {
+            pwb->integral_over_k1[index_l3][index_l2][index_l1-index_l1_min] = NULL;
+            continue;
+          }
+  
+          class_calloc (pwb->integral_over_k1[index_l3][index_l2][index_l1-index_l1_min],
+                        pwb->r_size,
+                        sizeof(double),
+                        pbi->error_message);
+        
+        /* Increase memory counter, excluding non-physical configurations where |M3|>l3 */
+        if (pwb->abs_M3 <= pbi->l[index_l3])
+          pwb->count_allocated_for_integral_over_k1 += pwb->r_size;
+      
+        } // end of for(index_l1)
+      } // end of for(index_l2)
+    } // end of for(index_l3)
+    
+    if (pbi->bispectra_verbose > 2)
+      printf("     * allocated ~ %.3g MB (%ld doubles) for the k1-integral array (l_size=%d)\n",
+        pwb->count_allocated_for_integral_over_k1*sizeof(double)/1e6, pwb->count_allocated_for_integral_over_k1, pbi->l_size);
+  
+  } // end of if(offset_L1==0 and pwb->Z==0)
+  
+  
+  // ==============================================================================================================
+  // =                                   Compute the INT_l2_l3(r, k1) integral                                    =
+  // ==============================================================================================================
+  
+  /* Initialize counter for the number of integrals computed */
+  pwb->count_memorised_for_integral_over_k1 = 0;
+
+  /* We parallelize the loop over 'r'. */
+  abort = _FALSE_;
+  #pragma omp parallel              \
+    shared (ppt,ppt2,pbs,ptr,ptr2,ppm,pbi,pwb,abort)       \
+    private (thread)
+  {
+  
+    #ifdef _OPENMP
+    thread = omp_get_thread_num();
+    #endif
+  
+    #pragma omp for schedule (dynamic)
+    for (int index_r = 0; index_r < pwb->r_size; ++index_r) {
+  
+      if (pbi->bispectra_verbose > 2)
+        printf("     * computing the k1 integral for r=%g, index_r=%d\n", pwb->r[index_r], index_r);
+
+      /* We compute the integral over k1 for all possible l2-values */
+      for (int index_l3 = 0; index_l3 < pbi->l_size; ++index_l3) {
+
+        int l3 = pbi->l[index_l3];
+
+        /* The configurations with |M3|>l3 do not contribute to the bispectrum because
+        they would violate the 3j-symbol properties */
+        if (pwb->abs_M3 > pbi->l[index_l3])
+          continue;
+
+        if (pbi->bispectra_verbose > 3)
+          printf("      \\ computing the k1 integral for l3=%d, index_l3=%d, L1=%d, offset_L1=%d\n",
+            pbi->l[index_l3], index_l3, pbs2->l1[offset_L1], offset_L1);
+  
+        /* We compute the integral over k1 for all possible l3-values */
+        for (int index_l2 = 0; index_l2 < pbi->l_size; ++index_l2) {  
+
+          /* Determine the limits for l1, which come from the triangular inequality |l2-l2| <= l1 <= l2+l2 */
+          int index_l1_min = pbi->index_l_triangular_min[index_l3][index_l2];
+          int index_l1_max = pbi->index_l_triangular_max[index_l3][index_l2];
+          
+          /* DISABLED: see comment outside the outside the outermost loop. */
+          /* We compute only those l1's whereby l1 >= l2. The reason is that the k1<->k2 symmetry of the
+          second-order transfer functions enforces the l2<->l1 symmetry of I_l2_l3_l1(r). Note that
+          this is a different symmetry than the full (l2,l3,l1) symmetry of the bispectrum, which we shall
+          enforce later. If you comment out the following line together with the next one outside the
+          outermost loop, the result should not change. */
+          // index_l1_min = MAX (index_l2, index_l1_min);
+
+          /* Interpolate the integral I_l2_l3(k1,r) that we computed above in the integration grid of k1 */
+          if ((index_l1_max >= index_l1_min) && (pwb->l3l2_triangle_count[index_l3][index_l2] > 0)) {
+            
+            class_call_parallel (bispectra2_interpolate_over_k1 (
+                          ppr,
+                          ppr2,
+                          ppt,
+                          ppt2,
+                          pbs,
+                          pbs2,
+                          ptr,
+                          ptr2,
+                          ppm,
+                          pbi,
+                          index_r,
+                          index_l3,
+                          index_l2,
+                          pwb->integral_over_k2[index_l3][index_l2][index_r],
+                          pwb->integral_splines[thread],
+                          pwb->interpolated_integral[thread],
+                          pwb->f[thread],
+                          pwb),
+              pbi->error_message,
+              pbi->error_message);
+              
+          }
+          else {
+            continue;
+          }
+
+
+          /* l1 is the index of the first transfer function that we are going to integrate,
+          while L1 is the order of the Bessel function */
+          for (int index_l1=index_l1_min; index_l1<=index_l1_max; ++index_l1) {
+
+            /* Skip the configurations that were not requested */
+            if (pwb->triangle_mask[pwb->triangle_start[index_l3][index_l2] + index_l1-index_l1_min] == _FALSE_)
+              continue;
+            
+            int l1 = pbi->l[index_l1];
+            int L1 = abs(l1-pwb->abs_M3) + offset_L1;
+
+            /* Skip the (L3,l3,M3) configurations forbidden by the triangular condition */
+            if (L1 > (l1+pwb->abs_M3)) {
+              #pragma omp atomic
+              ++pwb->count_memorised_for_integral_over_k1;
+              continue;
+            }  
+      
+            /* Find L1 inside pbs2->l1, the list of l's where we have computed the Bessel functions 
+            for the extended l-range that is necessary to compute the m!=0 bispectra. */
+            int index_L1 = pbs2->index_l1[L1];
+
+#ifdef DEBUG
+            /* Paranoid android */
+            class_test_parallel ((ppr2->m_max_song==0) && (l1!=L1),
+              pbi->error_message,
+              "inconsistency! for scalar modes, L1 must be equal to l1");
+              
+            class_test_parallel (pbs2->l1[index_L1]!=L1,
+              pbi->error_message,
+              "error in the indexing of pbs2->l1. Is the pbs2->extend_l1_using_m parameter true?");
+#endif // DEBUG
+
+            /* Define the pointer to the first-order transfer functions as a function of k */
+            double * transfer = &(ptr->transfer [ppt->index_md_scalars]
+                                                [((ppt->index_ic_ad * ptr->tt_size[ppt->index_md_scalars] + index_tt_k1)
+                                                * ptr->l_size[ppt->index_md_scalars] + index_l1) * k_tr_size]);
+  
+            /* It is important to note that the used Bessel here has order L1 rather than l1 */
+            class_call_parallel (bessel2_convolution (
+                                   ppr,
+                                   pbs2,
+                                   k_tr,
+                                   pbi->delta_k,
+                                   k_tr_size,
+                                   pwb->interpolated_integral[thread],
+                                   transfer,
+                                   index_L1,
+                                   pwb->r[index_r],
+                                   &(pwb->integral_over_k1[index_l3][index_l2][index_l1-index_l1_min][index_r]),
+                                   pbi->error_message
+                                   ),
+              pbi->error_message,
+              pbi->error_message);
+  
+  
+            /* Update the counter */
+            #pragma omp atomic
+            ++pwb->count_memorised_for_integral_over_k1;
+
+            /* Print the integral as a function of r */
+            // if ((pwb->abs_M3==0) && (pwb->offset_L3==0) && (offset_L1==0))
+            //   if ((pwb->X==pbi->index_bf_t) && (pwb->Y==pbi->index_bf_t) && (pwb->Z==pbi->index_bf_t))
+            //     if ((pbi->l[index_l1]==2) && (pbi->l[index_l2]==2) && (pbi->l[index_l3]==2))
+            //         fprintf (stderr, "%17.7g %17.7g\n",
+            //           pwb->r[index_r], pwb->integral_over_k1[index_l3][index_l2][index_l1-index_l1_min][index_r]);
+
+            #pragma omp flush(abort)
+  
+          } // end of for(index_l1)
+        } // end of for(index_l2)
+      } // end of for(index_l3)
+    } // end of for(index_r)
+  } if (abort == _TRUE_) return _FAILURE_;  // end of parallel region
+
+  /* DISABLED:  While the optimization makes sense, the way we implement it below leads to nan's. Investigate. */
+  /* Take care of the case when l1 < l2 */
+  // for (index_r = 0; index_r < pwb->r_size; ++index_r) {
+  //   for (index_l2=0; index_l2<pbi->l_size; ++index_l2) {
+  //     for (index_l3=0; index_l3<pbi->l_size; ++index_l3) {
+  //
+  //       if (pwb->abs_M3 > pbi->l[index_l3])
+  //        continue;
+  // 
+  //       int index_l1_min = pbi->index_l_triangular_min[index_l3][index_l2];
+  //       int index_l1_max = pbi->index_l_triangular_max[index_l3][index_l2];
+  // 
+  //       /* The following is equivalent to restrict the loop to l1<l2 */
+  //       index_l1_max = MIN (index_l2-1, index_l1_max);
+  // 
+  //       for (index_l1=index_l1_min; index_l1<=index_l1_max; ++index_l1) {
+  // 
+  //           int index_l2_min = pbi->index_l_triangular_min[index_l3][index_l1];
+  //         
+  //           pwb->integral_over_k1[index_l3][index_l2][index_l1-index_l1_min][index_r]
+  //             = pwb->integral_over_k1[index_l1][index_l3][index_l2-index_l2_min][index_r];
+  //         
+  //           /* Update the counter */
+  //           #pragma omp atomic
+  //           ++pwb->count_memorised_for_integral_over_k1;
+  //         
+  //       }
+  //     }
+  //   }
+  // }
+
+  if (pbi->bispectra_verbose > 2)
+    printf("     * memorised ~ %.3g MB (%ld doubles) for the k1-integral array (k1_size=%d)\n",
+      pwb->count_memorised_for_integral_over_k1*sizeof(double)/1e6, pwb->count_memorised_for_integral_over_k1,
+      k_tr_size);
+  
+  /* Check that we correctly filled the array */
+  class_test (pwb->count_memorised_for_integral_over_k1 != pwb->count_allocated_for_integral_over_k1,
+    pbi->error_message,
+    "there is a mismatch between allocated (%ld) and used (%ld) space!",
+    pwb->count_allocated_for_integral_over_k1, pwb->count_memorised_for_integral_over_k1);
+
+  /* Free the memory that was allocated for the integral over k2, but do that only when we are at
+  the last iteration of the loops on offset_L1 (which is always performed since 2*abs_M3 is always
+  even), Z and Y. */
+  if ((offset_L1 == (2*pwb->abs_M3)) && (pwb->Y == (pbi->bf_size-1)) && (pwb->Z == (pbi->bf_size-1))) {
+    for (int index_l3=0; index_l3<pbi->l_size; ++index_l3) {
+      for (int index_l2=0; index_l2<pbi->l_size; ++index_l2) {
+        if (pwb->integral_over_k2[index_l3][index_l2] == NULL)
+          continue;
+        for (int index_r=0; index_r < pwb->r_size; ++index_r) {      
+          free (pwb->integral_over_k2[index_l3][index_l2][index_r]);
+        } // end of for(index_r)
+        free (pwb->integral_over_k2[index_l3][index_l2]);
+      } // end of for(index_l2)
+      free (pwb->integral_over_k2[index_l3]);
+    } // end of for(index_l3)
+    free (pwb->integral_over_k2);
+  } // end of if last term in the L1, Y, Z sums
+  
+  return _SUCCESS_;
+}
+      
+
+
+
+
+int bispectra2_intrinsic_integrate_over_r(
+    struct precision * ppr,
+    struct precision2 * ppr2,
+    struct perturbs * ppt,
+    struct perturbs2 * ppt2,
+    struct bessels * pbs,
+    struct bessels2 * pbs2,
+    struct transfers * ptr,
+    struct transfers2 * ptr2,
+    struct primordial * ppm,
+    struct bispectra * pbi,
+    struct bispectra_workspace_intrinsic * pwb
+    )
+{
+  
+  // ==========================================================================================================
+  // =                                    Allocate memory for INT_l1_l2_l3(r)                                 =
+  // ==========================================================================================================
+  
+  /* We shall allocate the array pwb->integral_over_r[index_l3][index_l2][index_l1-index_l_triangular_min]
+  so that the l1 level is the one satisfying the triangular inequality. 
+  pwb->integral_over_r is recycled by the different iterations in the L1 loop and in the Z-field loop, hence
+  we allocate it only at the first iteration (offset_L1==0 and pwb->Z==0) */
+
+  if ((pwb->offset_L1 == 0) && (pwb->Y == 0) && (pwb->Z == 0)) {
+  
+    /* All the values of the array are stored contiguously in pwb->integral_over_r_arena. We do
+    not reserve space for the non-physical configurations where |M3|>l3, whose l1 level is set
+    to NULL. The memory counter is just the size of the arena. */
+    long int size = 0;
+    for (int index_l3=0; index_l3<pbi->l_size; ++index_l3)
+      if (pwb->abs_M3 <= pbi->l[index_l3])
+        for (int index_l2=0; index_l2<pbi->l_size; ++index_l2)
+          size += pbi->l_triangular_size[index_l3][index_l2];
+
+    class_call (arena_init (&(pwb->integral_over_r_arena), size, pbi->error_message),
+      pbi->error_message,
+      pbi->error_message);
+
+    pwb->count_allocated_for_integral_over_r = pwb->integral_over_r_arena.size;
+  
+    /* Allocate l3-level */
+    class_alloc (pwb->integral_over_r, pbi->l_size*sizeof(double **), pbi->error_message);
+
+    for (int index_l3=0; index_l3<pbi->l_size; ++index_l3) {
+
+      /* Allocate l2-level */
+      class_alloc (pwb->integral_over_r[index_l3], pbi->l_size*sizeof(double *), pbi->error_message);
+
+      /* Point the l1-level inside the arena */
+      if (pwb->abs_M3 <= pbi->l[index_l3]) {
+        class_call (arena_take_row (
+                      &(pwb->integral_over_r_arena),
+                      pbi->l_size,
+                      pbi->l_triangular_size[index_l3],
+                      1,
+                      pwb->integral_over_r[index_l3],
+                      pbi->error_message),
+          pbi->error_message,
+          pbi->error_message);
+      }
+      else {
+        for (int index_l2=0; index_l2<pbi->l_size; ++index_l2)
+          pwb->integral_over_r[index_l3][index_l2] = NULL;
+      }
+
+    } // end of for(index_l3)
+
+    if (pbi->bispectra_verbose > 2)
+      printf(" -> allocated ~ %.3g MB (%ld doubles) for the r-integral array\n",
+        pwb->count_allocated_for_integral_over_r*sizeof(double)/1e6, pwb->count_allocated_for_integral_over_r);
+
+  } // end of if(offset_L1==0 and pwb->Z == 0)
+  
+  
+  // ==========================================================================================================
+  // =                                    Compute  INT_l1_l2_l3(r)  integral                                  =
+  // ==========================================================================================================
+  
+  /* We now proceed to the to integrate I(l3,l2,l1,r) over r. The function also multiplies
+  the result by the appropriate coefficients.  */
+    
+  /* We parallelize the loop over the (l3,l2) pairs, starting from those with the
+  largest number of l1 values; see bispectra2_l3l2_queue(). */
+  int abort = _FALSE_;
+  #pragma omp parallel shared (ppt,ppt2,pbs,ptr,ptr2,ppm,pbi,pwb,abort)
+  {
+  
+    #pragma omp for schedule (dynamic,1)
+    for (int index_pair = 0; index_pair < pwb->l3l2_pair_size; ++index_pair) {
+
+      int index_l3 = pwb->l3l2_pairs[index_pair].index_l3;
+      int index_l2 = pwb->l3l2_pairs[index_pair].index_l2;
+  
+      /* The configurations with |M3|>l3 do not contribute to the bispectrum because
+      they would violate the 3j-symbol properties */
+      if (pwb->abs_M3 > pbi->l[index_l3])
+        continue;
+  
+      if (pbi->bispectra_verbose > 4)
+        printf("     * computing the r-integral for (l3,l2)=(%d,%d)\n", pbi->l[index_l3], pbi->l[index_l2]);
+  
+      /* Determine the limits for l1, which come from the triangular inequality |l2-l3| <= l1 <= l2+l3 */
+      int index_l1_min = pbi->index_l_triangular_min[index_l3][index_l2];
+      int index_l1_max = pbi->index_l_triangular_max[index_l3][index_l2];
+
+      for (int index_l1=index_l1_min; index_l1<=index_l1_max; ++index_l1) {  
+
+        if (pbi->bispectra_verbose > 4)
+          printf("     * now considering (index_l3,index_l2,index_l1) = (%d,%d,%d)\n", index_l3, index_l2, index_l1);
+
+        /* The configurations that were not requested have no integrand, and their
+        integral is left to zero */
+        if (pwb->triangle_mask[pwb->triangle_start[index_l3][index_l2] + index_l1-index_l1_min] == _FALSE_)
+          continue;
+      
+        /* Shortcut to the main part of the integrand function */
+        double * I = pwb->integral_over_k1[index_l3][index_l2][index_l1-index_l1_min];
+        double * r_weight = pwb->r_weight;
+        double integral = 0;
+
+        /* Increment the estimate of the integral, using the trapezoidal weights r^2*delta_r */
+        if (pwb->scalar_kernels == _TRUE_) {
+          for (int index_r = 0; index_r < pwb->r_size; ++index_r) {
+            double r = pwb->r[index_r];
+            double integrand = r*r * I[index_r];
+            if (integrand == 0.)
+              continue;
+            integral += integrand * pwb->delta_r[index_r];
+          }
+        }
+        else {
+          #pragma omp simd reduction(+:integral)
+          for (int index_r = 0; index_r < pwb->r_size; ++index_r)
+            integral += r_weight[index_r] * I[index_r];
+        }
+
+
+        /* Fill the result array and include the factor 1/2 from trapezoidal rule */
+        pwb->integral_over_r[index_l3][index_l2][index_l1-index_l1_min] = 0.5 * integral;
+
+        /* Some debug - output the integral as a function of r on stderr for a custom (l2,l3,l1) */
+        // if ( (l2==l3) && (l3==l1) ) {
+        //   fprintf(stderr, "%12d %17.7g\n", l2, pwb->integral_over_r[index_l3][index_l2][index_l1-index_l1_min]);
+        // }
+          
+      } // end of for(index_l1)
+      
+      #pragma omp flush(abort)
+      
+    } // end of for(index_pair)
+  } if (abort == _TRUE_) return _FAILURE_;  // end of parallel region
+  
+  /* We can free the memory that was allocated for the integral over k1, as it is no longer needed */
+  if ((pwb->offset_L1 == (2*pwb->abs_M3)) && (pwb->Y == (pbi->bf_size-1)) && (pwb->Z == (pbi->bf_size-1))) {
+    for (int index_l3 = 0; index_l3 < pbi->l_size; ++index_l3) {
+      for (int index_l2 = 0; index_l2 < pbi->l_size; ++index_l2) {
+        int index_l1_min = pbi->index_l_triangular_min[index_l3][index_l2];
+        int index_l1_max = pbi->index_l_triangular_max[index_l3][index_l2];
+        for (int index_l1=index_l1_min; index_l1<=index_l1_max; ++index_l1) {  
+          free (pwb->integral_over_k1[index_l3][index_l2][index_l1-index_l1_min]);
+        } // end of for(index_l1)
+        free (pwb->integral_over_k1[index_l3][index_l2]);
+      } // end of for(index_l3)
+      free (pwb->integral_over_k1[index_l3]);
+    } // end of for(index_l2)
+    free (pwb->integral_over_k1);
+  } // end of last term in the L1 and loop
+  
+  return _SUCCESS_; 
+}
+
+
+
+
+/**
+ * Compute the integrals over k3, k2, k1 and r of the intrinsic bispectrum for a
+ * given (M3,offset_L3) and for all the (Y,offset_L1,Z) combinations, and sum
+ * them with the geometrical factors into pwb->unsymmetrised_bispectrum.
+ *
+ * This function gives the same result as the chain bispectra2_intrinsic_integrate_over_k3(),
+ * bispectra2_intrinsic_integrate_over_k2(), bispectra2_intrinsic_integrate_over_k1()
+ * and bispectra2_intrinsic_integrate_over_r(), but it never stores the full
+ * intermediate arrays, whose size grows as l_size^2*r_size*k_size and which
+ * therefore limit the maximum multipole of the bispectrum.
+ *
+ * Instead, the integrals are computed one l3 at a time. For a given l3, we first
+ * compute the integral over k3 for all values of (r,k1,k2); then, each thread takes
+ * one r value at a time and performs the integrals over k2 and k1 for all (l2,l1),
+ * keeping only the l_size*k_size array INT_l2_l3(r,k1) in memory. The contribution
+ * of each r to the integral over r is accumulated in a thread-local array, which is
+ * added to the result at the end of the l3 iteration. The working set of each thread
+ * is therefore independent of r_size and of the number of l3 values.
+ *
+ * The integral over r is computed for all (Y,offset_L1,Z) combinations before the
+ * geometrical factors are applied, so that the second-order transfer functions are
+ * loaded from disk only once for each l3.
+ *
+ * This function is used when ppr2->tile_intrinsic_bispectrum is _TRUE_.
+ */
+
+int bispectra2_intrinsic_integrate_tiled (
+    struct precision * ppr,
+    struct precision2 * ppr2,
+    struct perturbs * ppt,
+    struct perturbs2 * ppt2,
+    struct bessels * pbs,
+    struct bessels2 * pbs2,
+    struct transfers * ptr,
+    struct transfers2 * ptr2,
+    struct primordial * ppm,
+    struct bispectra * pbi,
+    int index_bt,
+    int index_tt2_k3,
+    int index_M3,
+    int offset_L3,
+    struct bispectra_workspace_intrinsic * pwb
+    )
+{
+
+  /* Integration grid */
+  int k_tr_size = ptr->q_size;
+  double * k_tr = ptr->q;
+
+  /* Parallelization variables */
+  int number_of_threads = 1;
+  int thread = 0;
+  int abort = _FALSE_;
+
+  #pragma omp parallel
+  {
+    #ifdef _OPENMP
+    number_of_threads = omp_get_num_threads();
+    #endif
+  }
+
+  /* Number of offsets for L1, and number of (Y,offset_L1,Z) combinations */
+  int L1_size = 2*pwb->abs_M3+1;
+  int YLZ_size = pbi->bf_size*L1_size*pbi->bf_size;
+
+  
+  // ====================================================================================
+  // =                                 Allocate memory                                  =
+  // ====================================================================================
+
+  /* Integral over r for all (Y,offset_L1,Z) combinations, indexed as
+  integral_over_r[index_YLZ][index_l3][index_l2][index_l1-index_l1_min], with
+  index_YLZ = (Y*L1_size + offset_L1)*pbi->bf_size + Z. The values are stored
+  contiguously in an arena, which is initialised to zero as we shall accumulate
+  the integral over r */
+  long int size = 0;
+  for (int index_l3=0; index_l3 < pbi->l_size; ++index_l3)
+    for (int index_l2=0; index_l2 < pbi->l_size; ++index_l2)
+      size += YLZ_size * pbi->l_triangular_size[index_l3][index_l2];
+
+  struct arena integral_over_r_arena;
+  class_call (arena_init (&integral_over_r_arena, size, pbi->error_message),
+    pbi->error_message,
+    pbi->error_message);
+
+  pwb->count_allocated_for_integral_over_r = integral_over_r_arena.size;
+
+  double **** integral_over_r;
+  class_alloc (integral_over_r, YLZ_size*sizeof(double ***), pbi->error_message);
+
+  for (int index_YLZ=0; index_YLZ < YLZ_size; ++index_YLZ) {
+    class_alloc (integral_over_r[index_YLZ], pbi->l_size*sizeof(double **), pbi->error_message);
+    for (int index_l3=0; index_l3 < pbi->l_size; ++index_l3) {
+      class_alloc (integral_over_r[index_YLZ][index_l3], pbi->l_size*sizeof(double *), pbi->error_message);
+      class_call (arena_take_row (
+                    &integral_over_r_arena,
+                    pbi->l_size,
+                    pbi->l_triangular_size[index_l3],
+                    1,
+                    integral_over_r[index_YLZ][index_l3],
+                    pbi->error_message),
+        pbi->error_message,
+        pbi->error_message);
+    }
+  }
+
+  /* Integral over k3 for a single l3, indexed as integral_over_k3[index_r][index_k1][index_k2].
+  If the transfer functions are streamed, the integrals for all l3 were already computed by
+  bispectra2_intrinsic_stream_over_k3(), and we just point to them. */
+  double *** integral_over_k3 = NULL;
+  int index_slab = (pwb->X*ppr2->m_size + index_M3)*pwb->streamed_L3_size + offset_L3;
+
+  if (ppr2->stream_transfers == _FALSE_) {
+    class_alloc (integral_over_k3, pwb->r_size*sizeof(double **), pbi->error_message);
+    for (int index_r=0; index_r < pwb->r_size; ++index_r) {
+      class_alloc (integral_over_k3[index_r], pwb->k_smooth_size*sizeof(double *), pbi->error_message);
+      for (int index_k1=0; index_k1 < pwb->k_smooth_size; ++index_k1)
+        class_calloc (integral_over_k3[index_r][index_k1], index_k1+1, sizeof(double), pbi->error_message);
+    }
+  }
+
+  /* Find the largest number of (l2,l1) pairs for a given l3 */
+  int l2_l1_size_max = 0;
+  for (int index_l3=0; index_l3 < pbi->l_size; ++index_l3) {
+    int l2_l1_size = 0;
+    for (int index_l2=0; index_l2 < pbi->l_size; ++index_l2)
+      l2_l1_size += pbi->l_triangular_size[index_l3][index_l2];
+    l2_l1_size_max = MAX (l2_l1_size_max, l2_l1_size);
+  }
+
+  /* Thread-local arrays: INT_l2_l3(r,k1) for one (l3,r) and all (l2,k1), indexed as
+  integral_over_k2[thread][index_l2][index_k1]; contribution to the integral over r
+  for one l3 and all (Y,offset_L1,Z,l2,l1), indexed as
+  partial_integral_over_r[thread][index_YLZ*l2_l1_size_max + index_l2_l1] */
+  double *** integral_over_k2;
+  double ** partial_integral_over_r;
+  class_alloc (integral_over_k2, number_of_threads*sizeof(double **), pbi->error_message);
+  class_alloc (partial_integral_over_r, number_of_threads*sizeof(double *), pbi->error_message);
+
+  for (int thread=0; thread < number_of_threads; ++thread) {
+    class_alloc (integral_over_k2[thread], pbi->l_size*sizeof(double *), pbi->error_message);
+    for (int index_l2=0; index_l2 < pbi->l_size; ++index_l2)
+      class_alloc (integral_over_k2[thread][index_l2], pwb->k_smooth_size*sizeof(double), pbi->error_message);
+    class_alloc (partial_integral_over_r[thread], YLZ_size*l2_l1_size_max*sizeof(double), pbi->error_message);
+  }
+
+  if (pbi->bispectra_verbose > 2)
+    printf("     * allocated ~ %.3g MB for the r-integral array and ~ %.3g MB for the k-integrals\n",
+      pwb->count_allocated_for_integral_over_r*sizeof(double)/1e6,
+      (pwb->r_size*pwb->k_smooth_size*(pwb->k_smooth_size+1)/2
+      + number_of_threads*(pbi->l_size*pwb->k_smooth_size + YLZ_size*l2_l1_size_max))*sizeof(double)/1e6);
+
+  /* Position of the l2 level in the thread-local array for the integral over r */
+  int * index_l2_l1_start;
+  class_alloc (index_l2_l1_start, pbi->l_size*sizeof(int), pbi->error_message);
+
+
+
+  // ====================================================================================
+  // =                                  Cycle on l3                                     =
+  // ====================================================================================
+
+  pwb->count_memorised_for_integral_over_k3 = 0;
+  double average_k3_grid_size = 0;
+
+  for (int index_l3 = 0; index_l3 < pbi->l_size; ++index_l3) {
+
+    int l3 = pbi->l[index_l3];
+    int L3 = abs(l3-pwb->abs_M3) + offset_L3;
+
+    /* The configurations with |M3|>l3 do not contribute to the bispectrum because
+    they would violate the 3j-symbol properties, and those with L3>l3+|M3| are
+    forbidden by the triangular condition; in both cases, the integral vanishes */
+    if ((pwb->abs_M3 > l3) || (L3 > (l3+pwb->abs_M3)))
+      continue;
+
+    /* Skip the l3 values that do not appear in any requested configuration */
+    if (pwb->l3_mask[index_l3] == _FALSE_)
+      continue;
+
+    int index_L3 = pbs2->index_l1[L3];
+
+    class_test (pbs2->l1[index_L3]!=L3,
+      pbi->error_message,
+      "error in the indexing of pbs2->l1. Is the pbs2->extend_l1_using_m parameter true?");
+
+    if (pbi->bispectra_verbose > 2)
+      printf("     * computing the intrinsic bispectrum integrals for l3=%d, index_l3=%d, L3=%d\n",
+        l3, index_l3, L3);
+
+    if (ppr2->stream_transfers == _TRUE_) {
+      integral_over_k3 = pwb->streamed_integral_over_k3[index_slab][index_l3];
+    }
+    else {
+
+      /* Load the transfer functions from disk */
+      if ((ppr2->load_transfers_from_disk == _TRUE_) || (ppr2->store_transfers_to_disk == _TRUE_)) {
+        class_call (transfer2_load_transfers_from_disk (
+                      ppr2,
+                      ppt2,
+                      ptr2,
+                      index_tt2_k3 + ptr2->lm_array[index_l3][index_M3]),
+          ptr2->error_message,
+          pbi->error_message);
+      }
+
+      /* Compute the integral over k3 for all (r,k1,k2) */
+      class_call (bispectra2_intrinsic_integrate_over_k3_for_l3 (
+                    ppr,
+                    ppr2,
+                    ppt,
+                    ppt2,
+                    pbs,
+                    pbs2,
+                    ptr,
+                    ptr2,
+                    ppm,
+                    pbi,
+                    index_tt2_k3,
+                    index_M3,
+                    index_l3,
+                    index_L3,
+                    integral_over_k3,
+                    &average_k3_grid_size,
+                    pwb),
+        pbi->error_message,
+        pbi->error_message);
+
+      if ((ppr2->load_transfers_from_disk == _TRUE_) || (ppr2->store_transfers_to_disk == _TRUE_)) {
+        class_call (transfer2_free_type_level (
+                      ppt2,
+                      ptr2,
+                      index_tt2_k3 + ptr2->lm_array[index_l3][index_M3]),
+          ptr2->error_message,
+          pbi->error_message);
+      }
+    }
+
+    int l2_l1_size = 0;
+    for (int index_l2=0; index_l2 < pbi->l_size; ++index_l2) {
+      index_l2_l1_start[index_l2] = l2_l1_size;
+      l2_l1_size += pbi->l_triangular_size[index_l3][index_l2];
+    }
+
+    /* Integrate over k2 and k1 for each value of r, and accumulate the integral over r */
+    abort = _FALSE_;
+    #pragma omp parallel shared (abort) private (thread)
+    {
+
+      #ifdef _OPENMP
+      thread = omp_get_thread_num();
+      #endif
+
+      double ** I_k2 = integral_over_k2[thread];
+      double * I_r = partial_integral_over_r[thread];
+
+      for (int index=0; index < YLZ_size*l2_l1_size_max; ++index)
+        I_r[index] = 0;
+
+      #pragma omp for schedule (dynamic)
+      for (int index_r = 0; index_r < pwb->r_size; ++index_r) {
+
+        double r = pwb->r[index_r];
+
+        for (int Y=0; Y < pbi->bf_size; ++Y) {
+
+          /* Integral over k2 for all (l2,k1) */
+          for (int index_k1 = 0; index_k1 < pwb->k_smooth_size; ++index_k1) {
+
+            class_call_parallel (bispectra2_interpolate_over_k2 (
+                                   ppr,
+                                   ppr2,
+                                   ppt,
+                                   ppt2,
+                                   pbs,
+                                   pbs2,
+                                   ptr,
+                                   ptr2,
+                                   ppm,
+                                   pbi,
+                                   index_r,
+                                   index_k1,
+                                   index_l3,
+                                   integral_over_k3[index_r],
+                                   pwb->integral_splines[thread],
+                                   pwb->interpolated_integral[thread],
+                                   pwb->f[thread],
+                                   pwb),
+              pbi->error_message,
+              pbi->error_message);
+
+            for (int index_l2 = 0; index_l2 < pbi->l_size; ++index_l2) {
+
+              if (pwb->l3l2_triangle_count[index_l3][index_l2] == 0)
+                continue;
+
+              double * transfer = &(ptr->transfer [ppt->index_md_scalars]
+                                                  [((ppt->index_ic_ad * ptr->tt_size[ppt->index_md_scalars] + pbi->index_tt_of_bf[Y])
+                                                  * ptr->l_size[ppt->index_md_scalars] + index_l2) * k_tr_size]);
+
+              class_call_parallel (bessel_convolution (
+                                     ppr,
+                                     pbs,
+                                     k_tr,
+                                     pbi->delta_k,
+                                     k_tr_size,
+                                     pwb->interpolated_integral[thread],
+                                     transfer,
+                                     index_l2,
+                                     r,
+                                     &(I_k2[index_l2][index_k1]),
+                                     pbi->error_message
+                                     ),
+                pbi->error_message,
+                pbi->error_message);
+
+            } // end of for(index_l2)
+          } // end of for(index_k1)
+
+          /* Integral over k1 for all (offset_L1,Z,l2,l1). As in bispectra2_intrinsic_init(),
+          offset_L1 has to be even */
+          for (int offset_L1=0; offset_L1 < L1_size; offset_L1 += 2) {
+
+            for (int Z=0; Z < pbi->bf_size; ++Z) {
+
+              int index_YLZ = (Y*L1_size + offset_L1)*pbi->bf_size + Z;
+
+              for (int index_l2 = 0; index_l2 < pbi->l_size; ++index_l2) {
+
+                int index_l1_min = pbi->index_l_triangular_min[index_l3][index_l2];
+                int index_l1_max = pbi->index_l_triangular_max[index_l3][index_l2];
+
+                if ((index_l1_max < index_l1_min) || (pwb->l3l2_triangle_count[index_l3][index_l2] == 0))
+                  continue;
+
+                class_call_parallel (bispectra2_interpolate_over_k1 (
+                                       ppr,
+                                       ppr2,
+                                       ppt,
+                                       ppt2,
+                                       pbs,
+                                       pbs2,
+                                       ptr,
+                                       ptr2,
+                                       ppm,
+                                       pbi,
+                                       index_r,
+                                       index_l3,
+                                       index_l2,
+                                       I_k2[index_l2],
+                                       pwb->integral_splines[thread],
+                                       pwb->interpolated_integral[thread],
+                                       pwb->f[thread],
+                                       pwb),
+                  pbi->error_message,
+                  pbi->error_message);
+
+                for (int index_l1=index_l1_min; index_l1<=index_l1_max; ++index_l1) {
+
+                  /* Skip the configurations that were not requested */
+                  if (pwb->triangle_mask[pwb->triangle_start[index_l3][index_l2] + index_l1-index_l1_min] == _FALSE_)
+                    continue;
+
+                  int l1 = pbi->l[index_l1];
+                  int L1 = abs(l1-pwb->abs_M3) + offset_L1;
+
+                  /* Skip the (L1,l1,M3) configurations forbidden by the triangular condition */
+                  if (L1 > (l1+pwb->abs_M3))
+                    continue;
+
+                  int index_L1 = pbs2->index_l1[L1];
+
+                  double * transfer = &(ptr->transfer [ppt->index_md_scalars]
+                                                      [((ppt->index_ic_ad * ptr->tt_size[ppt->index_md_scalars] + pbi->index_tt_of_bf[Z])
+                                                      * ptr->l_size[ppt->index_md_scalars] + index_l1) * k_tr_size]);
+
+                  double integral_over_k1;
+
+                  class_call_parallel (bessel2_convolution (
+                                         ppr,
+                                         pbs2,
+                                         k_tr,
+                                         pbi->delta_k,
+                                         k_tr_size,
+                                         pwb->interpolated_integral[thread],
+                                         transfer,
+                                         index_L1,
+                                         r,
+                                         &integral_over_k1,
+                                         pbi->error_message
+                                         ),
+                    pbi->error_message,
+                    pbi->error_message);
+
+                  /* Trapezoidal rule for the integral over r; the factor 1/2 is included below */
+                  if (pwb->scalar_kernels == _TRUE_)
+                    I_r[index_YLZ*l2_l1_size_max + index_l2_l1_start[index_l2] + index_l1-index_l1_min]
+                      += r*r * integral_over_k1 * pwb->delta_r[index_r];
+                  else
+                    I_r[index_YLZ*l2_l1_size_max + index_l2_l1_start[index_l2] + index_l1-index_l1_min]
+                      += pwb->r_weight[index_r] * integral_over_k1;
+
+                } // end of for(index_l1)
+              } // end of for(index_l2)
+            } // end of for(Z)
+          } // end of for(offset_L1)
+        } // end of for(Y)
+
+        #pragma omp flush(abort)
+
+      } // end of for(index_r)
+
+      /* Add the contribution of this thread to the integral over r */
+      #pragma omp critical (bispectra2_intrinsic_integrate_tiled)
+      for (int index_YLZ=0; index_YLZ < YLZ_size; ++index_YLZ)
+        for (int index_l2=0; index_l2 < pbi->l_size; ++index_l2)
+          for (int index_l1=0; index_l1 < pbi->l_triangular_size[index_l3][index_l2]; ++index_l1)
+            integral_over_r[index_YLZ][index_l3][index_l2][index_l1] +=
+              0.5 * I_r[index_YLZ*l2_l1_size_max + index_l2_l1_start[index_l2] + index_l1];
+
+    } if (abort == _TRUE_) return _FAILURE_; /* end of parallel region */
+
+  } // end of for(index_l3)
+
+
+
+  // ====================================================================================
+  // =                               Deal with geometry                                 =
+  // ====================================================================================
+
+  /* Apply the geometrical factors to the integral of each (Y,offset_L1,Z) combination */
+  for (int Y=0; Y < pbi->bf_size; ++Y) {
+    for (int offset_L1=0; offset_L1 < L1_size; offset_L1 += 2) {
+      for (int Z=0; Z < pbi->bf_size; ++Z) {
+
+        pwb->Y = Y;
+        pwb->Z = Z;
+        pwb->offset_L1 = offset_L1;
+        pwb->integral_over_r = integral_over_r[(Y*L1_size + offset_L1)*pbi->bf_size + Z];
+
+        class_call (bispectra2_intrinsic_geometrical_factors (
+                      ppr,
+                      ppr2,
+                      ppt,
+                      ppt2,
+                      pbs,
+                      pbs2,
+                      ptr,
+                      ptr2,
+                      ppm,
+                      pbi,
+                      index_bt,
+                      index_M3,
+                      offset_L3,
+                      offset_L1,
+                      pwb->unsymmetrised_bispectrum[pwb->X][Y][Z], /* out */
+                      pwb),
+          pbi->error_message,
+          pbi->error_message);
+      }
+    }
+  }
+
+  pwb->integral_over_r = NULL;
+
+
+
+  // ====================================================================================
+  // =                                   Free memory                                    =
+  // ====================================================================================
+
+  for (int index_YLZ=0; index_YLZ < YLZ_size; ++index_YLZ) {
+    for (int index_l3=0; index_l3 < pbi->l_size; ++index_l3)
+      free (integral_over_r[index_YLZ][index_l3]);
+    free (integral_over_r[index_YLZ]);
+  }
+  free (integral_over_r);
+  arena_free (&integral_over_r_arena);
+
+  if (ppr2->stream_transfers == _FALSE_) {
+    for (int index_r=0; index_r < pwb->r_size; ++index_r) {
+      for (int index_k1=0; index_k1 < pwb->k_smooth_size; ++index_k1)
+        free (integral_over_k3[index_r][index_k1]);
+      free (integral_over_k3[index_r]);
+    }
+    free (integral_over_k3);
+  }
+  else {
+    class_call (bispectra2_intrinsic_free_k3_integral (
+                  pwb->streamed_integral_over_k3[index_slab],
+                  &(pwb->streamed_integral_over_k3_arena[index_slab])),
+      pbi->error_message,
+      pbi->error_message);
+    pwb->streamed_integral_over_k3[index_slab] = NULL;
+  }
+
+  for (int thread=0; thread < number_of_threads; ++thread) {
+    for (int index_l2=0; index_l2 < pbi->l_size; ++index_l2)
+      free (integral_over_k2[thread][index_l2]);
+    free (integral_over_k2[thread]);
+    free (partial_integral_over_r[thread]);
+  }
+  free (integral_over_k2);
+  free (partial_integral_over_r);
+  free (index_l2_l1_start);
 
-  /* Free the memory that was allocated for the integral over k2, but do that only when we are at
-  the last iteration of the loops on offset_L1 (which is always performed since 2*abs_M3 is always
-  even), Z and Y. */
-  if ((offset_L1 == (2*pwb->abs_M3)) && (pwb->Y == (pbi->bf_size-1)) && (pwb->Z == (pbi->bf_size-1))) {
-    for (int index_l3=0; index_l3<pbi->l_size; ++index_l3) {
-      for (int index_l2=0; index_l2<pbi->l_size; ++index_l2) {
-        for (int index_r=0; index_r < pwb->r_size; ++index_r) {      
-          free (pwb->integral_over_k2[index_l3][index_l2][index_r]);
-        } // end of for(index_r)
-        free (pwb->integral_over_k2[index_l3][index_l2]);
-      } // end of for(index_l2)
-      free (pwb->integral_over_k2[index_l3]);
-    } // end of for(index_l3)
-    free (pwb->integral_over_k2);
-  } // end of if last term in the L1, Y, Z sums
-  
   return _SUCCESS_;
+
 }
-      
 
 
 
 
-int bispectra2_intrinsic_integrate_over_r(
+
+/**
+ * Multiply the r-integral of the intrinsic bispectrum for a given (M3,offset_L3,offset_L1)
+ * by the geometrical factors (four 3j's and a 6j) appearing outside of the integral, and add
+ * the result to the unsymmetrised bispectrum.
+ *
+ * The geometrical factors depend only on the multipoles and on the parity of the bispectrum.
+ * They are computed by bispectra2_intrinsic_geometrical_table(); if ppr2->cache_geometrical_factors
+ * is _TRUE_, they are kept in pwb->geometrical_table and reused for all the fields and bispectrum
+ * types; if ppr2->geometrical_factors_cache_dir is not empty, they are also read from and written
+ * to that directory; if ppr2->kept_geometrical_factors is not NULL, they are also read from and
+ * copied to the tables kept in memory by the caller.
+ */
+
+int bispectra2_intrinsic_geometrical_factors (
     struct precision * ppr,
     struct precision2 * ppr2,
     struct perturbs * ppt,
@@ -2301,159 +4162,194 @@ int bispectra2_intrinsic_integrate_over_r(
     struct transfers2 * ptr2,
     struct primordial * ppm,
     struct bispectra * pbi,
+    int index_bt,
+    int index_M3,
+    int offset_L3,
+    int offset_L1,
+    double *** result, /* out */
     struct bispectra_workspace_intrinsic * pwb
     )
 {
-  
-  // ==========================================================================================================
-  // =                                    Allocate memory for INT_l1_l2_l3(r)                                 =
-  // ==========================================================================================================
-  
-  /* We shall allocate the array pwb->integral_over_r[index_l3][index_l2][index_l1-index_l_triangular_min]
-  so that the l1 level is the one satisfying the triangular inequality. 
-  pwb->integral_over_r is recycled by the different iterations in the L1 loop and in the Z-field loop, hence
-  we allocate it only at the first iteration (offset_L1==0 and pwb->Z==0) */
 
-  if ((pwb->offset_L1 == 0) && (pwb->Y == 0) && (pwb->Z == 0)) {
-  
-    /* Initialize counter */
-    pwb->count_allocated_for_integral_over_r = 0;
-  
-    /* Allocate l3-level */
-    class_alloc (pwb->integral_over_r, pbi->l_size*sizeof(double **), pbi->error_message);
+  int abs_M3 = pwb->abs_M3;
 
-    for (int index_l3=0; index_l3<pbi->l_size; ++index_l3) {
+  // =======================================================================
+  // =                      Obtain geometrical factors                     =
+  // =======================================================================
 
-      /* Allocate l2-level */
-      class_alloc (pwb->integral_over_r[index_l3], pbi->l_size*sizeof(double *), pbi->error_message);
+  int index_parity = (pwb->bispectrum_parity == _EVEN_ ? 0 : 1);
+  double ** table = &(pwb->geometrical_table[index_parity][index_M3][offset_L3][offset_L1]);
 
-      for (int index_l2=0; index_l2<pbi->l_size; ++index_l2) {
+  /* Compute the geometrical factors, unless we have already done so for a previous
+  field or bispectrum type */
+  if (*table == NULL) {
 
-        /* Allocate l1-level */
-        int l1_size = pbi->l_triangular_size[index_l3][index_l2];
-        class_alloc (pwb->integral_over_r[index_l3][index_l2], l1_size*sizeof(double), pbi->error_message);
+    class_calloc (*table, pwb->triangle_size, sizeof(double), pbi->error_message);
 
-        /* Increase memory counter, excluding non-physical configurations where |M3|>l3 */
-        if (pwb->abs_M3 <= pbi->l[index_l3])
-          pwb->count_allocated_for_integral_over_r += l1_size;
+    short found = _FALSE_;
 
-      } // end of for(index_l2)
-    } // end of for(index_l3)
+    /* Look first among the tables kept in memory by a previous run, then in the cache directory */
+    if (ppr2->kept_geometrical_factors != NULL)
+      class_call (bispectra2_geometrical_table_recall (
+                    ppr2,
+                    pbi,
+                    index_M3,
+                    offset_L3,
+                    offset_L1,
+                    *table,
+                    &found,
+                    pwb),
+        pbi->error_message,
+        pbi->error_message);
 
-    if (pbi->bispectra_verbose > 2)
-      printf(" -> allocated ~ %.3g MB (%ld doubles) for the r-integral array\n",
-        pwb->count_allocated_for_integral_over_r*sizeof(double)/1e6, pwb->count_allocated_for_integral_over_r);
+    short is_kept = found;
+
+    if ((found == _FALSE_) && (strlen (ppr2->geometrical_factors_cache_dir) > 0)) {
+      class_call (bispectra2_geometrical_table_load (
+                    ppr2,
+                    pbi,
+                    index_M3,
+                    offset_L3,
+                    offset_L1,
+                    *table,
+                    &found,
+                    pwb),
+        pbi->error_message,
+        pbi->error_message);
+    }
 
-  } // end of if(offset_L1==0 and pwb->Z == 0)
-  
-  
-  // ==========================================================================================================
-  // =                                    Compute  INT_l1_l2_l3(r)  integral                                  =
-  // ==========================================================================================================
-  
-  /* We now proceed to the to integrate I(l3,l2,l1,r) over r. The function also multiplies
-  the result by the appropriate coefficients.  */
-    
-  /* We parallelize the outer loop over 'l3'. */
-  int abort = _FALSE_;
-  #pragma omp parallel shared (ppt,ppt2,pbs,ptr,ptr2,ppm,pbi,pwb,abort)
-  {
-  
-    #pragma omp for schedule (dynamic)
-    for (int index_l3 = 0; index_l3 < pbi->l_size; ++index_l3) {
-  
-      /* The configurations with |M3|>l3 do not contribute to the bispectrum because
-      they would violate the 3j-symbol properties */
-      if (pwb->abs_M3 > pbi->l[index_l3])
-        continue;
-  
-      if (pbi->bispectra_verbose > 2)
-        printf("     * computing the r-integral for l3=%d, index_l3=%d\n", pbi->l[index_l3], index_l3);
-  
-      /* We compute the integral over k2 for all possible l3-values */
-      for (int index_l2 = 0; index_l2 < pbi->l_size; ++index_l2) {
-  
-        /* Determine the limits for l1, which come from the triangular inequality |l2-l3| <= l1 <= l2+l3 */
-        int index_l1_min = pbi->index_l_triangular_min[index_l3][index_l2];
-        int index_l1_max = pbi->index_l_triangular_max[index_l3][index_l2];
-  
-        for (int index_l1=index_l1_min; index_l1<=index_l1_max; ++index_l1) {  
+    if (found == _FALSE_) {
 
-          if (pbi->bispectra_verbose > 4)
-            printf("     * now considering (index_l3,index_l2,index_l1) = (%d,%d,%d)\n", index_l3, index_l2, index_l1);
-        
-          /* Shortcut to the main part of the integrand function */
-          double * I = pwb->integral_over_k1[index_l3][index_l2][index_l1-index_l1_min];
-          double integral = 0;
-  
-          for (int index_r = 0; index_r < pwb->r_size; ++index_r) {
-      
-            double r = pwb->r[index_r];
-            double integrand = r*r * I[index_r];
+      class_call (bispectra2_intrinsic_geometrical_table (
+                    ppr,
+                    ppr2,
+                    ppt,
+                    ppt2,
+                    pbs,
+                    pbs2,
+                    ptr,
+                    ptr2,
+                    ppm,
+                    pbi,
+                    index_M3,
+                    offset_L3,
+                    offset_L1,
+                    *table,
+                    pwb),
+        pbi->error_message,
+        pbi->error_message);
+
+      /* When only some configurations are requested, the table is only partially
+      computed and cannot be reused by other runs */
+      if ((strlen (ppr2->geometrical_factors_cache_dir) > 0) && (ppr2->bispectrum_triangles == all_triangles)) {
+        class_call (bispectra2_geometrical_table_store (
+                      ppr2,
+                      pbi,
+                      index_M3,
+                      offset_L3,
+                      offset_L1,
+                      *table,
+                      pwb),
+          pbi->error_message,
+          pbi->error_message);
+      }
+    }
+
+    /* Keep a copy of the table for the next runs in the same process */
+    if ((ppr2->kept_geometrical_factors != NULL) && (is_kept == _FALSE_)
+      && (ppr2->bispectrum_triangles == all_triangles))
+      class_call (bispectra2_geometrical_table_keep (
+                    ppr2,
+                    pbi,
+                    index_M3,
+                    offset_L3,
+                    offset_L1,
+                    *table,
+                    pwb),
+        pbi->error_message,
+        pbi->error_message);
+  }
+
+
+  // ==========================================================================
+  // =                        Increment the bispectrum                        =
+  // ==========================================================================
+
+  #pragma omp parallel for schedule (dynamic,1)
+  for (int index_pair=0; index_pair < pwb->l3l2_pair_size; ++index_pair) {
+
+    int index_l3 = pwb->l3l2_pairs[index_pair].index_l3;
+    int index_l2 = pwb->l3l2_pairs[index_pair].index_l2;
+
+    int l3 = pbi->l[index_l3];
+    int L3 = abs(l3-abs_M3) + offset_L3;
+
+    /* Skip the configurations that do not contribute to the bispectrum, as in
+    bispectra2_intrinsic_geometrical_table() */
+    if ((L3 > (l3+abs_M3)) || (abs_M3 > l3))
+      continue;
+
+    int index_l1_min = pbi->index_l_triangular_min[index_l3][index_l2];
+    int index_l1_max = pbi->index_l_triangular_max[index_l3][index_l2];
+
+    double * factor = *table + pwb->triangle_start[index_l3][index_l2];
+
+    for (int index_l1=index_l1_min; index_l1<=index_l1_max; ++index_l1) {
+
+      /* Four-dimensional integral */
+      double integral = pwb->integral_over_r[index_l3][index_l2][index_l1-index_l1_min];
+
+      /* We treat m=0 as a special case because in this way we can define the reduced
+      bispectrum for m=0 also when l1+l2+l3 is odd. We cannot do this for the m>0 cases
+      because there we have to numerically divide the bispectrum formula by the 3j-symbol
+      (l1,l2,l3)(0,0,0) rather than extracting it analitically */
+      /* TODO: the m_max check here should be removed. We want a unique way to define the
+      reduced bispectrum regardless of the m */
+      if ((pwb->bispectrum_parity == _EVEN_) && (ppr2->m_max_song == 0))
+        result[index_l3][index_l2][index_l1-index_l1_min] = 8/_PI_CUBE_ * integral;
+
+      /* Add the contribution from (l1,l2,l3,M3,L3,L1) to the bispectrum */
+      else
+        result[index_l3][index_l2][index_l1-index_l1_min] += factor[index_l1-index_l1_min] * integral;
+
+    } // end of for(index_l1)
+  } // end of for(index_pair)
+
+  /* If we are not caching the geometrical factors, free them */
+  if (ppr2->cache_geometrical_factors == _FALSE_) {
+    free (*table);
+    *table = NULL;
+  }
+
+  /* We can free the memory that was allocated for the integral over r, as it is no longer needed.
+  When the integrals are tiled, the array is owned by bispectra2_intrinsic_integrate_tiled() */
+  if ((offset_L1 == (2*pwb->abs_M3)) && (pwb->Y == (pbi->bf_size-1)) && (pwb->Z == (pbi->bf_size-1))
+    && (ppr2->tile_intrinsic_bispectrum == _FALSE_)) {
+    for (int index_l3 = 0; index_l3 < pbi->l_size; ++index_l3)
+      free (pwb->integral_over_r[index_l3]);
+    free (pwb->integral_over_r);
+    arena_free (&(pwb->integral_over_r_arena));
+  } // end of last term in the L1 loop
+
+  return _SUCCESS_;
 
-            if (integrand == 0.)
-              continue;
-      
-            /* Increment the estimate of the integral */
-            integral += integrand * pwb->delta_r[index_r];
-    
-            /* Some debug - output intermediate results on stderr for a custom (l2,l3,l1) configuration */
-            // int index_l3 = pbi->l[index_l3];
-            // int index_l2 = pbi->l[index_l2];
-            // int index_l1 = pbi->l[index_l1];
-            // if ( (l3==100) && (l2==200) && (l1==300) ) {
-            //   if (index_r==0) {
-            //     fprintf(stderr, "##########    l3 = %d, l2 = %d, l1 = %d, n_rows = %d    ##########\n\n",
-            //       l3, l2, l1, r, pwb->r_size);
-            //     fprintf(stderr, "%12s %17s %17s %17s\n", "r", "r^2*I_l2_l3_l1(r)", "integral","delta_r");
-            //   }
-            //   else {
-            //     fprintf(stderr, "%12.7g %17.7g %17.7g %17.7g\n", r, integrand, integral, pwb->delta_r[index_r]);
-            //   }
-            // }
-   
-          } // end of for(index_r)
-  
-  
-          /* Fill the result array and include the factor 1/2 from trapezoidal rule */
-          pwb->integral_over_r[index_l3][index_l2][index_l1-index_l1_min] = 0.5 * integral;
-  
-          /* Some debug - output the integral as a function of r on stderr for a custom (l2,l3,l1) */
-          // if ( (l2==l3) && (l3==l1) ) {
-          //   fprintf(stderr, "%12d %17.7g\n", l2, pwb->integral_over_r[index_l3][index_l2][index_l1-index_l1_min]);
-          // }
-            
-        } // end of for(index_l1)
-      } // end of for(index_l2)
-      
-      #pragma omp flush(abort)
-      
-    } // end of for(index_l3)
-  } if (abort == _TRUE_) return _FAILURE_;  // end of parallel region
-  
-  /* We can free the memory that was allocated for the integral over k1, as it is no longer needed */
-  if ((pwb->offset_L1 == (2*pwb->abs_M3)) && (pwb->Y == (pbi->bf_size-1)) && (pwb->Z == (pbi->bf_size-1))) {
-    for (int index_l3 = 0; index_l3 < pbi->l_size; ++index_l3) {
-      for (int index_l2 = 0; index_l2 < pbi->l_size; ++index_l2) {
-        int index_l1_min = pbi->index_l_triangular_min[index_l3][index_l2];
-        int index_l1_max = pbi->index_l_triangular_max[index_l3][index_l2];
-        for (int index_l1=index_l1_min; index_l1<=index_l1_max; ++index_l1) {  
-          free (pwb->integral_over_k1[index_l3][index_l2][index_l1-index_l1_min]);
-        } // end of for(index_l1)
-        free (pwb->integral_over_k1[index_l3][index_l2]);
-      } // end of for(index_l3)
-      free (pwb->integral_over_k1[index_l3]);
-    } // end of for(index_l2)
-    free (pwb->integral_over_k1);
-  } // end of last term in the L1 and loop
-  
-  return _SUCCESS_; 
 }
 
 
 
 
-int bispectra2_intrinsic_geometrical_factors (
+/**
+ * Compute the geometrical factors of the intrinsic bispectrum for a given
+ * (M3,offset_L3,offset_L1) and for all (l1,l2,l3).
+ *
+ * The geometrical factors are the product of four 3j-symbols and one 6j-symbol,
+ * times the prefactor of the reduced bispectrum and the alternating sign; they
+ * do not depend on the fields (T,E,...) nor on cosmology. The result is stored in
+ * table[pwb->triangle_start[index_l3][index_l2] + index_l1-index_l1_min]; the
+ * configurations that do not contribute to the bispectrum are set to zero.
+ */
+
+int bispectra2_intrinsic_geometrical_table (
     struct precision * ppr,
     struct precision2 * ppr2,
     struct perturbs * ppt,
@@ -2464,11 +4360,10 @@ int bispectra2_intrinsic_geometrical_factors (
     struct transfers2 * ptr2,
     struct primordial * ppm,
     struct bispectra * pbi,
-    int index_bt,
     int index_M3,
     int offset_L3,
     int offset_L1,
-    double *** result, /* out */
+    double * table, /* out */
     struct bispectra_workspace_intrinsic * pwb
     )
 {
@@ -2517,15 +4412,20 @@ int bispectra2_intrinsic_geometrical_factors (
   }
 
   // ========================================================================
-  // =                              Cycle on l3                             =
+  // =                          Cycle on (l3,l2) pairs                      =
   // ========================================================================
 
-  #pragma omp parallel for private (thread)  
-  for (int index_l3=0; index_l3 < pbi->l_size; ++index_l3) {
+  /* We distribute between the threads the (l3,l2) pairs rather than the l3 values,
+  starting from the most expensive ones; see bispectra2_l3l2_queue() */
+  #pragma omp parallel for private (thread) schedule (dynamic,1)
+  for (int index_pair=0; index_pair < pwb->l3l2_pair_size; ++index_pair) {
 
     #ifdef _OPENMP
     thread = omp_get_thread_num();
     #endif
+
+    int index_l3 = pwb->l3l2_pairs[index_pair].index_l3;
+    int index_l2 = pwb->l3l2_pairs[index_pair].index_l2;
   
     int l3 = pbi->l[index_l3];
     int L3 = abs(l3-abs_M3) + offset_L3;
@@ -2588,423 +4488,569 @@ int bispectra2_intrinsic_geometrical_factors (
     } // end of if(M3!=0)
   
     // =========================================================================
-    // =                             Cycle on l2                             =
+    // =                           Consider l2                               =
     // =========================================================================
-    for (int index_l2=0; index_l2 < pbi->l_size; ++index_l2) {
+    int l2 = pbi->l[index_l2];
+          
+    /* Compute the three-j symbol (l1,l2,l3)(0,0,0) for all allowed values of l1.
+    If we are dealing with an odd bispectrum, compute (l1,l2,l3)(2,0,-2) instead */      
+    int F = ((pwb->bispectrum_parity == _EVEN_) ? 0:2);
+    
+    class_call_parallel (drc3jj (
+                           l2, l3, F, -F,
+                           &min_D, &max_D,
+                           value[thread][l1_l2_l3],
+                           (2*pbi->l_max+1),
+                           pbi->error_message       
+                           ),
+      pbi->error_message,
+      pbi->error_message);
+    
+    min[thread][l1_l2_l3] = (int)(min_D + _EPS_);
+    max[thread][l1_l2_l3] = (int)(max_D + _EPS_);
+    size[thread][l1_l2_l3] = max[thread][l1_l2_l3] - min[thread][l1_l2_l3] + 1;
+
+    /* Compute the three-j symbol (L1,l2,L3)(0,0,0) for all allowed values of L1 */
+    class_call_parallel (drc3jj (
+                           l2, L3, 0, 0,
+                           &min_D, &max_D,
+                           value[thread][L1_l2_L3],
+                           (2*pbi->l_max+1),
+                           pbi->error_message       
+                           ),
+      pbi->error_message,
+      pbi->error_message);
+    
+    min[thread][L1_l2_L3] = (int)(min_D + _EPS_);
+    max[thread][L1_l2_L3] = (int)(max_D + _EPS_);
+    size[thread][L1_l2_L3] = max[thread][L1_l2_L3] - min[thread][L1_l2_L3] + 1;
+    
+    /* Allowed values of l1 */
+    int index_l1_min = pbi->index_l_triangular_min[index_l3][index_l2];
+    int index_l1_max = pbi->index_l_triangular_max[index_l3][index_l2];
+
+    // =========================================================================
+    // =                             Cycle on l1                             =
+    // =========================================================================
+    for (int index_l1=index_l1_min; index_l1<=index_l1_max; ++index_l1) {
+
+      int l1 = pbi->l[index_l1];
+      int L1 = abs(l1-abs_M3) + offset_L1;
+          
+      /* Skip the (L1,l1,M3) configurations forbidden by the triangular condition */
+      if (L1 > (l1+abs_M3))
+        continue;
+
+      /* Getting paranoid about those offset indices... */
+      class_test_parallel ((!is_triangular_int(l1,L1,abs_M3)) || (!is_triangular_int(l3,L3,abs_M3)),
+        pbi->error_message,
+        "error with either offset_L1 or offset_L3 loop indexing");
+    
+      /* Enforce the triangular condition given by the (L1,l2,L3)(0,0,0) 3j-symbol. In terms of
+      offset_L1 and offset_L3, the constraints excludes the cases when their difference is large
+      with respect to l2. Note that there is no need to enforce the four triangular conditions
+      arising from the 6j symbol, as they are the same as those for the 3j's. */
+      if (!is_triangular_int(L1,l2,L3))
+        continue;
+
+      /* For an even/odd, the only non-vanishing contributions come from even/odd l1+l2+l3  */
+      short is_even_configuration = ((l1+l2+l3)%2==0);
+
+      /* Value of l1_l2_l3 in L1 */
+      class_test_parallel ((l1 - min[thread][l1_l2_l3]) >= size[thread][l1_l2_l3],
+        pbi->error_message,
+        "error in the computation of the three-j symbol l1_l2_l3");
+      
+      double FACTOR_l1_l2_l3 = value[thread][l1_l2_l3][l1 - min[thread][l1_l2_l3]];
+      
+      /* Debug l1_l2_l3 */
+      // printf ("L1=%d,L2=%d,M3=%d: I(l1,l2,l3)(%d,0,%d) = (%d,%d,%d)(%d,0,%d) = %g\n",
+      //   L1, L3, M3, F, -F, l1, l2, l3, F, -F, FACTOR_l1_l2_l3);
+      
+      /* The reduced bispectrum is given by the angle averaged bispectrum divided by FACTOR_l1_l2_l3.
+      Here we make sure that FACTOR_l1_l2_l3 is not zero. We do not worry if it is zero for even 
+      bispectra and odd l1+l2+l3, because in that case it must vanish and we cannot define a
+      reduced bispectrum. */
+      if (!((pwb->bispectrum_parity == _EVEN_) && (is_even_configuration==_FALSE_)))
+        class_test_parallel (fabs(FACTOR_l1_l2_l3) < _MINUSCULE_,
+          pbi->error_message,
+          "possibility of having nans, caution! (l1,l2,l3)=(%d,%d,%d), F=%d, 3J=%g",
+          l1, l2, l3, F, FACTOR_l1_l2_l3);
+
+      /* Value of L1_l2_L3 in L1 */
+      class_test_parallel ((L1 - min[thread][L1_l2_L3]) >= size[thread][L1_l2_L3],
+        pbi->error_message,
+        "error in the computation of the three-j symbol L1_l2_L3 (L1=%d, min=%d, size=%d)",
+        L1, min[thread][L1_l2_L3], size[thread][L1_l2_L3]);
       
-      int l2 = pbi->l[index_l2];
-            
-      /* Compute the three-j symbol (l1,l2,l3)(0,0,0) for all allowed values of l1.
-      If we are dealing with an odd bispectrum, compute (l1,l2,l3)(2,0,-2) instead */      
-      int F = ((pwb->bispectrum_parity == _EVEN_) ? 0:2);
+      double FACTOR_L1_l2_L3 = value[thread][L1_l2_L3][L1 - min[thread][L1_l2_L3]];
       
+      /* Debug (L1,l2,L3)(0,0,0) */
+      // if (offset_L1 == 4)
+      //   printf ("I(L1,l2,L3)(0,0,0) = (%d,%d,%d)(0,0,0) = %g\n",
+      //       L1, l2, L3, FACTOR_L1_l2_L3);
+
+      /* EXPERIMENTAL: Uncomment to use analytic formula for the threej ratio instead */
+      // class_test_parallel ((L1-l1)%2!=0, pbi->error_message, "offset not even!");
+      //
+      // class_call_parallel (threej_ratio_L (
+      //               l1, l2, l3,
+      //               (L1-l1)/2, 0, (L3-l3)/2,
+      //               &FACTOR_L1_l2_L3,
+      //               pbi->error_message),
+      //   pbi->error_message,
+      //   pbi->error_message);
+      //
+      // FACTOR_l1_l2_l3 = 1;        
+
+      /* Compute the three-j symbol (l1,L1,M3)(0,0,0) for all allowed values of L1 */
       class_call_parallel (drc3jj (
-                             l2, l3, F, -F,
+                             l1, abs_M3, 0, 0,
                              &min_D, &max_D,
-                             value[thread][l1_l2_l3],
+                             value[thread][l1_L1_M3],
                              (2*pbi->l_max+1),
                              pbi->error_message       
                              ),
         pbi->error_message,
-        pbi->error_message);
+        pbi->error_message);        
       
-      min[thread][l1_l2_l3] = (int)(min_D + _EPS_);
-      max[thread][l1_l2_l3] = (int)(max_D + _EPS_);
-      size[thread][l1_l2_l3] = max[thread][l1_l2_l3] - min[thread][l1_l2_l3] + 1;
+      min[thread][l1_L1_M3] = (int)(min_D + _EPS_);
+      max[thread][l1_L1_M3] = (int)(max_D + _EPS_);
+      size[thread][l1_L1_M3] = max[thread][l1_L1_M3] - min[thread][l1_L1_M3] + 1;
+      
+      /* Value of l1_L1_M3 in L1 */
+      class_test_parallel ((L1 - min[thread][l1_L1_M3]) >= size[thread][l1_L1_M3],
+        pbi->error_message,
+        "error in the computation of the three-j symbol l1_L1_M3");
+        
+      double FACTOR_l1_L1_M3 = value[thread][l1_L1_M3][L1 - min[thread][l1_L1_M3]];
 
-      /* Compute the three-j symbol (L1,l2,L3)(0,0,0) for all allowed values of L1 */
-      class_call_parallel (drc3jj (
-                             l2, L3, 0, 0,
+      /* Debug (l1,L1,M3)(0,0,0) */
+      // printf ("I(l1,L1,M3)(0,0,0) = (%d,%d,%d)(0,0,0) = %g\n",
+      //   l1, L1, abs_M3, FACTOR_l1_L1_M3);
+
+      /* Compute the six-j symbol {l1,l3,l2}{L3,L1,|M3|} for all allowed values of L1. In order to fit
+      it in the Slatec function, we recast it as {L1,L3,l2}{l3,l1,|M3|} */
+      class_call_parallel (drc6j (
+                             /*L1,*/ L3, l2, l3, l1, abs_M3,
                              &min_D, &max_D,
-                             value[thread][L1_l2_L3],
+                             value[thread][l1_l3_l2_L3_L1_M3],
                              (2*pbi->l_max+1),
                              pbi->error_message       
                              ),
         pbi->error_message,
         pbi->error_message);
+
+      min[thread][l1_l3_l2_L3_L1_M3] = (int)(min_D + _EPS_);
+      max[thread][l1_l3_l2_L3_L1_M3] = (int)(max_D + _EPS_);
+      size[thread][l1_l3_l2_L3_L1_M3] = max[thread][l1_l3_l2_L3_L1_M3] - min[thread][l1_l3_l2_L3_L1_M3] + 1;
+
+      /* Value of {l1,l3,l2}{L3,L1,|M3|} in L1 */
+      class_test_parallel ((L1 - min[thread][l1_l3_l2_L3_L1_M3]) >= size[thread][l1_l3_l2_L3_L1_M3],
+        pbi->error_message,
+        "error in the computation of the three-j symbol l1_l3_l2_L3_L1_M3");
       
-      min[thread][L1_l2_L3] = (int)(min_D + _EPS_);
-      max[thread][L1_l2_L3] = (int)(max_D + _EPS_);
-      size[thread][L1_l2_L3] = max[thread][L1_l2_L3] - min[thread][L1_l2_L3] + 1;
+      double FACTOR_l1_l3_l2_L3_L1_M3 =
+        value[thread][l1_l3_l2_L3_L1_M3][L1 - min[thread][l1_l3_l2_L3_L1_M3]];
+
+      /* Debug {l1,l3,l2}{L3,L1,|M3|} */
+      // if (offset_L3 == 2)
+      //   if (offset_L1 == 2)
+      //     printf ("I{l1,l3,l2}{L3,L1,|M3|} = {%d,%d,%d}{%d,%d,%d} = %g\n",
+      //       l1, l3, l2, L3, L1, abs_M3, FACTOR_l1_l3_l2_L3_L1_M3);
+
+      // ==========================================================================
+      // =                        Increment the bispectrum                        =
+      // ==========================================================================
+
+      /* Prefactor for the reduced bispectrum. This already has a factor
+      sqrt((2l1+1.)*(2l2+1.)*(2l3+1.)/(4*_PI_)) taken out, and it
+      is multiplied by (2*l1+1)*(2*l2+1)*(2*l3+1) with respect
+      to the one in Christian's notes because in Song the transfer functions
+      are the Legendre ones. */
+      double prefactor;
       
-      /* Allowed values of l1 */
-      int index_l1_min = pbi->index_l_triangular_min[index_l3][index_l2];
-      int index_l1_max = pbi->index_l_triangular_max[index_l3][index_l2];
-  
-      // =========================================================================
-      // =                             Cycle on l1                             =
-      // =========================================================================
-      for (int index_l1=index_l1_min; index_l1<=index_l1_max; ++index_l1) {
-  
-        int l1 = pbi->l[index_l1];
-        int L1 = abs(l1-abs_M3) + offset_L1;
-            
-        /* Skip the (L1,l1,M3) configurations forbidden by the triangular condition */
-        if (L1 > (l1+abs_M3))
-          continue;
-
-        /* Getting paranoid about those offset indices... */
-        class_test_parallel ((!is_triangular_int(l1,L1,abs_M3)) || (!is_triangular_int(l3,L3,abs_M3)),
-          pbi->error_message,
-          "error with either offset_L1 or offset_L3 loop indexing");
+      if (pwb->bispectrum_parity == _EVEN_) {
+        prefactor = 8/_PI_CUBE_ * (2*L1+1.) * (2*L3+1.);
+      }
+      else {
+        /* The last line is the P_l -> Y_lm factor, without 2*l3+1 */
+        prefactor = - 0.5 / (4*_PI_FOURTH_) * (2*L1+1.) * (2*L3+1.) * (2*l1+1) * (2*l2+1);
+      }
       
-        /* Enforce the triangular condition given by the (L1,l2,L3)(0,0,0) 3j-symbol. In terms of
-        offset_L1 and offset_L3, the constraints excludes the cases when their difference is large
-        with respect to l2. Note that there is no need to enforce the four triangular conditions
-        arising from the 6j symbol, as they are the same as those for the 3j's. */
-        if (!is_triangular_int(L1,l2,L3))
-          continue;
-
-        /* For an even/odd, the only non-vanishing contributions come from even/odd l1+l2+l3  */
-        short is_even_configuration = ((l1+l2+l3)%2==0);
-
-        /* Value of l1_l2_l3 in L1 */
-        class_test_parallel ((l1 - min[thread][l1_l2_l3]) >= size[thread][l1_l2_l3],
-          pbi->error_message,
-          "error in the computation of the three-j symbol l1_l2_l3");
-        
-        double FACTOR_l1_l2_l3 = value[thread][l1_l2_l3][l1 - min[thread][l1_l2_l3]];
-        
-        /* Debug l1_l2_l3 */
-        // printf ("L1=%d,L2=%d,M3=%d: I(l1,l2,l3)(%d,0,%d) = (%d,%d,%d)(%d,0,%d) = %g\n",
-        //   L1, L3, M3, F, -F, l1, l2, l3, F, -F, FACTOR_l1_l2_l3);
-        
-        /* The reduced bispectrum is given by the angle averaged bispectrum divided by FACTOR_l1_l2_l3.
-        Here we make sure that FACTOR_l1_l2_l3 is not zero. We do not worry if it is zero for even 
-        bispectra and odd l1+l2+l3, because in that case it must vanish and we cannot define a
-        reduced bispectrum. */
-        if (!((pwb->bispectrum_parity == _EVEN_) && (is_even_configuration==_FALSE_)))
-          class_test_parallel (fabs(FACTOR_l1_l2_l3) < _MINUSCULE_,
-            pbi->error_message,
-            "possibility of having nans, caution! (l1,l2,l3)=(%d,%d,%d), F=%d, 3J=%g",
-            l1, l2, l3, F, FACTOR_l1_l2_l3);
+      /* Product of all the geometrical factors */
+      double geometry = SUMMED_FACTOR_l3_L3_M3 * FACTOR_l1_L1_M3 * FACTOR_L1_l2_L3 * FACTOR_l1_l3_l2_L3_L1_M3;
 
-        /* Value of L1_l2_L3 in L1 */
-        class_test_parallel ((L1 - min[thread][L1_l2_L3]) >= size[thread][L1_l2_L3],
+      /* Check parity for T and E-modes */
+      if (pwb->bispectrum_parity == _EVEN_) {
+        class_test_parallel ((!is_even_configuration) && (fabs(geometry)>_MINUSCULE_),
           pbi->error_message,
-          "error in the computation of the three-j symbol L1_l2_L3 (L1=%d, min=%d, size=%d)",
-          L1, min[thread][L1_l2_L3], size[thread][L1_l2_L3]);
-        
-        double FACTOR_L1_l2_L3 = value[thread][L1_l2_L3][L1 - min[thread][L1_l2_L3]];
-        
-        /* Debug (L1,l2,L3)(0,0,0) */
-        // if (offset_L1 == 4)
-        //   printf ("I(L1,l2,L3)(0,0,0) = (%d,%d,%d)(0,0,0) = %g\n",
-        //       L1, l2, L3, FACTOR_L1_l2_L3);
-
-        /* EXPERIMENTAL: Uncomment to use analytic formula for the threej ratio instead */
-        // class_test_parallel ((L1-l1)%2!=0, pbi->error_message, "offset not even!");
-        //
-        // class_call_parallel (threej_ratio_L (
-        //               l1, l2, l3,
-        //               (L1-l1)/2, 0, (L3-l3)/2,
-        //               &FACTOR_L1_l2_L3,
-        //               pbi->error_message),
-        //   pbi->error_message,
-        //   pbi->error_message);
-        //
-        // FACTOR_l1_l2_l3 = 1;        
-
-        /* Compute the three-j symbol (l1,L1,M3)(0,0,0) for all allowed values of L1 */
-        class_call_parallel (drc3jj (
-                               l1, abs_M3, 0, 0,
-                               &min_D, &max_D,
-                               value[thread][l1_L1_M3],
-                               (2*pbi->l_max+1),
-                               pbi->error_message       
-                               ),
+          "geometry does not respect parity: G_%d_%d_%d=%g! Possible bug in the sum of 3js and 6js.",
+          l1, l2, l3, geometry);
+      }
+      else {
+        /* Check parity for B-modes */
+        class_test_parallel ((is_even_configuration) && (fabs(geometry)>_MINUSCULE_),
           pbi->error_message,
-          pbi->error_message);        
+          "geometry does not respect parity: G_%d_%d_%d=%g! Possible bug in the sum of 3js and 6js.",
+          l1, l2, l3, geometry);
+      }
+
+      /* Divide by the 3j symbol (l1,l2,l3)(0,0,0) in order to obtain the reduced bispectrum. Note that
+      for odd values of l1+l2+l3, the ratio will give a nan, so in that case we leave the geometry
+      factor as it is; this is is not an issue because for odd l1+l2+l3, the geometry factor vanishes.
+      For an odd bispectrum, divide by (l1,l2,l3)(-2,0,2), which is different from zero both for 
+      odd and even l1+l2+l3. */
+      if (pwb->bispectrum_parity == _EVEN_) {
+        if (is_even_configuration) 
+          geometry /= FACTOR_l1_l2_l3;
+      }
+      /* DISABLED: we don't need to take the (l1 l2 l3)(2 0 -2) explicitly */
+      // else
+      //   geometry *= FACTOR_l1_l2_l3;
         
-        min[thread][l1_L1_M3] = (int)(min_D + _EPS_);
-        max[thread][l1_L1_M3] = (int)(max_D + _EPS_);
-        size[thread][l1_L1_M3] = max[thread][l1_L1_M3] - min[thread][l1_L1_M3] + 1;
-        
-        /* Value of l1_L1_M3 in L1 */
-        class_test_parallel ((L1 - min[thread][l1_L1_M3]) >= size[thread][l1_L1_M3],
-          pbi->error_message,
-          "error in the computation of the three-j symbol l1_L1_M3");
-          
-        double FACTOR_l1_L1_M3 = value[thread][l1_L1_M3][L1 - min[thread][l1_L1_M3]];
-
-        /* Debug (l1,L1,M3)(0,0,0) */
-        // printf ("I(l1,L1,M3)(0,0,0) = (%d,%d,%d)(0,0,0) = %g\n",
-        //   l1, L1, abs_M3, FACTOR_l1_L1_M3);
-
-        /* Compute the six-j symbol {l1,l3,l2}{L3,L1,|M3|} for all allowed values of L1. In order to fit
-        it in the Slatec function, we recast it as {L1,L3,l2}{l3,l1,|M3|} */
-        class_call_parallel (drc6j (
-                               /*L1,*/ L3, l2, l3, l1, abs_M3,
-                               &min_D, &max_D,
-                               value[thread][l1_l3_l2_L3_L1_M3],
-                               (2*pbi->l_max+1),
-                               pbi->error_message       
-                               ),
-          pbi->error_message,
-          pbi->error_message);
 
-        min[thread][l1_l3_l2_L3_L1_M3] = (int)(min_D + _EPS_);
-        max[thread][l1_l3_l2_L3_L1_M3] = (int)(max_D + _EPS_);
-        size[thread][l1_l3_l2_L3_L1_M3] = max[thread][l1_l3_l2_L3_L1_M3] - min[thread][l1_l3_l2_L3_L1_M3] + 1;
 
-        /* Value of {l1,l3,l2}{L3,L1,|M3|} in L1 */
-        class_test_parallel ((L1 - min[thread][l1_l3_l2_L3_L1_M3]) >= size[thread][l1_l3_l2_L3_L1_M3],
-          pbi->error_message,
-          "error in the computation of the three-j symbol l1_l3_l2_L3_L1_M3");
-        
-        double FACTOR_l1_l3_l2_L3_L1_M3 =
-          value[thread][l1_l3_l2_L3_L1_M3][L1 - min[thread][l1_l3_l2_L3_L1_M3]];
-
-        /* Debug {l1,l3,l2}{L3,L1,|M3|} */
-        // if (offset_L3 == 2)
-        //   if (offset_L1 == 2)
-        //     printf ("I{l1,l3,l2}{L3,L1,|M3|} = {%d,%d,%d}{%d,%d,%d} = %g\n",
-        //       l1, l3, l2, L3, L1, abs_M3, FACTOR_l1_l3_l2_L3_L1_M3);
-
-        // ==========================================================================
-        // =                        Increment the bispectrum                        =
-        // ==========================================================================
-
-        /* Four-dimensional integral */
-        double integral = pwb->integral_over_r[index_l3][index_l2][index_l1-index_l1_min];
-
-        /* There might be something wrong when the result is zero */
-        // if (pwb->abs_M3 <= pbi->l[index_l3]) {
-        //   class_test_lazy (integral < _MINUSCULE_,
-        //     pbi->error_message,
-        //     "integral(l1=%d,l2=%d,l3=%d,L1=%d,L3=%d,M3=%d)=%.16g", l1, l2, l3, L1, L3, M3, integral);
-        // }
 
-        /* Prefactor for the reduced bispectrum. This already has a factor
-        sqrt((2l1+1.)*(2l2+1.)*(2l3+1.)/(4*_PI_)) taken out, and it
-        is multiplied by (2*l1+1)*(2*l2+1)*(2*l3+1) with respect
-        to the one in Christian's notes because in Song the transfer functions
-        are the Legendre ones. */
-        double prefactor;
-        
-        if (pwb->bispectrum_parity == _EVEN_) {
-          prefactor = 8/_PI_CUBE_ * (2*L1+1.) * (2*L3+1.);
-        }
-        else {
-          /* The last line is the P_l -> Y_lm factor, without 2*l3+1 */
-          prefactor = - 0.5 / (4*_PI_FOURTH_) * (2*L1+1.) * (2*L3+1.) * (2*l1+1) * (2*l2+1);
-        }
+      // ***   Alternating sign   ***
+
+      /* The bispectrum formula has a prefactor of the form (-i)^(l3+L3-l1-L1). The exponent has the same
+      parity of offset_L1+offset_L3 (offset_L1=L1-|l1-|M3|| and offset_L3=L3-|l3-|M3||). For intensity,
+      both offsets have to be even, which ensures that the prefactor, and thus the whole bispectrum, is
+      real.
+
+      For B-modes, offset_L1 is still even but offset_L3 needs to be odd (see the comment in the 
+      offset_L3 loop in bispectra2_intrinsic_init). This makes the overall factor always imaginary,
+      which is the way it should be (we are computing <conj(B)IE> which is needed to obtain the
+      C_l's) */
+      int exponent;
+
+      if (pwb->bispectrum_parity == _EVEN_)
+        exponent = l3+L3-l1-L1;
+      else
+        exponent = l3+L3-l1-L1-1;
+
+      class_test_parallel ((exponent%2!=0) && (fabs(geometry)>_MINUSCULE_),
+        pbi->error_message,
+        "imaginary bispectrum, something is wrong with the 3js");
+
         
-        /* Product of all the geometrical factors */
-        double geometry = SUMMED_FACTOR_l3_L3_M3 * FACTOR_l1_L1_M3 * FACTOR_L1_l2_L3 * FACTOR_l1_l3_l2_L3_L1_M3;
+      /* Store the geometrical factor for (l1,l2,l3,M3,L3,L1) */
+      double factor = ALTERNATING_SIGN(exponent/2) * prefactor * geometry;
 
-        /* Check parity for T and E-modes */
-        if (pwb->bispectrum_parity == _EVEN_) {
-          class_test_parallel ((!is_even_configuration) && (fabs(geometry)>_MINUSCULE_),
-            pbi->error_message,
-            "geometry does not respect parity: G_%d_%d_%d=%g! Possible bug in the sum of 3js and 6js.",
-            l1, l2, l3, geometry);
-        }
-        else {
-          /* Check parity for B-modes */
-          class_test_parallel ((is_even_configuration) && (fabs(geometry)>_MINUSCULE_),
+      table[pwb->triangle_start[index_l3][index_l2] + index_l1-index_l1_min] = factor;
+
+      /* Check that for scalar modes the sum simplifies to a simpler formula, similar to the
+      one in eq. 17 of Fergusson & Shellard (2007), where the (l1,l2,l3) 3j-symbol is extracted
+      analytically rather than factored out numerically */
+      if ((pwb->bispectrum_parity == _EVEN_) && (abs_M3 == 0) && is_even_configuration) {
+
+        double factor_for_m0 = 8/_PI_CUBE_;
+
+        if (fabs(factor) > _MINUSCULE_)
+          class_test_parallel (fabs(1-factor_for_m0/factor) > _SMALL_,
             pbi->error_message,
-            "geometry does not respect parity: G_%d_%d_%d=%g! Possible bug in the sum of 3js and 6js.",
-            l1, l2, l3, geometry);
-        }
+            "error in the geometrical factor, m=0 not recovered (%g != %g) for b_%d_%d_%d.",
+            factor_for_m0, factor, l2, l3, l1);
+      }
 
-        /* Divide by the 3j symbol (l1,l2,l3)(0,0,0) in order to obtain the reduced bispectrum. Note that
-        for odd values of l1+l2+l3, the ratio will give a nan, so in that case we leave the geometry
-        factor as it is; this is is not an issue because for odd l1+l2+l3, the geometry factor vanishes.
-        For an odd bispectrum, divide by (l1,l2,l3)(-2,0,2), which is different from zero both for 
-        odd and even l1+l2+l3. */
-        if (pwb->bispectrum_parity == _EVEN_) {
-          if (is_even_configuration) 
-            geometry /= FACTOR_l1_l2_l3;
-        }
-        /* DISABLED: we don't need to take the (l1 l2 l3)(2 0 -2) explicitly */
-        // else
-        //   geometry *= FACTOR_l1_l2_l3;
-          
+      #pragma omp flush(abort)
 
+    } // end of for(index_l1)
+  } // end of for(index_pair) and of parallel region
+  if (abort == _TRUE_) return _FAILURE_;
+
+  /* Free 3j values array */
+  for (thread=0; thread < number_of_threads; ++thread) {
+    for (int ii=0; ii < n_geometrical_factors; ++ii)
+      free (value[thread][ii]);
+    free (value[thread]);
+  }
+  free (value);
 
+  return _SUCCESS_;
 
-        // ***   Alternating sign   ***
+}
 
-        /* The bispectrum formula has a prefactor of the form (-i)^(l3+L3-l1-L1). The exponent has the same
-        parity of offset_L1+offset_L3 (offset_L1=L1-|l1-|M3|| and offset_L3=L3-|l3-|M3||). For intensity,
-        both offsets have to be even, which ensures that the prefactor, and thus the whole bispectrum, is
-        real.
 
-        For B-modes, offset_L1 is still even but offset_L3 needs to be odd (see the comment in the 
-        offset_L3 loop in bispectra2_intrinsic_init). This makes the overall factor always imaginary,
-        which is the way it should be (we are computing <conj(B)IE> which is needed to obtain the
-        C_l's) */
-        int exponent;
 
-        if (pwb->bispectrum_parity == _EVEN_)
-          exponent = l3+L3-l1-L1;
-        else
-          exponent = l3+L3-l1-L1-1;
 
-        class_test_parallel ((exponent%2!=0) && (fabs(geometry)>_MINUSCULE_),
-          pbi->error_message,
-          "imaginary bispectrum, something is wrong with the 3js");
+/**
+ * Build the path of the cache file for the geometrical factors of the intrinsic
+ * bispectrum with the given (M3,offset_L3,offset_L1) and with the parity of the
+ * current bispectrum.
+ *
+ * The geometrical factors depend only on the multipole sampling (pbi->l), on
+ * (M3,offset_L3,offset_L1), on the parity of the bispectrum and on ppr2->m_max_song.
+ * The key identifying the file is a 64-bit FNV-1a hash of these quantities, and is
+ * used both to name the file and to validate it.
+ */
 
-          
-        /* Add the contribution from (l1,l2,l3,M3,L3,L1) to the bispectrum */
-        /* TODO: the m_max check here should be removed. We want a unique way to define the
-        reduced bispectrum regardless of the m */
-        if (pwb->bispectrum_parity == _EVEN_) {
-          if (ppr2->m_max_song != 0) {
+int bispectra2_geometrical_table_path (
+    struct precision2 * ppr2,
+    struct bispectra * pbi,
+    int index_M3,
+    int offset_L3,
+    int offset_L1,
+    char * path, /* out */
+    unsigned long long * key, /* out */
+    struct bispectra_workspace_intrinsic * pwb
+    )
+{
 
-            #pragma omp atomic
-            result[index_l3][index_l2][index_l1-index_l1_min]
-              += ALTERNATING_SIGN(exponent/2) * prefactor * geometry * integral;
+  *key = 14695981039346656037ULL;
 
-          }
-          /* We treat m=0 as a special case because in this way we can define the reduced
-          bispectrum for m=0 also when l1+l2+l3 is odd. We cannot do this for the m>0 cases
-          because there we have to numerically divide the bispectrum formula by the 3j-symbol
-          (l1,l2,l3)(0,0,0) rather than extracting it analitically */
-          else {
-        
-            result[index_l3][index_l2][index_l1-index_l1_min]
-              = 8/_PI_CUBE_ * integral;
-        
-          }
-          
-          /* Check that for scalar modes the integral simplifies to a simpler formula, similar
-          to the one in eq. 17 of Fergusson & Shellard (2007) */
-          if (abs_M3 == 0) {
+  int flags[] = {
+    pbi->l_size, pwb->bispectrum_parity, ppr2->m_max_song,
+    ppr2->m[index_M3], offset_L3, offset_L1
+  };
 
-            /* Simple formula with the (l1,l2,l3) 3j-symbol analytically extracted */
-            double bispectrum_for_m0 = 8/_PI_CUBE_ * integral;
+  const unsigned char * bytes = (const unsigned char *)flags;
+  for (int i=0; i < (int)sizeof(flags); ++i) {
+    *key ^= bytes[i];
+    *key *= 1099511628211ULL;
+  }
 
-            /* Full formula, with the (l1,l2,l3) 3j-symbol factored out numerically */
-            double bispectrum = 0;
-            if (is_even_configuration)
-              bispectrum = ALTERNATING_SIGN(exponent/2) * prefactor * geometry * integral;          
+  bytes = (const unsigned char *)pbi->l;
+  for (long int i=0; i < pbi->l_size*(long int)sizeof(int); ++i) {
+    *key ^= bytes[i];
+    *key *= 1099511628211ULL;
+  }
 
-            if (fabs(bispectrum) > _MINUSCULE_)
-              class_test_parallel (fabs(1-bispectrum_for_m0/bispectrum) > _SMALL_,
-                pbi->error_message,
-                "error in the geometrical factor, m=0 not recovered (%g != %g) for b_%d_%d_%d.",
-                bispectrum_for_m0, bispectrum, l2, l3, l1);
-          }
-        } // end of if even parity
-        else {
+  sprintf (path, "%s/geometrical_factors_%016llx.dat", ppr2->geometrical_factors_cache_dir, *key);
 
-          #pragma omp atomic
-          result[index_l3][index_l2][index_l1-index_l1_min]
-            += ALTERNATING_SIGN(exponent/2) * prefactor * geometry * integral;
-          
-        } // end of if odd parity
-
-        /* Comparison with Christian's B-modes */
-        // if (pwb->abs_M3==1) {
-        //   if ((l1>200) && (l1<310)) {
-        // 
-        //     double geometry_prefactor = - 0.5 / (4*_PI_FOURTH_) * (2*L1+1.) * (2*L3+1.) / (2.*l3+1);
-        //     double integral_prefactor = (2.*l1+1) * (2.*l2+1) * (2.*l3+1);
-        //   
-        //     #pragma omp critical
-        //     fprintf (stderr, "(l1,l2,l3 | L1,L3)=(%3d,%3d,%3d | %3d,%3d): geometry=%10g, integral=%10g\n",
-        //       l1,l2,l3,L1,L3,
-        //       ALTERNATING_SIGN(exponent/2) * geometry_prefactor * geometry,
-        //       integral_prefactor*integral);
-        // 
-        //   }
-        // }
+  return _SUCCESS_;
 
-        /* Debug - print subparts of the final result */
-        // printf ("(M3,L3,L1,l1,l2,l3,offset_L3,offset_L1)=(%d,%d,%d,%d,%d,%d,%d,%d):",
-        //   ppr2->m[index_M3],L3,L1,l1,l2,l3,offset_L3,offset_L1);
-        // printf ("\tresult=%g,prefactor=%g, integral=%g, geometry=%g, product=%g\n",
-        //   result[index_l3][index_l2][index_l1-index_l1_min],
-        //   ALTERNATING_SIGN(exponent/2)*prefactor, integral, geometry,
-        //   ALTERNATING_SIGN(exponent/2)*ALTERNATING_SIGN(exponent)*integral*geometry);
-        
-        /* Mathematica batch debug */
-        // double val = ALTERNATING_SIGN(exponent/2)*geometry;
-        // if ((abs_M3==2) && (offset_L3==4)) {
-        //   if (val==0) {
-        //     fprintf (stderr, "Abs[g[%d,%d,%d,%d,%d,%d]] == 0,\n",
-        //       abs_M3,L3,L1,l1,l2,l3);
-        //   }
-        //   else {
-        //     fprintf (stderr, "Abs[1-g[%d,%d,%d,%d,%d,%d]/((%g)*10^(%f))],\n",
-        //       abs_M3,L3,L1,l1,l2,l3,SIGN(val),log10(fabs(val)));
-        //   }
-        // }
+}
 
-        /* Uncomment test the accuracy of 'threej_ratio_L_recursive' and 'threej_ratio_L_recursive' */
-        // int M=4;
-        // double threej_num[2*pbi->l_max+1], threej_den[2*pbi->l_max+1];
-        // int l3_min_num, l3_min_den;
-        // double min_D, max_D;
-        // class_call_parallel (drc3jj (
-        //                        MAX(l1,M), MAX(l2,M), 0, -M,
-        //                        &min_D, &max_D,
-        //                        &(threej_num[0]),
-        //                        (2*pbi->l_max+1),
-        //                        pbi->error_message),
-        //   pbi->error_message,
-        //   pbi->error_message);
-        // l3_min_num = (int)(min_D + _EPS_);          
-        // class_call_parallel (drc3jj (
-        //                        MAX(l1,M), MAX(l2,M), 0, 0,
-        //                        &min_D, &max_D,
-        //                        &(threej_den[0]),
-        //                        (2*pbi->l_max+1),
-        //                        pbi->error_message),
-        //   pbi->error_message,
-        //   pbi->error_message);
-        // l3_min_den = (int)(min_D + _EPS_);          
-        // 
-        // for (int index_l3=index_l3_min; index_l3<=index_l3_max; ++index_l3) {
-        //   int l3 = pbi->l[index_l3];
-        //   if ((l1+l2+l3)%2==0) {
-        //     if ((l1<M) || (l2<M) || (l3<M)) continue;
-        //     double * ratio = malloc(sizeof(double)*(M+1));
-        //     class_call_parallel (threej_ratio_M_recursive(l1, l2, l3, M, ratio, pbi->error_message),
-        //       pbi->error_message, pbi->error_message);
-        //     double res_1 = threej_num[l3-l3_min_num]/threej_den[l3-l3_min_den];
-        //     double res_2 = ratio[M];
-        //     double frac = 1-res_1/res_2;
-        //     class_test_parallel (fabs(frac) > _SMALL_,
-        //       pbi->error_message,
-        //       "(%3d,%3d,%3d,M=%d), res_1=%14.6g, res_2=%14.6g, diff=%14.6g\n",
-        //       l1, l2, l3, M, res_1, res_2, frac);
-        //   }
-        // }
-        
-        #pragma omp flush(abort)
-  
-      } // end of for(index_l1)
-    } // end of for(index_l2)
-  } // end of for(index_l3) and of parallel region
-  if (abort == _TRUE_) return _FAILURE_;
 
-  /* We can free the memory that was allocated for the integral over r, as it is no longer needed */
-  if ((offset_L1 == (2*pwb->abs_M3)) && (pwb->Y == (pbi->bf_size-1)) && (pwb->Z == (pbi->bf_size-1))) {
-    for (int index_l3 = 0; index_l3 < pbi->l_size; ++index_l3) {
-      for (int index_l2 = 0; index_l2 < pbi->l_size; ++index_l2) {
-        free (pwb->integral_over_r[index_l3][index_l2]);
-      } // end of for(index_l2)
-      free (pwb->integral_over_r[index_l3]);
-    } // end of for(index_l3)
-    free (pwb->integral_over_r);
-  } // end of last term in the L1 loop
 
-  /* Free 3j values array */
-  for (thread=0; thread < number_of_threads; ++thread) {
-    for (int ii=0; ii < n_geometrical_factors; ++ii)
-      free (value[thread][ii]);
-    free (value[thread]);
+/**
+ * Look for the geometrical factors of the intrinsic bispectrum for a given
+ * (M3,offset_L3,offset_L1) in ppr2->geometrical_factors_cache_dir, and read
+ * them in the table if they are there.
+ *
+ * The cache file starts with a bispectra2_geometry_header, followed by the
+ * geometrical factors in the same order as in pwb->geometrical_table. A missing
+ * or invalid file is not an error: in that case, 'found' is set to _FALSE_ and
+ * the geometrical factors will be computed.
+ */
+
+int bispectra2_geometrical_table_load (
+    struct precision2 * ppr2,
+    struct bispectra * pbi,
+    int index_M3,
+    int offset_L3,
+    int offset_L1,
+    double * table, /* out */
+    short * found, /* out */
+    struct bispectra_workspace_intrinsic * pwb
+    )
+{
+
+  *found = _FALSE_;
+
+  char path[_FILENAMESIZE_+64];
+  unsigned long long key;
+
+  class_call (bispectra2_geometrical_table_path (
+                ppr2, pbi, index_M3, offset_L3, offset_L1, path, &key, pwb),
+    pbi->error_message,
+    pbi->error_message);
+
+  FILE * cache_file = fopen (path, "rb");
+
+  if (cache_file == NULL)
+    return _SUCCESS_;
+
+  struct bispectra2_geometry_header header;
+
+  short is_valid = (fread (&header, sizeof(struct bispectra2_geometry_header), 1, cache_file) == 1)
+                && (memcmp (header.magic, "SONGGEO", sizeof(header.magic)) == 0)
+                && (header.key == key)
+                && (header.size == pwb->triangle_size)
+                && (fread (table, sizeof(double), pwb->triangle_size, cache_file) == pwb->triangle_size);
+
+  fclose (cache_file);
+
+  if (is_valid == _FALSE_) {
+    if (pbi->bispectra_verbose > 1)
+      printf ("     * ignoring invalid geometrical factors cache '%s'\n", path);
+    for (long int i=0; i < pwb->triangle_size; ++i)
+      table[i] = 0;
+    return _SUCCESS_;
   }
-  free (value);
+
+  if (pbi->bispectra_verbose > 2)
+    printf ("     * read the geometrical factors from the cache '%s'\n", path);
+
+  *found = _TRUE_;
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Write the geometrical factors of the intrinsic bispectrum for a given
+ * (M3,offset_L3,offset_L1) in ppr2->geometrical_factors_cache_dir; see
+ * bispectra2_geometrical_table_load() for the format.
+ *
+ * The file is first written with a temporary name and then renamed, so that
+ * concurrent runs never read a partial file. A failure in writing the cache
+ * is not fatal.
+ */
+
+int bispectra2_geometrical_table_store (
+    struct precision2 * ppr2,
+    struct bispectra * pbi,
+    int index_M3,
+    int offset_L3,
+    int offset_L1,
+    double * table,
+    struct bispectra_workspace_intrinsic * pwb
+    )
+{
+
+  char path[_FILENAMESIZE_+64];
+  unsigned long long key;
+
+  class_call (bispectra2_geometrical_table_path (
+                ppr2, pbi, index_M3, offset_L3, offset_L1, path, &key, pwb),
+    pbi->error_message,
+    pbi->error_message);
+
+  struct bispectra2_geometry_header header;
+  memset (&header, 0, sizeof(struct bispectra2_geometry_header));
+  strcpy (header.magic, "SONGGEO");
+  header.key = key;
+  header.size = pwb->triangle_size;
+
+  char tmp_path[_FILENAMESIZE_+96];
+  sprintf (tmp_path, "%s.%d.tmp", path, (int)getpid());
+
+  FILE * cache_file = fopen (tmp_path, "wb");
+
+  int write_error = (cache_file == NULL)
+    || (fwrite (&header, sizeof(struct bispectra2_geometry_header), 1, cache_file) != 1)
+    || (fwrite (table, sizeof(double), pwb->triangle_size, cache_file) != pwb->triangle_size);
+
+  if (cache_file != NULL)
+    write_error = (fclose (cache_file) != 0) || write_error;
+
+  if (write_error || (rename (tmp_path, path) != 0)) {
+    remove (tmp_path);
+    if (pbi->bispectra_verbose > 0)
+      printf (" -> could not store the geometrical factors in '%s'\n", path);
+    return _SUCCESS_;
+  }
+
+  if (pbi->bispectra_verbose > 2)
+    printf ("     * stored the geometrical factors in the cache '%s'\n", path);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Look for the geometrical factors of the intrinsic bispectrum for a given
+ * (M3,offset_L3,offset_L1) among those kept in memory by a previous run in
+ * ppr2->kept_geometrical_factors, and copy them in the table if they are there.
+ */
+
+int bispectra2_geometrical_table_recall (
+    struct precision2 * ppr2,
+    struct bispectra * pbi,
+    int index_M3,
+    int offset_L3,
+    int offset_L1,
+    double * table, /* out */
+    short * found, /* out */
+    struct bispectra_workspace_intrinsic * pwb
+    )
+{
+
+  *found = _FALSE_;
+
+  char path[_FILENAMESIZE_+64];
+  unsigned long long key;
+
+  class_call (bispectra2_geometrical_table_path (
+                ppr2, pbi, index_M3, offset_L3, offset_L1, path, &key, pwb),
+    pbi->error_message,
+    pbi->error_message);
+
+  struct bispectra2_kept_geometry * pkg = ppr2->kept_geometrical_factors;
+
+  for (int index_table=0; index_table < pkg->table_size; ++index_table) {
+
+    if ((pkg->keys[index_table] != key) || (pkg->sizes[index_table] != pwb->triangle_size))
+      continue;
+
+    memcpy (table, pkg->tables[index_table], pwb->triangle_size*sizeof(double));
+
+    *found = _TRUE_;
+
+    break;
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Keep a copy of the geometrical factors of the intrinsic bispectrum for a given
+ * (M3,offset_L3,offset_L1) in ppr2->kept_geometrical_factors, so that the next
+ * runs in the same process do not need to compute them again.
+ */
+
+int bispectra2_geometrical_table_keep (
+    struct precision2 * ppr2,
+    struct bispectra * pbi,
+    int index_M3,
+    int offset_L3,
+    int offset_L1,
+    double * table,
+    struct bispectra_workspace_intrinsic * pwb
+    )
+{
+
+  char path[_FILENAMESIZE_+64];
+  unsigned long long key;
+
+  class_call (bispectra2_geometrical_table_path (
+                ppr2, pbi, index_M3, offset_L3, offset_L1, path, &key, pwb),
+    pbi->error_message,
+    pbi->error_message);
+
+  struct bispectra2_kept_geometry * pkg = ppr2->kept_geometrical_factors;
+
+  int index_table = pkg->table_size;
+
+  class_realloc (pkg->keys, pkg->keys, (index_table+1)*sizeof(unsigned long long), pbi->error_message);
+  class_realloc (pkg->sizes, pkg->sizes, (index_table+1)*sizeof(long int), pbi->error_message);
+  class_realloc (pkg->tables, pkg->tables, (index_table+1)*sizeof(double *), pbi->error_message);
+
+  class_alloc (pkg->tables[index_table], pwb->triangle_size*sizeof(double), pbi->error_message);
+  memcpy (pkg->tables[index_table], table, pwb->triangle_size*sizeof(double));
+
+  pkg->keys[index_table] = key;
+  pkg->sizes[index_table] = pwb->triangle_size;
+  pkg->table_size++;
 
   return _SUCCESS_;
 
 }
 
 
+
+
+
 /**
  * Add to the intrinsic bispectrum a quadratic term in C_l to account for various
  * corrections.
@@ -3073,6 +5119,21 @@ int bispectra2_add_quadratic_corrections (
               for (int index_l3=index_l3_min; index_l3<=index_l3_max; ++index_l3) {
                   
                 long int index_l1_l2_l3 = pbi->index_l1_l2_l3[index_l1][index_l1-index_l2][index_l3_max-index_l3];
+
+                /* The configurations that were not requested stay zero */
+                short needed;
+                class_call (bispectra2_needed_triangle (
+                              ppr2,
+                              pbi,
+                              index_l1,
+                              index_l2,
+                              index_l3,
+                              &needed),
+                  pbi->error_message,
+                  pbi->error_message);
+
+                if (needed == _FALSE_)
+                  continue;
               
                 /* Bolometric temperature correction (sec. 6.3.1 of http://arxiv.org/abs/1405.2280 or
                 sec. 3.2 of http://arxiv.org/abs/1401.3296) */
@@ -523,6 +523,19 @@ int input2_init (
   /* Fixed number of grid points for any (k1,k2) pair, used when k3_sampling is set to either lin or log */
   class_read_int("k3_size", ppr2->k3_size);
 
+  /* Relative accuracy of the linear interpolation in k3 of the sources, and spacing of the
+  k3 modes that are always solved, used to skip the other k3 modes */
+  class_read_double("sources2_k3_adaptive_tol", ppr2->k3_adaptive_tol);
+  class_read_int("sources2_k3_adaptive_stride", ppr2->k3_adaptive_stride);
+
+  class_test (ppr2->k3_adaptive_tol < 0,
+    errmsg,
+    "sources2_k3_adaptive_tol=%g must be non-negative", ppr2->k3_adaptive_tol);
+
+  class_test (ppr2->k3_adaptive_stride < 2,
+    errmsg,
+    "sources2_k3_adaptive_stride=%d must be at least 2", ppr2->k3_adaptive_stride);
+
   if (ppt2->has_cmb_bispectra && ppt2->k3_sampling == sym_k3_sampling) {
     printf ("\nWARNING: symmetric sampling not supported for intrinsic bispectrum; switching to 'smart' sampling\n\n");
     ppt2->k3_sampling = smart_k3_sampling;
@@ -582,6 +595,24 @@ int input2_init (
   class_read_double("tol_perturb_integration_2nd_order",ppr2->tol_perturb_integration_song); /* obsolete */
   class_read_double("tol_perturb_integration_song",ppr2->tol_perturb_integration_song);
 
+  /* Should we reuse the first-order perturbations in the quadratic sources for all the
+  k3 modes of a given (k1,k2) pair? */
+  class_call(parser_read_string(pfc,"cache_quadsources",&(string1),&(flag1),errmsg),errmsg,errmsg);
+  if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL)))
+    ppr2->cache_quadsources = _TRUE_;
+
+  /* Should we stop evolving a wavemode once its line-of-sight sources have become negligible? */
+  class_read_double("sources_cutoff_song",ppr2->sources_cutoff_song);
+
+  class_test (ppr2->sources_cutoff_song < 0,
+    errmsg,
+    "sources_cutoff_song must be non-negative");
+
+  /* Should we check the sparsity pattern of the Jacobian of the second-order system? */
+  class_call(parser_read_string(pfc,"check_jacobian_pattern",&(string1),&(flag1),errmsg),errmsg,errmsg);
+  if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL)))
+    ppr2->check_jacobian_pattern = _TRUE_;
+
 
   // ====================================================================================
   // =                      Perturbations, perturbed recombination                      =
@@ -1441,6 +1472,30 @@ int input2_init (
   /* Linear step dx where we are going to sample the j_l1(x) and J_Llm(x) */
   class_read_double("bessel_x_step_2nd_order", ppr2->bessel_x_step_song); /* obsolete */
   class_read_double("bessel_x_step_song", ppr2->bessel_x_step_song);
+
+  /* Should we store J_Llm(x) in single precision? */
+  class_call(parser_read_string(pfc,"compact_projection_functions",&(string1),&(flag1),errmsg),errmsg,errmsg);
+  if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL)))
+    ppr2->compact_projection_functions = _TRUE_;
+
+  /* Relative tolerance for the adaptive sampling of J_Llm(x); it is implemented only for
+  linear interpolation and double-precision storage */
+  class_read_double("bessel_J_adaptive_tol_song", ppr2->bessel_J_adaptive_tol_song);
+
+  class_test ((ppr2->bessel_J_adaptive_tol_song > 0) && (ppr->bessels_interpolation != linear_interpolation),
+    errmsg,
+    "the adaptive sampling of the projection functions (bessel_J_adaptive_tol_song) requires bessels_interpolation=linear");
+
+  class_test ((ppr2->bessel_J_adaptive_tol_song > 0) && (ppr2->compact_projection_functions == _TRUE_),
+    errmsg,
+    "the adaptive sampling of the projection functions (bessel_J_adaptive_tol_song) is not compatible with compact_projection_functions");
+
+  /* Directory where to cache J_Llm(x) between runs */
+  class_call(parser_read_string(pfc,"projection_functions_cache_dir",&(string1),&(flag1),errmsg),errmsg,errmsg);
+  if ((flag1 == _TRUE_) && (strlen(string1) > 0)) {
+    ppr2->cache_projection_functions = _TRUE_;
+    strcpy (ppr2->projection_functions_cache_dir, string1);
+  }
   
 
   // =========================================================================================
@@ -1542,6 +1597,11 @@ int input2_init (
   if (ppr2->tau_linstep_song < 0)
     ppr2->tau_linstep_song = _HUGE_;
 
+  /* Should we compute the E and B-mode transfer functions with the same (l,m) together? */
+  class_call(parser_read_string(pfc,"batch_transfers",&(string1),&(flag1),errmsg),errmsg,errmsg);
+  if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL)))
+    ppr2->batch_transfers = _TRUE_;
+
   
 
   // =============================================================================================
@@ -1558,6 +1618,99 @@ int input2_init (
     pbi->add_quadratic_correction = _FALSE_;
   }
 
+  /* Should we compute the integrals of the intrinsic bispectrum one l3 at a time? */
+  class_call(parser_read_string(pfc,"tile_intrinsic_bispectrum",&(string1),&(flag1),errmsg),errmsg,errmsg);
+  if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL)))
+    ppr2->tile_intrinsic_bispectrum = _TRUE_;
+
+  /* Should we use the scalar reference loops for the interpolation over k and the integral over r? */
+  class_call(parser_read_string(pfc,"scalar_bispectrum_kernels",&(string1),&(flag1),errmsg),errmsg,errmsg);
+  if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL)))
+    ppr2->scalar_bispectrum_kernels = _TRUE_;
+
+  /* Should we compute the transfer functions one k1 at a time inside the bispectrum module? */
+  class_call(parser_read_string(pfc,"stream_transfers",&(string1),&(flag1),errmsg),errmsg,errmsg);
+  if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL)))
+    ppr2->stream_transfers = _TRUE_;
+
+  /* Should we keep the geometrical factors of the intrinsic bispectrum in memory? */
+  class_call(parser_read_string(pfc,"cache_geometrical_factors",&(string1),&(flag1),errmsg),errmsg,errmsg);
+  if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL)))
+    ppr2->cache_geometrical_factors = _TRUE_;
+
+  /* Directory where to store the geometrical factors between runs */
+  class_call(parser_read_string(pfc,"geometrical_factors_cache_dir",&(string1),&(flag1),errmsg),errmsg,errmsg);
+  if ((flag1 == _TRUE_) && (strlen(string1) > 0))
+    strcpy (ppr2->geometrical_factors_cache_dir, string1);
+
+  /* For which (l1,l2,l3) configurations should we compute the intrinsic bispectrum? */
+  class_call(parser_read_string(pfc,"bispectrum_triangles",&string1,&flag1,errmsg),
+       errmsg,
+       errmsg);
+
+  if (flag1 == _TRUE_) {
+
+    if (strcmp(string1,"all") == 0)
+      ppr2->bispectrum_triangles = all_triangles;
+
+    else if (strcmp(string1,"squeezed") == 0)
+      ppr2->bispectrum_triangles = squeezed_triangles;
+
+    else if (strcmp(string1,"equilateral") == 0)
+      ppr2->bispectrum_triangles = equilateral_triangles;
+
+    else if (strcmp(string1,"list") == 0)
+      ppr2->bispectrum_triangles = listed_triangles;
+
+    else
+      class_stop(errmsg,
+        "bispectrum_triangles=%s not supported. Choose between 'all', 'squeezed', 'equilateral' and 'list'.",
+        string1);
+  }
+
+  class_read_int("l_squeezed", ppr2->l_squeezed);
+
+  /* Read the list of (l1,l2,l3) configurations, one list per multipole */
+  if (ppr2->bispectrum_triangles == listed_triangles) {
+
+    char * triangle_list_names[3] = {"bispectrum_l1_list", "bispectrum_l2_list", "bispectrum_l3_list"};
+    int * triangle_lists[3] = {ppr2->triangle_l1, ppr2->triangle_l2, ppr2->triangle_l3};
+
+    for (int index_list=0; index_list < 3; ++index_list) {
+
+      class_call(parser_read_list_of_integers(
+                   pfc,
+                   triangle_list_names[index_list],
+                   &(int1),
+                   &(int_pointer1),
+                   &flag1,
+                   errmsg),
+        errmsg,
+        errmsg);
+
+      class_test (flag1 == _FALSE_,
+        errmsg,
+        "bispectrum_triangles=list requires the parameter %s", triangle_list_names[index_list]);
+
+      class_test ((index_list > 0) && (int1 != ppr2->triangle_size),
+        errmsg,
+        "specify the same number of values in bispectrum_l1_list, bispectrum_l2_list and bispectrum_l3_list");
+
+      class_test (int1 > _MAX_NUM_TRIANGLES_,
+        errmsg,
+        "at most %d configurations can be given in %s; increase _MAX_NUM_TRIANGLES_",
+        _MAX_NUM_TRIANGLES_, triangle_list_names[index_list]);
+
+      ppr2->triangle_size = int1;
+
+      for (i=0; i < int1; ++i)
+        triangle_lists[index_list][i] = int_pointer1[i];
+
+      free (int_pointer1);
+
+    }
+  }
+
 
 
   // =============================================================================================
@@ -1576,6 +1729,12 @@ int input2_init (
   // -                               Disk storage of sources                                -
   // ----------------------------------------------------------------------------------------
 
+  /* All the MPI processes share the run directory of the first one */
+  #ifdef _MPI
+  if (ppr2->mpi_size > 1)
+    MPI_Bcast (ppr->data_dir, _FILENAMESIZE_, MPI_CHAR, 0, MPI_COMM_WORLD);
+  #endif
+
   /* Store to disk the second-order line of sight sources? */
   class_call(parser_read_string(pfc,"store_sources",&(string1),&(flag1),errmsg),
       errmsg,
@@ -1584,48 +1743,208 @@ int input2_init (
   if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL)))
     ppr2->store_sources_to_disk = _TRUE_;
 
-  sprintf(ppt2->sources_dir, "%s/sources", ppr->data_dir);
+  /* Store the sources in a single memory-mapped file rather than in one file per k1? */
+  class_call(parser_read_string(pfc,"store_sources_mmap",&(string1),&(flag1),errmsg),
+      errmsg,
+      errmsg);
+      
+  if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL)))
+    ppr2->store_sources_mmap = _TRUE_;
+
+  /* Compress the sources and transfer functions stored to disk? */
+  class_call(parser_read_string(pfc,"disk_compression",&string1,&flag1,errmsg),
+       errmsg,
+       errmsg); 
+
+  if (flag1 == _TRUE_) {
+
+    if (((strstr(string1,"none") != NULL) || (strstr(string1,"NONE") != NULL)
+    || (strstr(string1,"no") != NULL) || (strstr(string1,"NO") != NULL)))
+      ppr2->disk_compression = block_compression_none;
 
-  /* If we are not loading from disk, just create the source directory */
-  if ((ppr2->store_sources_to_disk == _TRUE_) && (ppr->load_run == _FALSE_)) {
-    
-    class_test (mkdir (ppt2->sources_dir, 0777) != 0,
+    else if (((strstr(string1,"lossless") != NULL) || (strstr(string1,"LOSSLESS") != NULL)))
+      ppr2->disk_compression = block_compression_lossless;
+
+    else if (((strstr(string1,"lossy") != NULL) || (strstr(string1,"LOSSY") != NULL)))
+      ppr2->disk_compression = block_compression_lossy;
+
+    else
+      class_stop (errmsg,
+        "disk_compression=%s not supported, choose between 'none', 'lossless' and 'lossy'",
+        string1);
+  }
+
+  class_read_double("disk_compression_tolerance",ppr2->disk_compression_tolerance);
+
+  class_test ((ppr2->disk_compression == block_compression_lossy)
+    && ((ppr2->disk_compression_tolerance <= 0) || (ppr2->disk_compression_tolerance >= 1)),
+    errmsg,
+    "disk_compression_tolerance must be between 0 and 1, found %g", ppr2->disk_compression_tolerance);
+
+  class_test ((ppr2->disk_compression != block_compression_none) && (ppr2->store_sources_mmap == _TRUE_),
+    errmsg,
+    "the memory-mapped sources (store_sources_mmap=yes) cannot be compressed; set disk_compression=none");
+
+  /* Overlap the disk access for the sources and transfer functions with the computation? */
+  class_call(parser_read_string(pfc,"prefetch_sources",&(string1),&(flag1),errmsg),
       errmsg,
-      "could not create directory '%s', maybe it already exists?", ppt2->sources_dir);
+      errmsg);
+      
+  if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL)))
+    ppr2->prefetch_sources = _TRUE_;
+
+  /* Number of NUMA domains spanned by the OpenMP threads */
+  class_read_int("numa_domains", ppr2->numa_domains);
+
+  class_test (ppr2->numa_domains < 1,
+    errmsg,
+    "numa_domains must be at least 1, found %d", ppr2->numa_domains);
+
+  /* Each domain needs at least one thread, otherwise its replica of the projection
+  functions would never be filled */
+  #ifdef _OPENMP
+  if (ppr2->numa_domains > omp_get_max_threads()) {
+    if (ptr2->transfer2_verbose > 1)
+      printf (" -> there are only %d threads, ignoring numa_domains=%d.\n",
+        omp_get_max_threads(), ppr2->numa_domains);
+    ppr2->numa_domains = 1;
   }
-  /* If we are in a run directory, checks if it already contains the source functions */
-  else if (ppr->load_run == _TRUE_) {
-
-    struct stat st;
-    short sources_dir_exists = (stat(ppt2->sources_dir, &st)==0);
-
-    /* If the sources directory exists, then we shall load the 2nd-order source functions from it */
-    if (sources_dir_exists) {
-      ppr2->store_sources_to_disk = _FALSE_;
-      ppr2->load_sources_from_disk = _TRUE_;
-      if (ppt2->perturbations2_verbose > 1)
-        printf (" -> found source functions folder in run directory.\n");
+  #else
+  ppr2->numa_domains = 1;
+  #endif
+
+  /* Write a JSON report with the timing and memory usage of the run? */
+  class_call(parser_read_string(pfc,"write_run_report",&(string1),&(flag1),errmsg),
+      errmsg,
+      errmsg);
+      
+  if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL)))
+    ppr2->write_run_report = _TRUE_;
+
+  /* Directory where to keep the sources and transfer functions between runs. It is
+  ignored when loading a run directory, which already contains them. */
+  class_call(parser_read_string(pfc,"run_cache_dir",&(string1),&(flag1),errmsg),
+      errmsg,
+      errmsg);
+
+  if ((flag1 == _TRUE_) && (strlen(string1) > 0) && (ppr->load_run == _FALSE_)) {
+    ppr2->cache_run = _TRUE_;
+    strcpy (ppr2->run_cache_dir, string1);
+  }
+
+  /* With the run cache, the sources and transfers directories are named after the parameters
+  they depend on, and behave as those of a loaded run directory: they are loaded if complete,
+  resumed if incomplete, and created and filled otherwise */
+  unsigned long long sources_key = 0, transfers_key = 0;
+
+  if (ppr2->cache_run == _TRUE_) {
+
+    class_test (ppr2->store_sources_mmap == _TRUE_,
+      errmsg,
+      "the run cache (run_cache_dir) cannot store the memory-mapped sources (store_sources_mmap=yes)");
+
+    class_call (input2_run_cache_keys (pfc, &sources_key, &transfers_key, errmsg),
+      errmsg,
+      errmsg);
+
+    ppr2->store_sources_to_disk = _TRUE_;
+    sprintf(ppt2->sources_dir, "%s/sources_%016llx", ppr2->run_cache_dir, sources_key);
+
+    /* The cache directory itself is shared by all runs */
+    if (ppr2->mpi_rank == 0) {
+      struct stat st;
+      class_test ((stat(ppr2->run_cache_dir, &st) != 0) && (mkdir (ppr2->run_cache_dir, 0777) != 0),
+        errmsg,
+        "could not create the run cache directory '%s'", ppr2->run_cache_dir);
     }
-    /* Otherwise, create it */
-    else if (ppr2->store_sources_to_disk == _TRUE_) {
-              
-      if (ppt2->perturbations2_verbose > 1)
-        printf (" -> source functions folder not found in run directory, will create it.\n");
 
-      class_test (mkdir (ppt2->sources_dir, 0777)!=0,
+    /* Unless the user chose another directory, keep the projection functions in the run cache too */
+    if (ppr2->cache_projection_functions == _FALSE_) {
+      ppr2->cache_projection_functions = _TRUE_;
+      strcpy (ppr2->projection_functions_cache_dir, ppr2->run_cache_dir);
+    }
+
+    if (ppt2->perturbations2_verbose > 1)
+      printf (" -> using the run cache in '%s'\n", ppr2->run_cache_dir);
+  }
+  else {
+    sprintf(ppt2->sources_dir, "%s/sources", ppr->data_dir);
+  }
+
+  short reuse_sources_dir = (ppr->load_run == _TRUE_) || (ppr2->cache_run == _TRUE_);
+
+  /* The status file keeps track of the sources files that are complete, so that an
+  interrupted run can be resumed; see perturb2_sources_status_init() */
+  sprintf(ppt2->sources_status_path, "%s/sources_status.txt", ppt2->sources_dir);
+  short has_sources_status = (ppr2->store_sources_to_disk == _TRUE_) && (ppr2->store_sources_mmap == _FALSE_);
+
+  /* When running with MPI, only the first process creates the directory and decides whether
+  to load or resume the sources; the others are told by input2_mpi_share_disk_flags() */
+  if (ppr2->mpi_rank == 0) {
+
+    /* If we are not loading from disk, just create the source directory */
+    if ((ppr2->store_sources_to_disk == _TRUE_) && (reuse_sources_dir == _FALSE_)) {
+    
+      class_test (mkdir (ppt2->sources_dir, 0777) != 0,
         errmsg,
         "could not create directory '%s', maybe it already exists?", ppt2->sources_dir);
+
+      if (has_sources_status == _TRUE_) {
+        class_open (ppt2->sources_status_file, ppt2->sources_status_path, "w", errmsg);
+        fclose (ppt2->sources_status_file);
+      }
+    }
+    /* If we are in a run directory, checks if it already contains the source functions */
+    else if (reuse_sources_dir == _TRUE_) {
+
+      struct stat st;
+      short sources_dir_exists = (stat(ppt2->sources_dir, &st)==0);
+
+      short sources_status_exists, sources_are_complete;
+      class_call (input2_read_status_file (
+                    ppt2->sources_status_path,
+                    &sources_status_exists,
+                    &sources_are_complete,
+                    errmsg),
+        errmsg,
+        errmsg);
+
+      /* If the sources directory was left incomplete by an interrupted run, compute
+      the missing source functions and store them in it */
+      if (sources_dir_exists && sources_status_exists && (sources_are_complete == _FALSE_)) {
+        ppr2->store_sources_to_disk = _TRUE_;
+        ppr2->store_sources_mmap = _FALSE_;
+        ppr2->load_sources_from_disk = _FALSE_;
+        if (ppt2->perturbations2_verbose > 1)
+          printf (" -> found incomplete source functions folder in run directory, will resume it.\n");
+      }
+      /* If the sources directory exists, then we shall load the 2nd-order source functions from it */
+      else if (sources_dir_exists) {
+        ppr2->store_sources_to_disk = _FALSE_;
+        ppr2->load_sources_from_disk = _TRUE_;
+        if (ppt2->perturbations2_verbose > 1)
+          printf (" -> found source functions folder in run directory.\n");
+      }
+      /* Otherwise, create it */
+      else if (ppr2->store_sources_to_disk == _TRUE_) {
+              
+        if (ppt2->perturbations2_verbose > 1)
+          printf (" -> source functions folder not found in run directory, will create it.\n");
+
+        class_test (mkdir (ppt2->sources_dir, 0777)!=0,
+          errmsg,
+          "could not create directory '%s', maybe it already exists?", ppt2->sources_dir);
+
+        if (has_sources_status == _TRUE_) {
+          class_open (ppt2->sources_status_file, ppt2->sources_status_path, "w", errmsg);
+          fclose (ppt2->sources_status_file);
+        }
         
-      ppr2->load_sources_from_disk = _FALSE_;
+        ppr2->load_sources_from_disk = _FALSE_;
+      }
     }
-  }
 
-  /* Create/open the status file. The 'a+' mode means that if the file does not exist it will be created,
-  but if it exist it won't be erased (append mode) */
-  // if (ppr2->store_sources_to_disk == _TRUE_) {
-  //   sprintf(ppt2->sources_status_path, "%s/sources_status_file.txt", ppr->data_dir);
-  //   class_open(ppt2->sources_status_file, ppt2->sources_status_path, "a+", errmsg);
-  // }
+  } // end of if(mpi_rank==0)
 
   class_test ((ppr2->store_sources_to_disk == _TRUE_) && (ppr2->load_sources_from_disk == _TRUE_),
     errmsg,
@@ -1644,53 +1963,128 @@ int input2_init (
   if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL)))
     ppr2->store_transfers_to_disk = _TRUE_;
 
-  sprintf(ptr2->transfers_dir, "%s/transfers", ppr->data_dir);
+  if (ppr2->cache_run == _TRUE_) {
+    ppr2->store_transfers_to_disk = _TRUE_;
+    sprintf(ptr2->transfers_dir, "%s/transfers_%016llx", ppr2->run_cache_dir, transfers_key);
+  }
+  else {
+    sprintf(ptr2->transfers_dir, "%s/transfers", ppr->data_dir);
+  }
+
+  /* The status file keeps track of the k1 levels that are complete in the transfers
+  files, so that an interrupted run can be resumed; see transfer2_transfers_status_init() */
+  sprintf(ptr2->transfers_status_path, "%s/transfers_status.txt", ptr2->transfers_dir);
 
-  /* If we are not loading from disk, just create the transfer directory */
-  if ((ppr2->store_transfers_to_disk == _TRUE_) && (ppr->load_run == _FALSE_)) {
+  /* As for the sources, only the first process creates the directory */
+  if (ppr2->mpi_rank == 0) {
+
+    /* If we are not loading from disk, just create the transfer directory */
+    if ((ppr2->store_transfers_to_disk == _TRUE_) && (reuse_sources_dir == _FALSE_)) {
     
-    class_test (mkdir (ptr2->transfers_dir, 0777) != 0,
-      errmsg,
-      "could not create directory '%s', maybe it already exists?", ptr2->transfers_dir);
-  }
-  /* If we are in a run directory, checks if it already contains the transfer functions */
-  else if (ppr->load_run == _TRUE_) {
-
-    struct stat st;
-    short transfers_dir_exists = (stat(ptr2->transfers_dir, &st)==0);
-
-    /* If the transfers directory exists, then we shall load the 2nd-order transfer functions from it */
-    if (transfers_dir_exists) {
-      ppr2->store_transfers_to_disk = _FALSE_;
-      ppr2->load_transfers_from_disk = _TRUE_;
-      if (ptr2->transfer2_verbose > 1)
-        printf (" -> found transfer functions folder in run directory.\n");
+      class_test (mkdir (ptr2->transfers_dir, 0777) != 0,
+        errmsg,
+        "could not create directory '%s', maybe it already exists?", ptr2->transfers_dir);
+
+      class_open (ptr2->transfers_status_file, ptr2->transfers_status_path, "w", errmsg);
+      fclose (ptr2->transfers_status_file);
     }
-    /* Otherwise, create it */
-    else if (ppr2->store_transfers_to_disk == _TRUE_) {
+    /* If we are in a run directory, checks if it already contains the transfer functions */
+    else if (reuse_sources_dir == _TRUE_) {
+
+      struct stat st;
+      short transfers_dir_exists = (stat(ptr2->transfers_dir, &st)==0);
+
+      short transfers_status_exists, transfers_are_complete;
+      class_call (input2_read_status_file (
+                    ptr2->transfers_status_path,
+                    &transfers_status_exists,
+                    &transfers_are_complete,
+                    errmsg),
+        errmsg,
+        errmsg);
+
+      /* If the transfers directory was left incomplete by an interrupted run, compute
+      the missing transfer functions and store them in it */
+      if (transfers_dir_exists && transfers_status_exists && (transfers_are_complete == _FALSE_)) {
+        ppr2->store_transfers_to_disk = _TRUE_;
+        ppr2->load_transfers_from_disk = _FALSE_;
+        if (ptr2->transfer2_verbose > 1)
+          printf (" -> found incomplete transfer functions folder in run directory, will resume it.\n");
+      }
+      /* If the transfers directory exists, then we shall load the 2nd-order transfer functions from it */
+      else if (transfers_dir_exists) {
+        ppr2->store_transfers_to_disk = _FALSE_;
+        ppr2->load_transfers_from_disk = _TRUE_;
+        if (ptr2->transfer2_verbose > 1)
+          printf (" -> found transfer functions folder in run directory.\n");
+      }
+      /* Otherwise, create it */
+      else if (ppr2->store_transfers_to_disk == _TRUE_) {
               
-      if (ptr2->transfer2_verbose > 1)
-        printf (" -> transfer functions folder not found in run directory, will create it.\n");
+        if (ptr2->transfer2_verbose > 1)
+          printf (" -> transfer functions folder not found in run directory, will create it.\n");
 
-      class_test (mkdir (ptr2->transfers_dir, 0777)!=0,
-        errmsg,
-        "could not create directory '%s', maybe it already exists?", ptr2->transfers_dir);
+        class_test (mkdir (ptr2->transfers_dir, 0777)!=0,
+          errmsg,
+          "could not create directory '%s', maybe it already exists?", ptr2->transfers_dir);
+
+        class_open (ptr2->transfers_status_file, ptr2->transfers_status_path, "w", errmsg);
+        fclose (ptr2->transfers_status_file);
         
-      ppr2->load_transfers_from_disk = _FALSE_;
+        ppr2->load_transfers_from_disk = _FALSE_;
+      }
     }
-  }
 
-  /* Create/open the status file. The 'a+' mode means that if the file does not exist it will be created,
-  but if it exist it won't be erased (append mode) */
-  // if (ppr2->store_transfers_to_disk == _TRUE_) {
-  //   sprintf(ptr2->transfers_status_path, "%s/transfers_status_file.txt", ppr->data_dir);
-  //   class_open(ptr2->transfers_status_file, ptr2->transfers_status_path, "a+", errmsg);
-  // }
+  } // end of if(mpi_rank==0)
 
   class_test ((ppr2->store_transfers_to_disk == _TRUE_) && (ppr2->load_transfers_from_disk == _TRUE_),
     errmsg,
     "cannot load and save transfers at the same time!");
-    
+
+  /* Tell the other processes what the first one decided about the sources and transfers
+  directories */
+  class_call (input2_mpi_share_disk_flags (ppr2, errmsg),
+    errmsg,
+    errmsg);
+
+  /* The processes exchange the k1 levels through the disk */
+  class_test ((ppr2->mpi_size > 1)
+    && (ppr2->store_sources_to_disk == _FALSE_) && (ppr2->load_sources_from_disk == _FALSE_),
+    errmsg,
+    "when running with more than one MPI process, set store_sources=yes");
+
+  class_test ((ppr2->mpi_size > 1)
+    && (ppr2->store_transfers_to_disk == _FALSE_) && (ppr2->load_transfers_from_disk == _FALSE_),
+    errmsg,
+    "when running with more than one MPI process, set store_transfers=yes");
+
+  class_test ((ppr2->mpi_size > 1)
+    && (ppr2->store_sources_to_disk == _TRUE_) && (ppr2->store_sources_mmap == _TRUE_),
+    errmsg,
+    "the memory-mapped sources (store_sources_mmap=yes) cannot be shared between MPI processes");
+
+  /* The streamed transfer functions are computed inside the bispectrum module and never kept
+  in full; there is nothing to stream if they are read from a previous run */
+  if ((ppr2->stream_transfers == _TRUE_) && (ppr2->load_transfers_from_disk == _TRUE_)) {
+    ppr2->stream_transfers = _FALSE_;
+    if (ptr2->transfer2_verbose > 1)
+      printf (" -> transfer functions will be read from disk, ignoring stream_transfers.\n");
+  }
+
+  class_test ((ppr2->stream_transfers == _TRUE_) && (ppr2->store_transfers_to_disk == _TRUE_),
+    errmsg,
+    "stream_transfers=yes is not compatible with store_transfers=yes or with run_cache_dir");
+
+  class_test ((ppr2->stream_transfers == _TRUE_)
+    && ((ppt2->has_cmb_spectra == _TRUE_) || (ptr2->stop_at_transfers2 == _TRUE_)),
+    errmsg,
+    "stream_transfers=yes is not compatible with the second-order spectra and with stop_at_transfers2");
+
+  /* The streamed transfer functions are used only by the intrinsic bispectrum */
+  class_test ((ppr2->stream_transfers == _TRUE_) && (ppt2->has_cmb_bispectra == _FALSE_),
+    errmsg,
+    "stream_transfers=yes requires the intrinsic bispectrum (bispectrum_types=intrinsic)");
+
 
   // =============================================================================================
   // =                                  Interpolation techniques                                 =
@@ -2024,6 +2418,174 @@ int input2_init (
  * All default parameter values (for input parameters)
  */
 
+/**
+ * Read the status file of a sources or transfers directory.
+ *
+ * The status file is created empty together with the directory, and its
+ * last line is "complete" only if the directory was fully written; see
+ * perturb2_sources_status_init() and transfer2_transfers_status_init().
+ * Directories produced by older versions of SONG have no status file and
+ * are assumed to be complete.
+ */
+
+int input2_read_status_file (
+         char * status_path,
+         short * exists,
+         short * is_complete,
+         ErrorMsg errmsg
+         )
+{
+
+  FILE * status_file = fopen (status_path, "r");
+
+  *exists = (status_file != NULL);
+  *is_complete = _FALSE_;
+
+  if (*exists == _FALSE_)
+    return _SUCCESS_;
+
+  char line[_LINE_LENGTH_MAX_];
+
+  while (fgets (line, _LINE_LENGTH_MAX_, status_file) != NULL)
+    *is_complete = (strncmp (line, "complete", 8) == 0);
+
+  fclose (status_file);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Share with all the MPI processes the flags that determine whether the sources
+ * and transfer functions are stored to or loaded from disk.
+ *
+ * These flags depend on the content of the run directory, which is inspected and
+ * modified only by the first process (mpi_rank=0). Without MPI, this function does
+ * nothing.
+ */
+
+int input2_mpi_share_disk_flags (
+         struct precision2 * ppr2,
+         ErrorMsg errmsg
+         )
+{
+
+  #ifdef _MPI
+  if (ppr2->mpi_size == 1)
+    return _SUCCESS_;
+
+  short flags[] = {
+    ppr2->store_sources_to_disk,
+    ppr2->store_sources_mmap,
+    ppr2->load_sources_from_disk,
+    ppr2->store_transfers_to_disk,
+    ppr2->load_transfers_from_disk
+  };
+
+  class_test (MPI_Bcast (flags, 5, MPI_SHORT, 0, MPI_COMM_WORLD) != MPI_SUCCESS,
+    errmsg,
+    "could not broadcast the disk storage flags");
+
+  ppr2->store_sources_to_disk = flags[0];
+  ppr2->store_sources_mmap = flags[1];
+  ppr2->load_sources_from_disk = flags[2];
+  ppr2->store_transfers_to_disk = flags[3];
+  ppr2->load_transfers_from_disk = flags[4];
+  #endif
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Compute the keys identifying the line-of-sight sources and the transfer
+ * functions of the current run in the run cache (ppr2->run_cache_dir).
+ *
+ * Each key is a hash of the "name = value" pairs in the parameter files,
+ * except for those that cannot affect the considered module. The pairs are
+ * hashed separately and summed, so that the key does not depend on the order
+ * of the parameters. A parameter that is not excluded below can only cause
+ * a recomputation, never the reuse of wrong results; therefore, new parameters
+ * need to be added to the lists only if they do not affect the module.
+ *
+ * The transfers key hashes all the parameters of the sources key, so that
+ * new sources always give new transfer functions.
+ */
+
+int input2_run_cache_keys (
+         struct file_content * pfc,
+         unsigned long long * sources_key,
+         unsigned long long * transfers_key,
+         ErrorMsg errmsg
+         )
+{
+
+  /* Parameters that affect neither the sources nor the transfer functions: file
+  locations, storage and performance options that do not change the result, and the
+  bispectrum and the primordial spectrum, which are computed afterwards. The parameters
+  ending with "_verbose" are excluded too. */
+  char * not_in_transfers[] = {
+    "root", "data_directory", "run_directory", "append_date", "store_run", "store_sources",
+    "store_transfers", "store_bispectra", "prefetch_sources", "numa_domains", "write_run_report",
+    "run_cache_dir", "projection_functions_cache_dir", "geometrical_factors_cache_dir",
+    "cache_geometrical_factors", "cache_quadsources", "check_jacobian_pattern", "batch_transfers",
+    "tile_intrinsic_bispectrum", "scalar_bispectrum_kernels", "stream_transfers", "add_quadratic_correction", "bispectrum_types",
+    "bispectrum_triangles", "l_squeezed", "bispectra_r_sampling", "bispectra_interpolation",
+    "bispectra_k3_extrapolation", "r_left", "r_right", "r_size", "output_binary_bispectra", "A_s",
+    "n_s", "k_pivot", "dump_debug_files"
+  };
+
+  /* Parameters of the bessel, bessel2 and transfer2 modules, which do not affect the sources */
+  char * not_in_sources[] = {
+    "l_linstep", "l_logstep", "q_linstep", "bessel_x_step", "bessel_j_cut", "bessel_tol_x_min",
+    "bessels_interpolation", "bessel_x_step_song", "bessel_x_step_2nd_order", "bessel_j_cut_song",
+    "bessel_j_cut_2nd_order", "bessel_J_cut_song", "bessel_J_cut_2nd_order", "bessel_J_adaptive_tol_song",
+    "compact_projection_functions", "transfer2_k_sampling", "transfer2_k3_sampling", "q_linstep_song",
+    "k_step_trans_scalars_2nd_order", "transfer2_tau_sampling", "tau_linstep_song", "tau_step_trans_song",
+    "tau_step_trans_2nd_order", "sources_time_interpolation", "sources_k3_interpolation"
+  };
+
+  int not_in_transfers_size = sizeof(not_in_transfers)/sizeof(char *);
+  int not_in_sources_size = sizeof(not_in_sources)/sizeof(char *);
+
+  *sources_key = 0;
+  *transfers_key = 0;
+
+  for (int i=0; i < pfc->size; ++i) {
+
+    char * name = pfc->name[i];
+
+    short in_transfers = (strlen (name) < 8) || (strcmp (name + strlen(name) - 8, "_verbose") != 0);
+    for (int j=0; j < not_in_transfers_size; ++j)
+      if (strcmp (name, not_in_transfers[j]) == 0)
+        in_transfers = _FALSE_;
+
+    short in_sources = in_transfers;
+    for (int j=0; j < not_in_sources_size; ++j)
+      if (strcmp (name, not_in_sources[j]) == 0)
+        in_sources = _FALSE_;
+
+    unsigned long long hash = _CHECKSUM_SEED_;
+    perturb2_checksum (name, strlen (name), &hash);
+    perturb2_checksum ("=", 1, &hash);
+    perturb2_checksum (pfc->value[i], strlen (pfc->value[i]), &hash);
+
+    if (in_sources == _TRUE_)
+      *sources_key += hash;
+    if (in_transfers == _TRUE_)
+      *transfers_key += hash;
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+
 int input2_default_params (
        struct background *pba,
        struct thermo *pth,
@@ -2188,6 +2750,7 @@ int input2_default_params (
   ppt2->output_class_perturbations = _TRUE_;
   ppt2->output_quadratic_sources = _FALSE_;
   ppt2->k_out_mode = _FALSE_;
+  ppt2->kept_couplings = NULL;
           
 
   // =============================================================
@@ -2196,6 +2759,7 @@ int input2_default_params (
 
   pbs2->bessels2_verbose = 0;
   pbs2->extend_l1_using_m = _FALSE_;
+  pbs2->kept_J = NULL;
 
   
   // ============================================================
@@ -2312,6 +2876,8 @@ int input2_default_precision ( struct precision2 * ppr2 ) {
   /* k-triangular */
   ppr2->k3_size_min = 5;
   ppr2->k3_size = 100;
+  ppr2->k3_adaptive_tol = 0;
+  ppr2->k3_adaptive_stride = 8;
   
 
   // ====================================================================
@@ -2321,6 +2887,7 @@ int input2_default_precision ( struct precision2 * ppr2 ) {
   ppr2->bessel_j_cut_song = 1e-12;
   ppr2->bessel_J_cut_song = 1e-6;
   ppr2->bessel_x_step_song = 0.2;
+  ppr2->bessel_J_adaptive_tol_song = 0;
 
 
 
@@ -2331,6 +2898,35 @@ int input2_default_precision ( struct precision2 * ppr2 ) {
   ppr2->sources_time_interpolation = linear_interpolation;
   ppr2->sources_k3_interpolation = linear_interpolation;
 
+
+  // ===============================================================================
+  // =                                   Performance                               =
+  // ===============================================================================
+
+  ppr2->cache_quadsources = _FALSE_;
+  ppr2->sources_cutoff_song = 0;
+  ppr2->check_jacobian_pattern = _FALSE_;
+  ppr2->store_sources_mmap = _FALSE_;
+  ppr2->disk_compression = block_compression_none;
+  ppr2->disk_compression_tolerance = 1e-6;
+  ppr2->prefetch_sources = _FALSE_;
+  ppr2->numa_domains = 1;
+  ppr2->write_run_report = _FALSE_;
+  ppr2->batch_transfers = _FALSE_;
+  ppr2->compact_projection_functions = _FALSE_;
+  ppr2->cache_projection_functions = _FALSE_;
+  ppr2->cache_run = _FALSE_;
+  strcpy (ppr2->run_cache_dir, "");
+  ppr2->tile_intrinsic_bispectrum = _FALSE_;
+  ppr2->scalar_bispectrum_kernels = _FALSE_;
+  ppr2->stream_transfers = _FALSE_;
+  ppr2->cache_geometrical_factors = _FALSE_;
+  strcpy (ppr2->geometrical_factors_cache_dir, "");
+  ppr2->kept_geometrical_factors = NULL;
+  ppr2->bispectrum_triangles = all_triangles;
+  ppr2->l_squeezed = -1;
+  ppr2->triangle_size = 0;
+
   
   // ===============================================================================
   // =                                  Technical stuff                            =
@@ -2342,6 +2938,19 @@ int input2_default_precision ( struct precision2 * ppr2 ) {
   ppr2->store_transfers_to_disk = _FALSE_;
   ppr2->load_transfers_from_disk = _FALSE_;
 
+  run_report_init (&(ppr2->report));
+
+  ppr2->mpi_rank = 0;
+  ppr2->mpi_size = 1;
+  #ifdef _MPI
+  int mpi_initialised;
+  MPI_Initialized (&mpi_initialised);
+  if (mpi_initialised) {
+    MPI_Comm_rank (MPI_COMM_WORLD, &(ppr2->mpi_rank));
+    MPI_Comm_size (MPI_COMM_WORLD, &(ppr2->mpi_size));
+  }
+  #endif
+
   return _SUCCESS_;
 
 }
@@ -2351,6 +2960,8 @@ int input2_free (struct precision2 * ppr2)
 {
   
   free(ppr2->index_m_max);
+
+  run_report_free (&(ppr2->report));
     
   return _SUCCESS_;
   
@@ -40,6 +40,9 @@
 
 
 #include "perturbations2.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 /**
  * Fill all the fields in the perturbs2 structure, especially the ppt2->sources
@@ -100,6 +103,13 @@ int perturb2_init (
   if (ppt2->perturbations2_verbose > 0)
     printf("Computing second-order perturbations\n");
 
+  /* Filled only if the run report is requested and the sources are computed */
+  ppt2->ode_stats = NULL;
+
+  /* Set below, when the structures can be freed even if a later step fails */
+  ppt2->is_freeable = _FALSE_;
+  ppt2->has_solved_perturbations1 = _FALSE_;
+
 
 
   // ====================================================================================
@@ -132,6 +142,50 @@ int perturb2_init (
     ppt2->error_message);
 
 
+  /* Assign each k1 level to an MPI process */
+  double * k1_cost;
+  class_alloc (k1_cost, ppt2->k_size*sizeof(double), ppt2->error_message);
+  class_alloc (ppt2->k1_rank, ppt2->k_size*sizeof(int), ppt2->error_message);
+
+  for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1) {
+    k1_cost[index_k1] = 0;
+    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2)
+      k1_cost[index_k1] += perturb2_k1k2_cost (ppt2, index_k1, index_k2);
+  }
+
+  class_call (perturb2_assign_k1_to_ranks (
+                ppr2,
+                ppt2->k_size,
+                k1_cost,
+                ppt2->k1_rank,
+                ppt2->error_message),
+    ppt2->error_message,
+    ppt2->error_message);
+
+  free (k1_cost);
+
+  /* Keep track of the sources files that are complete, so that an interrupted run can
+  be resumed. This is not done for the memory-mapped sources. */
+  ppt2->has_stored_sources = NULL;
+
+  if ((ppr2->store_sources_to_disk == _TRUE_) && (ppr2->store_sources_mmap == _FALSE_))
+    class_call (perturb2_sources_status_init (ppr2, ppt2),
+      ppt2->error_message,
+      ppt2->error_message);
+
+
+  /* Create or open the memory-mapped file for the sources, if needed */
+
+  class_call (perturb2_sources_map_init (
+                ppr2,
+                ppt2),
+    ppt2->error_message,
+    ppt2->error_message);
+
+  /* From now on, perturb2_free() can be called even if this function fails */
+  ppt2->is_freeable = _TRUE_;
+
+
 
   // ====================================================================================
   // =                            Solve first-order system                              =
@@ -156,6 +210,8 @@ int perturb2_init (
                 pth,
                 ppt),
     ppt->error_message, ppt2->error_message);
+
+  ppt2->has_solved_perturbations1 = _TRUE_;
   
 
   /* Stop here if the user asked to compute only the first-order perturbations */
@@ -277,6 +333,10 @@ int perturb2_init (
       ppt2->error_message);
     
   } if (abort == _TRUE_) return _FAILURE_; // end of parallel region
+
+  if ((ppr2->cache_quadsources == _TRUE_) && (ppt2->perturbations2_verbose > 1))
+    printf(" -> allocated ~ %.3g MB (%ld doubles) for the quadratic sources cache of %d thread(s)\n",
+      ppt2->count_allocated_for_cache*sizeof(double)/1e6, ppt2->count_allocated_for_cache, number_of_threads);
   
   
 
@@ -284,33 +344,113 @@ int perturb2_init (
   // =                             Solve differential system                            =
   // ====================================================================================
 
+  /* IMPORTANT: we are assuming that the quadratic sources are given in a form symmetric
+  under exchange of k1 and k2.  Hence, we shall solve the system only for those k2 that
+  are equal to or larger than k1, which means that the cycle on k2 will stop when
+  index_k2 = index_k1. The perturbations for k1<k2 will be obtained in the subsequent
+  modules by applying a (-1)^m factor. For more details, see Sec. B.2 of
+  http://arxiv.org/abs/1405.2280. */
+
+  /* Rather than parallelising the loop on k1, which would leave most threads idle while
+  the last few high-k1 levels are being computed, we build a queue of (k1,k2) pairs sorted
+  by their expected cost, and let the threads pick pairs from it dynamically. All the k3
+  modes of a given pair are solved by the same thread. See perturb2_k1k2_queue() for
+  details on the cost estimate. */
+  int pair_size;
+  struct perturb2_k1k2_pair * pairs;
+
+  class_call (perturb2_k1k2_queue (
+                ppr2,
+                ppt2,
+                &pair_size,
+                &pairs),
+    ppt2->error_message,
+    ppt2->error_message);
+
+  /* Number of (k1,k2) pairs that still need to be computed for each k1; when it hits
+  zero, the k1 level of ppt2->sources is complete and can be stored to disk */
+  int * pairs_left;
+  class_alloc (pairs_left, ppt2->k_size*sizeof(int), ppt2->error_message);
+  for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1)
+    pairs_left[index_k1] = index_k1 + 1;
+
+  /* Statistics of the differential system for each (k1,k2,k3) mode, for the run report */
+  if (ppr2->write_run_report == _TRUE_) {
+
+    class_alloc (ppt2->ode_stats, ppt2->k_size*sizeof(struct perturb2_ode_stats **), ppt2->error_message);
+
+    for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1) {
+
+      class_alloc (ppt2->ode_stats[index_k1], (index_k1+1)*sizeof(struct perturb2_ode_stats *), ppt2->error_message);
+
+      for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2)
+        class_calloc (ppt2->ode_stats[index_k1][index_k2], MAX (1, ppt2->k3_size[index_k1][index_k2]),
+          sizeof(struct perturb2_ode_stats), ppt2->error_message);
+    }
+  }
+
+  /* Time spent by each thread solving the pairs */
+  int index_region;
+  class_call (run_report_region (&(ppr2->report), "perturb2_solve", "modes", number_of_threads,
+                &index_region, ppt2->error_message),
+    ppt2->error_message,
+    ppt2->error_message);
+
+  double region_start = run_report_time();
+
   /* Beginning of parallel region */
   abort = _FALSE_;    
 
-  /* Loops over k1, k2, k3 follow */
-  #pragma omp parallel for private (thread) schedule (dynamic)
-  for (int index_k1 = ppt2->k_size-1; index_k1 >= 0; --index_k1) {
+  /* Loops over the (k1,k2) pairs and k3 follow */
+  #pragma omp parallel for private (thread) schedule (dynamic,1)
+  for (int index_pair = 0; index_pair < pair_size; ++index_pair) {
 
     #ifdef _OPENMP
     thread = omp_get_thread_num();
     #endif
 
-    if (ppt2->perturbations2_verbose > 1)
-      printf ("     * computing sources for index_k1=%d of %d, k1=%g\n",
-        index_k1, ppt2->k_size-1, ppt2->k[index_k1]);
+    double busy_start = run_report_time();
 
-    /* Allocate the k1 level of ppt2->sources, so that it can be filled by perturb2_solve() */
-    class_call_parallel (perturb2_allocate_k1_level (ppt2, index_k1),
-      ppt2->error_message, ppt2->error_message);
+    int index_k1 = pairs[index_pair].index_k1;
+    int index_k2 = pairs[index_pair].index_k2;
 
-    /* IMPORTANT: we are assuming that the quadratic sources are given in a form symmetric
-    under exchange of k1 and k2.  Hence, we shall solve the system only for those k2 that
-    are equal to or larger than k1, which means that the cycle on k2 will stop when
-    index_k2 = index_k1. The perturbations for k1<k2 will be obtained in the subsequent
-    modules by applying a (-1)^m factor. For more details, see Sec. B.2 of
-    http://arxiv.org/abs/1405.2280. */
-      
-    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+    /* Allocate the k1 level of ppt2->sources, so that it can be filled by perturb2_solve().
+    The first thread that needs a given k1 level is in charge of allocating it. */
+    #pragma omp critical (perturb2_k1_level)
+    {
+      if ((abort == _FALSE_) && (ppt2->has_allocated_sources[index_k1] == _FALSE_)) {
+
+        if (ppt2->perturbations2_verbose > 1)
+          printf ("     * computing sources for index_k1=%d of %d, k1=%g\n",
+            index_k1, ppt2->k_size-1, ppt2->k[index_k1]);
+
+        class_call_parallel (perturb2_allocate_k1_level (ppt2, index_k1, ppt2->error_message),
+          ppt2->error_message, ppt2->error_message);
+      }
+    }
+
+    /* Number of k3 modes for which the differential system is solved */
+    int k3_solved = ppt2->k3_size[index_k1][index_k2];
+
+    /* Solve only the k3 modes needed to resolve the shape of the sources in k3 */
+    if (ppr2->k3_adaptive_tol > 0) {
+
+      class_call_parallel (perturb2_solve_k3_adaptive (
+                             ppr,
+                             ppr2,
+                             pba,
+                             pth,
+                             ppt,
+                             ppt2,
+                             index_k1,
+                             index_k2,
+                             pppw2[thread],
+                             &k3_solved),
+        ppt2->error_message,
+        ppt2->error_message);
+
+    }
+    else {
 
       for (int index_k3 = 0; index_k3 < ppt2->k3_size[index_k1][index_k2]; ++index_k3) {
 
@@ -329,19 +469,23 @@ int perturb2_init (
           ppt2->error_message);
 
       }  // for k3
+    }
 
-    } // for k2
-
+    /* Keep track of how many pairs are left for this k1 */
+    int k1_pairs_left;
+    #pragma omp atomic capture
+    k1_pairs_left = --pairs_left[index_k1];
 
     /* Dump to file the source function for the considered value of index_k1 and
-    free the associated memory, if requested. The next time we'll need the source
+    free the associated memory, if requested. This is done by the thread that completed
+    the last (k1,k2) pair for this k1. The next time we'll need the source
     function, we shall load it from disk. Note that this kind of output is meant
     to free memory at the expense of disk space, contrary to the binary files
     produced by perturb2_save_perturbations() and the text files produced by
     produced by perturb2_output(), whose purpose is to plot and inspect the
     perturbations and the source function, respectively. */
 
-    if (ppr2->store_sources_to_disk == _TRUE_) {
+    if ((k1_pairs_left == 0) && (ppr2->store_sources_to_disk == _TRUE_)) {
 
       class_call_parallel (perturb2_store_sources_to_disk (
                              ppt2,
@@ -357,9 +501,42 @@ int perturb2_init (
 
     }
 
+    ppr2->report.regions[index_region].busy_time[thread] += run_report_time() - busy_start;
+    ppr2->report.regions[index_region].work[thread] += k3_solved;
+
     #pragma omp flush(abort)
     
-  } if (abort == _TRUE_) return _FAILURE_; // for k1
+  } // for (k1,k2) pairs
+
+  /* If the differential system could not be solved for some mode, free the memory
+  that perturb2_free() cannot reach; the k1 levels of ppt2->sources that were
+  allocated are freed by perturb2_free() */
+  if (abort == _TRUE_) {
+    for (thread = 0; thread < number_of_threads; ++thread)
+      perturb2_workspace_free (ppt2, pba, pppw2[thread]);
+    free (pppw2);
+    free (pairs_left);
+    free (pairs);
+    return _FAILURE_;
+  }
+
+  ppr2->report.regions[index_region].wall_time += run_report_time() - region_start;
+
+  free (pairs_left);
+  free (pairs);
+
+  /* Wait for the other MPI processes to store their k1 levels, which are needed
+  by the transfer2 module */
+  #ifdef _MPI
+  if (ppr2->mpi_size > 1)
+    MPI_Barrier (MPI_COMM_WORLD);
+  #endif
+
+  /* All the k1 levels are on disk: mark the sources directory as complete */
+  if (ppr2->mpi_rank == 0)
+    class_call (perturb2_sources_status_update (ppt2, -1, 0),
+      ppt2->error_message,
+      ppt2->error_message);
 
 
   /* Check that the number of filled values corresponds to the number of allocated space */
@@ -371,6 +548,10 @@ int perturb2_init (
 
   if (ppt2->perturbations2_verbose > 1)
     printf(" -> filled ppt2->sources with %ld values\n", ppt2->count_memorised_sources);
+
+  if ((ppt2->perturbations2_verbose > 1) && (ppt2->count_interpolated_k3 > 0))
+    printf(" -> interpolated the sources in %ld of %ld k-configurations (sources2_k3_adaptive_tol=%g)\n",
+      ppt2->count_interpolated_k3, ppt2->count_k_configurations, ppr2->k3_adaptive_tol);
     
 
 
@@ -442,6 +623,204 @@ int perturb2_init (
 
 
 
+/**
+ * Build the queue of (k1,k2) pairs that will be distributed between the threads
+ * in perturb2_init().
+ *
+ * The cost of solving the differential system for a given (k1,k2) pair grows with
+ * its number of k3 modes and with the magnitude of the wavemodes, because the
+ * number of steps taken by the evolver is roughly proportional to the number
+ * of oscillations of the perturbations over the integration range, that is to
+ * k*tau. We estimate the cost of the pair as the sum over the k3 modes of
+ * 1 + max(k1,k2,k3)*(tau_end-tau_ini), and sort the queue so that the most
+ * expensive pairs come first; the cheap pairs will then fill the gaps at the
+ * end of the parallel loop.
+ *
+ * If the sources are to be stored to disk, the queue is sorted first by k1 (from
+ * the largest to the smallest) and then by cost. In this way only a few k1 levels
+ * of ppt2->sources are in memory at any given time, while still allowing the pairs
+ * of the same k1 to be shared between the threads.
+ *
+ * The queue is written in the array pointed by pairs, which must be freed by
+ * the caller.
+ */
+
+int perturb2_k1k2_queue (
+        struct precision2 * ppr2,
+        struct perturbs2 * ppt2,
+        int * pair_size,               /**< output: number of (k1,k2) pairs in the queue */
+        struct perturb2_k1k2_pair ** pairs  /**< output: queue of (k1,k2) pairs, sorted by cost */
+        )
+{
+
+  *pair_size = ppt2->k_size*(ppt2->k_size+1)/2;
+
+  class_alloc (*pairs, (*pair_size)*sizeof(struct perturb2_k1k2_pair), ppt2->error_message);
+
+  int index_pair = 0;
+
+  for (int index_k1 = ppt2->k_size-1; index_k1 >= 0; --index_k1) {
+
+    /* Skip the k1 levels already stored to disk by an interrupted run, and those
+    assigned to other MPI processes */
+    if ((ppt2->has_stored_sources != NULL) && (ppt2->has_stored_sources[index_k1] == _TRUE_))
+      continue;
+
+    if (ppt2->k1_rank[index_k1] != ppr2->mpi_rank)
+      continue;
+
+    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+
+      (*pairs)[index_pair].index_k1 = index_k1;
+      (*pairs)[index_pair].index_k2 = index_k2;
+      (*pairs)[index_pair].cost = perturb2_k1k2_cost (ppt2, index_k1, index_k2);
+      index_pair++;
+
+    }
+  }
+
+  *pair_size = index_pair;
+
+  if (ppr2->store_sources_to_disk == _TRUE_)
+    qsort (*pairs, *pair_size, sizeof(struct perturb2_k1k2_pair), perturb2_compare_k1k2_pairs_by_k1);
+  else
+    qsort (*pairs, *pair_size, sizeof(struct perturb2_k1k2_pair), perturb2_compare_k1k2_pairs);
+
+  if ((ppt2->perturbations2_verbose > 2) && (*pair_size > 0))
+    printf (" -> distributing %d (k1,k2) pairs between threads; most expensive pair is (%d,%d)\n",
+      *pair_size, (*pairs)[0].index_k1, (*pairs)[0].index_k2);
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Estimate the cost of solving the differential system for all the k3
+ * modes of the (k1,k2) pair; see perturb2_k1k2_queue().
+ */
+
+double perturb2_k1k2_cost (
+        struct perturbs2 * ppt2,
+        int index_k1,
+        int index_k2
+        )
+{
+
+  double tau_range = ppt2->tau_sampling[ppt2->tau_size-1] - ppt2->tau_sampling[0];
+
+  double k12_max = MAX (ppt2->k[index_k1], ppt2->k[index_k2]);
+
+  double cost = 0;
+
+  for (int index_k3 = 0; index_k3 < ppt2->k3_size[index_k1][index_k2]; ++index_k3)
+    cost += 1 + MAX (k12_max, ppt2->k3[index_k1][index_k2][index_k3]) * tau_range;
+
+  return cost;
+
+}
+
+
+/**
+ * Distribute the k1 levels between the MPI processes, so that each process
+ * has roughly the same total cost.
+ *
+ * The levels are considered by decreasing cost and each is assigned to the
+ * process with the smallest total cost so far. The assignment is deterministic,
+ * so that all processes compute the same one without communicating. On output,
+ * k1_rank[index_k1] is the rank of the process in charge of index_k1; without
+ * MPI, or with only one process, it is always zero.
+ *
+ * This function is used for both the line-of-sight sources and the transfer
+ * functions, with the cost of each k1 level given in k1_cost.
+ */
+
+int perturb2_assign_k1_to_ranks (
+        struct precision2 * ppr2,
+        int k_size,
+        double * k1_cost,
+        int * k1_rank,
+        ErrorMsg error_message
+        )
+{
+
+  struct perturb2_k1k2_pair * levels;
+  class_alloc (levels, k_size*sizeof(struct perturb2_k1k2_pair), error_message);
+
+  for (int index_k1 = 0; index_k1 < k_size; ++index_k1) {
+    levels[index_k1].index_k1 = index_k1;
+    levels[index_k1].index_k2 = 0;
+    levels[index_k1].cost = k1_cost[index_k1];
+  }
+
+  qsort (levels, k_size, sizeof(struct perturb2_k1k2_pair), perturb2_compare_k1k2_pairs);
+
+  double * rank_cost;
+  class_calloc (rank_cost, ppr2->mpi_size, sizeof(double), error_message);
+
+  for (int index_level = 0; index_level < k_size; ++index_level) {
+
+    int rank = 0;
+    for (int index_rank = 1; index_rank < ppr2->mpi_size; ++index_rank)
+      if (rank_cost[index_rank] < rank_cost[rank])
+        rank = index_rank;
+
+    k1_rank[levels[index_level].index_k1] = rank;
+    rank_cost[rank] += levels[index_level].cost;
+  }
+
+  free (rank_cost);
+  free (levels);
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Comparison function to sort the (k1,k2) pairs by decreasing cost, to
+ * be passed to qsort().
+ */
+
+int perturb2_compare_k1k2_pairs (
+        const void * a,
+        const void * b
+        )
+{
+
+  double cost_a = ((const struct perturb2_k1k2_pair *)a)->cost;
+  double cost_b = ((const struct perturb2_k1k2_pair *)b)->cost;
+
+  return (cost_a < cost_b) - (cost_a > cost_b);
+
+}
+
+
+/**
+ * Comparison function to sort the (k1,k2) pairs by decreasing k1 and, for
+ * the same k1, by decreasing cost, to be passed to qsort().
+ */
+
+int perturb2_compare_k1k2_pairs_by_k1 (
+        const void * a,
+        const void * b
+        )
+{
+
+  int index_k1_a = ((const struct perturb2_k1k2_pair *)a)->index_k1;
+  int index_k1_b = ((const struct perturb2_k1k2_pair *)b)->index_k1;
+
+  if (index_k1_a != index_k1_b)
+    return index_k1_b - index_k1_a;
+
+  return perturb2_compare_k1k2_pairs (a, b);
+
+}
+
+
+
+
+
 /**
  * Allocate the k1 level of the array for the second-order line of sight
  * sources (ppt2->sources).
@@ -456,17 +835,59 @@ int perturb2_init (
 
 int perturb2_allocate_k1_level(
      struct perturbs2 * ppt2,     /**< pointer to perturbs2 structure */
-     int index_k1                 /**< index in ppt2->k that we want to load the sources for  */
+     int index_k1,                /**< index in ppt2->k that we want to load the sources for  */
+     ErrorMsg error_message       /**< output: error message */
      )
 {
 
   /* Issue an error if ppt2->sources[index_k1] has already been allocated */
   class_test (ppt2->has_allocated_sources[index_k1] == _TRUE_,
-    ppt2->error_message,
+    error_message,
     "the index_k1=%d level of ppt2->sources is already allocated, stop to prevent error",
     index_k1);
 
   long int count=0;
+
+  /* If the sources are memory mapped, map the k1 level of the sources file; the
+  (k3,tau) levels will point inside the mapping rather than being allocated. When
+  we are storing the sources, the mapping is shared, so that ppt2->sources is
+  written directly to the file; when loading, it is private, so that the file is
+  never modified. */
+  struct perturb2_sources_map_block * first_block = NULL;
+
+  if (ppt2->has_sources_map == _TRUE_) {
+
+    size_t length;
+    class_call (perturb2_sources_map_k1_level (ppt2, index_k1, &first_block, &length),
+      ppt2->error_message,
+      error_message);
+
+    ppt2->sources_map[index_k1] = mmap (
+      NULL,
+      length,
+      PROT_READ|PROT_WRITE,
+      (ppt2->sources_map_writable == _TRUE_ ? MAP_SHARED : MAP_PRIVATE),
+      ppt2->sources_map_fd,
+      first_block->offset);
+
+    class_test (ppt2->sources_map[index_k1] == MAP_FAILED,
+      error_message,
+      "could not map %ld bytes of '%s' for index_k1=%d",
+      (long int)length, ppt2->sources_map_path, index_k1);
+  }
+
+  /* Otherwise, allocate all the values of the k1 level in a single block. Use calloc
+  (via arena_init) as we rely on the array to be initialised to zero. */
+  else {
+
+    long int size = 0;
+    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2)
+      size += ppt2->tp2_size * ppt2->tau_size * ppt2->k3_size[index_k1][index_k2];
+
+    class_call (arena_init (&(ppt2->sources_k1_arena[index_k1]), size, error_message),
+      error_message,
+      error_message);
+  }
   
   for (int index_type = 0; index_type < ppt2->tp2_size; index_type++) {
 
@@ -477,16 +898,30 @@ int perturb2_allocate_k1_level(
     class_alloc (
       ppt2->sources[index_type][index_k1],
       (index_k1+1) * sizeof(double *),
-      ppt2->error_message);
+      error_message);
+
+    /* Point the k3-tau level inside the arena */
+    if (ppt2->has_sources_map == _FALSE_) {
+      class_call (arena_take_row (
+                    &(ppt2->sources_k1_arena[index_k1]),
+                    index_k1+1,
+                    ppt2->k3_size[index_k1],
+                    ppt2->tau_size,
+                    ppt2->sources[index_type][index_k1],
+                    error_message),
+        error_message,
+        error_message);
+    }
 
     for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
 
-      /* Allocate k3-tau level. Use calloc as we rely on the array to be initialised to zero. */
-      class_calloc (
-        ppt2->sources[index_type][index_k1][index_k2],
-        ppt2->tau_size*ppt2->k3_size[index_k1][index_k2],
-        sizeof(double),
-        ppt2->error_message);
+      /* Point the k3-tau level to the mapped file. A freshly created file is
+      initialised to zero, as required by perturb2_solve(). */
+      if (ppt2->has_sources_map == _TRUE_) {
+        struct perturb2_sources_map_block * block = first_block + index_type*(index_k1+1) + index_k2;
+        ppt2->sources[index_type][index_k1][index_k2] =
+          (double *)((char *)ppt2->sources_map[index_k1] + (block->offset - first_block->offset));
+      }
     
       #pragma omp atomic
       ppt2->count_allocated_sources += ppt2->tau_size*ppt2->k3_size[index_k1][index_k2];
@@ -520,9 +955,34 @@ int perturb2_allocate_k1_level(
 
 int perturb2_load_sources_from_disk(
         struct perturbs2 * ppt2,
-        int index_k1
+        int index_k1,
+        ErrorMsg error_message
         )
 {
+
+  /* If the sources are memory mapped, there is nothing to read: perturb2_allocate_k1_level()
+  has already pointed ppt2->sources inside the sources file, and the operating system will
+  read from disk only the pages that are actually accessed */
+  if (ppt2->has_sources_map == _TRUE_) {
+
+    class_test (ppt2->has_allocated_sources[index_k1] == _FALSE_,
+      error_message,
+      "the index_k1=%d level of ppt2->sources is not mapped; call perturb2_allocate_k1_level() first",
+      index_k1);
+
+    if (ppt2->perturbations2_verbose > 2)
+      printf("     * mapped line-of-sight source for index_k1=%d from '%s'\n",
+        index_k1, ppt2->sources_map_path);
+
+    long int count = 0;
+    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2)
+      count += ppt2->tp2_size*ppt2->tau_size*ppt2->k3_size[index_k1][index_k2];
+
+    #pragma omp atomic
+    ppt2->count_memorised_sources += count;
+
+    return _SUCCESS_;
+  }
    
   if (ppt2->perturbations2_verbose > 2)
     printf("     * reading line-of-sight source for index_k1=%d from '%s' ... \n",
@@ -531,7 +991,37 @@ int perturb2_load_sources_from_disk(
   /* Open file for reading */
   class_open (ppt2->sources_files[index_k1],
     ppt2->sources_paths[index_k1],
-    "rb", ppt2->error_message);
+    "rb", error_message);
+
+  /* Compressed files start with _BLOCK_MAGIC_ */
+  unsigned long long magic = 0;
+  short is_compressed = (fread (&magic, sizeof(unsigned long long), 1, ppt2->sources_files[index_k1]) == 1)
+    && (magic == _BLOCK_MAGIC_);
+
+  if (is_compressed == _TRUE_) {
+
+    class_call (perturb2_load_sources_compressed (
+                  ppt2,
+                  index_k1,
+                  ppt2->sources_paths[index_k1],
+                  ppt2->sources_files[index_k1],
+                  error_message),
+      error_message,
+      error_message);
+
+    long int count = 0;
+    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2)
+      count += ppt2->tp2_size*ppt2->tau_size*ppt2->k3_size[index_k1][index_k2];
+
+    #pragma omp atomic
+    ppt2->count_memorised_sources += count;
+
+    fclose(ppt2->sources_files[index_k1]);
+
+    return _SUCCESS_;
+  }
+
+  rewind (ppt2->sources_files[index_k1]);
 
   for (int index_tp2 = 0; index_tp2 < ppt2->tp2_size; ++index_tp2) {
   
@@ -543,9 +1033,10 @@ int perturb2_load_sources_from_disk(
                     index_k1,
                     index_k2,
                     ppt2->sources_paths[index_k1],
-                    ppt2->sources_files[index_k1]),
-        ppt2->error_message,
-        ppt2->error_message);
+                    ppt2->sources_files[index_k1],
+                    error_message),
+        error_message,
+        error_message);
 
       /* Update the counter for the values stored in ppt2->sources */
       #pragma omp atomic
@@ -578,7 +1069,8 @@ int perturb2_load_sources_k3_tau(
         int index_k1,
         int index_k2,
         char * filepath,
-        FILE * input_stream
+        FILE * input_stream,
+        ErrorMsg error_message
         )
 {
    
@@ -593,7 +1085,7 @@ int perturb2_load_sources_k3_tau(
                  input_stream);
  
   class_test(n_read != n_to_read,
-    ppt2->error_message,
+    error_message,
     "Error reading from %s; read %d entries but expected %d",
     filepath, n_read, n_to_read);
 
@@ -603,6 +1095,88 @@ int perturb2_load_sources_k3_tau(
 
 
 
+/**
+ * Load from disk the compressed sources for a given k1 value, written by
+ * perturb2_store_sources_compressed(), and store them in ppt2->sources.
+ *
+ * The block index at the end of the file gives the position of each (type,k2)
+ * block. The blocks are read in a single pass and then decompressed in parallel.
+ */
+
+int perturb2_load_sources_compressed(
+        struct perturbs2 * ppt2,
+        int index_k1,
+        char * filepath,
+        FILE * input_stream,
+        ErrorMsg error_message
+        )
+{
+
+  int k2_size = index_k1+1;
+  long int n_blocks = ppt2->tp2_size*k2_size;
+
+  /* Read the block index */
+  long int index_position;
+
+  class_test ((fseek (input_stream, -(long int)sizeof(long int), SEEK_END) != 0)
+           || (fread (&index_position, sizeof(long int), 1, input_stream) != 1),
+    error_message,
+    "could not read the block index of '%s'", filepath);
+
+  long int * block_offset;
+  class_alloc (block_offset, (n_blocks+1)*sizeof(long int), error_message);
+
+  class_test ((fseek (input_stream, index_position, SEEK_SET) != 0)
+           || (fread (block_offset, sizeof(long int), n_blocks+1, input_stream) != (size_t)(n_blocks+1)),
+    error_message,
+    "could not read the block index of '%s'; was it written with a different k sampling?", filepath);
+
+  class_test ((block_offset[0] != sizeof(unsigned long long)) || (block_offset[n_blocks] != index_position),
+    error_message,
+    "the block index of '%s' is corrupted", filepath);
+
+  /* Read all the blocks */
+  long int data_size = block_offset[n_blocks] - block_offset[0];
+
+  unsigned char * data;
+  class_alloc (data, MAX (data_size, 1), error_message);
+
+  class_test ((fseek (input_stream, block_offset[0], SEEK_SET) != 0)
+           || (fread (data, 1, data_size, input_stream) != (size_t)data_size),
+    error_message,
+    "could not read the compressed sources from '%s'", filepath);
+
+  /* Decompress each (type,k2) block in ppt2->sources */
+  int abort = _FALSE_;
+
+  #pragma omp parallel for schedule (dynamic)
+  for (long int index_block = 0; index_block < n_blocks; ++index_block) {
+
+    int index_tp2 = index_block/k2_size;
+    int index_k2 = index_block%k2_size;
+
+    class_call_parallel (block_decompress (
+                           data + block_offset[index_block] - block_offset[0],
+                           block_offset[index_block+1] - block_offset[index_block],
+                           ppt2->sources[index_tp2][index_k1][index_k2],
+                           ppt2->tau_size*ppt2->k3_size[index_k1][index_k2],
+                           error_message),
+      error_message,
+      error_message);
+  }
+
+  free (data);
+  free (block_offset);
+
+  if (abort == _TRUE_)
+    return _FAILURE_;
+
+  return _SUCCESS_;
+
+}
+
+
+
 /**
  * Free the k1 level of the sources array ppt2->sources.
  */
@@ -619,13 +1193,29 @@ int perturb2_free_k1_level(
 
   int k1_size = ppt2->k_size;
 
-  for (int index_type = 0; index_type < ppt2->tp2_size; index_type++) {
-    for (int index_k2 = 0; index_k2 <= index_k1; index_k2++)
-        free(ppt2->sources[index_type][index_k1][index_k2]);
-  
+  for (int index_type = 0; index_type < ppt2->tp2_size; index_type++)
     free(ppt2->sources[index_type][index_k1]);
-  
-  } // end of for (index_type)
+
+  /* Free the values of the sources, that are stored contiguously */
+  if (ppt2->has_sources_map == _FALSE_)
+    arena_free (&(ppt2->sources_k1_arena[index_k1]));
+
+  /* If the sources are memory mapped, release the mapping of the k1 level. The
+  content of a shared mapping is not lost, as it is kept in the page cache until
+  the kernel writes it to the sources file. */
+  if (ppt2->has_sources_map == _TRUE_) {
+
+    size_t length;
+    class_call (perturb2_sources_map_k1_level (ppt2, index_k1, NULL, &length),
+      ppt2->error_message,
+      ppt2->error_message);
+
+    class_test (munmap (ppt2->sources_map[index_k1], length) != 0,
+      ppt2->error_message,
+      "could not unmap the index_k1=%d level of '%s'", index_k1, ppt2->sources_map_path);
+
+    ppt2->sources_map[index_k1] = NULL;
+  }
 
 
   /* We succesfully freed the k1 level of ppt2->sources */
@@ -637,6 +1227,275 @@ int perturb2_free_k1_level(
 
 
 
+/**
+ * Create or open the memory-mapped file for the line-of-sight sources.
+ *
+ * With the memory-mapped storage, the sources are kept in a single file,
+ * sources_dir/sources.map, rather than in one file per k1 value. The file
+ * starts with a perturb2_sources_map_header, followed by an index with the
+ * position of each (k1,tp2,k2) block of ppt2->sources (see the documentation
+ * of ppt2->sources_map_blocks) and by the data itself. The blocks of each k1
+ * are contiguous and start on a page boundary, so that they can be mapped
+ * independently by perturb2_allocate_k1_level().
+ *
+ * There is no explicit read or write of the sources: perturb2_solve() writes
+ * directly in the mapped pages and the subsequent modules read from them,
+ * so that only the source types that are actually accessed are read from disk.
+ *
+ * The memory-mapped storage is used when the user asks to store the sources
+ * with store_sources_mmap=yes, and when loading the sources from a run
+ * directory that contains the sources.map file.
+ *
+ * This function requires ppt2->k3_size and ppt2->tau_size, and therefore
+ * must be called after perturb2_timesampling_for_sources().
+ */
+
+int perturb2_sources_map_init(
+     struct precision2 * ppr2,
+     struct perturbs2 * ppt2
+     )
+{
+
+  ppt2->has_sources_map = _FALSE_;
+  ppt2->sources_map_writable = _FALSE_;
+  ppt2->sources_map_fd = -1;
+  ppt2->sources_map_blocks = NULL;
+  ppt2->sources_map = NULL;
+
+  sprintf (ppt2->sources_map_path, "%s/sources.map", ppt2->sources_dir);
+
+  /* Use the memory-mapped storage when requested, or when the run we are loading
+  from was stored that way */
+  if ((ppr2->store_sources_to_disk == _TRUE_) && (ppr2->store_sources_mmap == _TRUE_)) {
+    ppt2->has_sources_map = _TRUE_;
+    ppt2->sources_map_writable = _TRUE_;
+  }
+  else if (ppr2->load_sources_from_disk == _TRUE_) {
+    struct stat st;
+    ppt2->has_sources_map = (stat(ppt2->sources_map_path, &st)==0);
+  }
+
+  if (ppt2->has_sources_map == _FALSE_)
+    return _SUCCESS_;
+
+  long int n_blocks = (long int)ppt2->tp2_size*ppt2->k_size*(ppt2->k_size+1)/2;
+  long int page_size = sysconf (_SC_PAGESIZE);
+
+  class_alloc (ppt2->sources_map_blocks,
+    n_blocks*sizeof(struct perturb2_sources_map_block),
+    ppt2->error_message);
+
+  class_calloc (ppt2->sources_map,
+    ppt2->k_size,
+    sizeof(void *),
+    ppt2->error_message);
+
+  struct perturb2_sources_map_header header;
+  FILE * map_file;
+
+
+  // -------------------------------------------------------------------------------
+  // -                            Create the sources file                          -
+  // -------------------------------------------------------------------------------
+
+  if (ppt2->sources_map_writable == _TRUE_) {
+
+    /* Build the index of the file, starting each k1 level on a page boundary */
+    long int offset = sizeof(struct perturb2_sources_map_header)
+                    + n_blocks*sizeof(struct perturb2_sources_map_block);
+    long int index_block = 0;
+
+    for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1) {
+
+      offset = ((offset + page_size - 1)/page_size)*page_size;
+
+      for (int index_tp2 = 0; index_tp2 < ppt2->tp2_size; ++index_tp2) {
+        for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+          ppt2->sources_map_blocks[index_block].offset = offset;
+          ppt2->sources_map_blocks[index_block].size = ppt2->tau_size*ppt2->k3_size[index_k1][index_k2];
+          offset += ppt2->sources_map_blocks[index_block].size*sizeof(double);
+          index_block++;
+        }
+      }
+    }
+
+    /* Write header and index */
+    memset (&header, 0, sizeof(struct perturb2_sources_map_header));
+    strcpy (header.magic, "SONGMAP");
+    header.tp2_size = ppt2->tp2_size;
+    header.k_size = ppt2->k_size;
+    header.tau_size = ppt2->tau_size;
+    header.page_size = page_size;
+    header.n_blocks = n_blocks;
+
+    class_open (map_file, ppt2->sources_map_path, "wb", ppt2->error_message);
+
+    class_test ((fwrite (&header, sizeof(struct perturb2_sources_map_header), 1, map_file) != 1)
+             || (fwrite (ppt2->sources_map_blocks, sizeof(struct perturb2_sources_map_block), n_blocks, map_file) != n_blocks),
+      ppt2->error_message,
+      "could not write the index of '%s'", ppt2->sources_map_path);
+
+    /* Extend the file to its final size. The data is not written, so that the file is
+    initialised to zero without actually filling the disk. */
+    class_test ((fseek (map_file, offset-1, SEEK_SET) != 0) || (fputc (0, map_file) == EOF),
+      ppt2->error_message,
+      "could not extend '%s' to %ld bytes", ppt2->sources_map_path, offset);
+
+    fclose (map_file);
+
+    ppt2->sources_map_fd = open (ppt2->sources_map_path, O_RDWR);
+
+    if (ppt2->perturbations2_verbose > 1)
+      printf (" -> line-of-sight sources will be stored in the memory-mapped file '%s' (%.3g MB)\n",
+        ppt2->sources_map_path, offset/1e6);
+  }
+
+
+  // -------------------------------------------------------------------------------
+  // -                             Open the sources file                           -
+  // -------------------------------------------------------------------------------
+
+  else {
+
+    class_open (map_file, ppt2->sources_map_path, "rb", ppt2->error_message);
+
+    class_test (fread (&header, sizeof(struct perturb2_sources_map_header), 1, map_file) != 1,
+      ppt2->error_message,
+      "could not read the header of '%s'", ppt2->sources_map_path);
+
+    class_test (strncmp (header.magic, "SONGMAP", 8) != 0,
+      ppt2->error_message,
+      "'%s' is not a memory-mapped sources file", ppt2->sources_map_path);
+
+    class_test ((header.tp2_size != ppt2->tp2_size) || (header.k_size != ppt2->k_size)
+             || (header.tau_size != ppt2->tau_size) || (header.n_blocks != n_blocks),
+      ppt2->error_message,
+      "the sampling of '%s' (tp2_size=%d, k_size=%d, tau_size=%d) does not match the current run (%d, %d, %d)",
+      ppt2->sources_map_path, header.tp2_size, header.k_size, header.tau_size,
+      ppt2->tp2_size, ppt2->k_size, ppt2->tau_size);
+
+    class_test (fread (ppt2->sources_map_blocks, sizeof(struct perturb2_sources_map_block), n_blocks, map_file) != n_blocks,
+      ppt2->error_message,
+      "could not read the index of '%s'", ppt2->sources_map_path);
+
+    fclose (map_file);
+
+    /* Check that the index is consistent with the k3 sampling and with the page size
+    of this machine, which constrains the offsets that can be mapped */
+    struct stat st;
+    stat (ppt2->sources_map_path, &st);
+    long int index_block = 0;
+
+    for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1) {
+
+      class_test (ppt2->sources_map_blocks[index_block].offset % page_size != 0,
+        ppt2->error_message,
+        "'%s' was created with a page size of %d bytes, which is not compatible with the one of this machine (%ld bytes)",
+        ppt2->sources_map_path, header.page_size, page_size);
+
+      for (int index_tp2 = 0; index_tp2 < ppt2->tp2_size; ++index_tp2) {
+        for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+
+          struct perturb2_sources_map_block * block = &(ppt2->sources_map_blocks[index_block++]);
+
+          class_test (block->size != ppt2->tau_size*ppt2->k3_size[index_k1][index_k2],
+            ppt2->error_message,
+            "the k3 sampling of '%s' for (index_k1,index_k2)=(%d,%d) does not match the current run",
+            ppt2->sources_map_path, index_k1, index_k2);
+
+          class_test (block->offset + block->size*sizeof(double) > st.st_size,
+            ppt2->error_message,
+            "'%s' is truncated; was the run interrupted?", ppt2->sources_map_path);
+        }
+      }
+    }
+
+    ppt2->sources_map_fd = open (ppt2->sources_map_path, O_RDONLY);
+
+    if (ppt2->perturbations2_verbose > 1)
+      printf (" -> line-of-sight sources will be read from the memory-mapped file '%s' (%.3g MB)\n",
+        ppt2->sources_map_path, st.st_size/1e6);
+  }
+
+  class_test (ppt2->sources_map_fd < 0,
+    ppt2->error_message,
+    "could not open '%s'", ppt2->sources_map_path);
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Find the portion of the memory-mapped sources file that contains the
+ * index_k1 level of ppt2->sources.
+ *
+ * The first block of the level is returned in first_block, if not NULL,
+ * and the size of the level in bytes in length.
+ */
+
+int perturb2_sources_map_k1_level(
+     struct perturbs2 * ppt2,
+     int index_k1,
+     struct perturb2_sources_map_block ** first_block,
+     size_t * length
+     )
+{
+
+  long int index_first = (long int)ppt2->tp2_size*index_k1*(index_k1+1)/2;
+  long int index_last = index_first + (long int)ppt2->tp2_size*(index_k1+1) - 1;
+
+  struct perturb2_sources_map_block * first = &(ppt2->sources_map_blocks[index_first]);
+  struct perturb2_sources_map_block * last = &(ppt2->sources_map_blocks[index_last]);
+
+  if (first_block != NULL)
+    *first_block = first;
+
+  *length = last->offset + last->size*sizeof(double) - first->offset;
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Release the memory-mapped sources file and its index.
+ *
+ * The k1 levels that are still mapped are unmapped; their pointer arrays
+ * in ppt2->sources are not freed here, use perturb2_free_k1_level() for that.
+ */
+
+int perturb2_sources_map_free(
+     struct perturbs2 * ppt2
+     )
+{
+
+  for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1) {
+
+    if (ppt2->sources_map[index_k1] != NULL) {
+
+      size_t length;
+      class_call (perturb2_sources_map_k1_level (ppt2, index_k1, NULL, &length),
+        ppt2->error_message,
+        ppt2->error_message);
+
+      munmap (ppt2->sources_map[index_k1], length);
+    }
+  }
+
+  close (ppt2->sources_map_fd);
+
+  free (ppt2->sources_map);
+  free (ppt2->sources_map_blocks);
+
+  ppt2->has_sources_map = _FALSE_;
+
+  return _SUCCESS_;
+
+}
+
+
+
 
 
 
@@ -1048,6 +1907,11 @@ int perturb2_indices_of_perturbs(
   // ================================================================================
   
 
+  /* Compression of the stored sources. When loading, each file tells whether it is
+  compressed, regardless of this flag. */
+  ppt2->sources_compression = ppr2->disk_compression;
+  ppt2->sources_compression_tolerance = ppr2->disk_compression_tolerance;
+
   /* Create the files to store the source functions in */
   if ((ppr2->store_sources_to_disk == _TRUE_) || (ppr2->load_sources_from_disk == _TRUE_)) {
     
@@ -1063,7 +1927,7 @@ int perturb2_indices_of_perturbs(
       
     } // end of loop on index_k1
     
-    if (ppr2->store_sources_to_disk == _TRUE_)
+    if ((ppr2->store_sources_to_disk == _TRUE_) && (ppr2->store_sources_mmap == _FALSE_))
       if (ppt2->perturbations2_verbose > 2)
         printf ("     * will create %d files to store the sources\n", ppt2->k_size);
     
@@ -1269,6 +2133,60 @@ int perturb2_get_lm_lists (
       } // end of for m2
     } // end of for m
   } // end of for l
+
+
+  // ======================================================================================
+  // =                            Choose the free-streaming kernels                       =
+  // ======================================================================================
+
+  /* Copy the C and D coefficients with m1=m, which are the only ones needed by the
+  second-order Boltzmann hierarchies, in contiguous arrays */
+  class_alloc (ppt2->c_minus_mm, n_multipoles*sizeof(double), ppt2->error_message);
+  class_alloc (ppt2->c_plus_mm, n_multipoles*sizeof(double), ppt2->error_message);
+  class_alloc (ppt2->d_minus_mm, n_multipoles*sizeof(double), ppt2->error_message);
+  class_alloc (ppt2->d_plus_mm, n_multipoles*sizeof(double), ppt2->error_message);
+  class_alloc (ppt2->d_zero_mm, n_multipoles*sizeof(double), ppt2->error_message);
+
+  for (int l=0; l <= ppt2->largest_l; ++l) {
+    for (int index_m=0; index_m <= ppr2->index_m_max[l]; ++index_m) {
+      int m = ppr2->m[index_m];
+      ppt2->c_minus_mm[lm(l,m)] = c_minus(l,m,m);
+      ppt2->c_plus_mm[lm(l,m)] = c_plus(l,m,m);
+      ppt2->d_minus_mm[lm(l,m)] = d_minus(l,m,m);
+      ppt2->d_plus_mm[lm(l,m)] = d_plus(l,m,m);
+      ppt2->d_zero_mm[lm(l,m)] = d_zero(l,m,m);
+    }
+  }
+
+  /* The specialised kernels work only if the requested m are 0,...,M-1, for M=1 or
+  M=3, so that for l>2 the (l,m) multipoles are stored with stride M */
+  ppt2->free_streaming_kernel = NULL;
+  ppt2->free_streaming_pol_kernel = NULL;
+
+  int M = ppt2->m_size;
+  short is_regular = ((M == 1) || (M == 3));
+
+  for (int index_m=0; index_m < M; ++index_m)
+    if (ppt2->m[index_m] != index_m)
+      is_regular = _FALSE_;
+
+  for (int l=3; (l <= ppt2->largest_l) && is_regular; ++l)
+    for (int index_m=0; index_m < M; ++index_m)
+      if (ppt2->lm_array[l][index_m] != ppt2->lm_array[3][0] + (l-3)*M + index_m)
+        is_regular = _FALSE_;
+
+  if (is_regular && (M == 1)) {
+    ppt2->free_streaming_kernel = perturb2_free_streaming_scalar;
+    ppt2->free_streaming_pol_kernel = perturb2_free_streaming_pol_scalar;
+  }
+  else if (is_regular && (M == 3)) {
+    ppt2->free_streaming_kernel = perturb2_free_streaming_m012;
+    ppt2->free_streaming_pol_kernel = perturb2_free_streaming_pol_m012;
+  }
+
+  if (ppt2->perturbations2_verbose > 2)
+    printf (" -> using %s kernel for the l>2 multipoles\n",
+      (ppt2->free_streaming_kernel == NULL) ? "the generic" : "a specialised");
   
 
 
@@ -1282,7 +2200,39 @@ int perturb2_get_lm_lists (
   details on what these coefficients are, please refer to the documentation for
   ppt2->coupling_coefficients in perturbations2.c. */
 
-  if ((ppt2->has_cmb == _TRUE_) && (ppt2->use_delta_tilde_in_los == _TRUE_)) {
+  /* The coupling coefficients depend only on the fields and on the multipoles. If the
+  caller keeps them between runs (see ppt2->kept_couplings), reuse those computed by a
+  previous run with the same fields and multipoles. */
+  short has_kept_couplings = _FALSE_;
+  unsigned long long coupling_key = 0;
+
+  if ((ppt2->has_cmb == _TRUE_) && (ppt2->use_delta_tilde_in_los == _TRUE_) && (ppt2->kept_couplings != NULL)) {
+
+    class_call (perturb2_coupling_key (ppr2, ppt2, &coupling_key),
+      ppt2->error_message,
+      ppt2->error_message);
+
+    struct perturb2_couplings * kept = ppt2->kept_couplings;
+
+    if ((kept->coefficients != NULL) && (kept->key == coupling_key)) {
+
+      ppt2->l1_max = MAX (ppr2->l_max_los_quadratic, ppr2->l_max_los_quadratic_p);
+      ppt2->l2_max = MAX (ppr2->l_max_los_quadratic, ppr2->l_max_los_quadratic_p);
+      ppt2->coupling_lm_size = n_multipoles;
+      ppt2->coupling_l2_size = 2*ppt2->largest_l+1;
+
+      ppt2->coupling_coefficients = kept->coefficients;
+      ppt2->coupling_offsets = kept->offsets;
+      ppt2->coupling_size = kept->size;
+
+      has_kept_couplings = _TRUE_;
+
+      if (ppt2->perturbations2_verbose > 1)
+        printf ("     * reusing the %ld coupling coefficients of a previous run\n", kept->size);
+    }
+  }
+
+  if ((ppt2->has_cmb == _TRUE_) && (ppt2->use_delta_tilde_in_los == _TRUE_) && (has_kept_couplings == _FALSE_)) {
 
     /* We compute the coupling coefficients only up to ppr2->l_max_los_quadratic, because
     this is the highest multipole we are gonna consider for the delta_tilde transformation.
@@ -1293,59 +2243,64 @@ int perturb2_get_lm_lists (
 
     /* Derived limits */
     int m1_min = -ppt2->l1_max;
-    int m2_min = -ppt2->l2_max;
     int m1_max = ppt2->l1_max;
-    int m2_max = ppt2->l2_max;
     int l1_size = ppt2->l1_max+1;
-    int l2_size = ppt2->l2_max+1;
-    int m1_size = m1_max-m1_min+1;
-    int m2_size = m2_max-m2_min+1;
-  
+
+    /* For a given (l,l1), the triangular condition leaves at most 2*l+1 values of l2 */
+    ppt2->coupling_lm_size = n_multipoles;
+    ppt2->coupling_l2_size = 2*ppt2->largest_l+1;
+
+
     // --------------------------------------------------------------------------------
     // -                             Allocate coefficients                            -
     // --------------------------------------------------------------------------------
 
+    /* We store only the coefficients allowed by the selection rules of the 3j symbols, that
+    is, those with |l-l1| <= l2 <= l+l1, |m1| <= l1 and |m-m1| <= l2, and with the parity
+    of l+l1+l2 given by the field. All other coefficients vanish, and are never accessed
+    by perturb2_quadratic_sources(). For each (l,m,l1,l2), the allowed m1 are contiguous,
+    so that we only need to record where they start in the flat array; see the
+    documentation of ppt2->coupling_offsets and of the coupling_coefficient() macro. */
+
+    long int offsets_size = (long int)ppt2->pf_size*n_multipoles*l1_size*ppt2->coupling_l2_size;
+
+    class_alloc (ppt2->coupling_offsets, offsets_size*sizeof(long int), ppt2->error_message);
+
+    for (long int i=0; i < offsets_size; ++i)
+      ppt2->coupling_offsets[i] = -1;
+
     long int counter = 0;
 
-    class_alloc (ppt2->coupling_coefficients, ppt2->pf_size*sizeof(double****), ppt2->error_message);
-  
     for (int index_pf=0; index_pf < ppt2->pf_size; ++index_pf) {
-
-      class_alloc (ppt2->coupling_coefficients[index_pf], n_multipoles*sizeof(double***), ppt2->error_message);
-  
       for (int l=0; l <= ppt2->largest_l; ++l) {
         for (int index_m=0; index_m <= ppr2->index_m_max[l]; ++index_m) {
-  
+
           int m = ppr2->m[index_m];
-  
-          class_alloc (ppt2->coupling_coefficients[index_pf][lm(l,m)],
-                       l1_size*sizeof(double**),
-                       ppt2->error_message);
-      
+
           for (int l1=0; l1 <= ppt2->l1_max; ++l1) {
-  
-            class_alloc (ppt2->coupling_coefficients[index_pf][lm(l,m)][l1],
-                         m1_size*sizeof(double*),
-                         ppt2->error_message);
-  
-            for (int m1=m1_min; m1 <= m1_max; ++m1) {
+            for (int l2=abs(l-l1); l2 <= MIN (l+l1, ppt2->l2_max); ++l2) {
 
-              class_calloc (ppt2->coupling_coefficients[index_pf][lm(l,m)][l1][m1-m1_min],
-                           l2_size,
-                           sizeof(double),
-                           ppt2->error_message);
-  
-              counter += l2_size;        
+              int L = l-l1-l2;
+              if ( ((abs(L)%2==0) && (ppt2->field_parity[index_pf]==_ODD_))
+                || ((abs(L)%2!=0) && (ppt2->field_parity[index_pf]==_EVEN_)) )
+                continue;
 
-            } // for m1
+              ppt2->coupling_offsets[coupling_offset_index(index_pf,l,m,l1,l2)] = counter;
+              counter += MAX (MIN(l1,m+l2) - MAX(-l1,m-l2) + 1, 0);
+
+            } // for l2
           } // for l1
         } // for m
       } // for l
-    } // for T,E,B...  
-    
+    } // for T,E,B...
+
+    ppt2->coupling_size = counter;
+
+    class_calloc (ppt2->coupling_coefficients, MAX (counter,1), sizeof(double), ppt2->error_message);
+
     if (ppt2->perturbations2_verbose > 1)
       printf ("     * allocated ~%ld doubles (~%g MB) for the coupling coefficients\n",
-        counter, counter*sizeof(double)/1e6);
+        counter, (counter*sizeof(double) + offsets_size*sizeof(long int))/1e6);
 
 
     // --------------------------------------------------------------------------------
@@ -1392,6 +2347,13 @@ int perturb2_get_lm_lists (
     // ---------------------------------------------------------------------------------------
     // -                              Compute the coefficients                               -
     // ---------------------------------------------------------------------------------------
+
+    /* Each (l3,m1) block writes the coefficients for all the values of m3, l1 and l2, which
+    are disjoint from those of all other blocks. We parallelise over the blocks rather than
+    over (l3,m3) because the 3j symbols computed by coupling_general() for a given m1 serve
+    all values of m3 at once. */
+    int m1_size = m1_max-m1_min+1;
+    int block_size = (ppt2->largest_l+1)*m1_size;
   
     for (int index_pf=0; index_pf < ppt2->pf_size; ++index_pf) {
     
@@ -1424,86 +2386,95 @@ int perturb2_get_lm_lists (
         #endif
 
         #pragma omp for schedule (dynamic)
-        for (int l2=0; l2 <= ppt2->l2_max; ++l2) {
-          for (int l3=0; l3 <= ppt2->largest_l; ++l3) {
+        for (int index_block=0; index_block < block_size; ++index_block) {
+
+          int l3 = index_block/m1_size;
+          int m1 = m1_min + index_block%m1_size;
+
+          /* The range of m3 for this l3 */
+          int m3_min = ppr2->m[0];
+          int m3_max = ppr2->m[ppr2->index_m_max[l3]];
+
+          for (int l2=0; l2 <= ppt2->l2_max; ++l2) {
 
             /* The absolute value of F must be always smaller than l2 and l3. This means
             that the polarisation coefficient vanishes for for l2<2 and l3<2. */
             if ((l2<abs(F)) || (l3<abs(F)))
               continue;
 
-            for (int m1=m1_min; m1 <= m1_max; ++m1) {
+            /* m1 must always be smaller than l1, whose upper limit is l2+l3 */
+            if (abs(m1)>l2+l3)
+              continue;
 
-              /* m1 must always be smaller than l1, whose upper limit is l2+l3 */
-              if (abs(m1)>l2+l3)
-                continue;
+            /* Skip the 3j symbols if no stored m3 satisfies |m2|=|m3-m1|<=l2 */
+            if ((m1-l2>m3_max) || (m1+l2<m3_min))
+              continue;
 
-              /* Compute the following coefficients for all values of l1 and m2: 
-
-              (-1)^m3 * (2*l3+1) * ( l1  l2  l3 ) * (  l1   l2      l3  )
-                                   (  0   F  -F )   (  m1   m2  -m1-m2  ) */
-              int l1_min_3j, l1_max_3j;
-              int m2_min_3j, m2_max_3j;
-
-              class_call_parallel (coupling_general(
-                                     l2, l3, m1, F,
-                                     three_j_000[thread], l_size_max,
-                                     three_j_mmm[thread], l_size_max,
-                                     &l1_min_3j, &l1_max_3j, /* out, allowed l values */
-                                     &m2_min_3j, &m2_max_3j, /* out, allowed m values */
-                                     temp[thread],
-                                     ppt2->error_message),
-                ppt2->error_message,
-                ppt2->error_message);
-                
-              /* Fill the coupling coefficient array, but only for the allowed values of l2 and m1 */
-              for (int l1=0; l1 <= ppt2->l1_max; ++l1) {
+            /* Compute the following coefficients for all values of l1 and m2: 
+
+            (-1)^m3 * (2*l3+1) * ( l1  l2  l3 ) * (  l1   l2      l3  )
+                                 (  0   F  -F )   (  m1   m2  -m1-m2  ) */
+            int l1_min_3j, l1_max_3j;
+            int m2_min_3j, m2_max_3j;
+
+            class_call_parallel (coupling_general(
+                                   l2, l3, m1, F,
+                                   three_j_000[thread], l_size_max,
+                                   three_j_mmm[thread], l_size_max,
+                                   &l1_min_3j, &l1_max_3j, /* out, allowed l values */
+                                   &m2_min_3j, &m2_max_3j, /* out, allowed m values */
+                                   temp[thread],
+                                   ppt2->error_message),
+              ppt2->error_message,
+              ppt2->error_message);
+              
+            /* Fill the coupling coefficient array, but only for the allowed values of l1 and m2 */
+            for (int l1=MAX(abs(m1),l1_min_3j); l1 <= MIN(ppt2->l1_max,l1_max_3j); ++l1) {
 
-                int L = l3-l1-l2;
+              int L = l3-l1-l2;
 
-                /* For even-parity fields (T and E), we skip the configurations where l1+l2+l3 is odd;
-                for odd-parity (B) fields, we skip the configurations where l1+l2+l3 is even */
-                if ( ((abs(L)%2==0) && (ppt2->field_parity[index_pf]==_ODD_))
-                  || ((abs(L)%2!=0) && (ppt2->field_parity[index_pf]==_EVEN_)) )
-                  continue;
-            
-                /* For even-parity fields, the sign-factor is i^L. For sign-parity ones, it is i^(L-1).
-                In both cases, the exponent is even (see above), so that the sign-factor is real-valued */
-                double sign = (ppt2->field_parity[index_pf] == _EVEN_) ?
-                                ALTERNATING_SIGN (abs(L)/2) :
-                                ALTERNATING_SIGN (abs(L-1)/2);
+              /* For even-parity fields (T and E), we skip the configurations where l1+l2+l3 is odd;
+              for odd-parity (B) fields, we skip the configurations where l1+l2+l3 is even */
+              if ( ((abs(L)%2==0) && (ppt2->field_parity[index_pf]==_ODD_))
+                || ((abs(L)%2!=0) && (ppt2->field_parity[index_pf]==_EVEN_)) )
+                continue;
+          
+              /* For even-parity fields, the sign-factor is i^L. For sign-parity ones, it is i^(L-1).
+              In both cases, the exponent is even (see above), so that the sign-factor is real-valued */
+              double sign = (ppt2->field_parity[index_pf] == _EVEN_) ?
+                              ALTERNATING_SIGN (abs(L)/2) :
+                              ALTERNATING_SIGN (abs(L-1)/2);
 
-                for (int index_m3=0; index_m3 <= ppr2->index_m_max[l3]; ++index_m3) {
+              for (int index_m3=0; index_m3 <= ppr2->index_m_max[l3]; ++index_m3) {
 
-                  /* What we need is
+                /* What we need is
 
-                  prefactor * (-1)^m3 * (2*l3+1) * ( l1  l2  l3 ) * (  l1   l2      l3  )
-                                                   (  0   F  -F )   (  m1   m3-m1  -m3  ) ,
-        
-                  for all values of l1 and m3. We obtain it from what we have computed above by
-                  defining m2=m3-m1 => m3=m1+m2. */            
-                  int m3 = ppr2->m[index_m3];
-                  int m2 = m3-m1;
+                prefactor * (-1)^m3 * (2*l3+1) * ( l1  l2  l3 ) * (  l1   l2      l3  )
+                                                 (  0   F  -F )   (  m1   m3-m1  -m3  ) ,
+      
+                for all values of l1 and m3. We obtain it from what we have computed above by
+                defining m2=m3-m1 => m3=m1+m2. */            
+                int m3 = ppr2->m[index_m3];
+                int m2 = m3-m1;
 
-                  /* Skip those configurations outside the triangular region, and those with abs(M)>L */
-                  if ((l1<l1_min_3j) || (l1>l1_max_3j) || (m2<m2_min_3j) || (m2>m2_max_3j))
-                    continue;
+                /* Skip those configurations with abs(M)>L */
+                if ((m2<m2_min_3j) || (m2>m2_max_3j) || (abs(m2)>l2))
+                  continue;
 
-                  ppt2->coupling_coefficients[index_pf][lm(l3,m3)][l1][m1-m1_min][l2]
-                    = prefactor * sign * temp[thread][l1-l1_min_3j][m2-m2_min_3j];
-                  
-                  /* Debug - print out the values stored in ppt2->coupling_coefficients. */
-                  // printf ("C(l1=%d,l2=%d,l3=%d,m1=%d,m2=%d,m3=%d,F=%d)=%g\n",
-                  //   l1, l2, l3, m1, m2, m3, F, ppt2->coupling_coefficients[index_bf][lm(l3,m3)][l1][m1-m1_min][l2]);
-            
-                } // for m3
-              } // for l1
-            } // for m1
-          } // for l3
+                ppt2->coupling_coefficients[coupling_coefficient_index(index_pf,l3,m3,l1,l2,m1)]
+                  = prefactor * sign * temp[thread][l1-l1_min_3j][m2-m2_min_3j];
+                
+                /* Debug - print out the values stored in ppt2->coupling_coefficients. */
+                // printf ("C(l1=%d,l2=%d,l3=%d,m1=%d,m2=%d,m3=%d,F=%d)=%g\n",
+                //   l1, l2, l3, m1, m2, m3, F, coupling_coefficient(index_pf,l3,m3,l1,l2,m1));
+          
+              } // for m3
+            } // for l1
+          } // for l2
           
           #pragma omp flush(abort)
           
-        } // for l2
+        } // for (l3,m1)
       } if (abort == _TRUE_) return _FAILURE_;
     } // for T,E,B...
   
@@ -1524,6 +2495,16 @@ int perturb2_get_lm_lists (
     free (three_j_000);
     free (three_j_mmm);
 
+    /* Keep the coefficients for the next runs, in place of the old ones */
+    if (ppt2->kept_couplings != NULL) {
+      free (ppt2->kept_couplings->coefficients);
+      free (ppt2->kept_couplings->offsets);
+      ppt2->kept_couplings->coefficients = ppt2->coupling_coefficients;
+      ppt2->kept_couplings->offsets = ppt2->coupling_offsets;
+      ppt2->kept_couplings->size = ppt2->coupling_size;
+      ppt2->kept_couplings->key = coupling_key;
+    }
+
   } // if (has_cmb)
   
   
@@ -1535,6 +2516,42 @@ int perturb2_get_lm_lists (
 
 
 
+/**
+ * Compute the key of the coupling coefficients in ppt2->coupling_coefficients, that is
+ * a hash of all the parameters they depend on: the fields and their parity, the (l,m)
+ * multipoles and the range in l1 and l2. Two runs with the same key have the same
+ * coupling coefficients; see ppt2->kept_couplings.
+ */
+
+int perturb2_coupling_key (
+          struct precision2 * ppr2,
+          struct perturbs2 * ppt2,
+          unsigned long long * key /**< output: hash of the parameters of the coupling coefficients */
+          )
+{
+
+  *key = _CHECKSUM_SEED_;
+
+  int flags[] = {
+    ppt2->pf_size, ppt2->largest_l, ppr2->m_size,
+    MAX (ppr2->l_max_los_quadratic, ppr2->l_max_los_quadratic_p),
+    ppt2->has_source_T ? ppt2->index_pf_t : -1,
+    ppt2->has_source_E ? ppt2->index_pf_e : -1,
+    ppt2->has_source_B ? ppt2->index_pf_b : -1
+  };
+
+  perturb2_checksum (flags, sizeof(flags), key);
+  perturb2_checksum (ppt2->field_parity, ppt2->pf_size*sizeof(int), key);
+  perturb2_checksum (ppr2->m, ppr2->m_size*sizeof(int), key);
+  perturb2_checksum (ppr2->index_m_max, (ppt2->largest_l+1)*sizeof(int), key);
+
+  return _SUCCESS_;
+
+}
+
+
+
+
 /**
  * Determine the Fourier grid in (k1,k2,k3) that will be used to sample the line of
  * sight sources.
@@ -3062,6 +4079,48 @@ int perturb2_timesampling_for_sources (
   } // end of if tau_out
 
 
+
+  // ====================================================================================
+  // =                                  Evolved levels                                  =
+  // ====================================================================================
+
+  /* A custom time sampling is not cut at the end of recombination; we just stop
+  evolving the system there, or at the last output time if later, and set the sources
+  at later times to zero in perturb2_solve(). We count the levels only now, because
+  adding the output points might have shifted ppt2->index_tau_end_of_recombination. */
+
+  ppt2->tau_size_evolved = ppt2->tau_size;
+
+  if (ppt2->has_only_recombination && ppt2->has_custom_timesampling
+  && (ppt2->index_tau_end_of_recombination < ppt2->tau_size)) {
+
+    double tau_end;
+
+    class_call (background_tau_of_z (
+                  pba,
+                  ppt2->z_end_of_recombination,
+                  &tau_end),
+      pba->error_message,
+      ppt2->error_message);
+
+    for (int index_tau_out=0; index_tau_out < ppt2->tau_out_size; ++index_tau_out)
+      tau_end = MAX (tau_end, ppt2->tau_out[index_tau_out]);
+
+    /* Include the first level at or after tau_end */
+    ppt2->tau_size_evolved = 0;
+    while ((ppt2->tau_size_evolved < ppt2->tau_size)
+    && (ppt2->tau_sampling[ppt2->tau_size_evolved] < tau_end))
+      ppt2->tau_size_evolved++;
+
+    ppt2->tau_size_evolved = MIN (ppt2->tau_size_evolved+1, ppt2->tau_size);
+
+    if (ppt2->perturbations2_verbose > 1)
+      printf ("     * will stop integrating the system at the end of recombination (tau=%g) and set the later sources to zero\n",
+        ppt2->tau_sampling[ppt2->tau_size_evolved-1]);
+
+  }
+
+
   /* Debug - Print time sampling */
   // fprintf (stderr, "# ~~~ tau-sampling for the source function ~~~\n");
   // for (int index_tau=0; index_tau < ppt2->tau_size; ++index_tau) {
@@ -3090,7 +4149,9 @@ int perturb2_timesampling_for_sources (
   
   /* Keep track of memory usage (debug only) */
   ppt2->count_memorised_sources = 0;
+  ppt2->count_interpolated_k3 = 0;
   ppt2->count_allocated_sources = 0;
+  ppt2->count_allocated_for_cache = 0;
   
   /* Allocate k1 level.  The further levels (k2, k3 and time) will be allocated when needed */
   for (int index_type = 0; index_type < ppt2->tp2_size; index_type++)
@@ -3098,6 +4159,7 @@ int perturb2_timesampling_for_sources (
   
   /* Allocate and initialize the logical array that keeps track of the memory state of ppt2->sources */
   class_calloc (ppt2->has_allocated_sources, ppt2->k_size, sizeof(short), ppt2->error_message);
+  class_calloc (ppt2->sources_k1_arena, ppt2->k_size, sizeof(struct arena), ppt2->error_message);
 
 
 
@@ -3585,8 +4647,10 @@ int perturb2_end_of_recombination (
   /* Value of the visibility function when recombination ends */
   double g_end = g_max/ppt2->recombination_max_to_end_ratio;
 
-  /* Initialise time index corresponding to recombination */
+  /* Initialise time index corresponding to recombination, and the end of recombination
+  in case the time sampling stops before it */
   ppt2->index_tau_rec = ppt2->tau_size-1;
+  ppt2->index_tau_end_of_recombination = ppt2->tau_size;
 
   /* Now, find the time index in the sources sampling corresponding to
   the peak of recombination by looping over ppt2->tau_sampling */
@@ -4343,6 +5407,107 @@ int perturb2_workspace_init (
   class_calloc (ppw2->pvec_sources1, ppt->qs_size[ppt->index_md_scalars], sizeof(double), ppt2->error_message);
   class_calloc (ppw2->pvec_sources2, ppt->qs_size[ppt->index_md_scalars], sizeof(double), ppt2->error_message);
 
+  /* Allocate the vectors of evolved perturbations. The number of evolved equations
+  changes from one time interval to the other, depending on the active approximations,
+  but it is always smaller than _MAX_NUM_EQUATIONS_. By allocating the vectors with
+  the maximum size here, we avoid allocating and freeing memory for each
+  time interval of each wavemode in perturb2_vector_init(). Two vectors are needed
+  because at an approximation switch the initial conditions are copied from the old
+  vector to the new one. */
+  for (int index_pv=0; index_pv < 2; ++index_pv) {
+
+    class_alloc (ppw2->pv_pool[index_pv], sizeof(struct perturb2_vector), ppt2->error_message);
+    struct perturb2_vector * ppv = ppw2->pv_pool[index_pv];
+
+    class_alloc (ppv->y, _MAX_NUM_EQUATIONS_*sizeof(double), ppt2->error_message);
+    class_alloc (ppv->dy, _MAX_NUM_EQUATIONS_*sizeof(double), ppt2->error_message);
+    class_alloc (ppv->used_in_sources, _MAX_NUM_EQUATIONS_*sizeof(int), ppt2->error_message);
+    class_calloc (ppv->pt2_labels,
+      _MAX_NUM_EQUATIONS_*_MAX_LENGTH_LABEL_,
+      sizeof(char),
+      ppt2->error_message);
+
+    ppv->pt2_size = 0;
+
+    /* Sparsity pattern of the Jacobian; jacobian_Ai is allocated in perturb2_jacobian_pattern() */
+    class_alloc (ppv->jacobian_Ap, (_MAX_NUM_EQUATIONS_+1)*sizeof(int), ppt2->error_message);
+    class_alloc (ppv->jacobian_colour, _MAX_NUM_EQUATIONS_*sizeof(int), ppt2->error_message);
+    class_alloc (ppv->jacobian_work, 5*_MAX_NUM_EQUATIONS_*sizeof(int), ppt2->error_message);
+    class_alloc (ppv->jacobian_y, _MAX_NUM_EQUATIONS_*sizeof(double), ppt2->error_message);
+    class_alloc (ppv->jacobian_dy, _MAX_NUM_EQUATIONS_*sizeof(double), ppt2->error_message);
+    class_alloc (ppv->jacobian_step, _MAX_NUM_EQUATIONS_*sizeof(double), ppt2->error_message);
+    ppv->jacobian_Ai = NULL;
+    ppv->jacobian_Ai_capacity = 0;
+    ppv->jacobian_nnz = 0;
+    ppv->jacobian_colour_size = 0;
+  }
+  
+  ppw2->pv = NULL;
+
+  /* Allocate and fill the cache for the k3-independent part of the quadratic sources. The
+  background and thermodynamics quantities are computed here once and for all, while the
+  first-order perturbations will be filled in perturb2_quadratic_sources_for_k1k2k() */
+  ppw2->k1k2_cache_mode = k1k2_cache_off;
+  ppw2->index_k1_cache = -1;
+  ppw2->index_k2_cache = -1;
+  ppw2->pvecback_cache = NULL;
+  ppw2->pvecthermo_cache = NULL;
+  ppw2->sources1_cache = NULL;
+  ppw2->sources2_cache = NULL;
+
+  if ((ppr2->cache_quadsources == _TRUE_) && (ppt2->has_quadratic_sources == _TRUE_)) {
+
+    int tau_size = ppt->tau_size_quadsources;
+    int qs_size = ppt->qs_size[ppt->index_md_scalars];
+
+    class_alloc (ppw2->pvecback_cache, tau_size*pba->bg_size*sizeof(double), ppt2->error_message);
+    class_alloc (ppw2->pvecthermo_cache, tau_size*pth->th_size*sizeof(double), ppt2->error_message);
+    class_alloc (ppw2->sources1_cache, tau_size*qs_size*sizeof(double), ppt2->error_message);
+    class_alloc (ppw2->sources2_cache, tau_size*qs_size*sizeof(double), ppt2->error_message);
+
+    ppw2->last_index_back = 0;
+    ppw2->last_index_thermo = 0;
+
+    for (int index_tau=0; index_tau < tau_size; ++index_tau) {
+
+      double * pvecback = ppw2->pvecback_cache + index_tau*pba->bg_size;
+      double * pvecthermo = ppw2->pvecthermo_cache + index_tau*pth->th_size;
+
+      class_call (background_at_tau(
+                   pba,
+                   ppt->tau_sampling_quadsources[index_tau],
+                   pba->normal_info, 
+                   pba->inter_closeby,
+                   &(ppw2->last_index_back), 
+                   pvecback),
+        pba->error_message,
+        ppt2->error_message);
+
+      class_call (thermodynamics_at_z(
+                   pba,
+                   pth,
+                   1./pvecback[pba->index_bg_a]-1.,  /* redshift z=1./a-1 */
+                   pth->inter_closeby,
+                   &(ppw2->last_index_thermo),
+                   pvecback,
+                   pvecthermo),
+        pth->error_message,
+        ppt2->error_message);
+    }
+
+    #pragma omp atomic
+    ppt2->count_allocated_for_cache += tau_size*(pba->bg_size + pth->th_size + 2*qs_size);
+  }
+
+  /* Allocate the arrays that describe the time intervals of a wavemode. Each
+  approximation can switch state at most once, so that there are at most
+  ppw2->ap2_size+1 intervals. See perturb2_find_approximation_number(). */
+  class_alloc (ppw2->interval_number_of, ppw2->ap2_size*sizeof(int), ppt2->error_message);
+  class_alloc (ppw2->interval_limit, (ppw2->ap2_size+2)*sizeof(double), ppt2->error_message);
+  class_alloc (ppw2->interval_approx, (ppw2->ap2_size+1)*sizeof(int*), ppt2->error_message);
+  for (int index_interval=0; index_interval < ppw2->ap2_size+1; index_interval++)
+    class_alloc (ppw2->interval_approx[index_interval], ppw2->ap2_size*sizeof(int), ppt2->error_message);
+
 
   // =========================================================================================
   // =                               Initialize quadratic sources                            =
@@ -4790,6 +5955,25 @@ int perturb2_workspace_free (
   free(ppw2->rotation_1_minus);
   free(ppw2->rotation_2_minus);
 
+  /* Free the vectors of evolved perturbations */
+  for (int index_pv=0; index_pv < 2; ++index_pv)
+    class_call (perturb2_vector_free (ppw2->pv_pool[index_pv]),
+      ppt2->error_message,
+      ppt2->error_message);
+
+  /* Free the quadratic sources cache (the pointers are NULL if the cache is not used) */
+  free (ppw2->pvecback_cache);
+  free (ppw2->pvecthermo_cache);
+  free (ppw2->sources1_cache);
+  free (ppw2->sources2_cache);
+
+  /* Free the time intervals */
+  for (int index_interval=0; index_interval < ppw2->ap2_size+1; index_interval++)
+    free (ppw2->interval_approx[index_interval]);
+  free (ppw2->interval_approx);
+  free (ppw2->interval_limit);
+  free (ppw2->interval_number_of);
+
   free (ppw2->approx);
 
   free(ppw2);
@@ -6139,6 +7323,254 @@ int perturb2_wavemode_info (
 
 
 
+/**
+ * Solve the second-order differential system for the k3 modes of a (k1,k2) pair
+ * that are needed to sample the line-of-sight sources in k3 with the required
+ * accuracy, and interpolate the sources in the other modes.
+ *
+ * The k3 grid ppt2->k3[index_k1][index_k2] is the one set by the sampling recipe
+ * (ppt2->k3_sampling), so that the layout of ppt2->sources and the subsequent modules
+ * do not change. The function first solves a coarse subset of the grid, made of the
+ * two extremes and of one mode every ppr2->k3_adaptive_stride grid points. Then, for
+ * each interval between two solved modes a and b, it solves the mode m in the middle
+ * and compares its sources with their linear interpolation between a and b. If the
+ * difference is smaller than ppr2->k3_adaptive_tol times the largest absolute value
+ * of the source in the interval, for all source types and times, the sources in the
+ * remaining modes of the interval are linearly interpolated between a, m and b;
+ * otherwise, the two halves of the interval are considered separately in the same way.
+ * Since the sources of the interpolated modes are computed on two intervals half as
+ * large as the tested one, their error is typically smaller than the tolerance.
+ *
+ * The pairs that appear in the output lists k1_out and k2_out are always solved in
+ * full, so that the output files do not depend on the adaptive sampling.
+ */
+
+int perturb2_solve_k3_adaptive (
+        struct precision * ppr,
+        struct precision2 * ppr2,
+        struct background * pba,
+        struct thermo * pth,
+        struct perturbs * ppt,
+        struct perturbs2 * ppt2,
+        int index_k1,
+        int index_k2,
+        struct perturb2_workspace * ppw2,
+        int * k3_solved                  /**< output: number of k3 modes for which the system was solved */
+        )
+{
+
+  int k3_size = ppt2->k3_size[index_k1][index_k2];
+  int stride = ppr2->k3_adaptive_stride;
+
+  *k3_solved = 0;
+
+  /* Pairs that are too small to gain anything, or whose perturbations are output */
+  short solve_all = (k3_size <= stride);
+
+  for (int index_k_out=0; index_k_out < ppt2->k_out_size; ++index_k_out)
+    if ((index_k1 == ppt2->index_k1_out[index_k_out]) && (index_k2 == ppt2->index_k2_out[index_k_out]))
+      solve_all = _TRUE_;
+
+  if (solve_all == _TRUE_) {
+
+    for (int index_k3 = 0; index_k3 < k3_size; ++index_k3) {
+
+      class_call (perturb2_solve (ppr, ppr2, pba, pth, ppt, ppt2, index_k1, index_k2, index_k3, ppw2),
+        ppt2->error_message,
+        ppt2->error_message);
+
+      (*k3_solved)++;
+    }
+
+    return _SUCCESS_;
+  }
+
+  /* Intervals (a,b) between solved modes that still have to be checked; there are never
+  more than k3_size of them */
+  int * interval_a, * interval_b;
+  class_alloc (interval_a, k3_size*sizeof(int), ppt2->error_message);
+  class_alloc (interval_b, k3_size*sizeof(int), ppt2->error_message);
+  int interval_size = 0;
+
+  /* Coarse grid */
+  int index_a = -1;
+
+  for (int index_k3 = 0; index_k3 < k3_size; ++index_k3) {
+
+    if ((index_k3 % stride != 0) && (index_k3 != k3_size-1))
+      continue;
+
+    class_call (perturb2_solve (ppr, ppr2, pba, pth, ppt, ppt2, index_k1, index_k2, index_k3, ppw2),
+      ppt2->error_message,
+      ppt2->error_message);
+
+    (*k3_solved)++;
+
+    if (index_a >= 0) {
+      interval_a[interval_size] = index_a;
+      interval_b[interval_size] = index_k3;
+      interval_size++;
+    }
+
+    index_a = index_k3;
+  }
+
+  /* Refine the intervals until the sources are smooth enough */
+  while (interval_size > 0) {
+
+    interval_size--;
+    int a = interval_a[interval_size];
+    int b = interval_b[interval_size];
+
+    if (b - a < 2)
+      continue;
+
+    int m = (a + b)/2;
+
+    class_call (perturb2_solve (ppr, ppr2, pba, pth, ppt, ppt2, index_k1, index_k2, m, ppw2),
+      ppt2->error_message,
+      ppt2->error_message);
+
+    (*k3_solved)++;
+
+    short is_smooth;
+
+    class_call (perturb2_k3_is_smooth (ppr2, ppt2, index_k1, index_k2, a, m, b, &is_smooth),
+      ppt2->error_message,
+      ppt2->error_message);
+
+    if (is_smooth == _TRUE_) {
+
+      class_call (perturb2_interpolate_k3 (ppt2, index_k1, index_k2, a, m),
+        ppt2->error_message,
+        ppt2->error_message);
+
+      class_call (perturb2_interpolate_k3 (ppt2, index_k1, index_k2, m, b),
+        ppt2->error_message,
+        ppt2->error_message);
+    }
+    else {
+      interval_a[interval_size] = a;
+      interval_b[interval_size] = m;
+      interval_size++;
+      interval_a[interval_size] = m;
+      interval_b[interval_size] = b;
+      interval_size++;
+    }
+  }
+
+  free (interval_a);
+  free (interval_b);
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Check whether the line-of-sight sources of the k3 mode m are reproduced by their
+ * linear interpolation between the modes a and b, within a relative tolerance of
+ * ppr2->k3_adaptive_tol, for all the source types and times.
+ *
+ * The tolerance is relative to the largest absolute value of each source type in the
+ * three modes; source types that vanish in the three modes are always smooth.
+ */
+
+int perturb2_k3_is_smooth (
+        struct precision2 * ppr2,
+        struct perturbs2 * ppt2,
+        int index_k1,
+        int index_k2,
+        int a,
+        int m,
+        int b,
+        short * is_smooth              /**< output: _TRUE_ if the linear interpolation is accurate enough */
+        )
+{
+
+  int k3_size = ppt2->k3_size[index_k1][index_k2];
+  double * k3 = ppt2->k3[index_k1][index_k2];
+
+  double w = (k3[b] - k3[m])/(k3[b] - k3[a]);
+
+  *is_smooth = _TRUE_;
+
+  for (int index_tp = 0; index_tp < ppt2->tp2_size; ++index_tp) {
+
+    double * S = ppt2->sources[index_tp][index_k1][index_k2];
+
+    double scale = 0, error = 0;
+
+    for (int index_tau = 0; index_tau < ppt2->tau_size; ++index_tau) {
+      double S_a = S[index_tau*k3_size + a];
+      double S_m = S[index_tau*k3_size + m];
+      double S_b = S[index_tau*k3_size + b];
+      scale = MAX (scale, MAX (fabs(S_m), MAX (fabs(S_a), fabs(S_b))));
+      error = MAX (error, fabs (S_m - (w*S_a + (1-w)*S_b)));
+    }
+
+    if (error > ppr2->k3_adaptive_tol*scale) {
+      *is_smooth = _FALSE_;
+      break;
+    }
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Fill the line-of-sight sources of the k3 modes between a and b, excluded, by linear
+ * interpolation in k3, for all the source types and times. The sources of the modes
+ * a and b must have been computed by perturb2_solve().
+ */
+
+int perturb2_interpolate_k3 (
+        struct perturbs2 * ppt2,
+        int index_k1,
+        int index_k2,
+        int a,
+        int b
+        )
+{
+
+  if (b - a < 2)
+    return _SUCCESS_;
+
+  int k3_size = ppt2->k3_size[index_k1][index_k2];
+  double * k3 = ppt2->k3[index_k1][index_k2];
+
+  for (int index_tp = 0; index_tp < ppt2->tp2_size; ++index_tp) {
+
+    double * S = ppt2->sources[index_tp][index_k1][index_k2];
+
+    for (int index_tau = 0; index_tau < ppt2->tau_size; ++index_tau) {
+
+      double S_a = S[index_tau*k3_size + a];
+      double S_b = S[index_tau*k3_size + b];
+
+      for (int index_k3 = a+1; index_k3 < b; ++index_k3) {
+        double w = (k3[b] - k3[index_k3])/(k3[b] - k3[a]);
+        S[index_tau*k3_size + index_k3] = w*S_a + (1-w)*S_b;
+      }
+    }
+  }
+
+  /* The interpolated values count as filled entries of ppt2->sources */
+  #pragma omp atomic
+  ppt2->count_memorised_sources += (long int)ppt2->tp2_size*ppt2->tau_size*(b-a-1);
+
+  #pragma omp atomic
+  ppt2->count_interpolated_k3 += b-a-1;
+
+  return _SUCCESS_;
+
+}
+
+
+
+
 /**
  * Solve the second-order differential system for the considered wavemodes (k1,k2,k3).
  *
@@ -6267,6 +7699,14 @@ int perturb2_solve (
     }
   }
 
+  /* For the run report, count the time steps of all modes */
+  if ((ppw2->print_function == NULL) && (ppt2->ode_stats != NULL))
+    ppw2->print_function = perturb2_count_steps;
+
+  double solve_start = run_report_time();
+  int pt2_size_max = 0;
+  int jacobian_colours_max = 0;
+
 
   /* Initialize indices relevant for back/thermo tables search */
   ppw2->last_index_back=0;
@@ -6352,6 +7792,9 @@ int perturb2_solve (
   // =                             Determine time intervals                             =
   // ====================================================================================
 
+  /** The system is evolved up to tau_end=ppt2->tau_sampling[ppt2->tau_size_evolved-1],
+  beyond which the sources of all wavemodes vanish. */
+
   /** Following CLASS example, we split the time range [tau_ini, tau_end] in time intervals
   according to the number of active approximation schemes. The differential solver needs to
   be run separately for each time interval, because each approximations has its own set of
@@ -6366,8 +7809,7 @@ int perturb2_solve (
   equal to one (when the approximation never changes its state i.e. it is always turned ON
   or OFF), or equal to two (when the approximation changes its state, either from ON to OFF
   or from OFF to ON). */
-  int * interval_number_of;
-  class_alloc (interval_number_of, ppw2->ap2_size*sizeof(int), ppt2->error_message);
+  int * interval_number_of = ppw2->interval_number_of;
 
   /* Determine interval_number and interval_number_of */
   class_call(perturb2_find_approximation_number(
@@ -6379,23 +7821,24 @@ int perturb2_solve (
                ppt2,
                ppw2,
                ppw2->tau_start_evolution,
-               ppt2->tau_sampling[ppt2->tau_size-1],
+               ppt2->tau_sampling[ppt2->tau_size_evolved-1],
                &interval_number,
                interval_number_of),
     ppt2->error_message,
     ppt2->error_message);
 
-  /* Edge of the time intervals. The first and last elements are tau_ini and tau_end. */
-  double * interval_limit;
-  class_alloc (interval_limit,(interval_number+1)*sizeof(double),ppt2->error_message);
+  class_test (interval_number > ppw2->ap2_size+1,
+    ppt2->error_message,
+    "found %d time intervals, but there can be at most %d", interval_number, ppw2->ap2_size+1);
 
-  /* Logical matrix interval_approx[index_interval][index_ap] telling us which
-  approximations are active for a given time interval. */
-  int ** interval_approx;
+  /* Edge of the time intervals. The first and last elements are tau_ini and tau_end.
+  The array was allocated in perturb2_workspace_init() */
+  double * interval_limit = ppw2->interval_limit;
 
-  class_alloc (interval_approx,interval_number*sizeof(int*),ppt2->error_message);  
-  for (int index_interval=0; index_interval < interval_number; index_interval++)
-    class_alloc (interval_approx[index_interval], ppw2->ap2_size*sizeof(int), ppt2->error_message);
+  /* Logical matrix interval_approx[index_interval][index_ap] telling us which
+  approximations are active for a given time interval. The array was allocated
+  in perturb2_workspace_init() */
+  int ** interval_approx = ppw2->interval_approx;
 
   /* Determine interval_limit and interval_approx */ 
   class_call (perturb2_find_approximation_switches(
@@ -6407,7 +7850,7 @@ int perturb2_solve (
                 ppt2,
                 ppw2,
                 ppw2->tau_start_evolution,
-                ppt2->tau_sampling[ppt2->tau_size-1],
+                ppt2->tau_sampling[ppt2->tau_size_evolved-1],
                 ppr->tol_tau_approx,
                 interval_number,
                 interval_number_of,
@@ -6446,10 +7889,30 @@ int perturb2_solve (
   // ====================================================================================
   // =                                Solve the system                                  =
   // ====================================================================================
+
+  /* Number of time levels where the sources of this mode are computed by the evolver */
+  int tau_size_mode = ppt2->tau_size_evolved;
+
+  /* If requested, check every _SOURCES_CUTOFF_STRIDE_ time levels whether the sources
+  of the mode have become negligible, and stop evolving it when they have. The check
+  is skipped for the modes that are written to file, so that their output is complete. */
+  short check_sources = (ppt2->has_only_recombination == _TRUE_)
+    && (ppr2->sources_cutoff_song > 0)
+    && (ppw2->index_k_out == -1)
+    && (ppw2->index_k_out_for_tau_out == -1);
+
+  /* First time level to be checked; the sources before the peak of the visibility
+  function are still growing */
+  int index_tau_check = _SOURCES_CUTOFF_STRIDE_;
+  while ((index_tau_check < ppt2->tau_size_evolved)
+  && (ppt2->tau_sampling[index_tau_check-_SOURCES_CUTOFF_STRIDE_] < pth->tau_rec))
+    index_tau_check++;
+
+  int converged = _FALSE_;
   
   /* Loop over the time intervals and, for each interval, solve the differential system */
   
-  for (int index_interval=0; index_interval < interval_number; index_interval++) {
+  for (int index_interval=0; index_interval < interval_number && !converged; index_interval++) {
 
     /* Let the workspace know about the approximations which are turned on over the
     considered time interval */
@@ -6498,6 +7961,22 @@ int perturb2_solve (
  
 
 
+    pt2_size_max = MAX (pt2_size_max, ppw2->pv->pt2_size);
+    if (ppr->evolver != rk)
+      jacobian_colours_max = MAX (jacobian_colours_max, ppw2->pv->jacobian_colour_size);
+
+    /* If requested, make sure that the Jacobian at the start of the interval has no
+    nonzero entries outside the pattern computed by perturb2_vector_init() */
+    if (ppr2->check_jacobian_pattern == _TRUE_)
+      class_call (perturb2_jacobian_check (
+                    interval_limit[index_interval],
+                    ppw2->pv->y,
+                    &ppaw2,
+                    ppt2->error_message),
+        ppt2->error_message,
+        ppt2->error_message);
+
+
     // ----------------------------------------------------------------------------------
     // -                              Evolve the system                                 -
     // ----------------------------------------------------------------------------------
@@ -6513,36 +7992,96 @@ int perturb2_solve (
     else
       generic_evolver = evolver_ndf15;
 
-    /* Solve the differential system over the current time interval */
-    class_call (generic_evolver(
-                  perturb2_derivs,
-                  interval_limit[index_interval],
-                  interval_limit[index_interval+1],
-                  ppw2->pv->y,
-                  ppw2->pv->used_in_sources,
-                  ppw2->pv->pt2_size,
-                  &ppaw2,
-                  ppr2->tol_perturb_integration_song,
-                  ppr->smallest_allowed_variation,
-                  perturb2_timescale,                 /* Not needed when using the ndf15 integrator */
-                  ppr->perturb_integration_stepsize,  /* Not needed when using the ndf15 integrator */
-                  ppt2->tau_sampling,
-                  ppt2->tau_size,
-                  perturb2_sources,
-                  ppw2->print_function,
-                  what_if_ndf15_fails,  /* Exit strategy */
-                  ppt2->error_message),
-      ppt2->error_message,
-      ppt2->error_message);
+    /* Solve the differential system over the current time interval. When checking
+    the sources, split the interval at the checked time levels; each check is placed
+    halfway between two levels, so that no level is computed twice. */
+
+    double tau_from = interval_limit[index_interval];
+
+    while (tau_from < interval_limit[index_interval+1]) {
+
+      double tau_to = interval_limit[index_interval+1];
+      short is_check = _FALSE_;
+
+      if (check_sources && (index_tau_check < ppt2->tau_size_evolved)) {
+        double tau_check = 0.5*(ppt2->tau_sampling[index_tau_check-1] + ppt2->tau_sampling[index_tau_check]);
+        if ((tau_check > tau_from) && (tau_check < tau_to)) {
+          tau_to = tau_check;
+          is_check = _TRUE_;
+        }
+      }
+
+      class_call (generic_evolver(
+                    perturb2_derivs,
+                    tau_from,
+                    tau_to,
+                    ppw2->pv->y,
+                    ppw2->pv->used_in_sources,
+                    ppw2->pv->pt2_size,
+                    &ppaw2,
+                    ppr2->tol_perturb_integration_song,
+                    ppr->smallest_allowed_variation,
+                    perturb2_timescale,                 /* Not needed when using the ndf15 integrator */
+                    ppr->perturb_integration_stepsize,  /* Not needed when using the ndf15 integrator */
+                    ppt2->tau_sampling,
+                    ppt2->tau_size_evolved,
+                    perturb2_sources,
+                    ppw2->print_function,
+                    what_if_ndf15_fails,  /* Exit strategy */
+                    ppt2->error_message),
+        ppt2->error_message,
+        ppt2->error_message);
+
+      if (is_check == _TRUE_) {
+
+        class_call (perturb2_sources_cutoff (
+                      ppr2,
+                      ppt2,
+                      ppw2,
+                      index_tau_check,
+                      &converged),
+          ppt2->error_message,
+          ppt2->error_message);
+
+        if (converged == _TRUE_) {
+          tau_size_mode = index_tau_check;
+          printf_log_if (ppt2->perturbations2_verbose, 3,
+            "     * sources are negligible after tau=%g, stopping the evolution\n",
+            ppt2->tau_sampling[tau_size_mode-1]);
+          break;
+        }
+
+        index_tau_check += _SOURCES_CUTOFF_STRIDE_;
+      }
+
+      tau_from = tau_to;
+
+    }
 
   } // end of for (index_interval)
 
   
   /* Test that the sources where computed the right amount of times */
-  class_test (ppw2->sources_calls != ppt2->tau_size,
+  class_test (ppw2->sources_calls != tau_size_mode,
     ppt2->error_message,
-    "(%.25f[%d],%.25f[%d],%.25f[%d]): the sources function was called %d times instead of tau_size=%d times",
-    k1, index_k1, k2, index_k2, k, index_k3, ppw2->sources_calls, ppt2->tau_size);
+    "(%.25f[%d],%.25f[%d],%.25f[%d]): the sources function was called %d times instead of %d times",
+    k1, index_k1, k2, index_k2, k, index_k3, ppw2->sources_calls, tau_size_mode);
+
+  /* Set to zero the sources at the time levels that were not evolved */
+  for (int index_tp2=0; index_tp2 < ppt2->tp2_size; ++index_tp2)
+    for (int index_tau=tau_size_mode; index_tau < ppt2->tau_size; ++index_tau)
+      sources(index_tp2) = 0;
+
+  /* Keep track of the cost of this mode for the run report */
+  if (ppt2->ode_stats != NULL) {
+    struct perturb2_ode_stats * stats = &(ppt2->ode_stats[index_k1][index_k2][index_k3]);
+    stats->steps = ppw2->n_steps;
+    stats->derivs_calls = ppw2->derivs_calls;
+    stats->pt2_size = pt2_size_max;
+    stats->jacobian_colours = jacobian_colours_max;
+    stats->solve_time = run_report_time() - solve_start;
+    stats->tau_size = tau_size_mode;
+  }
 
 
 
@@ -6550,15 +8089,9 @@ int perturb2_solve (
   // =                                   Free memory                                    =
   // ====================================================================================
 
-  class_call (perturb2_vector_free (ppw2->pv),
-     ppt2->error_message,
-     ppt2->error_message);
-     
-  for (int index_interval=0; index_interval < interval_number; index_interval++)
-    free (interval_approx[index_interval]);
-  free (interval_approx);
-  free (interval_limit); 
-  free(interval_number_of);
+  /* The vector of evolved perturbations and the time intervals are owned by the
+  workspace, and will be reused by the next wavemode */
+  ppw2->pv = NULL;
 
   /* Close k_out files */
   if (ppw2->index_k_out != -1) {
@@ -6638,11 +8171,13 @@ int perturb2_vector_init (
       )
 {
 
-  /* Create a temporary perturb2_vector structure. We shall fill it below according
-  to what equations need to be evolved in the new time interval, and eventually
-  use it to replace the old structure in ppw2->pv. */
-  struct perturb2_vector * ppv;
-  class_alloc (ppv, sizeof(struct perturb2_vector), ppt2->error_message);
+  /* Pick the perturb2_vector structure that is not in use by the previous time interval.
+  We shall fill it below according to what equations need to be evolved in the new time
+  interval, and eventually use it to replace the old structure in ppw2->pv. The structure
+  is preallocated in the workspace, so that here we do not need to allocate memory. */
+  struct perturb2_vector * ppv = ppw2->pv_pool[0];
+  if (ppw2->pv == ppw2->pv_pool[0])
+    ppv = ppw2->pv_pool[1];
 
   /* Shortcut to the active approximation schemes */
   int * new_approx = ppw2->approx;  
@@ -6653,11 +8188,8 @@ int perturb2_vector_init (
   ppv->use_closure_pol_g = _TRUE_;
   ppv->use_closure_ur = _TRUE_;
 
-  /* Initialise the labels */
-  class_calloc (ppv->pt2_labels,
-    _MAX_NUM_EQUATIONS_*_MAX_LENGTH_LABEL_,
-    sizeof(char),
-    ppt2->error_message);
+  /* Initialise the labels, erasing those written the last time the vector was used */
+  memset (ppv->pt2_labels, 0, MIN(ppv->pt2_size+1,_MAX_NUM_EQUATIONS_)*_MAX_LENGTH_LABEL_*sizeof(char));
   
 
   // ====================================================================================
@@ -7006,13 +8538,16 @@ int perturb2_vector_init (
   ppv->pt2_size = index_pt;
 
 
-  /* Allocate vectors for storing the values of all the index_pt2 perturbations
-  and their time-derivatives. The allocation for y is made with calloc, so that
-  in the following we shall only need to specify the non-vanishing initial
-  conditions. */
-  class_calloc (ppv->y, ppv->pt2_size, sizeof(double), ppt2->error_message);
-  class_alloc (ppv->dy, ppv->pt2_size*sizeof(double), ppt2->error_message);
-  class_alloc (ppv->used_in_sources, ppv->pt2_size*sizeof(int), ppt2->error_message);
+  /* The vectors for storing the values of all the index_pt2 perturbations and their
+  time-derivatives were allocated in perturb2_workspace_init() with the maximum
+  size allowed. We set y to zero, so that in the following we shall only need to
+  specify the non-vanishing initial conditions. */
+  class_test (ppv->pt2_size > _MAX_NUM_EQUATIONS_,
+    ppt2->error_message,
+    "we need to evolve %d equations, but _MAX_NUM_EQUATIONS_=%d; increase it in perturbations2.h",
+    ppv->pt2_size, _MAX_NUM_EQUATIONS_);
+
+  memset (ppv->y, 0, ppv->pt2_size*sizeof(double));
 
   /* Each time the evolver gets close to a time that is in ppt2->tau_sampling, it will
   interpolate the pv->y array at that exact time. To optimise this process, it is
@@ -7025,6 +8560,13 @@ int perturb2_vector_init (
   for (int index_pt=0; index_pt < ppv->pt2_size; index_pt++)
     ppv->used_in_sources[index_pt] = _TRUE_;
 
+  /* The implicit evolver needs the Jacobian of the system; compute its sparsity
+  pattern, which is known in advance from the layout of the vector */
+  if ((ppr->evolver != rk) || (ppr2->check_jacobian_pattern == _TRUE_))
+    class_call (perturb2_jacobian_pattern (ppr2, pba, ppt2, ppv),
+      ppt2->error_message,
+      ppt2->error_message);
+
 
 
   // ====================================================================================
@@ -7315,13 +8857,8 @@ int perturb2_vector_init (
      
     } 
 
-    /* Free the previous vector of perturbations */
-    class_call (perturb2_vector_free(ppw2->pv),
-      ppt2->error_message,
-      ppt2->error_message);
-
-    /* Let ppw2->pv point towards the perturb2_vector structure that we created
-    and filled above */
+    /* Let ppw2->pv point towards the perturb2_vector structure that we filled
+    above; the previous one will be reused by the next time interval */
     ppw2->pv = ppv;
 
   } // end of if(pba_old != NULL)
@@ -7371,6 +8908,13 @@ int perturb2_vector_free(
   free(pv->dy);
   free(pv->used_in_sources);
   free(pv->pt2_labels);
+  free(pv->jacobian_Ap);
+  free(pv->jacobian_Ai);
+  free(pv->jacobian_colour);
+  free(pv->jacobian_work);
+  free(pv->jacobian_y);
+  free(pv->jacobian_dy);
+  free(pv->jacobian_step);
   free(pv);
   
   return _SUCCESS_;
@@ -7441,19 +8985,19 @@ int perturb2_free(
     
     int k1_size = ppt2->k_size;
 
-    /* Free the k1 level only if we are neither loading nor storing the sources to disk.  The memory
-    management in those two cases is handled separately, so that the sources are freed as soon
-    as they are not needed anymore via the source_load and sources_store functions. */
-    if ((ppr2->store_sources_to_disk==_FALSE_) && (ppr2->load_sources_from_disk==_FALSE_)) {
-      for (int index_k1 = 0; index_k1 < k1_size; ++index_k1) {
+    /* Free the k1 levels that are still allocated. When we are loading or storing the sources
+    to disk, the k1 levels are freed as soon as they are not needed anymore via the source_load
+    and sources_store functions, so that here we only free those left by a run of perturb2_init()
+    or transfer2_init() that failed halfway. */
+    for (int index_k1 = 0; index_k1 < k1_size; ++index_k1) {
 
-        /* If the transfer2 module was loaded, ppt2->sources had already been freed  */
-        if (ppt2->has_allocated_sources[index_k1] == _TRUE_)
-          class_call(perturb2_free_k1_level(ppt2, index_k1), ppt2->error_message, ppt2->error_message); 
-      }
+      /* If the transfer2 module was loaded, ppt2->sources had already been freed  */
+      if (ppt2->has_allocated_sources[index_k1] == _TRUE_)
+        class_call(perturb2_free_k1_level(ppt2, index_k1), ppt2->error_message, ppt2->error_message); 
     }
 
     free (ppt2->has_allocated_sources);
+    free (ppt2->sources_k1_arena);
 
     for (int index_type = 0; index_type < ppt2->tp2_size; index_type++)
       free(ppt2->sources[index_type]);
@@ -7474,34 +9018,21 @@ int perturb2_free(
     free(ppt2->k);
     free(ppt2->k3);
     free(ppt2->k3_size);
+    free(ppt2->k1_rank);
+
+    if (ppt2->ode_stats != NULL) {
+      for (int index_k1 = 0; index_k1 < k1_size; ++index_k1) {
+        for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2)
+          free (ppt2->ode_stats[index_k1][index_k2]);
+        free (ppt2->ode_stats[index_k1]);
+      }
+      free (ppt2->ode_stats);
+    }
     
-    /* Free memory for the general coupling coefficients */  
-    int m1_min = -ppt2->l1_max;
-    int m2_min = -ppt2->l2_max;
-    int m1_max = ppt2->l1_max;
-    int m2_max = ppt2->l2_max;
-    int l1_size = ppt2->l1_max+1;
-    int l2_size = ppt2->l2_max+1;
-    int m1_size = m1_max-m1_min+1;
-    int m2_size = m2_max-m2_min+1;
-    
-    if (ppt2->has_cmb && ppt2->use_delta_tilde_in_los) {
-      for (int index_pf=0; index_pf < ppt2->pf_size; ++index_pf) {
-        for (int l=0; l <= ppt2->largest_l; ++l) {
-          for (int index_m=0; index_m <= ppr2->index_m_max[l]; ++index_m) {
-            int m = ppr2->m[index_m];
-            for (int l1=0; l1 <= ppt2->l1_max; ++l1) {  
-              for (int m1=m1_min; m1 <= m1_max; ++m1) {
-                free (ppt2->coupling_coefficients[index_pf][lm(l,m)][l1][m1-m1_min]);
-              } // end of for m1
-              free (ppt2->coupling_coefficients[index_pf][lm(l,m)][l1]);
-            } // end of for l1
-            free (ppt2->coupling_coefficients[index_pf][lm(l,m)]);
-          } // end of for m
-        } // end of for l
-      free (ppt2->coupling_coefficients[index_pf]);
-      } // end of for T,E,B...
+    /* Free memory for the general coupling coefficients, unless they are kept by the caller */
+    if (ppt2->has_cmb && ppt2->use_delta_tilde_in_los && (ppt2->kept_couplings == NULL)) {
       free (ppt2->coupling_coefficients);
+      free (ppt2->coupling_offsets);
     }
 
     for (int l=0; l <= ppt2->largest_l; ++l)
@@ -7539,18 +9070,30 @@ int perturb2_free(
     free (ppt2->d_plus);
     free (ppt2->d_zero);
 
+    free (ppt2->c_minus_mm);
+    free (ppt2->c_plus_mm);
+    free (ppt2->d_minus_mm);
+    free (ppt2->d_plus_mm);
+    free (ppt2->d_zero_mm);
+
     free(ppt2->m);
 
     /* Free file arrays */
     if ((ppr2->store_sources_to_disk == _TRUE_) || (ppr2->load_sources_from_disk == _TRUE_)) {
     
-      // fclose(ppt2->sources_status_file);
-    
       for (int index_k1=0; index_k1<ppt2->k_size; ++index_k1)
         free (ppt2->sources_paths[index_k1]);
     
       free (ppt2->sources_files);
       free (ppt2->sources_paths);
+
+      if (ppt2->has_stored_sources != NULL)
+        free (ppt2->has_stored_sources);
+
+      if (ppt2->has_sources_map == _TRUE_)
+        class_call (perturb2_sources_map_free (ppt2),
+          ppt2->error_message,
+          ppt2->error_message);
     
     }
 
@@ -7911,14 +9454,27 @@ int perturb2_derivs (
 
   /* Higher moments are all tight coupling suppressed. Note that c_minus is always
   positive, while c_plus is always negative (at least in this case where m1==m). */
-  for (int l=3; l<=l_max_g; ++l) {
-    for (int index_m=0; index_m <= ppr2->index_m_max[l]; ++index_m) {
+  if (ppt2->free_streaming_kernel != NULL) {
+
+    /* Specialised kernel, with all arrays starting from the (l=3,m=0) multipole */
+    int lm_3 = ppt2->lm_array[3][0];
+    int index_pt2_3 = ppw2->pv->index_pt2_monopole_g + lm_3;
+
+    ppt2->free_streaming_kernel (l_max_g, k, kappa_dot,
+      ppt2->c_minus_mm + lm_3, ppt2->c_plus_mm + lm_3,
+      y + index_pt2_3, dy + index_pt2_3);
+  }
+  else {
+
+    for (int l=3; l<=l_max_g; ++l) {
+      for (int index_m=0; index_m <= ppr2->index_m_max[l]; ++index_m) {
       
-      int m = ppt2->m[index_m];
+        int m = ppt2->m[index_m];
       
-      dI(l,m) = k * (c_minus(l,m,m)*I(l-1,m) - c_plus(l,m,m)*I(l+1,m))
-                - kappa_dot * I(l,m);
+        dI(l,m) = k * (c_minus(l,m,m)*I(l-1,m) - c_plus(l,m,m)*I(l+1,m))
+                  - kappa_dot * I(l,m);
       
+      }
     }
   }
 
@@ -7988,13 +9544,33 @@ int perturb2_derivs (
 
 
     /* - E-modes higher moments */
+
+    /* The specialised kernel computes both the E-modes and the B-modes with l>2;
+    in that case, only the B-mode quadrupole is left for the loop below */
+    int l_max_B = l_max_pol_g;
     
-    for (int l=3; l<=l_max_pol_g; ++l) {
-      for (int index_m=0; index_m <= ppr2->index_m_max[l]; ++index_m) {
-        int m = ppt2->m[index_m];
-        dE(l,m) = k*(d_minus(l,m,m)*E(l-1,m) - d_plus(l,m,m)*E(l+1,m)
-                  - d_zero(l,m,m)*B(l,m))  /* Mixing between E- and B-modes */
-                  - kappa_dot*E(l,m);
+    if (ppt2->free_streaming_pol_kernel != NULL) {
+
+      l_max_B = MIN (l_max_pol_g, 2);
+
+      int lm_3 = ppt2->lm_array[3][0];
+      int index_pt2_E_3 = ppw2->pv->index_pt2_monopole_E + lm_3;
+      int index_pt2_B_3 = ppw2->pv->index_pt2_monopole_B + lm_3;
+
+      ppt2->free_streaming_pol_kernel (l_max_pol_g, k, kappa_dot,
+        ppt2->d_minus_mm + lm_3, ppt2->d_plus_mm + lm_3, ppt2->d_zero_mm + lm_3,
+        y + index_pt2_E_3, y + index_pt2_B_3,
+        dy + index_pt2_E_3, dy + index_pt2_B_3);
+    }
+    else {
+
+      for (int l=3; l<=l_max_pol_g; ++l) {
+        for (int index_m=0; index_m <= ppr2->index_m_max[l]; ++index_m) {
+          int m = ppt2->m[index_m];
+          dE(l,m) = k*(d_minus(l,m,m)*E(l-1,m) - d_plus(l,m,m)*E(l+1,m)
+                    - d_zero(l,m,m)*B(l,m))  /* Mixing between E- and B-modes */
+                    - kappa_dot*E(l,m);
+        }
       }
     }
     
@@ -8005,7 +9581,7 @@ int perturb2_derivs (
     Note that the B-modes are always zero for m=0, and that they only couple
     to E-modes. */
 
-    for (int l=2; l<=l_max_pol_g; ++l) {
+    for (int l=2; l<=l_max_B; ++l) {
       for (int index_m=0; index_m <= ppr2->index_m_max[l]; ++index_m) {
         int m = ppt2->m[index_m];
         dB(l,m) = k*(d_minus(l,m,m)*B(l-1,m) - d_plus(l,m,m)*B(l+1,m)
@@ -8093,7 +9669,22 @@ int perturb2_derivs (
 
     /* - Higher moments */
 
-    for (int l=2; l<=l_max_ur; ++l) {
+    /* If available, use the specialised kernel for l>2, without collision term */
+    int l_max_N = l_max_ur;
+
+    if (ppt2->free_streaming_kernel != NULL) {
+
+      l_max_N = MIN (l_max_ur, 2);
+
+      int lm_3 = ppt2->lm_array[3][0];
+      int index_pt2_3 = ppw2->pv->index_pt2_monopole_ur + lm_3;
+
+      ppt2->free_streaming_kernel (l_max_ur, k, 0.,
+        ppt2->c_minus_mm + lm_3, ppt2->c_plus_mm + lm_3,
+        y + index_pt2_3, dy + index_pt2_3);
+    }
+
+    for (int l=2; l<=l_max_N; ++l) {
       for (int index_m=0; index_m <= ppr2->index_m_max[l]; ++index_m) {
       
         int m = ppt2->m[index_m];
@@ -8402,53 +9993,512 @@ int perturb2_derivs (
 
 
 
-  /* - Synchronous gauge */
+  /* - Synchronous gauge */
+
+  if (ppt->gauge == synchronous) {
+
+    /* Curvature potential eta */
+    if (ppr2->compute_m[0] == _TRUE_)
+      dy[ppw2->pv->index_pt2_eta] = pvecmetric[ppw2->index_mt2_eta_prime];
+
+  }
+  
+
+  /* Debug - Print the full content of y and dy, along with comprehensive debug information.
+  This is a good way to debug the differential system step by step. */
+  // if (ppw2->derivs_calls < 4) {
+  //   if ((ppw2->index_k1==ppt2->index_k1_debug)
+  //     && (ppw2->index_k2==ppt2->index_k2_debug)
+  //      && (ppw2->index_k3==ppt2->index_k3_debug)) {
+  //
+  //     printf("> Leaving derivs for the %d time; k=(%g,%g,%g); tau = %.16f\n",
+  //       ppw2->derivs_calls, ppw2->k1, ppw2->k2, ppw2->k, tau);
+  //
+  //     /* Show content of y, dy and dy_quadsources */
+  //     int index_pt;
+  //     for (int index_pt=0; index_pt<ppw2->pv->pt2_size; ++index_pt)
+  //       printf("y[%3d] = %+12.3g,  dy[%3d] = %+12.3g,  %-15s\n",
+  //         index_pt, y[index_pt], index_pt, dy[index_pt],
+  //         ppw2->pv->pt2_labels[index_pt]);
+  //
+  //   }
+  // }
+
+  /* Debug - Print perturbations as a function of time. */
+  // if ((ppw2->index_k1==15) && (ppw2->index_k2==0) && (ppw2->index_k3==1)) {
+  //   fprintf (stderr, "%17.7g %17.7g %17.7g %17.7g %17.7g %17.7g %17.7g\n",
+  //     tau,
+  //     y[ppw2->pv->index_pt2_monopole_g],
+  //     dy[ppw2->pv->index_pt2_monopole_g],
+  //     I_00,
+  //     I_1m[0],
+  //     N_00,
+  //     N_1m[0]
+  //   );
+  // }
+
+  return _SUCCESS_;
+  
+}   // end of perturb2_derivs
+
+
+
+
+/**
+ * Specialised kernels for the free-streaming part of the l>2 radiation multipoles.
+ *
+ * For a set of M azimuthal numbers m=0,...,M-1, the (l,m) multipoles with l>2 are
+ * stored in the evolved vector with a constant stride M: the (l+1,m) multipole
+ * comes M positions after the (l,m) one. The macro below defines, for a given M
+ * known at compile time, the kernels that compute
+ *
+ *   dX(l,m) = k * (c_minus(l,m,m)*X(l-1,m) - c_plus(l,m,m)*X(l+1,m)) - kappa_dot*X(l,m)
+ *
+ * for the intensity and neutrino hierarchies, and the corresponding E-mode and B-mode
+ * equations with the mixing term d_zero, for all 3<=l<=l_max. The arrays start from
+ * the (l=3,m=0) multipole and are indexed with a single offset, so that the loops do
+ * not have bound checks or indirections and can be vectorised. The l_max multipole
+ * is computed with X(l_max+1,m)=0, as in the generic equations; it is then replaced
+ * by the closure relation, if any.
+ *
+ * The kernels are selected in perturb2_get_lm_lists() and called by perturb2_derivs().
+ */
+
+#define PERTURB2_FREE_STREAMING_KERNELS(NAME, M)                                      \
+                                                                                      \
+int perturb2_free_streaming_##NAME (                                                  \
+      int l_max,                                                                      \
+      double k,                                                                       \
+      double kappa_dot,                                                               \
+      const double * restrict c_minus,                                                \
+      const double * restrict c_plus,                                                 \
+      const double * restrict y,                                                      \
+      double * restrict dy                                                            \
+      )                                                                               \
+{                                                                                     \
+                                                                                      \
+  int inner_size = MAX (l_max-3, 0) * (M);                                            \
+  int size = MAX (l_max-2, 0) * (M);                                                  \
+                                                                                      \
+  _Pragma ("omp simd")                                                                \
+  for (int o=0; o < inner_size; ++o)                                                  \
+    dy[o] = k * (c_minus[o]*y[o-(M)] - c_plus[o]*y[o+(M)]) - kappa_dot*y[o];          \
+                                                                                      \
+  for (int o=inner_size; o < size; ++o)                                               \
+    dy[o] = k * c_minus[o]*y[o-(M)] - kappa_dot*y[o];                                 \
+                                                                                      \
+  return _SUCCESS_;                                                                   \
+                                                                                      \
+}                                                                                     \
+                                                                                      \
+int perturb2_free_streaming_pol_##NAME (                                              \
+      int l_max,                                                                      \
+      double k,                                                                       \
+      double kappa_dot,                                                               \
+      const double * restrict d_minus,                                                \
+      const double * restrict d_plus,                                                 \
+      const double * restrict d_zero,                                                 \
+      const double * restrict y_E,                                                    \
+      const double * restrict y_B,                                                    \
+      double * restrict dy_E,                                                         \
+      double * restrict dy_B                                                          \
+      )                                                                               \
+{                                                                                     \
+                                                                                      \
+  int inner_size = MAX (l_max-3, 0) * (M);                                            \
+  int size = MAX (l_max-2, 0) * (M);                                                  \
+                                                                                      \
+  _Pragma ("omp simd")                                                                \
+  for (int o=0; o < inner_size; ++o) {                                                \
+    dy_E[o] = k * (d_minus[o]*y_E[o-(M)] - d_plus[o]*y_E[o+(M)] - d_zero[o]*y_B[o])   \
+              - kappa_dot*y_E[o];                                                     \
+    dy_B[o] = k * (d_minus[o]*y_B[o-(M)] - d_plus[o]*y_B[o+(M)] + d_zero[o]*y_E[o])   \
+              - kappa_dot*y_B[o];                                                     \
+  }                                                                                   \
+                                                                                      \
+  for (int o=inner_size; o < size; ++o) {                                             \
+    dy_E[o] = k * (d_minus[o]*y_E[o-(M)] - d_zero[o]*y_B[o]) - kappa_dot*y_E[o];      \
+    dy_B[o] = k * (d_minus[o]*y_B[o-(M)] + d_zero[o]*y_E[o]) - kappa_dot*y_B[o];      \
+  }                                                                                   \
+                                                                                      \
+  return _SUCCESS_;                                                                   \
+                                                                                      \
+}
+
+/* Scalar modes only (m=0) */
+PERTURB2_FREE_STREAMING_KERNELS (scalar, 1)
+
+/* Scalar, vector and tensor modes (m=0,1,2) */
+PERTURB2_FREE_STREAMING_KERNELS (m012, 3)
+
+
+
+
+/**
+ * Compute the sparsity pattern of the Jacobian of the differential system for
+ * the vector of perturbations ppv, and partition its columns in groups that can
+ * be evaluated together by finite differences.
+ *
+ * The pattern follows the structure of perturb2_derivs():
+ *
+ * - The (l,m) multipole of a radiation hierarchy depends on the (l-1,m), (l,m)
+ *   and (l+1,m) multipoles of the same hierarchy; the E-mode and B-mode
+ *   hierarchies are also coupled to each other.
+ *
+ * - The metric variables, the baryon and cold dark matter moments, and the
+ *   l<=2 radiation multipoles depend on each other through the Einstein
+ *   equations, the collision term and the approximations; we treat them as a
+ *   dense block.
+ *
+ * The different m are never coupled, apart from the dense block. The pattern thus
+ * obtained contains all the nonzero entries of the Jacobian, and maybe a few
+ * more. It depends only on the layout of the vector, so it is recomputed only
+ * when the layout changes, that is, at the approximation switches.
+ *
+ * The groups are built with a greedy colouring of the columns, in the order of
+ * the vector. The columns in the dense block end up in different groups, while
+ * the hierarchies need only a handful of groups regardless of l_max.
+ */
+
+int perturb2_jacobian_pattern (
+      struct precision2 * ppr2,
+      struct background * pba,
+      struct perturbs2 * ppt2,
+      struct perturb2_vector * ppv /**< input: vector with the indices set; output: vector with the pattern */
+      )
+{
+
+  int pt2_size = ppv->pt2_size;
+
+  /* Radiation hierarchies: photon temperature, E-modes, B-modes and neutrinos */
+  int monopole[4] = {ppv->index_pt2_monopole_g, -1, -1, -1};
+  int l_max[4] = {ppv->l_max_g, -1, -1, -1};
+  int partner[4] = {0, 2, 1, 3};
+
+  if (ppt2->has_polarization2 == _TRUE_) {
+    monopole[1] = ppv->index_pt2_monopole_E;
+    monopole[2] = ppv->index_pt2_monopole_B;
+    l_max[1] = l_max[2] = ppv->l_max_pol_g;
+  }
+
+  if (pba->has_ur == _TRUE_) {
+    monopole[3] = ppv->index_pt2_monopole_ur;
+    l_max[3] = ppv->l_max_ur;
+  }
+
+  /* Nothing to do if the layout of the vector did not change since the last call */
+  int key[6] = {pt2_size, l_max[0], l_max[1], l_max[3], ppv->n_hierarchy_b, ppv->n_hierarchy_cdm};
+
+  if ((ppv->jacobian_nnz > 0) && (memcmp (key, ppv->jacobian_key, sizeof(key)) == 0))
+    return _SUCCESS_;
+
+  memcpy (ppv->jacobian_key, key, sizeof(key));
+
+  /* Workspace */
+  int * hierarchy = ppv->jacobian_work;
+  int * l_of = hierarchy + _MAX_NUM_EQUATIONS_;
+  int * index_m_of = l_of + _MAX_NUM_EQUATIONS_;
+  int * dense = index_m_of + _MAX_NUM_EQUATIONS_;
+  int * stamp = dense + _MAX_NUM_EQUATIONS_;
+
+  /* Find out the hierarchy and the multipole of each evolved perturbation. The
+  perturbations that do not belong to a radiation hierarchy have hierarchy=-1 */
+  for (int index_pt=0; index_pt < pt2_size; ++index_pt) {
+    hierarchy[index_pt] = -1;
+    l_of[index_pt] = -1;
+    index_m_of[index_pt] = -1;
+  }
+
+  for (int h=0; h < 4; ++h) {
+    for (int l=0; l <= l_max[h]; ++l) {
+      for (int index_m=0; index_m <= ppr2->index_m_max[l]; ++index_m) {
+        int index_pt = monopole[h] + ppt2->lm_array[l][index_m];
+        hierarchy[index_pt] = h;
+        l_of[index_pt] = l;
+        index_m_of[index_pt] = index_m;
+      }
+    }
+  }
+
+  /* List the perturbations in the dense block, in increasing order */
+  int dense_size = 0;
+
+  for (int index_pt=0; index_pt < pt2_size; ++index_pt)
+    if ((hierarchy[index_pt] < 0) || (l_of[index_pt] <= 2))
+      dense[dense_size++] = index_pt;
+
+  /* Make room for the nonzero entries; each column has at most six entries outside
+  the dense block */
+  int nnz_max = dense_size*dense_size + 6*pt2_size;
+
+  if (nnz_max > ppv->jacobian_Ai_capacity) {
+    class_realloc (ppv->jacobian_Ai, ppv->jacobian_Ai, nnz_max*sizeof(int), ppt2->error_message);
+    ppv->jacobian_Ai_capacity = nnz_max;
+  }
+
+
+  // -------------------------------------------------------------------------------
+  // -                              Fill the pattern                               -
+  // -------------------------------------------------------------------------------
+
+  int nnz = 0;
+
+  for (int j=0; j < pt2_size; ++j) {
+
+    ppv->jacobian_Ap[j] = nnz;
+
+    /* Rows coupled to column j through the hierarchy, sorted */
+    int local[6];
+    int local_size = 0;
+
+    if (hierarchy[j] >= 0) {
+
+      int h = hierarchy[j];
+      int l = l_of[j];
+      int index_m = index_m_of[j];
+      int fields[2] = {h, partner[h]};
+
+      for (int f=0; f < ((partner[h] == h) ? 1 : 2); ++f) {
+        for (int ll=MAX(l-1,0); ll <= MIN(l+1,l_max[fields[f]]); ++ll) {
+
+          if (index_m > ppr2->index_m_max[ll])
+            continue;
+
+          int row = monopole[fields[f]] + ppt2->lm_array[ll][index_m];
+          int pos = local_size++;
+          while ((pos > 0) && (local[pos-1] > row)) {
+            local[pos] = local[pos-1];
+            pos--;
+          }
+          local[pos] = row;
+        }
+      }
+    }
+
+    /* Columns outside the dense block only have the hierarchy entries */
+    if ((hierarchy[j] >= 0) && (l_of[j] > 2)) {
+      for (int b=0; b < local_size; ++b)
+        ppv->jacobian_Ai[nnz++] = local[b];
+      continue;
+    }
+
+    /* Columns in the dense block also have the whole block; merge the two sorted lists */
+    int a = 0, b = 0;
+    while ((a < dense_size) || (b < local_size)) {
+      if ((b == local_size) || ((a < dense_size) && (dense[a] < local[b])))
+        ppv->jacobian_Ai[nnz++] = dense[a++];
+      else if ((a == dense_size) || (local[b] < dense[a]))
+        ppv->jacobian_Ai[nnz++] = local[b++];
+      else {
+        ppv->jacobian_Ai[nnz++] = dense[a++];
+        b++;
+      }
+    }
+  }
+
+  ppv->jacobian_Ap[pt2_size] = nnz;
+  ppv->jacobian_nnz = nnz;
+
+
+  // -------------------------------------------------------------------------------
+  // -                             Colour the columns                              -
+  // -------------------------------------------------------------------------------
+
+  /* Two columns can be in the same group only if they do not share any row. The
+  pattern is symmetric, so that the columns with a nonzero in row r are the rows
+  of column r. */
+  for (int c=0; c < pt2_size; ++c)
+    stamp[c] = -1;
+
+  ppv->jacobian_colour_size = 0;
+
+  for (int j=0; j < pt2_size; ++j) {
+
+    /* Mark the groups of the previous columns that share a row with j */
+    for (int p = ppv->jacobian_Ap[j]; p < ppv->jacobian_Ap[j+1]; ++p) {
+      int r = ppv->jacobian_Ai[p];
+      for (int q = ppv->jacobian_Ap[r]; q < ppv->jacobian_Ap[r+1]; ++q) {
+        int jj = ppv->jacobian_Ai[q];
+        if (jj < j)
+          stamp[ppv->jacobian_colour[jj]] = j;
+      }
+    }
+
+    /* Pick the first free group */
+    int c = 0;
+    while (stamp[c] == j)
+      c++;
+
+    ppv->jacobian_colour[j] = c;
+    ppv->jacobian_colour_size = MAX (ppv->jacobian_colour_size, c+1);
+  }
+
+  if (ppt2->perturbations2_verbose > 5)
+    printf ("     * Jacobian pattern: %d equations, %d nonzero entries, %d groups of columns\n",
+      pt2_size, nnz, ppv->jacobian_colour_size);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Compute the Jacobian of the differential system, d(dy)/dy, at the given time
+ * by finite differences.
+ *
+ * The columns in the same group of the pattern computed by perturb2_jacobian_pattern()
+ * are shifted together, so that the Jacobian costs ppw2->pv->jacobian_colour_size
+ * calls to perturb2_derivs() rather than one call per evolved perturbation.
+ *
+ * This function has the same arguments as perturb2_derivs(), with the addition of
+ * dy, the derivatives at y, and jacobian, the output array with the nonzero
+ * entries in the order of ppw2->pv->jacobian_Ai. It is meant to be used by an
+ * evolver that supports a sparse Jacobian.
+ */
+
+int perturb2_jacobian (
+      double tau, /**< current time */
+      double * y, /**< values of evolved perturbations at tau */
+      double * dy, /**< derivatives of the evolved perturbations at tau, as computed by perturb2_derivs() */
+      double * jacobian, /**< output: nonzero entries of the Jacobian, in compressed sparse column format */
+      void * parameters_and_workspace, /**< same as for perturb2_derivs() */
+      ErrorMsg error_message /**< error message */
+      )
+{
+
+  struct perturb2_parameters_and_workspace * pppaw2 = parameters_and_workspace;
+  struct perturb2_vector * ppv = pppaw2->ppw2->pv;
+  int pt2_size = ppv->pt2_size;
+
+  for (int colour=0; colour < ppv->jacobian_colour_size; ++colour) {
+
+    /* Shift all the columns in the group at once */
+    for (int j=0; j < pt2_size; ++j) {
+      ppv->jacobian_y[j] = y[j];
+      if (ppv->jacobian_colour[j] == colour) {
+        ppv->jacobian_step[j] = _JACOBIAN_STEP_ * MAX (fabs(y[j]), 1);
+        ppv->jacobian_y[j] += ppv->jacobian_step[j];
+      }
+    }
+
+    class_call (perturb2_derivs (
+                  tau,
+                  ppv->jacobian_y,
+                  ppv->jacobian_dy,
+                  parameters_and_workspace,
+                  error_message),
+      error_message,
+      error_message);
+
+    /* Each row of the shifted columns is affected by only one of them */
+    for (int j=0; j < pt2_size; ++j) {
+      if (ppv->jacobian_colour[j] != colour)
+        continue;
+      for (int p = ppv->jacobian_Ap[j]; p < ppv->jacobian_Ap[j+1]; ++p) {
+        int i = ppv->jacobian_Ai[p];
+        jacobian[p] = (ppv->jacobian_dy[i] - dy[i]) / ppv->jacobian_step[j];
+      }
+    }
+  }
+
+  return _SUCCESS_;
+
+}
+
 
-  if (ppt->gauge == synchronous) {
 
-    /* Curvature potential eta */
-    if (ppr2->compute_m[0] == _TRUE_)
-      dy[ppw2->pv->index_pt2_eta] = pvecmetric[ppw2->index_mt2_eta_prime];
+/**
+ * Check that the Jacobian of the differential system at the given time has no
+ * nonzero entries outside the pattern computed by perturb2_jacobian_pattern().
+ *
+ * The full Jacobian is computed by finite differences, shifting one evolved
+ * perturbation at a time, with pt2_size+1 calls to perturb2_derivs(). Since the
+ * second-order system is linear in the evolved perturbations, shifting y[j] leaves
+ * dy[i] unchanged, bit by bit, unless dy[i] depends on y[j]; any change of a row
+ * outside the pattern of column j is an error. The check is slow and is meant for
+ * testing changes to perturb2_derivs() and to the layout of perturb2_vector; it is
+ * performed at the start of each time interval if ppr2->check_jacobian_pattern
+ * is _TRUE_.
+ *
+ * The extra calls to perturb2_derivs() are not counted in ppw2->derivs_calls.
+ */
+
+int perturb2_jacobian_check (
+      double tau, /**< current time */
+      double * y, /**< values of evolved perturbations at tau */
+      void * parameters_and_workspace, /**< same as for perturb2_derivs() */
+      ErrorMsg error_message /**< error message */
+      )
+{
+
+  struct perturb2_parameters_and_workspace * pppaw2 = parameters_and_workspace;
+  struct perturb2_workspace * ppw2 = pppaw2->ppw2;
+  struct perturb2_vector * ppv = ppw2->pv;
+  int pt2_size = ppv->pt2_size;
+  int derivs_calls = ppw2->derivs_calls;
+
+  /* Derivatives at y */
+  double * dy;
+  class_alloc (dy, pt2_size*sizeof(double), error_message);
 
+  class_call (perturb2_derivs (
+                tau,
+                y,
+                dy,
+                parameters_and_workspace,
+                error_message),
+    error_message,
+    error_message);
+
+  for (int j=0; j < pt2_size; ++j) {
+
+    for (int i=0; i < pt2_size; ++i)
+      ppv->jacobian_y[i] = y[i];
+
+    double step = _JACOBIAN_STEP_ * MAX (fabs(y[j]), 1);
+    ppv->jacobian_y[j] += step;
+
+    class_call (perturb2_derivs (
+                  tau,
+                  ppv->jacobian_y,
+                  ppv->jacobian_dy,
+                  parameters_and_workspace,
+                  error_message),
+      error_message,
+      error_message);
+
+    /* The rows of column j in the pattern are sorted */
+    int p = ppv->jacobian_Ap[j];
+
+    for (int i=0; i < pt2_size; ++i) {
+
+      while ((p < ppv->jacobian_Ap[j+1]) && (ppv->jacobian_Ai[p] < i))
+        p++;
+
+      short is_in_pattern = (p < ppv->jacobian_Ap[j+1]) && (ppv->jacobian_Ai[p] == i);
+
+      if ((is_in_pattern == _FALSE_) && (ppv->jacobian_dy[i] != dy[i])) {
+        double entry = (ppv->jacobian_dy[i] - dy[i]) / step;
+        free (dy);
+        class_stop (error_message,
+          "at tau=%g, the Jacobian entry d(dy[%d])/d(y[%d])=%g, with labels '%s' and '%s', is outside its sparsity pattern",
+          tau, i, j, entry, ppv->pt2_labels[i], ppv->pt2_labels[j]);
+      }
+    }
   }
-  
 
-  /* Debug - Print the full content of y and dy, along with comprehensive debug information.
-  This is a good way to debug the differential system step by step. */
-  // if (ppw2->derivs_calls < 4) {
-  //   if ((ppw2->index_k1==ppt2->index_k1_debug)
-  //     && (ppw2->index_k2==ppt2->index_k2_debug)
-  //      && (ppw2->index_k3==ppt2->index_k3_debug)) {
-  //
-  //     printf("> Leaving derivs for the %d time; k=(%g,%g,%g); tau = %.16f\n",
-  //       ppw2->derivs_calls, ppw2->k1, ppw2->k2, ppw2->k, tau);
-  //
-  //     /* Show content of y, dy and dy_quadsources */
-  //     int index_pt;
-  //     for (int index_pt=0; index_pt<ppw2->pv->pt2_size; ++index_pt)
-  //       printf("y[%3d] = %+12.3g,  dy[%3d] = %+12.3g,  %-15s\n",
-  //         index_pt, y[index_pt], index_pt, dy[index_pt],
-  //         ppw2->pv->pt2_labels[index_pt]);
-  //
-  //   }
-  // }
+  ppw2->derivs_calls = derivs_calls;
 
-  /* Debug - Print perturbations as a function of time. */
-  // if ((ppw2->index_k1==15) && (ppw2->index_k2==0) && (ppw2->index_k3==1)) {
-  //   fprintf (stderr, "%17.7g %17.7g %17.7g %17.7g %17.7g %17.7g %17.7g\n",
-  //     tau,
-  //     y[ppw2->pv->index_pt2_monopole_g],
-  //     dy[ppw2->pv->index_pt2_monopole_g],
-  //     I_00,
-  //     I_1m[0],
-  //     N_00,
-  //     N_1m[0]
-  //   );
-  // }
+  if (pppaw2->ppt2->perturbations2_verbose > 5)
+    printf ("     * Jacobian checked at tau=%g: all its nonzero entries are in the pattern of %d entries\n",
+      tau, ppv->jacobian_nnz);
+
+  free (dy);
 
   return _SUCCESS_;
-  
-}   // end of perturb2_derivs
+
+}
 
 
 
@@ -10419,32 +12469,68 @@ int perturb2_quadratic_sources_for_k1k2k (
   // =                                Compute and store                                 =
   // ====================================================================================
 
+  /* If the cache is active, the background and thermodynamics quantities are read
+  from the workspace, where they were stored in perturb2_workspace_init(). The
+  first-order perturbations in k1 and k2 are stored in the cache when we evolve the
+  first k3 mode of a (k1,k2) pair, and read from it for the other k3 modes. The
+  symmetric k-sampling is excluded because in that case k1 and k2 depend on k3. */
+
+  short has_cache = (ppw2->pvecback_cache != NULL);
+
+  ppw2->k1k2_cache_mode = k1k2_cache_off;
+
+  if ((has_cache == _TRUE_) && (ppt2->k3_sampling != sym_k3_sampling)) {
+
+    if ((ppw2->index_k1_cache == ppw2->index_k1) && (ppw2->index_k2_cache == ppw2->index_k2)) {
+      ppw2->k1k2_cache_mode = k1k2_cache_read;
+    }
+    else {
+      ppw2->k1k2_cache_mode = k1k2_cache_fill;
+      ppw2->index_k1_cache = -1;
+      ppw2->index_k2_cache = -1;
+    }
+  }
+
   for (int index_tau=0; index_tau<ppt->tau_size_quadsources; ++index_tau) {
     
     double tau = ppt->tau_sampling_quadsources[index_tau];
 
-    /* Interpolate background-related quantities (pvecback) */
-    class_call (background_at_tau(
-                 pba,
-                 tau, 
-                 pba->normal_info, 
-                 pba->inter_closeby,
-                 &(ppw2->last_index_back), 
-                 ppw2->pvecback),
-      pba->error_message,
-      ppt2->error_message);
+    if (has_cache == _TRUE_) {
 
-    /* Interpolate thermodynamics-related quantities (pvecthermo) */
-    class_call (thermodynamics_at_z(
-                 pba,
-                 pth,
-                 1./ppw2->pvecback[pba->index_bg_a]-1.,  /* redshift z=1./a-1 */
-                 pth->inter_closeby,
-                 &(ppw2->last_index_thermo),
-                 ppw2->pvecback,
-                 ppw2->pvecthermo),
-      pth->error_message,
-      ppt2->error_message);
+      memcpy (ppw2->pvecback,
+        ppw2->pvecback_cache + index_tau*pba->bg_size,
+        pba->bg_size*sizeof(double));
+
+      memcpy (ppw2->pvecthermo,
+        ppw2->pvecthermo_cache + index_tau*pth->th_size,
+        pth->th_size*sizeof(double));
+
+    }
+    else {
+
+      /* Interpolate background-related quantities (pvecback) */
+      class_call (background_at_tau(
+                   pba,
+                   tau, 
+                   pba->normal_info, 
+                   pba->inter_closeby,
+                   &(ppw2->last_index_back), 
+                   ppw2->pvecback),
+        pba->error_message,
+        ppt2->error_message);
+
+      /* Interpolate thermodynamics-related quantities (pvecthermo) */
+      class_call (thermodynamics_at_z(
+                   pba,
+                   pth,
+                   1./ppw2->pvecback[pba->index_bg_a]-1.,  /* redshift z=1./a-1 */
+                   pth->inter_closeby,
+                   &(ppw2->last_index_thermo),
+                   ppw2->pvecback,
+                   ppw2->pvecthermo),
+        pth->error_message,
+        ppt2->error_message);
+    }
 
     /* Compute the value of the quadratic sources and store them first in
     ppw2->pvec_quadsources, and from there to ppw2->quadsources_table, which
@@ -10473,6 +12559,16 @@ int perturb2_quadratic_sources_for_k1k2k (
 
   } // end of for (index_tau)
 
+  /* The cache now contains the first-order perturbations for the current (k1,k2) pair */
+  if (ppw2->k1k2_cache_mode == k1k2_cache_fill) {
+    ppw2->index_k1_cache = ppw2->index_k1;
+    ppw2->index_k2_cache = ppw2->index_k2;
+  }
+
+  /* Outside this function, perturb2_quadratic_sources() is called at generic times, and
+  it must not rely on the cache */
+  ppw2->k1k2_cache_mode = k1k2_cache_off;
+
 
 
   // ====================================================================================
@@ -10722,44 +12818,64 @@ int perturb2_quadratic_sources (
   employing the symmetric k-sampling; otherwise the quadratic sources
   are extracted at the node point ppt->k[index_md_scalars][index_k1]. */
   
-  int index_k1 = (ppt2->k3_sampling==sym_k3_sampling) ? -1 : ppw2->index_k1;
+  /* If the first-order perturbations for the current (k1,k2) pair were already
+  computed for a previous k3 mode, read them from the cache */
   
-	class_call (perturb_song_sources_at_tau_and_k (
-                ppr,
-                ppt,
-                ppt->index_md_scalars,
-                ppt2->index_ic_first_order,
-                tau,
-                index_tau,
-                ppw2->k1,
-                index_k1,
-                qs_size,
-                ppt->inter_normal,
-                &(ppw2->last_index_sources),
-                ppw2->pvec_sources1),
-		ppt->error_message,
-		ppt2->error_message);
+  if ((index_tau >= 0) && (ppw2->k1k2_cache_mode == k1k2_cache_read)) {
+
+    memcpy (ppw2->pvec_sources1, ppw2->sources1_cache + index_tau*qs_size, qs_size*sizeof(double));
+    memcpy (ppw2->pvec_sources2, ppw2->sources2_cache + index_tau*qs_size, qs_size*sizeof(double));
 
-  /* Get first-order quantities in tau and k2, and store the result in
-  ppw2->psources_2 */
+  }
 
-  int index_k2 = (ppt2->k3_sampling==sym_k3_sampling) ? -1 : ppw2->index_k2;
+  else {
 
-	class_call (perturb_song_sources_at_tau_and_k (
-                ppr,
-                ppt,
-                ppt->index_md_scalars,
-                ppt2->index_ic_first_order,
-                tau,
-                index_tau,
-                ppw2->k2,
-                index_k2,
-                qs_size,
-                ppt->inter_normal,
-                &(ppw2->last_index_sources),
-                ppw2->pvec_sources2),
-		ppt->error_message,
-		ppt2->error_message);
+    int index_k1 = (ppt2->k3_sampling==sym_k3_sampling) ? -1 : ppw2->index_k1;
+  
+    class_call (perturb_song_sources_at_tau_and_k (
+                  ppr,
+                  ppt,
+                  ppt->index_md_scalars,
+                  ppt2->index_ic_first_order,
+                  tau,
+                  index_tau,
+                  ppw2->k1,
+                  index_k1,
+                  qs_size,
+                  ppt->inter_normal,
+                  &(ppw2->last_index_sources),
+                  ppw2->pvec_sources1),
+      ppt->error_message,
+      ppt2->error_message);
+
+    /* Get first-order quantities in tau and k2, and store the result in
+    ppw2->psources_2 */
+
+    int index_k2 = (ppt2->k3_sampling==sym_k3_sampling) ? -1 : ppw2->index_k2;
+
+    class_call (perturb_song_sources_at_tau_and_k (
+                  ppr,
+                  ppt,
+                  ppt->index_md_scalars,
+                  ppt2->index_ic_first_order,
+                  tau,
+                  index_tau,
+                  ppw2->k2,
+                  index_k2,
+                  qs_size,
+                  ppt->inter_normal,
+                  &(ppw2->last_index_sources),
+                  ppw2->pvec_sources2),
+      ppt->error_message,
+      ppt2->error_message);
+
+    /* Store the first-order perturbations in the cache, to be reused by the next k3 modes */
+    if ((index_tau >= 0) && (ppw2->k1k2_cache_mode == k1k2_cache_fill)) {
+      memcpy (ppw2->sources1_cache + index_tau*qs_size, ppw2->pvec_sources1, qs_size*sizeof(double));
+      memcpy (ppw2->sources2_cache + index_tau*qs_size, ppw2->pvec_sources2, qs_size*sizeof(double));
+    }
+
+  } // end of if (k1k2_cache_read)
 
  
   /* Debug - Test the interpolation */
@@ -12352,14 +14468,14 @@ int perturb2_sources (
               if ((l1+l2+l)%2!=0)
                 continue;
               
-              /* LOOP ON M1 */
-              for (int m1 = -l1; m1 <= l1; ++m1) {
+              /* LOOP ON M1 - made in such a way that |m2| <= l2 */
+              for (int m1 = MAX(-l1,m-l2); m1 <= MIN(l1,m+l2); ++m1) {
           
                 /* Enforce m1 + m2 - m = 0 */
                 int m2 = m-m1;
           
                 /* Coupling coefficient for this (l,l1,l2,m,m1,m2) */
-                double coupling = ppt2->coupling_coefficients[ppt2->index_pf_t][lm(l,m)][l1][m1+ppt2->l1_max][l2];
+                double coupling = coupling_coefficient(ppt2->index_pf_t,l,m,l1,l2,m1);
           
                 /* Collision term, as appearing on the righ-hand-side of delta_tilde_dot */
                 double c_1 = rot_1(l2,m2)*pvec_sources1[ppt->index_qs_monopole_collision_g+l2];
@@ -12522,14 +14638,14 @@ int perturb2_sources (
               if ((l1+l2+l)%2!=0)
                 continue;
               
-              /* LOOP ON M1 */
-              for (int m1 = -l1; m1 <= l1; ++m1) {
+              /* LOOP ON M1 - made in such a way that |m2| <= l2 */
+              for (int m1 = MAX(-l1,m-l2); m1 <= MIN(l1,m+l2); ++m1) {
           
                 /* Enforce m1 + m2 - m = 0 */
                 int m2 = m-m1;
           
                 /* Coupling coefficient for this (l,l1,l2,m,m1,m2) */
-                double coupling = ppt2->coupling_coefficients[ppt2->index_pf_e][lm(l,m)][l1][m1+ppt2->l1_max][l2];
+                double coupling = coupling_coefficient(ppt2->index_pf_e,l,m,l1,l2,m1);
           
                 /* Collision term, as appearing on the righ-hand-side of delta_tilde_dot.  */
                 double c_I_k1_l1 = rot_1(l1,m1)*pvec_sources1[ppt->index_qs_monopole_collision_g+l1];
@@ -12671,14 +14787,14 @@ int perturb2_sources (
               if ((l1+l2+l)%2==0)
                 continue;
               
-              /* LOOP ON M1 */
-              for (int m1 = -l1; m1 <= l1; ++m1) {
+              /* LOOP ON M1 - made in such a way that |m2| <= l2 */
+              for (int m1 = MAX(-l1,m-l2); m1 <= MIN(l1,m+l2); ++m1) {
           
                 /* Enforce m1 + m2 - m = 0 */
                 int m2 = m-m1;
           
                 /* Coupling coefficient for this (l,l1,l2,m,m1,m2) */
-                double coupling = ppt2->coupling_coefficients[ppt2->index_pf_b][lm(l,m)][l1][m1+ppt2->l1_max][l2];
+                double coupling = coupling_coefficient(ppt2->index_pf_b,l,m,l1,l2,m1);
           
                 /* Collision term, as appearing on the righ-hand-side of delta_tilde_dot.  */
                 double c_I_k1_l1 = rot_1(l1,m1)*pvec_sources1[ppt->index_qs_monopole_collision_g+l1];
@@ -12922,40 +15038,184 @@ int what_if_ndf15_fails(int (*derivs)(double x,
       ppw2->k1, ppw2->index_k1, ppw2->k2, ppw2->index_k2, ppw2->k, ppw2->index_k3, ppw2->cosk1k2);
     fflush(stdout);
   }
-    
-    
-  /* We pass to the Runge-Kutta evolver the same arguments that were passed to the ndf15 one.  Note however
-  that rk relies on the function timescale_and_approximation while ndf15 does not, so make sure that it
-  points to a valid function. In principle we could also pass an exit_strategy function to evolver_rk
-  (e.g. what_if_rk_fails). */
-  extern int evolver_rk();
-  class_call (evolver_rk(
-                derivs,
-                x_ini,
-                x_end,
-                y, 
-                used_in_output,
-                y_size, 
-                parameters_and_workspace_for_derivs,
-                tolerance, 
-                minimum_variation, 
-                evaluate_timescale,
-                timestep_over_timescale, 
-                x_sampling, 
-                x_size,
-                output,
-                print_variables,
-                NULL,
-                error_message),
-    error_message,
-    error_message);
+    
+    
+  /* We pass to the Runge-Kutta evolver the same arguments that were passed to the ndf15 one.  Note however
+  that rk relies on the function timescale_and_approximation while ndf15 does not, so make sure that it
+  points to a valid function. In principle we could also pass an exit_strategy function to evolver_rk
+  (e.g. what_if_rk_fails). */
+  extern int evolver_rk();
+  class_call (evolver_rk(
+                derivs,
+                x_ini,
+                x_end,
+                y, 
+                used_in_output,
+                y_size, 
+                parameters_and_workspace_for_derivs,
+                tolerance, 
+                minimum_variation, 
+                evaluate_timescale,
+                timestep_over_timescale, 
+                x_sampling, 
+                x_size,
+                output,
+                print_variables,
+                NULL,
+                error_message),
+    error_message,
+    error_message);
+
+
+          
+  return _SUCCESS_;
+          
+};
+
+
+
+
+/**
+ * Check whether the line-of-sight sources of the current (k1,k2,k3) mode have
+ * become negligible, so that the evolution can be stopped; see the documentation
+ * of ppr2->sources_cutoff_song.
+ *
+ * The sources have been computed up to the time level index_tau_check-1. They are
+ * negligible if, for each source type, the largest absolute value over the last
+ * _SOURCES_CUTOFF_STRIDE_ levels is smaller than ppr2->sources_cutoff_song times the
+ * largest absolute value over the earlier levels.
+ */
+
+int perturb2_sources_cutoff (
+      struct precision2 * ppr2,
+      struct perturbs2 * ppt2,
+      struct perturb2_workspace * ppw2,
+      int index_tau_check, /**< input, number of time levels computed so far */
+      int * converged /**< output, _TRUE_ if the sources are negligible from now on */
+      )
+{
+
+  *converged = _TRUE_;
+
+  for (int index_tp2=0; index_tp2 < ppt2->tp2_size && *converged; ++index_tp2) {
+
+    double max_before = 0;
+    double max_last = 0;
+
+    for (int index_tau=0; index_tau < index_tau_check; ++index_tau) {
+      if (index_tau < index_tau_check-_SOURCES_CUTOFF_STRIDE_)
+        max_before = MAX (max_before, fabs (sources(index_tp2)));
+      else
+        max_last = MAX (max_last, fabs (sources(index_tp2)));
+    }
+
+    if (max_last > ppr2->sources_cutoff_song*max_before)
+      *converged = _FALSE_;
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Count the time steps taken by the evolver for the current (k1,k2,k3) mode.
+ *
+ * This function is passed to the evolver as print function when the run report
+ * is requested and the mode is not needed for the k_out output, which already
+ * counts the time steps in perturb2_save_perturbations().
+ */
+
+int perturb2_count_steps (
+          double tau, /**< Current conformal time */
+          int index_tau, /**< Location of tau inside ppt2->tau_sampling, or negative for an intermediate time step */
+          double * y, /**< Array with the value of the evolved perturbations in tau */
+          double * dy, /**< Derivative of y with respect to conformal time */
+          void * parameters_and_workspace, /**< Structure with accessory information*/
+          ErrorMsg error_message
+          )
+{
+
+  struct perturb2_parameters_and_workspace * pppaw2 = parameters_and_workspace;
+
+  if (index_tau < 0)
+    pppaw2->ppw2->n_steps++;
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Write the statistics of the differential system to a stream, as the "ode"
+ * member of the JSON run report; see run_report_write().
+ *
+ * The member contains the totals over all the modes, and an array of modes, each
+ * given as [index_k1, index_k2, index_k3, steps, derivs_calls, solve_time, pt2_size,
+ * jacobian_colours, tau_size]; pt2_size and jacobian_colours give the cost of a dense
+ * and of a coloured Jacobian in calls to perturb2_derivs(), while tau_size is the number
+ * of time levels reached by the evolver.
+ * Nothing is written if the statistics were not collected.
+ */
+
+int perturb2_write_run_report (
+          struct perturbs2 * ppt2,
+          FILE * stream
+          )
+{
+
+  if (ppt2->ode_stats == NULL)
+    return _SUCCESS_;
+
+  long int total_steps = 0;
+  long int total_derivs_calls = 0;
+  double total_solve_time = 0;
+
+  for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1) {
+    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+      for (int index_k3 = 0; index_k3 < ppt2->k3_size[index_k1][index_k2]; ++index_k3) {
+        struct perturb2_ode_stats * stats = &(ppt2->ode_stats[index_k1][index_k2][index_k3]);
+        total_steps += stats->steps;
+        total_derivs_calls += stats->derivs_calls;
+        total_solve_time += stats->solve_time;
+      }
+    }
+  }
+
+  fprintf (stream, ",\n  \"ode\": {\n");
+  fprintf (stream, "    \"total_steps\": %ld,\n", total_steps);
+  fprintf (stream, "    \"total_derivs_calls\": %ld,\n", total_derivs_calls);
+  fprintf (stream, "    \"total_solve_time\": %.6g,\n", total_solve_time);
+  fprintf (stream, "    \"mode_columns\": [\"index_k1\", \"index_k2\", \"index_k3\", \"steps\", \"derivs_calls\", \"solve_time\", \"pt2_size\", \"jacobian_colours\", \"tau_size\"],\n");
+  fprintf (stream, "    \"modes\": [");
+
+  short first = _TRUE_;
+
+  for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1) {
+    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+      for (int index_k3 = 0; index_k3 < ppt2->k3_size[index_k1][index_k2]; ++index_k3) {
+
+        struct perturb2_ode_stats * stats = &(ppt2->ode_stats[index_k1][index_k2][index_k3]);
+
+        /* Modes computed by another MPI process or by a previous run */
+        if (stats->derivs_calls == 0)
+          continue;
+
+        fprintf (stream, "%s\n      [%d, %d, %d, %d, %d, %.4g, %d, %d, %d]", (first == _TRUE_) ? "" : ",",
+          index_k1, index_k2, index_k3, stats->steps, stats->derivs_calls, stats->solve_time,
+          stats->pt2_size, stats->jacobian_colours, stats->tau_size);
+
+        first = _FALSE_;
+      }
+    }
+  }
 
+  fprintf (stream, "\n    ]\n  }");
 
-          
   return _SUCCESS_;
-          
-};
 
+}
 
 
 
@@ -14726,10 +16986,10 @@ int perturb2_output(
 
     /* Load the source function from disk if needed */
     if (ppr2->store_sources_to_disk == _TRUE_) {
-      class_call (perturb2_allocate_k1_level(ppt2, index_k1),
+      class_call (perturb2_allocate_k1_level(ppt2, index_k1, ppt2->error_message),
         ppt2->error_message,
         ppt2->error_message);
-      class_call(perturb2_load_sources_from_disk(ppt2, index_k1),
+      class_call(perturb2_load_sources_from_disk(ppt2, index_k1, ppt2->error_message),
         ppt2->error_message,
         ppt2->error_message);
     }
@@ -15254,10 +17514,10 @@ int perturb2_output(
         
         /* Load the source function from disk if needed */
         if (ppr2->store_sources_to_disk == _TRUE_) {
-          class_call (perturb2_allocate_k1_level(ppt2, index_k1),
+          class_call (perturb2_allocate_k1_level(ppt2, index_k1, ppt2->error_message),
             ppt2->error_message,
             ppt2->error_message);
-          class_call(perturb2_load_sources_from_disk(ppt2, index_k1),
+          class_call(perturb2_load_sources_from_disk(ppt2, index_k1, ppt2->error_message),
             ppt2->error_message,
             ppt2->error_message);
         }
@@ -15350,6 +17610,27 @@ int perturb2_store_sources_to_disk(
         )
 {
 
+  /* If the sources are memory mapped, they have been written directly to the sources
+  file by perturb2_solve(); here we only ask the kernel to start writing the k1 level to
+  disk, without waiting for it to finish */
+  if (ppt2->has_sources_map == _TRUE_) {
+
+    if (ppt2->perturbations2_verbose > 1)
+      printf("     \\ flushing sources for index_k1=%d to '%s' ...\n",
+        index_k1, ppt2->sources_map_path);
+
+    size_t length;
+    class_call (perturb2_sources_map_k1_level (ppt2, index_k1, NULL, &length),
+      ppt2->error_message,
+      ppt2->error_message);
+
+    class_test (msync (ppt2->sources_map[index_k1], length, MS_ASYNC) != 0,
+      ppt2->error_message,
+      "could not flush the index_k1=%d level of '%s'", index_k1, ppt2->sources_map_path);
+
+    return _SUCCESS_;
+  }
+
   if (ppt2->perturbations2_verbose > 1)
     printf("     \\ writing sources for index_k1=%d ...\n", index_k1);
 
@@ -15358,29 +17639,58 @@ int perturb2_store_sources_to_disk(
     ppt2->sources_paths[index_k1],
     "wb", ppt2->error_message);
 
-  /* For each type and k2, write the (k3, tau) level to file */
-  for (int index_tp2 = 0; index_tp2 < ppt2->tp2_size; ++index_tp2) {
+  /* Checksum of the data written to the file, in the same order */
+  unsigned long long checksum = _CHECKSUM_SEED_;
 
-    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+  /* Write the compressed sources, if requested */
+  if (ppt2->sources_compression != block_compression_none) {
 
-      class_call (perturb2_store_sources_k3_tau(
-                    ppt2,
-                    index_tp2,
-                    index_k1,
-                    index_k2,
-                    ppt2->sources_paths[index_k1],
-                    ppt2->sources_files[index_k1]),
-        ppt2->error_message,
-        ppt2->error_message);
-        
+    class_call (perturb2_store_sources_compressed (
+                  ppt2,
+                  index_k1,
+                  ppt2->sources_paths[index_k1],
+                  ppt2->sources_files[index_k1],
+                  &checksum),
+      ppt2->error_message,
+      ppt2->error_message);
+  }
+
+  /* Otherwise, for each type and k2, write the (k3, tau) level to file */
+  else {
+
+    for (int index_tp2 = 0; index_tp2 < ppt2->tp2_size; ++index_tp2) {
+
+      for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+
+        class_call (perturb2_store_sources_k3_tau(
+                      ppt2,
+                      index_tp2,
+                      index_k1,
+                      index_k2,
+                      ppt2->sources_paths[index_k1],
+                      ppt2->sources_files[index_k1]),
+          ppt2->error_message,
+          ppt2->error_message);
+
+        perturb2_checksum (
+          ppt2->sources[index_tp2][index_k1][index_k2],
+          ppt2->tau_size*ppt2->k3_size[index_k1][index_k2]*sizeof(double),
+          &checksum);
+
+      }
     }
   }
 
   /* Close file */
-  fclose(ppt2->sources_files[index_k1]);
+  class_test (fclose(ppt2->sources_files[index_k1]) != 0,
+    ppt2->error_message,
+    "could not write to '%s'", ppt2->sources_paths[index_k1]);
 
-  /* Write information on the status file */
-  // class_open (ppt2->sources_status_file, ppt2->sources_status_path, "a+", ppt2->error_message);
+  /* Record in the status file that this k1 level is complete. If the run is
+  interrupted, it will be resumed from the k1 levels that are not listed there. */
+  class_call (perturb2_sources_status_update (ppt2, index_k1, checksum),
+    ppt2->error_message,
+    ppt2->error_message);
 
   return _SUCCESS_;
 
@@ -15418,5 +17728,401 @@ int perturb2_store_sources_k3_tau(
   
 }
 
+
+
+/**
+ * Save to disk the sources in ppt2->sources for a given k1 value, in compressed
+ * form, and update the checksum of the data written.
+ *
+ * The file starts with _BLOCK_MAGIC_, followed by one compressed block for each
+ * (type,k2) pair, in the same order as the uncompressed file; see block_compress().
+ * It ends with the block index, that is, the position in the file of each block
+ * and of the end of the last one, followed by the position of the index itself.
+ * Therefore, any block can be read without reading the others.
+ *
+ * The blocks of each type are compressed in parallel, and then written in order.
+ */
+
+int perturb2_store_sources_compressed(
+        struct perturbs2 * ppt2,
+        int index_k1,
+        char * filepath,
+        FILE * output_stream,
+        unsigned long long * checksum
+        )
+{
+
+  int k2_size = index_k1+1;
+  long int n_blocks = ppt2->tp2_size*k2_size;
+
+  /* Position of each block in the file */
+  long int * block_offset;
+  class_alloc (block_offset, (n_blocks+1)*sizeof(long int), ppt2->error_message);
+
+  /* Room for the compressed blocks of one type */
+  long int * buffer_offset;
+  class_alloc (buffer_offset, (k2_size+1)*sizeof(long int), ppt2->error_message);
+
+  buffer_offset[0] = 0;
+  for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2)
+    buffer_offset[index_k2+1] = buffer_offset[index_k2]
+      + block_compress_bound (ppt2->tau_size*ppt2->k3_size[index_k1][index_k2]);
+
+  unsigned char * buffer;
+  class_alloc (buffer, buffer_offset[k2_size], ppt2->error_message);
+
+  long int * block_size;
+  class_alloc (block_size, k2_size*sizeof(long int), ppt2->error_message);
+
+  unsigned long long magic = _BLOCK_MAGIC_;
+
+  class_test (fwrite (&magic, sizeof(unsigned long long), 1, output_stream) != 1,
+    ppt2->error_message,
+    "could not write to '%s'", filepath);
+
+  perturb2_checksum (&magic, sizeof(unsigned long long), checksum);
+  block_offset[0] = sizeof(unsigned long long);
+
+  for (int index_tp2 = 0; index_tp2 < ppt2->tp2_size; ++index_tp2) {
+
+    int abort = _FALSE_;
+
+    #pragma omp parallel for schedule (dynamic)
+    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+
+      class_call_parallel (block_compress (
+                             ppt2->sources[index_tp2][index_k1][index_k2],
+                             ppt2->tau_size*ppt2->k3_size[index_k1][index_k2],
+                             ppt2->sources_compression,
+                             ppt2->sources_compression_tolerance,
+                             buffer + buffer_offset[index_k2],
+                             &block_size[index_k2],
+                             ppt2->error_message),
+        ppt2->error_message,
+        ppt2->error_message);
+    }
+
+    if (abort == _TRUE_) {
+      free (block_size);
+      free (buffer);
+      free (buffer_offset);
+      free (block_offset);
+      return _FAILURE_;
+    }
+
+    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+
+      class_test (fwrite (buffer + buffer_offset[index_k2], 1, block_size[index_k2], output_stream)
+        != (size_t)block_size[index_k2],
+        ppt2->error_message,
+        "could not write to '%s'", filepath);
+
+      perturb2_checksum (buffer + buffer_offset[index_k2], block_size[index_k2], checksum);
+
+      long int index_block = index_tp2*k2_size + index_k2;
+      block_offset[index_block+1] = block_offset[index_block] + block_size[index_k2];
+    }
+  }
+
+  /* Write the block index, followed by its position */
+  class_test ((fwrite (block_offset, sizeof(long int), n_blocks+1, output_stream) != (size_t)(n_blocks+1))
+           || (fwrite (&block_offset[n_blocks], sizeof(long int), 1, output_stream) != 1),
+    ppt2->error_message,
+    "could not write to '%s'", filepath);
+
+  perturb2_checksum (block_offset, (n_blocks+1)*sizeof(long int), checksum);
+  perturb2_checksum (&block_offset[n_blocks], sizeof(long int), checksum);
+
+  if (ppt2->perturbations2_verbose > 2)
+    printf("     * compressed the sources for index_k1=%d to %.3g%% of their size\n",
+      index_k1, 100.0*block_offset[n_blocks]/buffer_offset[k2_size]);
+
+  free (block_size);
+  free (buffer);
+  free (buffer_offset);
+  free (block_offset);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Update a 64-bit FNV-1a checksum with n_bytes bytes starting at data.
+ *
+ * The checksum must be initialised to _CHECKSUM_SEED_. Since the hash is
+ * computed byte by byte, calling this function on consecutive chunks of
+ * an array gives the same result as calling it once on the whole array;
+ * this is used to compare what is written to a file with what is later
+ * read from it.
+ */
+
+void perturb2_checksum (
+        const void * data,
+        size_t n_bytes,
+        unsigned long long * checksum
+        )
+{
+
+  const unsigned char * bytes = (const unsigned char *)data;
+
+  for (size_t i=0; i < n_bytes; ++i) {
+    *checksum ^= bytes[i];
+    *checksum *= 1099511628211ULL;
+  }
+
+}
+
+
+
+/**
+ * Open the status file of the sources directory and find out which k1
+ * levels of the line-of-sight sources are already stored in it.
+ *
+ * The status file (ppt2->sources_status_path) is created empty by the input
+ * module together with the sources directory. Its first line contains a key
+ * identifying the layout of the sources files (k and tau sampling, number of
+ * source types and k3 sizes); each subsequent line is written by
+ * perturb2_store_sources_to_disk() when a sources file is complete, and contains
+ * its k1 index and the checksum of its content. The last line, written by
+ * perturb2_init() when all the k1 levels are done, is "complete". When running
+ * with more than one MPI process, each process lists its k1 levels in its own
+ * file, sources_status.txt.<mpi_rank>, and only the key and the "complete" line
+ * are written in the shared file.
+ *
+ * If the status files already list some k1 levels, we are resuming an interrupted
+ * run: each listed file is read back and its checksum compared with the recorded
+ * one. The k1 levels that pass the test are flagged in ppt2->has_stored_sources
+ * and will not be computed again by perturb2_init(); the others, including
+ * any file that was being written when the run was interrupted, are computed
+ * from scratch.
+ */
+
+int perturb2_sources_status_init (
+        struct precision2 * ppr2,
+        struct perturbs2 * ppt2
+        )
+{
+
+  class_calloc (ppt2->has_stored_sources, ppt2->k_size, sizeof(short), ppt2->error_message);
+
+  /* Key identifying the layout of the sources files */
+  unsigned long long key = _CHECKSUM_SEED_;
+
+  int sizes[] = {ppt2->k_size, ppt2->tp2_size, ppt2->tau_size};
+  perturb2_checksum (sizes, sizeof(sizes), &key);
+  if (ppt2->sources_compression != block_compression_none) {
+    int compression = ppt2->sources_compression;
+    perturb2_checksum (&compression, sizeof(int), &key);
+    perturb2_checksum (&ppt2->sources_compression_tolerance, sizeof(double), &key);
+  }
+  perturb2_checksum (ppt2->k, ppt2->k_size*sizeof(double), &key);
+  perturb2_checksum (ppt2->tau_sampling, ppt2->tau_size*sizeof(double), &key);
+  for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1)
+    perturb2_checksum (ppt2->k3_size[index_k1], (index_k1+1)*sizeof(int), &key);
+
+  /* Read the status file left by a previous run, if any */
+  FILE * status_file = fopen (ppt2->sources_status_path, "r");
+
+  unsigned long long stored_key;
+  short has_key = (status_file != NULL) && (fscanf (status_file, "key %llx\n", &stored_key) == 1);
+
+  if (has_key == _TRUE_) {
+
+    class_test (stored_key != key,
+      ppt2->error_message,
+      "the sources in '%s' were computed with a different k or tau sampling; remove the directory to start afresh",
+      ppt2->sources_dir);
+
+    int index_k1;
+    unsigned long long checksum;
+    int count = 0;
+
+    /* The k1 levels are listed after the key, and in the files of the MPI processes of
+    previous runs, sources_status.txt.0, sources_status.txt.1, ... */
+    FILE * list_file = status_file;
+
+    for (int index_file = -1; list_file != NULL; ++index_file) {
+
+      while (fscanf (list_file, " k1 %d %llx", &index_k1, &checksum) == 2) {
+
+        if ((index_k1 < 0) || (index_k1 >= ppt2->k_size) || (ppt2->has_stored_sources[index_k1] == _TRUE_))
+          continue;
+
+        /* Each MPI process checks only its own files */
+        if (ppt2->k1_rank[index_k1] != ppr2->mpi_rank)
+          continue;
+
+        short is_valid;
+        class_call (perturb2_sources_file_is_valid (ppt2, index_k1, checksum, &is_valid),
+          ppt2->error_message,
+          ppt2->error_message);
+
+        if (is_valid == _TRUE_) {
+          ppt2->has_stored_sources[index_k1] = _TRUE_;
+          count++;
+        }
+        else if (ppt2->perturbations2_verbose > 1) {
+          printf ("     * the sources file '%s' is incomplete or corrupted, will compute it again\n",
+            ppt2->sources_paths[index_k1]);
+        }
+      }
+
+      if (list_file != status_file)
+        fclose (list_file);
+
+      char list_path[_FILENAMESIZE_+16];
+      sprintf (list_path, "%s.%d", ppt2->sources_status_path, index_file+1);
+      list_file = fopen (list_path, "r");
+    }
+
+    if (ppt2->perturbations2_verbose > 0)
+      printf (" -> resuming interrupted run: %d k1 levels of the sources are already on disk\n",
+        count);
+  }
+
+  if (status_file != NULL)
+    fclose (status_file);
+
+  /* A new status file starts with the key */
+  if ((has_key == _FALSE_) && (ppr2->mpi_rank == 0)) {
+
+    class_open (status_file, ppt2->sources_status_path, "w", ppt2->error_message);
+    fprintf (status_file, "key %llx\n", key);
+    fclose (status_file);
+  }
+
+  /* Appending to a shared file from several nodes is not atomic on network file systems;
+  with more than one MPI process, each process lists its k1 levels in its own file */
+  if (ppr2->mpi_size > 1) {
+    sprintf (ppt2->sources_status_rank_path, "%s.%d", ppt2->sources_status_path, ppr2->mpi_rank);
+    class_open (status_file, ppt2->sources_status_rank_path, "a", ppt2->error_message);
+    fclose (status_file);
+  }
+  else {
+    strcpy (ppt2->sources_status_rank_path, ppt2->sources_status_path);
+  }
+
+  /* Do not let the other MPI processes append to the status file before the key is written */
+  #ifdef _MPI
+  if (ppr2->mpi_size > 1)
+    MPI_Barrier (MPI_COMM_WORLD);
+  #endif
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Append a line to the status file of the sources directory.
+ *
+ * If index_k1 is non-negative, the line records that the sources file for
+ * index_k1 is complete and that its content has the given checksum, and it is
+ * written in the status file of the MPI process (ppt2->sources_status_rank_path);
+ * otherwise, it is the "complete" line that marks all the k1 levels as
+ * done, which only the first MPI process writes in the shared status file. The file is closed after each line, so that the status file is never
+ * left in an inconsistent state if the run is interrupted. Nothing is done
+ * if the sources are not stored to disk in one file per k1.
+ *
+ * This function can be called concurrently by different threads.
+ */
+
+int perturb2_sources_status_update (
+        struct perturbs2 * ppt2,
+        int index_k1,
+        unsigned long long checksum
+        )
+{
+
+  if (ppt2->has_stored_sources == NULL)
+    return _SUCCESS_;
+
+  int status = _SUCCESS_;
+
+  /* The k1 levels go to the file of this MPI process, the final line to the shared one */
+  char * status_path = (index_k1 >= 0) ? ppt2->sources_status_rank_path : ppt2->sources_status_path;
+
+  #pragma omp critical (perturb2_sources_status)
+  {
+    ppt2->sources_status_file = fopen (status_path, "a");
+
+    if (ppt2->sources_status_file == NULL) {
+      status = _FAILURE_;
+    }
+    else {
+      if (index_k1 >= 0)
+        fprintf (ppt2->sources_status_file, "k1 %d %llx\n", index_k1, checksum);
+      else
+        fprintf (ppt2->sources_status_file, "complete\n");
+
+      if (fclose (ppt2->sources_status_file) != 0)
+        status = _FAILURE_;
+    }
+  }
+
+  class_test (status == _FAILURE_,
+    ppt2->error_message,
+    "could not update the status file '%s'", status_path);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Check that the sources file for index_k1 has the expected size and that
+ * its content matches the given checksum, without loading it in
+ * ppt2->sources.
+ */
+
+int perturb2_sources_file_is_valid (
+        struct perturbs2 * ppt2,
+        int index_k1,
+        unsigned long long checksum,
+        short * is_valid
+        )
+{
+
+  *is_valid = _FALSE_;
+
+  /* Number of bytes written by perturb2_store_sources_to_disk() */
+  long int n_bytes = 0;
+  for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2)
+    n_bytes += ppt2->tau_size*ppt2->k3_size[index_k1][index_k2];
+  n_bytes *= ppt2->tp2_size*sizeof(double);
+
+  FILE * input_stream = fopen (ppt2->sources_paths[index_k1], "rb");
+
+  if (input_stream == NULL)
+    return _SUCCESS_;
+
+  size_t buffer_size = 1<<20;
+  unsigned char * buffer;
+  class_alloc (buffer, buffer_size, ppt2->error_message);
+
+  unsigned long long file_checksum = _CHECKSUM_SEED_;
+  long int n_read = 0;
+  size_t n;
+
+  while ((n = fread (buffer, 1, buffer_size, input_stream)) > 0) {
+    perturb2_checksum (buffer, n, &file_checksum);
+    n_read += n;
+  }
+
+  free (buffer);
+  fclose (input_stream);
+
+  /* The size of a compressed file is not known in advance */
+  *is_valid = ((n_read == n_bytes) || (ppt2->sources_compression != block_compression_none))
+    && (file_checksum == checksum);
+
+  return _SUCCESS_;
+
+}
+
 #undef sources
 
@@ -0,0 +1,522 @@
+/** @file song_context.c
+ *
+ * Library interface of SONG: run all the modules for a sequence of parameter
+ * files in the same process, keeping the cosmology-independent tables between
+ * the evaluations; see the documentation of struct song_context in song_context.h.
+ *
+ * The executable song (main/song.c) performs a single evaluation with this
+ * interface.
+ */
+
+#include "song_context.h"
+#include <sys/stat.h>
+
+
+/**
+ * Initialise an empty context.
+ *
+ * If cache_dir is not NULL or empty, the projection functions and the geometrical
+ * factors of the intrinsic bispectrum are kept there between the evaluations (and
+ * between different processes), unless the parameter files choose another directory.
+ */
+
+int song_context_init(
+      struct song_context * psc,
+      char * cache_dir,
+      ErrorMsg error_message
+      )
+{
+
+  psc->stage_size = 0;
+  psc->evaluation_count = 0;
+
+  psc->couplings.key = 0;
+  psc->couplings.coefficients = NULL;
+  psc->couplings.offsets = NULL;
+  psc->couplings.size = 0;
+
+  psc->projection_functions.data = NULL;
+  psc->projection_functions.size = 0;
+
+  psc->geometrical_factors.table_size = 0;
+  psc->geometrical_factors.keys = NULL;
+  psc->geometrical_factors.sizes = NULL;
+  psc->geometrical_factors.tables = NULL;
+
+  strcpy (psc->cache_dir, "");
+
+  if ((cache_dir != NULL) && (strlen (cache_dir) > 0)) {
+
+    class_test (strlen (cache_dir) >= _FILENAMESIZE_,
+      error_message,
+      "the path of the cache directory '%s' is too long", cache_dir);
+
+    strcpy (psc->cache_dir, cache_dir);
+
+    struct stat st;
+    class_test ((stat (psc->cache_dir, &st) != 0) && (mkdir (psc->cache_dir, 0777) != 0),
+      error_message,
+      "could not create the cache directory '%s'", psc->cache_dir);
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Run SONG for the parameter files in argv, with the same command-line syntax of
+ * the song executable (argv[0] is ignored).
+ *
+ * The results of the previous evaluation, if any, are freed first. The stages are
+ * listed in enum song_stages and timed in psc->pr2.report; if one of them fails, its
+ * error message is returned and psc->stage_size tells how far the evaluation got.
+ * The cosmological parameters of each model are read from its parameter files, so
+ * that any parameter can change between evaluations.
+ */
+
+int song_compute(
+      struct song_context * psc,
+      int argc,
+      char ** argv,
+      ErrorMsg error_message
+      )
+{
+
+  class_call (song_free_results (psc, error_message),
+    error_message,
+    error_message);
+
+  class_call (input_init_from_arguments (argc, argv, &psc->pr, &psc->ba, &psc->th,
+                &psc->pt, &psc->tr, &psc->pm, &psc->sp, &psc->nl, &psc->le, &psc->bs,
+                &psc->bi, &psc->fi, &psc->op, error_message),
+    error_message,
+    error_message);
+
+  psc->stage_size = song_input+1;
+
+  class_call (input2_init_from_arguments (argc, argv, &psc->pr, &psc->pr2, &psc->ba, &psc->th,
+                &psc->pt, &psc->pt2, &psc->tr, &psc->bs, &psc->bs2, &psc->tr2, &psc->pm,
+                &psc->sp, &psc->nl, &psc->le, &psc->bi, &psc->fi, &psc->op, error_message),
+    error_message,
+    error_message);
+
+  psc->stage_size = song_input2+1;
+
+  class_call (song_compute_modules (psc, error_message),
+    error_message,
+    error_message);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Run SONG for the parameters in pfc, which have the same format as the content of
+ * the parameter files read by parser_read_file(); the parameters that are not in pfc
+ * take their default values.
+ *
+ * This is the same as song_compute(), but it allows the caller to vary the parameters
+ * in memory, for example by building pfc with parser_init() at each step of an MCMC
+ * chain, without writing parameter files. The content of pfc is copied in
+ * psc->pr.parameter_files_content, so that pfc can be freed or modified by the caller
+ * as soon as this function returns.
+ */
+
+int song_compute_from_content(
+      struct song_context * psc,
+      struct file_content * pfc,
+      ErrorMsg error_message
+      )
+{
+
+  class_call (song_free_results (psc, error_message),
+    error_message,
+    error_message);
+
+  /* Keep a copy of the parameters, as input_init_from_arguments() does with the content
+  of the parameter files */
+  struct file_content fc_empty;
+  fc_empty.size = 0;
+
+  class_alloc (psc->pr.parameter_files_content, sizeof(struct file_content), error_message);
+
+  class_call (parser_cat (pfc, &fc_empty, psc->pr.parameter_files_content, error_message),
+    error_message,
+    error_message);
+
+  /* The copy of the parameters is freed with the other results, even if input_init() fails */
+  psc->stage_size = song_input+1;
+
+  class_call (input_init (pfc, &psc->pr, &psc->ba, &psc->th, &psc->pt, &psc->tr, &psc->pm,
+                &psc->sp, &psc->nl, &psc->le, &psc->bs, &psc->bi, &psc->fi, &psc->op,
+                error_message),
+    error_message,
+    error_message);
+
+  class_call (input2_init (pfc, &psc->pr, &psc->pr2, &psc->ba, &psc->th, &psc->pt, &psc->pt2,
+                &psc->tr, &psc->bs, &psc->bs2, &psc->tr2, &psc->pm, &psc->sp, &psc->nl,
+                &psc->le, &psc->bi, &psc->fi, &psc->op, error_message),
+    error_message,
+    error_message);
+
+  psc->stage_size = song_input2+1;
+
+  class_call (song_compute_modules (psc, error_message),
+    error_message,
+    error_message);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Run all the modules of SONG, from background_init() to output_init(), for the
+ * parameters read by song_compute() or song_compute_from_content().
+ */
+
+int song_compute_modules(
+      struct song_context * psc,
+      ErrorMsg error_message
+      )
+{
+
+  /* Run a stage, time it and record that it is complete */
+  #define song_stage(stage, name, function, function_error_message) {     \
+    class_call (run_report_stage_start (&(psc->pr2.report), name, error_message), \
+      error_message, error_message);                                       \
+    class_call (function, function_error_message, error_message);          \
+    class_call (run_report_stage_end (&(psc->pr2.report), error_message),  \
+      error_message, error_message);                                       \
+    psc->stage_size = stage+1;                                             \
+  }
+
+
+  // ====================================================================================
+  // =                                  Set parameters                                  =
+  // ====================================================================================
+
+  /* Keep the tables that do not depend on cosmology in the context */
+  psc->pt2.kept_couplings = &(psc->couplings);
+  psc->bs2.kept_J = &(psc->projection_functions);
+  psc->pr2.kept_geometrical_factors = &(psc->geometrical_factors);
+
+  /* Keep the tables that do not depend on cosmology in the cache directory of the context */
+  if (strlen (psc->cache_dir) > 0) {
+
+    if (psc->pr2.cache_projection_functions == _FALSE_) {
+      psc->pr2.cache_projection_functions = _TRUE_;
+      strcpy (psc->pr2.projection_functions_cache_dir, psc->cache_dir);
+    }
+
+    if (strlen (psc->pr2.geometrical_factors_cache_dir) == 0) {
+      psc->pr2.cache_geometrical_factors = _TRUE_;
+      strcpy (psc->pr2.geometrical_factors_cache_dir, psc->cache_dir);
+    }
+  }
+
+  /* This interface is meant only for computations that involve second-order perturbations */
+  class_test (psc->pt2.has_perturbations2 == _FALSE_,
+    error_message,
+    "the computation you requested is linear; use 'class' rather than 'song'");
+
+
+  // ====================================================================================
+  // =                                    Run modules                                   =
+  // ====================================================================================
+
+  /* Compute background quantities */
+  song_stage (song_background, "background_init",
+    background_init (&psc->pr, &psc->ba),
+    psc->ba.error_message);
+
+  /* Compute recombination and reionisation quantities */
+  song_stage (song_thermodynamics, "thermodynamics_init",
+    thermodynamics_init (&psc->pr, &psc->ba, &psc->th),
+    psc->th.error_message);
+
+  /* Compute the first-order C_l */
+  song_stage (song_cls, "compute_cls",
+    (psc->pt.has_cls ? compute_cls (&psc->pr, &psc->ba, &psc->th, &psc->pt, &psc->sp, &psc->le,
+      error_message) : _SUCCESS_),
+    error_message);
+
+  /* Compute first and second-order perturbations */
+  song_stage (song_perturbations, "perturb2_init",
+    perturb2_init (&psc->pr, &psc->pr2, &psc->ba, &psc->th, &psc->pt, &psc->pt2),
+    psc->pt2.error_message);
+
+  /* Compute primordial power spectrum from inflation */
+  song_stage (song_primordial, "primordial_init",
+    primordial_init (&psc->pr, &psc->pt, &psc->pm),
+    psc->pm.error_message);
+
+  /* Compute nonlinear corrections */
+  song_stage (song_nonlinear, "nonlinear_init",
+    nonlinear_init (&psc->pr, &psc->ba, &psc->th, &psc->pt, &psc->pm, &psc->nl),
+    psc->nl.error_message);
+
+  /* Compute first-order transfer functions using the line of sight formalism */
+  song_stage (song_transfer, "transfer_init",
+    transfer_init (&psc->pr, &psc->ba, &psc->th, &psc->pt, &psc->nl, &psc->tr),
+    psc->tr.error_message);
+
+  /* Compute geometrical factors needed for the bispectrum integration */
+  song_stage (song_bessel, "bessel_init",
+    bessel_init (&psc->pr, &psc->ba, &psc->th, &psc->tr, &psc->bs),
+    psc->bs.error_message);
+
+  /* Compute geometrical factors needed for the line of sight integration at second order */
+  song_stage (song_bessel2, "bessel2_init",
+    bessel2_init (&psc->pr, &psc->pr2, &psc->pt2, &psc->bs, &psc->bs2),
+    psc->bs2.error_message);
+
+  /* Compute second-order transfer functions using the line of sight formalism */
+  song_stage (song_transfer2, "transfer2_init",
+    transfer2_init (&psc->pr, &psc->pr2, &psc->ba, &psc->th, &psc->pt, &psc->pt2,
+      &psc->bs, &psc->bs2, &psc->tr, &psc->tr2),
+    psc->tr2.error_message);
+
+  /* Compute bispectra */
+  song_stage (song_bispectra, "bispectra_init",
+    bispectra_init (&psc->pr, &psc->ba, &psc->th, &psc->pt, &psc->bs, &psc->tr, &psc->pm,
+      &psc->sp, &psc->le, &psc->bi),
+    psc->bi.error_message);
+
+  /* Compute the intrinsic bispectrum */
+  song_stage (song_bispectra2, "bispectra2_init",
+    bispectra2_init (&psc->pr, &psc->pr2, &psc->ba, &psc->th, &psc->pt, &psc->pt2, &psc->bs,
+      &psc->bs2, &psc->tr, &psc->tr2, &psc->pm, &psc->sp, &psc->le, &psc->bi),
+    psc->bi.error_message);
+
+  /* Compute the intrinsic C_l */
+  song_stage (song_spectra2, "spectra2_init",
+    spectra2_init (&psc->pr, &psc->pr2, &psc->ba, &psc->th, &psc->pt, &psc->pt2, &psc->bs,
+      &psc->bs2, &psc->tr, &psc->tr2, &psc->pm, &psc->le, &psc->bi, &psc->sp),
+    psc->bi.error_message);
+
+  /* Compute Fisher matrix */
+  song_stage (song_fisher, "fisher_init",
+    fisher_init (&psc->pr, &psc->ba, &psc->th, &psc->pt, &psc->bs, &psc->tr, &psc->pm,
+      &psc->sp, &psc->le, &psc->bi, &psc->fi),
+    psc->fi.error_message);
+
+  #undef song_stage
+
+  /* Write output files */
+  class_call (output_init (&psc->ba, &psc->th, &psc->pt, &psc->pm, &psc->tr, &psc->sp,
+                &psc->nl, &psc->le, &psc->bi, &psc->fi, &psc->op),
+    psc->op.error_message,
+    error_message);
+
+  psc->stage_size = song_output+1;
+
+  /* Write the timing and memory report of the evaluation */
+  if (psc->pr2.write_run_report == _TRUE_)
+    class_call (song_write_run_report (psc, error_message),
+      error_message,
+      error_message);
+
+  psc->evaluation_count++;
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Write the timing and memory report of the last evaluation to the output
+ * directory, as run_report.json; with more than one MPI process, each process
+ * writes its own report, run_report_rankXXX.json.
+ */
+
+int song_write_run_report(
+      struct song_context * psc,
+      ErrorMsg error_message
+      )
+{
+
+  char report_path[_FILENAMESIZE_];
+  if (psc->pr2.mpi_size > 1)
+    sprintf (report_path, "%s/run_report_rank%03d.json", psc->op.root, psc->pr2.mpi_rank);
+  else
+    sprintf (report_path, "%s/run_report.json", psc->op.root);
+
+  FILE * report_file;
+  class_open (report_file, report_path, "w", error_message);
+
+  fprintf (report_file, "{\n");
+  fprintf (report_file, "  \"mpi_rank\": %d,\n", psc->pr2.mpi_rank);
+  fprintf (report_file, "  \"mpi_size\": %d,\n", psc->pr2.mpi_size);
+  run_report_write (&psc->pr2.report, report_file);
+  perturb2_write_run_report (&psc->pt2, report_file);
+  fprintf (report_file, "\n}\n");
+  fclose (report_file);
+
+  if (psc->pt2.perturbations2_verbose > 0)
+    printf (" -> written run report to %s\n", report_path);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Free the structures filled by the stages of the last evaluation that were
+ * completed, in the reverse order. The context can then be used for a new
+ * evaluation.
+ *
+ * If the evaluation failed, the stage that failed is psc->stage_size. The
+ * structures of the perturbations stage are freed also in this case, as far as
+ * perturb2_init() had filled them (see ppt2->is_freeable), because the
+ * differential system is the step that most often fails for extreme models.
+ * The other modules do not keep track of what they have allocated, so that the
+ * memory allocated by a stage that fails halfway is lost.
+ */
+
+int song_free_results(
+      struct song_context * psc,
+      ErrorMsg error_message
+      )
+{
+
+  int stage_size = psc->stage_size;
+
+  /* Even if freeing fails, do not free the same structures twice */
+  psc->stage_size = 0;
+
+  if (stage_size > song_fisher)
+    class_call (fisher_free (&psc->bi, &psc->fi),
+      psc->fi.error_message,
+      error_message);
+
+  if (stage_size > song_bispectra)
+    class_call (bispectra_free (&psc->pr, &psc->pt, &psc->sp, &psc->le, &psc->bi),
+      psc->bi.error_message,
+      error_message);
+
+  if (stage_size > song_transfer2)
+    class_call (transfer2_free (&psc->pr2, &psc->pt2, &psc->tr2),
+      psc->tr2.error_message,
+      error_message);
+
+  if (stage_size > song_bessel2)
+    class_call (bessel2_free (&psc->pr, &psc->pr2, &psc->bs, &psc->bs2),
+      psc->bs2.error_message,
+      error_message);
+
+  if (stage_size > song_bessel)
+    class_call (bessel_free (&psc->bs),
+      psc->bs.error_message,
+      error_message);
+
+  if (stage_size > song_transfer)
+    class_call (transfer_free (&psc->tr),
+      psc->tr.error_message,
+      error_message);
+
+  if (stage_size > song_nonlinear)
+    class_call (nonlinear_free (&psc->nl),
+      psc->nl.error_message,
+      error_message);
+
+  if (stage_size > song_primordial)
+    class_call (primordial_free (&psc->pm),
+      psc->pm.error_message,
+      error_message);
+
+  short has_failed_perturbations = (stage_size == song_perturbations);
+
+  if ((stage_size > song_perturbations) || (has_failed_perturbations && psc->pt2.is_freeable))
+    class_call (perturb2_free (&psc->pr2, &psc->pt2),
+      psc->pt2.error_message,
+      error_message);
+
+  if ((stage_size > song_perturbations) || (has_failed_perturbations && psc->pt2.has_solved_perturbations1))
+    class_call (perturb_free (&psc->pt),
+      psc->pt.error_message,
+      error_message);
+
+  if (stage_size > song_cls) {
+
+    class_call (lensing_free (&psc->le),
+      psc->le.error_message,
+      error_message);
+
+    if (psc->pt.has_cls == _TRUE_)
+      class_call (spectra_free (&psc->sp),
+        psc->sp.error_message,
+        error_message);
+  }
+
+  if (stage_size > song_thermodynamics)
+    class_call (thermodynamics_free (&psc->th),
+      psc->th.error_message,
+      error_message);
+
+  if (stage_size > song_background)
+    class_call (background_free (&psc->ba),
+      psc->ba.error_message,
+      error_message);
+
+  if (stage_size > song_input2)
+    class_call (input2_free (&psc->pr2),
+      psc->pr2.error_message,
+      error_message);
+
+  if (stage_size > song_input) {
+    parser_free (psc->pr.parameter_files_content);
+    free (psc->pr.parameter_files_content);
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Free all the memory associated with the context, including the results of
+ * the last evaluation. The cache directory is left on disk, so that other
+ * contexts and processes can use it.
+ */
+
+int song_context_free(
+      struct song_context * psc,
+      ErrorMsg error_message
+      )
+{
+
+  class_call (song_free_results (psc, error_message),
+    error_message,
+    error_message);
+
+  free (psc->couplings.coefficients);
+  free (psc->couplings.offsets);
+  psc->couplings.coefficients = NULL;
+  psc->couplings.offsets = NULL;
+
+  free (psc->projection_functions.data);
+  psc->projection_functions.data = NULL;
+  psc->projection_functions.size = 0;
+
+  for (int index_table=0; index_table < psc->geometrical_factors.table_size; ++index_table)
+    free (psc->geometrical_factors.tables[index_table]);
+  free (psc->geometrical_factors.tables);
+  free (psc->geometrical_factors.keys);
+  free (psc->geometrical_factors.sizes);
+  psc->geometrical_factors.table_size = 0;
+  psc->geometrical_factors.tables = NULL;
+  psc->geometrical_factors.keys = NULL;
+  psc->geometrical_factors.sizes = NULL;
+
+  return _SUCCESS_;
+
+}
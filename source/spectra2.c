@@ -288,304 +288,409 @@ int spectra2_cls (
   /* TEMPORARILY DISABLED */  
   // if ((ppt2->k3_sampling == sym_k3_sampling))
   //   printf("Angular power spectra can only be computed in standart k3 sampling. Change sampling strategy\n");
-    
+
 
   // -------------------------------------------------------------------------------
-  // -                             Sum over M, cycle L                             -
+  // -                          Which spectra to compute?                          -
   // -------------------------------------------------------------------------------
 
+  /* All the requested second-order C_l are computed in a single pass over the
+  transfer functions. For each of them, we store the position of the two transfer
+  functions in ptr2->transfer (for l=m=0) and whether scalar modes should be skipped */
+  int ct2_size = 0;
+  int ct2_index_ct[psp->ct_size];
+  int ct2_index_tt_1[psp->ct_size];
+  int ct2_index_tt_2[psp->ct_size];
+  short ct2_skip_scalars[psp->ct_size];
+
   for (int index_ct=0; index_ct < psp->ct_size; ++index_ct) {
 
     if (psp->cl_type[index_ct] != second_order)
       continue;
 
+    ct2_index_ct[ct2_size] = index_ct;
+    ct2_skip_scalars[ct2_size] = _FALSE_;
+
+    if (psp->has_tt2 && index_ct==psp->index_ct_tt2) {
+      ct2_index_tt_1[ct2_size] = ptr2->index_tt2_T;
+      ct2_index_tt_2[ct2_size] = ptr2->index_tt2_T;
+    }
+    else if (psp->has_ee2 && index_ct==psp->index_ct_ee2) { 
+      ct2_index_tt_1[ct2_size] = ptr2->index_tt2_E;
+      ct2_index_tt_2[ct2_size] = ptr2->index_tt2_E;
+    }
+    else if (psp->has_te2 && index_ct==psp->index_ct_te2) { 
+      ct2_index_tt_1[ct2_size] = ptr2->index_tt2_T;
+      ct2_index_tt_2[ct2_size] = ptr2->index_tt2_E;
+    }
+    else if (psp->has_bb2 && index_ct==psp->index_ct_bb2) {
+      ct2_index_tt_1[ct2_size] = ptr2->index_tt2_B;
+      ct2_index_tt_2[ct2_size] = ptr2->index_tt2_B;
+      ct2_skip_scalars[ct2_size] = _TRUE_; /* scalars do not contribute to b_modes */
+    }
+    else {
+      class_stop (psp->error_message, "second-order Cl_%s not implemented", psp->ct_labels[index_ct]);
+    }
+
     printf_log_if (psp->spectra_verbose, 0,
       " -> computing second-order Cl_%s\n", psp->ct_labels[index_ct]);
 
-    /* Variables used for the output of the parallel computation */
-    int abort = _FALSE_;
-    
-    #pragma omp parallel for schedule (dynamic)
-    for (int index_l=0; index_l<psp->l_size_song; ++index_l) {
+    /* Initialise spectrum */
+    for (int index_l=0; index_l<psp->l_size_song; ++index_l)
+      psp->cl[index_md][index_l * psp->ct_size + index_ct] = 0;
 
-      int l = psp->l_song[index_l];
+    ct2_size++;
+  }
 
-      /* Generate grid for k3 integration. We do it inside the l-loop
-      to avoid race conditions */
-      double * k3_grid = malloc (ptr2->k3_size_max*sizeof(double));
+  if (ct2_size == 0)
+    return _SUCCESS_;
 
-      /* Initialise spectrum */
-      double * result = &psp->cl[index_md][index_l * psp->ct_size + index_ct];
-      *result = 0;
 
-      /* Array to store the various m contributions */
-      double result_m[ppr2->m_size];
+  // -------------------------------------------------------------------------------
+  // -                             Integration weights                             -
+  // -------------------------------------------------------------------------------
 
-      /* Loop over m */
-      for (int index_M=0; index_M < ppr2->m_size; ++index_M) {
+  /* The weights of the (k1,k2,k3) integral do not depend on l, m or on the type of
+  C_l, apart from the rescaling factor sin(theta_1)^(2m) of the second-order transfer
+  functions. We compute them once and for all, together with sin(theta_1)^2, and keep
+  track of the range in k3 where they do not vanish because of the triangular condition.
+  The weights are indexed as weight[index_k1][index_k2][index_k3]. */
+  double *** weight, *** sin2_theta;
+  int ** k3_first, ** k3_last;
+  class_alloc (weight, psp->k_size*sizeof(double **), psp->error_message);
+  class_alloc (sin2_theta, psp->k_size*sizeof(double **), psp->error_message);
+  class_alloc (k3_first, psp->k_size*sizeof(int *), psp->error_message);
+  class_alloc (k3_last, psp->k_size*sizeof(int *), psp->error_message);
+
+  for (int index_k1 = 0; index_k1 < psp->k_size; ++index_k1) {
+    class_alloc (weight[index_k1], (index_k1+1)*sizeof(double *), psp->error_message);
+    class_alloc (sin2_theta[index_k1], (index_k1+1)*sizeof(double *), psp->error_message);
+    class_alloc (k3_first[index_k1], (index_k1+1)*sizeof(int), psp->error_message);
+    class_alloc (k3_last[index_k1], (index_k1+1)*sizeof(int), psp->error_message);
+    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+      int k3_size = ptr2->k_size_k1k2[index_k1][index_k2];
+      class_alloc (weight[index_k1][index_k2], k3_size*sizeof(double), psp->error_message);
+      class_alloc (sin2_theta[index_k1][index_k2], k3_size*sizeof(double), psp->error_message);
+    }
+  }
 
-        int m = ptr2->m[index_M];
-        
-        result_m[index_M] = 0;
-        
-        printf_log_if (psp->spectra_verbose, 1,
-          "     * computing spectra for l = %d m = %d\n", l, m);
+  /* Parallelization variables */
+  int number_of_threads = 1;
+  int abort = _FALSE_;
 
+  #pragma omp parallel
+  {
+    #ifdef _OPENMP
+    number_of_threads = omp_get_num_threads();
+    #endif
+  }
 
-        /* Determine the transfer functions needed to compute the requested Cl */
+  /* The grid in k3 depends on (k1,k2); we allocate one per thread */
+  double ** k3_grid;
+  class_alloc (k3_grid, number_of_threads*sizeof(double *), psp->error_message);
+  for (int thread=0; thread < number_of_threads; ++thread)
+    class_alloc (k3_grid[thread], ptr2->k3_size_max*sizeof(double), psp->error_message);
 
-        int index_tt_1;
-        int index_tt_2;
-      
-        if (psp->has_tt2 && index_ct==psp->index_ct_tt2) {
-          index_tt_1 = ptr2->index_tt2_T + lm_cls(index_l, index_M);
-          index_tt_2 = ptr2->index_tt2_T + lm_cls(index_l, index_M);
-          // printf ("l=%3d[%3d], m=%d[%d]: index_tt = %d\n", l, index_l, m, index_M, index_tt_1);
-        }
-        else if (psp->has_ee2 && index_ct==psp->index_ct_ee2) { 
-          index_tt_1 = ptr2->index_tt2_E + lm_cls(index_l, index_M);
-          index_tt_2 = ptr2->index_tt2_E + lm_cls(index_l, index_M);
-          // printf ("l=%3d[%3d], m=%d[%d]: index_tt = %d\n", l, index_l, m, index_M, index_tt_1);
-        }
-        else if (psp->has_te2 && index_ct==psp->index_ct_te2) { 
-          index_tt_1 = ptr2->index_tt2_T + lm_cls(index_l, index_M);
-          index_tt_2 = ptr2->index_tt2_E + lm_cls(index_l, index_M);
-          // printf ("l=%3d[%3d], m=%d[%d]: index_tt_1 = %d, index_tt_2 = %d\n", l, index_l, m, index_M, index_tt_1, index_tt_2);
-        }
-        else if (psp->has_bb2 && index_ct==psp->index_ct_bb2) {
-          if (m==0) continue; /* scalars do not contribute to b_modes */
-          index_tt_1 = ptr2->index_tt2_B + lm_cls(index_l, index_M);
-          index_tt_2 = ptr2->index_tt2_B + lm_cls(index_l, index_M);
-          // printf ("l=%3d[%3d], m=%d[%d]: index_tt = %d\n", l, index_l, m, index_M, index_tt_1);
-        }
+  #pragma omp parallel for schedule (dynamic)
+  for (int index_k1 = 0; index_k1 < psp->k_size; ++index_k1) {
 
+    int thread = 0;
+    #ifdef _OPENMP
+    thread = omp_get_thread_num();
+    #endif
 
-        /* Load transfer functions if needed */
+    /* Find stepsize */
 
-        if (ppr2->load_transfers_from_disk || ppr2->store_transfers_to_disk) {
+    double step_k1;
+    if (index_k1 == 0) step_k1 = (psp->k[1] - psp->k[0])/2.;
+    else if (index_k1 == psp->k_size-1) step_k1 = (psp->k[psp->k_size-1] - psp->k[psp->k_size -2])/2.;
+    else step_k1 = (psp->k[index_k1+1] - psp->k[index_k1 -1])/2.;
 
-          class_call_parallel (transfer2_load_transfers_from_disk (
-                                 ppt2,
-                                 ptr2,
-                                 index_tt_1),
-            ptr2->error_message,
-            psp->error_message);
+    double k1 = psp->k[index_k1];
 
-          if (index_tt_2 != index_tt_1)
-            class_call_parallel (transfer2_load_transfers_from_disk (
-                                   ppt2,
-                                   ptr2,
-                                   index_tt_2),
-              ptr2->error_message,
-              psp->error_message);
-        }
+    /* Primordial spectrum k1 */
 
+    double spectra_k1;
+    class_call_parallel (primordial_spectrum_at_k (
+                           ppm,
+                           index_md,
+                           linear,
+                           k1,
+                           &spectra_k1),
+      ppm->error_message,
+      psp->error_message);
+    spectra_k1 = 2*_PI_*_PI_/(k1*k1*k1) * spectra_k1;
 
+    /* Loop over k2 */
 
-        // =====================================================================================
-        // =                                Integrate over k1,k2,k3                            =
-        // =====================================================================================
+    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
 
-        for (int index_k1 = 0; index_k1 < psp->k_size; ++index_k1) {
+      /* Find stepsize */
 
-          /* Find stepsize */
+      double step_k2;
+      if (index_k1 == 0) step_k2 = 0.;
+      else if (index_k2 == 0) step_k2 = (psp->k[1] - psp->k[0])/2.;
+      else if (index_k2 == index_k1) step_k2 = (psp->k[index_k1] - psp->k[index_k1-1])/2.;
+      else step_k2 = (psp->k[index_k2+1] - psp->k[index_k2 -1])/2.;
 
-          double step_k1;
-          if (index_k1 == 0) step_k1 = (psp->k[1] - psp->k[0])/2.;
-          else if (index_k1 == psp->k_size-1) step_k1 = (psp->k[psp->k_size-1] - psp->k[psp->k_size -2])/2.;
-          else step_k1 = (psp->k[index_k1+1] - psp->k[index_k1 -1])/2.;
+      double k2 = psp->k[index_k2];
 
-          double k1 = psp->k[index_k1];
 
-          /* Primordial spectrum k1 */
+      /* Primordial spectrum k2 */
 
-          double spectra_k1;
-          class_call_parallel (primordial_spectrum_at_k (
-                                 ppm,
-                                 index_md,
-                                 linear,
-                                 k1,
-                                 &spectra_k1),
-            ppm->error_message,
-            psp->error_message);
-          spectra_k1 = 2*_PI_*_PI_/(k1*k1*k1) * spectra_k1;
+      double spectra_k2;
+      class_call_parallel (primordial_spectrum_at_k (
+                             ppm,
+                             index_md,
+                             linear,
+                             k2,
+                             &spectra_k2),
+        ppm->error_message,
+        psp->error_message);
+      spectra_k2 = 2*_PI_*_PI_/(k2*k2*k2) * spectra_k2;
 
-          /* Loop over k2 */
 
-          for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+      /* Integration grid in k3 */
+
+      int dump;
+      class_call_parallel (transfer2_get_k3_list (
+                             ppr,
+                             ppr2,
+                             ppt2,
+                             pbs,
+                             pbs2,
+                             ptr2,
+                             index_k1,
+                             index_k2,
+                             k3_grid[thread],
+                             &dump
+                             ),
+        ptr2->error_message,
+        psp->error_message);
+
+      double * k3 = k3_grid[thread];
+      int k3_size = ptr2->k_size_k1k2[index_k1][index_k2];
+
+      class_test_parallel (k3_size < 2,
+        psp->error_message,
+        "integration grid has less than two elements, cannot use trapezoidal integration");
+
+      int triangular_first = 0;
+      int triangular_last = 0;
+
+      k3_first[index_k1][index_k2] = k3_size;
+      k3_last[index_k1][index_k2] = -1;
+
+      for (int index_k3 = 0; index_k3 < k3_size; ++index_k3) {
 
-            /* Print some info */
-            printf_log_if (psp->spectra_verbose, 2,
-              "     \\ computing integral for (k1,k2) = (%.3g,%.3g)\n",
-              psp->k[index_k1], psp->k[index_k2]);
+        /* Find stepsize including the triangular condition edge */
 
+        double step_k3;
+        if (index_k3 == 0) step_k3 = (k3[1] - k3[0])/2.;
+        else if (index_k3 == k3_size -1) step_k3 = (k3[k3_size-1] - k3[k3_size -2])/2.;
+        else step_k3 = (k3[index_k3+1] - k3[index_k3 -1])/2.;
 
-            /* Find stepsize */
+        /* Triangular condition */
 
-            double step_k2;
-            if (index_k1 == 0) step_k2 = 0.;
-            else if (index_k2 == 0) step_k2 = (psp->k[1] - psp->k[0])/2.;
-            else if (index_k2 == index_k1) step_k2 = (psp->k[index_k1] - psp->k[index_k1-1])/2.;
-            else step_k2 = (psp->k[index_k2+1] - psp->k[index_k2 -1])/2.;
+        if ( k3[index_k3] < k1-k2 ||  k3[index_k3] > k1+k2) { // out of triangular region
+          step_k3 = 0.;
+        }
+        if ( k3[index_k3] >= k1-k2 && triangular_first == 0 && index_k3 < k3_size-1 ) { //first point
+          triangular_first = 1;
+          step_k3 = (k3[index_k3+1]-k3[index_k3])/2. + k3[index_k3] - (k1-k2);
+        }
+        if ( k3[index_k3+1] > k1+k2 && triangular_last == 0 && index_k3 > 0) {
+          //last point, note that this may not be found if the last point is bigger than kmax,
+          // however in that case no special treatment for the last point is needed.
+          triangular_last = 1;
+          step_k3 = (k3[index_k3] - k3[index_k3-1])/2. + (k1+k2) - k3[index_k3];
+        }
+
+        /* If we are in the extrapolated range, this k3 does not contribute */
+        weight[index_k1][index_k2][index_k3] = 0;
+        sin2_theta[index_k1][index_k2][index_k3] = 0;
 
-            double k2 = psp->k[index_k2];
+        if (step_k3 == 0)
+          continue;
 
+        k3_first[index_k1][index_k2] = MIN (k3_first[index_k1][index_k2], index_k3);
+        k3_last[index_k1][index_k2] = index_k3;
 
-            /* Primordial spectrum k2 */
+        /* This counters the rescaling performed for the bispectrum */
+        double cos_theta = (k3[index_k3]*k3[index_k3] + k1*k1 - k2*k2)/2./k3[index_k3]/k1;
+        sin2_theta[index_k1][index_k2][index_k3] = 1. - cos_theta*cos_theta;
 
-            double spectra_k2;
-            class_call_parallel (primordial_spectrum_at_k (
-                                   ppm,
-                                   index_md,
-                                   linear,
-                                   k2,
-                                   &spectra_k2),
-              ppm->error_message,
-              psp->error_message);
-            spectra_k2 = 2*_PI_*_PI_/(k2*k2*k2) * spectra_k2;
+        weight[index_k1][index_k2][index_k3] =
+            // symmetry factor (doing only half plane in k1 k2)
+            2.*
+            // integration weight
+            k1*k2*k3[index_k3]*
+            // integration stepsize
+            step_k1*step_k2*step_k3*
+            // spectra factors (2l+1) already in transfer def (how does sum over m work? does this need a factor 2 for m neq 0? yes :))
+            2. /_PI_ /2./_PI_/2./_PI_/2./_PI_ *
+            // definition of second order perturbation theory
+            // already in transfer definition 1./2./2.*
+            // factor 4 of Delta also already in transfer def
+            // primordial spectra
+            spectra_k1 * spectra_k2;
 
+      } // loop k3
+    } // loop k2
 
-            /* Integration grid in k3 */
+    #pragma omp flush(abort)
 
-            int dump;
-            class_call_parallel (transfer2_get_k3_list (
-                                   ppr,
-                                   ppr2,
-                                   ppt2,
-                                   pbs,
-                                   pbs2,
-                                   ptr2,
-                                   index_k1,
-                                   index_k2,
-                                   k3_grid,
-                                   &dump
-                                   ),
-              ptr2->error_message,
-              psp->error_message);
+  } // loop k1
+  if (abort == _TRUE_) return _FAILURE_;
+
+  for (int thread=0; thread < number_of_threads; ++thread)
+    free (k3_grid[thread]);
+  free (k3_grid);
+
+
+  // -------------------------------------------------------------------------------
+  // -                     Sum over M and k1,k2,k3, cycle L                        -
+  // -------------------------------------------------------------------------------
 
-            int k3_size = ptr2->k_size_k1k2[index_k1][index_k2];
+  /* We distribute between the threads the (l,k1) pairs, so that all cores are used even
+  when only a few l are requested. If the transfer functions are stored on disk, we
+  load them one l at a time outside of the parallel region, otherwise we consider all
+  l values at once. */
+  short transfers_on_disk = (ppr2->load_transfers_from_disk || ppr2->store_transfers_to_disk);
+  int l_block_size = transfers_on_disk ? 1 : psp->l_size_song;
+
+  /* Time spent by each thread summing over the (l,k1) pairs; the disk access is not included */
+  int index_region;
+  class_call (run_report_region (&(ppr2->report), "spectra2_cls", "", number_of_threads,
+                &index_region, psp->error_message),
+    psp->error_message,
+    psp->error_message);
 
-            class_test_parallel (k3_size < 2,
-              psp->error_message,
-              "integration grid has less than two elements, cannot use trapezoidal integration");
+  for (int index_l_start=0; index_l_start < psp->l_size_song; index_l_start += l_block_size) {
 
+    /* Transfer types needed for this l; different C_l types share the same T or E
+    transfer functions, which must be loaded and freed only once */
+    int tt_size = 0;
+    int tt_list[2*ct2_size*ppr2->m_size];
 
-            /* Define the pointer to the second-order transfer functions as a function of k3.
-            Note that this transfer function has already been rescaled according to eq. 6.26
-            of http://arxiv.org/abs/1405.2280 in the perturbations.c module.  */
+    if (transfers_on_disk) {
+      for (int index_M=0; index_M < ppr2->m_size; ++index_M) {
+        for (int index_ct2=0; index_ct2 < ct2_size; ++index_ct2) {
+          for (int i=0; i < 2; ++i) {
+            int index_tt = (i==0 ? ct2_index_tt_1[index_ct2] : ct2_index_tt_2[index_ct2])
+                           + lm_cls(index_l_start, index_M);
+            short is_listed = _FALSE_;
+            for (int index_list=0; index_list < tt_size; ++index_list)
+              if (tt_list[index_list] == index_tt)
+                is_listed = _TRUE_;
+            if (is_listed == _FALSE_)
+              tt_list[tt_size++] = index_tt;
+          }
+        }
+      }
+    }
 
-            double * transfer_1 = ptr2->transfer[index_tt_1][index_k1][index_k2];
-            double * transfer_2 = ptr2->transfer[index_tt_2][index_k1][index_k2];
+    /* Load all the transfer functions needed for this l */
+    for (int index_list=0; index_list < tt_size; ++index_list)
+      class_call (transfer2_load_transfers_from_disk (ppr2, ppt2, ptr2, tt_list[index_list]),
+        ptr2->error_message,
+        psp->error_message);
 
-            int triangular_first = 0;
-            int triangular_last = 0;
+    double region_start = run_report_time();
 
-            /* Final integration over k3 */
+    #pragma omp parallel for collapse (2) schedule (dynamic)
+    for (int index_l=index_l_start; index_l < index_l_start+l_block_size; ++index_l) {
+      for (int index_k1 = 0; index_k1 < psp->k_size; ++index_k1) {
 
-            for (int index_k3 = 0; index_k3 < k3_size; ++index_k3) {
+        int thread = 0;
+        #ifdef _OPENMP
+        thread = omp_get_thread_num();
+        #endif
 
-              double k3 = k3_grid[index_k3];
+        double busy_start = run_report_time();
 
-              /* Find stepsize including the triangular condition edge */
+        /* Contribution of this k1 to the requested C_l */
+        double result[ct2_size];
+        for (int index_ct2=0; index_ct2 < ct2_size; ++index_ct2)
+          result[index_ct2] = 0;
 
-              double step_k3;
-              if (index_k3 == 0) step_k3 = (k3_grid[1] - k3_grid[0])/2.;
-              else if (index_k3 == k3_size -1) step_k3 = (k3_grid[k3_size-1] - k3_grid[k3_size -2])/2.;
-              else step_k3 = (k3_grid[index_k3+1] - k3_grid[index_k3 -1])/2.;
+        /* Loop over m */
+        for (int index_M=0; index_M < ppr2->m_size; ++index_M) {
 
-              /* Triangular condition */
+          int m = ptr2->m[index_M];
 
-              if ( k3 < k1-k2 ||  k3 > k1+k2) { // out of triangular region
-                step_k3 = 0.;
-              }
-              if ( k3 >= k1-k2 && triangular_first == 0 && index_k3 < k3_size-1 ) { //first point
-                triangular_first = 1;
-                step_k3 = (k3_grid[index_k3+1]-k3)/2. + k3 - (k1-k2);
+          if (index_k1 == 0)
+            printf_log_if (psp->spectra_verbose, 1,
+              "     * computing spectra for l = %d m = %d\n", psp->l_song[index_l], m);
+
+          for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+
+            double * w = weight[index_k1][index_k2];
+            double * sin2 = sin2_theta[index_k1][index_k2];
+            int first = k3_first[index_k1][index_k2];
+            int last = k3_last[index_k1][index_k2];
+
+            /* Note that the transfer functions have already been rescaled according to eq. 6.26
+            of http://arxiv.org/abs/1405.2280 in the perturbations.c module; we invert the
+            rescaling with the factor sin(theta_1)^(2m) */
+            for (int index_ct2=0; index_ct2 < ct2_size; ++index_ct2) {
+
+              if ((m == 0) && ct2_skip_scalars[index_ct2])
+                continue;
+
+              double * transfer_1 = ptr2->transfer[ct2_index_tt_1[index_ct2] + lm_cls(index_l, index_M)][index_k1][index_k2];
+              double * transfer_2 = ptr2->transfer[ct2_index_tt_2[index_ct2] + lm_cls(index_l, index_M)][index_k1][index_k2];
+              double integral = 0;
+
+              if (ppt2->rescale_cmb_sources && (m != 0)) {
+                for (int index_k3 = first; index_k3 <= last; ++index_k3)
+                  integral += w[index_k3] * pow (sin2[index_k3], m) * transfer_1[index_k3] * transfer_2[index_k3];
               }
-              if ( k3_grid[index_k3+1] > k1+k2 && triangular_last == 0 && index_k3 > 0) {
-                //last point, note that this may not be found if the last point is bigger than kmax,
-                // however in that case no special treatment for the last point is needed.
-                triangular_last = 1;
-                step_k3 = (k3 - k3_grid[index_k3-1])/2. + (k1+k2) - k3;
+              else {
+                #pragma omp simd reduction(+:integral)
+                for (int index_k3 = first; index_k3 <= last; ++index_k3)
+                  integral += w[index_k3] * transfer_1[index_k3] * transfer_2[index_k3];
               }
-              
-              /* If we are in the extrapolated range, skip this k3 */
-              if (step_k3 == 0)
-                continue;
 
-              /* This counters the rescaling performed for the bispectrum */
-              double scale = pow(sqrt( 1. - pow((k3*k3 + k1*k1 - k2*k2)/2./k3/k1,2)),m);
-
-
-              // =====================================================================================
-              // =                                Add up contributions                               =
-              // =====================================================================================
-
-              double total_factor =
-                  // symmetry factor (doing only half plane in k1 k2)
-                  2.*
-                  // integration weight
-                  k1*k2*k3*
-                  // integration stepsize
-                  step_k1*step_k2*step_k3*
-                  // if the sources were rescaled we have to invert this for the cl spectrum rescaling
-                  // the step_k3 condition makes sure that this is in triangular as the computation of angles fails out of trinagular region
-                  (ppt2->rescale_cmb_sources && step_k3 != 0. ? pow(scale,2) : 1. )*
-                  // spectra factors (2l+1) already in transfer def (how does sum over m work? does this need a factor 2 for m neq 0? yes :))
-                  2. /_PI_ /2./_PI_/2./_PI_/2./_PI_ *
-                  // definition of second order perturbation theory
-                  // already in transfer definition 1./2./2.*
-                  // factor 4 of Delta also already in transfer def
-                  // primordial spectra
-                  spectra_k1 * spectra_k2;
-
-              double integrand = total_factor * transfer_1[index_k3] * transfer_2[index_k3];
-
-              *result += integrand;
-              result_m[index_M] += integrand;
-
-              /* Debug: print the integrand function */
-              // if (l==2 && m==0)
-              //   printf ("integrand = %g, result =%g\n", integrand, *result);
-
-            } // loop k3
+              result[index_ct2] += integral;
+
+            } // loop ct
           } // loop k2
-        } // loop k1
-
-        if (ppr2->load_transfers_from_disk || ppr2->store_transfers_to_disk) {
-
-          class_call_parallel (transfer2_free_type_level (
-                                 ppt2,
-                                 ptr2,
-                                 index_tt_1),
-            ptr2->error_message,
-            psp->error_message);
-
-          if (index_tt_2 != index_tt_1)
-            class_call_parallel (transfer2_free_type_level (
-                                   ppt2,
-                                   ptr2,
-                                   index_tt_2),
-              ptr2->error_message,
-              psp->error_message);
+        } // sum over M
+
+        for (int index_ct2=0; index_ct2 < ct2_size; ++index_ct2) {
+          #pragma omp atomic
+          psp->cl[index_md][index_l * psp->ct_size + ct2_index_ct[index_ct2]] += result[index_ct2];
         }
 
-        /* Debug: print the M contribution */
-        // if (m==0 || m==1)
-        //   printf ("%10d %14g %14g\n", l, result_m[index_M], *result);
+        ppr2->report.regions[index_region].busy_time[thread] += run_report_time() - busy_start;
 
-      } // sum over M
-    
-      free (k3_grid);
-      
-      #pragma omp flush(abort)
-      
+      } // loop k1
     } // loop over l
 
-    if (abort)
-      return _FAILURE_;
+    ppr2->report.regions[index_region].wall_time += run_report_time() - region_start;
 
-  } // loop over ct
+    for (int index_list=0; index_list < tt_size; ++index_list)
+      class_call (transfer2_free_type_level (ppt2, ptr2, tt_list[index_list]),
+        ptr2->error_message,
+        psp->error_message);
+
+  } // loop over l blocks
+
+  for (int index_k1 = 0; index_k1 < psp->k_size; ++index_k1) {
+    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+      free (weight[index_k1][index_k2]);
+      free (sin2_theta[index_k1][index_k2]);
+    }
+    free (weight[index_k1]);
+    free (sin2_theta[index_k1]);
+    free (k3_first[index_k1]);
+    free (k3_last[index_k1]);
+  }
+  free (weight);
+  free (sin2_theta);
+  free (k3_first);
+  free (k3_last);
 
 
   // =====================================================================================
@@ -28,6 +28,11 @@
  * memory. To reload them from disk, use transfer2_load_transfers_from_disk().
  * To free again the memory associated to the sources, call
  * transfer2_free_type_level().
+ *
+ * If the user specified 'stream_transfers=yes', the module only computes the
+ * indices and the k-samplings; the transfer functions are computed one k1 level
+ * at a time by the bispectrum module with transfer2_stream_k1_level(), which
+ * integrates them over k3 and frees them before moving to the next level.
  * 
  * Created by Guido W. Pettinari on 04.06.2012 based on transfer.c by the CLASS
  * team (http://class-code.net/).
@@ -35,6 +40,7 @@
  */
 
 #include "transfer2.h"
+#include <unistd.h>
 
 
 /**
@@ -152,10 +158,28 @@ int transfer2_init(
     
     if (ptr2->transfer2_verbose > 0)
       printf(" -> leaving transfer2 module; transfer functions will be read from disk\n");
+
+    /* When running with MPI, only the first process evaluates the subsequent modules */
+    if (ppr2->mpi_rank > 0) {
+      ppt->has_cls = _FALSE_;
+      ppt->has_cmb_bispectra = _FALSE_;
+      ppt2->has_cmb_spectra = _FALSE_;
+      ppt2->has_cmb_bispectra = _FALSE_;
+    }
     
     return _SUCCESS_;
   }
 
+  /* If the user requested to stream the transfer functions to the bispectrum module, they
+  will be computed there, one k1 level at a time, with transfer2_stream_k1_level() */
+  if (ppr2->stream_transfers == _TRUE_) {
+
+    if (ptr2->transfer2_verbose > 0)
+      printf(" -> leaving transfer2 module; transfer functions will be computed by the bispectrum module\n");
+
+    return _SUCCESS_;
+  }
+
 
   // ==================================================================================
   // =                               Allocate workspaces                              =
@@ -164,123 +188,25 @@ int transfer2_init(
   /* - Parallelization variables */
 
   int number_of_threads = 1;
-  int thread = 0;
-  int abort = _FALSE_;
 
   #ifdef _OPENMP
   #pragma omp parallel
   number_of_threads = omp_get_num_threads();
   #endif
   
-
   /* - Allocate a workspace per thread */
     
   struct transfer2_workspace ** ppw;
-  class_alloc(ppw, number_of_threads*sizeof(struct transfer2_workspace*), ptr2->error_message);
-    
-  /* We shall allocate the time arrays with the maximum possible number of integration steps */
-  int tau_size_max;
-
-  /* In the sources time sampling, the integration grid matches the sources time sampling */
-  if (ptr2->tau_sampling == sources_tau_sampling) {
-    tau_size_max = ppt2->tau_size;
-  }
-
-  /* In the custom time sampling, the number of steps depend on the considered wavemode; the
-  largest k will have more time steps because the projection function, J(k(tau0-tau)),
-  oscillates faster in time. */
-  else if (ptr2->tau_sampling == custom_tau_sampling) {
-    double k_max = ptr2->k_max_k1k2[ppt2->k_size-1][ppt2->k_size-1];
-    double tau_step_min = 2*_PI_/k_max*ppr2->tau_linstep_song;
-    double tau_max = ppt2->tau_sampling[ppt2->tau_size-1];
-    tau_size_max = ppt2->tau_size + ceil(tau_max/tau_step_min) + 1;
-  }
-
-  /* In the bessel sampling, we take as many steps as the points where the Bessel functions
-  are sampled */
-  else if (ptr2->tau_sampling == bessel_tau_sampling) {
-    tau_size_max = ppt2->tau_size + pbs2->xx_size;
-  }
-
-  /* Print some information on the finest time grid that will be used */
-  if (ptr2->transfer2_verbose > 0)
-    printf (" -> maximum number of time steps in the LOS integration = %d\n", tau_size_max);
-  
-  /* Allocate arrays in the workspace */
-  abort = _FALSE_;
-  #pragma omp parallel shared(ppw,ptr2) private(thread)
-  {
-
-    #ifdef _OPENMP
-    thread = omp_get_thread_num();
-    #endif
-    
-    /* Allocate workspace array */
-    class_alloc_parallel(
-      ppw[thread],
-      sizeof(struct transfer2_workspace),
-      ptr2->error_message);
-
-    /* Allocate the k-grid with the maximum possible number of k3-values  */
-    class_alloc_parallel(
-      ppw[thread]->k_grid,
-      ptr2->k3_size_max*sizeof(double),
-      ptr2->error_message);
-
-    /* Allocate the integration grid array. */
-    class_alloc_parallel(
-      ppw[thread]->tau_grid,
-      tau_size_max*sizeof(double),
-      ptr2->error_message);
-    
-    /* Allocate tau0_minus_tau */
-    class_alloc_parallel(
-      ppw[thread]->tau0_minus_tau,
-      tau_size_max*sizeof(double),
-      ptr2->error_message);
-    
-    /* Allocate delta_tau, the trapezoidal measure of the line-of-sight integral. This array
-    is defined as tau(i+1)-tau(i-1) except for the first and last elements, which are,
-    respectively, tau(1)-tau(0) and tau(N)-tau(N-1). */
-    class_alloc_parallel(
-      ppw[thread]->delta_tau,
-      tau_size_max*sizeof(double),
-      ptr2->error_message);
-    
-    /* Allocate index_tau_left, an array useful for the time interpolation of the sources (see header file) */
-    class_alloc_parallel(
-      ppw[thread]->index_tau_left,
-      tau_size_max*sizeof(double),
-      ptr2->error_message);
-
-    /* Allocate the array that will contain the second derivatives of the sources with respect to time,
-    in view of spline interpolation */
-    class_alloc_parallel (
-      ppw[thread]->sources_time_spline,
-      ppt2->tp2_size*sizeof(double *),
-      ptr2->error_message);
-
-    for (int index_tp=0; index_tp<ppt2->tp2_size; ++index_tp)
-      class_alloc_parallel(
-        ppw[thread]->sources_time_spline[index_tp],
-        tau_size_max*sizeof(double),
-        ptr2->error_message);
-
-    /* Allocate the array that will contain the sources interpolated at the exact time-values in the integration grid */
-    class_alloc_parallel (
-      ppw[thread]->interpolated_sources_in_time,
-      ppt2->tp2_size*sizeof(double *),
-      ptr2->error_message);
-
-    for (int index_tp=0; index_tp<ppt2->tp2_size; ++index_tp)
-      class_alloc_parallel(
-        ppw[thread]->interpolated_sources_in_time[index_tp],
-        tau_size_max*sizeof(double),
-        ptr2->error_message);
 
-  } // end of parallel region
-  
-  if (abort == _TRUE_) return _FAILURE_;
+  class_call (transfer2_workspace_init (
+                ppr2,
+                ppt2,
+                pbs2,
+                ptr2,
+                number_of_threads,
+                &ppw),
+    ptr2->error_message,
+    ptr2->error_message);
 
   #ifdef _OPENMP
   if (ptr2->transfer2_verbose > 3)
@@ -312,8 +238,54 @@ int transfer2_init(
   if (ptr2->transfer2_verbose > 0)
     printf(" -> starting actual computation of second-order transfer functions\n");
 
+  /* Are the line-of-sight sources read from disk at the beginning of each k1 iteration,
+  and the transfer functions written to disk at its end? */
+  short has_sources_io = (ppr2->load_sources_from_disk == _TRUE_) || (ppr2->store_sources_to_disk == _TRUE_);
+  short has_transfers_io = (ppr2->store_transfers_to_disk == _TRUE_);
+
+  /* If requested, overlap the disk access with the computation. While the threads
+  compute the transfer functions for index_k1, an extra thread loads the sources for
+  the next k1 level and writes to disk the transfer functions for the previous one. This requires
+  at most two k1 levels of ppt2->sources and of ptr2->transfer in memory at the same
+  time. The computation runs in a nested parallel region, so that it can use all the
+  threads; see transfer2_prefetch_k1_level(). */
+  short has_prefetch = (ppr2->prefetch_sources == _TRUE_) && (has_sources_io || has_transfers_io);
+
+  #ifdef _OPENMP
+  int max_active_levels = omp_get_max_active_levels();
+  if (has_prefetch == _TRUE_)
+    omp_set_max_active_levels (MAX (max_active_levels, 2));
+  #endif
+
+  if ((has_prefetch == _TRUE_) && (ptr2->transfer2_verbose > 1))
+    printf (" -> disk access will be overlapped with the computation of the transfer functions\n");
+
+  /* List the k1 levels to be computed by this process. The levels assigned to other MPI
+  processes and those already stored to disk by an interrupted run are skipped; the
+  corresponding sources are freed, if they were kept in memory. */
+  int * k1_list;
+  int k1_list_size = 0;
+  class_alloc (k1_list, ppt2->k_size*sizeof(int), ptr2->error_message);
+
   for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1) {
 
+    if ((ptr2->k1_rank[index_k1] == ppr2->mpi_rank)
+    && ((ptr2->has_stored_transfers == NULL) || (ptr2->has_stored_transfers[index_k1] == _FALSE_)))
+      k1_list[k1_list_size++] = index_k1;
+
+    else if (ppt2->has_allocated_sources[index_k1] == _TRUE_)
+      class_call (perturb2_free_k1_level (ppt2, index_k1),
+        ppt2->error_message, ptr2->error_message);
+  }
+
+  for (int index_k1_list = 0; index_k1_list < k1_list_size; ++index_k1_list) {
+
+    int index_k1 = k1_list[index_k1_list];
+
+    /* Previous and next k1 levels computed by this process, or -1 if there are none */
+    int index_k1_previous = (index_k1_list > 0) ? k1_list[index_k1_list-1] : -1;
+    int index_k1_next = (index_k1_list < k1_list_size-1) ? k1_list[index_k1_list+1] : -1;
+
     if (ptr2->transfer2_verbose > 1)
       printf ("     * computing transfer functions today for index_k1=%d of %d, k1=%g\n",
         index_k1, ppt2->k_size, ppt2->k[index_k1]);
@@ -324,227 +296,96 @@ int transfer2_init(
     // -----------------------------------------------------------------------------
     
     /* Allocate the remaining levels of ptr2->transfer */
-    class_call(transfer2_allocate_k1_level(ppt2, ptr2, index_k1),
+    class_call(transfer2_allocate_k1_level(ppr2, ppt2, ptr2, index_k1),
       ptr2->error_message, ptr2->error_message);
 
     /* Load sources from disk if they were previously stored.  This can be true either because we
-    are loading them from a precomputed run, or because we stored them in this same run. */
-    if ((ppr2->load_sources_from_disk == _TRUE_) || (ppr2->store_sources_to_disk == _TRUE_)) {
+    are loading them from a precomputed run, or because we stored them in this same run. When
+    prefetching, the sources were already loaded in the previous iteration, except for the
+    first one. */
+    if ((has_sources_io == _TRUE_) && ((has_prefetch == _FALSE_) || (index_k1_previous < 0))) {
 
       /* Allocate memory to hold the line-of-sight sources */
-      class_call (perturb2_allocate_k1_level(ppt2, index_k1),
+      class_call (perturb2_allocate_k1_level(ppt2, index_k1, ppt2->error_message),
         ppt2->error_message,
         ptr2->error_message);
 
 
-      class_call(perturb2_load_sources_from_disk(ppt2, index_k1),
+      class_call(perturb2_load_sources_from_disk(ppt2, index_k1, ppt2->error_message),
           ppt2->error_message,
           ptr2->error_message);
           
     }
 
-    /* We only need to consider those k2's that are equal to or larger than k1,
-    as the quadratic sources were symmetrised in the perturbation2.c module */
-    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
-
-      if (ptr2->transfer2_verbose > 2)
-        printf(" -> computing transfer function for (k1,k2) = (%.3g,%.3g)\n", ppt2->k[index_k1], ppt2->k[index_k2]);
 
-      // -----------------------------------------------------------------------------
-      // -                        Interpolate sources in k3                          -
-      // -----------------------------------------------------------------------------
+    // -----------------------------------------------------------------------------
+    // -                        Compute transfer functions                         -
+    // -----------------------------------------------------------------------------
 
-      /* Find the integration grid in k3 for the current (k1,k2) pair */
-      int last_used_index_pt;
-      double * k_grid_temp;
-      class_alloc(k_grid_temp, ptr2->k3_size_max*sizeof(double), ptr2->error_message);
+    if (has_prefetch == _FALSE_) {
 
-      class_call_parallel (transfer2_get_k3_list(
+      /* Compute the transfer functions for all the (k2,k3) pairs associated to this k1 */
+      class_call (transfer2_compute_k1_level (
                     ppr,
                     ppr2,
+                    ppt,
                     ppt2,
                     pbs,
                     pbs2,
                     ptr2,
                     index_k1,
-                    index_k2,
-                    k_grid_temp,  /* output */
-                    &last_used_index_pt
-                    ),
+                    number_of_threads,
+                    ppw,
+                    sources_k_spline,
+                    interpolated_sources_in_k),
         ptr2->error_message,
         ptr2->error_message);
+    }
 
-      /* Copy the k3 grid in the pwb workspace. We do so in a parallel region because
-      we have as many pwb[thread] workspaces as the number of threads */
-      for (int thread=0; thread < number_of_threads; ++thread)
-        for (int index_k=0; index_k < ptr2->k_size_k1k2[index_k1][index_k2]; ++index_k)
-          ppw[thread]->k_grid[index_k] = k_grid_temp[index_k];
-      
-      /* Print some information */
-      if (ptr2->transfer2_verbose > 3)
-        printf("     * (k1,k2)=(%.3g,%.3g): the k3-grid comprises sources+transfer+left+right=%d+%d+%d+%d points from %g to %g\n",
-          ppt2->k[index_k1], ppt2->k[index_k2],
-          last_used_index_pt,
-          ptr2->k_physical_size_k1k2[index_k1][index_k2] - last_used_index_pt,
-          ptr2->k_physical_start_k1k2[index_k1][index_k2],
-          ptr2->k_size_k1k2[index_k1][index_k2]
-            - ptr2->k_physical_size_k1k2[index_k1][index_k2] - ptr2->k_physical_start_k1k2[index_k1][index_k2],
-          ppw[thread]->k_grid[0], ppw[thread]->k_grid[ptr2->k_size_k1k2[index_k1][index_k2]-1]);
-
-      free (k_grid_temp);
-      
-
-      // -----------------------------------------------------------------------------
-      // -                          Interpolate sources in k                         -
-      // -----------------------------------------------------------------------------
+    /* Same as above, but with the disk access for the previous and next k1 running at the
+    same time in a separate section. The error message of the latter is kept separate, as
+    the two sections run concurrently. */
+    else {
 
-      for (int index_tp=0; index_tp<ppt2->tp2_size; ++index_tp) {
-      
-        class_alloc(
-          sources_k_spline[index_tp],
-          ppt2->k3_size[index_k1][index_k2]*ppt2->tau_size*sizeof(double),
-          ptr2->error_message);
-      
-        class_alloc(
-          interpolated_sources_in_k[index_tp],
-          ptr2->k_size_k1k2[index_k1][index_k2]*ppt2->tau_size*sizeof(double),
-          ptr2->error_message);
-      
-        class_call (transfer2_interpolate_sources_in_k(
-                      ppr,
-                      ppr2,
-                      ppt,
-                      ppt2,
-                      pbs,
-                      pbs2,
-                      ptr2,
-                      index_k1,
-                      index_k2,
-                      index_tp,
-                      ppw[0]->k_grid, /* Grid of desired k-values for integration; all ppw->[thread]->k_grid are filled with the same values */
-                      sources_k_spline[index_tp], /* Will be filled with second-order derivatives */
-                      interpolated_sources_in_k[index_tp] /* Will be filled with interpolated values in ptr2->k(k1,k2) */
-                      ),
-          ptr2->error_message,
-          ptr2->error_message);
-      
-      } // end of for (index_tp)
+      int compute_status = _SUCCESS_;
+      int prefetch_status = _SUCCESS_;
+      ErrorMsg prefetch_error_message;
 
-                    
-      /* Beginning of parallel region */
-      abort = _FALSE_;    
-      #pragma omp parallel shared (ppw,ppr,ppt2,pbs,ptr2,abort) private (thread)
+      #pragma omp parallel sections num_threads(2)
       {
-
-        #ifdef _OPENMP
-        thread = omp_get_thread_num();
-        #endif
-
-        /* Update workspace */
-        ppw[thread]->thread = thread;
-        ppw[thread]->index_k1 = index_k1;
-        ppw[thread]->k1 = ppt2->k[index_k1];
-        ppw[thread]->index_k2 = index_k2;
-        ppw[thread]->k2 = ppt2->k[index_k2];
-
-        #pragma omp for schedule (static)
-        for (int index_k = 0; index_k < ptr2->k_size_k1k2[index_k1][index_k2]; ++index_k) { 
-
-          /* Update workspace */
-          ppw[thread]->index_k = index_k;
-          ppw[thread]->k = ppw[thread]->k_grid[index_k];
-
-
-          // -----------------------------------------------------------------------
-          // -                    Interpolate sources in time                      -
-          // -----------------------------------------------------------------------
-
-          /* Get the integration grid in time for the given k-mode */
-          class_call_parallel (transfer2_get_time_grid(
-                                 ppr,
-                                 ppr2,
-                                 ppt,
-                                 ppt2,
-                                 pbs,
-                                 pbs2,
-                                 ptr2,
-                                 index_k1,
-                                 index_k2,
-                                 index_k,
-                                 ppw[thread]
-                                 ),
-            ptr2->error_message,
-            ptr2->error_message);
-
-          /* Interpolate the sources at the right value of time */
-            
-          for (int index_tp=0; index_tp<ppt2->tp2_size; ++index_tp) {
-      
-            class_call_parallel (transfer2_interpolate_sources_in_time(
-                          ppr,
-                          ppr2,
-                          ppt,
-                          ppt2,
-                          pbs,
-                          pbs2,
-                          ptr2,
-                          index_tp,
-                          interpolated_sources_in_k[index_tp], /* Must be already filled by transfer2_interpolate_sources_in_k() */
-                          ppw[thread]->sources_time_spline[index_tp], /* Will be filled with second-order derivatives */
-                          ppw[thread]->interpolated_sources_in_time[index_tp], /* Will be filled with interpolated values in pw->tau_grid */
-                          ppw[thread]
-                          ),
-              ptr2->error_message,
-              ptr2->error_message);
-      
-          } // end of for (index_tp)
-
-          
-          // ----------------------------------------------------------------------------
-          // -                         Compute transfer functions                       -
-          // ----------------------------------------------------------------------------
-
-          /* Now that we have interpolated the source function as a function of time in
-          the right point of k, we have all the ingredients to compute the second-order
-          transfer functions. We do so by looping over index_tt, the composite index that
-          includes both the field (T,E,B) and multipole (l,m) dependences. */
-
-          for (int index_tt = 0; index_tt < ptr2->tt2_size; index_tt++) {
-  
-            class_call_parallel (transfer2_compute (
-                                   ppr,
-                                   ppr2,
-                                   ppt2,
-                                   pbs,
-                                   pbs2,
-                                   ptr2,
-                                   index_k1,
-                                   index_k2,
-                                   index_k,
-                                   ptr2->corresponding_index_l[index_tt],
-                                   ptr2->corresponding_index_m[index_tt],
-                                   index_tt,
-                                   ppw[thread]->interpolated_sources_in_time,
-                                   ppw[thread]
-                                   ),
-              ptr2->error_message,
-              ptr2->error_message);
-
-          } // end of for(index_tt)
-
-          #pragma omp flush(abort)
-
-        } // end of for(index_k) 
-
-      } if (abort == _TRUE_) return _FAILURE_; /* end of parallel region */
-
-      /* Free the memory for the interpolated sources */
-      for (int index_tp=0; index_tp<ppt2->tp2_size; ++index_tp) {
-        free(sources_k_spline[index_tp]);
-        free(interpolated_sources_in_k[index_tp]);
+        #pragma omp section
+        compute_status = transfer2_compute_k1_level (
+                           ppr,
+                           ppr2,
+                           ppt,
+                           ppt2,
+                           pbs,
+                           pbs2,
+                           ptr2,
+                           index_k1,
+                           number_of_threads,
+                           ppw,
+                           sources_k_spline,
+                           interpolated_sources_in_k);
+
+        #pragma omp section
+        prefetch_status = transfer2_prefetch_k1_level (
+                            ppr2,
+                            ppt2,
+                            ptr2,
+                            index_k1_previous,
+                            index_k1_next,
+                            prefetch_error_message);
       }
 
-    } // end of for(index_k2)
+      class_call (compute_status,
+        ptr2->error_message,
+        ptr2->error_message);
+
+      class_call (prefetch_status,
+        prefetch_error_message,
+        ptr2->error_message);
+    }
 
     /* Free the memory associated with the line-of-sight sources for the considered k1.
     We won't need them anymore because the different k1 modes are independent. Note that
@@ -555,49 +396,64 @@ int transfer2_init(
 
 
     /* Save all transfer functions for the given k1, and free the memory associated with them.
-    The next time we'll need them, we shall load them from disk.  */
-    if (ppr2->store_transfers_to_disk == _TRUE_) {
+    The next time we'll need them, we shall load them from disk. When prefetching, this is
+    done during the next iteration, or right after the loop for the last k1. */
+    if ((has_transfers_io == _TRUE_)
+    && ((has_prefetch == _FALSE_) || (index_k1_next < 0))) {
       
-      class_call (transfer2_store_transfers_to_disk (ppt2, ptr2, index_k1),
+      class_call (transfer2_store_transfers_to_disk (ppt2, ptr2, index_k1, ptr2->error_message),
           ptr2->error_message,
           ptr2->error_message);
 
-      class_call (transfer2_free_k1_level (ppt2, ptr2, index_k1),
+      class_call (transfer2_free_k1_level (ppt2, ptr2, index_k1, ptr2->error_message),
         ptr2->error_message, ptr2->error_message);
     }
 
   } // end of for(index_k1)
 
+  free (k1_list);
+
+  #ifdef _OPENMP
+  omp_set_max_active_levels (max_active_levels);
+  #endif
+
   free (sources_k_spline);
   free (interpolated_sources_in_k);
   
-  #pragma omp parallel shared(ppw) private(thread)
-  {
-    #ifdef _OPENMP
-    thread = omp_get_thread_num();
+  class_call (transfer2_workspace_free (
+                ppt2,
+                number_of_threads,
+                ppw),
+    ptr2->error_message,
+    ptr2->error_message);
+  
+  /* We are finished filling the transfer function files, so close them and mark
+  the transfers directory as complete */
+  if (ppr2->store_transfers_to_disk == _TRUE_) {
+
+    for (int index_tt = 0; index_tt < ptr2->tt2_size; index_tt++)
+      class_test (fclose (ptr2->transfers_files[index_tt]) != 0,
+        ptr2->error_message,
+        "could not write to '%s'", ptr2->transfers_paths[index_tt]);
+
+    /* Wait for the other MPI processes to write their k1 levels */
+    #ifdef _MPI
+    if (ppr2->mpi_size > 1)
+      MPI_Barrier (MPI_COMM_WORLD);
     #endif
 
-    free(ppw[thread]->k_grid);
-    free(ppw[thread]->tau_grid);
-    free(ppw[thread]->tau0_minus_tau);
-    free(ppw[thread]->delta_tau);
-    free(ppw[thread]->index_tau_left);    
-    int index_tp;
-    for (index_tp=0; index_tp<ppt2->tp2_size; ++index_tp) {
-      free(ppw[thread]->sources_time_spline[index_tp]);
-      free(ppw[thread]->interpolated_sources_in_time[index_tp]);
+    if (ppr2->mpi_rank == 0) {
+
+      if (ptr2->transfers_compression != block_compression_none)
+        class_call (transfer2_compact_transfers (ppt2, ptr2),
+          ptr2->error_message,
+          ptr2->error_message);
+
+      class_open (ptr2->transfers_status_file, ptr2->transfers_status_path, "a", ptr2->error_message);
+      fprintf (ptr2->transfers_status_file, "complete\n");
+      fclose (ptr2->transfers_status_file);
     }
-    free(ppw[thread]->sources_time_spline);
-    free(ppw[thread]->interpolated_sources_in_time);
-    free(ppw[thread]);
   }
-    
-  free(ppw);
-  
-  /* We are finished filling the transfer function files, so close them */
-  if (ppr2->store_transfers_to_disk == _TRUE_)
-    for (int index_tt = 0; index_tt < ptr2->tt2_size; index_tt++)
-      fclose (ptr2->transfers_files[index_tt]);
 
   if (ptr2->transfer2_verbose > 1)
     printf (" -> filled ptr2->transfer with %ld values (%g MB)\n",
@@ -609,8 +465,10 @@ int transfer2_init(
       ptr2->error_message,
       "there is a mismatch between allocated (%ld) and used (%ld) space!", ptr2->count_allocated_transfers, ptr2->count_memorised_transfers);
   
-  /* Do not evaluate the subsequent modules if ppt2->has_transfers2_only == _TRUE_ */
-  if (ptr2->stop_at_transfers2 == _TRUE_) {
+  /* Do not evaluate the subsequent modules if ppt2->has_transfers2_only == _TRUE_. When
+  running with MPI, the subsequent modules are evaluated only by the first process, which
+  reads the transfer functions computed by all processes from disk. */
+  if ((ptr2->stop_at_transfers2 == _TRUE_) || (ppr2->mpi_rank > 0)) {
     ppt->has_cls = _FALSE_;
     ppt->has_cmb_bispectra = _FALSE_;
     ppt2->has_cmb_spectra = _FALSE_;
@@ -622,38 +480,726 @@ int transfer2_init(
 
 
 /**
- * Allocate all levels beyond the transfer-type level of the transfer functions array.
- *
- * Allocate the transfer type (tt) level of the array that will contain the second-order
- * transfer functions: ptr2->transfer[index_tt][index_k1][index_k2][index_k].
+ * Compute the second-order transfer functions for a given k1 value, that is,
+ * fill the index_k1 level of ptr2->transfer.
  *
- * This function makes space for the transfer functions; it is called before loading
- * them from disk in transfer2_load_transfers_from_disk(). It relies on values that are
- * computed by transfer2_indices_of_perturbs() and transfer2_get_k3_sizes(), so make
- * sure to call them beforehand.
+ * The function loops over k2, interpolates the line-of-sight sources in the
+ * k3 grid of the (k1,k2) pair using transfer2_interpolate_sources_in_k(), and
+ * then solves the line-of-sight integral for all the k3 values in parallel.
  *
+ * Before calling this function, make sure that the index_k1 levels of
+ * ppt2->sources and ptr2->transfer are allocated. The workspaces ppw and the
+ * arrays sources_k_spline and interpolated_sources_in_k are allocated in
+ * transfer2_init().
  */
-int transfer2_allocate_type_level(
-     struct perturbs2 * ppt2,
-     struct transfers2 * ptr2,
-     int index_tt
-     )
+
+int transfer2_compute_k1_level(
+      struct precision * ppr,
+      struct precision2 * ppr2,
+      struct perturbs * ppt,
+      struct perturbs2 * ppt2,
+      struct bessels * pbs,
+      struct bessels2 * pbs2,
+      struct transfers2 * ptr2,
+      int index_k1,
+      int number_of_threads,
+      struct transfer2_workspace ** ppw,
+      double ** sources_k_spline,
+      double ** interpolated_sources_in_k
+      )
 {
 
-  long int count=0;
-  int k1_size = ppt2->k_size;
+  int thread = 0;
+  int abort = _FALSE_;
 
-  class_alloc(
-    ptr2->transfer[index_tt],
-    k1_size * sizeof(double **),
+  /* Time spent by each thread solving the line-of-sight integrals */
+  int index_region;
+  class_call (run_report_region (&(ppr2->report), "transfer2_compute", "integrals", number_of_threads,
+                &index_region, ptr2->error_message),
+    ptr2->error_message,
     ptr2->error_message);
 
-  for (int index_k1=0; index_k1<k1_size; ++index_k1) {
+  double region_start = run_report_time();
 
-    /* Allocate k2 level.  Note that, as for ppt2->sources, the size of this level is smaller
-    than ppt2->k_size, and it depends on k1.  The reason is that we only need to compute
-    the transfer functions for those k2's that are smaller than k1 (our equations are symmetrised
-    wrt to k1<->k2) */
+  /* We only need to consider those k2's that are equal to or larger than k1,
+  as the quadratic sources were symmetrised in the perturbation2.c module */
+  for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+
+    if (ptr2->transfer2_verbose > 2)
+      printf(" -> computing transfer function for (k1,k2) = (%.3g,%.3g)\n", ppt2->k[index_k1], ppt2->k[index_k2]);
+
+    // -----------------------------------------------------------------------------
+    // -                        Interpolate sources in k3                          -
+    // -----------------------------------------------------------------------------
+
+    /* Find the integration grid in k3 for the current (k1,k2) pair */
+    int last_used_index_pt;
+    double * k_grid_temp;
+    class_alloc(k_grid_temp, ptr2->k3_size_max*sizeof(double), ptr2->error_message);
+
+    class_call_parallel (transfer2_get_k3_list(
+                  ppr,
+                  ppr2,
+                  ppt2,
+                  pbs,
+                  pbs2,
+                  ptr2,
+                  index_k1,
+                  index_k2,
+                  k_grid_temp,  /* output */
+                  &last_used_index_pt
+                  ),
+      ptr2->error_message,
+      ptr2->error_message);
+
+    /* Copy the k3 grid in the pwb workspace. We do so in a parallel region because
+    we have as many pwb[thread] workspaces as the number of threads */
+    for (int thread=0; thread < number_of_threads; ++thread)
+      for (int index_k=0; index_k < ptr2->k_size_k1k2[index_k1][index_k2]; ++index_k)
+        ppw[thread]->k_grid[index_k] = k_grid_temp[index_k];
+    
+    /* Print some information */
+    if (ptr2->transfer2_verbose > 3)
+      printf("     * (k1,k2)=(%.3g,%.3g): the k3-grid comprises sources+transfer+left+right=%d+%d+%d+%d points from %g to %g\n",
+        ppt2->k[index_k1], ppt2->k[index_k2],
+        last_used_index_pt,
+        ptr2->k_physical_size_k1k2[index_k1][index_k2] - last_used_index_pt,
+        ptr2->k_physical_start_k1k2[index_k1][index_k2],
+        ptr2->k_size_k1k2[index_k1][index_k2]
+          - ptr2->k_physical_size_k1k2[index_k1][index_k2] - ptr2->k_physical_start_k1k2[index_k1][index_k2],
+        ppw[0]->k_grid[0], ppw[0]->k_grid[ptr2->k_size_k1k2[index_k1][index_k2]-1]);
+
+    free (k_grid_temp);
+    
+
+    // -----------------------------------------------------------------------------
+    // -                          Interpolate sources in k                         -
+    // -----------------------------------------------------------------------------
+
+    for (int index_tp=0; index_tp<ppt2->tp2_size; ++index_tp) {
+    
+      class_alloc(
+        sources_k_spline[index_tp],
+        ppt2->k3_size[index_k1][index_k2]*ppt2->tau_size*sizeof(double),
+        ptr2->error_message);
+    
+      class_alloc(
+        interpolated_sources_in_k[index_tp],
+        ptr2->k_size_k1k2[index_k1][index_k2]*ppt2->tau_size*sizeof(double),
+        ptr2->error_message);
+
+      /* The interpolated sources are filled by this thread only, but each of their rows is
+      read by one thread in the parallel loop over index_k below. On multi-socket nodes, place
+      each row in the memory of its reader by touching the array with the same static schedule;
+      this is skipped when prefetching, as the loop runs in a nested parallel region */
+      class_call (numa_first_touch (
+                    interpolated_sources_in_k[index_tp],
+                    ptr2->k_size_k1k2[index_k1][index_k2],
+                    ppt2->tau_size,
+                    -1,
+                    ppr2->numa_domains,
+                    ptr2->error_message),
+        ptr2->error_message,
+        ptr2->error_message);
+    
+      class_call (transfer2_interpolate_sources_in_k(
+                    ppr,
+                    ppr2,
+                    ppt,
+                    ppt2,
+                    pbs,
+                    pbs2,
+                    ptr2,
+                    index_k1,
+                    index_k2,
+                    index_tp,
+                    ppw[0]->k_grid, /* Grid of desired k-values for integration; all ppw->[thread]->k_grid are filled with the same values */
+                    sources_k_spline[index_tp], /* Will be filled with second-order derivatives */
+                    interpolated_sources_in_k[index_tp] /* Will be filled with interpolated values in ptr2->k(k1,k2) */
+                    ),
+        ptr2->error_message,
+        ptr2->error_message);
+    
+    } // end of for (index_tp)
+
+                  
+    /* Beginning of parallel region */
+    abort = _FALSE_;    
+    #pragma omp parallel shared (ppw,ppr,ppt2,pbs,ptr2,abort) private (thread)
+    {
+
+      #ifdef _OPENMP
+      thread = omp_get_thread_num();
+      #endif
+
+      /* Update workspace */
+      ppw[thread]->thread = thread;
+      ppw[thread]->index_k1 = index_k1;
+      ppw[thread]->k1 = ppt2->k[index_k1];
+      ppw[thread]->index_k2 = index_k2;
+      ppw[thread]->k2 = ppt2->k[index_k2];
+
+      #pragma omp for schedule (static)
+      for (int index_k = 0; index_k < ptr2->k_size_k1k2[index_k1][index_k2]; ++index_k) { 
+
+        double busy_start = run_report_time();
+
+        /* Update workspace */
+        ppw[thread]->index_k = index_k;
+        ppw[thread]->k = ppw[thread]->k_grid[index_k];
+
+
+        // -----------------------------------------------------------------------
+        // -                    Interpolate sources in time                      -
+        // -----------------------------------------------------------------------
+
+        /* Get the integration grid in time for the given k-mode */
+        class_call_parallel (transfer2_get_time_grid(
+                               ppr,
+                               ppr2,
+                               ppt,
+                               ppt2,
+                               pbs,
+                               pbs2,
+                               ptr2,
+                               index_k1,
+                               index_k2,
+                               index_k,
+                               ppw[thread]
+                               ),
+          ptr2->error_message,
+          ptr2->error_message);
+
+        /* Interpolate the sources at the right value of time */
+          
+        for (int index_tp=0; index_tp<ppt2->tp2_size; ++index_tp) {
+    
+          class_call_parallel (transfer2_interpolate_sources_in_time(
+                        ppr,
+                        ppr2,
+                        ppt,
+                        ppt2,
+                        pbs,
+                        pbs2,
+                        ptr2,
+                        index_tp,
+                        interpolated_sources_in_k[index_tp], /* Must be already filled by transfer2_interpolate_sources_in_k() */
+                        ppw[thread]->sources_time_spline[index_tp], /* Will be filled with second-order derivatives */
+                        ppw[thread]->interpolated_sources_in_time[index_tp], /* Will be filled with interpolated values in pw->tau_grid */
+                        ppw[thread]
+                        ),
+            ptr2->error_message,
+            ptr2->error_message);
+    
+        } // end of for (index_tp)
+
+        
+        // ----------------------------------------------------------------------------
+        // -                         Compute transfer functions                       -
+        // ----------------------------------------------------------------------------
+
+        /* Now that we have interpolated the source function as a function of time in
+        the right point of k, we have all the ingredients to compute the second-order
+        transfer functions. We do so by looping over index_tt, the composite index that
+        includes both the field (T,E,B) and multipole (l,m) dependences. */
+
+        for (int index_tt = 0; index_tt < ptr2->tt2_size; index_tt++) {
+
+          /* If requested, compute the E-mode and B-mode transfer functions with the same (l,m)
+          together, when we encounter the E-mode one */
+          if ((ppr2->batch_transfers == _TRUE_) && ppt2->has_source_E && ppt2->has_source_B) {
+
+            int index_tt_monopole = ptr2->index_tt2_monopole[index_tt];
+
+            if (index_tt_monopole == ptr2->index_tt2_B)
+              continue;
+
+            if (index_tt_monopole == ptr2->index_tt2_E) {
+
+              class_call_parallel (transfer2_compute_EB (
+                                     ppr,
+                                     ppr2,
+                                     ppt2,
+                                     pbs,
+                                     pbs2,
+                                     ptr2,
+                                     index_k1,
+                                     index_k2,
+                                     index_k,
+                                     ptr2->corresponding_index_l[index_tt],
+                                     ptr2->corresponding_index_m[index_tt],
+                                     index_tt,
+                                     ptr2->index_tt2_B + (index_tt - ptr2->index_tt2_E),
+                                     ppw[thread]->interpolated_sources_in_time,
+                                     ppw[thread]
+                                     ),
+                ptr2->error_message,
+                ptr2->error_message);
+
+              continue;
+            }
+          }
+
+          class_call_parallel (transfer2_compute (
+                                 ppr,
+                                 ppr2,
+                                 ppt2,
+                                 pbs,
+                                 pbs2,
+                                 ptr2,
+                                 index_k1,
+                                 index_k2,
+                                 index_k,
+                                 ptr2->corresponding_index_l[index_tt],
+                                 ptr2->corresponding_index_m[index_tt],
+                                 index_tt,
+                                 ppw[thread]->interpolated_sources_in_time,
+                                 ppw[thread]
+                                 ),
+            ptr2->error_message,
+            ptr2->error_message);
+
+        } // end of for(index_tt)
+
+        ppr2->report.regions[index_region].busy_time[thread] += run_report_time() - busy_start;
+        ppr2->report.regions[index_region].work[thread] += ptr2->tt2_size;
+
+        #pragma omp flush(abort)
+
+      } // end of for(index_k) 
+
+    } if (abort == _TRUE_) return _FAILURE_; /* end of parallel region */
+
+    /* Free the memory for the interpolated sources */
+    for (int index_tp=0; index_tp<ppt2->tp2_size; ++index_tp) {
+      free(sources_k_spline[index_tp]);
+      free(interpolated_sources_in_k[index_tp]);
+    }
+
+  } // end of for(index_k2)
+
+  ppr2->report.regions[index_region].wall_time += run_report_time() - region_start;
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Allocate the workspaces used by transfer2_compute_k1_level(), one per thread.
+ *
+ * The time arrays in the workspaces are allocated with the largest number of
+ * integration steps allowed by the time sampling of the line-of-sight integral,
+ * ptr2->tau_sampling. The workspaces must be freed with transfer2_workspace_free().
+ */
+
+int transfer2_workspace_init(
+      struct precision2 * ppr2,
+      struct perturbs2 * ppt2,
+      struct bessels2 * pbs2,
+      struct transfers2 * ptr2,
+      int number_of_threads,                  /**< input: number of threads, one workspace each */
+      struct transfer2_workspace *** pppw     /**< output: array of workspaces, ppw[thread] */
+      )
+{
+
+  int thread = 0;
+  int abort = _FALSE_;
+
+  class_alloc(*pppw, number_of_threads*sizeof(struct transfer2_workspace*), ptr2->error_message);
+  struct transfer2_workspace ** ppw = *pppw;
+    
+  /* We shall allocate the time arrays with the maximum possible number of integration steps */
+  int tau_size_max;
+
+  /* In the sources time sampling, the integration grid matches the sources time sampling */
+  if (ptr2->tau_sampling == sources_tau_sampling) {
+    tau_size_max = ppt2->tau_size;
+  }
+
+  /* In the custom time sampling, the number of steps depend on the considered wavemode; the
+  largest k will have more time steps because the projection function, J(k(tau0-tau)),
+  oscillates faster in time. */
+  else if (ptr2->tau_sampling == custom_tau_sampling) {
+    double k_max = ptr2->k_max_k1k2[ppt2->k_size-1][ppt2->k_size-1];
+    double tau_step_min = 2*_PI_/k_max*ppr2->tau_linstep_song;
+    double tau_max = ppt2->tau_sampling[ppt2->tau_size-1];
+    tau_size_max = ppt2->tau_size + ceil(tau_max/tau_step_min) + 1;
+  }
+
+  /* In the bessel sampling, we take as many steps as the points where the Bessel functions
+  are sampled */
+  else if (ptr2->tau_sampling == bessel_tau_sampling) {
+    tau_size_max = ppt2->tau_size + pbs2->xx_size;
+  }
+
+  /* Print some information on the finest time grid that will be used */
+  if (ptr2->transfer2_verbose > 0)
+    printf (" -> maximum number of time steps in the LOS integration = %d\n", tau_size_max);
+  
+  /* Allocate arrays in the workspace */
+  abort = _FALSE_;
+  #pragma omp parallel shared(ppw,ptr2) private(thread)
+  {
+
+    #ifdef _OPENMP
+    thread = omp_get_thread_num();
+    #endif
+    
+    /* Allocate workspace array */
+    class_alloc_parallel(
+      ppw[thread],
+      sizeof(struct transfer2_workspace),
+      ptr2->error_message);
+
+    /* Allocate the k-grid with the maximum possible number of k3-values  */
+    class_alloc_parallel(
+      ppw[thread]->k_grid,
+      ptr2->k3_size_max*sizeof(double),
+      ptr2->error_message);
+
+    /* Allocate the integration grid array. */
+    class_alloc_parallel(
+      ppw[thread]->tau_grid,
+      tau_size_max*sizeof(double),
+      ptr2->error_message);
+    
+    /* Allocate tau0_minus_tau */
+    class_alloc_parallel(
+      ppw[thread]->tau0_minus_tau,
+      tau_size_max*sizeof(double),
+      ptr2->error_message);
+    
+    /* Allocate delta_tau, the trapezoidal measure of the line-of-sight integral. This array
+    is defined as tau(i+1)-tau(i-1) except for the first and last elements, which are,
+    respectively, tau(1)-tau(0) and tau(N)-tau(N-1). */
+    class_alloc_parallel(
+      ppw[thread]->delta_tau,
+      tau_size_max*sizeof(double),
+      ptr2->error_message);
+    
+    /* Allocate index_tau_left, an array useful for the time interpolation of the sources (see header file) */
+    class_alloc_parallel(
+      ppw[thread]->index_tau_left,
+      tau_size_max*sizeof(double),
+      ptr2->error_message);
+
+    /* Allocate the position and interpolation weight of x=k*(tau0-tau) in pbs2->xx, used
+    in transfer2_integrate() to interpolate the projection functions */
+    class_alloc_parallel(
+      ppw[thread]->index_x,
+      tau_size_max*sizeof(int),
+      ptr2->error_message);
+
+    class_alloc_parallel(
+      ppw[thread]->a_J,
+      tau_size_max*sizeof(double),
+      ptr2->error_message);
+
+    /* Allocate the projection functions interpolated on the time grid, used in
+    transfer2_integrate_EB() */
+    for (int i=0; i < 2; ++i)
+      class_alloc_parallel(
+        ppw[thread]->J_in_time[i],
+        tau_size_max*sizeof(double),
+        ptr2->error_message);
+
+    /* Allocate the array that will contain the second derivatives of the sources with respect to time,
+    in view of spline interpolation */
+    class_alloc_parallel (
+      ppw[thread]->sources_time_spline,
+      ppt2->tp2_size*sizeof(double *),
+      ptr2->error_message);
+
+    for (int index_tp=0; index_tp<ppt2->tp2_size; ++index_tp)
+      class_alloc_parallel(
+        ppw[thread]->sources_time_spline[index_tp],
+        tau_size_max*sizeof(double),
+        ptr2->error_message);
+
+    /* Allocate the array that will contain the sources interpolated at the exact time-values in the integration grid */
+    class_alloc_parallel (
+      ppw[thread]->interpolated_sources_in_time,
+      ppt2->tp2_size*sizeof(double *),
+      ptr2->error_message);
+
+    for (int index_tp=0; index_tp<ppt2->tp2_size; ++index_tp)
+      class_alloc_parallel(
+        ppw[thread]->interpolated_sources_in_time[index_tp],
+        tau_size_max*sizeof(double),
+        ptr2->error_message);
+
+    /* Read the projection functions from the NUMA domain of the thread, if they were
+    replicated in the bessel2 module */
+    if (abort == _FALSE_) {
+
+      ppw[thread]->J_Llm_x = pbs2->J_Llm_x;
+      ppw[thread]->ddJ_Llm_x = pbs2->ddJ_Llm_x;
+      ppw[thread]->J_Llm_x_float = pbs2->J_Llm_x_float;
+      ppw[thread]->ddJ_Llm_x_float = pbs2->ddJ_Llm_x_float;
+
+      if (pbs2->J_replica_size > 0) {
+        int domain = numa_thread_domain (thread, number_of_threads, pbs2->J_replica_size);
+        if (pbs2->J_Llm_x_replica != NULL)
+          ppw[thread]->J_Llm_x = pbs2->J_Llm_x_replica[domain];
+        if (pbs2->ddJ_Llm_x_replica != NULL)
+          ppw[thread]->ddJ_Llm_x = pbs2->ddJ_Llm_x_replica[domain];
+        if (pbs2->J_Llm_x_float_replica != NULL)
+          ppw[thread]->J_Llm_x_float = pbs2->J_Llm_x_float_replica[domain];
+        if (pbs2->ddJ_Llm_x_float_replica != NULL)
+          ppw[thread]->ddJ_Llm_x_float = pbs2->ddJ_Llm_x_float_replica[domain];
+      }
+    }
+
+  } // end of parallel region
+  
+  if (abort == _TRUE_) return _FAILURE_;
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Free the workspaces allocated by transfer2_workspace_init().
+ */
+
+int transfer2_workspace_free(
+      struct perturbs2 * ppt2,
+      int number_of_threads,
+      struct transfer2_workspace ** ppw
+      )
+{
+
+  int thread = 0;
+
+  #pragma omp parallel shared(ppw) private(thread)
+  {
+    #ifdef _OPENMP
+    thread = omp_get_thread_num();
+    #endif
+
+    free(ppw[thread]->k_grid);
+    free(ppw[thread]->tau_grid);
+    free(ppw[thread]->tau0_minus_tau);
+    free(ppw[thread]->delta_tau);
+    free(ppw[thread]->index_tau_left);    
+    free(ppw[thread]->index_x);
+    free(ppw[thread]->a_J);
+    free(ppw[thread]->J_in_time[0]);
+    free(ppw[thread]->J_in_time[1]);
+    int index_tp;
+    for (index_tp=0; index_tp<ppt2->tp2_size; ++index_tp) {
+      free(ppw[thread]->sources_time_spline[index_tp]);
+      free(ppw[thread]->interpolated_sources_in_time[index_tp]);
+    }
+    free(ppw[thread]->sources_time_spline);
+    free(ppw[thread]->interpolated_sources_in_time);
+    free(ppw[thread]);
+  }
+    
+  free(ppw);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Compute the second-order transfer functions for a given k1 value outside of
+ * transfer2_init(), for use when ppr2->stream_transfers is _TRUE_.
+ *
+ * The function allocates the index_k1 level of ptr2->transfer, loads the
+ * line-of-sight sources from disk if needed, fills the level with
+ * transfer2_compute_k1_level() and frees the sources for index_k1, as
+ * done in each iteration of the main loop of transfer2_init(). The caller is
+ * responsible for freeing the transfer functions with transfer2_free_k1_level()
+ * as soon as they are not needed anymore, so that only one k1 level is kept
+ * in memory at any time.
+ *
+ * The workspaces ppw must be allocated with transfer2_workspace_init().
+ */
+
+int transfer2_stream_k1_level(
+      struct precision * ppr,
+      struct precision2 * ppr2,
+      struct perturbs * ppt,
+      struct perturbs2 * ppt2,
+      struct bessels * pbs,
+      struct bessels2 * pbs2,
+      struct transfers2 * ptr2,
+      int index_k1,
+      int number_of_threads,
+      struct transfer2_workspace ** ppw
+      )
+{
+
+  if (ptr2->transfer2_verbose > 1)
+    printf ("     * computing transfer functions today for index_k1=%d of %d, k1=%g\n",
+      index_k1, ppt2->k_size, ppt2->k[index_k1]);
+
+  class_call (transfer2_allocate_k1_level (ppr2, ppt2, ptr2, index_k1),
+    ptr2->error_message, ptr2->error_message);
+
+  /* Load the sources from disk if they were previously stored */
+  if ((ppr2->load_sources_from_disk == _TRUE_) || (ppr2->store_sources_to_disk == _TRUE_)) {
+
+    class_call (perturb2_allocate_k1_level (ppt2, index_k1, ppt2->error_message),
+      ppt2->error_message,
+      ptr2->error_message);
+
+    class_call (perturb2_load_sources_from_disk (ppt2, index_k1, ppt2->error_message),
+      ppt2->error_message,
+      ptr2->error_message);
+  }
+
+  /* Arrays of pointers to the interpolated sources, filled in transfer2_compute_k1_level() */
+  double ** sources_k_spline;
+  double ** interpolated_sources_in_k;
+  class_alloc (sources_k_spline, ppt2->tp2_size*sizeof(double *), ptr2->error_message);
+  class_alloc (interpolated_sources_in_k, ppt2->tp2_size*sizeof(double *), ptr2->error_message);
+
+  class_call (transfer2_compute_k1_level (
+                ppr,
+                ppr2,
+                ppt,
+                ppt2,
+                pbs,
+                pbs2,
+                ptr2,
+                index_k1,
+                number_of_threads,
+                ppw,
+                sources_k_spline,
+                interpolated_sources_in_k),
+    ptr2->error_message,
+    ptr2->error_message);
+
+  free (sources_k_spline);
+  free (interpolated_sources_in_k);
+
+  /* The different k1 modes are independent, so we do not need the sources anymore */
+  class_call (perturb2_free_k1_level (ppt2, index_k1),
+    ppt2->error_message, ptr2->error_message);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Disk access for the k1 levels that precede and follow index_k1, to be
+ * executed while the transfer functions for index_k1 are being computed.
+ *
+ * If the transfer functions are stored to disk, write and free the
+ * index_k1_previous level of ptr2->transfer. If the line-of-sight sources are
+ * read from disk, allocate and load the index_k1_next level of ppt2->sources.
+ * These are the k1 levels computed by this process before and after index_k1;
+ * a negative value means that there is no such level.
+ *
+ * This function is called by transfer2_init() in a parallel section, at
+ * the same time as transfer2_compute_k1_level(); therefore, it and the
+ * functions it calls write their errors directly to error_message, and never
+ * to ptr2->error_message or ppt2->error_message.
+ */
+
+int transfer2_prefetch_k1_level(
+      struct precision2 * ppr2,
+      struct perturbs2 * ppt2,
+      struct transfers2 * ptr2,
+      int index_k1_previous,
+      int index_k1_next,
+      ErrorMsg error_message
+      )
+{
+
+  /* Write the transfer functions computed in the previous iteration */
+  if ((ppr2->store_transfers_to_disk == _TRUE_) && (index_k1_previous >= 0)) {
+
+    class_call (transfer2_store_transfers_to_disk (ppt2, ptr2, index_k1_previous, error_message),
+      error_message,
+      error_message);
+
+    class_call (transfer2_free_k1_level (ppt2, ptr2, index_k1_previous, error_message),
+      error_message,
+      error_message);
+  }
+
+  /* Load the sources needed in the next iteration */
+  if (((ppr2->load_sources_from_disk == _TRUE_) || (ppr2->store_sources_to_disk == _TRUE_))
+  && (index_k1_next >= 0)) {
+
+    class_call (perturb2_allocate_k1_level (ppt2, index_k1_next, error_message),
+      error_message,
+      error_message);
+
+    class_call (perturb2_load_sources_from_disk (ppt2, index_k1_next, error_message),
+      error_message,
+      error_message);
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Allocate all levels beyond the transfer-type level of the transfer functions array.
+ *
+ * Allocate the transfer type (tt) level of the array that will contain the second-order
+ * transfer functions: ptr2->transfer[index_tt][index_k1][index_k2][index_k].
+ *
+ * This function makes space for the transfer functions; it is called before loading
+ * them from disk in transfer2_load_transfers_from_disk(). It relies on values that are
+ * computed by transfer2_indices_of_perturbs() and transfer2_get_k3_sizes(), so make
+ * sure to call them beforehand.
+ *
+ * On nodes with several NUMA domains (ppr2->numa_domains > 1), each k1 level of the
+ * type level is first touched by the threads of the domain that owns it, as it is done
+ * for the k1 levels in transfer2_allocate_k1_level().
+ *
+ */
+int transfer2_allocate_type_level(
+     struct precision2 * ppr2,
+     struct perturbs2 * ppt2,
+     struct transfers2 * ptr2,
+     int index_tt
+     )
+{
+
+  int k1_size = ppt2->k_size;
+
+  /* Allocate all the values of the type level in a single block */
+  long int count=0;
+  for (int index_k1=0; index_k1<k1_size; ++index_k1)
+    for (int index_k2=0; index_k2<=index_k1; ++index_k2)
+      count += ptr2->k_size_k1k2[index_k1][index_k2];
+
+  struct arena * pa = &(ptr2->transfer_type_arena[index_tt]);
+
+  class_call (arena_init (pa, count, ptr2->error_message),
+    ptr2->error_message,
+    ptr2->error_message);
+
+  #pragma omp atomic
+  ptr2->count_allocated_transfers += pa->size;
+
+  class_alloc(
+    ptr2->transfer[index_tt],
+    k1_size * sizeof(double **),
+    ptr2->error_message);
+
+  for (int index_k1=0; index_k1<k1_size; ++index_k1) {
+
+    /* Allocate k2 level.  Note that, as for ppt2->sources, the size of this level is smaller
+    than ppt2->k_size, and it depends on k1.  The reason is that we only need to compute
+    the transfer functions for those k2's that are smaller than k1 (our equations are symmetrised
+    wrt to k1<->k2) */
     int k2_size = index_k1 + 1;
   
     class_alloc(
@@ -661,24 +1207,52 @@ int transfer2_allocate_type_level(
       k2_size * sizeof(double *),
       ptr2->error_message);
   
-    for (int index_k2=0; index_k2<=index_k1; ++index_k2) {
+    /* Point the k level inside the arena. Note that we are using ptr2->k_size here instead of
+    ppt2->k_size.  The reason is that ptr2->k is sampled much more finely than ppt2->k in order
+    to catch the wild oscillation of the Bessel functions in k.  Furthermore, we only allocate
+    memory for the k's that are compatible with the values of k1 and k2, i.e. we impose
+    fabs(cosk1k2) <= 1.  See transfer2_get_k3_sizes() for further details. */
+    class_call (arena_take_row (
+                  pa,
+                  k2_size,
+                  ptr2->k_size_k1k2[index_k1],
+                  1,
+                  ptr2->transfer[index_tt][index_k1],
+                  ptr2->error_message),
+      ptr2->error_message,
+      ptr2->error_message);
 
-      /* Allocate k level. Note that we are using ptr2->k_size here instead of ppt2->k_size.  The
-      reason is that ptr2->k is sampled much more finely than ppt2->k in order to catch the wild
-      oscillation of the Bessel functions in k.  Furthermore, we only allocate memory for the k's
-      that are compatible with the values of k1 and k2, i.e. we impose fabs(cosk1k2) <= 1.  See
-      transfer2_get_k3_sizes() for further details. */
-      class_alloc(
-        ptr2->transfer[index_tt][index_k1][index_k2],
-        ptr2->k_size_k1k2[index_k1][index_k2] * sizeof(double),
-        ptr2->error_message);
+  } // end of for(index_k1)
+
+  /* Place each k1 level in the memory of the NUMA domain that will read it. The k1
+  levels are contiguous in the arena, and so are the k1 levels owned by each domain. */
+  for (int domain = 0; domain < ppr2->numa_domains; ++domain) {
+
+    int first_k1 = -1, last_k1 = -1;
+    for (int index_k1=0; index_k1<k1_size; ++index_k1) {
+      if (numa_k1_domain (index_k1, k1_size, ppr2->numa_domains) == domain) {
+        if (first_k1 < 0)
+          first_k1 = index_k1;
+        last_k1 = index_k1;
+      }
+    }
+
+    if (first_k1 < 0)
+      continue;
 
-      #pragma omp atomic
-      ptr2->count_allocated_transfers += ptr2->k_size_k1k2[index_k1][index_k2];
-      count += ptr2->k_size_k1k2[index_k1][index_k2];
+    double * start = ptr2->transfer[index_tt][first_k1][0];
+    double * end = ptr2->transfer[index_tt][last_k1][last_k1] + ptr2->k_size_k1k2[last_k1][last_k1];
 
-    } // end of for(index_k2)
-  } // end of for(index_k1)
+    class_call (numa_first_touch (
+                  start,
+                  end - start,
+                  1,
+                  domain,
+                  ppr2->numa_domains,
+                  ptr2->error_message),
+      ptr2->error_message,
+      ptr2->error_message);
+  }
   
   /* Print some debug information on memory consumption */
   if (ptr2->transfer2_verbose > 2) {
@@ -703,6 +1277,7 @@ int transfer2_allocate_type_level(
  * This function is used in the bispectra2.c module and in the print_transfers2.c file.
  */
 int transfer2_load_transfers_from_disk(
+        struct precision2 * ppr2,
         struct perturbs2 * ppt2,
         struct transfers2 * ptr2,
         int index_tt
@@ -710,7 +1285,7 @@ int transfer2_load_transfers_from_disk(
 {
 
   /* Allocate memory to keep the transfer functions */
-  class_call (transfer2_allocate_type_level(ppt2, ptr2, index_tt),
+  class_call (transfer2_allocate_type_level(ppr2, ppt2, ptr2, index_tt),
     ptr2->error_message, ptr2->error_message);
 
   /* Print some debug */
@@ -720,7 +1295,27 @@ int transfer2_load_transfers_from_disk(
   
   /* Open file for reading */
   class_open (ptr2->transfers_files[index_tt], ptr2->transfers_paths[index_tt], "rb", ptr2->error_message);
-  
+
+  /* Files written with disk_compression start with the magic number of a compressed block */
+  unsigned long long magic;
+  short is_compressed = (fread (&magic, sizeof(unsigned long long), 1, ptr2->transfers_files[index_tt]) == 1)
+                     && (magic == _BLOCK_MAGIC_);
+  rewind (ptr2->transfers_files[index_tt]);
+
+  if (is_compressed == _TRUE_) {
+
+    class_call (transfer2_load_transfers_compressed (ppt2, ptr2, index_tt),
+      ptr2->error_message,
+      ptr2->error_message);
+
+    fclose(ptr2->transfers_files[index_tt]);
+
+    if (ptr2->transfer2_verbose > 2)
+      printf ("Done.\n");
+
+    return _SUCCESS_;
+  }
+
   /* Two loops follow to read the file */
   for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1) {
   
@@ -763,6 +1358,91 @@ int transfer2_load_transfers_from_disk(
 }
 
 
+/**
+ * Load from disk the compressed transfer functions for the transfer type index_tt,
+ * written by transfer2_store_transfers_to_disk() and transfer2_compact_transfers(),
+ * and store them in ptr2->transfer[index_tt].
+ *
+ * The transfers file must be open for reading in ptr2->transfers_files[index_tt].
+ * The block index at the end of the file gives the position of each k1 level; the
+ * blocks are read in a single pass and then decompressed in parallel.
+ */
+
+int transfer2_load_transfers_compressed(
+        struct perturbs2 * ppt2,
+        struct transfers2 * ptr2,
+        int index_tt
+        )
+{
+
+  FILE * input_stream = ptr2->transfers_files[index_tt];
+  long int n_blocks = ppt2->k_size;
+
+  /* Read the block index */
+  long int index_position;
+
+  class_test ((fseek (input_stream, -(long int)sizeof(long int), SEEK_END) != 0)
+           || (fread (&index_position, sizeof(long int), 1, input_stream) != 1),
+    ptr2->error_message,
+    "could not read the block index of '%s'", ptr2->transfers_paths[index_tt]);
+
+  long int * block_offset;
+  class_alloc (block_offset, (n_blocks+1)*sizeof(long int), ptr2->error_message);
+
+  class_test ((fseek (input_stream, index_position, SEEK_SET) != 0)
+           || (fread (block_offset, sizeof(long int), n_blocks+1, input_stream) != (size_t)(n_blocks+1)),
+    ptr2->error_message,
+    "could not read the block index of '%s'; was it written with a different k sampling?",
+    ptr2->transfers_paths[index_tt]);
+
+  class_test ((block_offset[0] != 0) || (block_offset[n_blocks] != index_position),
+    ptr2->error_message,
+    "the block index of '%s' is corrupted", ptr2->transfers_paths[index_tt]);
+
+  /* Read all the blocks */
+  unsigned char * data;
+  class_alloc (data, MAX (block_offset[n_blocks], 1), ptr2->error_message);
+
+  class_test ((fseek (input_stream, 0, SEEK_SET) != 0)
+           || (fread (data, 1, block_offset[n_blocks], input_stream) != (size_t)block_offset[n_blocks]),
+    ptr2->error_message,
+    "could not read the compressed transfer functions from '%s'", ptr2->transfers_paths[index_tt]);
+
+  /* Decompress each k1 level in ptr2->transfer */
+  int abort = _FALSE_;
+
+  #pragma omp parallel for schedule (dynamic)
+  for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1) {
+
+    long int n = 0;
+    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2)
+      n += ptr2->k_size_k1k2[index_k1][index_k2];
+
+    class_call_parallel (block_decompress (
+                           data + block_offset[index_k1],
+                           block_offset[index_k1+1] - block_offset[index_k1],
+                           ptr2->transfer[index_tt][index_k1][0],
+                           n,
+                           ptr2->error_message),
+      ptr2->error_message,
+      ptr2->error_message);
+
+    #pragma omp atomic
+    ptr2->count_memorised_transfers += n;
+  }
+
+  free (data);
+  free (block_offset);
+
+  if (abort == _TRUE_)
+    return _FAILURE_;
+
+  return _SUCCESS_;
+
+}
+
+
+
 /**
  * Free all the memory space allocated by transfer2_init().
  */ 
@@ -785,7 +1465,7 @@ int transfer2_free(
     if ((ppr2->store_transfers_to_disk==_FALSE_) && (ppr2->load_transfers_from_disk==_FALSE_)) {
       for (int index_k1 = 0; index_k1 < k1_size; ++index_k1)
         if (ptr2->has_allocated_transfers[index_k1] == _TRUE_)
-          class_call(transfer2_free_k1_level(ppt2, ptr2, index_k1), ptr2->error_message, ptr2->error_message);
+          class_call(transfer2_free_k1_level(ppt2, ptr2, index_k1, ptr2->error_message), ptr2->error_message, ptr2->error_message);
       for (int index_tt = 0; index_tt < ptr2->tt2_size; ++index_tt)
         free (ptr2->transfer[index_tt]);
     }
@@ -793,6 +1473,8 @@ int transfer2_free(
     free (ptr2->transfer);
 
     free (ptr2->has_allocated_transfers);
+    free (ptr2->transfer_k1_arena);
+    free (ptr2->transfer_type_arena);
 
     for(int index_k1=0; index_k1<ppt2->k_size; ++index_k1) {
       free (ptr2->k_size_k1k2[index_k1]);
@@ -819,10 +1501,16 @@ int transfer2_free(
       free (ptr2->lm_array[index_l]);
     free (ptr2->lm_array);
 
+    free (ptr2->k1_rank);
+
     /* Free file arrays */
     if ((ppr2->store_transfers_to_disk == _TRUE_) || (ppr2->load_transfers_from_disk == _TRUE_)) {
 
-      // fclose(ptr2->transfers_status_file);
+      if (ptr2->has_stored_transfers != NULL) {
+        free (ptr2->has_stored_transfers);
+        free (ptr2->k1_offset);
+      }
+
 
       for(int index_tt=0; index_tt<ptr2->tt2_size; ++index_tt)
         free (ptr2->transfers_paths[index_tt]);
@@ -1031,6 +1719,8 @@ int transfer2_indices_of_transfers(
   
   /* Allocate and initialize the logical array that keeps track of the memory state of ptr2->transfers */
   class_calloc(ptr2->has_allocated_transfers, ppt2->k_size, sizeof(short), ptr2->error_message);
+  class_calloc(ptr2->transfer_k1_arena, ppt2->k_size, sizeof(struct arena), ptr2->error_message);
+  class_calloc(ptr2->transfer_type_arena, ptr2->tt2_size, sizeof(struct arena), ptr2->error_message);
 
 
 
@@ -1051,14 +1741,50 @@ int transfer2_indices_of_transfers(
       /* The name of each transfers file will have the tt index in it */
       class_alloc (ptr2->transfers_paths[index_tt], _FILENAMESIZE_*sizeof(char), ptr2->error_message);
       sprintf (ptr2->transfers_paths[index_tt], "%s/transfers_%03d.dat", ptr2->transfers_dir, index_tt);
-      if (ppr2->store_transfers_to_disk == _TRUE_)
-        class_open (ptr2->transfers_files[index_tt], ptr2->transfers_paths[index_tt], "wb", ptr2->error_message);
       
     }
 
+  }
+
+  /* Assign each k1 level to an MPI process, with a cost proportional to the number of
+  transfer functions to compute */
+  double * k1_cost;
+  class_alloc (k1_cost, ppt2->k_size*sizeof(double), ptr2->error_message);
+  class_alloc (ptr2->k1_rank, ppt2->k_size*sizeof(int), ptr2->error_message);
+
+  for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1) {
+    k1_cost[index_k1] = 0;
+    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2)
+      k1_cost[index_k1] += ptr2->k_size_k1k2[index_k1][index_k2];
+  }
+
+  class_call (perturb2_assign_k1_to_ranks (
+                ppr2,
+                ppt2->k_size,
+                k1_cost,
+                ptr2->k1_rank,
+                ptr2->error_message),
+    ptr2->error_message,
+    ptr2->error_message);
+
+  free (k1_cost);
+
+  /* Open the transfers files for writing, keeping the k1 levels already stored by an
+  interrupted run, if any */
+  ptr2->has_stored_transfers = NULL;
+  ptr2->k1_offset = NULL;
+
+  ptr2->transfers_compression = ppr2->disk_compression;
+  ptr2->transfers_compression_tolerance = ppr2->disk_compression_tolerance;
+
+  if (ppr2->store_transfers_to_disk == _TRUE_) {
+
+    class_call (transfer2_transfers_status_init (ppr2, ppt2, ptr2),
+      ptr2->error_message,
+      ptr2->error_message);
+
     if (ptr2->transfer2_verbose > 2)
       printf ("     * created %d files to store transfer functions\n", ptr2->tt2_size);
-
   }
   
 
@@ -2063,9 +2789,46 @@ int transfer2_compute (
 
 
   // =====================================================================================
-  // =                             Rescale transfer functions                            =
+  // =                              Store transfer function                              =
   // =====================================================================================
 
+  class_call (transfer2_rescale_and_store (
+                ptr2,
+                index_k1,
+                index_k2,
+                index_k,
+                index_l,
+                index_tt,
+                pw->transfer),
+    ptr2->error_message,
+    ptr2->error_message);
+
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Apply the normalisation factors to the line of sight integral for the
+ * transfer type index_tt, and store the result in ptr2->transfer.
+ *
+ * The integral is computed either by transfer2_compute() or, for the
+ * E and B-modes at the same time, by transfer2_compute_EB().
+ */
+
+int transfer2_rescale_and_store (
+        struct transfers2 * ptr2,
+        int index_k1,
+        int index_k2,
+        int index_k,
+        int index_l,
+        int index_tt,
+        double transfer /**< input, line of sight integral for the given (index_tt,index_k1,index_k2,index_k) */
+        )
+{
+
   /**
    * This is the best place to apply several factors on our second-order transfer functions.
    *
@@ -2089,13 +2852,13 @@ int transfer2_compute (
    */     
           
   /* Brightness -> Brightness temperature */
-  pw->transfer /= 4.;
+  transfer /= 4.;
         
   /* Y_lm expansion -> Legendre expansion */
-  pw->transfer /= (2.*ptr2->l[index_l] + 1);
+  transfer /= (2.*ptr2->l[index_l] + 1);
     
   /* Take the full second-order part of the temperature perturbation */
-  pw->transfer /= 2.;
+  transfer /= 2.;
 
 
 
@@ -2104,7 +2867,7 @@ int transfer2_compute (
   // =====================================================================================
 
   /* Store transfer function in transfer structure */
-  ptr2->transfer[index_tt][index_k1][index_k2][index_k] = pw->transfer;
+  ptr2->transfer[index_tt][index_k1][index_k2][index_k] = transfer;
 
   /* Counter to keep track of the number of values fit into ptr2->transfer */
   #pragma omp atomic
@@ -2118,6 +2881,341 @@ int transfer2_compute (
 
 
 
+/**
+ * Compute the E-mode and B-mode transfer functions for a given (k1,k2,k,l,m)
+ * at the same time, and store them in ptr2->transfer.
+ *
+ * This function is equivalent to calling transfer2_compute() for the E-mode
+ * and B-mode transfer types of the same (l,m), but it evaluates the four line
+ * of sight integrals involved (E->E, B->E, B->B and E->B) in a single sweep over
+ * the time grid using transfer2_integrate_EB(). The two projection functions
+ * and the two source functions are thus read only once, rather than twice.
+ *
+ * Used instead of transfer2_compute() when ppr2->batch_transfers is _TRUE_.
+ */
+
+int transfer2_compute_EB (
+        struct precision * ppr,
+        struct precision2 * ppr2,
+        struct perturbs2 * ppt2,
+        struct bessels * pbs,
+        struct bessels2 * pbs2,
+        struct transfers2 * ptr2,
+        int index_k1, /**< input, ppt2->k[index_k1] is the k1-value for which we shall compute T_lm(k1,k2,k) */
+        int index_k2, /**< input, ppt2->k[index_k2] is the k2-value for which we shall compute T_lm(k1,k2,k) */
+        int index_k,  /**< input, pw->k_grid[index_k] is the k-value for which we shall compute T_lm(k1,k2,k) */
+        int index_l,  /**< input, ptr2->l[index_l] is the l-value for which we shall compute T_lm(k1,k2,k) */
+        int index_m,  /**< input, ptr2->m[index_m] is the m-value for which we shall compute T_lm(k1,k2,k) */
+        int index_tt_E, /**< input, index of the E-mode transfer function for (l,m) */
+        int index_tt_B, /**< input, index of the B-mode transfer function for (l,m) */
+        double ** interpolated_sources_in_time, /**< input, value of the source functions S_lm(k1,k2,k) at all times in pw->tau_grid */
+        struct transfer2_workspace * pw /**< input and output, workspace containing the time grid (pw->tau_grid) and the value of k (pw->index_k)  */
+        )
+{
+
+  if (ptr2->transfer2_verbose > 4)
+    printf("     * computing E and B transfer functions for (l,m) = (%d,%d)\n", ptr2->l[index_l], ptr2->m[index_m]);
+
+  /* Number of multipole sources to consider */
+  pw->L_max = ppr2->l_max_los_p;
+
+  /* Direct and mixing contributions to E and B; see transfer2_compute() */
+  double E_to_E, B_to_E, B_to_B, E_to_B;
+
+  class_call (transfer2_integrate_EB (
+                ppr,
+                ppr2,
+                pbs2,
+                ppt2,
+                ptr2,
+                index_l,
+                index_m,
+                interpolated_sources_in_time,
+                pw,
+                &E_to_E,
+                &B_to_E,
+                &B_to_B,
+                &E_to_B),
+    ptr2->error_message,
+    ptr2->error_message);
+
+  /* The E->B contribution is computed with J_EB = -J_BE, hence the minus sign. As
+  in transfer2_compute(), the B->E contribution is included only for non-scalar modes. */
+  double transfer_E = E_to_E + (ptr2->m[index_m] != 0 ? B_to_E : 0);
+  double transfer_B = B_to_B - E_to_B;
+
+  class_call (transfer2_rescale_and_store (
+                ptr2,
+                index_k1,
+                index_k2,
+                index_k,
+                index_l,
+                index_tt_E,
+                transfer_E),
+    ptr2->error_message,
+    ptr2->error_message);
+
+  class_call (transfer2_rescale_and_store (
+                ptr2,
+                index_k1,
+                index_k2,
+                index_k,
+                index_l,
+                index_tt_B,
+                transfer_B),
+    ptr2->error_message,
+    ptr2->error_message);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Solve at the same time the four line of sight integrals needed for the
+ * E-mode and B-mode transfer functions for a given (k1,k2,k,l,m).
+ *
+ * The integrals combine the projection functions J_EE and J_EB with the
+ * source functions S_E and S_B:
+ * - E_to_E is the integral of J_EE*S_E,
+ * - B_to_E is the integral of J_EB*S_B,
+ * - B_to_B is the integral of J_EE*S_B (J_BB is equal to J_EE),
+ * - E_to_B is the integral of J_EB*S_E (J_BE is equal to -J_EB).
+ *
+ * For each L, the projection functions are first interpolated on the time
+ * grid using transfer2_interpolate_J(); then the four integrals are updated
+ * in one loop over time. The summation order is the same as in
+ * transfer2_integrate(), so that the results are identical.
+ */
+
+int transfer2_integrate_EB (
+      struct precision * ppr,
+      struct precision2 * ppr2,
+      struct bessels2 * pbs2,
+      struct perturbs2 * ppt2,
+      struct transfers2 * ptr2,
+      int index_l,
+      int index_m,
+      double ** interpolated_sources_in_time,
+      struct transfer2_workspace * pw,
+      double * E_to_E,
+      double * B_to_E,
+      double * B_to_B,
+      double * E_to_B
+      )
+{
+
+  int l = ptr2->l[index_l];
+  int m = ptr2->m[index_m];
+
+  *E_to_E = *B_to_E = *B_to_B = *E_to_B = 0;
+
+  double * J_EE = pw->J_in_time[0];
+  double * J_EB = pw->J_in_time[1];
+  double * delta_tau = pw->delta_tau;
+
+  for(int index_L=0; index_L<=pw->L_max; ++index_L) {
+
+    /* The 3j symbol in the definition of J forces the azimuthal number m to be smaller
+    than both l and L */
+    int L = pbs2->L[index_L];
+    if (abs(m) > MIN(L,l))
+      continue;
+
+    /* Interpolate the projection functions on the time grid; tau_size_EE and tau_size_EB
+    are the number of time steps where they are not negligible */
+    int tau_size_EE, tau_size_EB;
+
+    class_call (transfer2_interpolate_J (ppr, pbs2, ptr2, pbs2->index_J_EE, index_L, index_l, index_m,
+                  pw, J_EE, &tau_size_EE),
+      ptr2->error_message,
+      ptr2->error_message);
+
+    class_call (transfer2_interpolate_J (ppr, pbs2, ptr2, pbs2->index_J_EB, index_L, index_l, index_m,
+                  pw, J_EB, &tau_size_EB),
+      ptr2->error_message,
+      ptr2->error_message);
+
+    /* The projection function with the shortest range is zero beyond it */
+    int tau_size = MAX (tau_size_EE, tau_size_EB);
+
+    if (tau_size == 0)
+      continue;
+
+    for (int index_tau=tau_size_EE; index_tau < tau_size; ++index_tau)
+      J_EE[index_tau] = 0;
+    for (int index_tau=tau_size_EB; index_tau < tau_size; ++index_tau)
+      J_EB[index_tau] = 0;
+
+    /* Source functions for this L */
+    double * source_E = interpolated_sources_in_time[ppt2->index_tp2_E + lm(L,m)];
+    double * source_B = interpolated_sources_in_time[ppt2->index_tp2_B + lm(L,m)];
+
+    double E_to_E_L = 0, B_to_E_L = 0, B_to_B_L = 0, E_to_B_L = 0;
+
+    #pragma omp simd reduction(+:E_to_E_L,B_to_E_L,B_to_B_L,E_to_B_L)
+    for (int index_tau=0; index_tau < tau_size; ++index_tau) {
+      E_to_E_L += J_EE[index_tau] * source_E[index_tau] * delta_tau[index_tau];
+      B_to_E_L += J_EB[index_tau] * source_B[index_tau] * delta_tau[index_tau];
+      B_to_B_L += J_EE[index_tau] * source_B[index_tau] * delta_tau[index_tau];
+      E_to_B_L += J_EB[index_tau] * source_E[index_tau] * delta_tau[index_tau];
+    }
+
+    *E_to_E += E_to_E_L;
+    *B_to_E += B_to_E_L;
+    *B_to_B += B_to_B_L;
+    *E_to_B += E_to_B_L;
+
+  } // end of for(index_L)
+
+  /* Correct for factor 1/2 from the trapezoidal rule */
+  *E_to_E *= 0.5;
+  *B_to_E *= 0.5;
+  *B_to_B *= 0.5;
+  *E_to_B *= 0.5;
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Interpolate the projection function J_Llm(x) on the time grid of the line of
+ * sight integral, x=k*(tau0-tau), for a given projection type (index_J).
+ *
+ * The result is written in J_in_time for the first tau_size points of the time
+ * grid, where tau_size is the number of time steps where J_Llm is not negligible;
+ * see transfer2_integrate() for details.
+ */
+
+int transfer2_interpolate_J (
+      struct precision * ppr,
+      struct bessels2 * pbs2,
+      struct transfers2 * ptr2,
+      int index_J,
+      int index_L,
+      int index_l,
+      int index_m,
+      struct transfer2_workspace * pw,
+      double * J_in_time,
+      int * tau_size
+      )
+{
+
+  int * index_x = pw->index_x;
+  double * a_J = pw->a_J;
+
+  /* Find the time steps where J_Llm is not negligible; they are at the beginning of
+  the grid, because x decreases with time */
+  int index_x_min = pbs2->index_xmin_J[index_J][index_L][index_l][index_m];
+
+  *tau_size = pw->tau_grid_size;
+  while ((*tau_size > 0) && (index_x[*tau_size-1] < index_x_min))
+    --(*tau_size);
+
+  if (*tau_size == 0)
+    return _SUCCESS_;
+
+#ifdef DEBUG
+  int x_size = pbs2->x_size_J[index_J][index_L][index_l][index_m];
+  class_test (index_x[0] - index_x_min >= x_size,
+    ptr2->error_message,
+    "L=%d, l=%d, m=%d: wrong indexing for pbs2->J_Llm_x; index_x_in_J=%d, x_size=%d, index_x_min=%d",
+    pbs2->L[index_L], ptr2->l[index_l], ptr2->m[index_m], index_x[0] - index_x_min, x_size, index_x_min);
+#endif // DEBUG
+
+  double xx_step_sq_over_6 = pbs2->xx_step * pbs2->xx_step / 6.0;
+
+  /* Projection function stored on its own x-grid (see bessel2_adapt_J()). The segment
+  and the stride are found in O(1) from the position index_x in the fine grid pbs2->xx;
+  only linear interpolation is supported */
+  if (pbs2->has_adaptive_J == _TRUE_) {
+
+    double * J = pw->J_Llm_x[index_J][index_L][index_l][index_m];
+    struct bessel2_segment * segments = pbs2->J_segments[index_J][index_L][index_l][index_m];
+
+    for (int index_tau=0; index_tau < *tau_size; ++index_tau) {
+      int index_x_in_J = index_x[index_tau] - index_x_min;
+      struct bessel2_segment segment = segments[index_x_in_J >> _BESSEL2_SEGMENT_SHIFT_];
+      double t = ((index_x_in_J & (_BESSEL2_SEGMENT_SIZE_-1)) + 1 - a_J[index_tau]) / segment.stride;
+      int node = (int)t;
+      double b = t - node;
+      J_in_time[index_tau] = (1-b)*J[segment.offset+node] + b*J[segment.offset+node+1];
+    }
+  }
+
+  /* The two branches differ only in the type of the stored projection function; the
+  single-precision values are upconverted to double before the interpolation, so that
+  the only loss of accuracy is the one due to storage (see bessel2_compact_J()) */
+  else if (pbs2->has_compact_J == _FALSE_) {
+
+    double * J = pw->J_Llm_x[index_J][index_L][index_l][index_m];
+
+    if (ppr->bessels_interpolation == linear_interpolation) {
+
+      #pragma omp simd
+      for (int index_tau=0; index_tau < *tau_size; ++index_tau) {
+        int index_x_in_J = index_x[index_tau] - index_x_min;
+        J_in_time[index_tau] = a_J[index_tau]*J[index_x_in_J] + (1-a_J[index_tau])*J[index_x_in_J+1];
+      }
+    }
+
+    else if (ppr->bessels_interpolation == cubic_interpolation) {
+
+      double * ddJ = pw->ddJ_Llm_x[index_J][index_L][index_l][index_m];
+
+      #pragma omp simd
+      for (int index_tau=0; index_tau < *tau_size; ++index_tau) {
+        int index_x_in_J = index_x[index_tau] - index_x_min;
+        double a = a_J[index_tau];
+        J_in_time[index_tau] = (a * J[index_x_in_J] +
+                                (1.-a) * (J[index_x_in_J+1]
+                              - a * ((a+1.) * ddJ[index_x_in_J]
+                               +(2.-a) * ddJ[index_x_in_J+1])
+                              * xx_step_sq_over_6));
+      }
+    }
+  }
+
+  else {
+
+    float * J = pw->J_Llm_x_float[index_J][index_L][index_l][index_m];
+
+    if (ppr->bessels_interpolation == linear_interpolation) {
+
+      #pragma omp simd
+      for (int index_tau=0; index_tau < *tau_size; ++index_tau) {
+        int index_x_in_J = index_x[index_tau] - index_x_min;
+        J_in_time[index_tau] = a_J[index_tau]*(double)J[index_x_in_J] + (1-a_J[index_tau])*(double)J[index_x_in_J+1];
+      }
+    }
+
+    else if (ppr->bessels_interpolation == cubic_interpolation) {
+
+      float * ddJ = pw->ddJ_Llm_x_float[index_J][index_L][index_l][index_m];
+
+      #pragma omp simd
+      for (int index_tau=0; index_tau < *tau_size; ++index_tau) {
+        int index_x_in_J = index_x[index_tau] - index_x_min;
+        double a = a_J[index_tau];
+        J_in_time[index_tau] = (a * (double)J[index_x_in_J] +
+                                (1.-a) * ((double)J[index_x_in_J+1]
+                              - a * ((a+1.) * (double)ddJ[index_x_in_J]
+                               +(2.-a) * (double)ddJ[index_x_in_J+1])
+                              * xx_step_sq_over_6));
+      }
+    }
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+
+
 /**
  * Solve the line of sight integral for the set of parameters (k1,k2,k,l,m)
  * using the trapezoidal method.
@@ -2182,148 +3280,131 @@ int transfer2_integrate (
   // =                             Perform the integration                               =
   // =====================================================================================
   
-  /* Solve the line of sight integral by looping over time. The integral is in eq. 5.95
-  of http://arxiv.org/abs/1405.2280. The time grid is built in transfer2_get_time_grid()
-  to match the sampling of the line of sight sources (ppt2->tau_sampling), with the addition
-  of extra points to follow the oscillations of the projection functions J. We implement
-  the integration following the positive direction of time, which is the negative direction
-  of x=k(tau0-tau). */
-  
-  for (int index_tau=0; index_tau < pw->tau_grid_size; ++index_tau) {
+  /* Solve the line of sight integral. The integral is in eq. 5.95 of
+  http://arxiv.org/abs/1405.2280; the integrand function is the sum over L of the product
+  between the source S_Lm(k1,k2,k,tau) and the projection functions J_Llm(k(tau0-tau)).
+  The time grid is built in transfer2_get_time_grid() to match the sampling of the line
+  of sight sources (ppt2->tau_sampling), with the addition of extra points to follow the
+  oscillations of the projection functions J.
   
-    /* Argument of the projection function at the considered time */
-    double x = k * pw->tau0_minus_tau[index_tau];
-      
-    /* Position of x inside pbs2->xx, the array that we used to sample the projection
-    functions */
-    int index_x = (int)(x/pbs2->xx_step);
+  We perform the sum over L in the outer loop and the integral over time in the inner
+  one, so that the inner loop accesses J_Llm(x) and S_Lm(tau) sequentially for fixed L,
+  and has no branches: the position of x=k(tau0-tau) in pbs2->xx and its interpolation
+  weight were computed in transfer2_get_time_grid(), the time range where J_Llm is not
+  negligible is determined beforehand, and the interpolation method is chosen outside
+  the loop. This allows the compiler to vectorise the inner loop.
   
-    /* Interpolation weight assigned to x */
-    double a_J = (pbs2->xx[index_x+1] - x)/pbs2->xx_step;
-    
-    /* The integrand function is the sum over L of the product between the source
-    S_Lm(k1,k2,k,tau) and the projection functions J_Llm(k(tau0-tau)); therefore,
-    we shall increment the integrand function inside a loop over L from 0 to 
-    pw->L_max. In principle, pw->L_max should be of order O(2000), but in practice
-    it is O(few) at recombination due to tight-coupling suppression of higher-order
-    multipoles. */
-    double integrand = 0;
-
-    for(int index_L=0; index_L<=pw->L_max; ++index_L) {
-  
-      /* The 3j symbol in the definition of J forces the azimuthal number m to be smaller
-      than both l and L (see eq. 5.97 of http://arxiv.org/abs/1405.2280) */
-      int L = pbs2->L[index_L];
-      if (abs(m) > MIN(L,l))
-        continue;
-            
-      /* The projection function J_Llm is negligible when x is too small; index_x_min is the first
-      value in pbs2->xx where J_Llm(x) is non-negligible */
-      int index_x_min = pbs2->index_xmin_J[index_J][index_L][index_l][index_m];
-
-      /* Skip the contribution to the integral from this L if the projection function is
-      negligible. The projection function J_Llm(x) is basically a Bessel function of order l,
-      so it vanishes when x<<l. Since its argument is x=k*(tau_0-tau), this means that J
-      vanishes when tau is much larger than tau_0-l/k; that is, high-l multipoles do not get
-      contributions from low-k modes. If you do not include this check, you will get random
-      segmentation faults, because you would end up addressing J_Llm_x with a negative x index.
-      Note that this check also ensures that we skip L<2 configurations for polarisation,
-      as it should be. */
-      if (index_x < index_x_min)
-        continue;
+  In principle, pw->L_max should be of order O(2000), but in practice it is O(few) at
+  recombination due to tight-coupling suppression of higher-order multipoles. */
+
+  int * index_x = pw->index_x;
+  double * a_J = pw->a_J;
+  double * delta_tau = pw->delta_tau;
+  double xx_step_sq_over_6 = pbs2->xx_step * pbs2->xx_step / 6.0;
   
-      /* Index needed to address the x-level of the projection function array, pbs2->J_Llm_x.
-      The above check ensures that the index is non-negative. */
-      int index_x_in_J = index_x - index_x_min;
-      
+  for(int index_L=0; index_L<=pw->L_max; ++index_L) {
+
+    /* The 3j symbol in the definition of J forces the azimuthal number m to be smaller
+    than both l and L (see eq. 5.97 of http://arxiv.org/abs/1405.2280) */
+    int L = pbs2->L[index_L];
+    if (abs(m) > MIN(L,l))
+      continue;
+
+    /* The projection function J_Llm is negligible when x is too small; index_x_min is the first
+    value in pbs2->xx where J_Llm(x) is non-negligible */
+    int index_x_min = pbs2->index_xmin_J[index_J][index_L][index_l][index_m];
+
+    /* Skip the contribution to the integral from the times where the projection function is
+    negligible. The projection function J_Llm(x) is basically a Bessel function of order l,
+    so it vanishes when x<<l. Since its argument is x=k*(tau_0-tau), this means that J
+    vanishes when tau is much larger than tau_0-l/k; that is, high-l multipoles do not get
+    contributions from low-k modes. Since x decreases with time, the times to skip are at
+    the end of the grid, and tau_size is the number of time steps that contribute. If you
+    do not include this check, you will get random segmentation faults, because you would
+    end up addressing J_Llm_x with a negative x index. Note that this check also ensures
+    that we skip L<2 configurations for polarisation, as it should be. */
+    int tau_size = pw->tau_grid_size;
+    while ((tau_size > 0) && (index_x[tau_size-1] < index_x_min))
+      --tau_size;
+
+    if (tau_size == 0)
+      continue;
+
 #ifdef DEBUG
-      /* Check that index_x is within the limits for which we have computed the projection functions */
-      int x_size = pbs2->x_size_J[index_J][index_L][index_l][index_m];
-      class_test ((index_x_in_J >= x_size) || (index_x_in_J < 0),
-        ptr2->error_message,
-        "L=%d, l=%d, m=%d, x=%g: wrong indexing for pbs2->J_Llm_x; index_x_in_J=%d, x_size=%d, index_x_min=%d",
-        L, l, m, x, index_x_in_J, x_size, index_x_min);
+    /* Check that index_x is within the limits for which we have computed the projection functions;
+    the largest x is at the first time step */
+    int x_size = pbs2->x_size_J[index_J][index_L][index_l][index_m];
+    class_test (index_x[0] - index_x_min >= x_size,
+      ptr2->error_message,
+      "L=%d, l=%d, m=%d, x=%g: wrong indexing for pbs2->J_Llm_x; index_x_in_J=%d, x_size=%d, index_x_min=%d",
+      L, l, m, k*pw->tau0_minus_tau[0], index_x[0] - index_x_min, x_size, index_x_min);
 #endif // DEBUG
-  
-  
-      // ---------------------------------------------------------------------------
-      // -                              Interpolate J(x)                           -
-      // ---------------------------------------------------------------------------
 
-      /* Interpolate J in x=k*(tau0-tau) */
-      double J_Llm;
-      double * J = &(pbs2->J_Llm_x[index_J][index_L][index_l][index_m][index_x_in_J]);
-      double J_Llm_left = *J;
-      double J_Llm_right = *(J+1);
-      
-      if (ppr->bessels_interpolation == linear_interpolation) {
-        J_Llm = a_J*J_Llm_left + (1-a_J)*J_Llm_right;
-      }
-      else if (ppr->bessels_interpolation == cubic_interpolation) {
-        double * ddJ = &(pbs2->ddJ_Llm_x[index_J][index_L][index_l][index_m][index_x_in_J]);
-        double ddJ_Llm_left = *ddJ;
-        double ddJ_Llm_right = *(ddJ+1);
-        J_Llm = (a_J * J_Llm_left +                                
-                 (1.-a_J) * (J_Llm_right
-               - a_J * ((a_J+1.) * ddJ_Llm_left
-                +(2.-a_J) * ddJ_Llm_right) 
-               * pbs2->xx_step * pbs2->xx_step / 6.0) );
-      }
+    /* Projection function and pre-interpolated source function in tau and k3 for the
+    desired source type */
+    double * J = pw->J_Llm_x[index_J][index_L][index_l][index_m];
+    double * source_Lm = interpolated_sources_in_time[index_source_monopole + lm(L,m)];
 
-      /* Debug - Check the interpolation of the projection function */
-      // if ((index_tau == ppt2->index_tau_rec) && (pw->index_k1==1) && (pw->index_k2==0)) {
-      //
-      //   int index_xmin_J = pbs2->index_xmin_J[index_J][index_L][index_l][index_m];
-      //   double x_left = pbs2->xx[index_x-index_xmin_J];
-      //   double x_right = pbs2->xx[index_x-index_xmin_J+1];
-      //
-      //   if ((L == 2) && (l==4) && (m==0)) {
-      //     if (x_left > -1) {
-      //       double J_Llm_linear = a_J*J_Llm_left + (1-a_J)*J_Llm_right;
-      //       fprintf(stderr, "%.17f %.17f %.17f %.17f %.17f\n",
-      //         x, J_Llm, J_Llm_linear, J_Llm_left, J_Llm_right);
-      //       fprintf(stderr, "JL(%d,%d,%d,x=%10.6g[%d]) = %10.6g\n",
-      //         L, l, m, x_left, index_x-index_xmin_J, J_Llm_left);
-      //       fprintf(stderr, "J(%d,%d,%d,x=%10.6g) = %10.6g\n",
-      //         L, l, m, x, J_Llm);
-      //       fprintf(stderr, "JR(%d,%d,%d,x=%10.6g[%d]) = %10.6g\n",
-      //         L, l, m, x_right, index_x-index_xmin_J+1, J_Llm_right);
-      //       fprintf(stderr, "\n");
-      //     }
-      //   }
-      // }
+    /* Contribution of this L to the integral */
+    double integral_L = 0;
 
+    /* If the projection functions are stored in single precision or on an adaptive
+    grid, interpolate them on the time grid in double precision first, and then integrate */
+    if ((pbs2->has_compact_J == _TRUE_) || (pbs2->has_adaptive_J == _TRUE_)) {
 
-      // ---------------------------------------------------------------------------
-      // -                           Build the integrand                           -
-      // ---------------------------------------------------------------------------
+      double * J_in_time = pw->J_in_time[0];
 
-      /* Pre-interpolated source function in tau and k3 for the desired source type */
-      double source_Lm = interpolated_sources_in_time[index_source_monopole + lm(L,m)][index_tau];
+      class_call (transfer2_interpolate_J (
+                    ppr,
+                    pbs2,
+                    ptr2,
+                    index_J,
+                    index_L,
+                    index_l,
+                    index_m,
+                    pw,
+                    J_in_time,
+                    &tau_size),
+        ptr2->error_message,
+        ptr2->error_message);
 
-      /* Increment the integrand function by adding another L-multipole  */
-      integrand += J_Llm * source_Lm;
-  
-      /* Debug - Print the integrand function for a given set of (l,m,k1,k2,k) */
-      // if ( (l==100) && (m==0) ) {
-      //   if ( (pw->index_k1==0) && (pw->index_k2==1) && (pw->index_k==2500) ) {
-      //     fprintf (stderr, "%15f %15f\n", ptr2->tau0_minus_tau[index_tau], integrand);
-      //   }
-      // }
+      #pragma omp simd reduction(+:integral_L)
+      for (int index_tau=0; index_tau < tau_size; ++index_tau)
+        integral_L += J_in_time[index_tau] * source_Lm[index_tau] * delta_tau[index_tau];
+    }
 
-    } // end of for(index_L)    
-    
-    /* Increment the result with the contribution from the considered time-step */
-    *integral += integrand * pw->delta_tau[index_tau];
-  
-    /* Debug - Output the integrand as a function of time */
-    // if (l == 2) {
-    //   if (index_tau==0)
-    //     fprintf_k_debug (stderr, "# k1=%g, k2=%g, k=%g\n", ppt2->k[index_k1], ppt2->k[index_k2], k);
-    //   p2 (pw->tau_grid[index_tau], integrand);
-    // }
-  
-  } // end of for(index_tau)
+    /* Interpolate J linearly in x=k*(tau0-tau) */
+    else if (ppr->bessels_interpolation == linear_interpolation) {
+
+      #pragma omp simd reduction(+:integral_L)
+      for (int index_tau=0; index_tau < tau_size; ++index_tau) {
+        int index_x_in_J = index_x[index_tau] - index_x_min;
+        double J_Llm = a_J[index_tau]*J[index_x_in_J] + (1-a_J[index_tau])*J[index_x_in_J+1];
+        integral_L += J_Llm * source_Lm[index_tau] * delta_tau[index_tau];
+      }
+    }
+
+    /* Interpolate J with cubic splines in x=k*(tau0-tau) */
+    else if (ppr->bessels_interpolation == cubic_interpolation) {
+
+      double * ddJ = pw->ddJ_Llm_x[index_J][index_L][index_l][index_m];
+
+      #pragma omp simd reduction(+:integral_L)
+      for (int index_tau=0; index_tau < tau_size; ++index_tau) {
+        int index_x_in_J = index_x[index_tau] - index_x_min;
+        double a = a_J[index_tau];
+        double J_Llm = (a * J[index_x_in_J] +
+                        (1.-a) * (J[index_x_in_J+1]
+                      - a * ((a+1.) * ddJ[index_x_in_J]
+                       +(2.-a) * ddJ[index_x_in_J+1])
+                      * xx_step_sq_over_6));
+        integral_L += J_Llm * source_Lm[index_tau] * delta_tau[index_tau];
+      }
+    }
+
+    *integral += integral_L;
+
+  } // end of for(index_L)
 
   /* Correct for factor 1/2 from the trapezoidal rule */
   *integral *= 0.5;
@@ -2579,6 +3660,16 @@ int transfer2_get_time_grid(
       
   pw->delta_tau[pw->tau_grid_size-1] = pw->tau_grid[pw->tau_grid_size-1]-pw->tau_grid[pw->tau_grid_size-2];
 
+  /* Fill the position of x=k*(tau0-tau) inside pbs2->xx, the array that we used to sample
+  the projection functions, and its linear interpolation weight. These do not depend on
+  the multipoles, so we compute them once for all the calls to transfer2_integrate(). */
+  for (index_tau_tr=0; index_tau_tr < pw->tau_grid_size; ++index_tau_tr) {
+    double x = pw->k * pw->tau0_minus_tau[index_tau_tr];
+    int index_x = (int)(x/pbs2->xx_step);
+    pw->index_x[index_tau_tr] = index_x;
+    pw->a_J[index_tau_tr] = (pbs2->xx[index_x+1] - x)/pbs2->xx_step;
+  }
+
 
   return _SUCCESS_;
 
@@ -2915,13 +4006,25 @@ int transfer2_interpolate_sources_in_time (
  * Save the transfer functions to disk for a given k1 index.
  * 
  * The transfer functions are stored to disk in as many files as the number
- * of transfer types (index_tt2). This function will append to each of these files
- * the transfer functions relative to the considered index_k1.
+ * of transfer types (index_tt2). This function will write to each of these files
+ * the transfer functions relative to the considered index_k1, at the position
+ * ptr2->k1_offset[index_k1].
  *
  * The path of the files is stored in ptr2->transfers_paths[index_tt2],
  * while their file reference is in ptr2->transfers_files[index_tt2]. All files
  * must be already open for writing.
  *
+ * If ptr2->transfers_compression is not block_compression_none, the level of each
+ * type is written as a single compressed block (see block_compress()) at the start
+ * of its slot, which has room for the uncompressed level and the block header;
+ * the rest of the slot is not written to, and is removed by
+ * transfer2_compact_transfers() once all the k1 levels are written.
+ *
+ * Once all the files are written, the checksums of the data are recorded in the
+ * status file, so that the k1 level is not computed again if the run is interrupted;
+ * see transfer2_transfers_status_init(). Different MPI processes can call this
+ * function at the same time for different k1 levels.
+ *
  * This function will not free memory; if you are concerned about memory consumption
  * you will have to free it manually with transfer2_free_k1_level().
  * 
@@ -2929,38 +4032,473 @@ int transfer2_interpolate_sources_in_time (
 int transfer2_store_transfers_to_disk(
         struct perturbs2 * ppt2,
         struct transfers2 * ptr2,
-        int index_k1
+        int index_k1,
+        ErrorMsg error_message
         )
 {
 
   /* Print some info */
   if (ptr2->transfer2_verbose > 1)
     printf("     \\ writing transfer function for index_k1=%d ...\n", index_k1);
-          
+
+  /* Checksum of the data written to each file */
+  unsigned long long * checksums;
+  class_alloc (checksums, ptr2->tt2_size*sizeof(unsigned long long), error_message);
+
+  /* Compress the level of each type in parallel; since the k2 rows of a (type,k1) pair
+  are contiguous, each of them becomes a single block */
+  long int n = 0;
+  for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2)
+    n += ptr2->k_size_k1k2[index_k1][index_k2];
+
+  unsigned char * blocks = NULL;
+  long int * block_size = NULL;
+
+  if (ptr2->transfers_compression != block_compression_none) {
+
+    class_alloc (blocks, ptr2->tt2_size*block_compress_bound (n), error_message);
+    class_alloc (block_size, ptr2->tt2_size*sizeof(long int), error_message);
+
+    int abort = _FALSE_;
+
+    #pragma omp parallel for schedule (dynamic)
+    for (int index_tt = 0; index_tt < ptr2->tt2_size; index_tt++) {
+
+      class_call_parallel (block_compress (
+                             ptr2->transfer[index_tt][index_k1][0],
+                             n,
+                             ptr2->transfers_compression,
+                             ptr2->transfers_compression_tolerance,
+                             blocks + index_tt*block_compress_bound (n),
+                             &block_size[index_tt],
+                             error_message),
+        error_message,
+        error_message);
+    }
+
+    if (abort == _TRUE_) {
+      free (checksums);
+      free (blocks);
+      free (block_size);
+      return _FAILURE_;
+    }
+  }
+
   for (int index_tt = 0; index_tt < ptr2->tt2_size; index_tt++) {
+
+    checksums[index_tt] = _CHECKSUM_SEED_;
+
+    /* The k1 levels might be written in any order */
+    class_test (fseek (ptr2->transfers_files[index_tt], ptr2->k1_offset[index_k1], SEEK_SET) != 0,
+      error_message,
+      "could not seek to the index_k1=%d level of '%s'", index_k1, ptr2->transfers_paths[index_tt]);
     
     /* Print some info */
     if (ptr2->transfer2_verbose > 3)
       printf("     * writing transfer function for (index_tt,index_k1)=(%d,%d) on '%s' ...\n",
         index_tt, index_k1, ptr2->transfers_paths[index_tt]);
 
-    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
-  
-      /* Write a chunk with all the k-values for this set of (type,k1,k2) */
-      fwrite(
-            ptr2->transfer[index_tt][index_k1][index_k2],
-            sizeof(double),
-            ptr2->k_size_k1k2[index_k1][index_k2],
-            ptr2->transfers_files[index_tt]
-            );
+    if (ptr2->transfers_compression != block_compression_none) {
 
-    } // end of for(index_k2)
+      unsigned char * block = blocks + index_tt*block_compress_bound (n);
+
+      class_test (fwrite (block, 1, block_size[index_tt], ptr2->transfers_files[index_tt])
+        != (size_t)block_size[index_tt],
+        error_message,
+        "could not write to '%s'", ptr2->transfers_paths[index_tt]);
+
+      perturb2_checksum (block, block_size[index_tt], &checksums[index_tt]);
+    }
+    else {
+
+      for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2) {
+
+        /* Write a chunk with all the k-values for this set of (type,k1,k2) */
+        fwrite(
+              ptr2->transfer[index_tt][index_k1][index_k2],
+              sizeof(double),
+              ptr2->k_size_k1k2[index_k1][index_k2],
+              ptr2->transfers_files[index_tt]
+              );
+
+        perturb2_checksum (
+          ptr2->transfer[index_tt][index_k1][index_k2],
+          ptr2->k_size_k1k2[index_k1][index_k2]*sizeof(double),
+          &checksums[index_tt]);
+
+      } // end of for(index_k2)
+    }
+
+    /* Make sure that the data is out of the buffers before recording it in the status file */
+    class_test (fflush (ptr2->transfers_files[index_tt]) != 0,
+      error_message,
+      "could not write to '%s'", ptr2->transfers_paths[index_tt]);
 
   } // end of for(index_tt)
 
+  /* Record that the k1 level is complete, in the status file of this MPI process */
+  class_open (ptr2->transfers_status_file, ptr2->transfers_status_rank_path, "a", error_message);
+
+  fprintf (ptr2->transfers_status_file, "k1 %d", index_k1);
+  for (int index_tt = 0; index_tt < ptr2->tt2_size; index_tt++)
+    fprintf (ptr2->transfers_status_file, " %llx", checksums[index_tt]);
+  fprintf (ptr2->transfers_status_file, "\n");
+
+  class_test (fclose (ptr2->transfers_status_file) != 0,
+    error_message,
+    "could not update the status file '%s'", ptr2->transfers_status_rank_path);
+
+  free (checksums);
+  free (blocks);
+  free (block_size);
+
   return _SUCCESS_; 
   
 }
+
+
+
+/**
+ * Rewrite the compressed transfers files without the unused part of the k1 slots.
+ *
+ * While the transfer functions are computed, each k1 level of a compressed transfers
+ * file has a slot large enough for the uncompressed level (see transfer2_k1_offsets()),
+ * so that the levels can be written in any order by different MPI processes. Once all
+ * the levels are written, this function moves the compressed blocks one after the
+ * other and appends the block index, that is, the position in the file of each block
+ * and of the end of the last one, followed by the position of the index itself, as in
+ * the compressed sources files. Each file is written next to the old one and then
+ * renamed, so that an interrupted run never leaves a truncated file.
+ *
+ * The transfers files must be closed. Only the first MPI process calls this function,
+ * after all the processes have written their k1 levels.
+ */
+
+int transfer2_compact_transfers (
+        struct perturbs2 * ppt2,
+        struct transfers2 * ptr2
+        )
+{
+
+  long int n_blocks = ppt2->k_size;
+
+  long int max_bytes = 0;
+  for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1)
+    max_bytes = MAX (max_bytes, ptr2->k1_offset[index_k1+1] - ptr2->k1_offset[index_k1]);
+
+  unsigned char * block;
+  class_alloc (block, max_bytes, ptr2->error_message);
+
+  long int * block_offset;
+  class_alloc (block_offset, (n_blocks+1)*sizeof(long int), ptr2->error_message);
+
+  long int compressed_size = 0;
+
+  for (int index_tt = 0; index_tt < ptr2->tt2_size; ++index_tt) {
+
+    char * path = ptr2->transfers_paths[index_tt];
+    char tmp_path[_FILENAMESIZE_+32];
+    sprintf (tmp_path, "%s.%d.tmp", path, (int)getpid());
+
+    FILE * input_stream = fopen (path, "rb");
+    FILE * output_stream = fopen (tmp_path, "wb");
+
+    int write_error = (input_stream == NULL) || (output_stream == NULL);
+
+    block_offset[0] = 0;
+
+    for (int index_k1 = 0; (index_k1 < ppt2->k_size) && !write_error; ++index_k1) {
+
+      long int block_size = 0;
+
+      write_error = (fseek (input_stream, ptr2->k1_offset[index_k1], SEEK_SET) != 0)
+        || (block_read (input_stream, block, max_bytes, &block_size, ptr2->error_message) != _SUCCESS_)
+        || (fwrite (block, 1, block_size, output_stream) != (size_t)block_size);
+
+      block_offset[index_k1+1] = block_offset[index_k1] + block_size;
+    }
+
+    /* Write the block index, followed by its position */
+    write_error = write_error
+      || (fwrite (block_offset, sizeof(long int), n_blocks+1, output_stream) != (size_t)(n_blocks+1))
+      || (fwrite (&block_offset[n_blocks], sizeof(long int), 1, output_stream) != 1);
+
+    if (input_stream != NULL)
+      fclose (input_stream);
+
+    if (output_stream != NULL)
+      write_error = (fclose (output_stream) != 0) || write_error;
+
+    if (write_error || (rename (tmp_path, path) != 0)) {
+      remove (tmp_path);
+      free (block);
+      free (block_offset);
+      class_stop (ptr2->error_message,
+        "could not compact the compressed transfer functions in '%s'", path);
+    }
+
+    compressed_size += block_offset[n_blocks] + (n_blocks+2)*sizeof(long int);
+  }
+
+  if (ptr2->transfer2_verbose > 1)
+    printf (" -> compressed the transfer functions to %.3g%% of their size\n",
+      100.0*compressed_size/(ptr2->tt2_size*(double)ptr2->k1_offset[ppt2->k_size]));
+
+  free (block);
+  free (block_offset);
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Compute the position in bytes of each k1 level in the transfers files.
+ *
+ * The array k1_offset is allocated by this function with ppt2->k_size+1
+ * elements, the last being the size of the files. If is_compressed is _TRUE_,
+ * each level has room for the header of the compressed block; the compressed
+ * block is never larger than this, and the rest of the slot is left empty until
+ * transfer2_compact_transfers() removes it at the end of the run.
+ */
+
+int transfer2_k1_offsets (
+        struct perturbs2 * ppt2,
+        struct transfers2 * ptr2,
+        short is_compressed,
+        long int ** k1_offset
+        )
+{
+
+  class_alloc (*k1_offset, (ppt2->k_size+1)*sizeof(long int), ptr2->error_message);
+
+  (*k1_offset)[0] = 0;
+  for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1) {
+    long int n = 0;
+    for (int index_k2 = 0; index_k2 <= index_k1; ++index_k2)
+      n += ptr2->k_size_k1k2[index_k1][index_k2];
+    (*k1_offset)[index_k1+1] = (*k1_offset)[index_k1]
+      + ((is_compressed == _TRUE_) ? block_compress_bound (n) : n*sizeof(double));
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+
+/**
+ * Open the transfers files for writing, and find out which k1 levels were
+ * already stored in them by an interrupted run.
+ *
+ * Each transfers file contains the k1 levels in order, and each level has a
+ * fixed size; therefore, transfer2_store_transfers_to_disk() can write the
+ * levels in any order, at the offsets given by ptr2->k1_offset. This allows
+ * the different MPI processes to fill the same files at the same time.
+ *
+ * The status file (ptr2->transfers_status_path) is created empty by the input
+ * module together with the transfers directory. Its first line contains a key
+ * identifying the layout of the transfers files (k1 sampling, number of transfer
+ * types and k sizes); each subsequent line records that a k1 level was written
+ * to all the files, together with the checksum of the data written to each file.
+ * The last line, written by transfer2_init() when all the k1 levels are done,
+ * is "complete". When running with more than one MPI process, each process lists
+ * its k1 levels in its own file, transfers_status.txt.<mpi_rank>, and only the key
+ * and the "complete" line are written in the shared file.
+ *
+ * If the status file already lists some k1 levels, we are resuming an interrupted
+ * run: the listed levels are read back from the files and compared with the recorded
+ * checksums. The k1 levels that pass the test in all the files are flagged in
+ * ptr2->has_stored_transfers and will not be computed again by transfer2_init().
+ * If a level is listed more than once, only the last checksum counts.
+ */
+
+int transfer2_transfers_status_init (
+        struct precision2 * ppr2,
+        struct perturbs2 * ppt2,
+        struct transfers2 * ptr2
+        )
+{
+
+  /* Key identifying the layout of the transfers files */
+  unsigned long long key = _CHECKSUM_SEED_;
+
+  int sizes[] = {ppt2->k_size, ptr2->tt2_size};
+  perturb2_checksum (sizes, sizeof(sizes), &key);
+  perturb2_checksum (ppt2->k, ppt2->k_size*sizeof(double), &key);
+  for (int index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1)
+    perturb2_checksum (ptr2->k_size_k1k2[index_k1], (index_k1+1)*sizeof(int), &key);
+
+  /* Runs without compression keep the key of the older versions */
+  if (ptr2->transfers_compression != block_compression_none) {
+    perturb2_checksum (&ptr2->transfers_compression, sizeof(enum block_compression), &key);
+    perturb2_checksum (&ptr2->transfers_compression_tolerance, sizeof(double), &key);
+  }
+
+  /* Position of each k1 level in the transfers files */
+  class_call (transfer2_k1_offsets (ppt2, ptr2, ptr2->transfers_compression != block_compression_none,
+                &(ptr2->k1_offset)),
+    ptr2->error_message,
+    ptr2->error_message);
+
+  class_calloc (ptr2->has_stored_transfers, ppt2->k_size, sizeof(short), ptr2->error_message);
+
+  /* Read the checksums listed in the status file left by a previous run, if any */
+  FILE * status_file = fopen (ptr2->transfers_status_path, "r");
+
+  unsigned long long stored_key;
+  short has_key = (status_file != NULL) && (fscanf (status_file, "key %llx\n", &stored_key) == 1);
+
+  class_test ((has_key == _TRUE_) && (stored_key != key),
+    ptr2->error_message,
+    "the transfer functions in '%s' were computed with a different k sampling; remove the directory to start afresh",
+    ptr2->transfers_dir);
+
+  unsigned long long ** checksums;
+  class_calloc (checksums, ppt2->k_size, sizeof(unsigned long long *), ptr2->error_message);
+
+  unsigned long long * line_checksums;
+  class_alloc (line_checksums, ptr2->tt2_size*sizeof(unsigned long long), ptr2->error_message);
+
+  int index_k1;
+
+  /* The k1 levels are listed after the key, and in the files of the MPI processes of
+  previous runs, transfers_status.txt.0, transfers_status.txt.1, ... */
+  FILE * list_file = (has_key == _TRUE_) ? status_file : NULL;
+
+  for (int index_file = -1; list_file != NULL; ++index_file) {
+
+    while (fscanf (list_file, " k1 %d", &index_k1) == 1) {
+
+      int index_tt = 0;
+      while ((index_tt < ptr2->tt2_size) && (fscanf (list_file, " %llx", &line_checksums[index_tt]) == 1))
+        index_tt++;
+
+      /* A truncated line can only be the last one */
+      if (index_tt < ptr2->tt2_size)
+        break;
+
+      if ((index_k1 < 0) || (index_k1 >= ppt2->k_size))
+        continue;
+
+      if (checksums[index_k1] == NULL)
+        class_alloc (checksums[index_k1], ptr2->tt2_size*sizeof(unsigned long long), ptr2->error_message);
+
+      for (index_tt = 0; index_tt < ptr2->tt2_size; ++index_tt)
+        checksums[index_k1][index_tt] = line_checksums[index_tt];
+    }
+
+    if (list_file != status_file)
+      fclose (list_file);
+
+    char list_path[_FILENAMESIZE_+16];
+    sprintf (list_path, "%s.%d", ptr2->transfers_status_path, index_file+1);
+    list_file = fopen (list_path, "r");
+  }
+
+  if (status_file != NULL)
+    fclose (status_file);
+
+  /* Check the listed k1 levels; each MPI process checks only its own levels */
+  long int max_bytes = 0;
+  for (index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1)
+    max_bytes = MAX (max_bytes, ptr2->k1_offset[index_k1+1] - ptr2->k1_offset[index_k1]);
+
+  unsigned char * buffer;
+  class_alloc (buffer, max_bytes, ptr2->error_message);
+
+  int count = 0;
+
+  for (index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1) {
+
+    if ((checksums[index_k1] == NULL) || (ptr2->k1_rank[index_k1] != ppr2->mpi_rank))
+      continue;
+
+    long int n_bytes = ptr2->k1_offset[index_k1+1] - ptr2->k1_offset[index_k1];
+
+    short is_valid = _TRUE_;
+
+    for (int index_tt = 0; (index_tt < ptr2->tt2_size) && (is_valid == _TRUE_); ++index_tt) {
+
+      FILE * input_stream = fopen (ptr2->transfers_paths[index_tt], "rb");
+
+      unsigned long long checksum = _CHECKSUM_SEED_;
+
+      /* A compressed level fills only the start of its slot */
+      long int block_size = n_bytes;
+
+      is_valid = (input_stream != NULL)
+        && (fseek (input_stream, ptr2->k1_offset[index_k1], SEEK_SET) == 0);
+
+      if ((is_valid == _TRUE_) && (ptr2->transfers_compression != block_compression_none))
+        is_valid = (block_read (input_stream, buffer, n_bytes, &block_size, ptr2->error_message) == _SUCCESS_);
+      else if (is_valid == _TRUE_)
+        is_valid = (fread (buffer, 1, n_bytes, input_stream) == (size_t)n_bytes);
+
+      if (is_valid == _TRUE_) {
+        perturb2_checksum (buffer, block_size, &checksum);
+        is_valid = (checksum == checksums[index_k1][index_tt]);
+      }
+
+      if (input_stream != NULL)
+        fclose (input_stream);
+    }
+
+    ptr2->has_stored_transfers[index_k1] = is_valid;
+    count += is_valid;
+  }
+
+  if ((has_key == _TRUE_) && (ptr2->transfer2_verbose > 0))
+    printf (" -> resuming interrupted run: %d k1 levels of the transfer functions are already on disk\n",
+      count);
+
+  for (index_k1 = 0; index_k1 < ppt2->k_size; ++index_k1)
+    free (checksums[index_k1]);
+  free (checksums);
+  free (line_checksums);
+  free (buffer);
+
+  /* A new status file starts with the key. The first MPI process also creates the
+  transfers files, if they do not exist yet, so that all processes can open them for
+  update. */
+  if (ppr2->mpi_rank == 0) {
+
+    if (has_key == _FALSE_) {
+      class_open (status_file, ptr2->transfers_status_path, "w", ptr2->error_message);
+      fprintf (status_file, "key %llx\n", key);
+      fclose (status_file);
+    }
+
+    for (int index_tt = 0; index_tt < ptr2->tt2_size; ++index_tt) {
+      class_open (ptr2->transfers_files[index_tt], ptr2->transfers_paths[index_tt],
+        (has_key == _TRUE_) ? "ab" : "wb", ptr2->error_message);
+      fclose (ptr2->transfers_files[index_tt]);
+    }
+  }
+
+  /* Appending to a shared file from several nodes is not atomic on network file systems;
+  with more than one MPI process, each process lists its k1 levels in its own file */
+  if (ppr2->mpi_size > 1) {
+    sprintf (ptr2->transfers_status_rank_path, "%s.%d", ptr2->transfers_status_path, ppr2->mpi_rank);
+    class_open (status_file, ptr2->transfers_status_rank_path, "a", ptr2->error_message);
+    fclose (status_file);
+  }
+  else {
+    strcpy (ptr2->transfers_status_rank_path, ptr2->transfers_status_path);
+  }
+
+  #ifdef _MPI
+  if (ppr2->mpi_size > 1)
+    MPI_Barrier (MPI_COMM_WORLD);
+  #endif
+
+  for (int index_tt = 0; index_tt < ptr2->tt2_size; ++index_tt)
+    class_open (ptr2->transfers_files[index_tt], ptr2->transfers_paths[index_tt], "r+b", ptr2->error_message);
+
+  return _SUCCESS_;
+
+}
   
   
   
@@ -2972,8 +4510,13 @@ int transfer2_store_transfers_to_disk(
  * This function relies on values that are computed by transfer2_indices_of_perturbs()
  * and transfer2_get_k3_sizes(), so make sure to call them beforehand.
  *
+ * On nodes with several NUMA domains (ppr2->numa_domains > 1), the k1 level is first
+ * touched by the threads of the domain that owns index_k1, which are the ones that
+ * integrate it over k3 in bispectra2_intrinsic_integrate_over_k3_for_l3(); see
+ * numa_k1_domain().
  */
 int transfer2_allocate_k1_level(
+     struct precision2 * ppr2,
      struct perturbs2 * ppt2,
      struct transfers2 * ptr2,
      int index_k1
@@ -2986,11 +4529,32 @@ int transfer2_allocate_k1_level(
     "the index_k1=%d level of ptr2->transfers is already allocated, stop to prevent error",
     index_k1);
 
+  /* Allocate all the values of the k1 level in a single block */
   long int count=0;
+  for(int index_k2=0; index_k2<=index_k1; ++index_k2)
+    count += ptr2->tt2_size * ptr2->k_size_k1k2[index_k1][index_k2];
 
-  for(int index_tt=0; index_tt<ptr2->tt2_size; ++index_tt) {
+  struct arena * pa = &(ptr2->transfer_k1_arena[index_k1]);
 
-    int k1_size = ppt2->k_size;
+  class_call (arena_init (pa, count, ptr2->error_message),
+    ptr2->error_message,
+    ptr2->error_message);
+
+  /* Place the k1 level in the memory of the NUMA domain that will read it */
+  class_call (numa_first_touch (
+                pa->data,
+                pa->size,
+                1,
+                numa_k1_domain (index_k1, ppt2->k_size, ppr2->numa_domains),
+                ppr2->numa_domains,
+                ptr2->error_message),
+    ptr2->error_message,
+    ptr2->error_message);
+
+  #pragma omp atomic
+  ptr2->count_allocated_transfers += pa->size;
+
+  for(int index_tt=0; index_tt<ptr2->tt2_size; ++index_tt) {
 
     /* Allocate k2 level.  Note that, as for ppt2->sources, the size of this level is smaller
     than the k1 level, and it depends on k1. The reason is that we only need to compute
@@ -3003,19 +4567,17 @@ int transfer2_allocate_k1_level(
       k2_size * sizeof(double *),
       ptr2->error_message);
   
-    for(int index_k2=0; index_k2<=index_k1; ++index_k2) {      
-
-      /* Allocate k level */
-      class_alloc(
-        ptr2->transfer[index_tt][index_k1][index_k2],
-        ptr2->k_size_k1k2[index_k1][index_k2] * sizeof(double),
-        ptr2->error_message);
-
-      #pragma omp atomic
-      ptr2->count_allocated_transfers += ptr2->k_size_k1k2[index_k1][index_k2];
-      count += ptr2->k_size_k1k2[index_k1][index_k2];
+    /* Point the k level inside the arena */
+    class_call (arena_take_row (
+                  pa,
+                  k2_size,
+                  ptr2->k_size_k1k2[index_k1],
+                  1,
+                  ptr2->transfer[index_tt][index_k1],
+                  ptr2->error_message),
+      ptr2->error_message,
+      ptr2->error_message);
 
-    } // end of for(index_k2)
   } // end of for(index_tt)
   
   /* Print some debug information on memory consumption */
@@ -3044,17 +4606,14 @@ int transfer2_free_type_level(
 
   int k1_size = ppt2->k_size;
   
-  for (int index_k1=0; index_k1<k1_size; ++index_k1) {
-
-    for (int index_k2=0; index_k2<=index_k1; ++index_k2)
-      free(ptr2->transfer[index_tt][index_k1][index_k2]);
-
+  for (int index_k1=0; index_k1<k1_size; ++index_k1)
     free(ptr2->transfer[index_tt][index_k1]);
   
-  }
-  
   free(ptr2->transfer[index_tt]);
 
+  /* Free the values of the transfer functions, that are stored contiguously */
+  arena_free (&(ptr2->transfer_type_arena[index_tt]));
+
   return _SUCCESS_;
 
 }
@@ -3069,27 +4628,23 @@ int transfer2_free_type_level(
 int transfer2_free_k1_level(
      struct perturbs2 * ppt2,
      struct transfers2 * ptr2,
-     int index_k1
+     int index_k1,
+     ErrorMsg error_message
      )
 {
 
   /* Issue an error if ptr2->transfers[index_k1] has already been freed */
   class_test (ptr2->has_allocated_transfers[index_k1] == _FALSE_,
-    ptr2->error_message,
+    error_message,
     "the index_k1=%d level of ptr2->transfers is already free, stop to prevent error", index_k1);
 
-  int k1_size = ppt2->k_size;
-
-  long int count = 0;
-
-  for (int index_tt = 0; index_tt < ptr2->tt2_size; index_tt++) {
-    for(int index_k2=0; index_k2<=index_k1; ++index_k2) {
-      free(ptr2->transfer[index_tt][index_k1][index_k2]);
-      count += ptr2->k_size_k1k2[index_k1][index_k2];
-    }
+  long int count = ptr2->transfer_k1_arena[index_k1].size;
 
+  for (int index_tt = 0; index_tt < ptr2->tt2_size; index_tt++)
     free(ptr2->transfer[index_tt][index_k1]);
-  }
+
+  /* Free the values of the transfer functions, that are stored contiguously */
+  arena_free (&(ptr2->transfer_k1_arena[index_k1]));
 
   /* Print some debug information on memory consumption */
   if (ptr2->transfer2_verbose > 2)
@@ -230,7 +230,7 @@ int main(int argc, char **argv) {
   /* Load sources from disk if they were previously stored.  This can be true either because we are loading
   them from a precomputed run, or because we stored them in this run. */
   if ( (pr2.load_sources_from_disk == _TRUE_) || (pr2.store_sources_to_disk == _TRUE_) ) {
-    if (perturb2_load_sources_from_disk(&pt2, index_k1) == _FAILURE_) {
+    if (perturb2_load_sources_from_disk(&pt2, index_k1, pt2.error_message) == _FAILURE_) {
       printf("\n\nError in perturb2_load_sources_from_disk \n=>%s\n", pt2.error_message);
       return _FAILURE_;
     }       
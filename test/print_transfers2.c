@@ -333,7 +333,7 @@ int main (int argc, char **argv) {
   /* Load the transfer functions if we stored them to disk previously, either during a separate
   run or during this run. */
   if ( (pr2.load_transfers_from_disk == _TRUE_) || (pr2.store_transfers_to_disk == _TRUE_) ) {
-    if (transfer2_load_transfers_from_disk(&pt2, &tr2, index_tt) == _FAILURE_) {
+    if (transfer2_load_transfers_from_disk(&pr2,&pt2, &tr2, index_tt) == _FAILURE_) {
       printf("\n\nError in transfer2_load_transfers_from_disk \n=>%s\n", tr2.error_message);
       return _FAILURE_;
     }
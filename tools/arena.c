@@ -0,0 +1,132 @@
+/** @file arena.c
+ *
+ * Contiguous storage for the jagged arrays of SONG; see the documentation
+ * of struct arena in arena.h.
+ *
+ * A typical usage is:
+ *
+ *   long int size = 0;
+ *   for (int index_k2=0; index_k2 <= index_k1; ++index_k2)
+ *     size += k3_size[index_k1][index_k2];
+ *
+ *   class_call (arena_init (&arena, size, errmsg), errmsg, errmsg);
+ *   class_call (arena_take_row (&arena, index_k1+1, k3_size[index_k1], 1, array[index_k1], errmsg),
+ *     errmsg, errmsg);
+ *   ...
+ *   arena_free (&arena);
+ */
+
+#include "arena.h"
+
+
+/**
+ * Allocate a block of memory for 'size' doubles, initialised to zero.
+ *
+ * The block is allocated with calloc, so that the pages that are never
+ * written to do not use physical memory.
+ */
+
+int arena_init(
+    struct arena * pa,
+    long int size,
+    ErrorMsg error_message
+    )
+{
+
+  class_test (size < 0,
+    error_message,
+    "cannot allocate an arena with negative size %ld", size);
+
+  pa->size = size;
+  pa->used = 0;
+  pa->data = NULL;
+
+  if (size > 0)
+    class_calloc (pa->data, size, sizeof(double), error_message);
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Assign the next 'n' doubles of the arena to a row of the jagged array.
+ *
+ * The rows are assigned in the order of the calls, hence the arena should be
+ * filled in the same order used to compute its size. If the arena is shared
+ * between threads, this function should be called only by one of them.
+ */
+
+int arena_take(
+    struct arena * pa,
+    long int n,
+    double ** row,
+    ErrorMsg error_message
+    )
+{
+
+  class_test (pa->used + n > pa->size,
+    error_message,
+    "arena overflow: requested %ld doubles, but only %ld of %ld are left",
+    n, pa->size - pa->used, pa->size);
+
+  *row = pa->data + pa->used;
+  pa->used += n;
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Assign consecutive chunks of the arena to the 'n_rows' rows of a level of the
+ * jagged array, so that rows[i] has row_size[i]*stride doubles.
+ *
+ * If row_size is NULL, all the rows have 'stride' doubles; this is the case, for
+ * example, of the k3 level of an array sampled on the same k3 grid for all (k1,k2).
+ */
+
+int arena_take_row(
+    struct arena * pa,
+    int n_rows,
+    int * row_size,
+    long int stride,
+    double ** rows,
+    ErrorMsg error_message
+    )
+{
+
+  for (int i=0; i < n_rows; ++i) {
+
+    long int n = (row_size == NULL ? stride : row_size[i]*stride);
+
+    class_call (arena_take (pa, n, &rows[i], error_message),
+      error_message,
+      error_message);
+
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Free the memory block of the arena. The jagged array pointing inside the
+ * arena cannot be used after this call.
+ */
+
+int arena_free(
+    struct arena * pa
+    )
+{
+
+  free (pa->data);
+
+  pa->data = NULL;
+  pa->size = 0;
+  pa->used = 0;
+
+  return _SUCCESS_;
+
+}
@@ -0,0 +1,310 @@
+/** @file block_compress.c
+ *
+ * Compression of the arrays that SONG stores to disk; see the documentation
+ * of struct block_header in block_compress.h.
+ *
+ * A block is compressed and written to a stream with:
+ *
+ *   unsigned char * block;
+ *   class_alloc (block, block_compress_bound (n), errmsg);
+ *   long int block_size;
+ *   class_call (block_compress (data, n, block_compression_lossy, 1e-6, block, &block_size, errmsg),
+ *     errmsg, errmsg);
+ *   fwrite (block, 1, block_size, stream);
+ *
+ * and read back with:
+ *
+ *   class_call (block_read (stream, block, block_compress_bound (n), &block_size, errmsg),
+ *     errmsg, errmsg);
+ *   class_call (block_decompress (block, block_size, data, n, errmsg),
+ *     errmsg, errmsg);
+ *
+ * The functions in this file do not share any state, and can be called by
+ * different threads on different blocks at the same time.
+ */
+
+#include "block_compress.h"
+
+
+/**
+ * Largest size in bytes of the compressed block for n doubles, including
+ * its header. Since block_compress() falls back to the raw doubles when
+ * compressing would not save space, a block is never larger than this.
+ */
+
+long int block_compress_bound(
+    long int n
+    )
+{
+
+  return sizeof(struct block_header) + n*sizeof(double);
+
+}
+
+
+/**
+ * Compress the n doubles in data into a block, made of a header and a payload.
+ *
+ * With block_compression_lossless, the doubles are stored exactly. With
+ * block_compression_lossy, the absolute error on each double is at most
+ * tolerance times the largest absolute value in the block. The block is
+ * written to the output array 'block', which should have room for at least
+ * block_compress_bound(n) bytes, and its size in bytes is returned in block_size.
+ */
+
+int block_compress(
+    double * data,                     /**< input, doubles to be compressed */
+    long int n,                        /**< input, number of doubles in data */
+    enum block_compression compression, /**< input, requested compression */
+    double tolerance,                  /**< input, relative error for block_compression_lossy */
+    unsigned char * block,             /**< output, compressed block */
+    long int * block_size,             /**< output, size of the compressed block in bytes */
+    ErrorMsg error_message
+    )
+{
+
+  /* Clear the padding of the header, so that the same data always gives the same file */
+  struct block_header header;
+  memset (&header, 0, sizeof(struct block_header));
+  header.magic = _BLOCK_MAGIC_;
+  header.n = n;
+  header.step = 0;
+
+  unsigned char * payload = block + sizeof(struct block_header);
+  long int capacity = n*sizeof(double);
+  long int size = 0;
+
+  /* Largest absolute value in the block; NaN and infinite values are stored as they are */
+  double max = 0;
+  short is_finite = _TRUE_;
+
+  for (long int i=0; i < n; ++i) {
+    if (!isfinite (data[i]))
+      is_finite = _FALSE_;
+    else if (fabs (data[i]) > max)
+      max = fabs (data[i]);
+  }
+
+  /* Choose the codec. The multiples of the quantisation step must be exact in double
+  precision, hence the lossy codec requires tolerance>2^-53. */
+  if ((compression == block_compression_none) || (is_finite == _FALSE_))
+    header.codec = block_codec_raw;
+  else if (max == 0)
+    header.codec = block_codec_zero;
+  else if ((compression == block_compression_lossy) && (tolerance > pow (2, -53)))
+    header.codec = block_codec_quantised;
+  else
+    header.codec = block_codec_predicted;
+
+  if (header.codec == block_codec_quantised)
+    header.step = 2*tolerance*max;
+
+  /* Encode the doubles as varints, and give up if the payload becomes as large as the
+  raw doubles */
+  if ((header.codec == block_codec_predicted) || (header.codec == block_codec_quantised)) {
+
+    /* Previous two values of the ordered integers, for the predicted codec */
+    unsigned long long previous_1 = 0, previous_2 = 0;
+    long long int previous_multiple = 0;
+
+    for (long int i=0; (i < n) && (header.codec != block_codec_raw); ++i) {
+
+      unsigned long long word;
+
+      /* The unsigned arithmetic wraps around, so that the residual is exact */
+      if (header.codec == block_codec_predicted) {
+        unsigned long long bits;
+        memcpy (&bits, &data[i], sizeof(double));
+        unsigned long long ordered = bits ^ ((bits >> 63) ? ~0ULL : (1ULL << 63));
+        unsigned long long residual = ordered - (2*previous_1 - previous_2);
+        word = (residual << 1) ^ (0 - (residual >> 63));
+        previous_2 = previous_1;
+        previous_1 = ordered;
+      }
+      else {
+        long long int multiple = llround (data[i]/header.step);
+        unsigned long long delta = (unsigned long long)multiple - (unsigned long long)previous_multiple;
+        word = (delta << 1) ^ (0 - (delta >> 63));
+        previous_multiple = multiple;
+      }
+
+      do {
+        if (size == capacity) {
+          header.codec = block_codec_raw;
+          break;
+        }
+        unsigned char byte = word & 0x7f;
+        word >>= 7;
+        payload[size++] = byte | ((word != 0) ? 0x80 : 0);
+      } while (word != 0);
+    }
+  }
+
+  if (header.codec == block_codec_raw) {
+    header.step = 0;
+    size = capacity;
+    if (n > 0)
+      memcpy (payload, data, capacity);
+  }
+
+  header.payload_size = size;
+  memcpy (block, &header, sizeof(struct block_header));
+
+  *block_size = sizeof(struct block_header) + size;
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Decompress a block produced by block_compress() into the n doubles of data.
+ */
+
+int block_decompress(
+    unsigned char * block,  /**< input, compressed block */
+    long int block_size,    /**< input, size of the compressed block in bytes */
+    double * data,          /**< output, decompressed doubles; should have room for n doubles */
+    long int n,             /**< input, expected number of doubles in the block */
+    ErrorMsg error_message
+    )
+{
+
+  struct block_header header;
+
+  class_test (block_size < (long int)sizeof(struct block_header),
+    error_message,
+    "the compressed block is truncated (%ld bytes)", block_size);
+
+  memcpy (&header, block, sizeof(struct block_header));
+
+  class_test (header.magic != _BLOCK_MAGIC_,
+    error_message,
+    "the data is not a compressed block");
+
+  class_test (header.n != n,
+    error_message,
+    "the compressed block has %ld values, but %ld were expected", header.n, n);
+
+  class_test (sizeof(struct block_header) + header.payload_size > block_size,
+    error_message,
+    "the compressed block is truncated (%ld bytes, expected %ld)",
+    block_size, (long int)(sizeof(struct block_header) + header.payload_size));
+
+  unsigned char * payload = block + sizeof(struct block_header);
+  long int position = 0;
+
+  switch (header.codec) {
+
+    case block_codec_raw:
+
+      class_test (header.payload_size != n*(long int)sizeof(double),
+        error_message,
+        "the raw block has %ld bytes, but %ld were expected",
+        header.payload_size, n*(long int)sizeof(double));
+
+      if (n > 0)
+        memcpy (data, payload, n*sizeof(double));
+      break;
+
+    case block_codec_zero:
+
+      for (long int i=0; i < n; ++i)
+        data[i] = 0;
+      break;
+
+    case block_codec_predicted:
+    case block_codec_quantised: {
+
+      unsigned long long previous_1 = 0, previous_2 = 0;
+      long long int previous_multiple = 0;
+
+      for (long int i=0; i < n; ++i) {
+
+        unsigned long long word = 0;
+        int shift = 0;
+        unsigned char byte;
+
+        do {
+          class_test ((position >= header.payload_size) || (shift > 63),
+            error_message,
+            "the compressed block is corrupted at value %ld of %ld", i, n);
+          byte = payload[position++];
+          word |= (unsigned long long)(byte & 0x7f) << shift;
+          shift += 7;
+        } while (byte & 0x80);
+
+        unsigned long long residual = (word >> 1) ^ (0 - (word & 1));
+
+        if (header.codec == block_codec_predicted) {
+          unsigned long long ordered = residual + (2*previous_1 - previous_2);
+          unsigned long long bits = ordered ^ ((ordered >> 63) ? (1ULL << 63) : ~0ULL);
+          memcpy (&data[i], &bits, sizeof(double));
+          previous_2 = previous_1;
+          previous_1 = ordered;
+        }
+        else {
+          previous_multiple = (long long int)((unsigned long long)previous_multiple + residual);
+          data[i] = previous_multiple*header.step;
+        }
+      }
+      break;
+    }
+
+    default:
+      class_stop (error_message,
+        "the compressed block has an unknown codec %d", header.codec);
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Read from a stream the next compressed block, made of its header and payload.
+ *
+ * The block is written to the output array 'block', which has room for
+ * 'capacity' bytes, and its size in bytes is returned in block_size. The
+ * stream is left just after the block.
+ */
+
+int block_read(
+    FILE * stream,          /**< input, stream positioned at the start of a block */
+    unsigned char * block,  /**< output, compressed block */
+    long int capacity,      /**< input, size of the 'block' array in bytes */
+    long int * block_size,  /**< output, size of the compressed block in bytes */
+    ErrorMsg error_message
+    )
+{
+
+  struct block_header header;
+
+  class_test (capacity < (long int)sizeof(struct block_header),
+    error_message,
+    "no room for the header of the compressed block");
+
+  class_test (fread (&header, sizeof(struct block_header), 1, stream) != 1,
+    error_message,
+    "could not read the header of the compressed block");
+
+  class_test (header.magic != _BLOCK_MAGIC_,
+    error_message,
+    "the file does not contain a compressed block at this position");
+
+  *block_size = sizeof(struct block_header) + header.payload_size;
+
+  class_test ((header.payload_size < 0) || (*block_size > capacity),
+    error_message,
+    "the compressed block has %ld bytes, but at most %ld were expected", *block_size, capacity);
+
+  memcpy (block, &header, sizeof(struct block_header));
+
+  class_test (fread (block + sizeof(struct block_header), 1, header.payload_size, stream)
+    != (size_t)header.payload_size,
+    error_message,
+    "the compressed block is truncated");
+
+  return _SUCCESS_;
+
+}
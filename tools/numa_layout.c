@@ -0,0 +1,172 @@
+/** @file numa_layout.c
+ *
+ * Placement of the large arrays of SONG on nodes with several NUMA domains;
+ * see the documentation in numa_layout.h.
+ *
+ * A typical usage is to first-touch the k1 level of an array by the domain
+ * that will read it:
+ *
+ *   int domain = numa_k1_domain (index_k1, k_size, ppr2->numa_domains);
+ *   class_call (numa_first_touch (arena.data, arena.size, 1, domain, ppr2->numa_domains,
+ *     errmsg), errmsg, errmsg);
+ *
+ * and then to let the threads of each domain process the k1 levels it owns:
+ *
+ *   int domain = numa_thread_domain (thread, number_of_threads, ppr2->numa_domains);
+ *   if (numa_k1_domain (index_k1, k_size, ppr2->numa_domains) == domain)
+ *     ...
+ */
+
+#include "numa_layout.h"
+
+
+/**
+ * Return the NUMA domain of a thread, when number_of_threads threads are split
+ * in domain_size domains.
+ */
+
+int numa_thread_domain(
+    int thread,
+    int number_of_threads,
+    int domain_size
+    )
+{
+
+  if ((domain_size <= 1) || (number_of_threads <= 1))
+    return 0;
+
+  return MIN (domain_size-1, (int)(((long int)thread*domain_size)/number_of_threads));
+
+}
+
+
+/**
+ * Find the threads that belong to a NUMA domain; they are the thread_size threads
+ * starting from first_thread. The function is the inverse of numa_thread_domain().
+ */
+
+int numa_domain_threads(
+    int domain,
+    int number_of_threads,
+    int domain_size,
+    int * first_thread,   /**< output: first thread of the domain */
+    int * thread_size     /**< output: number of threads in the domain */
+    )
+{
+
+  *first_thread = 0;
+  *thread_size = 0;
+
+  for (int thread=0; thread < number_of_threads; ++thread) {
+    if (numa_thread_domain (thread, number_of_threads, domain_size) == domain) {
+      if (*thread_size == 0)
+        *first_thread = thread;
+      (*thread_size)++;
+    }
+  }
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Return the NUMA domain that owns a k1 level.
+ *
+ * The k1 levels are split in domain_size contiguous blocks. Since the arrays of
+ * SONG are triangular in (k1,k2), the work and the memory associated to index_k1
+ * are proportional to index_k1+1; the blocks are chosen so that each domain has
+ * roughly the same number of (k1,k2) pairs.
+ */
+
+int numa_k1_domain(
+    int index_k1,
+    int k_size,
+    int domain_size
+    )
+{
+
+  if ((domain_size <= 1) || (k_size <= 1))
+    return 0;
+
+  /* Number of (k1,k2) pairs before the middle of the index_k1 level */
+  double pairs_before = 0.5*index_k1*(index_k1+1) + 0.5*(index_k1+1);
+  double pairs_total = 0.5*k_size*(k_size+1);
+
+  return MIN (domain_size-1, (int)(domain_size*pairs_before/pairs_total));
+
+}
+
+
+/**
+ * Write zeros in an array of n_rows*row_size doubles from the threads that will
+ * later read it, so that its pages are placed in their NUMA domains.
+ *
+ * If domain is negative, the rows are distributed between all threads with the
+ * same static schedule of a '#pragma omp for schedule(static)' loop over the
+ * rows; a parallel loop over the same number of rows with a static schedule will
+ * then find its rows in the local memory of each thread. Otherwise, the rows are
+ * split in contiguous blocks between the threads of the given domain only.
+ *
+ * The function does nothing if SONG was compiled without OpenMP, if there is only
+ * one domain, or if it is called from inside a parallel region; in the latter case
+ * the pages are placed by the writing thread as usual.
+ */
+
+int numa_first_touch(
+    double * data,
+    long int n_rows,
+    long int row_size,
+    int domain,
+    int domain_size,
+    ErrorMsg error_message
+    )
+{
+
+  class_test (domain >= domain_size,
+    error_message,
+    "domain=%d does not exist, there are only %d NUMA domains", domain, domain_size);
+
+  if ((data == NULL) || (n_rows <= 0) || (domain_size <= 1))
+    return _SUCCESS_;
+
+#ifdef _OPENMP
+
+  if (omp_in_parallel())
+    return _SUCCESS_;
+
+  /* All threads, with the same schedule of the consumer loop */
+  if (domain < 0) {
+
+    #pragma omp parallel for schedule (static)
+    for (long int index_row=0; index_row < n_rows; ++index_row)
+      memset (data + index_row*row_size, 0, row_size*sizeof(double));
+
+    return _SUCCESS_;
+  }
+
+  /* Only the threads of the requested domain */
+  #pragma omp parallel
+  {
+    int thread = omp_get_thread_num();
+    int number_of_threads = omp_get_num_threads();
+
+    if (numa_thread_domain (thread, number_of_threads, domain_size) == domain) {
+
+      int first_thread, thread_size;
+      numa_domain_threads (domain, number_of_threads, domain_size, &first_thread, &thread_size);
+
+      int rank = thread - first_thread;
+      long int row_start = (n_rows*rank)/thread_size;
+      long int row_end = (n_rows*(rank+1))/thread_size;
+
+      if (row_end > row_start)
+        memset (data + row_start*row_size, 0, (row_end-row_start)*row_size*sizeof(double));
+    }
+  }
+
+#endif // _OPENMP
+
+  return _SUCCESS_;
+
+}
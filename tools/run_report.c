@@ -0,0 +1,305 @@
+/** @file run_report.c
+ *
+ * Timing and memory report of a SONG run; see the documentation of struct
+ * run_report in run_report.h.
+ *
+ * A stage is timed by the main program with:
+ *
+ *   class_call (run_report_stage_start (&report, "perturb2_init", errmsg), errmsg, errmsg);
+ *   perturb2_init (...);
+ *   class_call (run_report_stage_end (&report, errmsg), errmsg, errmsg);
+ *
+ * A parallel region is timed by a module with:
+ *
+ *   int index_region;
+ *   class_call (run_report_region (&report, "perturb2_solve", "modes", number_of_threads,
+ *     &index_region, errmsg), errmsg, errmsg);
+ *   double region_start = run_report_time();
+ *
+ *   #pragma omp parallel for
+ *   for (...) {
+ *     double busy_start = run_report_time();
+ *     ...
+ *     report.regions[index_region].busy_time[thread] += run_report_time() - busy_start;
+ *     report.regions[index_region].work[thread] += number_of_modes_solved;
+ *   }
+ *
+ *   report.regions[index_region].wall_time += run_report_time() - region_start;
+ */
+
+#include "run_report.h"
+#include <time.h>
+#include <sys/resource.h>
+
+
+/**
+ * Wall time in seconds, measured from an arbitrary origin.
+ */
+
+double run_report_time()
+{
+
+  #ifdef _OPENMP
+  return omp_get_wtime();
+  #else
+  return (double)time(NULL);
+  #endif
+
+}
+
+
+/**
+ * CPU time used by the process in seconds, summed over all threads, and peak
+ * resident memory of the process in kB.
+ */
+
+int run_report_usage(
+    double * cpu_time,
+    long int * peak_memory
+    )
+{
+
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+
+  *cpu_time = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec/1e6
+            + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec/1e6;
+
+  *peak_memory = usage.ru_maxrss;
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Initialise an empty report.
+ */
+
+int run_report_init(
+    struct run_report * prr
+    )
+{
+
+  prr->stage_size = 0;
+  prr->region_size = 0;
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Start timing a new stage; the stage ends with the next call to run_report_stage_end().
+ */
+
+int run_report_stage_start(
+    struct run_report * prr,
+    char * name,
+    ErrorMsg error_message
+    )
+{
+
+  class_test (prr->stage_size >= _MAX_NUM_REPORT_STAGES_,
+    error_message,
+    "cannot time more than %d stages, increase _MAX_NUM_REPORT_STAGES_", _MAX_NUM_REPORT_STAGES_);
+
+  struct run_report_stage * stage = &(prr->stages[prr->stage_size]);
+
+  strncpy (stage->name, name, _REPORT_NAME_LENGTH_-1);
+  stage->name[_REPORT_NAME_LENGTH_-1] = '\0';
+
+  prr->stage_start_wall_time = run_report_time();
+  run_report_usage (&(prr->stage_start_cpu_time), &(prr->stage_start_memory));
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Stop timing the current stage and add it to the report.
+ */
+
+int run_report_stage_end(
+    struct run_report * prr,
+    ErrorMsg error_message
+    )
+{
+
+  class_test (prr->stage_size >= _MAX_NUM_REPORT_STAGES_,
+    error_message,
+    "cannot time more than %d stages, increase _MAX_NUM_REPORT_STAGES_", _MAX_NUM_REPORT_STAGES_);
+
+  struct run_report_stage * stage = &(prr->stages[prr->stage_size]);
+
+  double cpu_time;
+  run_report_usage (&cpu_time, &(stage->peak_memory));
+
+  stage->wall_time = run_report_time() - prr->stage_start_wall_time;
+  stage->cpu_time = cpu_time - prr->stage_start_cpu_time;
+  stage->peak_memory_increase = stage->peak_memory - prr->stage_start_memory;
+
+  prr->stage_size++;
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Find the parallel region with the given name in the report, or add it if it
+ * is not there yet, and return its index in prr->regions.
+ *
+ * The caller is in charge of adding the wall time of the region, the busy
+ * time of each thread and, if work_unit is not empty, the work items processed
+ * by each thread to prr->regions[*index_region]; see the example at the top of
+ * this file. This function should be called outside the parallel region.
+ */
+
+int run_report_region(
+    struct run_report * prr,
+    char * name,
+    char * work_unit,
+    int thread_size,
+    int * index_region,
+    ErrorMsg error_message
+    )
+{
+
+  for (*index_region = 0; *index_region < prr->region_size; ++(*index_region))
+    if (strncmp (prr->regions[*index_region].name, name, _REPORT_NAME_LENGTH_-1) == 0)
+      break;
+
+  /* Add a new region */
+  if (*index_region == prr->region_size) {
+
+    class_test (prr->region_size >= _MAX_NUM_REPORT_REGIONS_,
+      error_message,
+      "cannot time more than %d regions, increase _MAX_NUM_REPORT_REGIONS_", _MAX_NUM_REPORT_REGIONS_);
+
+    struct run_report_region * region = &(prr->regions[*index_region]);
+
+    strncpy (region->name, name, _REPORT_NAME_LENGTH_-1);
+    region->name[_REPORT_NAME_LENGTH_-1] = '\0';
+    region->thread_size = 0;
+    region->calls = 0;
+    region->wall_time = 0;
+    region->busy_time = NULL;
+    region->work = NULL;
+    strncpy (region->work_unit, work_unit, _REPORT_NAME_LENGTH_-1);
+    region->work_unit[_REPORT_NAME_LENGTH_-1] = '\0';
+
+    prr->region_size++;
+  }
+
+  struct run_report_region * region = &(prr->regions[*index_region]);
+
+  /* Make room for all the threads */
+  if (thread_size > region->thread_size) {
+
+    class_realloc (region->busy_time, region->busy_time, thread_size*sizeof(double), error_message);
+    class_realloc (region->work, region->work, thread_size*sizeof(long int), error_message);
+
+    for (int thread = region->thread_size; thread < thread_size; ++thread) {
+      region->busy_time[thread] = 0;
+      region->work[thread] = 0;
+    }
+
+    region->thread_size = thread_size;
+  }
+
+  region->calls++;
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Write the stages and the parallel regions of the report to a stream, as
+ * the "stages" and "regions" members of a JSON object. The caller is in
+ * charge of the enclosing braces, so that other members can be added to
+ * the same object.
+ */
+
+int run_report_write(
+    struct run_report * prr,
+    FILE * stream
+    )
+{
+
+  fprintf (stream, "  \"stages\": [\n");
+
+  for (int index_stage = 0; index_stage < prr->stage_size; ++index_stage) {
+
+    struct run_report_stage * stage = &(prr->stages[index_stage]);
+
+    fprintf (stream,
+      "    {\"name\": \"%s\", \"wall_time\": %.6g, \"cpu_time\": %.6g, "
+      "\"peak_memory_kb\": %ld, \"peak_memory_increase_kb\": %ld}%s\n",
+      stage->name, stage->wall_time, stage->cpu_time,
+      stage->peak_memory, stage->peak_memory_increase,
+      (index_stage < prr->stage_size-1) ? "," : "");
+  }
+
+  fprintf (stream, "  ],\n");
+
+  fprintf (stream, "  \"regions\": [\n");
+
+  for (int index_region = 0; index_region < prr->region_size; ++index_region) {
+
+    struct run_report_region * region = &(prr->regions[index_region]);
+
+    fprintf (stream, "    {\"name\": \"%s\", \"calls\": %d, \"wall_time\": %.6g, \"busy_time\": [",
+      region->name, region->calls, region->wall_time);
+
+    for (int thread = 0; thread < region->thread_size; ++thread)
+      fprintf (stream, "%.6g%s", region->busy_time[thread], (thread < region->thread_size-1) ? ", " : "");
+
+    fprintf (stream, "], \"idle_time\": [");
+
+    for (int thread = 0; thread < region->thread_size; ++thread)
+      fprintf (stream, "%.6g%s", MAX (0, region->wall_time - region->busy_time[thread]),
+        (thread < region->thread_size-1) ? ", " : "");
+
+    fprintf (stream, "]");
+
+    /* Throughput of the region, in work items per second of wall time */
+    if (strlen (region->work_unit) > 0) {
+
+      long int work = 0;
+      for (int thread = 0; thread < region->thread_size; ++thread)
+        work += region->work[thread];
+
+      fprintf (stream, ", \"work\": %ld, \"work_unit\": \"%s\", \"throughput\": %.6g",
+        work, region->work_unit, (region->wall_time > 0) ? work/region->wall_time : 0);
+    }
+
+    fprintf (stream, "}%s\n", (index_region < prr->region_size-1) ? "," : "");
+  }
+
+  fprintf (stream, "  ]");
+
+  return _SUCCESS_;
+
+}
+
+
+/**
+ * Free the memory associated with the report.
+ */
+
+int run_report_free(
+    struct run_report * prr
+    )
+{
+
+  for (int index_region = 0; index_region < prr->region_size; ++index_region) {
+    free (prr->regions[index_region].busy_time);
+    free (prr->regions[index_region].work);
+  }
+
+  return _SUCCESS_;
+
+}